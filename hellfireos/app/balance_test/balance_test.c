@@ -0,0 +1,27 @@
+#include <hellfire.h>
+#include <noc.h>
+#include <balance.h>
+
+/* migratable worker, keeps no state between work items */
+void worker(void)
+{
+	volatile int32_t i;
+
+	for (;;){
+		for (i = 0; i < 100000; i++);
+		printf("\nworker %d on cpu %d, load %d%%", hf_selfid(), hf_cpuid(), hf_balance_load(hf_cpuid()));
+		hf_balance_point();
+	}
+}
+
+void app_main(void)
+{
+	int32_t i;
+
+	hf_balance_register("worker", worker, 1024);
+	hf_balance_init(100);
+
+	if (hf_cpuid() == 0)
+		for (i = 0; i < 6; i++)
+			hf_balance_spawn("worker");
+}
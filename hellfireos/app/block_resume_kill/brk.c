@@ -19,17 +19,17 @@ void task2(void){
 		jobs = hf_jobs(hf_selfid());
 		hf_block(2);
 		while (jobs == hf_jobs(hf_selfid()));
-		delay_ms(100);
+		hf_msleep(100);
 		printf("\nunblocking task 2");
 		jobs = hf_jobs(hf_selfid());
 		hf_resume(2);
 		while (jobs == hf_jobs(hf_selfid()));
-		delay_ms(100);
+		hf_msleep(100);
 		printf("\nkilling task 2");
 		jobs = hf_jobs(hf_selfid());
 		hf_kill(2);
 		while (jobs == hf_jobs(hf_selfid()));
-		delay_ms(100);
+		hf_msleep(100);
 		printf("\nspawning task 2");
 		jobs = hf_jobs(hf_selfid());
 		hf_spawn(task, 8, 2, 8, "task b", 2048);
@@ -15,10 +15,10 @@ void task(void){
 
 void task2(void){
 	for (;;){
-		delay_ms(50);
+		hf_msleep(50);
 		printf("\nsignalling task... just one task");
 		hf_condsignal(&cond);
-		delay_ms(50);
+		hf_msleep(50);
 		printf("\nsignalling task... everybody");
 		hf_condbroadcast(&cond);
 	}
@@ -113,8 +113,17 @@ void portable_init(core_portable *p, int *argc, char *argv[])
 /* Function : portable_fini
 	Target specific final code 
 */
+core_report last_run;
+
 void portable_fini(core_portable *p)
 {
+	/* p is the port of the results of the first context */
+	core_results *res=(core_results *)((ee_u8 *)p-(ee_ptr_int)&(((core_results *)0)->port));
+
+	last_run.ticks=get_time();
+	last_run.iterations=res->iterations;
+	last_run.crc=res->crc;
+	last_run.err=res->err;
 	p->portable_id=0;
 }
 
@@ -170,6 +170,19 @@ typedef struct CORE_PORTABLE_S {
 	ee_u8	portable_id;
 } core_portable;
 
+/* Variable : last_run
+	Figures of the last run, kept by <portable_fini> for ports that report them
+	somewhere else than the console (e.g. app/coremark_noc, to aggregate the cores).
+*/
+typedef struct CORE_REPORT_S {
+	CORE_TICKS	ticks;
+	ee_u32	iterations;
+	ee_u16	crc;
+	ee_u16	err;
+} core_report;
+
+extern core_report last_run;
+
 /* target specific init/fini */
 void portable_init(core_portable *p, int *argc, char *argv[]);
 void portable_fini(core_portable *p);
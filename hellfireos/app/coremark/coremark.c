@@ -5,7 +5,7 @@ void task(void){
 	
 	for (i = 0; i < 10; i++){
 		printf("\ntask %d, task cpu load %d%% (%d%% idle)", hf_selfid(), hf_cpuload(hf_selfid()), hf_cpuload(0));
-		delay_ms(50);
+		hf_msleep(50);
 	}
 	
 	while(1){
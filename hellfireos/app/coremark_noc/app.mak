@@ -0,0 +1,13 @@
+APP_DIR = $(SRC_DIR)/$(APP)
+COREMARK_DIR = $(SRC_DIR)/app/coremark
+COREMARK_FLAGS = -Dee_printf=printf -DPERFORMANCE_RUN=1 -DITERATIONS=600 -DMAIN_HAS_NOARGC=1
+
+app: kernel
+	$(CC) $(CFLAGS) $(COREMARK_FLAGS) \
+		$(COREMARK_DIR)/core_list_join.c \
+		$(COREMARK_DIR)/core_main.c -DFLAGS_STR=\"'${CFLAGS}'\" \
+		$(COREMARK_DIR)/core_matrix.c \
+		$(COREMARK_DIR)/core_state.c \
+		$(COREMARK_DIR)/core_util.c \
+		$(COREMARK_DIR)/core_portme.c \
+		$(APP_DIR)/coremark_noc.c
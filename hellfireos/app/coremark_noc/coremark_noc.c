@@ -0,0 +1,198 @@
+/*
+ * CoreMark on all cores of the NoC at once.
+ *
+ * every core runs the CoreMark of app/coremark (one context per core). the other cores tell
+ * core 0 they are ready, core 0 multicasts the start, so all instances run at the same time,
+ * and each core sends its figures back when done. core 0 prints them per core (ticks are
+ * cycles of each processor) and the aggregate: the sum of the iterations per second and of
+ * the CoreMark/MHz of the cores, and the spread between the slowest and the fastest core.
+ *
+ * NOC_LOAD 1 adds a task on each core that sends a message of LOAD_SIZE bytes to the next
+ * core every LOAD_PERIOD ms and takes the ones sent to it, so the figures show what the
+ * interrupts and the NoC traffic cost under load. with NOC_LOAD 0 the only noise is the OS
+ * (the tick and the idle reports).
+ */
+#include <hellfire.h>
+#include <noc.h>
+#include "../coremark/coremark.h"
+
+#ifndef NOC_LOAD
+#define NOC_LOAD	0
+#endif
+
+#define BENCH_PORT	5000
+#define LOAD_PORT	5001
+#define CH_READY	1		/* a core is ready to start */
+#define CH_START	2		/* start, multicast by core 0 */
+#define CH_RESULT	3		/* figures of a core */
+#define CH_LOAD		4		/* background traffic */
+#define LOAD_SIZE	256
+#define LOAD_PERIOD	5
+#define MAX_CORES	32
+
+MAIN_RETURN_TYPE coremain(void);
+
+struct result {
+	uint32_t ticks;
+	uint32_t iterations;
+	uint16_t crc;
+	uint16_t err;
+	uint32_t tx_packets;
+	uint32_t rx_packets;
+	uint32_t dropped;
+};
+
+/* CoreMark/MHz, times 1000 */
+static uint32_t score(struct result *r)
+{
+	uint32_t tpi;
+
+	tpi = r->iterations ? r->ticks / r->iterations : 0;
+
+	return tpi ? 1000000000 / tpi : 0;
+}
+
+static void fixed(uint32_t v)
+{
+	printf("%d.%03d", v / 1000, v % 1000);
+}
+
+/* runs CoreMark, and keeps its figures and the NoC traffic of this core meanwhile */
+static void run(struct result *r)
+{
+	struct noc_stats stats;
+
+	hf_noc_resetstats();
+	coremain();
+	hf_noc_stats(&stats);
+
+	r->ticks = last_run.ticks;
+	r->iterations = last_run.iterations;
+	r->crc = last_run.crc;
+	r->err = last_run.err;
+	r->tx_packets = stats.tx_packets;
+	r->rx_packets = stats.rx_packets;
+	r->dropped = stats.drop_noc_full + stats.drop_task_full + stats.drop_no_port + stats.drop_no_flow + stats.drop_quota + stats.drop_class;
+}
+
+#if CPU_ID == 0
+void master(void)
+{
+	struct result result[MAX_CORES], r;
+	uint32_t s, min = 0xffffffff, max = 0, sum = 0, mhz;
+	int32_t i, k, cores, errors = 0, val;
+	uint16_t cpu, port, size;
+	int8_t req;
+
+	if (hf_comm_create(hf_selfid(), BENCH_PORT, 0))
+		panic(0xff);
+
+	cores = hf_ncores() < MAX_CORES ? hf_ncores() : MAX_CORES;
+	printf("\n\nCoreMark on %d cores (NOC_LOAD %d), waiting for the cores\n", cores, NOC_LOAD);
+
+	/* barrier: all cores ready, then start them at once */
+	for (i = 1; i < cores; i++){
+		val = hf_recv(&cpu, &port, &req, &size, CH_READY);
+		if (val) printf("ready: error %d\n", val);
+	}
+	if (cores > 1){
+		val = hf_multicast(((1U << cores) - 1) & ~1U, BENCH_PORT, &req, sizeof(req), CH_START);
+		if (val) printf("hf_multicast(): error %d\n", val);
+	}
+
+	run(&result[0]);
+
+	for (i = 1; i < cores; i++){
+		val = hf_recv(&cpu, &port, (int8_t *)&r, &size, CH_RESULT);
+		if (val || cpu >= cores)
+			printf("result: error %d\n", val);
+		else
+			result[cpu] = r;
+	}
+
+	mhz = CPU_SPEED / 1000000;
+	printf("\ncore         ticks  iterations     crc  errors  CoreMark/MHz  tx packets  rx packets  dropped\n");
+	for (k = 0; k < cores; k++){
+		s = score(&result[k]);
+		if (s < min) min = s;
+		if (s > max) max = s;
+		sum += s;
+		errors += result[k].err;
+		printf("%4d %13d %11d  0x%04x %7d %9d.%03d %11d %11d %8d\n", k, result[k].ticks, result[k].iterations,
+			result[k].crc, result[k].err, s / 1000, s % 1000, result[k].tx_packets, result[k].rx_packets, result[k].dropped);
+	}
+
+	printf("\naggregate CoreMark/MHz   : ");
+	fixed(sum);
+	printf("\naggregate Iterations/Sec : ");
+	fixed(sum * mhz);
+	printf(" (%d MHz)\nper core CoreMark/MHz    : ", mhz);
+	fixed(min);
+	printf(" min, ");
+	fixed(sum / cores);
+	printf(" avg, ");
+	fixed(max);
+	printf(" max, spread %d%%\n", max ? (max - min) * 100 / max : 0);
+	if (errors)
+		printf("Errors detected on the cores (%d)\n", errors);
+	else
+		printf("All cores validated\n");
+
+	panic(0);
+}
+#else
+void worker(void)
+{
+	struct result result;
+	uint16_t cpu, port, size;
+	int8_t req = 0;
+	int32_t val;
+
+	if (hf_comm_create(hf_selfid(), BENCH_PORT, 0))
+		panic(0xff);
+
+	hf_send(0, BENCH_PORT, &req, sizeof(req), CH_READY);
+	val = hf_recv(&cpu, &port, &req, &size, CH_START);
+	if (val) printf("start: error %d\n", val);
+
+	run(&result);
+
+	val = hf_send(0, BENCH_PORT, (int8_t *)&result, sizeof(result), CH_RESULT);
+	if (val) printf("result: error %d\n", val);
+
+	while (1)
+		hf_recv(&cpu, &port, &req, &size, CH_START);
+}
+#endif
+
+#if NOC_LOAD == 1
+void load(void)
+{
+	int8_t buf[LOAD_SIZE];
+	uint16_t cpu, port, size;
+
+	if (hf_comm_create(hf_selfid(), LOAD_PORT, 0))
+		panic(0xff);
+
+	memset(buf, hf_cpuid(), sizeof(buf));
+	while (1){
+		hf_send((hf_cpuid() + 1) % hf_ncores(), LOAD_PORT, buf, sizeof(buf), CH_LOAD);
+		while (hf_recvprobe(CH_LOAD) > 0)
+			hf_recv(&cpu, &port, buf, &size, CH_LOAD);
+		hf_msleep(LOAD_PERIOD);
+	}
+}
+#endif
+
+void app_main(void)
+{
+#if CPU_ID == 0
+	hf_spawn(master, 0, 0, 0, "coremark", 16384);
+#else
+	hf_spawn(worker, 0, 0, 0, "coremark", 16384);
+#endif
+#if NOC_LOAD == 1
+	if (hf_ncores() > 1)
+		hf_spawn(load, 0, 0, 0, "load", 2048);
+#endif
+}
@@ -1,4 +1,5 @@
 #include <hellfire.h>
+#include <bench.h>
 
 float epsilon(void){
 	double x = 1.0;
@@ -43,6 +44,70 @@ void testfp(void){
 
 }
 
+/*
+speed (processor cycles per call, _readcounter()) and accuracy of the floating point
+operations and of the math library. each test prints one line:
+
+BENCH <test> <samples> <min> <avg> <max>
+
+accuracy is checked on identities (sin^2 + cos^2 = 1, exp(log(x)) = x), and printed
+as the largest error found, in units of 1e-9.
+*/
+#define SAMPLES		256
+
+volatile float va, vb, vr;
+
+/* operands in [-range, range], from the same seed for every test */
+static float operand(float range)
+{
+	return ((float)(random() % 20001) - 10000.0f) * range / 10000.0f;
+}
+
+#define BENCH_OP(name, range, expr) \
+	do { \
+		bench_init(&b); \
+		srand(SAMPLES); \
+		for (i = 0; i < SAMPLES; i++){ \
+			va = operand(range); \
+			vb = operand(range) + 2.0f * range; \
+			t = _readcounter(); \
+			vr = expr; \
+			bench_add(&b, _readcounter() - t); \
+		} \
+		bench_print(name, &b); \
+	} while (0)
+
+void bench_fp(void){
+	struct bench b;
+	uint32_t t, i;
+	float x, s, c, e, err_sc = 0.0f, err_el = 0.0f;
+
+	BENCH_OP("add", 1000.0f, va + vb);
+	BENCH_OP("mul", 1000.0f, va * vb);
+	BENCH_OP("div", 1000.0f, va / vb);
+	BENCH_OP("itof", 1000000.0f, (float)(int32_t)va);
+	BENCH_OP("sin", 100.0f, sin(va));
+	BENCH_OP("cos", 100.0f, cos(va));
+	BENCH_OP("exp", 40.0f, exp(va));
+	BENCH_OP("log", 1000.0f, log(vb));
+	BENCH_OP("sqrt", 1000.0f, sqrt(vb));
+
+	srand(SAMPLES);
+	for (i = 0; i < SAMPLES * 4; i++){
+		x = operand(100.0f);
+		s = sin(x);
+		c = cos(x);
+		e = fabs(s * s + c * c - 1.0f);
+		if (e > err_sc) err_sc = e;
+		x = operand(1000.0f) + 1000.01f;
+		e = fabs(exp(log(x)) / x - 1.0f);
+		if (e > err_el) err_el = e;
+	}
+	printf("\nBENCH err_sin_cos %d %d %d %d", SAMPLES * 4, 0, (int32_t)(err_sc * 1e9f), (int32_t)(err_sc * 1e9f));
+	printf("\nBENCH err_exp_log %d %d %d %d", SAMPLES * 4, 0, (int32_t)(err_el * 1e9f), (int32_t)(err_el * 1e9f));
+	printf("\nBENCH done\n");
+}
+
 void task(){
 	uint32_t i = 0;
 	
@@ -54,5 +119,6 @@ void task(){
 
 void app_main(void)
 {
+	bench_fp();
 	hf_spawn(task, 0, 0, 0, "task", 2048);
 }
@@ -2,4 +2,5 @@ APP_DIR = $(SRC_DIR)/$(APP)
 
 app: kernel
 	$(CC) $(CFLAGS) \
+		$(APP_DIR)/kernels.c \
 		$(APP_DIR)/filter.c 
@@ -1,149 +1,110 @@
 #include <hellfire.h>
 #include "image.h"
-
-uint8_t gausian(uint8_t buffer[5][5]){
-	int32_t sum = 0, mpixel;
-	uint8_t i, j;
-
-	int16_t kernel[5][5] =	{	{2, 4, 5, 4, 2},
-					{4, 9, 12, 9, 4},
-					{5, 12, 15, 12, 5},
-					{4, 9, 12, 9, 4},
-					{2, 4, 5, 4, 2}
-				};
-	for (i = 0; i < 5; i++)
-		for (j = 0; j < 5; j++)
-			sum += ((int32_t)buffer[i][j] * (int32_t)kernel[i][j]);
-	mpixel = (int32_t)(sum / 159);
-
-	return (uint8_t)mpixel;
-}
-
-uint32_t isqrt(uint32_t a){
-	uint32_t i, rem = 0, root = 0, divisor = 0;
-
-	for (i = 0; i < 16; i++){
-		root <<= 1;
-		rem = ((rem << 2) + (a >> 30));
-		a <<= 2;
-		divisor = (root << 1) + 1;
-		if (divisor <= rem){
-			rem -= divisor;
-			root++;
-		}
-	}
-	return root;
+#include "kernels.h"
+
+/*
+ * FILTER_STREAM 1 filters the image in one pass with filter_stream(), a few rows in memory,
+ * and prints the output rows as they come. 0 filters it as a whole, with two frame buffers.
+ */
+#ifndef FILTER_STREAM
+#define FILTER_STREAM	1
+#endif
+
+struct sink {
+	uint32_t count;
+	uint32_t sum;
+};
+
+/* rows of the image in image.h. a NoC, socket or file source would receive them instead */
+int32_t read_row(void *arg, int32_t row, uint8_t *buf){
+	memcpy(buf, image + row * width, width);
+
+	return ERR_OK;
 }
 
-uint8_t sobel(uint8_t buffer[3][3]){
-	int32_t sum = 0, gx = 0, gy = 0;
-	uint8_t i, j;
-
-	int16_t kernelx[3][3] =	{	{-1, 0, 1},
-					{-2, 0, 2},
-					{-1, 0, 1},
-				};
-	int16_t kernely[3][3] =	{	{-1, -2, -1},
-					{0, 0, 0},
-					{1, 2, 1},
-				};
-	for (i = 0; i < 3; i++){
-		for (j = 0; j < 3; j++){
-			gx += ((int32_t)buffer[i][j] * (int32_t)kernelx[i][j]);
-			gy += ((int32_t)buffer[i][j] * (int32_t)kernely[i][j]);
-		}
-	}
-	
-	sum = isqrt(gy * gy + gx * gx);
+int32_t sum_row(void *arg, int32_t row, uint8_t *buf){
+	struct sink *s = arg;
+	int32_t j;
 
-	if (sum > 255) sum = 255;
-	if (sum < 0) sum = 0;
+	for (j = 0; j < width; j++)
+		s->sum = (s->sum << 1 | s->sum >> 31) ^ buf[j];
 
-	return (uint8_t)sum;
+	return ERR_OK;
 }
 
-void do_gausian(uint8_t *img, int32_t width, int32_t height){
-	int32_t i, j, k, l;
-	uint8_t image_buf[5][5];
-	
-	for(i = 0; i < height; i++){
-		if (i > 1 || i < height-1){
-			for(j = 0; j < width; j++){
-				if (j > 1 || j < width-1){
-					for (k = 0; k < 5;k++)
-						for(l = 0; l < 5; l++)
-							image_buf[k][l] = image[(((i + l-2) * width) + (j + k-2))];
-
-					img[((i * width) + j)] = gausian(image_buf);
-				}else{
-					img[((i * width) + j)] = image[((i * width) + j)];
-				}
-			}
-		}
-	}
-}
+int32_t print_row(void *arg, int32_t row, uint8_t *buf){
+	struct sink *s = arg;
+	int32_t j;
 
-void do_sobel(uint8_t *img, int32_t width, int32_t height){
-	int32_t i, j, k, l;
-	uint8_t image_buf[3][3];
-	
-	for(i = 0; i < height; i++){
-		if (i > 0 || i < height){
-			for(j = 0; j < width; j++){
-				if (j > 0 || j < width){
-					for (k = 0; k < 3;k++)
-						for(l = 0; l < 3; l++)
-							image_buf[k][l] = image[(((i + l-1) * width) + (j + k-1))];
-
-					img[((i * width) + j)] = sobel(image_buf);
-				}else{
-					img[((i * width) + j)] = image[((i * width) + j)];
-				}
-			}
-		}
+	for (j = 0; j < width; j++){
+		printf("0x%x", buf[j]);
+		if ((row < height-1) || (j < width-1)) printf(", ");
+		if ((++s->count % 16) == 0) printf("\n");
 	}
+
+	return ERR_OK;
 }
 
 void task(void){
-	uint32_t i, j, k = 0;
-	uint8_t *img;
+	struct sink s;
+	uint32_t i;
 	uint32_t time;
-	
+#if FILTER_STREAM == 0
+	uint8_t *img, *blur;
+#endif
+
 	while(1) {
+#if FILTER_STREAM == 0
 		img = (uint8_t *) malloc(height * width);
-		if (img == NULL){
+		blur = (uint8_t *) malloc(height * width);
+		if (img == NULL || blur == NULL){
 			printf("\nmalloc() failed!\n");
 			for(;;);
 		}
+#endif
 
 		printf("\n\nstart of processing!\n\n");
 
+		s.count = 0;
+		s.sum = 0;
 		time = _readcounter();
 
-		do_gausian(img, width, height);
-		do_sobel(img, width, height);
-
+#if FILTER_STREAM == 0
+		gaussian_rows(blur, 0, image, 0, width, height, 0, height);
+		sobel_rows(img, 0, blur, 0, width, height, 0, height);
+		time = _readcounter() - time;
+		for (i = 0; i < height; i++)
+			sum_row(&s, i, img + i * width);
+#else
+		if (filter_stream(width, height, read_row, sum_row, &s)){
+			printf("\nmalloc() failed!\n");
+			for(;;);
+		}
 		time = _readcounter() - time;
+#endif
 
-		printf("done in %d clock cycles.\n\n", time);
+		printf("done in %d clock cycles (FILTER_STREAM %d, FILTER_FAST %d, FILTER_SWAR %d, SOBEL_L1 %d).\n", time, FILTER_STREAM, FILTER_FAST, FILTER_SWAR, SOBEL_L1);
+		printf("checksum 0x%x\n\n", s.sum);
 
 		printf("\n\nint32_t width = %d, height = %d;\n", width, height);
 		printf("uint8_t image[] = {\n");
-		for (i = 0; i < height; i++){
-			for (j = 0; j < width; j++){
-				printf("0x%x", img[i * width + j]);
-				if ((i < height-1) || (j < width-1)) printf(", ");
-				if ((++k % 16) == 0) printf("\n");
-			}
-		}
+#if FILTER_STREAM == 0
+		for (i = 0; i < height; i++)
+			print_row(&s, i, img + i * width);
+#else
+		filter_stream(width, height, read_row, print_row, &s);
+#endif
 		printf("};\n");
 
+#if FILTER_STREAM == 0
+		free(blur);
 		free(img);
+#endif
 
 		printf("\n\nend of processing!\n");
 		panic(0);
 	}
-		
+
 }
 
 void app_main(void) {
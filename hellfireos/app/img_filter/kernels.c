@@ -0,0 +1,309 @@
+#include <hellfire.h>
+#include "kernels.h"
+
+union lanes {
+	uint32_t w;
+	uint16_t h[2];
+};
+
+static int32_t clamp(int32_t v, int32_t max){
+	if (v < 0) return 0;
+	if (v >= max) return max - 1;
+	return v;
+}
+
+uint32_t isqrt(uint32_t a){
+	uint32_t i, rem = 0, root = 0, divisor = 0;
+
+	for (i = 0; i < 16; i++){
+		root <<= 1;
+		rem = ((rem << 2) + (a >> 30));
+		a <<= 2;
+		divisor = (root << 1) + 1;
+		if (divisor <= rem){
+			rem -= divisor;
+			root++;
+		}
+	}
+	return root;
+}
+
+static uint8_t magnitude(int32_t gx, int32_t gy){
+	uint32_t sum;
+
+#if SOBEL_L1 == 1
+	sum = (gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy);
+#else
+	sum = isqrt(gx * gx + gy * gy);
+#endif
+	return sum > 255 ? 255 : sum;
+}
+
+#if FILTER_FAST == 0
+#define ROW_WORDS(width)	(((width) + 3) >> 2)	/* words of an input row, as kept in the ring */
+
+/* gaussian of one row, from the 5 rows around it */
+static void gaussian_row(uint8_t *dst, uint8_t *row[5], int32_t width){
+	static const int16_t kernel[5][5] = {	{2, 4, 5, 4, 2},
+						{4, 9, 12, 9, 4},
+						{5, 12, 15, 12, 5},
+						{4, 9, 12, 9, 4},
+						{2, 4, 5, 4, 2}
+					};
+	int32_t j, k, l, sum;
+
+	for (j = 0; j < width; j++){
+		sum = 0;
+		if (j >= 2 && j < width - 2){
+			for (k = 0; k < 5; k++)
+				for (l = 0; l < 5; l++)
+					sum += row[k][j + l - 2] * kernel[k][l];
+		}else{
+			for (k = 0; k < 5; k++)
+				for (l = 0; l < 5; l++)
+					sum += row[k][clamp(j + l - 2, width)] * kernel[k][l];
+		}
+		dst[j] = sum / 159;
+	}
+}
+
+/* sobel of one row, from the 3 rows around it (scratch is not used) */
+static void sobel_row(uint8_t *dst, uint8_t *row[3], int16_t *scratch, int32_t width){
+	static const int16_t kernelx[3][3] = {	{-1, 0, 1},
+						{-2, 0, 2},
+						{-1, 0, 1}
+					};
+	static const int16_t kernely[3][3] = {	{-1, -2, -1},
+						{0, 0, 0},
+						{1, 2, 1}
+					};
+	int32_t j, k, l, p, gx, gy;
+
+	for (j = 0; j < width; j++){
+		gx = 0;
+		gy = 0;
+		for (k = 0; k < 3; k++){
+			for (l = 0; l < 3; l++){
+				p = row[k][clamp(j + l - 1, width)];
+				gx += p * kernelx[k][l];
+				gy += p * kernely[k][l];
+			}
+		}
+		dst[j] = magnitude(gx, gy);
+	}
+}
+#else
+#define ROW_WORDS(width)	(((width) + 1) >> 1)	/* words of the row sums of an input row */
+
+/* 1 4 6 4 1 on a row around pixel x, up to 16 * 255 */
+static uint32_t gaussian_h(uint8_t *p, int32_t x, int32_t width){
+	uint32_t a, b, c, d, e;
+
+	if (x >= 2 && x < width - 2){
+		a = p[x - 2]; b = p[x - 1]; c = p[x]; d = p[x + 1]; e = p[x + 2];
+	}else{
+		a = p[clamp(x - 2, width)]; b = p[clamp(x - 1, width)]; c = p[x];
+		d = p[clamp(x + 1, width)]; e = p[clamp(x + 2, width)];
+	}
+
+	return a + e + ((b + d) << 2) + (c << 2) + (c << 1);
+}
+
+static uint32_t lane(uint32_t w, int32_t k){
+	union lanes u;
+
+	u.w = w;
+	return u.h[k];
+}
+
+/* row pass of the gaussian, two pixels per word (16 bit lanes) */
+static void gaussian_hpass(uint32_t *buf, uint8_t *p, int32_t width){
+	union lanes u;
+	int32_t j;
+
+	for (j = 0; j < width; j += 2){
+		u.h[0] = gaussian_h(p, j, width);
+		u.h[1] = j + 1 < width ? gaussian_h(p, j + 1, width) : 0;
+		buf[j >> 1] = u.w;
+	}
+}
+
+/*
+ * column pass of the gaussian, from the row sums of the 5 rows around it. the lanes of a
+ * word hold at most 256 * 255 + 128, so adding the two pixels of a word at once
+ * (FILTER_SWAR) never carries from one lane to the other.
+ */
+static void gaussian_vpass(uint8_t *dst, uint32_t *h[5], int32_t width){
+	uint32_t a, b, c, d, e, v;
+	union lanes u;
+	int32_t j, k;
+
+	for (j = 0; j < ROW_WORDS(width); j++){
+		a = h[0][j]; b = h[1][j]; c = h[2][j]; d = h[3][j]; e = h[4][j];
+#if FILTER_SWAR == 1
+		v = a + e + ((b + d) << 2) + (c << 2) + (c << 1) + 0x00800080;
+		u.w = (v >> 8) & 0x00ff00ff;
+#else
+		for (k = 0; k < 2; k++)
+			u.h[k] = (lane(a, k) + lane(e, k) + ((lane(b, k) + lane(d, k)) << 2) + (lane(c, k) << 2) + (lane(c, k) << 1) + 128) >> 8;
+#endif
+		dst[j << 1] = u.h[0];
+		if ((j << 1) + 1 < width)
+			dst[(j << 1) + 1] = u.h[1];
+	}
+}
+
+/*
+ * sobel of one row, from the 3 rows around it. gx is the difference of the 1 2 1 column
+ * sums on the left and right, gy the 1 2 1 sum of the column differences (row below minus
+ * row above). both are taken once per column (in scratch, 2 * width) and shared by the
+ * three pixels around it.
+ */
+static void sobel_row(uint8_t *dst, uint8_t *row[3], int16_t *scratch, int32_t width){
+	uint8_t *a = row[0], *b = row[1], *c = row[2];
+	int16_t *s = scratch, *d = scratch + width;
+	int32_t j, l, r, gx, gy;
+
+	for (j = 0; j < width; j++){
+		s[j] = a[j] + (b[j] << 1) + c[j];
+		d[j] = c[j] - a[j];
+	}
+	for (j = 0; j < width; j++){
+		l = j > 0 ? j - 1 : 0;
+		r = j < width - 1 ? j + 1 : j;
+		gx = s[r] - s[l];
+		gy = d[l] + (d[j] << 1) + d[r];
+		dst[j] = magnitude(gx, gy);
+	}
+}
+#endif
+
+/*
+ * an input row, as the gaussian keeps it: the row itself for the reference, its row sums
+ * for the separable filter. ring is ROW_WORDS(width) words.
+ */
+static void gaussian_load(uint32_t *ring, uint8_t *p, int32_t width){
+#if FILTER_FAST == 0
+	memcpy(ring, p, width);
+#else
+	gaussian_hpass(ring, p, width);
+#endif
+}
+
+static void gaussian_emit(uint8_t *dst, uint32_t *ring[5], int32_t width){
+#if FILTER_FAST == 0
+	uint8_t *row[5];
+	int32_t k;
+
+	for (k = 0; k < 5; k++)
+		row[k] = (uint8_t *)ring[k];
+	gaussian_row(dst, row, width);
+#else
+	gaussian_vpass(dst, ring, width);
+#endif
+}
+
+/*
+ * rows are kept in a ring of 5 (gaussian), so each input row is loaded once. with the
+ * reference filter rows are copied to the ring, which could read the band in place, but
+ * keeps a single code path.
+ */
+int32_t gaussian_rows(uint8_t *out, int32_t out_first, uint8_t *in, int32_t in_first, int32_t width, int32_t height, int32_t r0, int32_t r1){
+	uint32_t *rows, *h[5], *t;
+	int32_t i, k, words;
+
+	words = ROW_WORDS(width);
+	rows = malloc(5 * words * sizeof(uint32_t));
+	if (rows == NULL) return ERR_OUT_OF_MEMORY;
+
+	for (k = 0; k < 5; k++){
+		h[k] = rows + k * words;
+		gaussian_load(h[k], in + (clamp(r0 + k - 2, height) - in_first) * width, width);
+	}
+
+	for (i = r0; i < r1; i++){
+		gaussian_emit(out + (i - out_first) * width, h, width);
+		if (i + 1 < r1){
+			t = h[0];
+			for (k = 0; k < 4; k++)
+				h[k] = h[k + 1];
+			h[4] = t;
+			gaussian_load(t, in + (clamp(i + 3, height) - in_first) * width, width);
+		}
+	}
+	free(rows);
+
+	return ERR_OK;
+}
+
+int32_t sobel_rows(uint8_t *out, int32_t out_first, uint8_t *in, int32_t in_first, int32_t width, int32_t height, int32_t r0, int32_t r1){
+	uint8_t *row[3];
+	int16_t *scratch;
+	int32_t i;
+
+	scratch = malloc(2 * width * sizeof(int16_t));
+	if (scratch == NULL) return ERR_OUT_OF_MEMORY;
+
+	for (i = r0; i < r1; i++){
+		row[0] = in + (clamp(i - 1, height) - in_first) * width;
+		row[1] = in + (i - in_first) * width;
+		row[2] = in + (clamp(i + 1, height) - in_first) * width;
+		sobel_row(out + (i - out_first) * width, row, scratch, width);
+	}
+	free(scratch);
+
+	return ERR_OK;
+}
+
+/*
+ * both filters in a single pass, a row at a time. input rows are loaded to the gaussian ring
+ * (5 rows) as the gaussian needs them, each gaussian row goes to a ring of 3 rows, and each
+ * output row is written once the gaussian row below it is done, so at most 3 input rows are
+ * read ahead of the output. memory is a few rows, whatever the height.
+ */
+int32_t filter_stream(int32_t width, int32_t height, int32_t (*read)(void *arg, int32_t row, uint8_t *buf),
+	int32_t (*write)(void *arg, int32_t row, uint8_t *buf), void *arg){
+	uint32_t *mem, *ring, *h[5];
+	uint8_t *in, *blur, *out, *row[3];
+	int16_t *scratch;
+	int32_t words, i, k, next = 0, val = ERR_OK;
+
+	words = ROW_WORDS(width);
+	mem = malloc(5 * words * sizeof(uint32_t) + 2 * width * sizeof(int16_t) + 5 * width);
+	if (mem == NULL) return ERR_OUT_OF_MEMORY;
+	ring = mem;
+	scratch = (int16_t *)(ring + 5 * words);
+	in = (uint8_t *)(scratch + 2 * width);
+	blur = in + width;
+	out = blur + 3 * width;
+
+	for (k = 0; k < height; k++){
+		for (; next <= k + 2 && next < height; next++){
+			val = read(arg, next, in);
+			if (val) break;
+			gaussian_load(ring + (next % 5) * words, in, width);
+		}
+		if (val) break;
+		for (i = 0; i < 5; i++)
+			h[i] = ring + (clamp(k + i - 2, height) % 5) * words;
+		gaussian_emit(blur + (k % 3) * width, h, width);
+
+		if (k > 0){
+			for (i = 0; i < 3; i++)
+				row[i] = blur + (clamp(k + i - 2, height) % 3) * width;
+			sobel_row(out, row, scratch, width);
+			val = write(arg, k - 1, out);
+			if (val) break;
+		}
+	}
+	if (val == ERR_OK){
+		k = height - 1;
+		for (i = 0; i < 3; i++)
+			row[i] = blur + (clamp(k + i - 1, height) % 3) * width;
+		sobel_row(out, row, scratch, width);
+		val = write(arg, k, out);
+	}
+	free(mem);
+
+	return val;
+}
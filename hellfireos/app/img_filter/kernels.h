@@ -0,0 +1,38 @@
+/*
+ * gaussian blur and sobel edge detection on bands of rows of a grayscale image.
+ *
+ * in holds image rows from in_first and out image rows from out_first, both width pixels
+ * wide. rows [r0, r1) of the image are written to out, and in must have the rows around
+ * them (2 more above and below for the gaussian, 1 for the sobel) that are inside the image:
+ * pixels out of the image repeat the ones on the border.
+ *
+ * FILTER_FAST 0 is the reference: a 5x5 window (/159) and two 3x3 windows for each pixel.
+ * FILTER_FAST 1 uses separable passes and row buffers, with shifts for the products: a 5x5
+ * binomial gaussian (1 4 6 4 1 on rows and columns, 256 as the divisor), and the sobel as
+ * column sums (1 2 1 smoothing and a difference) shared by neighbour pixels. the sobel is
+ * the same as the reference, the gaussian a close approximation. FILTER_SWAR does the
+ * column pass of the gaussian on two pixels per 32 bit word (same results), and SOBEL_L1
+ * takes |gx| + |gy| as the magnitude instead of the square root, on both variants.
+ */
+#ifndef FILTER_FAST
+#define FILTER_FAST	1
+#endif
+#ifndef FILTER_SWAR
+#define FILTER_SWAR	1
+#endif
+#ifndef SOBEL_L1
+#define SOBEL_L1	0
+#endif
+
+int32_t gaussian_rows(uint8_t *out, int32_t out_first, uint8_t *in, int32_t in_first, int32_t width, int32_t height, int32_t r0, int32_t r1);
+int32_t sobel_rows(uint8_t *out, int32_t out_first, uint8_t *in, int32_t in_first, int32_t width, int32_t height, int32_t r0, int32_t r1);
+
+/*
+ * both filters on a whole image, streamed: input rows come from read() and output rows go to
+ * write(), both in order (row 0 first), as soon as they can be produced. memory is about
+ * 20 * width bytes, so the image does not have to fit the heap, and rows may come from (and
+ * go to) the NoC, a socket or a file. a callback returning other than ERR_OK stops the
+ * stream, with its value.
+ */
+int32_t filter_stream(int32_t width, int32_t height, int32_t (*read)(void *arg, int32_t row, uint8_t *buf),
+	int32_t (*write)(void *arg, int32_t row, uint8_t *buf), void *arg);
@@ -0,0 +1,6 @@
+APP_DIR = $(SRC_DIR)/$(APP)
+
+app: kernel
+	$(CC) $(CFLAGS) \
+		$(SRC_DIR)/app/img_filter/kernels.c \
+		$(APP_DIR)/img_filter_noc.c 
@@ -0,0 +1,257 @@
+/*
+ * gaussian blur and sobel edge detection of an image, split on all cores of the NoC.
+ *
+ * core 0 has the image. it cuts the image in bands of rows (one per core), multicasts the
+ * image size to the other cores and sends each core its band with the halo rows the two
+ * filters need (3 above and 3 below, gaussian 5x5 then sobel 3x3). every core filters its
+ * band while the next ones are still being sent, core 0 included, and core 0 then pulls the
+ * filtered bands back, one core at a time, so its reception queue never overflows. rows and
+ * columns out of the image repeat the pixels on the border, so the result does not depend on
+ * the number of cores. the filters are the ones of img_filter (kernels.c).
+ */
+#include <hellfire.h>
+#include <noc.h>
+#include "../img_filter/kernels.h"
+#if CPU_ID == 0
+#include "../img_filter/image.h"
+#endif
+
+#define FILTER_PORT	5000
+#define CH_JOB		1		/* image size, multicast */
+#define CH_TILE		2		/* band and halo, to a core */
+#define CH_PULL		3		/* request for a filtered band */
+#define CH_RESULT	4		/* filtered band, and its timing */
+#define HALO		3
+#define CHUNK		2048		/* bytes per acknowledged message (fits a reception queue) */
+#define ACK_TIMEOUT	1000
+
+struct job {
+	int32_t width;
+	int32_t height;
+	int32_t cores;
+};
+
+struct timing {
+	uint32_t recv;			/* cycles from the job to the last byte of the band */
+	uint32_t filter;		/* cycles filtering the band */
+	uint32_t gather;		/* cycles core 0 took to pull the band back */
+};
+
+/* rows of the image filtered by a core */
+static void band(struct job *job, int32_t core, int32_t *r0, int32_t *r1)
+{
+	*r0 = job->height * core / job->cores;
+	*r1 = job->height * (core + 1) / job->cores;
+}
+
+/* rows of the image a core needs for its band */
+static void tile(struct job *job, int32_t core, int32_t *t0, int32_t *t1)
+{
+	band(job, core, t0, t1);
+	*t0 = *t0 - HALO < 0 ? 0 : *t0 - HALO;
+	*t1 = *t1 + HALO > job->height ? job->height : *t1 + HALO;
+}
+
+/*
+ * both filters on the band of a core. tile holds image rows [t0, t1), the gaussian goes to
+ * a scratch buffer for the band and a row above and below, the sobel to out (band rows).
+ */
+int32_t filter_band(struct job *job, int32_t core, uint8_t *tile_buf, uint8_t *out)
+{
+	int32_t r0, r1, t0, t1, g0, g1, val;
+	uint8_t *blur;
+
+	band(job, core, &r0, &r1);
+	tile(job, core, &t0, &t1);
+	g0 = r0 - 1 < 0 ? 0 : r0 - 1;
+	g1 = r1 + 1 > job->height ? job->height : r1 + 1;
+
+	blur = malloc((g1 - g0) * job->width);
+	if (blur == NULL) return ERR_OUT_OF_MEMORY;
+	val = gaussian_rows(blur, g0, tile_buf, t0, job->width, job->height, g0, g1);
+	if (val == ERR_OK)
+		val = sobel_rows(out, r0, blur, g0, job->width, job->height, r0, r1);
+	free(blur);
+
+	return val;
+}
+
+/* a buffer, as acknowledged messages of up to CHUNK bytes */
+int32_t send_chunks(uint16_t cpu, uint8_t *buf, int32_t size, uint16_t channel)
+{
+	int32_t i, n, val;
+
+	for (i = 0; i < size; i += n){
+		n = size - i < CHUNK ? size - i : CHUNK;
+		val = hf_sendack(cpu, FILTER_PORT, (int8_t *)buf + i, n, channel, ACK_TIMEOUT);
+		if (val) return val;
+	}
+
+	return ERR_OK;
+}
+
+int32_t recv_chunks(uint8_t *buf, int32_t size, uint16_t channel)
+{
+	uint16_t cpu, port, n;
+	int32_t i, val;
+
+	for (i = 0; i < size; i += n){
+		val = hf_recvack(&cpu, &port, (int8_t *)buf + i, &n, channel);
+		if (val) return val;
+	}
+
+	return ERR_OK;
+}
+
+#if CPU_ID == 0
+void master(void)
+{
+	struct job job;
+	struct timing timing[32];
+	uint32_t time, scatter, gather, total, sum = 0;
+	int32_t i, j, k, r0, r1, t0, t1, val;
+	uint16_t cpu, port, size;
+	uint8_t *img;
+	int8_t req = 0;
+
+	if (hf_comm_create(hf_selfid(), FILTER_PORT, 0))
+		panic(0xff);
+
+	job.width = width;
+	job.height = height;
+	job.cores = hf_ncores() < 32 ? hf_ncores() : 32;
+
+	img = (uint8_t *) malloc(height * width);
+	if (img == NULL){
+		printf("\nmalloc() failed!\n");
+		for(;;);
+	}
+
+	printf("\n\nstart of processing (%d cores)!\n\n", job.cores);
+
+	total = _readcounter();
+
+	/* scatter: image size to all, then each band with its halo */
+	if (job.cores > 1){
+		val = hf_multicast(((1U << job.cores) - 1) & ~1U, FILTER_PORT, (int8_t *)&job, sizeof(job), CH_JOB);
+		if (val) printf("hf_multicast(): error %d\n", val);
+	}
+	for (k = 1; k < job.cores; k++){
+		tile(&job, k, &t0, &t1);
+		val = send_chunks(k, image + t0 * width, (t1 - t0) * width, CH_TILE);
+		if (val) printf("core %d, tile: error %d\n", k, val);
+	}
+	scatter = _readcounter() - total;
+
+	/* our own band, the image is already here */
+	time = _readcounter();
+	val = filter_band(&job, 0, image, img);
+	if (val) printf("core 0, filter: error %d\n", val);
+	timing[0].recv = 0;
+	timing[0].filter = _readcounter() - time;
+	timing[0].gather = 0;
+
+	/* gather: a core at a time, its timing and then its band */
+	gather = _readcounter();
+	for (k = 1; k < job.cores; k++){
+		time = _readcounter();
+		band(&job, k, &r0, &r1);
+		hf_send(k, FILTER_PORT, &req, sizeof(req), CH_PULL);
+		val = hf_recvack(&cpu, &port, (int8_t *)&timing[k], &size, CH_RESULT);
+		if (val == ERR_OK)
+			val = recv_chunks(img + r0 * width, (r1 - r0) * width, CH_RESULT);
+		if (val) printf("core %d, result: error %d\n", k, val);
+		timing[k].gather = _readcounter() - time;
+	}
+	gather = _readcounter() - gather;
+	total = _readcounter() - total;
+
+	printf("core     rows   recv cycles  filter cycles  gather cycles\n");
+	for (k = 0; k < job.cores; k++){
+		band(&job, k, &r0, &r1);
+		printf("%4d %8d %13d %14d %14d\n", k, r1 - r0, timing[k].recv, timing[k].filter, timing[k].gather);
+	}
+	printf("\nscatter %d, gather %d, done in %d clock cycles.\n", scatter, gather, total);
+
+	for (i = 0; i < height * width; i++)
+		sum = (sum << 1 | sum >> 31) ^ img[i];
+	printf("checksum 0x%x\n", sum);
+
+	k = 0;
+	printf("\n\nint32_t width = %d, height = %d;\n", width, height);
+	printf("uint8_t image[] = {\n");
+	for (i = 0; i < height; i++){
+		for (j = 0; j < width; j++){
+			printf("0x%x", img[i * width + j]);
+			if ((i < height-1) || (j < width-1)) printf(", ");
+			if ((++k % 16) == 0) printf("\n");
+		}
+	}
+	printf("};\n");
+
+	free(img);
+
+	printf("\n\nend of processing!\n");
+	panic(0);
+}
+#else
+/* serves jobs from core 0, one band each */
+void worker(void)
+{
+	struct job job;
+	struct timing timing;
+	uint32_t time;
+	int32_t r0, r1, t0, t1, val;
+	uint16_t cpu, port, size;
+	uint8_t *tile_buf, *out;
+	int8_t req;
+
+	if (hf_comm_create(hf_selfid(), FILTER_PORT, 0))
+		panic(0xff);
+
+	while (1){
+		val = hf_recv(&cpu, &port, (int8_t *)&job, &size, CH_JOB);
+		if (val) printf("job: error %d\n", val);
+		if (val || hf_cpuid() >= job.cores)
+			continue;
+
+		band(&job, hf_cpuid(), &r0, &r1);
+		tile(&job, hf_cpuid(), &t0, &t1);
+		tile_buf = malloc((t1 - t0) * job.width);
+		out = malloc((r1 - r0) * job.width);
+		if (tile_buf == NULL || out == NULL){
+			printf("\nmalloc() failed!\n");
+			for(;;);
+		}
+
+		time = _readcounter();
+		val = recv_chunks(tile_buf, (t1 - t0) * job.width, CH_TILE);
+		if (val) printf("tile: error %d\n", val);
+		timing.recv = _readcounter() - time;
+
+		time = _readcounter();
+		val = filter_band(&job, hf_cpuid(), tile_buf, out);
+		if (val) printf("filter: error %d\n", val);
+		timing.filter = _readcounter() - time;
+		timing.gather = 0;
+		free(tile_buf);
+
+		/* wait to be pulled, so bands reach core 0 one at a time */
+		hf_recv(&cpu, &port, &req, &size, CH_PULL);
+		val = hf_sendack(0, FILTER_PORT, (int8_t *)&timing, sizeof(timing), CH_RESULT, ACK_TIMEOUT);
+		if (val == ERR_OK)
+			val = send_chunks(0, out, (r1 - r0) * job.width, CH_RESULT);
+		if (val) printf("result: error %d\n", val);
+		free(out);
+	}
+}
+#endif
+
+void app_main(void)
+{
+#if CPU_ID == 0
+	hf_spawn(master, 0, 0, 0, "filter", 4096);
+#else
+	hf_spawn(worker, 0, 0, 0, "filter", 4096);
+#endif
+}
@@ -0,0 +1,5 @@
+APP_DIR = $(SRC_DIR)/$(APP)
+
+app: kernel
+	$(CC) $(CFLAGS) \
+		$(APP_DIR)/mailbox.c
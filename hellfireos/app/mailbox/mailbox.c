@@ -0,0 +1,48 @@
+#include <hellfire.h>
+
+#define MB_SIZE		16
+#define MSG_SIZE	100
+
+mbox_t mb;
+struct pool *msgs;
+
+void sender(void)
+{
+	int32_t i = 0;
+	int8_t *buf;
+
+	for(;;){
+		buf = hf_pool_alloc(msgs);
+		if (buf){
+			sprintf(buf, "hello from task %d, counting %d (item at %08x)", hf_selfid(), i++, (uint32_t)buf);
+			if (hf_mboxsend(&mb, buf, strlen(buf) + 1)){
+				printf("mailbox is full!\n");
+				hf_pool_free(msgs, buf);
+			}
+		}
+		hf_yield();
+	}
+}
+
+void receiver(void)
+{
+	uint16_t source, size;
+	void *b;
+
+	for(;;){
+		hf_mboxrecv(&mb, &source, &b, &size);
+		printf("task %d <- task %d (%d bytes): %s\n", hf_selfid(), source, size, (int8_t *)b);
+		hf_pool_free(msgs, b);
+	}
+}
+
+void app_main(void){
+	msgs = hf_pool_create(MSG_SIZE, MB_SIZE * 2);
+	hf_mboxinit(&mb, MB_SIZE);
+
+	hf_spawn(sender, 0, 0, 0, "sender 1", 1024);
+	hf_spawn(sender, 0, 0, 0, "sender 2", 1024);
+	hf_spawn(sender, 0, 0, 0, "sender 3", 1024);
+	hf_spawn(receiver, 0, 0, 0, "receiver 1", 1024);
+	hf_spawn(receiver, 0, 0, 0, "receiver 2", 1024);
+}
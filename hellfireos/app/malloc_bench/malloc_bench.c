@@ -0,0 +1,268 @@
+/*
+allocator benchmark: replays allocation traces on the kernel heap, to compare the
+MEM_ALLOC variants. the traces are generated from a fixed seed, so every allocator
+gets the same sequence of requests. figures are in processor cycles (_readcounter()),
+each operation measured with interrupts disabled, one line each:
+
+BENCH <trace>_malloc <samples> <min> <avg> <max>	cycles per hf_malloc() (max is the worst case)
+BENCH <trace>_free <samples> <min> <avg> <max>		cycles per hf_free()
+BENCH <trace>_frag <samples> <min> <avg> <max>		fragmentation, per mille, sampled during the trace
+HEAP <trace> failed <n> live_peak <bytes>		allocations that failed, peak of live data
+
+and, every SAMPLE_EVERY operations, a point of the fragmentation over time:
+
+HEAP <trace> <op> <used> <free> <largest> <free_blocks> <frag>
+
+fragmentation is 1000 - 1000 * largest / free: the share of the free memory that is not
+in the largest free block (0 when all free memory is in one block). traces:
+
+boot	long lived blocks of the kernel boot (task stacks, control blocks, queues and
+	pools), allocated in a row and freed at the end
+churn	aperiodic tasks created and killed at random (a stack and a few control blocks
+	each), with a small long lived block left behind now and then
+net	network buffer churn: frames of 64 to 1518 bytes, most freed in order and some
+	held longer, with small headers in between
+*/
+
+#include <hellfire.h>
+#include <bench.h>
+
+#define SAMPLE_EVERY	100
+#define SLOTS		64
+#define CHURN_OPS	2000
+#define NET_OPS		4000
+
+struct trace {
+	int8_t *name;
+	struct bench malloc, free, frag;
+	uint32_t ops, failed, live, live_peak;
+};
+
+static uint32_t seed;
+
+/* the same sequence on every build, whatever the libc rand() */
+static uint32_t next(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static uint32_t range(uint32_t lo, uint32_t hi)
+{
+	return lo + next() % (hi - lo + 1);
+}
+
+static void sample(struct trace *t)
+{
+	struct heap_stats s;
+	uint32_t frag;
+
+	hf_heapstats(&s);
+	frag = s.free ? 1000 - (uint32_t)((uint64_t)s.largest * 1000 / s.free) : 0;
+	bench_add(&t->frag, frag);
+	printf("\nHEAP %s %d %d %d %d %d %d", t->name, t->ops, s.used, s.free, s.largest, s.free_blocks, frag);
+}
+
+static void op_done(struct trace *t)
+{
+	if (++t->ops % SAMPLE_EVERY == 0)
+		sample(t);
+}
+
+static void *trace_malloc(struct trace *t, uint32_t size)
+{
+	uint32_t status, time;
+	void *p;
+
+	status = _di();
+	time = _readcounter();
+	p = hf_malloc(size);
+	time = _readcounter() - time;
+	_ei(status);
+
+	bench_add(&t->malloc, time);
+	if (p){
+		t->live += size;
+		if (t->live > t->live_peak) t->live_peak = t->live;
+	}else{
+		t->failed++;
+	}
+	op_done(t);
+
+	return p;
+}
+
+static void trace_free(struct trace *t, void *p, uint32_t size)
+{
+	uint32_t status, time;
+
+	if (!p) return;
+	status = _di();
+	time = _readcounter();
+	hf_free(p);
+	time = _readcounter() - time;
+	_ei(status);
+
+	bench_add(&t->free, time);
+	t->live -= size;
+	op_done(t);
+}
+
+static void trace_init(struct trace *t, int8_t *name)
+{
+	t->name = name;
+	bench_init(&t->malloc);
+	bench_init(&t->free);
+	bench_init(&t->frag);
+	t->ops = 0;
+	t->failed = 0;
+	t->live = 0;
+	t->live_peak = 0;
+	seed = 0x2545f491;
+}
+
+static void trace_print(struct trace *t)
+{
+	sample(t);
+	bench_print_sub(t->name, "malloc", &t->malloc);
+	bench_print_sub(t->name, "free", &t->free);
+	bench_print_sub(t->name, "frag", &t->frag);
+	printf("\nHEAP %s failed %d live_peak %d", t->name, t->failed, t->live_peak);
+}
+
+/* kernel boot: 16 tasks (stack and control blocks), queues, pools and buffers, all long lived */
+static void trace_boot(void)
+{
+	static const uint32_t stacks[] = {1024, 2048, 2048, 4096, 16384};
+	struct trace t;
+	void *p[SLOTS * 2];
+	uint32_t size[SLOTS * 2];
+	int32_t i, n = 0;
+
+	trace_init(&t, "boot");
+	for (i = 0; i < 16; i++){
+		size[n] = stacks[next() % 5];				/* task stack */
+		p[n] = trace_malloc(&t, size[n]); n++;
+		size[n] = range(16, 64);				/* semaphore, mutex, list node */
+		p[n] = trace_malloc(&t, size[n]); n++;
+		if (i % 2 == 0){
+			size[n] = range(64, 512);			/* queue */
+			p[n] = trace_malloc(&t, size[n]); n++;
+		}
+		if (i % 4 == 0){
+			size[n] = range(1024, 8192);			/* pool or driver buffer */
+			p[n] = trace_malloc(&t, size[n]); n++;
+		}
+	}
+	sample(&t);
+
+	/* and the teardown, in reverse order */
+	while (n > 0){
+		n--;
+		trace_free(&t, p[n], size[n]);
+	}
+	trace_print(&t);
+}
+
+/* aperiodic tasks: up to SLOTS / 4 alive, each a stack and 3 control blocks */
+static void trace_churn(void)
+{
+	struct trace t;
+	void *p[SLOTS], *leak[CHURN_OPS / 50];
+	uint32_t size[SLOTS];
+	int8_t alive[SLOTS / 4];
+	int32_t i, j, k, leaks = 0;
+
+	trace_init(&t, "churn");
+	for (i = 0; i < SLOTS; i++)
+		p[i] = NULL;
+	for (i = 0; i < SLOTS / 4; i++)
+		alive[i] = 0;
+
+	for (i = 0; t.ops < CHURN_OPS; i++){
+		k = next() % (SLOTS / 4);
+		alive[k] = !alive[k];
+		k *= 4;
+		if (!alive[k / 4]){
+			for (j = 0; j < 4; j++){			/* kill */
+				trace_free(&t, p[k + j], size[k + j]);
+				p[k + j] = NULL;
+			}
+		}else{
+			size[k] = range(1, 8) * 1024;			/* spawn */
+			for (j = 1; j < 4; j++)
+				size[k + j] = range(16, 256);
+			for (j = 0; j < 4; j++)
+				p[k + j] = trace_malloc(&t, size[k + j]);
+		}
+		if (i % 50 == 49 && leaks < CHURN_OPS / 50)
+			leak[leaks++] = trace_malloc(&t, range(16, 128));
+	}
+	trace_print(&t);
+
+	for (i = 0; i < SLOTS; i++)
+		trace_free(&t, p[i], size[i]);
+	for (i = 0; i < leaks; i++)
+		if (leak[i]) hf_free(leak[i]);
+}
+
+/* network buffers: a FIFO of frames (most freed in order) and a few held at random */
+static void trace_net(void)
+{
+	struct trace t;
+	void *p[SLOTS], *hdr = NULL;
+	uint32_t size[SLOTS];
+	int32_t i, head = 0, tail = 0, held;
+
+	trace_init(&t, "net");
+	for (i = 0; i < SLOTS; i++)
+		p[i] = NULL;
+
+	while (t.ops < NET_OPS){
+		if (tail - head < SLOTS / 2 && next() % 4){
+			i = tail++ % SLOTS;
+			size[i] = next() % 10 < 6 ? range(64, 128) : 1518;
+			p[i] = trace_malloc(&t, size[i]);
+		}else if (tail > head){
+			/* an older frame held by a socket goes out of order now and then */
+			held = next() % 8 == 0 ? head + next() % (tail - head) : head;
+			i = held % SLOTS;
+			trace_free(&t, p[i], size[i]);
+			p[i] = p[head % SLOTS];
+			size[i] = size[head % SLOTS];
+			head++;
+		}
+		if (next() % 16 == 0){
+			if (hdr)
+				trace_free(&t, hdr, 42);
+			hdr = trace_malloc(&t, 42);
+		}
+	}
+	trace_print(&t);
+
+	while (tail > head){
+		i = head++ % SLOTS;
+		trace_free(&t, p[i], size[i]);
+	}
+	trace_free(&t, hdr, 42);
+}
+
+void bench(void)
+{
+	printf("\nBENCH arch %s mem_alloc %d heap_size %d cpu_speed %d", CPU_ARCH, MEM_ALLOC, HEAP_SIZE, CPU_SPEED);
+	trace_boot();
+	trace_churn();
+	trace_net();
+	printf("\nBENCH done\n");
+
+	for (;;)
+		hf_msleep(1000);
+}
+
+void app_main(void)
+{
+	hf_spawn(bench, 0, 0, 0, "bench", 2048);
+}
@@ -12,7 +12,7 @@ void task(void){
 		shared = random();
 		printf("\nTask %d on critical region.. shared: %d itr: %d", hf_selfid(), shared, itr++);
 		hf_mtxunlock(&m);
-		delay_ms(1);			// do not hog the CPU!
+		hf_msleep(1);			// do not hog the CPU!
 	}
 }
 
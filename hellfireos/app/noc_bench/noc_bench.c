@@ -0,0 +1,310 @@
+/*
+NoC benchmarks: latency, bandwidth and loss of the packet driver. all cores run this
+application, core 0 drives the tests and prints the figures of every core, the other
+cores serve them. figures are in processor cycles (_readcounter()) of each core and in
+bytes, one line each:
+
+BENCH <test> <samples> <min> <avg> <max>
+NOCBENCH <test> <core> <tx_msgs> <rx_pkts> <expected_pkts> <dropped> <cycles> <rx_bytes_per_kcycle>
+
+pingpong_<size>		round trip of a message between core 0 and the last core (hf_send())
+pingack_<size>		the same with hf_sendack() / hf_recvack()
+stream_<size>		the last core sends MESSAGES messages to core 0, as fast as it can
+streamack_<size>	the same with hf_sendack() (flow control, no loss)
+all2all_<size>		every core sends MESSAGES messages to every other core
+hotspot_<size>		every core sends MESSAGES messages to core 0
+
+the BENCH lines of the traffic tests are the reception throughput of the receiving cores
+(<test>_<size>, bytes per 1000 cycles) and their loss (<test>_<size>_loss, per mille of the
+expected packets), one sample per receiving core. NOCBENCH lines hold the figures of each
+core: cycles are from the start of the test to the last packet received (or sent), packets
+not received once no packet came for QUIET cycles are lost, and dropped are the packets the
+driver of the core dropped (no free packet or a full reception ring). run with KERNEL_LOG = 0,
+with other NOC_PACKET_SIZE / NOC_PACKET_SLOTS settings to compare them.
+*/
+
+#include <hellfire.h>
+#include <bench.h>
+#include <noc.h>
+
+#define SAMPLES		32
+#define MESSAGES	32
+#define MAX_SIZE	4096
+#define MAX_CORES	32
+#define QUIET		(CPU_SPEED / 20)
+#define BENCH_PORT	3000
+#define CH_JOB		1		/* test to run, multicast by core 0 */
+#define CH_PULL		2		/* request for the figures of a core */
+#define CH_RESULT	3		/* figures of a core */
+#define CH_DATA		4		/* test traffic */
+#define ACK_TIMEOUT	1000
+
+enum {
+	PINGPONG, PINGACK, STREAM, STREAMACK, ALL2ALL, HOTSPOT, END
+};
+
+const int8_t *names[] = {"pingpong", "pingack", "stream", "streamack", "all2all", "hotspot"};
+
+struct job {
+	int32_t test;
+	int32_t size;
+	int32_t cores;
+};
+
+struct result {
+	uint32_t tx_msgs;
+	uint32_t rx_pkts;
+	uint32_t expected;
+	uint32_t dropped;
+	uint32_t cycles;
+};
+
+uint8_t buf[MAX_SIZE];
+
+/* packets of a message, as the driver cuts it */
+static uint32_t packets(int32_t size)
+{
+	return hf_noc_packets(size);
+}
+
+/* takes the packets waiting on the data channel, as they come (no message reassembly) */
+static uint32_t drain(struct result *r, uint32_t last)
+{
+	while (hf_recvprobe(CH_DATA) > 0){
+		hf_pktfree(hf_recvpkt(CH_DATA));
+		r->rx_pkts++;
+		last = _readcounter();
+	}
+
+	return last;
+}
+
+/* round trips between core 0 and the last core, measured on core 0 */
+static void pingpong(struct job *job, struct bench *b)
+{
+	uint16_t cpu, port, size;
+	int32_t i, peer, val;
+	uint32_t t;
+
+	peer = job->cores - 1;
+	for (i = 0; i < SAMPLES; i++){
+		if (hf_cpuid() == 0){
+			t = _readcounter();
+			if (job->test == PINGPONG){
+				hf_send(peer, BENCH_PORT, buf, job->size, CH_DATA);
+				val = hf_recv(&cpu, &port, buf, &size, CH_DATA);
+			}else{
+				val = hf_sendack(peer, BENCH_PORT, buf, job->size, CH_DATA, ACK_TIMEOUT);
+				if (val == ERR_OK)
+					val = hf_recvack(&cpu, &port, buf, &size, CH_DATA);
+			}
+			if (val == ERR_OK)
+				bench_add(b, _readcounter() - t);
+		}else if (hf_cpuid() == peer){
+			if (job->test == PINGPONG){
+				hf_recv(&cpu, &port, buf, &size, CH_DATA);
+				hf_send(0, BENCH_PORT, buf, job->size, CH_DATA);
+			}else{
+				hf_recvack(&cpu, &port, buf, &size, CH_DATA);
+				hf_sendack(0, BENCH_PORT, buf, job->size, CH_DATA, ACK_TIMEOUT);
+			}
+		}
+	}
+}
+
+/* stream, all-to-all and hotspot: sends the messages of this core, and takes the ones to it */
+static void traffic(struct job *job, struct result *r)
+{
+	struct noc_stats stats;
+	uint16_t cpu, port, size, dest[MAX_CORES];
+	uint32_t start, last;
+	int32_t i, k, n = 0, senders = 0, self, val;
+
+	self = hf_cpuid();
+	switch (job->test){
+	case STREAM:
+	case STREAMACK:
+		if (self == job->cores - 1) dest[n++] = 0;
+		if (self == 0) senders = 1;
+		break;
+	case ALL2ALL:
+		for (k = 1; k < job->cores; k++)
+			dest[n++] = (self + k) % job->cores;
+		senders = job->cores - 1;
+		break;
+	case HOTSPOT:
+		if (self != 0) dest[n++] = 0;
+		if (self == 0) senders = job->cores - 1;
+		break;
+	}
+	r->expected = senders * MESSAGES * packets(job->size);
+
+	hf_noc_resetstats();
+	start = last = _readcounter();
+	if (job->test == STREAMACK){
+		for (i = 0; i < MESSAGES && n; i++){
+			val = hf_sendack(dest[0], BENCH_PORT, buf, job->size, CH_DATA, ACK_TIMEOUT);
+			if (val == ERR_OK) r->tx_msgs++;
+			last = _readcounter();
+		}
+		for (i = 0; i < MESSAGES && senders; i++){
+			val = hf_recvack(&cpu, &port, buf, &size, CH_DATA);
+			if (val == ERR_OK) r->rx_pkts += packets(size);
+			last = _readcounter();
+		}
+	}else{
+		for (i = 0; i < MESSAGES; i++){
+			for (k = 0; k < n; k++){
+				val = hf_send(dest[k], BENCH_PORT, buf, job->size, CH_DATA);
+				if (val == ERR_OK) r->tx_msgs++;
+				last = drain(r, _readcounter());
+			}
+		}
+		while (r->rx_pkts < r->expected && _readcounter() - last < QUIET)
+			last = drain(r, last);
+	}
+	r->cycles = last - start;
+
+	hf_noc_stats(&stats);
+	r->dropped = stats.drop_noc_full + stats.drop_task_full;
+}
+
+/* packets that came after the end of a test */
+static void flush(void)
+{
+	struct result r;
+
+	drain(&r, 0);
+}
+
+static uint32_t throughput(struct job *job, struct result *r)
+{
+	uint64_t bytes;
+
+	bytes = (uint64_t)r->rx_pkts * job->size / packets(job->size);
+
+	return r->cycles ? (uint32_t)(bytes * 1000 / r->cycles) : 0;
+}
+
+#if CPU_ID == 0
+static void run(int32_t test, int32_t size)
+{
+	struct job job;
+	struct result res[MAX_CORES], r;
+	struct bench b, loss;
+	int8_t name[32], req = 0;
+	uint16_t cpu, port, len;
+	int32_t k, val;
+
+	job.test = test;
+	job.size = size;
+	job.cores = hf_ncores() < MAX_CORES ? hf_ncores() : MAX_CORES;
+	val = hf_multicast(((1U << job.cores) - 1) & ~1U, BENCH_PORT, (int8_t *)&job, sizeof(job), CH_JOB);
+	if (val) printf("\nhf_multicast(): error %d", val);
+	if (test == END) return;
+
+	sprintf(name, "%s_%d", names[test], size);
+	bench_init(&b);
+	if (test == PINGPONG || test == PINGACK){
+		pingpong(&job, &b);
+		bench_print(name, &b);
+		return;
+	}
+
+	memset(&res[0], 0, sizeof(res[0]));
+	traffic(&job, &res[0]);
+	flush();
+	for (k = 1; k < job.cores; k++){
+		memset(&res[k], 0, sizeof(res[k]));
+		hf_send(k, BENCH_PORT, &req, sizeof(req), CH_PULL);
+		val = hf_recv(&cpu, &port, (int8_t *)&r, &len, CH_RESULT);
+		if (val == ERR_OK && cpu == k)
+			res[k] = r;
+		else
+			printf("\ncore %d, result: error %d", k, val);
+	}
+
+	bench_init(&loss);
+	for (k = 0; k < job.cores; k++){
+		printf("\nNOCBENCH %s %d %d %d %d %d %d %d", name, k, res[k].tx_msgs, res[k].rx_pkts, res[k].expected,
+			res[k].dropped, res[k].cycles, throughput(&job, &res[k]));
+		if (res[k].expected){
+			bench_add(&b, throughput(&job, &res[k]));
+			bench_add(&loss, res[k].rx_pkts < res[k].expected ?
+				(uint32_t)((uint64_t)(res[k].expected - res[k].rx_pkts) * 1000 / res[k].expected) : 0);
+		}
+	}
+	bench_print(name, &b);
+	strcat(name, "_loss");
+	bench_print(name, &loss);
+}
+
+void bench(void)
+{
+	static const int32_t ping[] = {16, 64, 256, 1024, 4096};
+	static const int32_t flood[] = {16, 256, 1024};
+	int32_t i, t;
+
+	if (hf_comm_create(hf_selfid(), BENCH_PORT, 0))
+		panic(0xff);
+
+	/* let the other cores create their ports */
+	hf_msleep(100);
+	printf("\nBENCH noc cores %d packet_size %d packet_slots %d cpu_speed %d", hf_ncores(), NOC_PACKET_SIZE, NOC_PACKET_SLOTS, CPU_SPEED);
+	if (hf_ncores() < 2){
+		printf("\nBENCH needs two or more cores");
+	}else{
+		for (t = PINGPONG; t <= PINGACK; t++)
+			for (i = 0; i < sizeof(ping) / sizeof(ping[0]); i++)
+				run(t, ping[i]);
+		for (t = STREAM; t <= HOTSPOT; t++)
+			for (i = 0; i < sizeof(flood) / sizeof(flood[0]); i++)
+				run(t, flood[i]);
+		run(END, 0);
+	}
+	printf("\nBENCH done\n");
+
+	for (;;)
+		hf_msleep(1000);
+}
+#else
+void bench(void)
+{
+	struct job job;
+	struct result r;
+	struct bench b;
+	uint16_t cpu, port, size;
+	int8_t req;
+	int32_t val;
+
+	if (hf_comm_create(hf_selfid(), BENCH_PORT, 0))
+		panic(0xff);
+
+	for (;;){
+		val = hf_recv(&cpu, &port, (int8_t *)&job, &size, CH_JOB);
+		if (val) continue;
+		if (job.test == END) break;
+		if (hf_cpuid() >= job.cores) continue;
+
+		if (job.test == PINGPONG || job.test == PINGACK){
+			pingpong(&job, &b);
+			continue;
+		}
+		memset(&r, 0, sizeof(r));
+		traffic(&job, &r);
+		/* late packets must not fill the ring before the pull comes */
+		while (hf_recvprobe(CH_PULL) <= 0)
+			flush();
+		hf_recv(&cpu, &port, &req, &size, CH_PULL);
+		hf_send(0, BENCH_PORT, (int8_t *)&r, sizeof(r), CH_RESULT);
+	}
+
+	for (;;)
+		hf_msleep(1000);
+}
+#endif
+
+void app_main(void)
+{
+	hf_spawn(bench, 0, 0, 0, "bench", 4096);
+}
@@ -18,7 +18,7 @@ void sender(void)
 				if (val) printf("sender, hf_sendack(): error %d\n", val);
 			}
 		}
-		delay_ms(10);
+		hf_msleep(10);
 	}
 }
 
@@ -56,7 +56,7 @@ void sender2(void)
 				if (val) printf("sender2, hf_sendack(): error %d\n", val);
 			}
 		}
-		delay_ms(10);
+		hf_msleep(10);
 	}
 }
 
@@ -0,0 +1,70 @@
+#include <hellfire.h>
+#include <noc.h>
+#include <rpc.h>
+#include <device.h>
+#include <block.h>
+#include <ramdisk.h>
+#include <nocdisk.h>
+#include <uhfs.h>
+
+/* core 0 keeps a ramdisk with a uhfs volume and serves it, the other cores mount it */
+
+struct device ramdisk0 = {ramdisk_open, ramdisk_read, ramdisk_write, ramdisk_close, ramdisk_ioctl, 0};
+struct device nocdisk0 = {nocdisk_open, nocdisk_read, nocdisk_write, nocdisk_close, nocdisk_ioctl, 0};
+
+void server(void)
+{
+	struct blk_info info;
+	struct file *fptr;
+	int8_t str[64];
+
+	hf_dev_ioctl(&ramdisk0, DISK_INIT, (void *)200);
+	hf_dev_ioctl(&ramdisk0, DISK_GETINFO, (void *)&info);
+	hf_mkfs(&ramdisk0, info.bytes_sector);
+	hf_mount(&ramdisk0);
+	hf_mkdir(&ramdisk0, "/shared");
+	fptr = hf_fopen(&ramdisk0, "/shared/hello.txt", "w");
+	sprintf(str, "hello from the storage core (cpu %d)", hf_cpuid());
+	hf_fwrite(str, 1, strlen(str) + 1, fptr);
+	hf_fclose(fptr);
+	hf_umount(&ramdisk0);
+
+	nocdisk_serve(&ramdisk0, 1000, 0);
+	panic(0xff);
+}
+
+void client(void)
+{
+	struct nocdisk_server srv = {0, 1000, 0, 0};
+	struct file *fptr;
+	int8_t str[64];
+
+	if (hf_comm_create(hf_selfid(), 2000, 0))
+		panic(0xff);
+	hf_msleep(100);
+	if (hf_dev_ioctl(&nocdisk0, DISK_INIT, (void *)&srv))
+		panic(0xff);
+	if (hf_mount(&nocdisk0))
+		panic(0xff);
+
+	while (1){
+		fptr = hf_fopen(&nocdisk0, "/shared/hello.txt", "r");
+		if (fptr){
+			memset(str, 0, sizeof(str));
+			hf_fread(str, 1, sizeof(str) - 1, fptr);
+			hf_fclose(fptr);
+			printf("cpu %d: %s\n", hf_cpuid(), str);
+		}else{
+			printf("cpu %d: can't open /shared/hello.txt\n", hf_cpuid());
+		}
+		hf_msleep(1000);
+	}
+}
+
+void app_main(void)
+{
+	if (hf_cpuid() == 0)
+		hf_spawn(server, 0, 0, 0, "server", 4096);
+	else
+		hf_spawn(client, 0, 0, 0, "client", 4096);
+}
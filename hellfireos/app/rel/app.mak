@@ -1,5 +1,15 @@
 APP_DIR = $(SRC_DIR)/$(APP)
+MODULE_DIR = $(SRC_DIR)/usr/module
 
-app: kernel
-	$(CC) $(CFLAGS) \
-		$(APP_DIR)/rel.c 
+# the module is compiled with the flags of the kernel, linked at address 0 with its
+# relocations (-q) and converted by mkmodule. the file is embedded on the image.
+module:
+	$(MAKE) -C $(MODULE_DIR) mkmodule
+	$(CC) $(CFLAGS) -o dynamic.mo $(APP_DIR)/dynamic.c
+	$(LD) -q --no-relax --unresolved-symbols=ignore-all -T $(MODULE_DIR)/module.ld -o dynamic.elf dynamic.mo
+	$(MODULE_DIR)/mkmodule -n dynamic dynamic.elf dynamic.hfm
+	xxd -i dynamic.hfm > dynamic_hfm.h
+
+app: kernel module
+	$(CC) $(CFLAGS) -I . \
+		$(APP_DIR)/rel.c
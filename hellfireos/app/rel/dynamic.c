@@ -1,9 +1,15 @@
-/* this code is compiled as position independent code */
+/*
+ * a loadable module (sys/kernel/module.c). it is linked at address 0, on its own, and the
+ * kernel functions it calls are imported by the loader. module_main() is the task body.
+ */
 
 #include <hellfire.h>
 
-void func(void){
-	while(1){
-		DEBUG_ADDR = (int32_t)'a';
+static int32_t count;
+
+void module_main(void){
+	for (;;){
+		printf("\nmodule %s (task %d), run %d, free memory: %d bytes", hf_selfname(), hf_selfid(), ++count, hf_freemem());
+		hf_msleep(500);
 	}
 }
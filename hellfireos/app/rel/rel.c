@@ -1,19 +1,31 @@
+/*
+ * loads the module of dynamic.c (converted by mkmodule and embedded on the image as
+ * dynamic_hfm[], see app.mak), spawns it as a best effort task, and unloads it after
+ * a while. the same module could come from a uhfs file (hf_module_fload()), UDP
+ * (hf_module_uudp()) or the NoC (hf_module_noc()).
+ */
+
 #include <hellfire.h>
+#include "dynamic_hfm.h"
 
-typedef void (*fpt)(void);
-/*
-void func(void){
-	while(1){
-		DEBUG_ADDR = (int32_t)'a';
+void loader(void){
+	struct module m;
+	int32_t val;
+
+	for (;;){
+		val = hf_module_load(&m, dynamic_hfm, dynamic_hfm_len);
+		if (val != ERR_OK){
+			printf("\nmodule load failed: %d", val);
+			hf_kill(hf_selfid());
+		}
+		printf("\nmodule %s loaded at %08x (%d bytes)", m.name, (uint32_t)m.base, m.size);
+		hf_module_spawn(&m, 0, 0, 0);
+		hf_msleep(3000);
+		printf("\nmodule %s unloaded: %d", m.name, hf_module_unload(&m));
+		hf_msleep(1000);
 	}
 }
-*/
 
 void app_main(void){
-	fpt function;
-	
-	function = (void *)malloc(5000);
-//	memcpy(function, func, 4000);
-	
-	hf_spawn(function, 0, 0, 0, "Consumer C", 1024);
+	hf_spawn(loader, 0, 0, 0, "loader", 2048);
 }
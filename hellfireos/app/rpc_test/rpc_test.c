@@ -0,0 +1,84 @@
+#include <hellfire.h>
+#include <noc.h>
+#include <rpc.h>
+
+#define PROC_ADD	0
+#define PROC_HELLO	1
+
+int32_t add(int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size)
+{
+	int32_t val[2];
+
+	if (size != sizeof(val)) return ERR_INVALID_PARAMETER;
+	memcpy(val, arg, sizeof(val));
+	val[0] += val[1];
+	memcpy(res, val, sizeof(int32_t));
+	*res_size = sizeof(int32_t);
+
+	return ERR_OK;
+}
+
+int32_t hello(int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size)
+{
+	sprintf(res, "hello from cpu %d", hf_cpuid());
+	*res_size = strlen(res) + 1;
+
+	return ERR_OK;
+}
+
+void server(void)
+{
+	struct rpc_server srv;
+	int32_t val;
+
+	if (hf_rpc_server(&srv, 1000, 0))
+		panic(0xff);
+	hf_rpc_register(&srv, PROC_ADD, add);
+	hf_rpc_register(&srv, PROC_HELLO, hello);
+
+	while (1){
+		val = hf_rpc_serve(&srv);
+		if (val) printf("server, hf_rpc_serve(): error %d\n", val);
+	}
+}
+
+void client(void)
+{
+	struct rpc_client c;
+	struct rpc_future f[8];
+	int32_t i, val, arg[2], sum[8];
+	int8_t buf[RPC_RES_SIZE];
+	uint16_t size;
+
+	if (hf_comm_create(hf_selfid(), 2000, 0))
+		panic(0xff);
+	if (hf_rpc_client(&c, 0, 1000, 0, 0))
+		panic(0xff);
+
+	while (1){
+		val = hf_rpc_call(&c, PROC_HELLO, NULL, 0, buf, &size);
+		if (val) printf("client, hf_rpc_call(): error %d\n", val);
+		else printf("%s (to cpu %d)\n", buf, hf_cpuid());
+
+		/* eight calls outstanding at once, batched several per packet */
+		for (i = 0; i < 8; i++){
+			arg[0] = i;
+			arg[1] = hf_cpuid() * 100;
+			hf_rpc_call_async(&c, PROC_ADD, (int8_t *)arg, sizeof(arg), (int8_t *)&sum[i], sizeof(int32_t), &f[i]);
+		}
+		for (i = 0; i < 8; i++){
+			val = hf_rpc_wait(&c, &f[i]);
+			if (val || sum[i] != i + hf_cpuid() * 100)
+				printf("client, add %d: error %d\n", i, val);
+		}
+		hf_msleep(10);
+	}
+}
+
+void app_main(void)
+{
+	if (hf_cpuid() == 0)
+		hf_spawn(server, 0, 0, 0, "server", 4096);
+	else
+		hf_spawn(client, 0, 0, 0, "client", 4096);
+}
@@ -0,0 +1,210 @@
+/*
+scheduler and synchronization microbenchmarks. all figures are in processor
+cycles (_readcounter()), and each test prints one line:
+
+BENCH <test> <samples> <min> <avg> <max>
+
+run with KERNEL_LOG = 0. the min column is the most repeatable one, as periodic
+tasks and interrupts may inflate some samples.
+*/
+
+#include <hellfire.h>
+#include <bench.h>
+
+#define SAMPLES		100
+
+sem_t ping, pong;
+mutex_t m;
+volatile int32_t stop;
+
+static void sleep_ticks(uint32_t ticks)
+{
+	hf_delay(hf_selfid(), ticks);
+	hf_yield();
+}
+
+/* stops the helper tasks of a test and waits for them to finish */
+static void stop_helpers(int8_t *name)
+{
+	stop = 1;
+	while (hf_id(name) >= 0)
+		sleep_ticks(1);
+}
+
+void yielder(void)
+{
+	while (!stop)
+		hf_yield();
+	hf_kill(hf_selfid());
+}
+
+void spinner(void)
+{
+	while (!stop);
+	hf_kill(hf_selfid());
+}
+
+void ponger(void)
+{
+	for (;;){
+		hf_semwait(&ping);
+		if (stop) break;
+		hf_sempost(&pong);
+	}
+	hf_kill(hf_selfid());
+}
+
+void holder(void)
+{
+	while (!stop){
+		hf_mtxlock(&m);
+		hf_yield();
+		hf_mtxunlock(&m);
+		hf_yield();
+	}
+	hf_kill(hf_selfid());
+}
+
+void empty(void)
+{
+	for (;;);
+}
+
+/* hf_yield() round trip, switching to another task and back */
+static void bench_yield(void)
+{
+	struct bench b;
+	uint32_t t, i;
+
+	bench_init(&b);
+	stop = 0;
+	hf_spawn(yielder, 0, 0, 0, "yielder", 1024);
+	hf_yield();
+	for (i = 0; i < SAMPLES; i++){
+		t = _readcounter();
+		hf_yield();
+		bench_add(&b, _readcounter() - t);
+	}
+	stop_helpers("yielder");
+	bench_print("yield_roundtrip", &b);
+}
+
+/* dispatcher cost per preemption, with n other tasks spinning */
+static void bench_tick(int32_t n, int8_t *name)
+{
+	struct bench b;
+	uint32_t cs, i;
+	uint64_t cycles;
+
+	bench_init(&b);
+	stop = 0;
+	for (i = 0; i < n; i++)
+		hf_spawn(spinner, 0, 0, 0, "spinner", 1024);
+	for (i = 0; i < SAMPLES / 10; i++){
+		cs = krnl_pcb.preempt_cswitch;
+		cycles = hf_schedtime();
+		sleep_ticks(10);
+		if (krnl_pcb.preempt_cswitch != cs)
+			bench_add(&b, (uint32_t)((hf_schedtime() - cycles) / (krnl_pcb.preempt_cswitch - cs)));
+	}
+	stop_helpers("spinner");
+	bench_print(name, &b);
+}
+
+/* semaphore ping-pong, post + wait round trip between two tasks */
+static void bench_sem(void)
+{
+	struct bench b;
+	uint32_t t, i;
+
+	bench_init(&b);
+	stop = 0;
+	hf_seminit(&ping, 0);
+	hf_seminit(&pong, 0);
+	hf_spawn(ponger, 0, 0, 0, "ponger", 1024);
+	for (i = 0; i < SAMPLES; i++){
+		t = _readcounter();
+		hf_sempost(&ping);
+		hf_semwait(&pong);
+		bench_add(&b, _readcounter() - t);
+	}
+	stop = 1;
+	hf_sempost(&ping);
+	stop_helpers("ponger");
+	bench_print("sem_pingpong", &b);
+}
+
+/* mutex lock + unlock, uncontended and contended */
+static void bench_mutex(void)
+{
+	struct bench b;
+	uint32_t t, i;
+
+	hf_mtxinit(&m);
+	bench_init(&b);
+	for (i = 0; i < SAMPLES; i++){
+		t = _readcounter();
+		hf_mtxlock(&m);
+		hf_mtxunlock(&m);
+		bench_add(&b, _readcounter() - t);
+	}
+	bench_print("mutex_uncontended", &b);
+
+	bench_init(&b);
+	stop = 0;
+	hf_spawn(holder, 0, 0, 0, "holder", 1024);
+	hf_yield();
+	for (i = 0; i < SAMPLES; i++){
+		t = _readcounter();
+		hf_mtxlock(&m);
+		hf_mtxunlock(&m);
+		bench_add(&b, _readcounter() - t);
+		hf_yield();
+	}
+	stop_helpers("holder");
+	bench_print("mutex_contended", &b);
+}
+
+/* hf_spawn() and hf_kill() of a best effort task */
+static void bench_spawn(void)
+{
+	struct bench bs, bk;
+	uint32_t t, i;
+	int32_t id;
+
+	bench_init(&bs);
+	bench_init(&bk);
+	for (i = 0; i < SAMPLES; i++){
+		t = _readcounter();
+		id = hf_spawn(empty, 0, 0, 0, "empty", 1024);
+		bench_add(&bs, _readcounter() - t);
+		if (id < 0) break;
+		t = _readcounter();
+		hf_kill(id);
+		bench_add(&bk, _readcounter() - t);
+	}
+	bench_print("spawn", &bs);
+	bench_print("kill", &bk);
+}
+
+void bench(void)
+{
+	printf("\nBENCH arch %s mutex_type %d mem_alloc %d cpu_speed %d", CPU_ARCH, MUTEX_TYPE, MEM_ALLOC, CPU_SPEED);
+	bench_yield();
+	bench_tick(0, "tick_0_tasks");
+	bench_tick(4, "tick_4_tasks");
+	bench_tick(8, "tick_8_tasks");
+	bench_tick(16, "tick_16_tasks");
+	bench_sem();
+	bench_mutex();
+	bench_spawn();
+	printf("\nBENCH done\n");
+
+	for (;;)
+		sleep_ticks(100);
+}
+
+void app_main(void)
+{
+	hf_spawn(bench, 0, 0, 0, "bench", 2048);
+}
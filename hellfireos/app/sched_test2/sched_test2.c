@@ -1,13 +1,12 @@
 #include <hellfire.h>
 
 void task(void){
-	int32_t jobs, id;
+	int32_t id;
 
 	id = hf_selfid();
 	for(;;){
-		jobs = hf_jobs(id);
 		printf("\n%s (%d)[%d][%d]", hf_selfname(), id, hf_jobs(id), hf_dlm(id));
-		while (jobs == hf_jobs(id));
+		hf_waitperiod();
 	}
 }
 
@@ -0,0 +1,63 @@
+#include <hellfire.h>
+
+/*
+timed waits and hf_delay(): a task blocked on a timed wait can't be delayed (its
+delay is the timeout of the wait), so hf_delay() fails and the wait goes on as if
+nothing happened, ending when the semaphore is signaled or the wait times out.
+*/
+
+sem_t s;
+mutex_t m;
+cond_t c;
+int32_t waiter_id, results[3];
+volatile int32_t round;
+
+void waiter(void){
+	results[0] = hf_semwait_timeout(&s, 200);
+	round = 1;
+	results[1] = hf_semwait_timeout(&s, 50);
+	round = 2;
+	hf_mtxlock(&m);
+	results[2] = hf_condwait_timeout(&c, &m, 200);
+	hf_mtxunlock(&m);
+	round = 3;
+	for(;;);
+}
+
+void check(int8_t *what, int32_t val, int32_t expected){
+	printf("\n%s: %d (expected %d) %s", what, val, expected, val == expected ? "PASS" : "FAIL");
+}
+
+void controller(void){
+	hf_msleep(20);
+	check("delay of a task on hf_semwait_timeout()", hf_delay(waiter_id, 10), ERR_ERROR);
+	hf_sempost(&s);
+	while (round < 1);
+	check("hf_semwait_timeout(), signaled", results[0], ERR_OK);
+
+	hf_msleep(10);
+	check("delay of a task on hf_semwait_timeout()", hf_delay(waiter_id, 1000), ERR_ERROR);
+	while (round < 2);
+	check("hf_semwait_timeout(), timed out", results[1], ERR_TIMEOUT);
+
+	hf_msleep(20);
+	check("delay of a task on hf_condwait_timeout()", hf_delay(waiter_id, 10), ERR_ERROR);
+	hf_mtxlock(&m);
+	hf_condsignal(&c);
+	hf_mtxunlock(&m);
+	while (round < 3);
+	check("hf_condwait_timeout(), signaled", results[2], ERR_OK);
+
+	check("semaphore count", s.count, 0);
+	printf("\ndone");
+	for(;;);
+}
+
+void app_main(void){
+	hf_seminit(&s, 0);
+	hf_mtxinit(&m);
+	hf_condinit(&c);
+
+	waiter_id = hf_spawn(waiter, 0, 0, 0, "waiter", 1024);
+	hf_spawn(controller, 0, 0, 0, "controller", 1024);
+}
@@ -12,7 +12,7 @@ void test(void){
 		for (i = 0; i < 10; i++)
 			buf[i] = spi_sendrecv(buf[i]);
 		spi_stop();
-		delay_ms(1);
+		hf_msleep(1);
 	}
 }
 
@@ -0,0 +1,247 @@
+/*
+file system (uhfs) microbenchmarks, on the ramdisk. all figures are in processor
+cycles (_readcounter()) per operation, and each test prints one line:
+
+BENCH <test> <samples> <min> <avg> <max>
+
+the benchmark runs from app_main(), before the scheduler is started, so samples are
+not inflated by other tasks. read / write throughput is the block size over the avg
+column of the seq_* and rand_* tests (one block per operation).
+*/
+
+#include <hellfire.h>
+#include <bench.h>
+#include <device.h>
+#include <block.h>
+#include <ramdisk.h>
+#include <uhfs.h>
+
+#define DISK_SECTORS	1024
+#define SAMPLES		100
+#define DIRS		128
+#define DEPTH		8
+#define FILE_BLOCKS	64
+
+struct device ramdisk0 = {ramdisk_open, ramdisk_read, ramdisk_write, ramdisk_close, ramdisk_ioctl, 0};
+uint32_t blk_size;
+int8_t *blk;
+
+/* a new, empty volume */
+static void volume(void)
+{
+	hf_umount(&ramdisk0);
+	hf_mkfs(&ramdisk0, blk_size);
+	hf_mount(&ramdisk0);
+}
+
+/* hf_mkdir() of the entries of a directory, as it grows */
+static void bench_mkdir(void)
+{
+	struct bench b;
+	uint32_t t, i;
+	int8_t path[32];
+
+	volume();
+	bench_init(&b);
+	hf_mkdir(&ramdisk0, "/m");
+	for (i = 0; i < DIRS; i++){
+		sprintf(path, "/m/d%d", i);
+		t = _readcounter();
+		if (hf_mkdir(&ramdisk0, path)) break;
+		bench_add(&b, _readcounter() - t);
+	}
+	bench_print("mkdir", &b);
+}
+
+/* path lookup (hf_size() of a file) at depths 1 to DEPTH */
+static void bench_lookup(void)
+{
+	struct bench b;
+	struct file *fp;
+	uint32_t t, i, d;
+	int8_t path[DEPTH * 4 + 8], name[DEPTH * 4 + 8];
+
+	volume();
+	path[0] = '\0';
+	for (d = 1; d <= DEPTH; d++){
+		sprintf(name, "%s/f", path);
+		fp = hf_fopen(&ramdisk0, name, "w");
+		if (fp) hf_fclose(fp);
+		strcpy(name, path);
+		sprintf(path, "%s/l%d", name, d);
+		hf_mkdir(&ramdisk0, path);
+	}
+
+	path[0] = '\0';
+	for (d = 1; d <= DEPTH; d++){
+		bench_init(&b);
+		sprintf(name, "%s/f", path);
+		for (i = 0; i < SAMPLES; i++){
+			t = _readcounter();
+			if (hf_size(&ramdisk0, name) < 0) break;
+			bench_add(&b, _readcounter() - t);
+		}
+		sprintf(name, "lookup_depth_%d", d);
+		bench_print(name, &b);
+		strcpy(name, path);
+		sprintf(path, "%s/l%d", name, d);
+	}
+}
+
+/* hf_readdir() per entry, over a directory of DIRS entries (left by bench_mkdir()) */
+static void bench_readdir(void)
+{
+	struct bench b;
+	struct file *fp;
+	struct fs_direntry entry;
+	uint32_t t, i;
+	int32_t err;
+
+	bench_init(&b);
+	for (i = 0; i < SAMPLES / 10; i++){
+		fp = hf_opendir(&ramdisk0, "/m/.");
+		if (!fp) break;
+		for (;;){
+			t = _readcounter();
+			err = hf_readdir(fp, &entry);
+			if (err) break;
+			bench_add(&b, _readcounter() - t);
+		}
+		hf_closedir(fp);
+	}
+	bench_print("readdir_entry", &b);
+}
+
+/* block allocation, writing whole blocks to a new file */
+static void bench_alloc(int8_t *path, int8_t *name)
+{
+	struct bench b;
+	struct file *fp;
+	uint32_t t, i;
+
+	bench_init(&b);
+	fp = hf_fopen(&ramdisk0, path, "w");
+	if (fp){
+		for (i = 0; i < SAMPLES; i++){
+			t = _readcounter();
+			if (hf_fwrite(blk, 1, blk_size, fp) != blk_size) break;
+			bench_add(&b, _readcounter() - t);
+		}
+		hf_fclose(fp);
+	}
+	bench_print(name, &b);
+}
+
+/* fill the volume with blocks of two files, in turns, until left blocks are free */
+static void fill(int8_t *path1, int8_t *path2, int32_t left)
+{
+	struct file *fp1, *fp2;
+
+	fp1 = hf_fopen(&ramdisk0, path1, "w");
+	fp2 = path2 ? hf_fopen(&ramdisk0, path2, "w") : NULL;
+	while (fp1 && hf_getfree(&ramdisk0) > left){
+		if (hf_fwrite(blk, 1, blk_size, fp1) != blk_size) break;
+		if (fp2 && hf_getfree(&ramdisk0) > left)
+			if (hf_fwrite(blk, 1, blk_size, fp2) != blk_size) break;
+	}
+	if (fp2) hf_fclose(fp2);
+	if (fp1) hf_fclose(fp1);
+}
+
+/*
+ * allocation on an empty volume, and on a nearly full one, where the free blocks are
+ * scattered: the volume is filled by two files in turns, one of them is removed and
+ * the holes are filled again, leaving SAMPLES free blocks.
+ */
+static void bench_alloc_full(void)
+{
+	volume();
+	bench_alloc("/a", "alloc_empty");
+
+	volume();
+	fill("/f1", "/f2", 0);
+	hf_unlink(&ramdisk0, "/f2");
+	fill("/f3", NULL, SAMPLES);
+	bench_alloc("/a", "alloc_full");
+}
+
+/* sequential and random reads and writes, one block per operation */
+static void bench_rw(void)
+{
+	struct bench b;
+	struct file *fp;
+	uint32_t t, i;
+
+	volume();
+	fp = hf_fopen(&ramdisk0, "/seq", "w+");
+	if (!fp){
+		printf("\nBENCH rw: can't create file");
+		return;
+	}
+
+	bench_init(&b);
+	for (i = 0; i < FILE_BLOCKS; i++){
+		t = _readcounter();
+		if (hf_fwrite(blk, 1, blk_size, fp) != blk_size) break;
+		bench_add(&b, _readcounter() - t);
+	}
+	bench_print("seq_write", &b);
+	hf_sync(&ramdisk0);
+
+	bench_init(&b);
+	hf_fseek(fp, 0, SEEK_SET);
+	for (i = 0; i < FILE_BLOCKS; i++){
+		t = _readcounter();
+		if (hf_fread(blk, 1, blk_size, fp) != blk_size) break;
+		bench_add(&b, _readcounter() - t);
+	}
+	bench_print("seq_read", &b);
+
+	srand(FILE_BLOCKS);
+	bench_init(&b);
+	for (i = 0; i < SAMPLES; i++){
+		t = _readcounter();
+		hf_fseek(fp, (int64_t)(random() % FILE_BLOCKS) * blk_size, SEEK_SET);
+		if (hf_fwrite(blk, 1, blk_size, fp) != blk_size) break;
+		bench_add(&b, _readcounter() - t);
+	}
+	bench_print("rand_write", &b);
+	hf_sync(&ramdisk0);
+
+	bench_init(&b);
+	for (i = 0; i < SAMPLES; i++){
+		t = _readcounter();
+		hf_fseek(fp, (int64_t)(random() % FILE_BLOCKS) * blk_size, SEEK_SET);
+		if (hf_fread(blk, 1, blk_size, fp) != blk_size) break;
+		bench_add(&b, _readcounter() - t);
+	}
+	bench_print("rand_read", &b);
+	hf_fclose(fp);
+}
+
+void app_main(void)
+{
+	struct blk_info info;
+
+	hf_dev_ioctl(&ramdisk0, DISK_INIT, (void *)DISK_SECTORS);
+	hf_dev_ioctl(&ramdisk0, DISK_GETINFO, (void *)&info);
+	blk_size = info.bytes_sector;
+	blk = hf_malloc(blk_size);
+	if (!blk){
+		printf("\nBENCH out of memory");
+		return;
+	}
+	memset(blk, 0x55, blk_size);
+
+	printf("\nBENCH uhfs blk_size %d disk_sectors %d cache_blocks %d", blk_size, DISK_SECTORS, UHFS_CACHE_BLOCKS);
+	bench_mkdir();
+	bench_readdir();
+	bench_lookup();
+	bench_alloc_full();
+	bench_rw();
+	printf("\nBENCH done\n");
+
+	hf_umount(&ramdisk0);
+	hf_dev_ioctl(&ramdisk0, DISK_FINISH, 0);
+	hf_free(blk);
+}
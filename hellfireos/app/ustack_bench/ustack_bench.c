@@ -0,0 +1,200 @@
+/*
+UDP benchmark of the ustack, driven by a host load generator (usr/bench/udp_load.c).
+
+port 30100 (echo)	datagrams are sent back to their source
+port 30101 (sink)	datagrams are counted and dropped
+port 30102 (control)	text commands, answered to the sender:
+	reset			clears the figures of the stack and of the benchmark
+	stats			the figures, one line each (see below)
+	tx <count> <size>	sends count datagrams of size bytes to the sender (source test),
+				each starting with its sequence number (4 bytes, big endian), and
+				answers "done <sent> <cycles>"
+
+figures are in processor cycles (_readcounter()):
+
+BENCH <layer> <frames> <min> <avg> <max>	per frame, on each layer (build with USTACK_STATS=1)
+BENCH udp_send <datagrams> <min> <avg> <max>	hf_uudp_send() on the echo and source tests
+SINK <datagrams> <bytes> <cycles>		received by the sink, cycles from the first to the last
+*/
+
+#include <hellfire.h>
+#include <bench.h>
+#include <ustack.h>
+#include <uudp.h>
+
+#define ECHO_PORT	30100
+#define SINK_PORT	30101
+#define CTRL_PORT	30102
+#define QUEUE		8
+#define DATA_SIZE	(PACKET_SIZE - PBUF_HEADROOM)
+
+struct uudp echo_comm, sink_comm, ctrl_comm;
+struct bench send_bench;
+uint32_t sink_count, sink_bytes, sink_first, sink_last;
+
+static int8_t *bench_line(int8_t *p, const int8_t *name, uint32_t n, uint32_t min, uint32_t avg, uint32_t max)
+{
+	sprintf(p, "BENCH %s %d %d %d %d\n", name, n, n ? min : 0, avg, max);
+
+	return p + strlen(p);
+}
+
+/* sends and times a datagram */
+static int32_t timed_send(struct uudp *comm, uint8_t ip[4], uint16_t port, uint8_t *buf, uint16_t len)
+{
+	uint32_t time, status;
+	int32_t val;
+
+	time = _readcounter();
+	val = hf_uudp_send(comm, ip, port, buf, len);
+	time = _readcounter() - time;
+	status = _di();
+	bench_add(&send_bench, time);
+	_ei(status);
+
+	return val;
+}
+
+static void reset(void)
+{
+	ustack_resetstats();
+	bench_init(&send_bench);
+	sink_count = 0;
+	sink_bytes = 0;
+}
+
+static uint16_t stats(int8_t *buf)
+{
+	struct ustack_stat *s;
+	int8_t *p = buf;
+	int32_t i;
+
+	for (i = 0; i < USTACK_STAT_LAYERS; i++){
+		s = &ustack_stats[i];
+		p = bench_line(p, ustack_stat_names[i], s->count, s->min, s->count ? (uint32_t)(s->cycles / s->count) : 0, s->max);
+	}
+	p = bench_line(p, "udp_send", send_bench.n, send_bench.min, bench_avg(&send_bench), send_bench.max);
+	sprintf(p, "SINK %d %d %d\n", sink_count, sink_bytes, sink_count > 1 ? sink_last - sink_first : 0);
+
+	return strlen(buf);
+}
+
+void echo(void)
+{
+	uint8_t ip[4];
+	uint16_t port;
+	int32_t len;
+	uint8_t *buf;
+
+	buf = hf_malloc(DATA_SIZE);
+	if (!buf){
+		printf("\nerror creating buffer");
+		for (;;);
+	}
+
+	while (1){
+		len = hf_uudp_recvwait(&echo_comm, ip, &port, buf, DATA_SIZE);
+		if (len >= 0)
+			timed_send(&echo_comm, ip, port, buf, len);
+	}
+}
+
+void sink(void)
+{
+	uint8_t ip[4];
+	uint16_t port;
+	int32_t len;
+	uint8_t *buf;
+
+	buf = hf_malloc(DATA_SIZE);
+	if (!buf){
+		printf("\nerror creating buffer");
+		for (;;);
+	}
+
+	while (1){
+		len = hf_uudp_recvwait(&sink_comm, ip, &port, buf, DATA_SIZE);
+		if (len < 0) continue;
+		sink_last = _readcounter();
+		if (sink_count++ == 0)
+			sink_first = sink_last;
+		sink_bytes += len;
+	}
+}
+
+/* source test: count datagrams of size bytes, as fast as the stack takes them */
+static uint16_t source(uint8_t ip[4], uint16_t port, int8_t *args, uint8_t *buf)
+{
+	int8_t *end;
+	uint32_t count, size, i, sent = 0, time;
+
+	count = strtol(args, &end, 10);
+	size = strtol(end, &end, 10);
+	if (size < 4) size = 4;
+	if (size > DATA_SIZE) size = DATA_SIZE;
+	memset(buf, 0, size);
+
+	time = _readcounter();
+	for (i = 0; i < count; i++){
+		buf[0] = i >> 24; buf[1] = i >> 16; buf[2] = i >> 8; buf[3] = i;
+		if (timed_send(&ctrl_comm, ip, port, buf, size) > 0)
+			sent++;
+	}
+	time = _readcounter() - time;
+	sprintf((int8_t *)buf, "done %d %d\n", sent, time);
+
+	return strlen((int8_t *)buf);
+}
+
+void control(void)
+{
+	uint8_t ip[4];
+	uint16_t port, len;
+	int32_t val;
+	int8_t *cmd;
+	uint8_t *buf;
+
+	cmd = hf_malloc(DATA_SIZE + 1);
+	buf = hf_malloc(DATA_SIZE);
+	if (!cmd || !buf){
+		printf("\nerror creating buffer");
+		for (;;);
+	}
+
+	while (1){
+		val = hf_uudp_recvwait(&ctrl_comm, ip, &port, (uint8_t *)cmd, DATA_SIZE);
+		if (val < 0) continue;
+		cmd[val] = '\0';
+		if (val > 0 && cmd[val - 1] == '\n')
+			cmd[val - 1] = '\0';
+
+		if (!strcmp(cmd, "reset")){
+			reset();
+			strcpy((int8_t *)buf, "ok\n");
+			len = 3;
+		}else if (!strcmp(cmd, "stats")){
+			len = stats((int8_t *)buf);
+		}else if (!strncmp(cmd, "tx ", 3)){
+			len = source(ip, port, cmd + 3, buf);
+		}else{
+			strcpy((int8_t *)buf, "unknown command\n");
+			len = strlen((int8_t *)buf);
+		}
+		hf_uudp_send(&ctrl_comm, ip, port, buf, len);
+	}
+}
+
+void app_main(void)
+{
+	if (hf_uudp_create(&echo_comm, ECHO_PORT, QUEUE) || hf_uudp_create(&sink_comm, SINK_PORT, QUEUE) ||
+	    hf_uudp_create(&ctrl_comm, CTRL_PORT, QUEUE)){
+		printf("\nerror creating comm");
+		for (;;);
+	}
+	reset();
+	printf("\nustack benchmark: echo %d, sink %d, control %d (USTACK_STATS %d)", ECHO_PORT, SINK_PORT, CTRL_PORT, USTACK_STATS);
+
+	hf_spawn(echo, 0, 0, 0, "echo", 2048);
+	hf_spawn(sink, 0, 0, 0, "sink", 2048);
+	hf_spawn(control, 0, 0, 0, "control", 2048);
+}
@@ -11,13 +11,13 @@ void task(void){
 	
 	udp_set_callback(udp_callback);
 	
-	delay_ms(4000);
+	hf_msleep(4000);
 	while(1){
 		printf("\nsending packet..");
 		memset(frame_out + ETH_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE, 0xaa, 200 + ETH_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE);
 		bytes = udp_out(addr, 666, 777, frame_out + ETH_HEADER_SIZE, 200 + UDP_HEADER_SIZE);
 		if (!bytes) printf("nothing sent. maybe an ARP request was needed?");
-		delay_ms(2000);
+		hf_msleep(2000);
 	}
 }
 
@@ -0,0 +1,37 @@
+#include <hellfire.h>
+#include <ustack.h>
+
+/* echo server
+ * 
+ * i will echo back anything sent to port 7000, one connection at a time.
+ * 
+ * try me:
+ * nc 192.168.5.10 7000
+ */
+void echo_server(void)
+{
+	uint8_t buf[512];
+	int32_t l, c, len;
+	
+	l = hf_tcp_listen(7000);
+	if (l < 0){
+		printf("\nerror creating listening connection");
+		for (;;);
+	}
+	
+	while(1){
+		c = hf_tcp_accept(l);
+		if (c < 0)
+			continue;
+		printf("\nconnection %d accepted", c);
+		while ((len = hf_tcp_recv(c, buf, sizeof(buf))) > 0)
+			hf_tcp_send(c, buf, len);
+		hf_tcp_close(c);
+		printf("\nconnection %d closed", c);
+	}
+}
+
+void app_main(void)
+{
+	hf_spawn(echo_server, 0, 0, 0, "echo_server", 2048);
+}
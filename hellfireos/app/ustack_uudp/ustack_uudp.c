@@ -15,7 +15,8 @@ void sendrecv(void)
 {
 	struct uudp uudp_comm;
 	uint8_t src_addr[4];
-	uint16_t port, len;
+	uint16_t port;
+	int32_t len;
 	uint8_t *buf;
 	uint8_t dst_addr[4] = {192, 168, 5, 2};
 	uint8_t message[] = "hello world!";
@@ -42,8 +43,8 @@ void sendrecv(void)
 			hf_uudp_send(&uudp_comm, dst_addr, 8855, message, sizeof(message));
 			time = _readcounter();
 		}
-		len = hf_uudp_recv(&uudp_comm, src_addr, &port, buf);
-		if (len){
+		len = hf_uudp_recv_timeout(&uudp_comm, src_addr, &port, buf, PACKET_SIZE, 100);
+		if (len > 0){
 			printf("\n(%d) from %d.%d.%d.%d, port %d: %s", len, src_addr[0], src_addr[1], src_addr[2], src_addr[3], port, buf);
 		}
 	}
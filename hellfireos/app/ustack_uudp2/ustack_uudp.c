@@ -17,7 +17,7 @@ void task_sender(void){
 		time = _read_us();
 		sprintf((int8_t *)message, "\nsystem uptime: %d hours (%d.%d seconds), sending packet #%d", (uint32_t)(time/1000000) / 3600, (uint32_t)(time/1000000), (uint32_t)((time/1000) - (time/1000000) * 1000), pkt++);
 		hf_uudp_send(&uudp_comm, dst_addr, 8855, message, strlen((int8_t *)message));
-		delay_ms(1000);
+		hf_msleep(1000);
 	}
 }
 
@@ -27,7 +27,8 @@ void task_sender(void){
  */
 void task_receiver(void){
 	uint8_t src_addr[4];
-	uint16_t port, len;
+	uint16_t port;
+	int32_t len;
 	uint8_t *buf;
 	
 	buf = hf_malloc(PACKET_SIZE);
@@ -37,8 +38,8 @@ void task_receiver(void){
 	}
 	
 	while(1){
-		len = hf_uudp_recv(&uudp_comm, src_addr, &port, buf);
-		if (len){
+		len = hf_uudp_recvwait(&uudp_comm, src_addr, &port, buf, PACKET_SIZE);
+		if (len > 0){
 			printf("\n(%d) from %d.%d.%d.%d, port %d: %s", len, src_addr[0], src_addr[1], src_addr[2], src_addr[3], port, buf);
 		}
 	}
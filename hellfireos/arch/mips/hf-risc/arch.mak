@@ -4,10 +4,19 @@ INC_DIRS  = -I $(ARCH_DIR)/include
 
 F_CLK=25000000
 TIME_SLICE=0
+# tickless idle (requires TIME_SLICE != 0)
+TICKLESS=0
+# nested device interrupts, by priority (higher IRQ bit first)
+IRQ_NESTING=0
+# buffered console, UART transmission ring size (power of 2, 0 polls the UART)
+UART_TXBUF=1024
+# full console ring: 0 waits for room, 1 drops characters
+UART_TXDROP=0
 
 CFLAGS_FEW_REGS = -ffixed-t0 -ffixed-t1 -ffixed-t2 -ffixed-t3 -ffixed-t4 -ffixed-t5 -ffixed-t6 -ffixed-t7 -ffixed-s0 -ffixed-s1 -ffixed-s2 -ffixed-s3 -ffixed-s4 -ffixed-s5 -ffixed-s6 -ffixed-s7
-CFLAGS_NO_HW_MULDIV = -mnohwmult -mnohwdiv -ffixed-lo -ffixed-hi
-CFLAGS_NO_HW_DIV = -mnohwdiv
+# cores without multiplier / divider (NO_HW_MUL / NO_HW_DIV select the libc helpers)
+CFLAGS_NO_HW_MULDIV = -mnohwmult -mnohwdiv -ffixed-lo -ffixed-hi -DNO_HW_MUL -DNO_HW_DIV
+CFLAGS_NO_HW_DIV = -mnohwdiv -DNO_HW_DIV
 #remove unreferenced functions
 CFLAGS_STRIP = -fdata-sections -ffunction-sections
 LDFLAGS_STRIP = --gc-sections
@@ -15,7 +24,7 @@ LDFLAGS_STRIP = --gc-sections
 # this is stuff used everywhere - compiler and flags should be declared (ASFLAGS, CFLAGS, LDFLAGS, LINKER_SCRIPT, CC, AS, LD, DUMP, READ, OBJ and SIZE).
 # remember the kernel, as well as the application, will be compiled using the *same* compiler and flags!
 ASFLAGS = -mips1 -msoft-float
-CFLAGS = -Wall -O2 -c -mips2 -mno-branch-likely -mpatfree -mfix-r4000 -mno-check-zero-division -msoft-float -fshort-double -ffreestanding -nostdlib -fomit-frame-pointer -G 0 $(INC_DIRS) -DCPU_SPEED=${F_CLK} -DTIME_SLICE=${TIME_SLICE} -DBIG_ENDIAN $(CFLAGS_NO_HW_MULDIV) -DKERN_VER=\"$(KERNEL_VER)\" $(CFLAGS_STRIP) #-DDEBUG_PORT # -mips2 -mno-branch-likely
+CFLAGS = -Wall -O2 -c -mips2 -mno-branch-likely -mpatfree -mfix-r4000 -mno-check-zero-division -msoft-float -fshort-double -ffreestanding -nostdlib -fomit-frame-pointer -G 0 $(INC_DIRS) -DCPU_SPEED=${F_CLK} -DTIME_SLICE=${TIME_SLICE} -DTICKLESS=${TICKLESS} -DIRQ_NESTING=${IRQ_NESTING} -DUART_TXBUF=${UART_TXBUF} -DUART_TXDROP=${UART_TXDROP} -DBIG_ENDIAN $(CFLAGS_NO_HW_MULDIV) -DKERN_VER=\"$(KERNEL_VER)\" $(CFLAGS_STRIP) #-DDEBUG_PORT # -mips2 -mno-branch-likely
 LDFLAGS = -mips1 $(LDFLAGS_STRIP)
 LINKER_SCRIPT = $(ARCH_DIR)/hf-risc.ld
 
@@ -32,4 +41,5 @@ hal:
 	$(CC) $(CFLAGS) \
 		$(ARCH_DIR)/drivers/interrupt.c \
 		$(ARCH_DIR)/drivers/hal.c \
-		$(ARCH_DIR)/drivers/eth_enc28j60.c
+		$(ARCH_DIR)/drivers/eth_enc28j60.c \
+		$(ARCH_DIR)/drivers/eth_vnic.c
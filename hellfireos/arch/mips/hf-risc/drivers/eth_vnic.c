@@ -0,0 +1,107 @@
+/*
+ * virtual Ethernet interface of the simulators (usr/sim, -n tap_device or -N in.pcap).
+ * takes the place of the ENC28J60 driver (drivers/spi/enc28j60.c) on builds with USTACK_VNIC,
+ * so the network stack runs on the simulator at host speed. the device moves whole frames
+ * between memory and the host on a command, and never interrupts: the network service polls
+ * it (USTACK_IRQ 0).
+ */
+#include <hellfire.h>
+
+#if defined(USTACK) && defined(USTACK_VNIC)
+#include <ustack.h>
+
+#define VNIC_TX			1
+#define VNIC_RX			2
+#define VNIC_PRESENT		1
+#define VNIC_FRAMELEN		1518
+#define VNIC_RX_FRAMES		4
+
+static uint8_t *vnic_ring[VNIC_RX_FRAMES];
+static int32_t vnic_rings;
+static mutex_t vnic_lock;
+
+int32_t en_init()
+{
+	uint32_t mac;
+
+	if (!(NIC_STATUS & VNIC_PRESENT)){
+		kprintf("\nHAL: virtual Ethernet interface, no backend on the simulator");
+		return 0;
+	}
+	mac = NIC_MAC0;
+	mymac[0] = mac; mymac[1] = mac >> 8;
+	mymac[2] = mac >> 16; mymac[3] = mac >> 24;
+	mac = NIC_MAC1;
+	mymac[4] = mac; mymac[5] = mac >> 8;
+
+	kprintf("\nHAL: Ethernet interface vnic0: MAC address %x:%x:%x:%x:%x:%x",
+		mymac[0], mymac[1], mymac[2], mymac[3], mymac[4], mymac[5]);
+
+	frame_in = (uint8_t *)malloc(VNIC_FRAMELEN);
+	frame_out = (uint8_t *)malloc(VNIC_FRAMELEN);
+	if (!frame_in || !frame_out) panic(PANIC_OOM);
+
+	vnic_ring[0] = frame_in;
+	for (vnic_rings = 1; vnic_rings < VNIC_RX_FRAMES; vnic_rings++){
+		vnic_ring[vnic_rings] = (uint8_t *)malloc(VNIC_FRAMELEN);
+		if (!vnic_ring[vnic_rings]) break;
+	}
+
+	hf_mtxinit(&vnic_lock);
+
+	return 1;
+}
+
+int32_t en_watchdog(void)
+{
+	return 0;
+}
+
+/* the next frame is copied to the buffer by the simulator, 0 if none */
+static int32_t vnic_read(uint8_t *frame)
+{
+	NIC_RXADDR = (uint32_t)frame;
+	NIC_CTRL = VNIC_RX;
+
+	return NIC_RXLEN;
+}
+
+int32_t en_ll_input(uint8_t *frame)
+{
+	int32_t size;
+
+	hf_mtxlock(&vnic_lock);
+	size = vnic_read(frame);
+	hf_mtxunlock(&vnic_lock);
+
+	return size;
+}
+
+/* batched receive, as on the ENC28J60 driver (buffers from the ring where frames[] is NULL) */
+int32_t en_ll_inputv(uint8_t **frames, int32_t *sizes, int32_t max)
+{
+	int32_t n;
+
+	if (max > vnic_rings) max = vnic_rings;
+	hf_mtxlock(&vnic_lock);
+	for (n = 0; n < max; n++){
+		if (!frames[n])
+			frames[n] = vnic_ring[n];
+		sizes[n] = vnic_read(frames[n]);
+		if (sizes[n] == 0)
+			break;
+	}
+	hf_mtxunlock(&vnic_lock);
+
+	return n;
+}
+
+void en_ll_output(uint8_t *frame, uint16_t size)
+{
+	hf_mtxlock(&vnic_lock);
+	NIC_TXADDR = (uint32_t)frame;
+	NIC_TXLEN = size;
+	NIC_CTRL = VNIC_TX;
+	hf_mtxunlock(&vnic_lock);
+}
+#endif
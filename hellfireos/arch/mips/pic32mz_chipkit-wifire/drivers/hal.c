@@ -39,11 +39,15 @@ int32_t getchar(void)
 void dputchar(int32_t value){
 }
 
+/* core clock level (_cpu_level()), and the time base at the last change */
+static uint32_t cpu_level = 0;
+static uint64_t cpu_level_us = 0, cpu_level_cycles = 0;
+
 /* hardware platform dependent stuff */
 void delay_ms(uint32_t msec)
 {
 	uint32_t now = mfc0(CP0_COUNT, 0);
-	uint32_t final = now + msec * (CPU_SPEED / 1000) / 2;
+	uint32_t final = now + ((msec * (CPU_SPEED / 1000) / 2) >> cpu_level);
 
 	for (;;){
 		now = mfc0(CP0_COUNT, 0);
@@ -54,7 +58,7 @@ void delay_ms(uint32_t msec)
 void delay_us(uint32_t usec)
 {
 	uint32_t now = mfc0(CP0_COUNT, 0);
-	uint32_t final = now + usec * (CPU_SPEED / 1000000) / 2;
+	uint32_t final = now + ((usec * (CPU_SPEED / 1000000) / 2) >> cpu_level);
 
 	for (;;){
 		now = mfc0(CP0_COUNT, 0);
@@ -171,11 +175,127 @@ uint8_t switch_get(uint16_t sw)
 }
 
 
+/*
+ * L1 caches. KSEG0 comes out of reset uncached (Config.K0 = 2) and the cache tags are not
+ * initialized, so the caches are cleared here and KSEG0 is made cacheable (write-back,
+ * write allocate), unless a boot loader did it already. Memory written by DMA engines
+ * must be invalidated (_dcache_inv()) before it is read, and memory read by DMA engines
+ * must be written back (_dcache_wb()) before the transfer starts. Addresses out of KSEG0
+ * (KSEG1, uncached) are skipped by these routines.
+ */
+#ifndef L1_CACHE
+#define L1_CACHE	1
+#endif
+
+#define ICACHE_INDEX_STORE_TAG	0x08
+#define DCACHE_INDEX_STORE_TAG	0x09
+#define DCACHE_HIT_INV		0x11
+#define DCACHE_HIT_WBINV	0x15
+#define DCACHE_HIT_WB		0x19
+
+#define cache_op(op, addr)	asm volatile ("cache %0, 0(%1)" : : "i" (op), "r" (addr) : "memory")
+#define kseg0(addr)		(((uint32_t)(addr) >> 29) == 4)
+
+#if L1_CACHE == 1
+static void cache_init(void)
+{
+	uint32_t config, config1, line, size, addr;
+
+	config = mfc0(CP0_CONFIG, 0);
+	if ((config & 7) == 3)
+		return;
+	config1 = mfc0(CP0_CONFIG1, 1);
+	mtc0(CP0_TAGLO, 0, 0);
+	mtc0(CP0_TAGLO, 2, 0);
+	asm volatile ("ehb");
+
+	/* instruction cache: line 2 << IL, 64 << IS sets, IA + 1 ways */
+	line = (config1 >> 19) & 7;
+	if (line){
+		line = 2 << line;
+		size = line * (64 << ((config1 >> 22) & 7)) * (((config1 >> 16) & 7) + 1);
+		for (addr = 0x80000000; addr < 0x80000000 + size; addr += line)
+			cache_op(ICACHE_INDEX_STORE_TAG, addr);
+	}
+
+	/* data cache: line 2 << DL, 64 << DS sets, DA + 1 ways */
+	line = (config1 >> 10) & 7;
+	if (line){
+		line = 2 << line;
+		size = line * (64 << ((config1 >> 13) & 7)) * (((config1 >> 7) & 7) + 1);
+		for (addr = 0x80000000; addr < 0x80000000 + size; addr += line)
+			cache_op(DCACHE_INDEX_STORE_TAG, addr);
+	}
+
+	/* KSEG0 cacheable, write-back, write allocate (the change takes effect after jr.hb) */
+	mtc0(CP0_CONFIG, 0, (config & ~7) | 3);
+	asm volatile (
+		".set push\n\t"
+		".set noreorder\n\t"
+		"la $8, 1f\n\t"
+		"jr.hb $8\n\t"
+		"nop\n"
+		"1:\n\t"
+		".set pop"
+		: : : "$8", "memory");
+}
+#endif
+
+/* writes back the data cache lines of an address range */
+void _dcache_wb(void *addr, uint32_t size)
+{
+	uint32_t a, end;
+
+	if (!L1_CACHE || !size || !kseg0(addr))
+		return;
+	end = (uint32_t)addr + size;
+	for (a = (uint32_t)addr & ~(CACHE_LINE - 1); a < end; a += CACHE_LINE)
+		cache_op(DCACHE_HIT_WB, a);
+	asm volatile ("sync" : : : "memory");
+}
+
+/* invalidates the data cache lines of an address range. partial lines at the ends are written back first, so data next to an unaligned buffer is kept */
+void _dcache_inv(void *addr, uint32_t size)
+{
+	uint32_t a, end, last;
+
+	if (!L1_CACHE || !size || !kseg0(addr))
+		return;
+	a = (uint32_t)addr & ~(CACHE_LINE - 1);
+	end = (uint32_t)addr + size;
+	last = end & ~(CACHE_LINE - 1);
+	if (a != (uint32_t)addr){
+		cache_op(DCACHE_HIT_WBINV, a);
+		a += CACHE_LINE;
+	}
+	if (last != end && last >= a)
+		cache_op(DCACHE_HIT_WBINV, last);
+	for (; a < last; a += CACHE_LINE)
+		cache_op(DCACHE_HIT_INV, a);
+	asm volatile ("sync" : : : "memory");
+}
+
+/* writes back and invalidates the data cache lines of an address range */
+void _dcache_wbinv(void *addr, uint32_t size)
+{
+	uint32_t a, end;
+
+	if (!L1_CACHE || !size || !kseg0(addr))
+		return;
+	end = (uint32_t)addr + size;
+	for (a = (uint32_t)addr & ~(CACHE_LINE - 1); a < end; a += CACHE_LINE)
+		cache_op(DCACHE_HIT_WBINV, a);
+	asm volatile ("sync" : : : "memory");
+}
+
 /* hardware dependent basic kernel stuff */
 void _hardware_init(void)
 {
 	uint32_t temp_CP0;
 	
+#if L1_CACHE == 1
+	cache_init();
+#endif
 	/* configure board registers (clock source, multiplier...) */
 /*	SYSKEY = 0xAA996655;
 	SYSKEY = 0x556699AA;
@@ -299,6 +419,32 @@ void _cpu_idle(void)
 {
 }
 
+/* the core clock (PBCLK7) is SYSCLK divided by 1, 2, 4 or 8. the tick (timer 2/3) and the UART run
+ * on other peripheral bus clocks, so only the core and its count register slow down. */
+int32_t _cpu_level(uint32_t level)
+{
+	volatile uint32_t status;
+
+	if (level >= CPU_LEVELS)
+		return -1;
+	status = _di();
+	if (level != cpu_level){
+		cpu_level_us = _read_us();
+		cpu_level_cycles = hf_cycles();
+		while (!(PB7DIV & 0x0800));
+		SYSKEY = 0x00000000;
+		SYSKEY = 0xAA996655;
+		SYSKEY = 0x556699AA;
+		PB7DIV = (PB7DIV & ~0x7f) | ((1 << level) - 1);
+		SYSKEY = 0x33333333;
+		while (!(PB7DIV & 0x0800));
+		cpu_level = level;
+	}
+	_ei(status);
+
+	return 0;
+}
+
 uint32_t _readcounter(void)
 {
 	return mfc0(CP0_COUNT, 0);
@@ -306,15 +452,7 @@ uint32_t _readcounter(void)
 
 uint64_t _read_us(void)
 {
-	static uint64_t timeref = 0;
-	static uint32_t tval2 = 0, tref = 0;
-	
-	if (tref == 0) _readcounter();
-	if (_readcounter() < tref) tval2++;
-	tref = _readcounter();
-	timeref = ((uint64_t)tval2 << 32) + (uint64_t)_readcounter();
-	
-	return (timeref / (CPU_SPEED / 1000000));
+	return cpu_level_us + ((hf_cycles() - cpu_level_cycles) << cpu_level) / (COUNTER_SPEED / 1000000);
 }
 
 void _soft_reset()
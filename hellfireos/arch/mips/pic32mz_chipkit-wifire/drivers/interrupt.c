@@ -1,6 +1,8 @@
 #include <hellfire.h>
 
 static funcptr isr[7][32] = {[0 ... 6][0 ... 31] = NULL};
+static uint32_t irq_count[7][32], irq_cycles[7][32];
+static uint32_t irq_start;
 
 /*
 interrupt management routines
@@ -14,6 +16,12 @@ void _irq_register(uint32_t port, uint32_t mask, funcptr ptr)
 			isr[port][i] = ptr;
 }
 
+/*
+interrupt dispatch: pending sources of each IFS register are served from
+the highest to the lowest bit, found with a count leading zeros (a single
+instruction on MIPS32). the number of interrupts and the cycles spent on
+each handler are accounted per source.
+*/
 void _irq_handler(uint32_t status, uint32_t cause)
 {
 	int32_t i, p;
@@ -21,17 +29,17 @@ void _irq_handler(uint32_t status, uint32_t cause)
 
 	krnl_pcb.interrupts++;	
 	for (p = 0; p < 7; p++){
-		i = 0;
 		irq = IFS(p);
-		do {
-			if (irq & 0x1){
-				if(isr[p][i]){
-					isr[p][i]();
-				}
+		while (irq){
+			i = 31 - __builtin_clz(irq);
+			irq &= ~(1U << i);
+			if (isr[p][i]){
+				irq_count[p][i]++;
+				irq_start = _readcounter();
+				isr[p][i]();
+				irq_cycles[p][i] += _readcounter() - irq_start;
 			}
-			irq >>= 1;
-			++i;
-		} while(irq);
+		}
 	}
 	
 	if (!(PORTB & (1 << 12))){
@@ -42,6 +50,17 @@ void _irq_handler(uint32_t status, uint32_t cause)
 	}
 }
 
+/*
+per source interrupt statistics. cycles of a handler which switches the
+running task are accounted when execution returns to a task which was
+interrupted, as the handler only returns then.
+*/
+void _irq_stats(uint32_t port, uint32_t irq, uint32_t *count, uint32_t *cycles)
+{
+	*count = irq_count[port % 7][irq & 31];
+	*cycles = irq_cycles[port % 7][irq & 31];
+}
+
 void _irq_mask_set(uint32_t port, uint32_t mask)
 {
 	IECSET(port) = mask;
@@ -21,6 +21,9 @@ static uint32_t read_index = 0;
 static uint32_t desc_offset = 0;
 static uint32_t frame_size = 0;
 static uint32_t read_nbytes = 0;
+static uint32_t held_index = 0;		/* first RX descriptor of the frames handed out in place */
+static uint32_t held_count = 0;		/* RX descriptors held by those frames */
+static mutex_t txlock;			/* serializes transmissions of concurrent senders */
 
 /*
  * Read PHY register.
@@ -325,6 +328,7 @@ static void en_setup_dma() {
 		DESC_CLEAR_NPV(&e->rx_desc[i]);
 		e->rx_desc[i].paddr = MACH_VIRT_TO_PHYS(&e->rx_buf[0] + (i * RX_BYTES_PER_DESC));
 	}
+	_dcache_inv(e->rx_buf, RX_BYTES);
 
 	/* Loop the list back to the begining.
 	 * This is a circular array descriptor list. */
@@ -333,6 +337,7 @@ static void en_setup_dma() {
 
 	/* Set RX at the start of the list. */
 	receive_index = 0;
+	held_count = 0;
 	ETHRXST = MACH_VIRT_TO_PHYS(&e->rx_desc[0]);
 
 	/* Set up the transmit descriptors all owned by
@@ -341,12 +346,29 @@ static void en_setup_dma() {
 	ETHTXST = MACH_VIRT_TO_PHYS(&e->tx_desc[0]);
 }
 
+/*
+ * return the RX descriptors of the frames handed out by en_ll_inputv() to the controller.
+ */
+static void en_ll_release(void) {
+	struct eth_port *e = &eth_port;
+
+	if (!held_count) return;
+	while (held_count--){
+		/* the frame may have been written in place, drop those lines before the DMA refills the buffer */
+		_dcache_inv(MACH_PHYS_TO_CACHED(e->rx_desc[held_index].paddr), RX_BYTES_PER_DESC);
+		DESC_SET_EOWN(&e->rx_desc[held_index]);		/* give up ownership */
+		ETHCON1SET = PIC32_ETHCON1_BUFCDEC;		/* decrement the BUFCNT */
+		held_index = INCR_RX_INDEX(held_index);
+	}
+	held_count = 0;
+}
+
 /*
  * ethernet low level input (receive)
  * 
  * a raw ethernet frame is fetched from the reception buffer (controlled by
- * the RX DMA) and copied to the application buffer. Warning: the application
- * buffer should be cache-coherent.
+ * the RX DMA) and copied to the application buffer. the reception buffer is
+ * cached, and its lines are invalidated before they are read.
  */
 int32_t en_ll_input(uint8_t *frame) {
 	struct eth_port *e = &eth_port;
@@ -357,6 +379,7 @@ int32_t en_ll_input(uint8_t *frame) {
 	read_nbytes = 0;
 
 	if (!e->is_up) return 0;
+	en_ll_release();
 
 	if (DESC_EOWN(&e->rx_desc[receive_index])) {
 		/* There are no receive descriptors to process. */
@@ -376,7 +399,8 @@ int32_t en_ll_input(uint8_t *frame) {
 		uint32_t nbytes = DESC_BYTECNT(&e->rx_desc[read_index]);
 		uint32_t cb     = min(nbytes - desc_offset, frame_size);
 
-		memcpy(buf, MACH_PHYS_TO_VIRT(e->rx_desc[read_index].paddr + desc_offset), cb);
+		_dcache_inv(MACH_PHYS_TO_CACHED(e->rx_desc[read_index].paddr + desc_offset), cb);
+		memcpy(buf, MACH_PHYS_TO_CACHED(e->rx_desc[read_index].paddr + desc_offset), cb);
 		buf         += cb;
 		desc_offset += cb;
 		read_nbytes += cb;
@@ -417,32 +441,127 @@ int32_t en_ll_input(uint8_t *frame) {
 }
 
 /*
- * ethernet low level output (send)
+ * ethernet low level batched input (receive, zero-copy)
  * 
- * a raw ethernet frame is copied from the application buffer to the transmission
- * buffer by the TX DMA engine. Warning: the application buffer should be
- * cache-coherent.
+ * up to max complete frames are handed out in place, on the RX DMA buffers, replacing
+ * the buffers given on frames[]. the descriptors of a frame are consecutive, and so are
+ * their buffers unless the frame wraps around the end of the ring. such a frame is copied
+ * to the buffer given on its frames[] entry (MTU bytes), or to frame_in if there is none
+ * (at most one per call). frames are valid until the next call to en_ll_inputv() or
+ * en_ll_input(), which gives their descriptors back to the controller. the RX buffers are
+ * cached: a frame is invalidated before it is handed out, so protocol processing runs on
+ * cached memory, and invalidated again when its descriptors are given back.
  */
-void en_ll_output(uint8_t *frame, uint16_t size) {
+int32_t en_ll_inputv(uint8_t **frames, int32_t *sizes, int32_t max) {
 	struct eth_port *e = &eth_port;
-	volatile eth_desc_t *desc = &e->tx_desc[0];
+	uint32_t first, index, count, size, nbytes, cb;
+	uint8_t *buf;
+	int32_t n = 0, copied = 0;
 
-	if (size > 0 && size <= MTU) {
-		while(ETHCON1 & PIC32_ETHCON1_TXRTS);
+	if (!e->is_up) return 0;
+	en_ll_release();
+	held_index = receive_index;
 
-		desc->hdr = 0;
-		desc->paddr = MACH_VIRT_TO_PHYS(frame);
-		DESC_SET_BYTECNT(desc, size);
-		DESC_SET_SOP(desc);	/* Start of packet */
-		DESC_SET_EOWN(desc);	/* Set owner */
-		DESC_SET_EOP(desc);	/* End of packet */
+	while (n < max) {
+		first = receive_index;
+		if (DESC_EOWN(&e->rx_desc[first]))
+			break;
+		size = DESC_FRAMESZ(&e->rx_desc[first]);
+		if (size > MTU)
+			size = 0;
+
+		/* find the end of the frame, stop if it is not complete yet */
+		for (index = first, count = 1; !DESC_EOP(&e->rx_desc[index]); count++) {
+			index = INCR_RX_INDEX(index);
+			if (DESC_EOWN(&e->rx_desc[index]) || count == RX_DESCRIPTORS)
+				return n;
+		}
+
+		if (first + count <= RX_DESCRIPTORS) {
+			frames[n] = MACH_PHYS_TO_CACHED(e->rx_desc[first].paddr);
+			_dcache_inv(frames[n], size);
+		} else {
+			buf = frames[n];
+			if (!buf) {
+				if (copied) break;
+				copied = 1;
+				buf = frame_in;
+			}
+			for (index = first, nbytes = 0; nbytes < size; index = INCR_RX_INDEX(index)) {
+				cb = min(DESC_BYTECNT(&e->rx_desc[index]), size - nbytes);
+				_dcache_inv(MACH_PHYS_TO_CACHED(e->rx_desc[index].paddr), cb);
+				memcpy(buf + nbytes, MACH_PHYS_TO_CACHED(e->rx_desc[index].paddr), cb);
+				nbytes += cb;
+			}
+			frames[n] = buf;
+		}
+		sizes[n] = size;
+
+		receive_index = (first + count) % RX_DESCRIPTORS;
+		held_count += count;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * ethernet low level gather output (send)
+ * 
+ * a raw ethernet frame, split on up to TX_DESCRIPTORS application buffers, is sent
+ * by the TX DMA engine straight from the buffers, one chained descriptor per buffer.
+ * senders may call this concurrently, and the call returns once the frame is sent, so
+ * the buffers may be reused (or released) right away. cached buffers are written back
+ * before the transfer starts.
+ */
+void en_ll_outputv(uint8_t **bufs, uint16_t *sizes, int32_t n) {
+	struct eth_port *e = &eth_port;
+	volatile eth_desc_t *desc;
+	uint32_t size = 0;
+	int32_t i;
+
+	for (i = 0; i < n; i++)
+		size += sizes[i];
+	if (n < 1 || n > TX_DESCRIPTORS || size == 0 || size > MTU)
+		return;
 
-		/* Set the descriptor table to be transmitted. */
-		ETHTXST = MACH_VIRT_TO_PHYS(e->tx_desc);
+	hf_mtxlock(&txlock);
 
-		/* Start transmitter. */
-		ETHCON1SET = PIC32_ETHCON1_TXRTS;
+	for (i = 0; i < n; i++) {
+		desc = &e->tx_desc[i];
+		desc->hdr = 0;
+		_dcache_wb(bufs[i], sizes[i]);
+		desc->paddr = MACH_VIRT_TO_PHYS(bufs[i]);
+		DESC_SET_BYTECNT(desc, sizes[i]);
+		if (i == 0)
+			DESC_SET_SOP(desc);	/* Start of packet */
+		if (i == n - 1)
+			DESC_SET_EOP(desc);	/* End of packet */
 	}
+	/* The list ends on the first descriptor not owned by the controller. */
+	e->tx_desc[n].hdr = 0;
+	for (i = n - 1; i >= 0; i--)
+		DESC_SET_EOWN(&e->tx_desc[i]);	/* Set owner */
+
+	/* Set the descriptor table to be transmitted. */
+	ETHTXST = MACH_VIRT_TO_PHYS(e->tx_desc);
+
+	/* Start transmitter and wait for the frame to be sent. */
+	ETHCON1SET = PIC32_ETHCON1_TXRTS;
+	while(ETHCON1 & PIC32_ETHCON1_TXRTS);
+
+	hf_mtxunlock(&txlock);
+}
+
+/*
+ * ethernet low level output (send)
+ * 
+ * a raw ethernet frame is sent by the TX DMA engine straight from the application
+ * buffer (which may be a frame handed out by en_ll_inputv(), for replies built in
+ * place).
+ */
+void en_ll_output(uint8_t *frame, uint16_t size) {
+	en_ll_outputv(&frame, &size, 1);
 }
 
 /*
@@ -659,6 +778,7 @@ void eth_isr(){
 
 int32_t en_init(){
 	struct eth_port *e = &eth_port;
+	int8_t *rx_mem;
 
 	/* Board-dependent initialization. */
 	setup_signals();
@@ -716,15 +836,19 @@ int32_t en_init(){
 		break;
 	}
 
-	/* allocate buffers and change pointers from kseg0 to kseg1 (non-cachable)
-	 * this will make DMA buffers coherent because we avoid acessing the L1 cache. */
-	e->rx_buf = MACH_PHYS_TO_VIRT(MACH_VIRT_TO_PHYS((int8_t *)malloc(RX_BYTES * sizeof(int8_t))));
+	/* allocate descriptors and change pointers from kseg0 to kseg1 (non-cachable), as their
+	 * ownership bits are shared with the controller. the RX buffer (aligned to cache lines,
+	 * so its lines hold no other data) and the software buffers stay cached, with explicit
+	 * cache maintenance around DMA transfers. */
+	rx_mem = (int8_t *)malloc(RX_BYTES + CACHE_LINE);
+	e->rx_buf = (int8_t *)(((uint32_t)rx_mem + CACHE_LINE - 1) & ~(CACHE_LINE - 1));
 	e->rx_desc = MACH_PHYS_TO_VIRT(MACH_VIRT_TO_PHYS((eth_desc_t *)malloc((RX_DESCRIPTORS+1) * sizeof(eth_desc_t))));
 	e->tx_desc = MACH_PHYS_TO_VIRT(MACH_VIRT_TO_PHYS((eth_desc_t *)malloc((TX_DESCRIPTORS+1) * sizeof(eth_desc_t))));
-	/* allocate coherent software buffers */
-	frame_in = MACH_PHYS_TO_VIRT(MACH_VIRT_TO_PHYS((uint8_t *)malloc(MTU)));
-	frame_out = MACH_PHYS_TO_VIRT(MACH_VIRT_TO_PHYS((uint8_t *)malloc(MTU)));
-	if (!e->rx_buf || !e->rx_desc || !e->tx_desc || !frame_in || !frame_out) panic(PANIC_OOM);
+	frame_in = (uint8_t *)malloc(MTU);
+	frame_out = (uint8_t *)malloc(MTU);
+	if (!rx_mem || !e->rx_desc || !e->tx_desc || !frame_in || !frame_out) panic(PANIC_OOM);
+
+	hf_mtxinit(&txlock);
 
 	_irq_register(IRQ_ETH >> 5, 1 << (IRQ_ETH & 31), eth_isr);
 	en_enable_interrupts();
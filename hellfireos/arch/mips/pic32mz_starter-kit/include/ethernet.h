@@ -45,6 +45,7 @@ typedef struct {
 
 #define MACH_VIRT_TO_PHYS(x)	((uint32_t)(x) & 0x1fffffff)
 #define MACH_PHYS_TO_VIRT(x)	((void *) ((x) | 0xa0000000))
+#define MACH_PHYS_TO_CACHED(x)	((void *) ((x) | 0x80000000))
 
 #define INCR_RX_INDEX(_i)	((_i + 1) % RX_DESCRIPTORS)
 
@@ -129,4 +130,6 @@ uint8_t mymac[6];
 int32_t en_init();
 int32_t en_watchdog(void);
 void en_ll_output(uint8_t *frame, uint16_t size);
+void en_ll_outputv(uint8_t **bufs, uint16_t *sizes, int32_t n);
 int32_t en_ll_input(uint8_t *frame);
+int32_t en_ll_inputv(uint8_t **frames, int32_t *sizes, int32_t max);
@@ -14,6 +14,10 @@ typedef void				(*funcptr)();
 #define _di()				_interrupt_set(0)
 #define _ei(S)				_interrupt_set(S)
 
+/* libc block memory routines: machine word and unaligned loads (unaligned sources are read with lwl / lwr) */
+#define MEM_WORD			uint32_t
+#define MEM_UNALIGNED			1
+
 #include <pic32mz.h>
 
 #define RA				0
@@ -40,7 +44,12 @@ typedef void				(*funcptr)();
 #define SPI_MISO			(1 << 4)
 #define SPI_IRQ0			(1 << 5)
 
+/* L1 cache line size, for the alignment of DMA buffers */
+#define CACHE_LINE			16
+
 #define STACK_MAGIC			0xb00bb00b
+#define COUNTER_SPEED			(CPU_SPEED / 2)	/* CP0 count runs at half the core clock */
+#define CPU_LEVELS			4		/* core clock levels (_cpu_level()), level n runs at CPU_SPEED >> n */
 typedef uint32_t context[20];
 
 /* hardware dependent stuff */
@@ -64,6 +73,11 @@ void led_set(uint16_t led, uint8_t val);
 uint8_t button_get(uint16_t btn);
 uint8_t switch_get(uint16_t sw);
 
+/* data cache maintenance on an address range (KSEG0), for buffers shared with DMA engines */
+void _dcache_wb(void *addr, uint32_t size);
+void _dcache_inv(void *addr, uint32_t size);
+void _dcache_wbinv(void *addr, uint32_t size);
+
 /* hardware dependent basic kernel stuff */
 void _hardware_init(void);
 void _vm_init(void);
@@ -78,6 +92,7 @@ void _set_task_tp(uint16_t task, void (*entry)());
 void *_get_task_tp(uint16_t task);
 void _timer_reset(void);
 void _cpu_idle(void);
+int32_t _cpu_level(uint32_t level);
 uint32_t _readcounter(void);
 uint64_t _read_us(void);
 void _soft_reset();
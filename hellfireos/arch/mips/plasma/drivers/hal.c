@@ -51,11 +51,9 @@ void delay_ms(uint32_t msec)
 	delta = msecs = 0;
 	cycles_per_msec = CPU_SPEED / 1000;
 	while(msec > msecs){
+		MemoryWrite(IDLE_HINT, cycles_per_msec - delta);
 		cur = MemoryRead(COUNTER_REG);
-		if (cur < last)
-			delta += (cur + (CPU_SPEED - last));
-		else
-			delta += (cur - last);
+		delta += cur - last;
 		last = cur;
 		if (delta >= cycles_per_msec){
 			msecs += delta / cycles_per_msec;
@@ -73,11 +71,9 @@ void delay_us(uint32_t usec)
 	delta = usecs = 0;
 	cycles_per_usec = CPU_SPEED / 1000000;
 	while(usec > usecs){
+		MemoryWrite(IDLE_HINT, cycles_per_usec - delta);
 		cur = MemoryRead(COUNTER_REG);
-		if (cur < last)
-			delta += (cur + (CPU_SPEED - last));
-		else
-			delta += (cur - last);
+		delta += cur - last;
 		last = cur;
 		if (delta >= cycles_per_usec){
 			usecs += delta / cycles_per_usec;
@@ -195,8 +191,16 @@ void _timer_reset(void)
 	lastcount = timecount;
 }
 
+/* nothing to do until an interrupt. the hint lets the simulator skip the wait */
 void _cpu_idle(void)
 {
+	MemoryWrite(IDLE_HINT, 0xffffffff);
+}
+
+/* the core clock can't be scaled */
+int32_t _cpu_level(uint32_t level)
+{
+	return level ? -1 : 0;
 }
 
 uint32_t _readcounter(void)
@@ -206,15 +210,7 @@ uint32_t _readcounter(void)
 
 uint64_t _read_us(void)
 {
-	static uint64_t timeref = 0;
-	static uint32_t tval2 = 0, tref = 0;
-	
-	if (tref == 0) _readcounter();
-	if (_readcounter() < tref) tval2++;
-	tref = _readcounter();
-	timeref = ((uint64_t)tval2 << 32) + (uint64_t)_readcounter();
-	
-	return (timeref / (CPU_SPEED / 1000000));
+	return hf_cycles() / (CPU_SPEED / 1000000);
 }
 
 void _panic(void)
@@ -1,6 +1,13 @@
 #include <hellfire.h>
 
 static funcptr isr[32] = {[0 ... 31] = NULL};
+static uint32_t irq_count[32], irq_cycles[32];
+static uint32_t irq_start;
+#if IRQ_NESTING == 1
+static uint32_t irq_nonest;				/* sources which never nest (scheduler tick) */
+static uint32_t irq_wake;				/* sources whose handlers wake up tasks */
+static uint32_t irq_sched_m, irq_sched_r;		/* mask before and during the scheduler window */
+#endif
 
 /*
 interrupt management routines
@@ -12,23 +19,121 @@ void _irq_register(uint32_t mask, funcptr ptr)
 	for (i = 0; i < 32; ++i)
 		if (mask & (1 << i))
 			isr[i] = ptr;
+#if IRQ_NESTING == 1
+	if (ptr == dispatch_isr)
+		irq_nonest |= mask;
+	else
+		irq_nonest &= ~mask;
+#endif
 }
 
+/*
+interrupt dispatch: pending sources are served from the highest to the lowest
+bit, so external devices come before the on chip timer and UART (and before a
+context switch performed by the scheduler tick). the highest pending bit is
+found with a count leading zeros. the number of interrupts and the cycles
+spent on each handler are accounted per source.
+
+with IRQ_NESTING, device handlers run with interrupts enabled and only
+sources of a higher priority (higher bit) unmasked, so they are preempted
+by more urgent devices. the scheduler tick (dispatch_isr()) never nests:
+it is masked while any other handler runs, and it opens its own nesting
+window for devices during the scheduling decision. changes made to the
+interrupt mask by a nested handler are kept when the mask is restored.
+sources whose handlers wake up tasks (_irq_wakeup()) change the kernel queues,
+so they are kept masked on the window of the scheduler (_irq_sched_open()).
+
+without IRQ_NESTING, work queued by the handlers (hf_defer()) may switch to
+the deferred work worker once all sources are served (defer_dispatch()), and
+a task woken up by a handler (hf_sempost_isr()) may be switched to at once
+(dispatch_resched()).
+*/
 void _irq_handler(uint32_t cause, uint32_t *stack)
 {
-	int32_t i = 0;
-	
+	int32_t i;
+#if IRQ_NESTING == 1
+	uint32_t m, r, c, t;
+#endif
+
 	krnl_pcb.interrupts++;
-	do {
-		if (cause & 0x1){
-			if(isr[i]){
+	while (cause){
+		i = 31 - __builtin_clz(cause);
+		cause &= ~(1U << i);
+		if (isr[i]){
+			irq_count[i]++;
+#if IRQ_NESTING == 1
+			if (!(irq_nonest & (1U << i))){
+				t = _readcounter();
+				m = MemoryRead(IRQ_MASK);
+				r = m & ~irq_nonest & ~((2U << i) - 1);
+				MemoryWrite(IRQ_MASK, r);
+				_ei(1);
 				isr[i](stack);
+				_di();
+				c = r ^ MemoryRead(IRQ_MASK);
+				MemoryWrite(IRQ_MASK, (m & ~c) | (MemoryRead(IRQ_MASK) & c));
+				irq_cycles[i] += _readcounter() - t;
+				continue;
 			}
+#endif
+			irq_start = _readcounter();
+			isr[i](stack);
+			irq_cycles[i] += _readcounter() - irq_start;
 		}
-		cause >>= 1;
-		++i;
-	} while(cause);
+	}
+#if IRQ_NESTING == 0
+	defer_dispatch();
+	dispatch_resched();
+#endif
+}
+
+/*
+per source interrupt statistics. cycles of a handler which switches the
+running task are accounted when execution returns to a task which was
+interrupted, as the handler only returns then.
+*/
+void _irq_stats(uint32_t irq, uint32_t *count, uint32_t *cycles)
+{
+	*count = irq_count[irq & 31];
+	*cycles = irq_cycles[irq & 31];
+}
+
+/*
+sources whose handlers wake up tasks or signal semaphores. with IRQ_NESTING,
+they are masked while the scheduler tick walks the kernel queues with
+interrupts enabled, and are served once it is done.
+*/
+void _irq_wakeup(uint32_t mask)
+{
+#if IRQ_NESTING == 1
+	irq_wake |= mask;
+#endif
+}
+
+#if IRQ_NESTING == 1
+/*
+nesting window of the scheduler tick (dispatch_isr()), called with interrupts
+disabled. interrupts are enabled with the sources of _irq_wakeup() masked, and
+disabled again on close, with the mask restored (keeping changes made to it
+by the handlers that ran on the window).
+*/
+void _irq_sched_open(void)
+{
+	irq_sched_m = MemoryRead(IRQ_MASK);
+	irq_sched_r = irq_sched_m & ~irq_wake;
+	MemoryWrite(IRQ_MASK, irq_sched_r);
+	_ei(1);
+}
+
+void _irq_sched_close(void)
+{
+	uint32_t c;
+
+	_di();
+	c = irq_sched_r ^ MemoryRead(IRQ_MASK);
+	MemoryWrite(IRQ_MASK, (irq_sched_m & ~c) | (MemoryRead(IRQ_MASK) & c));
 }
+#endif
 
 void _irq_mask_set(uint32_t mask)
 {
@@ -24,3 +24,34 @@ void _ni_write(uint16_t data)
 	MemoryWrite(NOC_WRITE, data);
 //	asm ("nop\nnop\nnop");
 }
+
+/*
+block transfers: the network interface moves a whole packet (the payload field,
+the second flit, tells the number of flits after it) between itself and memory,
+and raises IRQ_NOC_DMA_RX or IRQ_NOC_DMA_TX when done. a reception is started after IRQ_NOC_READ (the dummy flit read by
+the programmed I/O path is skipped by the interface). the buffer must not be
+touched until the transfer completes.
+*/
+void _ni_dma_recv(uint16_t *buf)
+{
+	MemoryWrite(NOC_DMA_RX_ADDR, (uint32_t)buf);
+	MemoryWrite(NOC_DMA_CTRL, NOC_DMA_RX);
+}
+
+void _ni_dma_send(uint16_t *buf)
+{
+	MemoryWrite(NOC_DMA_TX_ADDR, (uint32_t)buf);
+	MemoryWrite(NOC_DMA_CTRL, NOC_DMA_TX);
+}
+
+/* NOC_DMA_RX / NOC_DMA_TX are set while a transfer is in progress */
+uint16_t _ni_dma_status(void)
+{
+	return (uint16_t)MemoryRead(NOC_DMA_STATUS);
+}
+
+/* acknowledges (clears) a DMA completion interrupt */
+void _ni_dma_ack(uint32_t irq)
+{
+	MemoryWrite(NOC_DMA_STATUS, irq);
+}
@@ -14,6 +14,10 @@ typedef void				(*funcptr)();
 #define _di()				_interrupt_set(0)
 #define _ei(S)				_interrupt_set(S)
 
+/* libc block memory routines: machine word and unaligned loads (no lwl / lwr (patent free core), unaligned sources are merged by shifts) */
+#define MEM_WORD			uint32_t
+#define MEM_UNALIGNED			0
+
 /* configure, read and write board pins */
 #define _port_setup(a, opts)		*(volatile uint32_t *)(a) = (opts)
 #define _port_read(a)			(*(volatile uint32_t *)(a))
@@ -36,6 +40,8 @@ typedef void				(*funcptr)();
 #define TICK_TIME_REG			0x200000B0	/* simulator only */
 #define OUT_FACILITY			0x200000D0	/* not implemented on hw, but yeah on sim */
 #define LOG_FACILITY			0x200000E0	/* simulator only */
+#define IDLE_HINT			0x20000140	/* simulator only */
+#define CHECKPOINT			0x20000150	/* simulator only */
 
 #define IRQ_UART_READ_AVAILABLE		0x01
 #define IRQ_UART_WRITE_AVAILABLE	0x02
@@ -51,6 +57,7 @@ typedef void				(*funcptr)();
 
 
 #define STACK_MAGIC			0xb00bb00b
+#define CPU_LEVELS			1		/* core clock levels (_cpu_level()), the clock is fixed */
 typedef uint32_t context[20];
 
 /* hardware dependent stuff */
@@ -85,7 +92,10 @@ size_t _get_task_sp(uint16_t task);
 void _set_task_tp(uint16_t task, void (*entry)());
 void *_get_task_tp(uint16_t task);
 void _timer_reset(void);
+void _irq_sched_open(void);
+void _irq_sched_close(void);
 void _cpu_idle(void);
+int32_t _cpu_level(uint32_t level);
 uint32_t _readcounter(void);
 uint64_t _read_us(void);
 void _panic(void);
@@ -2,9 +2,22 @@
 #define NOC_WRITE			0x20000080	/*WRITE*/
 #define NOC_STATUS			0x20000090	/*STATUS*/
 #define NOC_CTRL			0x200000C0	/*CONTROL*/
+#define NOC_DMA_RX_ADDR			0x20000100	/*DMA reception buffer*/
+#define NOC_DMA_TX_ADDR			0x20000110	/*DMA transmission buffer*/
+#define NOC_DMA_CTRL			0x20000120	/*DMA start (write)*/
+#define NOC_DMA_STATUS			0x20000130	/*DMA busy (read), interrupt ack (write)*/
+
+#define NOC_DMA_RX			0x1
+#define NOC_DMA_TX			0x2
 
 #define IRQ_NOC_READ			0x100
+#define IRQ_NOC_DMA_RX			0x200
+#define IRQ_NOC_DMA_TX			0x400
 
 uint16_t _ni_status(void);
 uint16_t _ni_read(void);
 void _ni_write(uint16_t data);
+void _ni_dma_recv(uint16_t *buf);
+void _ni_dma_send(uint16_t *buf);
+uint16_t _ni_dma_status(void);
+void _ni_dma_ack(uint32_t irq);
@@ -4,6 +4,33 @@ INC_DIRS  = -I $(ARCH_DIR)/include
 
 F_CLK=25000000
 TIME_SLICE=0
+# tickless idle (requires TIME_SLICE != 0)
+TICKLESS=0
+# nested device interrupts, by priority (higher IRQ bit first)
+IRQ_NESTING=0
+# buffered console, UART transmission ring size (power of 2, 0 polls the UART)
+UART_TXBUF=1024
+# full console ring: 0 waits for room, 1 drops characters
+UART_TXDROP=0
+
+# M extension (multiplier / divider): 1 builds RV32IM, 0 builds RV32I, where NO_HW_MUL / NO_HW_DIV
+# select the libc helpers. may be set by the platform makefile, before including this file
+RV32M ?= 0
+ifeq ($(RV32M),1)
+MARCH = RV32IM
+CFLAGS_NO_HW_MULDIV =
+else
+MARCH = RV32I
+CFLAGS_NO_HW_MULDIV = -DNO_HW_MUL -DNO_HW_DIV
+endif
+# compressed instructions (RVC, 16 bit encodings of the common ones): 1 for smaller images,
+# on cores (and simulators) that decode them. crt0.s is not compressed
+RVC ?= 0
+ifeq ($(RVC),1)
+CFLAGS_RVC = -mrvc
+else
+CFLAGS_RVC =
+endif
 
 #remove unreferenced functions
 CFLAGS_STRIP = -fdata-sections -ffunction-sections
@@ -12,7 +39,7 @@ LDFLAGS_STRIP = --gc-sections
 # this is stuff used everywhere - compiler and flags should be declared (ASFLAGS, CFLAGS, LDFLAGS, LINKER_SCRIPT, CC, AS, LD, DUMP, READ, OBJ and SIZE).
 # remember the kernel, as well as the application, will be compiled using the *same* compiler and flags!
 ASFLAGS = -m32 -msoft-float #-fPIC
-CFLAGS = -Wall -march=RV32I -O2 -c -msoft-float -fshort-double -ffreestanding -nostdlib -ffixed-s10 -ffixed-s11 $(INC_DIRS) -DCPU_SPEED=${F_CLK} -DTIME_SLICE=${TIME_SLICE} -DLITTLE_ENDIAN $(CFLAGS_STRIP) -DKERN_VER=\"$(KERNEL_VER)\" #-mrvc -fPIC -DDEBUG_PORT
+CFLAGS = -Wall -march=$(MARCH) -O2 -c -msoft-float -fshort-double -ffreestanding -nostdlib -ffixed-s10 -ffixed-s11 $(INC_DIRS) -DCPU_SPEED=${F_CLK} -DTIME_SLICE=${TIME_SLICE} -DTICKLESS=${TICKLESS} -DIRQ_NESTING=${IRQ_NESTING} -DUART_TXBUF=${UART_TXBUF} -DUART_TXDROP=${UART_TXDROP} -DLITTLE_ENDIAN $(CFLAGS_NO_HW_MULDIV) $(CFLAGS_RVC) $(CFLAGS_STRIP) -DKERN_VER=\"$(KERNEL_VER)\" #-fPIC -DDEBUG_PORT
 #CFLAGS = -Wall -march=RV32I -O2 -c -msoft-float -ffreestanding -nostdlib -ffixed-s10 -ffixed-s11 $(INC_DIRS) -DCPU_SPEED=${F_CLK} -DTIME_SLICE=${TIME_SLICE} -DLITTLE_ENDIAN $(CFLAGS_STRIP) -DKERN_VER=\"$(KERNEL_VER)\" #-mrvc -fPIC -DDEBUG_PORT
 LDFLAGS = -melf32lriscv $(LDFLAGS_STRIP)
 LINKER_SCRIPT = $(ARCH_DIR)/hf-riscv.ld
@@ -30,5 +57,6 @@ hal:
 	$(CC) $(CFLAGS) \
 		$(ARCH_DIR)/drivers/interrupt.c \
 		$(ARCH_DIR)/drivers/hal.c \
-		$(ARCH_DIR)/drivers/eth_enc28j60.c
+		$(ARCH_DIR)/drivers/eth_enc28j60.c \
+		$(ARCH_DIR)/drivers/eth_vnic.c
 		
@@ -11,6 +11,9 @@ void eth_isr()
 	if (eth_driver >= 0 && eth_driver < MAX_TASKS)
 		krnl_tcb[eth_driver].critical = 1;
 	IRQ_MASK &= ~EXT_IRQ2_NOT;
+#if USTACK_IRQ == 1
+	netif_rxirq();
+#endif
 }
 
 void en_irqack()
@@ -5,11 +5,68 @@
 
 /* hardware dependent C library stuff */
 #ifndef DEBUG_PORT
+#if UART_TXBUF > 0
+/*
+buffered console. characters are put on a ring drained by the UART write available
+interrupt, so printing costs a copy instead of waiting for the serial line. when the
+ring is full the caller waits for room (UART_TXDROP == 0) or the character is dropped
+(UART_TXDROP == 1). before the interrupt is registered, and when printing with
+interrupts disabled (interrupt handlers, panic), the ring is flushed and the UART is
+polled, keeping the output in order.
+*/
+static volatile uint8_t uart_txring[UART_TXBUF];
+static volatile uint32_t uart_txhead = 0, uart_txtail = 0;
+static uint8_t uart_txready = 0;
+
+static void uart_tx_isr(void *arg)
+{
+	if (uart_txtail != uart_txhead)
+		UART = uart_txring[uart_txtail++ & (UART_TXBUF - 1)];
+	if (uart_txtail == uart_txhead)
+		_irq_mask_clr(IRQ_UART_WRITE_AVAILABLE);
+}
+
+static void uart_tx_init(void)
+{
+	_irq_register(IRQ_UART_WRITE_AVAILABLE, (funcptr)uart_tx_isr);
+	uart_txready = 1;
+}
+
+void putchar(int32_t value)
+{
+	uint32_t status;
+
+	for (;;){
+		status = _di();
+		if (!uart_txready || !status){
+			while (uart_txtail != uart_txhead){
+				while ((IRQ_CAUSE & IRQ_UART_WRITE_AVAILABLE) == 0);
+				UART = uart_txring[uart_txtail++ & (UART_TXBUF - 1)];
+			}
+			while ((IRQ_CAUSE & IRQ_UART_WRITE_AVAILABLE) == 0);
+			UART = value;
+			_ei(status);
+			return;
+		}
+		if (uart_txhead - uart_txtail < UART_TXBUF){
+			uart_txring[uart_txhead++ & (UART_TXBUF - 1)] = value;
+			_irq_mask_set(IRQ_UART_WRITE_AVAILABLE);
+			_ei(status);
+			return;
+		}
+		_ei(status);
+#if UART_TXDROP == 1
+		return;
+#endif
+	}
+}
+#else
 void putchar(int32_t value)
 {
 	while ((IRQ_CAUSE & IRQ_UART_WRITE_AVAILABLE) == 0);
 	UART = value;
 }
+#endif
 
 int32_t kbhit(void)
 {
@@ -53,11 +110,9 @@ void delay_ms(uint32_t msec)
 	delta = msecs = 0;
 	cycles_per_msec = CPU_SPEED / 1000;
 	while(msec > msecs){
+		IDLE_HINT = cycles_per_msec - delta;
 		cur = COUNTER;
-		if (cur < last)
-			delta += (cur + (CPU_SPEED - last));
-		else
-			delta += (cur - last);
+		delta += cur - last;
 		last = cur;
 		if (delta >= cycles_per_msec){
 			msecs += delta / cycles_per_msec;
@@ -75,11 +130,9 @@ void delay_us(uint32_t usec)
 	delta = usecs = 0;
 	cycles_per_usec = CPU_SPEED / 1000000;
 	while(usec > usecs){
+		IDLE_HINT = cycles_per_usec - delta;
 		cur = COUNTER;
-		if (cur < last)
-			delta += (cur + (CPU_SPEED - last));
-		else
-			delta += (cur - last);
+		delta += cur - last;
 		last = cur;
 		if (delta >= cycles_per_usec){
 			usecs += delta / cycles_per_usec;
@@ -154,6 +207,9 @@ void _irq_init(void)
 void _device_init(void)
 {
 	kprintf("\nHAL: _device_init()");
+#if !defined(DEBUG_PORT) && UART_TXBUF > 0
+	uart_tx_init();
+#endif
 #ifdef NOC_INTERCONNECT
 	ni_init();
 #endif
@@ -212,8 +268,62 @@ void _timer_reset(void)
 	lastcount = timecount;
 }
 
+#if TICKLESS == 1
+#if TIME_SLICE == 0
+#error "TICKLESS requires a TIME_SLICE (COMPARE2 timer)"
+#endif
+static uint32_t tickless_start, tickless_len;
+
+uint32_t _timer_tickless(uint32_t ticks)
+{
+	uint32_t slice;
+
+	slice = (CPU_SPEED/1000000) * TIME_SLICE;
+	if (ticks > 0x7fffffff / slice)
+		ticks = 0x7fffffff / slice;
+	tickless_start = COUNTER;
+	tickless_len = ticks;
+	COMPARE2 = tickless_start + slice * ticks;
+
+	return ticks;
+}
+
+/*
+ends a tickless period early, when an interrupt makes a task ready: the timer is
+programmed to the next tick boundary of the period (or the one after it, if the
+next is too close to be set in time), and the number of ticks of the period up to
+that point is returned.
+*/
+uint32_t _timer_tickless_end(void)
+{
+	uint32_t slice, ticks, next;
+
+	slice = (CPU_SPEED/1000000) * TIME_SLICE;
+	ticks = (COUNTER - tickless_start) / slice + 1;
+	next = tickless_start + slice * ticks;
+	if ((int32_t)(next - COUNTER) < (int32_t)(slice >> 4)){
+		ticks++;
+		next += slice;
+	}
+	if (ticks >= tickless_len)
+		return tickless_len;
+	tickless_len = ticks;
+	COMPARE2 = next;
+
+	return ticks;
+}
+#endif
+
+/* nothing to do until an interrupt. the hint lets the simulators skip the wait */
 void _cpu_idle(void)
 {
+	IDLE_HINT = 0xffffffff;
+}
+
+/* the core clock can't be scaled */
+int32_t _cpu_level(uint32_t level)
+{
+	return level ? -1 : 0;
 }
 
 uint32_t _readcounter(void)
@@ -221,17 +331,42 @@ uint32_t _readcounter(void)
 	return COUNTER;
 }
 
+/*
+the counters are read as upper, lower and upper halves again, until both reads of the
+upper half match (the lower half did not wrap in between). unknown counters read 0.
+*/
+#define CSR_READ64(lo, hi, v)	do {							\
+		uint32_t h, l, h2;							\
+		do {									\
+			__asm__ volatile ("csrr %0, " #hi : "=r" (h));			\
+			__asm__ volatile ("csrr %0, " #lo : "=r" (l));			\
+			__asm__ volatile ("csrr %0, " #hi : "=r" (h2));			\
+		} while (h != h2);							\
+		v = (uint64_t)h << 32 | l;						\
+	} while (0)
+
+uint64_t hf_perfcounter_read(uint32_t counter)
+{
+	uint64_t v;
+
+	switch (counter){
+	case PERF_CYCLE: CSR_READ64(cycle, cycleh, v); break;
+	case PERF_TIME: CSR_READ64(time, timeh, v); break;
+	case PERF_INSTRET: CSR_READ64(instret, instreth, v); break;
+	case PERF_LOADS: CSR_READ64(0xc03, 0xc83, v); break;
+	case PERF_STORES: CSR_READ64(0xc04, 0xc84, v); break;
+	case PERF_BRANCHES: CSR_READ64(0xc05, 0xc85, v); break;
+	case PERF_TAKEN: CSR_READ64(0xc06, 0xc86, v); break;
+	case PERF_JUMPS: CSR_READ64(0xc07, 0xc87, v); break;
+	default: v = 0;
+	}
+
+	return v;
+}
+
 uint64_t _read_us(void)
 {
-	static uint64_t timeref = 0;
-	static uint32_t tval2 = 0, tref = 0;
-	
-	if (tref == 0) _readcounter();
-	if (_readcounter() < tref) tval2++;
-	tref = _readcounter();
-	timeref = ((uint64_t)tval2 << 32) + (uint64_t)_readcounter();
-	
-	return (timeref / (CPU_SPEED / 1000000));
+	return hf_cycles() / (CPU_SPEED / 1000000);
 }
 
 void _panic(void)
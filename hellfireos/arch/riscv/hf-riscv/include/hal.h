@@ -14,6 +14,10 @@ typedef void				(*funcptr)();
 #define _di()				_interrupt_set(0)
 #define _ei(S)				_interrupt_set(S)
 
+/* libc block memory routines: machine word and unaligned loads (no misaligned loads, unaligned sources are merged by shifts) */
+#define MEM_WORD			uint32_t
+#define MEM_UNALIGNED			0
+
 /* configure, read and write board pins */
 #define _port_setup(a, opts)		*(volatile uint32_t *)(a) = (opts)
 #define _port_read(a)			(*(volatile uint32_t *)(a))
@@ -37,9 +41,26 @@ typedef void				(*funcptr)();
 #define EXTIO_IN			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x080))
 #define EXTIO_OUT			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x090))
 #define EXTIO_DIR			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x0a0))
+#define CHECKPOINT			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x0b0))	/* simulator only */
+#define IDLE_HINT			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x0c0))	/* simulator only */
 #define DEBUG_ADDR			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x0d0))
 #define UART				(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x0e0))
 #define UART_DIVISOR			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x0f0))
+#define TRACE_CTRL			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x100))	/* simulator only */
+#define NIC_CTRL			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x200))	/* simulator only, virtual Ethernet interface */
+#define NIC_STATUS			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x210))	/* simulator only */
+#define NIC_RXADDR			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x220))	/* simulator only */
+#define NIC_RXLEN			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x230))	/* simulator only */
+#define NIC_TXADDR			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x240))	/* simulator only */
+#define NIC_TXLEN			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x250))	/* simulator only */
+#define NIC_MAC0			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x260))	/* simulator only */
+#define NIC_MAC1			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x270))	/* simulator only */
+#define BLK_CTRL			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x300))	/* simulator only, virtual block device */
+#define BLK_STATUS			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x310))	/* simulator only */
+#define BLK_SECTOR			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x320))	/* simulator only */
+#define BLK_COUNT			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x330))	/* simulator only */
+#define BLK_ADDR			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x340))	/* simulator only */
+#define BLK_SECTORS			(*(volatile uint32_t *)(PERIPHERALS_BASE + 0x350))	/* simulator only */
 
 #define IRQ_COUNTER			0x00000001
 #define IRQ_COUNTER_NOT			0x00000002
@@ -88,6 +109,7 @@ typedef void				(*funcptr)();
 
 /* hardware dependent stuff */
 #define STACK_MAGIC			0xb00bb00b
+#define CPU_LEVELS			1		/* core clock levels (_cpu_level()), the clock is fixed */
 typedef uint32_t context[20];
 
 int32_t _interrupt_set(int32_t s);
@@ -101,6 +123,18 @@ int32_t kbhit(void);
 int32_t getchar(void);
 void dputchar(int32_t value);
 
+/* user level performance counters (RDCYCLE, RDTIME, RDINSTRET and hpmcounter3 .. 7) */
+#define PERF_CYCLE			0
+#define PERF_TIME			1
+#define PERF_INSTRET			2
+#define PERF_LOADS			3	/* simulator events (hpmcounter3 .. 7) */
+#define PERF_STORES			4
+#define PERF_BRANCHES			5
+#define PERF_TAKEN			6
+#define PERF_JUMPS			7
+
+uint64_t hf_perfcounter_read(uint32_t counter);
+
 /* hardware dependent stuff */
 void delay_ms(uint32_t msec);
 void delay_us(uint32_t usec);
@@ -121,7 +155,12 @@ size_t _get_task_sp(uint16_t task);
 void _set_task_tp(uint16_t task, void (*entry)());
 void *_get_task_tp(uint16_t task);
 void _timer_reset(void);
+void _irq_sched_open(void);
+void _irq_sched_close(void);
+uint32_t _timer_tickless(uint32_t ticks);
+uint32_t _timer_tickless_end(void);
 void _cpu_idle(void);
+int32_t _cpu_level(uint32_t level);
 uint32_t _readcounter(void);
 uint64_t _read_us(void);
 void _panic(void);
@@ -1,3 +1,18 @@
 block:
 	$(CC) $(CFLAGS) \
 		$(SRC_DIR)/drivers/block/ramdisk.c
+
+# needs the SPI driver (drivers/spi.mak, and its include directory)
+sramdisk:
+	$(CC) $(CFLAGS) \
+		$(SRC_DIR)/drivers/block/sramdisk.c
+
+# needs the virtual disk of the simulators (hf-risc and hf-riscv ports)
+simdisk:
+	$(CC) $(CFLAGS) \
+		$(SRC_DIR)/drivers/block/simdisk.c
+
+# needs the NoC driver (drivers/noc.mak, and its include directory)
+nocdisk:
+	$(CC) $(CFLAGS) \
+		$(SRC_DIR)/drivers/block/nocdisk.c
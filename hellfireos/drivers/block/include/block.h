@@ -4,7 +4,14 @@ enum {
 	DISK_SEEKSET,
 	DISK_SEEKCUR,
 	DISK_SEEKEND,
-	DISK_FINISH
+	DISK_FINISH,
+	DISK_MAP
+};
+
+/* DISK_MAP: memory backed devices return the address of a sector, for direct (read only) access */
+struct blk_map {
+	uint32_t sector;
+	void *ptr;
 };
 
 struct blk_info {
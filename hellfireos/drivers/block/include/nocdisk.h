@@ -0,0 +1,43 @@
+/* file:          nocdisk.h
+ * description:   remote block device, served by another core over the NoC (RPC)
+ * date:          10/2026
+ *
+ * noc.h, rpc.h and device.h must be included first.
+ */
+
+#define NOCDISK_DEBUG		0
+
+#ifndef NOCDISK_CACHE
+#define NOCDISK_CACHE		16		/* sectors cached by the client (0: no cache) */
+#endif
+
+#ifndef NOCDISK_SPAN
+#define NOCDISK_SPAN		8		/* sectors read by the server at once */
+#endif
+
+#ifndef NOCDISK_WINDOW
+#define NOCDISK_WINDOW		4		/* calls in flight on a transfer */
+#endif
+
+#define NOCDISK_CHUNK		RPC_RES_SIZE	/* bytes carried by a read call */
+
+/* procedures of the server */
+#define NOCDISK_INFO		0
+#define NOCDISK_READ		1
+#define NOCDISK_WRITE		2
+
+/* DISK_INIT of the client */
+struct nocdisk_server {
+	uint16_t cpu;				/* core of the server */
+	uint16_t port;				/* port of the server task */
+	uint16_t channel;			/* channel of the requests (on the server) */
+	uint16_t reply;				/* channel of the replies (on the calling task) */
+};
+
+int32_t nocdisk_serve(struct device *dev, uint16_t port, uint16_t channel);
+
+int32_t nocdisk_open(uint32_t flags);
+int32_t nocdisk_read(void *buf, uint32_t size);
+int32_t nocdisk_write(void *buf, uint32_t size);
+int32_t nocdisk_close(void);
+int32_t nocdisk_ioctl(uint32_t request, void *pval);
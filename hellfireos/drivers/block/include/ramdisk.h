@@ -1,5 +1,9 @@
 #define RAMDISK_DEBUG	0
 
+#ifndef RAMDISK_SECTOR_SIZE
+#define RAMDISK_SECTOR_SIZE	512		/* bytes per sector (a power of 2, 64 to 65536) */
+#endif
+
 int32_t ramdisk_open(uint32_t flags);
 int32_t ramdisk_read(void *buf, uint32_t size);
 int32_t ramdisk_write(void *buf, uint32_t size);
@@ -0,0 +1,18 @@
+/* file:          simdisk.h
+ * description:   block device driver for the virtual disk of the simulators
+ * date:          10/2026
+ */
+
+#define SIMDISK_DEBUG		0
+
+#define SIMDISK_SECTOR_SIZE	512		/* bytes per sector, fixed by the simulator */
+
+#define SIMDISK_READ		1		/* commands (BLK_CTRL) */
+#define SIMDISK_WRITE		2
+#define SIMDISK_SYNC		3
+
+int32_t simdisk_open(uint32_t flags);
+int32_t simdisk_read(void *buf, uint32_t size);
+int32_t simdisk_write(void *buf, uint32_t size);
+int32_t simdisk_close(void);
+int32_t simdisk_ioctl(uint32_t request, void *pval);
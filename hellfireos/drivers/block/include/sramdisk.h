@@ -0,0 +1,18 @@
+/* file:          sramdisk.h
+ * description:   block device driver for Microchip 23lcxx SPI SRAM chips
+ * date:          10/2026
+ */
+
+#define SRAMDISK_DEBUG		0
+
+#ifndef SRAMDISK_SECTOR_SIZE
+#define SRAMDISK_SECTOR_SIZE	512		/* bytes per sector (a power of 2, 64 to 65536) */
+#endif
+
+#define SRAM_MODE_SEQ		0x40		/* mode register: sequential mode */
+
+int32_t sramdisk_open(uint32_t flags);
+int32_t sramdisk_read(void *buf, uint32_t size);
+int32_t sramdisk_write(void *buf, uint32_t size);
+int32_t sramdisk_close(void);
+int32_t sramdisk_ioctl(uint32_t request, void *pval);
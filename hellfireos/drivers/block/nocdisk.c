@@ -0,0 +1,382 @@
+/* file:          nocdisk.c
+ * description:   remote block device, served by another core over the NoC (RPC)
+ * date:          10/2026
+ *
+ * a core which owns a block device exports it with nocdisk_serve(), called by a
+ * server task, and the other cores use the nocdisk block device (struct device) as
+ * if the disk was local, so a uhfs volume can be mounted by every core of the mesh.
+ *
+ * transfers are RPC calls (drivers/noc/rpc.c). a read gives the server a span of
+ * up to NOCDISK_SPAN sectors, which the server reads from the device at once, and
+ * is split into NOCDISK_CHUNK byte calls (the largest result of a procedure), with
+ * up to NOCDISK_WINDOW calls in flight. a write sends as many sectors as fit a
+ * message on each call. call arguments (high byte first):
+ *
+ *	NOCDISK_INFO	-			result: sectors (32 bit), sector size (16 bit)
+ *	NOCDISK_READ	lba, count, offset	result: span bytes from offset
+ *	NOCDISK_WRITE	lba, count, data
+ *
+ * the client keeps a direct mapped, write through cache of NOCDISK_CACHE sectors.
+ * caches of different clients are not kept coherent, so a volume shared by several
+ * cores should be written by only one of them (or built with NOCDISK_CACHE 0). replies
+ * arrive on the communication queue of the task which called DISK_INIT, so only that
+ * task may use the device. DISK_INIT takes a struct nocdisk_server.
+ */
+
+#include <hellfire.h>
+#include <noc.h>
+#include <rpc.h>
+#include <device.h>
+#include <block.h>
+#include <nocdisk.h>
+
+static void put16(int8_t *p, uint16_t val)
+{
+	p[0] = val >> 8;
+	p[1] = val & 0xff;
+}
+
+static uint16_t get16(int8_t *p)
+{
+	return ((uint8_t)p[0] << 8) | (uint8_t)p[1];
+}
+
+static void put32(int8_t *p, uint32_t val)
+{
+	put16(p, val >> 16);
+	put16(p + 2, val & 0xffff);
+}
+
+static uint32_t get32(int8_t *p)
+{
+	return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+/* server */
+
+static struct device *srv_dev;
+static struct blk_info srv_info;
+static int8_t *srv_span;
+static uint32_t srv_lba, srv_count;
+
+static int32_t srv_getinfo(int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size)
+{
+	put32(res, srv_info.num_sectors);
+	put16(res + 4, srv_info.bytes_sector);
+	*res_size = 6;
+
+	return ERR_OK;
+}
+
+static int32_t srv_read(int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size)
+{
+	uint32_t lba, count, offset, total, len;
+
+	if (size != 12)
+		return ERR_INVALID_PARAMETER;
+	lba = get32(arg);
+	count = get32(arg + 4);
+	offset = get32(arg + 8);
+	total = count * srv_info.bytes_sector;
+	if (count < 1 || count > NOCDISK_SPAN || lba + count > srv_info.num_sectors || lba + count < lba || offset >= total)
+		return ERR_INVALID_PARAMETER;
+	if (lba != srv_lba || count != srv_count){
+		srv_count = 0;
+		if (hf_dev_readblk(srv_dev, lba, srv_span, count))
+			return ERR_ERROR;
+		srv_lba = lba;
+		srv_count = count;
+	}
+	len = total - offset > NOCDISK_CHUNK ? NOCDISK_CHUNK : total - offset;
+	memcpy(res, srv_span + offset, len);
+	*res_size = len;
+
+	return ERR_OK;
+}
+
+static int32_t srv_write(int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size)
+{
+	uint32_t lba, count;
+
+	if (size < 8)
+		return ERR_INVALID_PARAMETER;
+	lba = get32(arg);
+	count = get32(arg + 4);
+	if (count < 1 || size != 8 + count * srv_info.bytes_sector || lba + count > srv_info.num_sectors || lba + count < lba)
+		return ERR_INVALID_PARAMETER;
+	if (lba < srv_lba + srv_count && srv_lba < lba + count)
+		srv_count = 0;
+#if NOCDISK_DEBUG == 1
+	kprintf("\nDEBUG: nocdisk write() block %d, %d sectors", lba, count);
+#endif
+
+	return hf_dev_writeblk(srv_dev, lba, arg + 8, count) ? ERR_ERROR : ERR_OK;
+}
+
+/*
+ * exports a block device to the other cores. the calling task binds port and serves
+ * requests on a channel, in a loop, so it only returns if the server can't be set up.
+ * the device must be initialized (DISK_INIT) before.
+ */
+int32_t nocdisk_serve(struct device *dev, uint16_t port, uint16_t channel)
+{
+	struct rpc_server srv;
+	int32_t err;
+
+	srv_dev = dev;
+	if (hf_dev_ioctl(dev, DISK_GETINFO, &srv_info))
+		return ERR_ERROR;
+	srv_span = hf_malloc(NOCDISK_SPAN * srv_info.bytes_sector);
+	if (!srv_span)
+		return ERR_OUT_OF_MEMORY;
+	srv_count = 0;
+	err = hf_rpc_server(&srv, port, channel);
+	if (err){
+		hf_free(srv_span);
+		return err;
+	}
+	hf_rpc_register(&srv, NOCDISK_INFO, srv_getinfo);
+	hf_rpc_register(&srv, NOCDISK_READ, srv_read);
+	hf_rpc_register(&srv, NOCDISK_WRITE, srv_write);
+	kprintf("\nKERNEL: nocdisk serving %d sectors on port %d", srv_info.num_sectors, port);
+
+	while (1){
+		err = hf_rpc_serve(&srv);
+		if (err)
+			kprintf("\nnocdisk_serve: error %d", err);
+	}
+
+	return ERR_OK;
+}
+
+/* client */
+
+static struct rpc_client client;
+static struct blk_info nocdisk_info;
+static uint32_t nocpos = -1, wspan;
+static int8_t *wbuf;
+#if NOCDISK_CACHE > 0
+static int8_t *cache;
+static uint32_t cache_lba[NOCDISK_CACHE];
+#endif
+
+/* cached copy of a sector, or NULL */
+static int8_t *cache_lookup(uint32_t lba)
+{
+#if NOCDISK_CACHE > 0
+	if (cache_lba[lba % NOCDISK_CACHE] == lba)
+		return cache + (lba % NOCDISK_CACHE) * nocdisk_info.bytes_sector;
+#endif
+	return NULL;
+}
+
+static void cache_fill(uint32_t lba, int8_t *buf)
+{
+#if NOCDISK_CACHE > 0
+	cache_lba[lba % NOCDISK_CACHE] = lba;
+	memcpy(cache + (lba % NOCDISK_CACHE) * nocdisk_info.bytes_sector, buf, nocdisk_info.bytes_sector);
+#endif
+}
+
+/* waits for the oldest call in flight, keeping the first error */
+static void remote_wait(struct rpc_future *f, int32_t *err)
+{
+	int32_t r;
+
+	r = hf_rpc_wait(&client, f);
+	if (!f->done)
+		hf_rpc_cancel(&client, f);
+	if (r && !*err)
+		*err = r;
+}
+
+/* count sectors (a span) from lba, in NOCDISK_CHUNK byte calls */
+static int32_t remote_read(uint32_t lba, uint32_t count, int8_t *buf)
+{
+	struct rpc_future f[NOCDISK_WINDOW];
+	int8_t arg[12];
+	uint32_t total, offset, len, n = 0, done = 0;
+	int32_t err = 0;
+
+	total = count * nocdisk_info.bytes_sector;
+	put32(arg, lba);
+	put32(arg + 4, count);
+	for (offset = 0; done < n || (offset < total && !err); ){
+		if (offset < total && !err && n - done < NOCDISK_WINDOW){
+			len = total - offset > NOCDISK_CHUNK ? NOCDISK_CHUNK : total - offset;
+			put32(arg + 8, offset);
+			err = hf_rpc_call_async(&client, NOCDISK_READ, arg, sizeof(arg), buf + offset, len, &f[n % NOCDISK_WINDOW]);
+			if (err) continue;
+			offset += len;
+			n++;
+			continue;
+		}
+		remote_wait(&f[done % NOCDISK_WINDOW], &err);
+		if (!err && f[done % NOCDISK_WINDOW].res_size != f[done % NOCDISK_WINDOW].res_max)
+			err = ERR_ERROR;
+		done++;
+	}
+
+	return err;
+}
+
+/* count sectors from lba, in calls of up to wspan sectors */
+static int32_t remote_write(uint32_t lba, uint32_t count, int8_t *buf)
+{
+	struct rpc_future f[NOCDISK_WINDOW];
+	uint32_t i, len, n = 0, done = 0;
+	int32_t err = 0;
+
+	for (i = 0; done < n || (i < count && !err); ){
+		if (i < count && !err && n - done < NOCDISK_WINDOW){
+			len = count - i > wspan ? wspan : count - i;
+			put32(wbuf, lba + i);
+			put32(wbuf + 4, len);
+			memcpy(wbuf + 8, buf + i * nocdisk_info.bytes_sector, len * nocdisk_info.bytes_sector);
+			err = hf_rpc_call_async(&client, NOCDISK_WRITE, wbuf, 8 + len * nocdisk_info.bytes_sector, NULL, 0, &f[n % NOCDISK_WINDOW]);
+			if (err) continue;
+			i += len;
+			n++;
+			continue;
+		}
+		remote_wait(&f[done % NOCDISK_WINDOW], &err);
+		done++;
+	}
+
+	return err;
+}
+
+int32_t nocdisk_open(uint32_t flags)
+{
+	return 0;
+}
+
+/* size is the number of sectors, transferred from the current position */
+int32_t nocdisk_read(void *buf, uint32_t size)
+{
+	int8_t *p = buf, *c;
+	uint32_t i, j, n, bs = nocdisk_info.bytes_sector;
+
+	if (nocpos + size > nocdisk_info.num_sectors || nocpos + size < nocpos || size < 1)
+		return -1;
+#if NOCDISK_DEBUG == 1
+	kprintf("\nDEBUG: read() block %d, %d sectors", nocpos, size);
+#endif
+	for (i = 0; i < size; i += n){
+		c = cache_lookup(nocpos + i);
+		if (c){
+			memcpy(p + i * bs, c, bs);
+			n = 1;
+			continue;
+		}
+		for (n = 1; i + n < size && n < NOCDISK_SPAN && !cache_lookup(nocpos + i + n); n++);
+		if (remote_read(nocpos + i, n, p + i * bs))
+			return -1;
+		for (j = 0; j < n; j++)
+			cache_fill(nocpos + i + j, p + (i + j) * bs);
+	}
+	nocpos += size;
+
+	return 0;
+}
+
+int32_t nocdisk_write(void *buf, uint32_t size)
+{
+	int8_t *p = buf;
+	uint32_t i;
+
+	if (nocpos + size > nocdisk_info.num_sectors || nocpos + size < nocpos || size < 1)
+		return -1;
+#if NOCDISK_DEBUG == 1
+	kprintf("\nDEBUG: write() block %d, %d sectors", nocpos, size);
+#endif
+	if (remote_write(nocpos, size, p)){
+#if NOCDISK_CACHE > 0
+		for (i = 0; i < size; i++)
+			if (cache_lookup(nocpos + i))
+				cache_lba[(nocpos + i) % NOCDISK_CACHE] = -1;
+#endif
+		return -1;
+	}
+	for (i = 0; i < size; i++)
+		cache_fill(nocpos + i, p + i * nocdisk_info.bytes_sector);
+	nocpos += size;
+
+	return 0;
+}
+
+int32_t nocdisk_close(void)
+{
+	return 0;
+}
+
+int32_t nocdisk_ioctl(uint32_t request, void *pval)
+{
+	struct nocdisk_server *s;
+	struct blk_info *infoptr;
+	int8_t res[RPC_RES_SIZE];
+	uint16_t res_size;
+	uint32_t i;
+
+	switch (request){
+	case DISK_INIT:
+		s = (struct nocdisk_server *)pval;
+		if (hf_rpc_client(&client, s->cpu, s->port, s->channel, s->reply))
+			return -1;
+		if (hf_rpc_call(&client, NOCDISK_INFO, NULL, 0, res, &res_size) || res_size != 6){
+			hf_rpc_close(&client);
+			return -1;
+		}
+		nocdisk_info.num_cylinders = 0;
+		nocdisk_info.num_heads = 0;
+		nocdisk_info.sectors_track = 0;
+		nocdisk_info.num_sectors = get32(res);
+		nocdisk_info.bytes_sector = get16(res + 4);
+		nocdisk_info.media_desc = 0x1000;
+
+		/* sectors of a write call, with its arguments, on a request message */
+		wspan = (RPC_MSG_SIZE - 2 - RPC_HEADER_SIZE - 8) / nocdisk_info.bytes_sector;
+		wbuf = wspan ? hf_malloc(8 + wspan * nocdisk_info.bytes_sector) : NULL;
+		if (!wbuf){
+			hf_rpc_close(&client);
+			return -1;
+		}
+#if NOCDISK_CACHE > 0
+		cache = hf_malloc(NOCDISK_CACHE * nocdisk_info.bytes_sector);
+		if (!cache){
+			hf_free(wbuf);
+			hf_rpc_close(&client);
+			return -1;
+		}
+		for (i = 0; i < NOCDISK_CACHE; i++)
+			cache_lba[i] = -1;
+#endif
+		nocpos = 0;
+		kprintf("\nKERNEL: nocdisk on cpu %d, %d sectors", s->cpu, nocdisk_info.num_sectors);
+		break;
+	case DISK_GETINFO:
+		infoptr = (struct blk_info *)pval;
+		*infoptr = nocdisk_info;
+		break;
+	case DISK_SEEKSET:
+		nocpos = (uint32_t)pval;
+		break;
+	case DISK_SEEKCUR:
+		return nocpos;
+	case DISK_SEEKEND:
+		nocpos = nocdisk_info.num_sectors;
+		break;
+	case DISK_FINISH:
+#if NOCDISK_CACHE > 0
+		hf_free(cache);
+#endif
+		hf_free(wbuf);
+		hf_rpc_close(&client);
+		nocpos = -1;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
@@ -11,27 +11,30 @@ int32_t ramdisk_open(uint32_t flags)
 	return 0;
 }
 
+/* size is the number of sectors, transferred from the current position */
 int32_t ramdisk_read(void *buf, uint32_t size)
 {
+	if ((rampos + size) * ramdisk_info.bytes_sector > lastpos + 1 || size < 1)
+		return -1;
 #if RAMDISK_DEBUG == 1
-	kprintf("\nDEBUG: read() block %d", rampos);
+	kprintf("\nDEBUG: read() block %d, %d sectors", rampos, size);
 #endif
-	memcpy(buf, ramarena + rampos * ramdisk_info.bytes_sector, ramdisk_info.bytes_sector);
-	rampos++;
+	memcpy(buf, ramarena + rampos * ramdisk_info.bytes_sector, size * ramdisk_info.bytes_sector);
+	rampos += size;
 
 	return 0;
 }
 
 int32_t ramdisk_write(void *buf, uint32_t size)
 {
-	if ((rampos * ramdisk_info.bytes_sector + ramdisk_info.bytes_sector > lastpos + 1) || size < 1)
+	if ((rampos + size) * ramdisk_info.bytes_sector > lastpos + 1 || size < 1)
 		return -1;
 #if RAMDISK_DEBUG == 1
-	kprintf("\nDEBUG: write() block %d", rampos);
-	hexdump(buf, ramdisk_info.bytes_sector);
+	kprintf("\nDEBUG: write() block %d, %d sectors", rampos, size);
+	hexdump(buf, size * ramdisk_info.bytes_sector);
 #endif
-	memcpy(ramarena + rampos * ramdisk_info.bytes_sector, buf, ramdisk_info.bytes_sector);
-	rampos++;
+	memcpy(ramarena + rampos * ramdisk_info.bytes_sector, buf, size * ramdisk_info.bytes_sector);
+	rampos += size;
 	
 	return 0;
 }
@@ -44,6 +47,7 @@ int32_t ramdisk_close(void)
 int32_t ramdisk_ioctl(uint32_t request, void *pval)
 {
 	static struct blk_info *infoptr;
+	struct blk_map *map;
 	
 	switch (request){
 	case DISK_INIT:
@@ -51,10 +55,10 @@ int32_t ramdisk_ioctl(uint32_t request, void *pval)
 		ramdisk_info.num_heads = 0;
 		ramdisk_info.sectors_track = 0;
 		ramdisk_info.num_sectors = (uint32_t)pval;
-		ramdisk_info.bytes_sector = 128;
+		ramdisk_info.bytes_sector = RAMDISK_SECTOR_SIZE;
 		ramdisk_info.media_desc = 0x1000;
 
-		ramarena = (int8_t *)hf_malloc((size_t)pval * ramdisk_info.bytes_sector);
+		ramarena = (int8_t *)hf_malloc_region((size_t)pval * ramdisk_info.bytes_sector, HEAP_EXTERNAL);
 		if (!ramarena) return -1;		
 		rampos = 0;
 		lastpos = (int32_t)pval * ramdisk_info.bytes_sector - 1;
@@ -72,6 +76,12 @@ int32_t ramdisk_ioctl(uint32_t request, void *pval)
 	case DISK_SEEKEND:
 		rampos = lastpos;
 		break;
+	case DISK_MAP:
+		map = (struct blk_map *)pval;
+		if (!ramarena || map->sector * ramdisk_info.bytes_sector > lastpos)
+			return -1;
+		map->ptr = ramarena + map->sector * ramdisk_info.bytes_sector;
+		break;
 	case DISK_FINISH:
 		hf_free(ramarena);
 		rampos = -1;
@@ -0,0 +1,109 @@
+/* file:          simdisk.c
+ * description:   block device driver for the virtual disk of the simulators
+ * date:          10/2026
+ *
+ * a block device (struct device) on the virtual disk of hf_risc_sim and hf_riscv_sim (-d
+ * disk.img), a host image file, so a uhfs volume may be larger than the simulated heap
+ * and is kept across runs. DISK_INIT takes the number of sectors to use (0 for the whole
+ * image). each read or write moves all of its sectors with a single command, straight
+ * between the image and the buffer. closing the device flushes the image to the host.
+ */
+
+#include <hellfire.h>
+#include <block.h>
+#include <simdisk.h>
+
+static uint32_t simpos = -1;
+static struct blk_info simdisk_info;
+
+int32_t simdisk_open(uint32_t flags)
+{
+	return 0;
+}
+
+static int32_t simdisk_cmd(uint32_t cmd, void *buf, uint32_t size)
+{
+	if (size < 1 || simpos >= simdisk_info.num_sectors || size > simdisk_info.num_sectors - simpos)
+		return -1;
+	BLK_SECTOR = simpos;
+	BLK_COUNT = size;
+	BLK_ADDR = (uint32_t)buf;
+	BLK_CTRL = cmd;
+	if (BLK_STATUS)
+		return -1;
+	simpos += size;
+
+	return 0;
+}
+
+/* size is the number of sectors, transferred from the current position */
+int32_t simdisk_read(void *buf, uint32_t size)
+{
+#if SIMDISK_DEBUG == 1
+	kprintf("\nDEBUG: read() block %d, %d sectors", simpos, size);
+#endif
+	return simdisk_cmd(SIMDISK_READ, buf, size);
+}
+
+int32_t simdisk_write(void *buf, uint32_t size)
+{
+#if SIMDISK_DEBUG == 1
+	kprintf("\nDEBUG: write() block %d, %d sectors", simpos, size);
+#endif
+	return simdisk_cmd(SIMDISK_WRITE, buf, size);
+}
+
+int32_t simdisk_close(void)
+{
+	BLK_CTRL = SIMDISK_SYNC;
+
+	return BLK_STATUS ? -1 : 0;
+}
+
+int32_t simdisk_ioctl(uint32_t request, void *pval)
+{
+	static struct blk_info *infoptr;
+	uint32_t sectors;
+
+	switch (request){
+	case DISK_INIT:
+		sectors = BLK_SECTORS;
+		if (sectors == 0 || (uint32_t)pval > sectors)
+			return -1;
+		if ((uint32_t)pval)
+			sectors = (uint32_t)pval;
+
+		simdisk_info.num_cylinders = 0;
+		simdisk_info.num_heads = 0;
+		simdisk_info.sectors_track = 0;
+		simdisk_info.num_sectors = sectors;
+		simdisk_info.bytes_sector = SIMDISK_SECTOR_SIZE;
+		simdisk_info.media_desc = 0x1002;
+		simpos = 0;
+		kprintf("\nKERNEL: simdisk initialized, %d bytes", sectors * SIMDISK_SECTOR_SIZE);
+		break;
+	case DISK_GETINFO:
+		infoptr = (struct blk_info *)pval;
+		*infoptr = simdisk_info;
+		break;
+	case DISK_SEEKSET:
+		if ((uint32_t)pval >= simdisk_info.num_sectors)
+			return -1;
+		simpos = (uint32_t)pval;
+		break;
+	case DISK_SEEKCUR:
+		return simpos;
+	case DISK_SEEKEND:
+		simpos = simdisk_info.num_sectors;
+		break;
+	case DISK_FINISH:
+		BLK_CTRL = SIMDISK_SYNC;
+		simpos = -1;
+		simdisk_info.num_sectors = 0;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
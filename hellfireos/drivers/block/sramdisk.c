@@ -0,0 +1,108 @@
+/* file:          sramdisk.c
+ * description:   block device driver for Microchip 23lcxx SPI SRAM chips
+ * date:          10/2026
+ *
+ * a block device (struct device) on top of the 23lc512 / 23lc1024 driver, so a uhfs
+ * volume (or any sector based data) can be placed on the external SRAM. DISK_INIT
+ * takes the size of the chip in bytes (65536 or 131072), and the SPI port must be set
+ * up (spi_setup()) with the chip select of the SRAM before. each read or write moves
+ * all of its sectors in a single sequential mode burst.
+ */
+
+#include <hellfire.h>
+#include <spi.h>
+#include <sram23lcxx.h>
+#include <block.h>
+#include <sramdisk.h>
+
+static uint32_t srampos = -1, sramsize = 0;
+static uint8_t hiaddr;
+static struct blk_info sramdisk_info;
+
+int32_t sramdisk_open(uint32_t flags)
+{
+	return 0;
+}
+
+/* size is the number of sectors, transferred from the current position */
+int32_t sramdisk_read(void *buf, uint32_t size)
+{
+	if ((srampos + size) * sramdisk_info.bytes_sector > sramsize || size < 1)
+		return -1;
+#if SRAMDISK_DEBUG == 1
+	kprintf("\nDEBUG: read() block %d, %d sectors", srampos, size);
+#endif
+	sram25lcxx_read(srampos * sramdisk_info.bytes_sector, hiaddr, buf, size * sramdisk_info.bytes_sector);
+	srampos += size;
+
+	return 0;
+}
+
+int32_t sramdisk_write(void *buf, uint32_t size)
+{
+	if ((srampos + size) * sramdisk_info.bytes_sector > sramsize || size < 1)
+		return -1;
+#if SRAMDISK_DEBUG == 1
+	kprintf("\nDEBUG: write() block %d, %d sectors", srampos, size);
+#endif
+	sram25lcxx_write(srampos * sramdisk_info.bytes_sector, hiaddr, buf, size * sramdisk_info.bytes_sector);
+	srampos += size;
+
+	return 0;
+}
+
+int32_t sramdisk_close(void)
+{
+	return 0;
+}
+
+int32_t sramdisk_ioctl(uint32_t request, void *pval)
+{
+	static struct blk_info *infoptr;
+
+	switch (request){
+	case DISK_INIT:
+		if ((uint32_t)pval != 65536 && (uint32_t)pval != 131072)
+			return -1;
+		sramsize = (uint32_t)pval;
+		hiaddr = sramsize > 65536;
+
+		sramdisk_info.num_cylinders = 0;
+		sramdisk_info.num_heads = 0;
+		sramdisk_info.sectors_track = 0;
+		sramdisk_info.num_sectors = sramsize / SRAMDISK_SECTOR_SIZE;
+		sramdisk_info.bytes_sector = SRAMDISK_SECTOR_SIZE;
+		sramdisk_info.media_desc = 0x1001;
+
+		/* the chips power up in sequential mode, but set it anyway */
+		spi_start();
+		spi_sendrecv(CMD_WRMR);
+		spi_sendrecv(SRAM_MODE_SEQ);
+		spi_stop();
+		srampos = 0;
+		kprintf("\nKERNEL: sramdisk initialized, %d bytes", sramsize);
+		break;
+	case DISK_GETINFO:
+		infoptr = (struct blk_info *)pval;
+		*infoptr = sramdisk_info;
+		break;
+	case DISK_SEEKSET:
+		if ((uint32_t)pval >= sramdisk_info.num_sectors)
+			return -1;
+		srampos = (uint32_t)pval;
+		break;
+	case DISK_SEEKCUR:
+		return srampos;
+	case DISK_SEEKEND:
+		srampos = sramdisk_info.num_sectors;
+		break;
+	case DISK_FINISH:
+		srampos = -1;
+		sramsize = 0;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
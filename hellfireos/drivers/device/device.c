@@ -1,5 +1,6 @@
 #include <hellfire.h>
 #include <device.h>
+#include <block.h>
 
 int32_t hf_dev_open(struct device *dev, uint32_t flags)
 {
@@ -49,3 +50,221 @@ int32_t hf_dev_ioctl(struct device *dev, uint32_t request, void *pval)
 {
 	return dev->dev_ioctl(request, pval);
 }
+
+#ifndef DEV_MERGE_MAX
+#define DEV_MERGE_MAX		16			/* requests merged in a single batch */
+#endif
+
+static struct device *dev_queued[DEV_QUEUE_MAX];
+static sem_t dev_iosem;
+
+/* move count sectors from / to the device, seeking to lba first (unless seek is 0) */
+static int32_t dev_transfer(struct device *dev, uint32_t op, uint32_t lba, void *buf, uint32_t count, int32_t seek)
+{
+	int32_t err = 0;
+	
+	if (seek)
+		err = dev->dev_ioctl(DISK_SEEKSET, (void *)lba);
+	if (!err)
+		err = op == DEV_REQ_WRITE ? dev->dev_write(buf, count) : dev->dev_read(buf, count);
+	
+	return err;
+}
+
+static int32_t dev_transfer_locked(struct device *dev, uint32_t op, uint32_t lba, void *buf, uint32_t count)
+{
+	int32_t err;
+	
+	if (!dev->queue)
+		return dev_transfer(dev, op, lba, buf, count, 1);
+	hf_mtxlock(&dev->queue->lock);
+	err = dev_transfer(dev, op, lba, buf, count, 1);
+	hf_mtxunlock(&dev->queue->lock);
+	
+	return err;
+}
+
+/* block devices: transfer count sectors, starting from a sector (lba) */
+int32_t hf_dev_readblk(struct device *dev, uint32_t lba, void *buf, uint32_t count)
+{
+	int32_t err;
+	
+	err = dev_transfer_locked(dev, DEV_REQ_READ, lba, buf, count);
+	if (err)
+		kprintf("\nhf_dev_readblk: error");
+	
+	return err;
+}
+
+int32_t hf_dev_writeblk(struct device *dev, uint32_t lba, void *buf, uint32_t count)
+{
+	int32_t err;
+	
+	err = dev_transfer_locked(dev, DEV_REQ_WRITE, lba, buf, count);
+	if (err)
+		kprintf("\nhf_dev_writeblk: error");
+	
+	return err;
+}
+
+static void dev_complete(struct dev_request *req, int32_t err)
+{
+	req->status = err;
+	if (req->callback)
+		req->callback(req);
+	if (req->done)
+		hf_sempost(req->done);
+}
+
+/*
+ * run a batch of requests on adjacent sectors. requests with contiguous buffers are
+ * moved in a single transfer, and the following ones go on from the current position
+ * of the device, without seeking again. after a failed transfer the next one seeks.
+ */
+static void dev_run(struct device *dev, struct dev_request **batch, uint32_t n)
+{
+	struct dev_queue *q = dev->queue;
+	uint32_t i, j, count;
+	int32_t err, seek = 1;
+	
+	hf_mtxlock(&q->lock);
+	for (i = 0; i < n; i = j){
+		count = batch[i]->count;
+		for (j = i + 1; j < n; j++){
+			if ((int8_t *)batch[j]->buf != (int8_t *)batch[j - 1]->buf + batch[j - 1]->count * q->bytes_sector)
+				break;
+			count += batch[j]->count;
+		}
+		err = dev_transfer(dev, batch[i]->op, batch[i]->lba, batch[i]->buf, count, seek);
+		if (err)
+			kprintf("\nhf_dev_submit: error");
+		seek = err != 0;
+		for (; i < j; i++)
+			dev_complete(batch[i], err);
+	}
+	hf_mtxunlock(&q->lock);
+}
+
+/*
+ * block i/o worker task. a single task serves the queues of all devices (one batch from
+ * each device in turn), taking the request on the head of a queue along with the ones
+ * following it on the media (same direction, starting on the sector after the previous
+ * one ends). the semaphore counts submitted requests, so a wakeup may find the queues
+ * empty when requests were merged in a previous batch.
+ */
+static void dev_io(void)
+{
+	struct device *dev = NULL;
+	struct dev_queue *q;
+	struct dev_request *batch[DEV_MERGE_MAX], *req;
+	uint32_t status, i, n, next = 0;
+	
+	while (1){
+		hf_semwait(&dev_iosem);
+		for (i = 0; i < DEV_QUEUE_MAX; i++){
+			dev = dev_queued[(next + i) % DEV_QUEUE_MAX];
+			if (dev && hf_queue_count(dev->queue->requests))
+				break;
+		}
+		if (i == DEV_QUEUE_MAX) continue;
+		next = (next + i + 1) % DEV_QUEUE_MAX;
+		q = dev->queue;
+		
+		status = _di();
+		batch[0] = hf_queue_remhead(q->requests);
+		for (n = 1; n < DEV_MERGE_MAX; n++){
+			req = hf_queue_get(q->requests, 0);
+			if (!req || req->op != batch[0]->op || req->lba != batch[n - 1]->lba + batch[n - 1]->count)
+				break;
+			batch[n] = hf_queue_remhead(q->requests);
+		}
+		_ei(status);
+		
+		dev_run(dev, batch, n);
+	}
+}
+
+/*
+ * create a request queue (up to slots pending requests) for a block device. the first
+ * queue created spawns the block i/o worker task. once a device has a queue, its
+ * synchronous transfers (hf_dev_readblk() / hf_dev_writeblk()) are serialized with the
+ * queued ones.
+ */
+int32_t hf_dev_queue(struct device *dev, uint32_t slots)
+{
+	struct dev_queue *q;
+	struct blk_info info;
+	uint32_t i, first = 1;
+	
+	if (dev->queue)
+		return ERR_ERROR;
+	for (i = 0; i < DEV_QUEUE_MAX; i++)
+		if (dev_queued[i])
+			first = 0;
+	for (i = 0; i < DEV_QUEUE_MAX; i++)
+		if (!dev_queued[i])
+			break;
+	if (i == DEV_QUEUE_MAX)
+		return ERR_EXCEED_MAX_NUM;
+	if (dev->dev_ioctl(DISK_GETINFO, &info) || !info.bytes_sector)
+		return ERR_ERROR;
+	
+	q = hf_malloc(sizeof(struct dev_queue));
+	if (!q)
+		return ERR_OUT_OF_MEMORY;
+	q->requests = hf_queue_create(slots);
+	if (!q->requests){
+		hf_free(q);
+		return ERR_OUT_OF_MEMORY;
+	}
+	hf_mtxinit(&q->lock);
+	q->bytes_sector = info.bytes_sector;
+	
+	if (first){
+		hf_seminit(&dev_iosem, 0);
+		if (hf_spawn(dev_io, 0, 0, 0, "blk io", 1024) < 0){
+			hf_queue_destroy(q->requests);
+			hf_free(q);
+			return ERR_OUT_OF_MEMORY;
+		}
+	}
+	dev->queue = q;
+	dev_queued[i] = dev;
+	
+	return ERR_OK;
+}
+
+/*
+ * submit an asynchronous transfer of req->count sectors, starting from req->lba. the
+ * call returns at once, and the request (and its buffer) belongs to the driver until it
+ * is completed: its status is set to the transfer result, then the callback is called
+ * and the done semaphore is signaled (both are optional). requests of a device are
+ * completed in submission order.
+ */
+int32_t hf_dev_submit(struct device *dev, struct dev_request *req)
+{
+	uint32_t status;
+	
+	if (!dev->queue || !req->count)
+		return ERR_ERROR;
+	req->status = DEV_REQ_PENDING;
+	status = _di();
+	if (hf_queue_addtail(dev->queue->requests, req)){
+		_ei(status);
+		return ERR_EXCEED_MAX_NUM;
+	}
+	_ei(status);
+	hf_sempost(&dev_iosem);
+	
+	return ERR_OK;
+}
+
+/* wait for a request to complete (the request must have its own done semaphore) */
+int32_t hf_dev_wait(struct dev_request *req)
+{
+	if (!req->done)
+		return ERR_ERROR;
+	hf_semwait(req->done);
+	
+	return req->status;
+}
@@ -2,15 +2,44 @@
 #define SEEK_CUR		1
 #define SEEK_END		2
 
+#ifndef DEV_QUEUE_MAX
+#define DEV_QUEUE_MAX		4			/* devices with a request queue */
+#endif
+
+#define DEV_REQ_READ		0
+#define DEV_REQ_WRITE		1
+
+#define DEV_REQ_PENDING		1			/* status of a request not completed yet */
+
+/* asynchronous block request (hf_dev_submit()), owned by the caller until completed */
+struct dev_request {
+	uint32_t lba;						/* first sector */
+	uint32_t count;						/* number of sectors */
+	void *buf;						/* data buffer */
+	uint32_t op;						/* DEV_REQ_READ or DEV_REQ_WRITE */
+	volatile int32_t status;				/* DEV_REQ_PENDING, then the transfer result */
+	sem_t *done;						/* semaphore signaled on completion, or NULL */
+	void (*callback)(struct dev_request *req);		/* called on completion (by the worker task), or NULL */
+	void *arg;						/* caller data */
+};
+
+/* per device request queue, drained by the block i/o worker task */
+struct dev_queue {
+	struct queue *requests;					/* pending requests, in submission order */
+	mutex_t lock;						/* serializes transfers (worker and synchronous calls) */
+	uint32_t bytes_sector;					/* sector size, for merging requests */
+};
+
 struct device {
 	int32_t (*dev_open)(uint32_t flags);
-	int32_t (*dev_read)(void *buf, uint32_t size);		/* size is ignored for block devices */
+	int32_t (*dev_read)(void *buf, uint32_t size);		/* size is a number of sectors for block devices */
 	int32_t (*dev_write)(void *buf, uint32_t size);
 	int32_t (*dev_close)(void);
 	int32_t (*dev_ioctl)(uint32_t request, void *pval);
 	void *ptr;						/* pointer to device specific data
 								(e.g struct fs_blkdevice, struct blk_device
 								or struct chr_device) */
+	struct dev_queue *queue;				/* request queue (hf_dev_queue()), or NULL */
 };
 
 int32_t hf_dev_open(struct device *dev, uint32_t flags);
@@ -18,3 +47,8 @@ int32_t hf_dev_read(struct device *dev, void *buf, uint32_t size);
 int32_t hf_dev_write(struct device *dev, void *buf, uint32_t size);
 int32_t hf_dev_close(struct device *dev);
 int32_t hf_dev_ioctl(struct device *dev, uint32_t request, void *pval);
+int32_t hf_dev_readblk(struct device *dev, uint32_t lba, void *buf, uint32_t count);
+int32_t hf_dev_writeblk(struct device *dev, uint32_t lba, void *buf, uint32_t count);
+int32_t hf_dev_queue(struct device *dev, uint32_t slots);
+int32_t hf_dev_submit(struct device *dev, struct dev_request *req);
+int32_t hf_dev_wait(struct dev_request *req);
@@ -1,3 +1,6 @@
 noc:
 	$(CC) $(CFLAGS) \
-		$(SRC_DIR)/drivers/noc/noc.c 
+		$(SRC_DIR)/drivers/noc/noc.c \
+		$(SRC_DIR)/drivers/noc/rpc.c \
+		$(SRC_DIR)/drivers/noc/coll.c \
+		$(SRC_DIR)/drivers/noc/balance.c
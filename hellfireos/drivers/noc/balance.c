@@ -0,0 +1,277 @@
+/**
+ * @file balance.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ * 
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Load balancing between cores. A balancer task on each core reports the core load (the share
+ * of the processor not taken by the idle task, from hf_cpuload()) to all other cores once per
+ * period, and moves migratable best effort tasks from a saturated core to the least loaded one.
+ * 
+ * Cores run their own images, so code is not shipped: migratable task types are registered
+ * by name on every core (hf_balance_register()), and a task moves by exiting on a migration
+ * point (hf_balance_point()) while the balancer asks the target core to spawn a new instance
+ * of the same type. Migratable tasks must be restartable: they keep no state between migration
+ * points (work is usually pulled from other cores) and own no communication queue there.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <kprintf.h>
+#include <lockstat.h>
+#include <semaphore.h>
+#include <kernel.h>
+#include <task.h>
+#include <processor.h>
+#include <ecodes.h>
+#include <noc.h>
+#include <balance.h>
+
+#define BALANCE_LOAD		0		/* load report: type, load (%) */
+#define BALANCE_MIGRATE		1		/* spawn request: type, task name */
+#define BALANCE_TIMEOUT		10		/* periods to wait for a task to reach a migration point */
+
+static struct balance_entry entries[BALANCE_ENTRIES];
+static int32_t n_entries;
+static uint8_t task_entry[MAX_TASKS];			/* entry (+ 1) of each migratable task, 0 if none */
+static volatile uint16_t task_target[MAX_TASKS];	/* core (+ 1) a task is moving to, 0 if none */
+static volatile uint8_t depart_entry[MAX_TASKS];	/* entry (+ 1) of a task which exited on a migration point */
+static volatile uint16_t depart_target[MAX_TASKS];	/* core (+ 1) it moves to */
+static int16_t loads[NOC_WIDTH * NOC_HEIGHT];		/* last load reported by each core */
+static int32_t moving = -1, moving_age;			/* task being moved, periods since selected */
+static uint32_t balance_period;
+static sem_t balance_sem;
+
+static int32_t balance_find(int8_t *name)
+{
+	int32_t i;
+
+	for (i = 0; i < n_entries; i++)
+		if (!strcmp(entries[i].name, name))
+			return i;
+
+	return -1;
+}
+
+/* handles a message from the balancer of another core */
+static void balance_message(uint16_t cpu, int8_t *msg, uint16_t size)
+{
+	if (size < 2 || cpu >= hf_ncores()) return;
+	switch (msg[0]){
+	case BALANCE_LOAD:
+		loads[cpu] = (uint8_t)msg[1];
+		break;
+	case BALANCE_MIGRATE:
+		msg[size - 1] = '\0';
+		if (hf_balance_spawn(msg + 1) < 0)
+			kprintf("\nKERNEL: balancer, could not spawn task %s from core %d", msg + 1, cpu);
+		break;
+	}
+}
+
+/* asks the target core to spawn the tasks which exited on a migration point */
+static void balance_depart(void)
+{
+	int8_t msg[1 + sizeof(entries[0].name)];
+	int8_t *name;
+	int32_t i;
+
+	for (i = 1; i < MAX_TASKS; i++){
+		if (!depart_entry[i]) continue;
+		name = entries[depart_entry[i] - 1].name;
+		msg[0] = BALANCE_MIGRATE;
+		strcpy(msg + 1, name);
+		if (hf_send(depart_target[i] - 1, BALANCE_PORT, msg, strlen(name) + 2, BALANCE_CHANNEL))
+			kprintf("\nKERNEL: balancer, could not move task %s", name);
+		depart_entry[i] = 0;
+		if (moving == i)
+			moving = -1;
+	}
+}
+
+/* reports the load of this core to all other cores */
+static void balance_report(void)
+{
+	int8_t msg[2];
+
+	loads[hf_cpuid()] = 100 - hf_cpuload(0);
+	msg[0] = BALANCE_LOAD;
+	msg[1] = loads[hf_cpuid()];
+	hf_multicast(0xffffffff, BALANCE_PORT, msg, sizeof(msg), BALANCE_CHANNEL);
+}
+
+/* selects a task to be moved if this core is saturated and another has spare capacity */
+static void balance_decide(void)
+{
+	int32_t i, t = -1, e;
+
+	if (moving >= 0){
+		if (++moving_age > BALANCE_TIMEOUT){
+			task_target[moving] = 0;
+			moving = -1;
+		}
+		return;
+	}
+	if (loads[hf_cpuid()] < BALANCE_HIGH) return;
+
+	for (i = 0; i < hf_ncores(); i++)
+		if (i != hf_cpuid() && (t < 0 || loads[i] < loads[t]))
+			t = i;
+	if (t < 0 || loads[t] > BALANCE_LOW) return;
+
+	for (i = 1; i < MAX_TASKS; i++){
+		e = task_entry[i];
+		if (e && krnl_tcb[i].ptask == entries[e - 1].task && !task_target[i]){
+			task_target[i] = t + 1;
+			moving = i;
+			moving_age = 0;
+			break;
+		}
+	}
+}
+
+static void balancer(void)
+{
+	int8_t msg[1 + sizeof(entries[0].name)];
+	uint16_t cpu, port, size;
+
+	if (hf_comm_create(hf_selfid(), BALANCE_PORT, 0)){
+		kprintf("\nKERNEL: balancer, could not create communication queue");
+		hf_kill(hf_selfid());
+	}
+
+	while (1){
+		if (hf_semwait_timeout(&balance_sem, balance_period) == ERR_TIMEOUT){
+			while (hf_recvprobe(BALANCE_CHANNEL) > 0)
+				if (hf_recv(&cpu, &port, msg, &size, BALANCE_CHANNEL) == ERR_OK)
+					balance_message(cpu, msg, size);
+			balance_report();
+			balance_decide();
+		}
+		balance_depart();
+	}
+}
+
+/**
+ * @brief Starts the balancer of this core.
+ * 
+ * @param period is the period of the load reports and balancing decisions (in ticks).
+ * 
+ * @return ERR_OK when successful, or the error of hf_spawn().
+ * 
+ * The balancer must be started on all cores (usually on app_main()), after the migratable
+ * task types are registered. It uses the BALANCE_PORT port.
+ */
+int32_t hf_balance_init(uint32_t period)
+{
+	int32_t i, id;
+
+	for (i = 0; i < NOC_WIDTH * NOC_HEIGHT; i++)
+		loads[i] = 100;
+	balance_period = period;
+	if (hf_seminit(&balance_sem, 0))
+		return ERR_OUT_OF_MEMORY;
+	id = hf_spawn(balancer, 0, 0, 0, "balancer", 2048);
+
+	return id < 0 ? id : ERR_OK;
+}
+
+/**
+ * @brief Registers a migratable task type.
+ * 
+ * @param name is the task name, which identifies the type on all cores.
+ * @param task is the task entry point.
+ * @param stack_size is the task stack size.
+ * 
+ * @return ERR_OK when successful, ERR_INVALID_NAME if the name is already registered and
+ * ERR_EXCEED_MAX_NUM if there are already BALANCE_ENTRIES types.
+ * 
+ * Each type must be registered with the same name on every core a task of the type may
+ * move to.
+ */
+int32_t hf_balance_register(int8_t *name, void (*task)(void), uint32_t stack_size)
+{
+	if (balance_find(name) >= 0)
+		return ERR_INVALID_NAME;
+	if (n_entries == BALANCE_ENTRIES)
+		return ERR_EXCEED_MAX_NUM;
+	strncpy(entries[n_entries].name, name, sizeof(entries[0].name) - 1);
+	entries[n_entries].name[sizeof(entries[0].name) - 1] = '\0';
+	entries[n_entries].task = task;
+	entries[n_entries].stack_size = stack_size;
+	n_entries++;
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Spawns a migratable (best effort) task on this core.
+ * 
+ * @param name is the name of a registered task type.
+ * 
+ * @return the task id, ERR_INVALID_NAME if the type is not registered, or the error of
+ * hf_spawn().
+ */
+int32_t hf_balance_spawn(int8_t *name)
+{
+	int32_t e, id;
+
+	e = balance_find(name);
+	if (e < 0)
+		return ERR_INVALID_NAME;
+	id = hf_spawn(entries[e].task, 0, 0, 0, entries[e].name, entries[e].stack_size);
+	if (id >= 0){
+		task_target[id] = 0;
+		task_entry[id] = e + 1;
+	}
+
+	return id;
+}
+
+/**
+ * @brief Migration point of a migratable task.
+ * 
+ * @return 0 if the task stays on this core. If the balancer has chosen the task to be moved,
+ * the task is killed (this call does not return) and a new instance is spawned on the target
+ * core.
+ * 
+ * Migratable tasks call this where they hold no state, locks nor communication queues, such
+ * as between work items.
+ */
+int32_t hf_balance_point(void)
+{
+	uint16_t id;
+
+	id = hf_selfid();
+	if (task_target[id] == 0)
+		return 0;
+	depart_target[id] = task_target[id];
+	depart_entry[id] = task_entry[id];
+	task_target[id] = 0;
+	task_entry[id] = 0;
+	hf_sempost(&balance_sem);
+	hf_kill(id);
+
+	return 1;
+}
+
+/**
+ * @brief Returns the load of a core.
+ * 
+ * @param cpu is the core number.
+ * 
+ * @return the last load reported by the core (0 to 100%, 100 until the core reports), or
+ * ERR_INVALID_CPU if the core does not exist.
+ */
+int32_t hf_balance_load(uint16_t cpu)
+{
+	if (cpu >= hf_ncores())
+		return ERR_INVALID_CPU;
+
+	return loads[cpu];
+}
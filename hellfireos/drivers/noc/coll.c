@@ -0,0 +1,329 @@
+/**
+ * @file coll.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ * 
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Collective operations (barrier, broadcast, reduce and all-gather) on top of hf_send() and
+ * hf_recvv(), for a group of tasks bound to the same port on every core of the mesh.
+ * 
+ * Messages travel on a tree rooted at the root core of the operation, built on the mesh: the
+ * root line is spanned first by a binomial tree over the columns (relative to the root), and
+ * each column is then spanned by a binomial tree over the lines. A core at relative position
+ * r of a line (or column) has r with its lowest bit cleared as its parent, and r + 2^k as its
+ * children for 2^k below the lowest bit of r (any k on the root), so the tree is
+ * log2(NOC_WIDTH) + log2(NOC_HEIGHT) levels deep, and every message goes along a line or a
+ * column of the mesh.
+ * 
+ * The core at offset 2^k on the same line (or column) of another is the same whatever the
+ * root, so each direction and offset has its own channel (COLL_CHANNELS channels from the
+ * base channel of the group), and the messages on a channel of a task come from a single
+ * core, in order. Operations (with any root) may follow each other without waiting.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <lockstat.h>
+#include <semaphore.h>
+#include <kernel.h>
+#include <task.h>
+#include <ecodes.h>
+#include <noc.h>
+#include <coll.h>
+
+#define COLL_DOWN_LINE		0		/* channel offsets: parent to child, along a line */
+#define COLL_DOWN_COLUMN	8		/* parent to child, along a column */
+#define COLL_UP_LINE		16		/* child to parent, along a line */
+#define COLL_UP_COLUMN		24		/* child to parent, along a column */
+#define COLL_CHILDREN		16		/* children of a core, at most */
+
+struct coll_tree {
+	int32_t dc, dl;					/* position of this core, relative to the root */
+	int32_t parent;					/* parent core, -1 on the root */
+	uint16_t up;					/* channel of the messages to the parent */
+	uint16_t down;					/* channel of the messages from the parent */
+	int32_t n;					/* number of children */
+	uint16_t child[COLL_CHILDREN];			/* children, the largest subtrees first */
+	uint16_t child_up[COLL_CHILDREN];		/* channel of the messages from each child */
+	uint16_t child_down[COLL_CHILDREN];		/* channel of the messages to each child */
+};
+
+/* core at a position relative to the root */
+static uint16_t coll_core(uint16_t root, int32_t dc, int32_t dl)
+{
+	return ((NOC_LINE(root) + dl) % NOC_HEIGHT) * NOC_WIDTH + (NOC_COLUMN(root) + dc) % NOC_WIDTH;
+}
+
+/* position of a core relative to the root */
+static void coll_pos(uint16_t core, uint16_t root, int32_t *dc, int32_t *dl)
+{
+	*dc = (NOC_COLUMN(core) - NOC_COLUMN(root) + NOC_WIDTH) % NOC_WIDTH;
+	*dl = (NOC_LINE(core) - NOC_LINE(root) + NOC_HEIGHT) % NOC_HEIGHT;
+}
+
+/* parent and children of this core on the tree rooted at root */
+static void coll_tree(struct noc_coll *g, uint16_t root, struct coll_tree *t)
+{
+	int32_t k, d;
+
+	coll_pos(hf_cpuid(), root, &t->dc, &t->dl);
+	t->parent = -1;
+	if (t->dl){
+		k = __builtin_ctz(t->dl);
+		t->parent = coll_core(root, t->dc, t->dl & (t->dl - 1));
+		t->up = g->channel + COLL_UP_COLUMN + k;
+		t->down = g->channel + COLL_DOWN_COLUMN + k;
+	}else if (t->dc){
+		k = __builtin_ctz(t->dc);
+		t->parent = coll_core(root, t->dc & (t->dc - 1), 0);
+		t->up = g->channel + COLL_UP_LINE + k;
+		t->down = g->channel + COLL_DOWN_LINE + k;
+	}
+
+	t->n = 0;
+	if (t->dl == 0){
+		for (k = 7; k >= 0; k--){
+			d = 1 << k;
+			if ((t->dc == 0 || d < (t->dc & -t->dc)) && t->dc + d < NOC_WIDTH){
+				t->child[t->n] = coll_core(root, t->dc + d, 0);
+				t->child_up[t->n] = g->channel + COLL_UP_LINE + k;
+				t->child_down[t->n++] = g->channel + COLL_DOWN_LINE + k;
+			}
+		}
+	}
+	for (k = 7; k >= 0; k--){
+		d = 1 << k;
+		if ((t->dl == 0 || d < (t->dl & -t->dl)) && t->dl + d < NOC_HEIGHT){
+			t->child[t->n] = coll_core(root, t->dc, t->dl + d);
+			t->child_up[t->n] = g->channel + COLL_UP_COLUMN + k;
+			t->child_down[t->n++] = g->channel + COLL_DOWN_COLUMN + k;
+		}
+	}
+}
+
+/* points iov to the blocks (size bytes each, indexed by core on buf) of the cores on the
+ * subtree of a core, in tree order. returns the number of blocks */
+static int32_t coll_subtree(uint16_t core, uint16_t root, int8_t *buf, uint32_t size, struct noc_iov *iov)
+{
+	int32_t dc, dl, c, l, c_end, l_end, n = 0;
+
+	coll_pos(core, root, &dc, &dl);
+	if (dl){
+		c_end = dc + 1;
+		l_end = dl + (dl & -dl);
+	}else{
+		c_end = dc ? dc + (dc & -dc) : NOC_WIDTH;
+		l_end = NOC_HEIGHT;
+	}
+	for (c = dc; c < c_end && c < NOC_WIDTH; c++){
+		for (l = dl; l < l_end && l < NOC_HEIGHT; l++){
+			iov[n].buf = buf + coll_core(root, c, l) * size;
+			iov[n++].size = size;
+		}
+	}
+
+	return n;
+}
+
+/* receives a message from a core on a channel, which must have size bytes */
+static int32_t coll_recv(uint16_t cpu, struct noc_iov *iov, int32_t iovcnt, uint32_t size, uint16_t channel)
+{
+	uint16_t source_cpu, source_port;
+	uint32_t total;
+	int32_t error;
+
+	error = hf_recvv(&source_cpu, &source_port, iov, iovcnt, &total, channel);
+	if (error == ERR_OK && (source_cpu != cpu || total != size))
+		error = ERR_COMM_ERROR;
+
+	return error;
+}
+
+/**
+ * @brief Initializes a group of tasks for collective operations.
+ * 
+ * @param g is a pointer to the group
+ * @param port is the port of the group tasks (the same on all cores)
+ * @param channel is the first of the COLL_CHANNELS channels used by the group
+ * 
+ * @return ERR_OK when successful and ERR_COMM_UNFEASIBLE if the calling task has no
+ * communication queue bound to the port.
+ * 
+ * A task on each core of the mesh calls this (after hf_comm_create()) and then takes part
+ * in all operations of the group, in the same order. The channels of the group must not be
+ * used by other messages to the group tasks.
+ */
+int32_t hf_coll_init(struct noc_coll *g, uint16_t port, uint16_t channel)
+{
+	uint16_t id;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL || pktdrv_ports[id] != port)
+		return ERR_COMM_UNFEASIBLE;
+	g->port = port;
+	g->channel = channel;
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Waits until all tasks of the group reach the barrier.
+ * 
+ * @param g is a pointer to the group
+ * 
+ * @return ERR_OK when successful or the error of a transfer.
+ * 
+ * Empty messages go up the tree rooted at core 0, and a release goes down once they all
+ * arrived, so the barrier takes two tree traversals.
+ */
+int32_t hf_coll_barrier(struct noc_coll *g)
+{
+	struct coll_tree t;
+	struct noc_iov iov;
+	int32_t i, e, error = ERR_OK;
+
+	coll_tree(g, 0, &t);
+	iov.buf = NULL;
+	iov.size = 0;
+	for (i = 0; i < t.n; i++){
+		e = coll_recv(t.child[i], &iov, 1, 0, t.child_up[i]);
+		if (e && !error) error = e;
+	}
+	if (t.parent >= 0){
+		hf_send(t.parent, g->port, NULL, 0, t.up);
+		e = coll_recv(t.parent, &iov, 1, 0, t.down);
+		if (e && !error) error = e;
+	}
+	for (i = 0; i < t.n; i++)
+		hf_send(t.child[i], g->port, NULL, 0, t.child_down[i]);
+
+	return error;
+}
+
+/**
+ * @brief Broadcasts a message from a core to all tasks of the group.
+ * 
+ * @param g is a pointer to the group
+ * @param root is the core which holds the message
+ * @param buf is the message (on root), or a buffer that receives it (on the other cores)
+ * @param size is the size (in bytes) of the message, the same on all cores
+ * 
+ * @return ERR_OK when successful or the error of a transfer (ERR_COMM_ERROR if the message
+ * size does not match).
+ */
+int32_t hf_coll_bcast(struct noc_coll *g, uint16_t root, void *buf, uint32_t size)
+{
+	struct coll_tree t;
+	struct noc_iov iov;
+	int32_t i, error = ERR_OK;
+
+	if (root >= hf_ncores())
+		return ERR_INVALID_CPU;
+	coll_tree(g, root, &t);
+	if (t.parent >= 0){
+		iov.buf = buf;
+		iov.size = size;
+		error = coll_recv(t.parent, &iov, 1, size, t.down);
+	}
+	for (i = 0; i < t.n; i++)
+		hf_send(t.child[i], g->port, buf, size, t.child_down[i]);
+
+	return error;
+}
+
+/**
+ * @brief Reduces the values of all tasks of the group to a core.
+ * 
+ * @param g is a pointer to the group
+ * @param root is the core which gets the result
+ * @param buf is the value of the calling task (size bytes), overwritten with the reduction
+ * of its subtree (the result, on root)
+ * @param size is the size (in bytes) of the values, the same on all cores
+ * @param op is the reduction operator
+ * 
+ * @return ERR_OK when successful, ERR_OUT_OF_MEMORY if a reception buffer could not be
+ * allocated or the error of a transfer.
+ * 
+ * Each core combines the values of its children, as they arrive, into its own value and
+ * sends it to its parent.
+ */
+int32_t hf_coll_reduce(struct noc_coll *g, uint16_t root, void *buf, uint32_t size, coll_op_t op)
+{
+	struct coll_tree t;
+	struct noc_iov iov;
+	int8_t *tmp = NULL;
+	int32_t i, e, error = ERR_OK;
+
+	if (root >= hf_ncores())
+		return ERR_INVALID_CPU;
+	coll_tree(g, root, &t);
+	if (t.n){
+		tmp = hf_malloc(size ? size : 1);
+		if (tmp == NULL)
+			error = ERR_OUT_OF_MEMORY;
+	}
+	for (i = 0; i < t.n; i++){
+		iov.buf = tmp;
+		iov.size = tmp ? size : 0;
+		e = coll_recv(t.child[i], &iov, 1, size, t.child_up[i]);
+		if (e == ERR_OK)
+			op(buf, tmp, size);
+		else if (!error)
+			error = e;
+	}
+	if (tmp)
+		hf_free(tmp);
+	if (t.parent >= 0)
+		hf_send(t.parent, g->port, buf, size, t.up);
+
+	return error;
+}
+
+/**
+ * @brief Gathers a block from each task of the group on all of them.
+ * 
+ * @param g is a pointer to the group
+ * @param sbuf is the block of the calling task
+ * @param size is the size (in bytes) of a block, the same on all cores
+ * @param rbuf is a buffer that receives the blocks of all cores (hf_ncores() * size bytes),
+ * the block of core n at n * size
+ * 
+ * @return ERR_OK when successful, ERR_OUT_OF_MEMORY if the buffer descriptors could not be
+ * allocated or the error of a transfer.
+ * 
+ * The blocks of each subtree go up to core 0 in a single message, scattered in place on
+ * rbuf, and the whole set is broadcast back down the tree.
+ */
+int32_t hf_coll_allgather(struct noc_coll *g, void *sbuf, uint32_t size, void *rbuf)
+{
+	struct coll_tree t;
+	struct noc_iov *iov;
+	int32_t i, n, e, error = ERR_OK;
+
+	iov = hf_malloc(sizeof(struct noc_iov) * hf_ncores());
+	if (iov == NULL)
+		return ERR_OUT_OF_MEMORY;
+	coll_tree(g, 0, &t);
+	memcpy((int8_t *)rbuf + hf_cpuid() * size, sbuf, size);
+	for (i = 0; i < t.n; i++){
+		n = coll_subtree(t.child[i], 0, rbuf, size, iov);
+		e = coll_recv(t.child[i], iov, n, n * size, t.child_up[i]);
+		if (e && !error) error = e;
+	}
+	if (t.parent >= 0){
+		n = coll_subtree(hf_cpuid(), 0, rbuf, size, iov);
+		hf_sendv(t.parent, g->port, iov, n, t.up);
+	}
+	hf_free(iov);
+
+	e = hf_coll_bcast(g, 0, rbuf, hf_ncores() * size);
+	if (e && !error) error = e;
+
+	return error;
+}
@@ -0,0 +1,43 @@
+/**
+ * @file balance.h
+ * @date October 2026
+ * 
+ * @section LICENSE
+ * 
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Load reports and best effort task migration between cores (noc.h must be included first).
+ */
+
+#define BALANCE_PORT		0xfff0		/*!< port of the balancer task, on all cores */
+#define BALANCE_CHANNEL		0		/*!< channel of the balancer messages */
+
+#ifndef BALANCE_ENTRIES
+#define BALANCE_ENTRIES		8		/*!< migratable task types */
+#endif
+
+#ifndef BALANCE_HIGH
+#define BALANCE_HIGH		90		/*!< load (%) above which a core gives tasks away */
+#endif
+
+#ifndef BALANCE_LOW
+#define BALANCE_LOW		60		/*!< load (%) below which a core takes tasks */
+#endif
+
+/**
+ * @brief Migratable task type, registered with the same name on all cores.
+ */
+struct balance_entry {
+	int8_t name[20];				/*!< task name, identifies the type on every core */
+	void (*task)(void);				/*!< task entry point */
+	uint32_t stack_size;				/*!< task stack size */
+};
+
+int32_t hf_balance_init(uint32_t period);
+int32_t hf_balance_register(int8_t *name, void (*task)(void), uint32_t stack_size);
+int32_t hf_balance_spawn(int8_t *name);
+int32_t hf_balance_point(void);
+int32_t hf_balance_load(uint16_t cpu);
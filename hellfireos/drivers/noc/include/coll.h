@@ -0,0 +1,36 @@
+/**
+ * @file coll.h
+ * @date October 2026
+ * 
+ * @section LICENSE
+ * 
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Collective operations over the NoC driver (noc.h must be included first).
+ */
+
+#define COLL_CHANNELS		32		/*!< channels used by a group, from its base channel */
+
+/**
+ * @brief Reduction operator, combines val into acc (size bytes each).
+ * 
+ * Must be associative and commutative, as contributions are combined as they arrive.
+ */
+typedef void (*coll_op_t)(void *acc, const void *val, uint32_t size);
+
+/**
+ * @brief Group of tasks, one on each core of the mesh, bound to the same port.
+ */
+struct noc_coll {
+	uint16_t port;					/*!< port of the group tasks, on all cores */
+	uint16_t channel;				/*!< first of the COLL_CHANNELS channels of the group */
+};
+
+int32_t hf_coll_init(struct noc_coll *g, uint16_t port, uint16_t channel);
+int32_t hf_coll_barrier(struct noc_coll *g);
+int32_t hf_coll_bcast(struct noc_coll *g, uint16_t root, void *buf, uint32_t size);
+int32_t hf_coll_reduce(struct noc_coll *g, uint16_t root, void *buf, uint32_t size, coll_op_t op);
+int32_t hf_coll_allgather(struct noc_coll *g, void *sbuf, uint32_t size, void *rbuf);
@@ -20,6 +20,9 @@
 #define ERR_COMM_BUSY		-205		/*!< communication channel is busy */
 #define ERR_COMM_UNFEASIBLE	-206		/*!< communication is not feasible */
 #define ERR_COMM_ERROR		-207		/*!< general communication error */
+#define ERR_COMM_OVERFLOW	-210		/*!< message does not fit the reception buffers */
+
+#define NOC_MODULE_CHUNK	1024		/*!< module file data per message (hf_module_noc()) */
 
 #define PKT_HEADER_SIZE		8
 #define PKT_TARGET_CPU		0
@@ -31,24 +34,199 @@
 #define PKT_SEQ			6
 #define PKT_CHANNEL		7
 
+#define PKT_SEQ_MCAST		0x8000		/*!< sequence number flag of multicast packets */
+#define PKT_SEQ_LONG		0x4000		/*!< sequence number flag of messages larger than 65535 bytes */
+#define PKT_SEQ_FLOW		0x2000		/*!< sequence number flag of messages sent on a flow (compact continuation packets) */
+#define PKT_SEQ_TIME		0x1000		/*!< sequence number flag of the first packet of a message carrying a send timestamp */
+#define PKT_SEQ_MASK		0x0fff		/*!< sequence number (packet of the message, modulo 4096) */
+#define PKT_DATA_BYTES		((NOC_PACKET_SIZE - PKT_HEADER_SIZE) * sizeof(uint16_t))
+#define PKT_DATA(pkt)		((int8_t *)((pkt) + PKT_HEADER_SIZE))
+#define PKT_BYTES(pkt)		(((pkt)[PKT_PAYLOAD] + 2 - PKT_HEADER_SIZE) * sizeof(uint16_t))
+
+/* continuation packets of a flow: |tgt_cpu |payload |flow |seq | ... data ... | */
+#define PKT_CONT_SIZE		4
+#define PKT_CONT_FLOW		2
+#define PKT_CONT_SEQ		3
+#define PKT_CONT_BYTES		((NOC_PACKET_SIZE - PKT_CONT_SIZE) * sizeof(uint16_t))
+#define PKT_FLOW		0x8000		/*!< flow flag, on the third flit (source cpu of full headers) */
+#define PKT_FLOW_ID(cpu, n)	(PKT_FLOW | ((cpu) << 7) | ((n) & 0x7f))
+#define PKT_ARRIVAL		(NOC_PACKET_SIZE + PKT_HEADER_SIZE - PKT_CONT_SIZE)	/*!< arrival time of a received packet (NOC_TIMESTAMP), after the largest packet */
+#define PKT_BUF_SIZE		(PKT_ARRIVAL + 2)	/*!< flits of a reception buffer (a continuation packet, with its full header rebuilt, and its arrival time) */
+
+#define NOC_CREDIT_CHANNEL	0xfffe		/*!< channel of the credit based flow control packets */
+#define NOC_RMA_PORT		0xfffd		/*!< port of remote memory requests, serviced by the driver */
+#define NOC_RMA_CHANNEL		0xfffd		/*!< channel of the replies of remote reads */
+#define RMA_READ		0x1		/*!< remote memory window may be read by other cores */
+#define RMA_WRITE		0x2		/*!< remote memory window may be written by other cores */
+#define NOC_CREDIT_PEERS	8		/*!< peers with credit state per task */
+
 #define NOC_COLUMN(core_n)	((core_n) % NOC_WIDTH)
 #define NOC_LINE(core_n)	((core_n) / NOC_WIDTH)
 
+/* width of the column and line fields of the router header (4 bits up to 16x16, the
+ * hardware routers, 8 bits for larger meshes). must match the NoC (mpsoc_sim -DNOC_ADDR_BITS) */
+#ifndef NOC_ADDR_BITS
+#if NOC_WIDTH > 16 || NOC_HEIGHT > 16
+#define NOC_ADDR_BITS		8
+#else
+#define NOC_ADDR_BITS		4
+#endif
+#endif
+#define NOC_HEADER(core_n)	((NOC_COLUMN(core_n) << NOC_ADDR_BITS) | NOC_LINE(core_n))
+
+/* traffic classes. the class of a packet is the top bit of the router header (above the column
+ * field, so up to 128 columns), which the routers give precedence on their outputs */
+#define PKT_PRIO		0x8000		/*!< real time class flag, on the first flit (router header) */
+#define NOC_CLASS_BULK		0		/*!< traffic class of bulk transfers */
+#define NOC_CLASS_RT		1		/*!< traffic class of real time (control) messages */
+
 /**
  * @brief Array of associations between tasks and reception ports.
  */
 uint16_t pktdrv_ports[MAX_TASKS];
 
 /**
- * @brief Array of queues. Each task can have its own custom sized queue.
+ * @brief Array of reception rings. Each task can have its own custom sized ring, filled
+ * by ni_isr() and drained by the task (single producer, single consumer).
  */
-struct queue *pktdrv_tqueue[MAX_TASKS];
+struct ring *pktdrv_tqueue[MAX_TASKS];
+
+/**
+ * @brief Array of reception wait flags. A task blocked on hf_recv() waiting for a packet
+ * has its flag set, and is woken up by ni_isr() when a packet arrives on its ring.
+ */
+volatile uint8_t pktdrv_wait[MAX_TASKS];
+
+/**
+ * @brief Credit based flow control state of a task for a peer (hf_sendcr() / hf_recvcr()).
+ */
+struct noc_peer {
+	uint16_t cpu;					/*!< peer processor */
+	uint16_t port;					/*!< peer port, 0 if the entry is free */
+	int16_t credits;				/*!< packets we may send to the peer, -1 while waiting for a grant */
+	uint16_t window;				/*!< credits granted by the peer (maximum message size, in packets) */
+	uint16_t grant;					/*!< credits we granted to the peer */
+	uint16_t consumed;				/*!< packets from the peer consumed, not given back yet */
+};
+
+/**
+ * @brief Credit based flow control state of a task.
+ */
+struct noc_credit {
+	struct noc_peer peer[NOC_CREDIT_PEERS];		/*!< peers */
+	uint16_t avail;					/*!< reception queue slots not granted yet */
+};
+
+/**
+ * @brief Array of credit states, one per task (allocated on first use, NULL if none).
+ */
+struct noc_credit *pktdrv_credit[MAX_TASKS];
+
+/**
+ * @brief Asynchronous transmission request (hf_send_async()).
+ */
+struct noc_tx {
+	uint16_t source_port;				/*!< sender task port */
+	uint16_t target_cpu;				/*!< target processor */
+	uint16_t target_port;				/*!< target task port */
+	uint32_t size;					/*!< message size, in bytes */
+	uint16_t channel;				/*!< message channel */
+	uint16_t cls;					/*!< traffic class of the message */
+	uint32_t time;					/*!< time the message was queued (NOC_TIMESTAMP) */
+	int8_t *buf;					/*!< message buffer, owned by the driver until sent */
+	sem_t *done;					/*!< semaphore signaled once the message is sent, or NULL */
+};
+
+/**
+ * @brief Message fragment, for scatter / gather transfers (hf_sendv() / hf_recvv()).
+ */
+struct noc_iov {
+	int8_t *buf;					/*!< fragment buffer */
+	uint32_t size;					/*!< fragment size, in bytes */
+};
+
+/**
+ * @brief Queue of pending asynchronous transmissions, drained by the transmission task.
+ */
+struct queue *pktdrv_txqueue;
+
+/**
+ * @brief Transmission task semaphore, counting the pending asynchronous transmissions.
+ */
+sem_t pktdrv_txsem;
+
+/**
+ * @brief Latency of a stage of the messages received or sent (NOC_TIMESTAMP), in cycles of
+ * the core counter.
+ */
+struct noc_latency {
+	uint32_t samples;				/*!< messages measured */
+	uint32_t min;					/*!< shortest latency */
+	uint32_t max;					/*!< longest latency */
+	uint64_t total;					/*!< sum of the latencies (the mean is total / samples) */
+};
+
+/**
+ * @brief NoC traffic counters of this core (hf_noc_stats()).
+ */
+struct noc_stats {
+	uint32_t tx_packets;				/*!< packets injected, including forwarded multicast packets */
+	uint32_t rx_packets;				/*!< packets delivered to a task reception ring */
+	uint32_t tx_rt;					/*!< packets of the real time class injected */
+	uint32_t rx_rt;					/*!< packets of the real time class delivered */
+	uint32_t drop_noc_full;				/*!< packets dropped, no free shared packet */
+	uint32_t drop_task_full;			/*!< packets dropped, task reception ring full */
+	uint32_t drop_no_port;				/*!< packets dropped, no task on the target port */
+	uint32_t drop_no_flow;				/*!< continuation packets dropped, the first packet of the flow was not received */
+	uint32_t drop_quota;				/*!< packets dropped, target port over its quota of shared packets */
+	uint32_t drop_class;				/*!< bulk packets dropped, free shared packets kept for the real time class */
+	uint32_t rma_served;				/*!< remote memory requests serviced */
+	uint32_t rma_denied;				/*!< remote memory requests denied (window, range or pending replies) */
+	uint16_t queue_free;				/*!< free shared packets */
+	uint16_t queue_min;				/*!< lowest number of free shared packets seen */
+	uint16_t reserved;				/*!< free shared packets kept for port reservations */
+	struct noc_latency lat_queue;			/*!< sent messages: call (or hf_send_async()) to the injection of the first packet */
+	struct noc_latency lat_transit;			/*!< received messages: injection of the first packet to its arrival */
+	struct noc_latency lat_pool;			/*!< received messages: arrival to being taken by a busy task */
+	struct noc_latency lat_wakeup;			/*!< received messages: arrival to a blocked task running with the packet */
+	uint32_t unsynced;				/*!< received messages not measured on transit, sender clock not calibrated (hf_noc_sync()) */
+};
+
+/**
+ * @brief NoC traffic counters of a reception port (hf_noc_portstats()).
+ */
+struct noc_port_stats {
+	uint32_t tx_packets;				/*!< packets sent from the port */
+	uint32_t rx_packets;				/*!< packets delivered to the port ring */
+	uint32_t dropped;				/*!< packets dropped, port ring full */
+	uint32_t drop_quota;				/*!< packets dropped, port over its quota of shared packets */
+	uint16_t ring_max;				/*!< highest number of packets seen on the port ring */
+	uint16_t held;					/*!< shared packets held by the port */
+	uint16_t held_max;				/*!< highest number of shared packets held by the port */
+};
+
+/**
+ * @brief Traffic counters of this core.
+ */
+struct noc_stats pktdrv_stats;
+
+/**
+ * @brief Array of traffic counters, one per task (port).
+ */
+struct noc_port_stats pktdrv_pstats[MAX_TASKS];
 
 /**
  * @brief Queue of free (shared) packets. The number of packets is NOC_PACKET_SLOTS.
  */
 struct queue *pktdrv_queue;
 
+/**
+ * @brief Storage of the shared packets (a pool of NOC_PACKET_SLOTS packets).
+ */
+struct pool *pktdrv_pool;
+
+struct module;
+
 void ni_init(void);
 void ni_isr(void *arg);
 
@@ -56,7 +234,28 @@ uint16_t hf_cpuid(void);
 uint16_t hf_ncores(void);
 int32_t hf_comm_create(uint16_t id, uint16_t port, uint16_t packets);
 int32_t hf_comm_destroy(uint16_t id);
+int32_t hf_comm_quota(uint16_t id, uint16_t reserved, uint16_t max);
+int32_t hf_comm_class(uint16_t id, uint16_t cls);
 int32_t hf_recv(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel);
-int32_t hf_send(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel);
+uint16_t *hf_recvpkt(uint16_t channel);
+void hf_pktfree(uint16_t *pkt);
+int32_t hf_recvv(uint16_t *source_cpu, uint16_t *source_port, struct noc_iov *iov, uint16_t iovcnt, uint32_t *size, uint16_t channel);
+int32_t hf_recvprobe(uint16_t channel);
+int32_t hf_send(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint32_t size, uint16_t channel);
+int32_t hf_sendv(uint16_t target_cpu, uint16_t target_port, struct noc_iov *iov, uint16_t iovcnt, uint16_t channel);
+int32_t hf_multicast(uint32_t core_mask, uint16_t target_port, int8_t *buf, uint32_t size, uint16_t channel);
+int32_t hf_send_async(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint32_t size, uint16_t channel, sem_t *done);
 int32_t hf_recvack(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel);
 int32_t hf_sendack(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout);
+int32_t hf_recvcr(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel);
+int32_t hf_sendcr(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout);
+int32_t hf_noc_stats(struct noc_stats *stats);
+int32_t hf_noc_portstats(uint16_t port, struct noc_port_stats *stats);
+void hf_noc_resetstats(void);
+int32_t hf_noc_sync(uint16_t cpu, int32_t *offset, uint32_t timeout);
+uint32_t hf_noc_packets(uint32_t size);
+int32_t hf_rma_window(uint16_t win, void *base, uint32_t size, uint16_t flags);
+int32_t hf_rma_get(uint16_t cpu, uint16_t win, uint32_t off, void *buf, uint32_t size, uint32_t timeout);
+int32_t hf_rma_put(uint16_t cpu, uint16_t win, uint32_t off, void *buf, uint32_t size);
+int32_t hf_module_noc(struct module *m, uint16_t channel);
+int32_t hf_module_nocsend(uint32_t core_mask, uint16_t target_port, void *buf, uint32_t size, uint16_t channel);
@@ -0,0 +1,92 @@
+/**
+ * @file rpc.h
+ * @date October 2026
+ * 
+ * @section LICENSE
+ * 
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Remote procedure calls over the NoC driver (noc.h must be included first).
+ */
+
+#define ERR_RPC_NO_PROC		-208		/*!< no handler registered for the procedure */
+#define ERR_RPC_OVERFLOW	-209		/*!< call or result does not fit the buffers */
+
+#ifndef RPC_PROCS
+#define RPC_PROCS		16		/*!< procedures per server */
+#endif
+
+#ifndef RPC_MSG_SIZE
+#define RPC_MSG_SIZE		1024		/*!< largest request or reply message, in bytes */
+#endif
+
+#ifndef RPC_RES_SIZE
+#define RPC_RES_SIZE		256		/*!< largest result of a procedure, in bytes */
+#endif
+
+#ifndef RPC_BATCH_SIZE
+#define RPC_BATCH_SIZE		PKT_DATA_BYTES	/*!< client batch of small calls (one packet) */
+#endif
+
+#define RPC_HEADER_SIZE		8		/*!< call record header: id, size, procedure / result */
+
+/**
+ * @brief Remote procedure, called by the server task.
+ * 
+ * Receives the call arguments (arg, size bytes) and writes up to RPC_RES_SIZE bytes of results
+ * to res, setting res_size. The return value is handed over to the caller.
+ */
+typedef int32_t (*rpc_proc_t)(int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size);
+
+/**
+ * @brief RPC server, bound to a reception port of the task which serves it.
+ */
+struct rpc_server {
+	rpc_proc_t procs[RPC_PROCS];			/*!< handler of each procedure, NULL if none */
+	uint16_t channel;				/*!< channel of the requests */
+	int8_t *req;					/*!< request message buffer */
+	int8_t *rep;					/*!< reply message buffer */
+};
+
+/**
+ * @brief Pending (or completed) remote call.
+ */
+struct rpc_future {
+	struct rpc_future *next;			/*!< next pending call of the client */
+	int8_t *res;					/*!< result buffer */
+	uint16_t res_max;				/*!< result buffer size */
+	uint16_t res_size;				/*!< result size */
+	uint16_t id;					/*!< request id */
+	volatile uint8_t done;				/*!< 1 once the reply has arrived */
+	int32_t result;					/*!< value returned by the procedure, or an error */
+};
+
+/**
+ * @brief RPC client, talking to a server on a core and port.
+ */
+struct rpc_client {
+	struct rpc_future *pending;			/*!< calls waiting for replies */
+	uint16_t cpu;					/*!< server processor */
+	uint16_t port;					/*!< server port */
+	uint16_t channel;				/*!< channel of the requests (on the server) */
+	uint16_t reply;					/*!< channel of the replies (on this task) */
+	uint16_t next_id;				/*!< next request id */
+	uint16_t batch_size;				/*!< bytes on the batch */
+	int8_t batch[RPC_BATCH_SIZE];			/*!< calls not sent yet */
+	int8_t *buf;					/*!< reply message buffer */
+};
+
+int32_t hf_rpc_server(struct rpc_server *srv, uint16_t port, uint16_t channel);
+int32_t hf_rpc_register(struct rpc_server *srv, uint16_t proc, rpc_proc_t func);
+int32_t hf_rpc_serve(struct rpc_server *srv);
+int32_t hf_rpc_client(struct rpc_client *c, uint16_t cpu, uint16_t port, uint16_t channel, uint16_t reply);
+int32_t hf_rpc_close(struct rpc_client *c);
+int32_t hf_rpc_call_async(struct rpc_client *c, uint16_t proc, int8_t *arg, uint16_t size, int8_t *res, uint16_t res_max, struct rpc_future *f);
+int32_t hf_rpc_flush(struct rpc_client *c);
+int32_t hf_rpc_poll(struct rpc_client *c);
+int32_t hf_rpc_wait(struct rpc_client *c, struct rpc_future *f);
+void hf_rpc_cancel(struct rpc_client *c, struct rpc_future *f);
+int32_t hf_rpc_call(struct rpc_client *c, uint16_t proc, int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size);
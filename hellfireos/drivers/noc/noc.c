@@ -15,7 +15,10 @@
  * _ni_read(), _ni_write() and _ni_status() helper functions (defined on the architecture
  * HAL). A 2D mesh NoC and a buffered (1 packet) network interface are assumed.
  * 
- * Packet format is as follows:
+ * Packets have a variable length: the payload field holds the number of flits after it (the
+ * rest of the header and the data), so the last packet of a message (or a short message, such
+ * as an acknowledgement) carries only the flits it needs. Packets are NOC_PACKET_SIZE flits
+ * at most. Packet format is as follows:
  * 
  \verbatim
   2 bytes   2 bytes   2 bytes   2 bytes   2 bytes   2 bytes   2 bytes   2 bytes       ....
@@ -24,14 +27,70 @@
  --------------------------------------------------------------------------------------------------
  \endverbatim
  * 
+ * With NOC_COMPACT, only the first packet of a unicast message of several packets carries the
+ * full header. It is flagged with PKT_SEQ_FLOW and carries a flow id (the sender core and a
+ * message number, PKT_FLOW_ID()) on a data flit, and the next packets of the message carry
+ * the flow id and their sequence number only:
+ * 
+ \verbatim
+  2 bytes   2 bytes   2 bytes   2 bytes       ....
+ ------------------------------------------------------
+ |tgt_cpu  |payload  |flow     |seq      |  ... data ...  |
+ ------------------------------------------------------
+ \endverbatim
+ * 
+ * The receiver keeps the header of the first packet on a table of open flows (NOC_FLOWS
+ * entries) and rebuilds the full header of each continuation packet on reception, so the
+ * packets of the message are reassembled as any other. Flow ids have the top bit set, which
+ * the source cpu field of a full header never has.
+ * 
+ * Packets belong to one of two traffic classes, flagged on the router header (PKT_PRIO): bulk
+ * and real time (control) traffic. The class of the messages sent from a port is set with
+ * hf_comm_class() (ports of real time tasks start on the real time class). Routers serve a
+ * waiting packet of the real time class before the bulk ones (a bulk packet holding an output
+ * is not preempted, so a real time packet waits for one packet at most on each hop), queued
+ * asynchronous messages of the real time class are sent before the bulk ones and the last
+ * NOC_CLASS_RESERVE free shared packets of the receiver are kept for real time packets, so a
+ * bulk transfer filling the pool does not make control messages drop.
+ * 
+ * With NOC_TIMESTAMP, the first packet of each message (but credit packets) is flagged with
+ * PKT_SEQ_TIME and carries the time it was injected (the core counter, two data flits after the
+ * multicast mask, size and flow id flits). Receivers keep the arrival time of each packet on
+ * its buffer (PKT_ARRIVAL), and the NoC statistics get the latency of each stage of the
+ * messages: sender queueing (to the injection), transit, wait on the reception ring and task
+ * wakeup. The transit needs the offset between the clocks, calibrated with hf_noc_sync().
+ * All cores skip the timestamp of the messages they receive, with NOC_TIMESTAMP or not.
+ * 
  * The platform should include the following macros:
  * 
  * NOC_INTERCONNECT			intra-chip interconnection type
  * CPU_ID				a unique sequential number for each core
  * NOC_WIDTH				number of columns of the 2D mesh
  * NOC_HEIGHT				number of rows of the 2D mesh
- * NOC_PACKET_SIZE			packet size (in 16 bit flits)
+ * NOC_PACKET_SIZE			maximum packet size (in 16 bit flits)
  * NOC_PACKET_SLOTS			number of slots in the shared packet queue per core
+ * NOC_DMA				1 if packets are moved by the network interface DMA
+ *					(_ni_dma_recv(), _ni_dma_send(), _ni_dma_status() and
+ *					_ni_dma_ack() helpers), 0 for programmed I/O
+ * NOC_ADDR_BITS				(optional) bits of the column and line fields of
+ *					the router header, 8 by default on meshes larger
+ *					than 16x16, 4 otherwise
+ * NOC_COMPACT				(optional) 1 (default) to send compact continuation
+ *					packets, 0 for full headers on every packet. all
+ *					cores receive both. not used on more than 256 cores
+ * NOC_FLOWS				(optional) open flows kept by the receiver (16)
+ * NOC_PORT_QUOTA			(optional) default maximum of shared packets held by
+ *					a port (3/4 of NOC_PACKET_SLOTS)
+ * NOC_RMA_WINDOWS			(optional) remote memory windows of a core (8)
+ * NOC_RMA_PENDING			(optional) remote reads waiting for their reply (8)
+ * NOC_CLASSES				(optional) 1 (default) to flag the traffic class of the
+ *					packets, 0 to send all of them as bulk. not used
+ *					on meshes of more than 128 columns
+ * NOC_CLASS_RESERVE			(optional) free shared packets only taken by packets
+ *					of the real time class (NOC_PACKET_SLOTS / 8)
+ * NOC_TIMESTAMP			(optional) 1 to timestamp messages and measure their
+ *					latency, 0 (default) otherwise
+ * NOC_SYNC_ROUNDS			(optional) exchanges of a clock calibration (8)
  */
 
 #include <hal.h>
@@ -39,21 +98,220 @@
 #include <kprintf.h>
 #include <malloc.h>
 #include <queue.h>
+#include <pool.h>
+#include <ring.h>
+#include <lockstat.h>
+#include <semaphore.h>
 #include <kernel.h>
 #include <panic.h>
+#include <scheduler.h>
 #include <task.h>
+#include <module.h>
 #include <ecodes.h>
 #include <interrupt.h>
+#include <trace.h>
 #include <noc.h>
 #include <ni.h>
 
+#define PORT_HASH_SIZE	32				/* port lookup hash buckets (power of two) */
+
+#ifndef NOC_COMPACT
+#define NOC_COMPACT	1
+#endif
+#if NOC_WIDTH * NOC_HEIGHT > 256
+#undef NOC_COMPACT
+#define NOC_COMPACT	0
+#endif
+#ifndef NOC_FLOWS
+#define NOC_FLOWS	16
+#endif
+#ifndef NOC_PORT_QUOTA
+#define NOC_PORT_QUOTA	(NOC_PACKET_SLOTS - NOC_PACKET_SLOTS / 4)
+#endif
+#ifndef NOC_RMA_WINDOWS
+#define NOC_RMA_WINDOWS	8
+#endif
+#ifndef NOC_RMA_PENDING
+#define NOC_RMA_PENDING	8
+#endif
+#ifndef NOC_CLASSES
+#define NOC_CLASSES	1
+#endif
+#if NOC_ADDR_BITS == 8 && NOC_WIDTH > 128
+#undef NOC_CLASSES
+#define NOC_CLASSES	0
+#endif
+#ifndef NOC_CLASS_RESERVE
+#define NOC_CLASS_RESERVE	(NOC_PACKET_SLOTS / 8)
+#endif
+#if NOC_CLASSES == 0
+#undef NOC_CLASS_RESERVE
+#define NOC_CLASS_RESERVE	0
+#endif
+#ifndef NOC_TIMESTAMP
+#define NOC_TIMESTAMP	0
+#endif
+#ifndef NOC_SYNC_ROUNDS
+#define NOC_SYNC_ROUNDS	8
+#endif
+
+/* open flow: a message being received with compact continuation packets */
+struct noc_flow {
+	uint16_t flow;					/* flow id, 0 if the entry is free */
+	uint16_t task;					/* receiving task */
+	int32_t left;					/* message bytes still to arrive */
+	uint16_t hdr[PKT_HEADER_SIZE];			/* header of the first packet */
+};
+
+static struct noc_flow flow_table[NOC_FLOWS];
+static uint16_t flow_victim;				/* entry replaced when the table is full */
+static uint8_t flow_next;				/* message number of the next flow sent */
+
+/* remote memory window, and remote read to be replied by the transmission task */
+struct noc_rma_win {
+	int8_t *base;					/* window memory, NULL if not registered */
+	uint32_t size;					/* window size, in bytes */
+	uint16_t flags;					/* RMA_READ, RMA_WRITE */
+};
+
+struct noc_rma_req {
+	uint16_t cpu;					/* requester */
+	uint16_t port;
+	uint16_t tag;					/* request tag, echoed on the reply */
+	int8_t *buf;					/* data to send back, NULL if denied */
+	uint32_t size;
+	uint8_t sync;					/* clock calibration request (hf_noc_sync()) */
+	uint32_t t0, t1;				/* calibration: request injected (requester clock) and arrived */
+};
+
+static struct noc_rma_win rma_win[NOC_RMA_WINDOWS];
+static struct noc_rma_req rma_req[NOC_RMA_PENDING];
+static volatile uint16_t rma_head, rma_tail;		/* remote reads queued and replied */
+static uint16_t rma_tag;				/* tag of the next remote read */
+static uint16_t rma_buf[PKT_BUF_SIZE];			/* remote memory request being serviced (programmed I/O) */
+
+#if NOC_TIMESTAMP == 1
+static uint32_t rx_time;				/* arrival time of the packet being received */
+static int32_t time_offset[NOC_WIDTH * NOC_HEIGHT];	/* clock of each core minus the clock of this one */
+static uint8_t time_synced[NOC_WIDTH * NOC_HEIGHT];	/* clock offset of each core calibrated */
+#endif
+
+static uint16_t port_held[MAX_TASKS];			/* shared packets held by each port */
+static uint16_t port_reserved[MAX_TASKS];		/* shared packets reserved to each port */
+static uint16_t port_max[MAX_TASKS];			/* maximum of shared packets held by each port */
+static uint16_t reserve_left;				/* reserved packets not held by their ports */
+static uint8_t port_class[MAX_TASKS];			/* traffic class of the messages sent by each port */
+
+static uint16_t port_hash[PORT_HASH_SIZE];		/* first task (id + 1) on each bucket, 0 if empty */
+static uint16_t port_next[MAX_TASKS];			/* next task (id + 1) on the same bucket */
+
+#if NOC_DMA == 1
+static uint16_t dma_scratch[NOC_PACKET_SIZE];		/* reception buffer of packets to be dropped */
+static uint16_t *volatile dma_rx_buf;			/* packet being received */
+static volatile uint16_t dma_tx_wait;			/* task (id + 1) waiting for a transmission, 0 if none */
+
+static void ni_dma_isr(void *arg);
+static void ni_dma_rx_isr(void *arg);
+static void ni_dma_tx_isr(void *arg);
+#endif
+
+static void ni_tx(void);
+static int32_t ni_recv(uint16_t id, uint16_t *source_cpu, uint16_t *source_port, struct noc_iov *iov, int32_t iovcnt, uint32_t *size, uint16_t channel);
+static void ni_inject(uint16_t *out_buf, int32_t yield, int32_t ts, uint32_t start);
+static void ni_rma(uint16_t *pkt);
+
+static uint8_t port_hash_key(uint16_t port)
+{
+	return (port ^ (port >> 5) ^ (port >> 10)) & (PORT_HASH_SIZE - 1);
+}
+
+static void port_hash_add(uint16_t id)
+{
+	uint8_t k;
+
+	k = port_hash_key(pktdrv_ports[id]);
+	port_next[id] = port_hash[k];
+	port_hash[k] = id + 1;
+}
+
+static void port_hash_del(uint16_t id)
+{
+	uint16_t *p;
+
+	p = &port_hash[port_hash_key(pktdrv_ports[id])];
+	while (*p && *p != id + 1)
+		p = &port_next[*p - 1];
+	if (*p)
+		*p = port_next[id];
+	port_next[id] = 0;
+}
+
+/* task id associated to a reception port, or 0 if none */
+static uint16_t port_find(uint16_t port)
+{
+	uint16_t i;
+
+	for (i = port_hash[port_hash_key(port)]; i; i = port_next[i - 1])
+		if (pktdrv_ports[i - 1] == port)
+			return i - 1;
+
+	return 0;
+}
+
+/**
+ * @internal
+ * @brief Releases the communication queue of a task being killed (hf_killhook()), so the
+ * packets buffered on it go back to the shared pool.
+ * 
+ * @param id is the task id.
+ */
+static void ni_kill(uint16_t id)
+{
+	if (pktdrv_tqueue[id])
+		hf_comm_destroy(id);
+}
+
+/* offset of the timestamp flits of the first packet of a message, 0 if it carries none */
+static int32_t ni_stamp_at(const uint16_t *pkt)
+{
+	int32_t i = PKT_HEADER_SIZE;
+
+	if ((pkt[PKT_SEQ] & PKT_SEQ_TIME) == 0)
+		return 0;
+	if (pkt[PKT_SEQ] & PKT_SEQ_MCAST) i += 2;
+	if (pkt[PKT_SEQ] & PKT_SEQ_LONG) i++;
+	if (pkt[PKT_SEQ] & PKT_SEQ_FLOW) i++;
+
+	return i;
+}
+
+#if NOC_TIMESTAMP == 1
+/* time (core counter) held on two flits */
+static uint32_t ni_time(const uint16_t *p)
+{
+	return ((uint32_t)p[0] << 16) | p[1];
+}
+
+/* adds a sample to the latency of a stage. interrupts disabled */
+static void ni_latency(struct noc_latency *l, uint32_t t)
+{
+	if (l->samples == 0 || t < l->min)
+		l->min = t;
+	if (t > l->max)
+		l->max = t;
+	l->total += t;
+	l->samples++;
+}
+#endif
+
 /**
  * @brief NoC driver: initializes the network interface.
  * 
  * A queue for the packet driver is initialized with NOC_PACKET_SLOTS capacity (in packets).
  * The queue is populated with empty packets (pointers to dinamically allocated memory areas)
  * which will be used (shared) among all tasks for the reception of data. The hardware is reset
- * and the NoC interrupt handler is registered. This routine is called during the system boot-up
+ * and the NoC interrupt handler is registered. The transmission queue and task used by
+ * hf_send_async() are created as well. This routine is called during the system boot-up
  * and is dependent on the architecture implementation.
  */
 void ni_init(void)
@@ -67,59 +325,314 @@ void ni_init(void)
 	pktdrv_queue = hf_queue_create(NOC_PACKET_SLOTS);
 	if (pktdrv_queue == NULL) panic(PANIC_OOM);
 	
-	for (i = 0; i < MAX_TASKS; i++)
+	for (i = 0; i < MAX_TASKS; i++){
 		pktdrv_ports[i] = 0;
+		pktdrv_wait[i] = 0;
+		port_next[i] = 0;
+		port_held[i] = 0;
+		port_reserved[i] = 0;
+		port_max[i] = 0;
+		port_class[i] = NOC_CLASS_BULK;
+	}
+	reserve_left = 0;
+	for (i = 0; i < PORT_HASH_SIZE; i++)
+		port_hash[i] = 0;
+#if NOC_TIMESTAMP == 1
+	time_synced[hf_cpuid()] = 1;
+#endif
 	
+	pktdrv_pool = hf_pool_create(sizeof(int16_t) * PKT_BUF_SIZE, NOC_PACKET_SLOTS);
+	if (pktdrv_pool == NULL) panic(PANIC_OOM);
 	for (i = 0; i < NOC_PACKET_SLOTS; i++){
-		ptr = hf_malloc(sizeof(int16_t) * NOC_PACKET_SIZE);
-		if (ptr == NULL) panic(PANIC_OOM);
+		ptr = hf_pool_alloc(pktdrv_pool);
 		hf_queue_addtail(pktdrv_queue, ptr);
 	}
+	hf_noc_resetstats();
+
+	hf_killhook(ni_kill);
+
+	pktdrv_txqueue = hf_queue_create(NOC_PACKET_SLOTS);
+	if (pktdrv_txqueue == NULL) panic(PANIC_OOM);
+	if (hf_seminit(&pktdrv_txsem, 0)) panic(PANIC_OOM);
+	if (hf_spawn(ni_tx, 0, 0, 0, "ni tx", 1024) < 0) panic(PANIC_OOM);
 
 	for(i = 0; i < NOC_PACKET_SIZE; i++)
 		_ni_read();
 
+#if NOC_DMA == 1
+	_irq_register(IRQ_NOC_READ, (funcptr)ni_dma_isr);
+	_irq_register(IRQ_NOC_DMA_RX, (funcptr)ni_dma_rx_isr);
+	_irq_register(IRQ_NOC_DMA_TX, (funcptr)ni_dma_tx_isr);
+	_irq_wakeup(IRQ_NOC_READ | IRQ_NOC_DMA_RX | IRQ_NOC_DMA_TX);
+	_irq_mask_set(IRQ_NOC_READ | IRQ_NOC_DMA_RX | IRQ_NOC_DMA_TX);
+#else
 	_irq_register(IRQ_NOC_READ, (funcptr)ni_isr);
+	_irq_wakeup(IRQ_NOC_READ);
 	_irq_mask_set(IRQ_NOC_READ);
+#endif
 
 	kprintf("\nKERNEL: NoC driver registered");
 }
 
+/**
+ * @internal
+ * @brief Puts a received packet on the reception ring of a task.
+ * 
+ * @param k is the task id bound to the packet target port
+ * @param buf_ptr is the packet
+ * 
+ * The packet is returned to the pool if the port is over its quota of shared packets or if
+ * the ring is full. A port under its reservation always gets the packet, otherwise it is
+ * admitted only if the free packets left still cover the unused reservations of the other
+ * ports (and NOC_CLASS_RESERVE packets more, for a packet of the bulk class). If the task is
+ * blocked waiting for packets (hf_recv()), it is woken up. With NOC_TIMESTAMP the arrival time is
+ * kept on the packet, and the transit of the first packet of a message is accounted.
+ */
+static void ni_deliver(uint16_t k, uint16_t *buf_ptr)
+{
+	int32_t slots, used, rt;
+#if NOC_TIMESTAMP == 1
+	uint16_t src;
+	int32_t ts, transit;
+
+	buf_ptr[PKT_ARRIVAL] = rx_time >> 16;
+	buf_ptr[PKT_ARRIVAL + 1] = rx_time & 0xffff;
+#endif
+
+	rt = buf_ptr[PKT_TARGET_CPU] & PKT_PRIO;
+	slots = hf_queue_count(pktdrv_queue);
+	if (port_held[k] >= port_max[k] || (port_held[k] >= port_reserved[k] && slots < reserve_left)){
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		pktdrv_stats.drop_quota++;
+		pktdrv_pstats[k].drop_quota++;
+#if KERNEL_LOG == 3
+		trace_event(TRACE_NOC_DROP, buf_ptr[PKT_TARGET_PORT]);
+#endif
+	}else if (!rt && port_held[k] >= port_reserved[k] && slots < reserve_left + NOC_CLASS_RESERVE){
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		pktdrv_stats.drop_class++;
+#if KERNEL_LOG == 3
+		trace_event(TRACE_NOC_DROP, buf_ptr[PKT_TARGET_PORT]);
+#endif
+	}else if (hf_ring_put(pktdrv_tqueue[k], buf_ptr)){
+		kprintf("\nKERNEL: task (on port %d) queue full! dropping packet...", buf_ptr[PKT_TARGET_PORT]);
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		pktdrv_stats.drop_task_full++;
+		pktdrv_pstats[k].dropped++;
+#if KERNEL_LOG == 3
+		trace_event(TRACE_NOC_DROP, buf_ptr[PKT_TARGET_PORT]);
+#endif
+	}else{
+		if (port_held[k]++ < port_reserved[k])
+			reserve_left--;
+		if (port_held[k] > pktdrv_pstats[k].held_max)
+			pktdrv_pstats[k].held_max = port_held[k];
+		if (slots < pktdrv_stats.queue_min)
+			pktdrv_stats.queue_min = slots;
+		used = hf_ring_count(pktdrv_tqueue[k]);
+		if (used > pktdrv_pstats[k].ring_max)
+			pktdrv_pstats[k].ring_max = used;
+		pktdrv_stats.rx_packets++;
+		pktdrv_pstats[k].rx_packets++;
+		if (rt)
+			pktdrv_stats.rx_rt++;
+#if NOC_TIMESTAMP == 1
+		ts = ni_stamp_at(buf_ptr);
+		if (ts){
+			src = buf_ptr[PKT_SOURCE_CPU];
+			if (src < NOC_WIDTH * NOC_HEIGHT && time_synced[src]){
+				transit = rx_time - ni_time(buf_ptr + ts) + time_offset[src];
+				ni_latency(&pktdrv_stats.lat_transit, transit > 0 ? transit : 0);
+			}else{
+				pktdrv_stats.unsynced++;
+			}
+		}
+#endif
+#if KERNEL_LOG == 3
+		trace_event(TRACE_NOC_RX, buf_ptr[PKT_TARGET_PORT]);
+#endif
+		if (pktdrv_wait[k]){
+			pktdrv_wait[k] = 0;
+			sched_wakeup(&krnl_tcb[k]);
+		}
+	}
+}
+
+/**
+ * @internal
+ * @brief Gives a packet held by a port back to the shared pool of packets.
+ * 
+ * @param k is the task id bound to the port
+ * @param buf_ptr is the packet
+ * 
+ * Must be called with interrupts disabled.
+ */
+static void ni_release(uint16_t k, uint16_t *buf_ptr)
+{
+	hf_queue_addtail(pktdrv_queue, buf_ptr);
+	if (port_held[k]){
+		if (--port_held[k] < port_reserved[k])
+			reserve_left++;
+	}
+}
+
+/* opens the flow of a message sent with compact continuation packets, on its first packet
+ * (flits long) received for task k */
+static void ni_flow_open(uint16_t k, uint16_t *buf_ptr, int32_t flits)
+{
+	struct noc_flow *f = NULL;
+	uint32_t total;
+	uint16_t flow;
+	int32_t i;
+
+	i = PKT_HEADER_SIZE;
+	total = buf_ptr[PKT_MSG_SIZE];
+	if (buf_ptr[PKT_SEQ] & PKT_SEQ_LONG) total |= (uint32_t)buf_ptr[i++] << 16;
+	flow = buf_ptr[i];
+	for (i = 0; i < NOC_FLOWS; i++){
+		if (flow_table[i].flow == flow){
+			f = &flow_table[i];
+			break;
+		}
+		if (!f && !flow_table[i].flow)
+			f = &flow_table[i];
+	}
+	if (!f){
+		f = &flow_table[flow_victim];
+		flow_victim = (flow_victim + 1) % NOC_FLOWS;
+	}
+	f->flow = flow;
+	f->task = k;
+	f->left = total - (flits - PKT_HEADER_SIZE) * 2;
+	memcpy(f->hdr, buf_ptr, sizeof(f->hdr));
+}
+
+/* finds the open flow of a continuation packet with data flits of data, and closes it on the
+ * last packet of the message. returns the task of the flow, or 0 if the packet is dropped */
+static uint16_t ni_flow_find(uint16_t flow, int32_t data, struct noc_flow **fp)
+{
+	struct noc_flow *f;
+	uint16_t k;
+	int32_t i;
+
+	for (i = 0, f = flow_table; i < NOC_FLOWS; i++, f++)
+		if (f->flow == flow)
+			break;
+	if (i == NOC_FLOWS){
+		pktdrv_stats.drop_no_flow++;
+		return 0;
+	}
+	*fp = f;
+	k = f->task;
+	f->left -= data * 2;
+	if (f->left <= 0)
+		f->flow = 0;
+	if (!krnl_tcb[k].ptask || pktdrv_ports[k] != f->hdr[PKT_TARGET_PORT]){
+		pktdrv_stats.drop_no_port++;
+		return 0;
+	}
+
+	return k;
+}
+
+/* rebuilds the full header of a continuation packet (data flits of data, at PKT_HEADER_SIZE) */
+static void ni_flow_header(struct noc_flow *f, uint16_t *buf_ptr, uint16_t seq, int32_t data)
+{
+	memcpy(buf_ptr, f->hdr, sizeof(f->hdr));
+	buf_ptr[PKT_PAYLOAD] = PKT_HEADER_SIZE - 2 + data;
+	buf_ptr[PKT_SEQ] = seq & PKT_SEQ_MASK;
+}
+
+/* receives a continuation packet (programmed I/O), after its flow id */
+static void ni_cont_isr(uint16_t flow, int32_t flits)
+{
+	struct noc_flow *f;
+	uint16_t k, seq, *buf_ptr;
+	int32_t i, data;
+
+	seq = _ni_read();
+	data = flits - PKT_CONT_SIZE;
+	k = ni_flow_find(flow, data, &f);
+	if (k){
+		buf_ptr = hf_queue_remhead(pktdrv_queue);
+		if (buf_ptr){
+			for (i = PKT_HEADER_SIZE; i < PKT_HEADER_SIZE + data; i++)
+				buf_ptr[i] = _ni_read();
+			ni_flow_header(f, buf_ptr, seq, data);
+			ni_deliver(k, buf_ptr);
+			return;
+		}
+		kprintf("\nKERNEL: NoC queue full! dropping packet...");
+		pktdrv_stats.drop_noc_full++;
+		pktdrv_stats.queue_min = 0;
+	}
+	for (i = 0; i < data; i++)
+		_ni_read();
+}
+
 /**
  * @brief NoC driver: network interface interrupt service routine.
  * 
  * This routine is called by the second level of interrupt handling. An interrupt from the network
- * interface means a full packet has arrived. The packet header is decoded and the target port is
- * identified. A reference to an empty packet is removed from the pool of buffers (packets), the
- * contents of the empty packet are filled with flits from the hardware queue and the reference is
+ * interface means a whole packet has arrived. The packet header is decoded and the target port is
+ * identified (on a hash of the reception ports, so the lookup cost does not depend on the number
+ * of tasks). A reference to an empty packet is removed from the pool of buffers (packets), the
+ * contents of the empty packet are filled with the flits of the packet (as many as its payload
+ * field tells) from the hardware queue and the reference is
  * put on the target task (associated to a port) queue of packets. There is one queue per task of
- * configurable size.
+ * configurable size. If the target task is blocked waiting for packets (hf_recv()), it is woken up.
+ * Continuation packets of a flow get the header of the first packet of their message.
  */
 void ni_isr(void *arg)
 {
 	uint16_t target_cpu, payload, source_cpu, source_port, target_port, msg_size, seq, channel;
-	int32_t i, k;
-	uint16_t *buf_ptr;
+	int32_t i, flits;
+	uint16_t k, *buf_ptr;
 
 	_di();
+#if NOC_TIMESTAMP == 1
+	rx_time = _readcounter();
+#endif
 	_ni_read();
 	target_cpu = _ni_read();
 	payload = _ni_read();
 	
-	if (payload != NOC_PACKET_SIZE - 2)
+	if (payload < PKT_CONT_SIZE - 2 || payload > NOC_PACKET_SIZE - 2)
 		return;
+	flits = payload + 2;
 	
 	source_cpu = _ni_read();
+	if (source_cpu & PKT_FLOW){
+		ni_cont_isr(source_cpu, flits);
+		return;
+	}
+	if (flits < PKT_HEADER_SIZE){
+		for (i = 3; i < flits; i++)
+			_ni_read();
+		return;
+	}
 	source_port = _ni_read();
 	target_port = _ni_read();
 	msg_size = _ni_read();
 	seq = _ni_read();
 	channel = _ni_read();
 
-	for (k = 0; k < MAX_TASKS; k++)
-		if (pktdrv_ports[k] == target_port) break;
+	if (target_port == NOC_RMA_PORT){
+		rma_buf[PKT_PAYLOAD] = payload;
+		rma_buf[PKT_SOURCE_CPU] = source_cpu;
+		rma_buf[PKT_SOURCE_PORT] = source_port;
+		rma_buf[PKT_MSG_SIZE] = msg_size;
+		rma_buf[PKT_SEQ] = seq;
+		rma_buf[PKT_CHANNEL] = channel;
+		for (i = PKT_HEADER_SIZE; i < flits; i++)
+			rma_buf[i] = _ni_read();
+		ni_rma(rma_buf);
+		return;
+	}
 
-	if (k && k < MAX_TASKS && krnl_tcb[k].ptask){
+	k = port_find(target_port);
+
+	if (k && krnl_tcb[k].ptask){
 		buf_ptr = hf_queue_remhead(pktdrv_queue);
 		if (buf_ptr){
 			buf_ptr[PKT_TARGET_CPU] = target_cpu;
@@ -131,27 +644,143 @@ void ni_isr(void *arg)
 			buf_ptr[PKT_SEQ] = seq;
 			buf_ptr[PKT_CHANNEL] = channel;
 
-			for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE; i++)
+			for (i = PKT_HEADER_SIZE; i < flits; i++)
 				buf_ptr[i] = _ni_read();
 
-			if (hf_queue_addtail(pktdrv_tqueue[k], buf_ptr)){
-				kprintf("\nKERNEL: task (on port %d) queue full! dropping packet...", target_port);
-				hf_queue_addtail(pktdrv_queue, buf_ptr);
-			}
+			if (seq & PKT_SEQ_FLOW)
+				ni_flow_open(k, buf_ptr, flits);
+			ni_deliver(k, buf_ptr);
 		}else{
 			kprintf("\nKERNEL: NoC queue full! dropping packet...");
-			for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE; i++)
+			for (i = PKT_HEADER_SIZE; i < flits; i++)
 				_ni_read();
+			pktdrv_stats.drop_noc_full++;
+			pktdrv_stats.queue_min = 0;
+#if KERNEL_LOG == 3
+			trace_event(TRACE_NOC_DROP, target_port);
+#endif
 		}
 	}else{
 		kprintf("\nKERNEL: no task on port %d (offender: cpu %d port %d) - dropping packet...", target_port, source_cpu, source_port);
-		for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE; i++)
+		for (i = PKT_HEADER_SIZE; i < flits; i++)
 			_ni_read();
+		pktdrv_stats.drop_no_port++;
+#if KERNEL_LOG == 3
+		trace_event(TRACE_NOC_DROP, target_port);
+#endif
 	}
 
 	return;
 }
 
+#if NOC_DMA == 1
+/**
+ * @brief NoC driver: network interface interrupt service routine (DMA).
+ * 
+ * A packet has arrived. A free packet is taken from the pool and the network interface is
+ * programmed to copy the whole packet to it (the interface takes the length from the payload
+ * field), so the processor is free during the transfer.
+ * If the pool is empty, the packet is received on a scratch buffer and dropped when done.
+ */
+static void ni_dma_isr(void *arg)
+{
+	_di();
+#if NOC_TIMESTAMP == 1
+	rx_time = _readcounter();
+#endif
+	dma_rx_buf = hf_queue_remhead(pktdrv_queue);
+	if (dma_rx_buf == NULL)
+		dma_rx_buf = dma_scratch;
+	_ni_dma_recv(dma_rx_buf);
+}
+
+/**
+ * @brief NoC driver: DMA reception complete interrupt service routine.
+ * 
+ * The packet header is decoded and the packet is put on the task queue bound to its target
+ * port, as ni_isr() does.
+ */
+static void ni_dma_rx_isr(void *arg)
+{
+	struct noc_flow *f;
+	uint16_t k, seq, *buf_ptr;
+	int32_t data;
+
+	_di();
+	_ni_dma_ack(IRQ_NOC_DMA_RX);
+	buf_ptr = dma_rx_buf;
+	dma_rx_buf = NULL;
+
+	if (buf_ptr == dma_scratch){
+		kprintf("\nKERNEL: NoC queue full! dropping packet...");
+		pktdrv_stats.drop_noc_full++;
+		pktdrv_stats.queue_min = 0;
+#if KERNEL_LOG == 3
+		trace_event(TRACE_NOC_DROP, buf_ptr[PKT_TARGET_PORT]);
+#endif
+		return;
+	}
+	if (buf_ptr[PKT_PAYLOAD] < PKT_CONT_SIZE - 2 || buf_ptr[PKT_PAYLOAD] > NOC_PACKET_SIZE - 2){
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		return;
+	}
+	if (buf_ptr[PKT_SOURCE_CPU] & PKT_FLOW){
+		data = buf_ptr[PKT_PAYLOAD] + 2 - PKT_CONT_SIZE;
+		k = ni_flow_find(buf_ptr[PKT_CONT_FLOW], data, &f);
+		if (k){
+			seq = buf_ptr[PKT_CONT_SEQ];
+			memmove(buf_ptr + PKT_HEADER_SIZE, buf_ptr + PKT_CONT_SIZE, data * sizeof(uint16_t));
+			ni_flow_header(f, buf_ptr, seq, data);
+			ni_deliver(k, buf_ptr);
+		}else{
+			hf_queue_addtail(pktdrv_queue, buf_ptr);
+		}
+		return;
+	}
+	if (buf_ptr[PKT_PAYLOAD] < PKT_HEADER_SIZE - 2){
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		return;
+	}
+	if (buf_ptr[PKT_TARGET_PORT] == NOC_RMA_PORT){
+		ni_rma(buf_ptr);
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		return;
+	}
+
+	k = port_find(buf_ptr[PKT_TARGET_PORT]);
+	if (k && krnl_tcb[k].ptask){
+		if (buf_ptr[PKT_SEQ] & PKT_SEQ_FLOW)
+			ni_flow_open(k, buf_ptr, buf_ptr[PKT_PAYLOAD] + 2);
+		ni_deliver(k, buf_ptr);
+	}else{
+		kprintf("\nKERNEL: no task on port %d (offender: cpu %d port %d) - dropping packet...", buf_ptr[PKT_TARGET_PORT], buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT]);
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		pktdrv_stats.drop_no_port++;
+#if KERNEL_LOG == 3
+		trace_event(TRACE_NOC_DROP, buf_ptr[PKT_TARGET_PORT]);
+#endif
+	}
+}
+
+/**
+ * @brief NoC driver: DMA transmission complete interrupt service routine.
+ * 
+ * Wakes up the task waiting for the transmission (ni_inject()), if any.
+ */
+static void ni_dma_tx_isr(void *arg)
+{
+	uint16_t id;
+
+	_di();
+	_ni_dma_ack(IRQ_NOC_DMA_TX);
+	if (dma_tx_wait){
+		id = dma_tx_wait - 1;
+		dma_tx_wait = 0;
+		sched_wakeup(&krnl_tcb[id]);
+	}
+}
+#endif
+
 /**
  * @brief Returns the current cpu id number.
  * 
@@ -186,20 +815,21 @@ uint16_t hf_ncores(void)
  * The queue created for the task will be used for the reception of data. Both ni_isr() and hf_recv()
  * routines will manage the queue, putting and pulling packets from the queue on demand. The communication
  * subsystem is configured by the association of a task id to a receiving port (alias) and the definition
- * of how many packet slots a task has on its queue.
+ * of how many packet slots a task has on its queue. The port may hold up to that many shared packets
+ * (NOC_PORT_QUOTA at most) and has none reserved; hf_comm_quota() changes that. Messages sent from
+ * the port are of the real time class if the task is a real time task, and of the bulk class
+ * otherwise; hf_comm_class() changes that.
  */
 int32_t hf_comm_create(uint16_t id, uint16_t port, uint16_t packets)
 {
-	int32_t k;
+	uint32_t status;
 	
 	if (id < MAX_TASKS){
 		if (krnl_tcb[id].ptask == 0)
 			return ERR_INVALID_ID;
 		if (pktdrv_tqueue[id] != NULL)
 			return ERR_COMM_UNFEASIBLE;
-		for (k = 0; k < MAX_TASKS; k++)
-			if (pktdrv_ports[k] == port) break;
-		if (!k || k < MAX_TASKS)
+		if (port == 0 || port == NOC_RMA_PORT || port_find(port))
 			return ERR_COMM_ERROR;
 	}else{
 		return ERR_INVALID_ID;
@@ -208,11 +838,21 @@ int32_t hf_comm_create(uint16_t id, uint16_t port, uint16_t packets)
 	if (packets > NOC_PACKET_SLOTS || packets == 0)
 		packets = NOC_PACKET_SLOTS;
 	
-	pktdrv_tqueue[id] = hf_queue_create(packets);
+	pktdrv_tqueue[id] = hf_ring_create(packets);
 	if (pktdrv_tqueue[id] == 0){
 		return ERR_OUT_OF_MEMORY;
 	}else{
+		status = _di();
 		pktdrv_ports[id] = port;
+		pktdrv_wait[id] = 0;
+		pktdrv_credit[id] = NULL;
+		memset(&pktdrv_pstats[id], 0, sizeof(struct noc_port_stats));
+		port_held[id] = 0;
+		port_reserved[id] = 0;
+		port_max[id] = packets < NOC_PORT_QUOTA ? packets : NOC_PORT_QUOTA;
+		port_class[id] = krnl_tcb[id].period ? NOC_CLASS_RT : NOC_CLASS_BULK;
+		port_hash_add(id);
+		_ei(status);
 		
 		return ERR_OK;
 	}
@@ -229,7 +869,8 @@ int32_t hf_comm_create(uint16_t id, uint16_t port, uint16_t packets)
  */
 int32_t hf_comm_destroy(uint16_t id)
 {
-	int32_t status;
+	void *pkts[16];
+	int32_t status, n;
 
 	if (id < MAX_TASKS){
 		if (krnl_tcb[id].ptask == 0)
@@ -238,15 +879,32 @@ int32_t hf_comm_destroy(uint16_t id)
 		return ERR_INVALID_ID;
 	}
 	
+	if (pktdrv_tqueue[id] == NULL)
+		return ERR_COMM_ERROR;
+	
+	/* buffered packets go back to the pool in blocks. the port holds them, so the
+	 * reservation it still had (held below reserved) is all reserve_left must lose */
 	status = _di();
-	while (hf_queue_count(pktdrv_tqueue[id]))
-		hf_queue_addtail(pktdrv_queue, hf_queue_remhead(pktdrv_tqueue[id]));
+	port_hash_del(id);
+	pktdrv_ports[id] = 0;
+	while ((n = hf_ring_getn(pktdrv_tqueue[id], pkts, 16)) > 0)
+		hf_queue_addn(pktdrv_queue, pkts, n);
+	if (port_held[id] < port_reserved[id])
+		reserve_left -= port_reserved[id] - port_held[id];
+	port_held[id] = 0;
+	port_reserved[id] = 0;
+	port_max[id] = 0;
+	port_class[id] = NOC_CLASS_BULK;
 	_ei(status);
 	
-	if (hf_queue_destroy(pktdrv_tqueue[id])){
+	if (hf_ring_destroy(pktdrv_tqueue[id])){
 		return ERR_COMM_ERROR;
 	}else{
-		pktdrv_ports[id] = 0;
+		pktdrv_tqueue[id] = NULL;
+		if (pktdrv_credit[id]){
+			hf_free(pktdrv_credit[id]);
+			pktdrv_credit[id] = NULL;
+		}
 		
 		return ERR_OK;
 	}
@@ -254,173 +912,217 @@ int32_t hf_comm_destroy(uint16_t id)
 }
 
 /**
- * @brief Receives a message from a task (blocking receive).
+ * @brief Sets the quota of shared packets of a communication queue.
  * 
- * @param source_cpu is a pointer to a variable which will hold the source cpu
- * @param source_port is a pointer to a variable which will hold the source port
- * @param buf is a pointer to a buffer to hold the received message
- * @param size a pointer to a variable which will hold the size (in bytes) of the received message
- * @param channel is the selected message channel of this message (must be the same as in the sender)
+ * @param id is the task id which owns the communication queue
+ * @param reserved is the number of shared packets reserved to the port
+ * @param max is the maximum number of shared packets held by the port (on its reception ring,
+ * being reassembled or taken with hf_recvpkt()), 0 for the size of the reception ring
  * 
- * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
- * created and ERR_SEQ_ERROR when received packets arrive out of order, so the message
- * is corrupted.
+ * @return ERR_OK when successful, ERR_INVALID_ID if no task matches the specified id,
+ * ERR_COMM_ERROR if the task has no communication queue and ERR_COMM_UNFEASIBLE if the
+ * reservations of all ports would exceed the pool (NOC_PACKET_SLOTS) or reserved > max.
  * 
- * A message is build from packets received on the ni_isr() routine. Packets are decoded and
- * combined in a complete message, returning the message, its size and source identification
- * to the calling task. The buffer where the message will be stored must be large enough or
- * we will have a problem that may not be noticed before its too late.
+ * Packets reserved to a port are kept free for it while it holds less than that, so the
+ * other ports can't take them. A port over its maximum drops packets (drop_quota), even
+ * with free packets on the pool, so a slow receiver can't starve the others.
  */
-int32_t hf_recv(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
+int32_t hf_comm_quota(uint16_t id, uint16_t reserved, uint16_t max)
 {
-	uint16_t id, seq = 0, packet = 0, packets, payload_bytes;
 	uint32_t status;
-	int32_t i, k, p = 0, error = ERR_OK;
-	uint16_t *buf_ptr;
+	int32_t i, total = reserved;
+
+	if (id >= MAX_TASKS || krnl_tcb[id].ptask == 0)
+		return ERR_INVALID_ID;
+	if (pktdrv_tqueue[id] == NULL)
+		return ERR_COMM_ERROR;
+	if (max == 0 || max > pktdrv_tqueue[id]->size)
+		max = pktdrv_tqueue[id]->size;
+	if (reserved > max)
+		return ERR_COMM_UNFEASIBLE;
 
-	id = hf_selfid();
-	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
-	
-	while (1){
-		k = hf_queue_count(pktdrv_tqueue[id]);
-		if (k){
-			buf_ptr = hf_queue_get(pktdrv_tqueue[id], 0);
-			if (buf_ptr)
-				if (buf_ptr[PKT_CHANNEL] == channel) break;
-		}
-	}
-		
 	status = _di();
-	buf_ptr = hf_queue_remhead(pktdrv_tqueue[id]);
-	_ei(status);
-	
-	*source_cpu = buf_ptr[PKT_SOURCE_CPU];
-	*source_port = buf_ptr[PKT_SOURCE_PORT];
-	*size = buf_ptr[PKT_MSG_SIZE];
-	seq = buf_ptr[PKT_SEQ];
-			
-	payload_bytes = (NOC_PACKET_SIZE - PKT_HEADER_SIZE) * sizeof(uint16_t);
-	(*size % payload_bytes == 0)?(packets = *size / payload_bytes):(packets = *size / payload_bytes + 1);
-			
-	while (++packet < packets){
-		if (buf_ptr[PKT_SEQ] != seq++)
-			error = ERR_SEQ_ERROR;
-			
-		for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE; i++){
-			buf[p++] = (uint8_t)(buf_ptr[i] >> 8);
-			buf[p++] = (uint8_t)(buf_ptr[i] & 0xff);
-		}
-		status = _di();
-		hf_queue_addtail(pktdrv_queue, buf_ptr);
-		_ei(status);
-		
-		while (1){
-			k = hf_queue_count(pktdrv_tqueue[id]);
-			if (k){
-				buf_ptr = hf_queue_get(pktdrv_tqueue[id], 0);
-				if (buf_ptr)
-					if (buf_ptr[PKT_CHANNEL] == channel) break;
-			}
-		}
-		status = _di();
-		buf_ptr = hf_queue_remhead(pktdrv_tqueue[id]);
+	for (i = 0; i < MAX_TASKS; i++)
+		if (i != id)
+			total += port_reserved[i];
+	if (total > NOC_PACKET_SLOTS){
 		_ei(status);
+		return ERR_COMM_UNFEASIBLE;
 	}
-	
-	if (buf_ptr[PKT_SEQ] != seq++)
-		error = ERR_SEQ_ERROR;
-
-	for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE && p < *size; i++){
-		buf[p++] = (uint8_t)(buf_ptr[i] >> 8);
-		buf[p++] = (uint8_t)(buf_ptr[i] & 0xff);
-	}
-	status = _di();
-	hf_queue_addtail(pktdrv_queue, buf_ptr);
+	if (port_held[id] < port_reserved[id])
+		reserve_left -= port_reserved[id] - port_held[id];
+	port_reserved[id] = reserved;
+	port_max[id] = max;
+	if (port_held[id] < reserved)
+		reserve_left += reserved - port_held[id];
 	_ei(status);
-	
-	return error;
+
+	return ERR_OK;
 }
 
 /**
- * @brief Sends a message to a task (blocking send).
+ * @brief Sets the traffic class of the messages sent from a communication queue.
  * 
- * @param target_cpu is the target processor
- * @param target_port is the target task port
- * @param buf is a pointer to a buffer that holds the message
- * @param size is the size (in bytes) of the message
- * @param channel is the selected message channel of this message (must be the same as in the receiver)
+ * @param id is the task id which owns the communication queue
+ * @param cls is the traffic class, NOC_CLASS_BULK or NOC_CLASS_RT
  * 
- * @return ERR_OK
+ * @return ERR_OK when successful, ERR_INVALID_ID if no task matches the specified id,
+ * ERR_COMM_ERROR if the task has no communication queue and ERR_COMM_UNFEASIBLE if the
+ * class is not known.
  * 
- * A message is broken into packets containing a header and part of the message as the payload.
- * The packets are injected, one by one, in the network through the network interface.
+ * Packets of the real time class are given precedence by the routers, on the transmission
+ * queue of hf_send_async() and on the shared packets of the receiver (NOC_CLASS_RESERVE),
+ * so short control messages keep a bounded latency under bulk transfers. The class should be
+ * kept for control traffic: real time messages only get ahead of bulk ones while they are few.
  */
-int32_t hf_send(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel)
+int32_t hf_comm_class(uint16_t id, uint16_t cls)
 {
-	uint16_t packet = 0, packets, payload_bytes, id;
-	uint32_t status;
-	int32_t i, p = 0;
-	uint16_t out_buf[NOC_PACKET_SIZE];
-	
-	id = hf_selfid();
-	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
-
-	payload_bytes = (NOC_PACKET_SIZE - PKT_HEADER_SIZE) * sizeof(uint16_t);
-	(size % payload_bytes == 0)?(packets = size / payload_bytes):(packets = size / payload_bytes + 1);
-
-	while (++packet < packets){
-		out_buf[PKT_TARGET_CPU] = (NOC_COLUMN(target_cpu) << 4) | NOC_LINE(target_cpu);
-		out_buf[PKT_PAYLOAD] = NOC_PACKET_SIZE - 2;
-		out_buf[PKT_SOURCE_CPU] = hf_cpuid();
-		out_buf[PKT_SOURCE_PORT] = pktdrv_ports[id];
-		out_buf[PKT_TARGET_PORT] = target_port;
-		out_buf[PKT_MSG_SIZE] = size;
-		out_buf[PKT_SEQ] = packet;
-		out_buf[PKT_CHANNEL] = channel;
-		
-		for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE; i++, p+=2)
-			out_buf[i] = (buf[p] << 8) | buf[p+1];
-
-again1:		while ((_ni_status() & 0x1) == 0);
-		status = _di();
-		if ((_ni_status() & 0x1) == 0){
-			_ei(status);
-			goto again1;
-		}
-		for (i = 0; i < NOC_PACKET_SIZE; i++)
-			_ni_write(out_buf[i]);
-		_ei(status);
-	}
-
-	out_buf[PKT_TARGET_CPU] = (NOC_COLUMN(target_cpu) << 4) | NOC_LINE(target_cpu);
-	out_buf[PKT_PAYLOAD] = NOC_PACKET_SIZE - 2;
-	out_buf[PKT_SOURCE_CPU] = hf_cpuid();
-	out_buf[PKT_SOURCE_PORT] = pktdrv_ports[id];
-	out_buf[PKT_TARGET_PORT] = target_port;
-	out_buf[PKT_MSG_SIZE] = size;
-	out_buf[PKT_SEQ] = packet;
-	out_buf[PKT_CHANNEL] = channel;
+	if (id >= MAX_TASKS || krnl_tcb[id].ptask == 0)
+		return ERR_INVALID_ID;
+	if (pktdrv_tqueue[id] == NULL)
+		return ERR_COMM_ERROR;
+	if (cls != NOC_CLASS_BULK && cls != NOC_CLASS_RT)
+		return ERR_COMM_UNFEASIBLE;
 
-	for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE && (p < size); i++, p+=2)
-		out_buf[i] = (buf[p] << 8) | buf[p+1];
-	for(; i < NOC_PACKET_SIZE; i++)
-		out_buf[i] = 0xdead;
+	port_class[id] = cls;
 
-again2:	while ((_ni_status() & 0x1) == 0);
-	status = _di();
-	if ((_ni_status() & 0x1) == 0){
-		_ei(status);
-		goto again2;
-	}
-	for (i = 0; i < NOC_PACKET_SIZE; i++)
-		_ni_write(out_buf[i]);
-	_ei(status);
-	
 	return ERR_OK;
 }
 
+typedef uint32_t __attribute__((__may_alias__)) ni_word;
+
 /**
- * @brief Receives a message from a task (blocking receive) with acknowledgement.
+ * @brief Copies flits between a packet and a message buffer.
+ * 
+ * @param dst is the destination (packet or message buffer)
+ * @param src is the source (message buffer or packet)
+ * @param flits is the number of flits (pairs of message bytes) to copy
+ * 
+ * Message bytes are carried high byte first on each flit, so the copy is the same in both
+ * directions: a plain copy on big endian cores, and a swap of the bytes of each flit on
+ * little endian cores. When both buffers are word aligned, two flits are copied at a time.
+ */
+static void ni_copy(void *dst, const void *src, int32_t flits)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+#ifdef LITTLE_ENDIAN
+	uint32_t w;
+#endif
+
+	if ((((size_t)d | (size_t)s) & 3) == 0){
+		for (; flits >= 2; flits -= 2, d += 4, s += 4){
+#ifdef LITTLE_ENDIAN
+			w = *(const ni_word *)s;
+			*(ni_word *)d = ((w & 0x00ff00ff) << 8) | ((w >> 8) & 0x00ff00ff);
+#else
+			*(ni_word *)d = *(const ni_word *)s;
+#endif
+		}
+	}
+	for (; flits > 0; flits--, d += 2, s += 2){
+#ifdef LITTLE_ENDIAN
+		d[0] = s[1];
+		d[1] = s[0];
+#else
+		d[0] = s[0];
+		d[1] = s[1];
+#endif
+	}
+}
+
+/* copies len (> 0) bytes of a message to the data of a packet, starting at byte off */
+static void ni_put(uint16_t *data, int32_t off, const int8_t *src, int32_t len)
+{
+	if (off & 1){
+		data[off >> 1] |= (uint8_t)*src++;
+		off++;
+		len--;
+	}
+	ni_copy(data + (off >> 1), src, len >> 1);
+	if (len & 1)
+		data[(off + len) >> 1] = (uint8_t)src[len - 1] << 8;
+}
+
+/* copies len (> 0) bytes of message from the data of a packet, starting at byte off */
+static void ni_get(int8_t *dst, const uint16_t *data, int32_t off, int32_t len)
+{
+	if (off & 1){
+		*dst++ = data[off >> 1] & 0xff;
+		off++;
+		len--;
+	}
+	ni_copy(dst, data + (off >> 1), len >> 1);
+	if (len & 1)
+		dst[len - 1] = data[(off + len) >> 1] >> 8;
+}
+
+/**
+ * @brief Finds the oldest packet on a channel in the reception ring of a task.
+ * 
+ * @param id is the task id (the calling task)
+ * @param channel is the message channel
+ * 
+ * @return the packet position on the ring, or -1 if there are no packets on the channel.
+ */
+static int32_t ni_find(uint16_t id, uint16_t channel)
+{
+	int32_t i, k;
+	uint16_t *buf_ptr;
+
+	k = hf_ring_count(pktdrv_tqueue[id]);
+	for (i = 0; i < k; i++){
+		buf_ptr = hf_ring_at(pktdrv_tqueue[id], i);
+		if (buf_ptr[PKT_CHANNEL] == channel)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Takes the next packet on a channel from the reception ring of a task.
+ * 
+ * @param id is the task id (the calling task)
+ * @param channel is the message channel
+ * 
+ * @return a packet from the ring.
+ * 
+ * Packets are taken out of order, so packets on other channels (such as acknowledgements
+ * on channel 0xffff) do not block the ones behind them. If there are no packets on the
+ * channel, the task is blocked until ni_isr() puts another packet on its ring, so the
+ * processor is free for other tasks while no data is arriving. With NOC_TIMESTAMP, the time
+ * the first packet of a message waited on the ring is accounted as a wait on the pool if the
+ * task was busy, or as its wakeup if the task was blocked.
+ */
+static uint16_t *ni_wait(uint16_t id, uint16_t channel)
+{
+	uint32_t status;
+	int32_t i, blocked = 0;
+	uint16_t *buf_ptr;
+
+	while (1){
+		status = _di();
+		i = ni_find(id, channel);
+		if (i >= 0){
+			buf_ptr = hf_ring_remove(pktdrv_tqueue[id], i);
+#if NOC_TIMESTAMP == 1
+			if (buf_ptr[PKT_SEQ] & PKT_SEQ_TIME)
+				ni_latency(blocked ? &pktdrv_stats.lat_wakeup : &pktdrv_stats.lat_pool, _readcounter() - ni_time(buf_ptr + PKT_ARRIVAL));
+#endif
+			_ei(status);
+			return buf_ptr;
+		}
+		pktdrv_wait[id] = 1;
+		blocked = 1;
+		sched_block(&krnl_tcb[id]);
+		_ei(status);
+		hf_yield();
+	}
+}
+
+/**
+ * @brief Receives a message from a task (blocking receive).
  * 
  * @param source_cpu is a pointer to a variable which will hold the source cpu
  * @param source_port is a pointer to a variable which will hold the source port
@@ -429,70 +1131,1500 @@ again2:	while ((_ni_status() & 0x1) == 0);
  * @param channel is the selected message channel of this message (must be the same as in the sender)
  * 
  * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
- * created and ERR_SEQ_ERROR when received packets arrive out of order, so the message
- * is corrupted.
+ * created, ERR_SEQ_ERROR when received packets arrive out of order, so the message
+ * is corrupted, and ERR_COMM_OVERFLOW if the message is larger than 65535 bytes.
  * 
  * A message is build from packets received on the ni_isr() routine. Packets are decoded and
  * combined in a complete message, returning the message, its size and source identification
  * to the calling task. The buffer where the message will be stored must be large enough or
- * we will have a problem that may not be noticed before its too late. After the reception
- * of the whole message is completed, an acknowledgement is sent to the sender task. This works
- * as a flow control mechanism, avoiding buffer/queue overflows common to the raw protocol. 
- * Message channel 65535 will be used for the flow control mechanism.
+ * we will have a problem that may not be noticed before its too late. The calling task is
+ * blocked while it waits for packets. Messages larger than 65535 bytes are truncated, and
+ * should be received with hf_recvv().
  */
-int32_t hf_recvack(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
+int32_t hf_recv(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
 {
+	struct noc_iov iov;
+	uint32_t total;
+	uint16_t id;
 	int32_t error;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	iov.buf = buf;
+	iov.size = 0xffff;
+	error = ni_recv(id, source_cpu, source_port, &iov, 1, &total, channel);
+	*size = total > 0xffff ? 0xffff : total;
+
+	return error;
+}
+
+/**
+ * @brief Receives a message from a task into several buffers (blocking scatter receive).
+ * 
+ * @param source_cpu is a pointer to a variable which will hold the source cpu
+ * @param source_port is a pointer to a variable which will hold the source port
+ * @param iov is an array of buffers, filled in order with the message
+ * @param iovcnt is the number of buffers
+ * @param size a pointer to a variable which will hold the size (in bytes) of the received message
+ * @param channel is the selected message channel of this message (must be the same as in the sender)
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
+ * created, ERR_SEQ_ERROR when received packets arrive out of order and ERR_COMM_OVERFLOW
+ * if the message does not fit the buffers (the remaining bytes are dropped).
+ * 
+ * Works as hf_recv(), but the message (of any size) is copied straight from the packets to the
+ * buffers, so a header and a payload can be received to different places without a staging
+ * copy. The whole message is always consumed, and size holds its full size.
+ */
+int32_t hf_recvv(uint16_t *source_cpu, uint16_t *source_port, struct noc_iov *iov, uint16_t iovcnt, uint32_t *size, uint16_t channel)
+{
+	uint16_t id;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	return ni_recv(id, source_cpu, source_port, iov, iovcnt, size, channel);
+}
+
+/**
+ * @brief Receives a packet from a task, without copying it (blocking receive).
+ * 
+ * @param channel is the selected message channel
+ * 
+ * @return a pointer to the packet, or NULL when no message queue (comm) was created.
+ * 
+ * The packet is taken from the task reception queue and handed over to the caller as is,
+ * so the message is not copied. Header fields are at the PKT_* offsets (source, message
+ * size and sequence number of the packet in the message) and PKT_BYTES() bytes of the
+ * message (PKT_DATA_BYTES at most) are at PKT_DATA(). Message bytes are carried high byte
+ * first on each flit, so on big endian cores the data is in message order. A message larger
+ * than PKT_DATA_BYTES spans several packets, received by successive calls (a message larger
+ * than 65535 bytes is flagged with PKT_SEQ_LONG, and the upper half of its size takes the
+ * first data flit of the first packet, a message sent on a flow is flagged with PKT_SEQ_FLOW,
+ * and its flow id takes the next one, and a message with a send timestamp is flagged with
+ * PKT_SEQ_TIME, and the timestamp takes the next two). The header of continuation packets is
+ * rebuilt on reception, so all packets of a message have a full header. The packet must be
+ * given back with hf_pktfree() as soon as possible, as the pool of packets is shared by all
+ * tasks (packets held count against the quota of the port, see hf_comm_quota()).
+ */
+uint16_t *hf_recvpkt(uint16_t channel)
+{
+	uint16_t id;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return NULL;
+
+	return ni_wait(id, channel);
+}
+
+/**
+ * @brief Gives a packet received with hf_recvpkt() back to the shared pool of packets.
+ * 
+ * @param pkt is a pointer to the packet
+ */
+void hf_pktfree(uint16_t *pkt)
+{
+	uint32_t status;
+	uint16_t k;
+
+	status = _di();
+	k = port_find(pkt[PKT_TARGET_PORT]);
+	ni_release(k, pkt);
+	_ei(status);
+}
+
+/**
+ * @brief Checks if a packet is waiting on a channel (non blocking).
+ * 
+ * @param channel is the selected message channel
+ * 
+ * @return 1 if a packet is waiting, 0 if there are none, and ERR_COMM_UNFEASIBLE when no
+ * message queue (comm) was created.
+ * 
+ * A waiting packet is the first of a message (or the next one of a message partially
+ * received), so a task may call hf_recv() without blocking for long when this returns 1.
+ */
+int32_t hf_recvprobe(uint16_t channel)
+{
+	uint32_t status;
+	uint16_t id;
+	int32_t i;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	status = _di();
+	i = ni_find(id, channel);
+	_ei(status);
+
+	return i >= 0;
+}
+
+/*
+ * splits the cores of a multicast mask (but this one) in two halves, each sent to its first core
+ * with the half as its own mask, forming a binary tree. returns the number of children.
+ */
+static int32_t ni_mcast_split(uint32_t mask, uint16_t *child, uint32_t *cmask)
+{
+	uint32_t bit, half = 0;
+	int32_t i, n;
+
+	mask &= ~(1U << hf_cpuid());
+	if (mask == 0) return 0;
+	n = __builtin_popcount(mask);
+	for (i = 0; i < (n + 1) / 2; i++){
+		bit = mask & -mask;
+		half |= bit;
+		mask &= ~bit;
+	}
+	child[0] = __builtin_ctz(half);
+	cmask[0] = half;
+	if (mask == 0) return 1;
+	child[1] = __builtin_ctz(mask);
+	cmask[1] = mask;
+
+	return 2;
+}
+
+/* rebuilds a message from the packets on a channel of the reception ring of a task, scattering
+ * it over the buffers of iov and forwarding the packets of multicast messages to the next cores
+ * of the tree */
+static int32_t ni_recv(uint16_t id, uint16_t *source_cpu, uint16_t *source_port, struct noc_iov *iov, int32_t iovcnt, uint32_t *size, uint16_t channel)
+{
+	uint16_t flags, child[2];
+	uint32_t status, total, packet = 0, seq, o = 0, cmask[2];
+	int32_t i, j, k = 0, c, n, off, v = 0, p = 0, error = ERR_OK;
+	uint16_t *buf_ptr;
+
+	buf_ptr = ni_wait(id, channel);
 	
-	error = hf_recv(source_cpu, source_port, buf, size, channel);
-	if (error == ERR_OK){
-		hf_send(*source_cpu, *source_port, "ok", 3, 0xffff);
+	*source_cpu = buf_ptr[PKT_SOURCE_CPU];
+	*source_port = buf_ptr[PKT_SOURCE_PORT];
+	flags = buf_ptr[PKT_SEQ] & (PKT_SEQ_MCAST | PKT_SEQ_LONG | PKT_SEQ_FLOW | PKT_SEQ_TIME);
+	seq = buf_ptr[PKT_SEQ] & PKT_SEQ_MASK;
+	total = buf_ptr[PKT_MSG_SIZE];
+	i = PKT_HEADER_SIZE;
+	if (flags & PKT_SEQ_MCAST) i += 2;
+	if (flags & PKT_SEQ_LONG) total |= (uint32_t)buf_ptr[i++] << 16;
+	if (flags & PKT_SEQ_FLOW) i++;
+	if (flags & PKT_SEQ_TIME) i += 2;
+	*size = total - (i - PKT_HEADER_SIZE) * 2;
+
+	while (1){
+		packet++;
+		if ((buf_ptr[PKT_SEQ] & PKT_SEQ_MASK) != (seq++ & PKT_SEQ_MASK))
+			error = ERR_SEQ_ERROR;
+
+		i = PKT_HEADER_SIZE;
+		if (packet == 1){
+			if (flags & PKT_SEQ_MCAST){
+				k = ni_mcast_split(((uint32_t)buf_ptr[i] << 16) | buf_ptr[i + 1], child, cmask);
+				i += 2;
+			}
+			if (flags & PKT_SEQ_LONG) i++;
+			if (flags & PKT_SEQ_FLOW) i++;
+			if (flags & PKT_SEQ_TIME) i += 2;
+		}
+		n = *size - p;
+		if (n > (buf_ptr[PKT_PAYLOAD] + 2 - i) * 2)
+			n = (buf_ptr[PKT_PAYLOAD] + 2 - i) * 2;
+		p += n;
+		for (off = 0; n > 0; off += c, n -= c){
+			while (v < iovcnt && o == iov[v].size){
+				v++;
+				o = 0;
+			}
+			if (v == iovcnt){
+				if (error == ERR_OK) error = ERR_COMM_OVERFLOW;
+				break;
+			}
+			c = iov[v].size - o < n ? iov[v].size - o : n;
+			ni_get(iov[v].buf + o, buf_ptr + i, off, c);
+			o += c;
+		}
+
+		for (j = 0; j < k; j++){
+			buf_ptr[PKT_TARGET_CPU] = NOC_HEADER(child[j]) | (buf_ptr[PKT_TARGET_CPU] & PKT_PRIO);
+			if (packet == 1){
+				buf_ptr[PKT_HEADER_SIZE] = cmask[j] >> 16;
+				buf_ptr[PKT_HEADER_SIZE + 1] = cmask[j] & 0xffff;
+			}
+			ni_inject(buf_ptr, 0, 0, 0);
+		}
+
+		status = _di();
+		ni_release(id, buf_ptr);
+		_ei(status);
+
+		if (p >= *size) break;
+		buf_ptr = ni_wait(id, channel);
 	}
 	
 	return error;
 }
 
+#if NOC_TIMESTAMP == 1
+/* stamps the first packet of a message (timestamp flits at ts) and accounts the time it waited
+ * on the sender since start. interrupts disabled */
+static void ni_stamp(uint16_t *out_buf, int32_t ts, uint32_t start)
+{
+	uint32_t now;
+
+	now = _readcounter();
+	out_buf[ts] = now >> 16;
+	out_buf[ts + 1] = now & 0xffff;
+	ni_latency(&pktdrv_stats.lat_queue, now - start);
+}
+#endif
+
 /**
- * @brief Sends a message to a task (blocking send) with acknowledgement.
+ * @brief Injects a packet in the network.
+ * 
+ * @param out_buf is the packet (PKT_PAYLOAD + 2 flits, NOC_PACKET_SIZE at most)
+ * @param yield is 1 if the calling task should yield the processor while the network
+ * interface is busy, or 0 to busy wait
+ * @param ts is the offset of the timestamp flits of the packet, 0 if it has none
+ * @param start is the time the message was sent (or queued), for its sender queueing latency
+ * 
+ * With NOC_DMA the interface copies the packet from memory by itself, taking its length from
+ * the payload field. The calling task is
+ * blocked until the copy is done (so other tasks run meanwhile) when it would yield, or polls
+ * for the end of the copy otherwise. A packet with a timestamp is stamped once the interface
+ * is free, just before it is injected.
+ */
+static void ni_inject(uint16_t *out_buf, int32_t yield, int32_t ts, uint32_t start)
+{
+	uint32_t status;
+#if NOC_DMA == 1
+	uint16_t id;
+
+	while (1){
+		while ((_ni_status() & 0x1) == 0 || (_ni_dma_status() & NOC_DMA_TX))
+			if (yield) hf_yield();
+		status = _di();
+		if ((_ni_status() & 0x1) && (_ni_dma_status() & NOC_DMA_TX) == 0) break;
+		_ei(status);
+	}
+#if NOC_TIMESTAMP == 1
+	if (ts)
+		ni_stamp(out_buf, ts, start);
+#endif
+	_ni_dma_send(out_buf);
+	pktdrv_stats.tx_packets++;
+	if (out_buf[PKT_TARGET_CPU] & PKT_PRIO)
+		pktdrv_stats.tx_rt++;
+#if KERNEL_LOG == 3
+	trace_event(TRACE_NOC_TX, out_buf[PKT_TARGET_CPU]);
+#endif
+	/* the buffer belongs to the interface until the transfer is complete */
+	id = hf_selfid();
+	while (_ni_dma_status() & NOC_DMA_TX){
+		if (!yield) continue;
+		dma_tx_wait = id + 1;
+		sched_block(&krnl_tcb[id]);
+		_ei(status);
+		hf_yield();
+		status = _di();
+	}
+	_ei(status);
+#else
+	int32_t i, flits;
+
+	while (1){
+		while ((_ni_status() & 0x1) == 0)
+			if (yield) hf_yield();
+		status = _di();
+		if (_ni_status() & 0x1) break;
+		_ei(status);
+	}
+#if NOC_TIMESTAMP == 1
+	if (ts)
+		ni_stamp(out_buf, ts, start);
+#endif
+	flits = out_buf[PKT_PAYLOAD] + 2;
+	for (i = 0; i < flits; i++)
+		_ni_write(out_buf[i]);
+	pktdrv_stats.tx_packets++;
+	if (out_buf[PKT_TARGET_CPU] & PKT_PRIO)
+		pktdrv_stats.tx_rt++;
+#if KERNEL_LOG == 3
+	trace_event(TRACE_NOC_TX, out_buf[PKT_TARGET_CPU]);
+#endif
+	_ei(status);
+#endif
+}
+
+/**
+ * @brief Breaks a message into packets and injects them in the network.
+ * 
+ * @param source_port is the sender task port
+ * @param target_cpu is the target processor
+ * @param target_port is the target task port
+ * @param iov is an array of buffers that hold the message, gathered in order
+ * @param iovcnt is the number of buffers
+ * @param channel is the message channel
+ * @param mcast is a pointer to the multicast mask (cores the target forwards the message to,
+ * carried on the first two data flits), or NULL for a unicast message
+ * @param yield is 1 if the calling task should yield the processor while the network
+ * interface is busy, or 0 to busy wait
+ * @param queued is the time the message was queued (hf_send_async()), 0 if it is sent at once
+ * 
+ * The message size is 16 bit wide on the packet header. On messages larger than that (flagged
+ * with PKT_SEQ_LONG) the upper half of the size goes on the next data flit of the first packet.
+ * Unicast messages of several packets are sent on a flow (flagged with PKT_SEQ_FLOW, the flow
+ * id on the next data flit of the first packet) with compact continuation packets.
+ * Packets are full but the last one, which ends on the last data flit (no padding), and are
+ * flagged with the traffic class of the source port (hf_comm_class()). With NOC_TIMESTAMP, the
+ * first packet carries its injection time (PKT_SEQ_TIME), on two data flits after the others.
+ */
+static void ni_packets(uint16_t source_port, uint16_t target_cpu, uint16_t target_port, struct noc_iov *iov, int32_t iovcnt, uint16_t channel, uint32_t *mcast, int32_t yield, uint32_t queued)
+{
+	uint16_t flags = 0, flow = 0, id, prio = 0, stamp = 0;
+	uint32_t status, size = 0, total, packet = 0, o = 0;
+	int32_t i, c, n, off, v = 0, p = 0, ts = 0;
+	uint16_t out_buf[NOC_PACKET_SIZE];
+
+	status = _di();
+	id = port_find(source_port);
+#if NOC_CLASSES == 1
+	if (id && port_class[id] == NOC_CLASS_RT)
+		prio = PKT_PRIO;
+#endif
+	_ei(status);
+
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].size;
+	total = size;
+	if (mcast){
+		flags |= PKT_SEQ_MCAST;
+		total += 4;
+	}
+#if NOC_TIMESTAMP == 1
+	if (channel != NOC_CREDIT_CHANNEL){
+		stamp = PKT_SEQ_TIME;
+		total += 4;
+		if (!queued)
+			queued = _readcounter();
+	}
+#endif
+	if (total > 0xffff){
+		flags |= PKT_SEQ_LONG;
+		total += 2;
+	}
+#if NOC_COMPACT == 1
+	if (!mcast && total > PKT_DATA_BYTES){
+		flags |= PKT_SEQ_FLOW;
+		total += 2;
+		status = _di();
+		flow = PKT_FLOW_ID(hf_cpuid(), flow_next++);
+		_ei(status);
+	}
+#endif
+
+	do {
+		packet++;
+		out_buf[PKT_TARGET_CPU] = NOC_HEADER(target_cpu) | prio;
+		if (packet > 1 && flow){
+			out_buf[PKT_CONT_FLOW] = flow;
+			out_buf[PKT_CONT_SEQ] = packet & PKT_SEQ_MASK;
+			i = PKT_CONT_SIZE;
+		}else{
+			out_buf[PKT_SOURCE_CPU] = hf_cpuid();
+			out_buf[PKT_SOURCE_PORT] = source_port;
+			out_buf[PKT_TARGET_PORT] = target_port;
+			out_buf[PKT_MSG_SIZE] = total & 0xffff;
+			out_buf[PKT_SEQ] = (packet & PKT_SEQ_MASK) | flags | (packet == 1 ? stamp : 0);
+			out_buf[PKT_CHANNEL] = channel;
+			i = PKT_HEADER_SIZE;
+		}
+		if (packet == 1){
+			if (mcast){
+				out_buf[i++] = *mcast >> 16;
+				out_buf[i++] = *mcast & 0xffff;
+			}
+			if (flags & PKT_SEQ_LONG)
+				out_buf[i++] = total >> 16;
+			if (flow)
+				out_buf[i++] = flow;
+			if (stamp){
+				ts = i;
+				i += 2;
+			}
+		}
+		n = size - p;
+		if (n > (NOC_PACKET_SIZE - i) * 2)
+			n = (NOC_PACKET_SIZE - i) * 2;
+		p += n;
+		for (off = 0; n > 0; off += c, n -= c){
+			while (o == iov[v].size){
+				v++;
+				o = 0;
+			}
+			c = iov[v].size - o < n ? iov[v].size - o : n;
+			ni_put(out_buf + i, off, iov[v].buf + o, c);
+			o += c;
+		}
+		out_buf[PKT_PAYLOAD] = i + ((off + 1) >> 1) - 2;
+
+		ni_inject(out_buf, yield, packet == 1 ? ts : 0, queued);
+	} while (p < size);
+
+	status = _di();
+	if (id && pktdrv_ports[id] == source_port)
+		pktdrv_pstats[id].tx_packets += packet;
+	_ei(status);
+}
+
+/**
+ * @brief Number of packets of a unicast message.
+ * 
+ * @param size is the size (in bytes) of the message
+ * 
+ * @return the number of packets the message is broken into, one at least.
+ * 
+ * A message of several packets is sent with compact continuation packets (NOC_COMPACT), which
+ * carry PKT_CONT_BYTES bytes of the message each. The timestamp (NOC_TIMESTAMP) takes 4 bytes
+ * of the first packet.
+ */
+uint32_t hf_noc_packets(uint32_t size)
+{
+	uint32_t total;
+
+#if NOC_TIMESTAMP == 1
+	size += 4;
+#endif
+	total = size > 0xffff ? size + 2 : size;
+	if (total <= PKT_DATA_BYTES)
+		return 1;
+#if NOC_COMPACT == 1
+	return 1 + (total + 2 - PKT_DATA_BYTES + PKT_CONT_BYTES - 1) / PKT_CONT_BYTES;
+#else
+	return (total + PKT_DATA_BYTES - 1) / PKT_DATA_BYTES;
+#endif
+}
+
+/**
+ * @brief Sends a message to a task (blocking send).
  * 
  * @param target_cpu is the target processor
  * @param target_port is the target task port
  * @param buf is a pointer to a buffer that holds the message
  * @param size is the size (in bytes) of the message
  * @param channel is the selected message channel of this message (must be the same as in the receiver)
- * @param timeout is the time (in ms) that the sender will wait for a reception acknowledgement
  * 
  * @return ERR_OK
  * 
  * A message is broken into packets containing a header and part of the message as the payload.
- * The packets are injected, one by one, in the network through the network interface. After that, the
- * sender will wait for an acknowledgement from the receiver. This works as a flow control mechanism,
- * avoiding buffer/queue overflows common to the raw protocol. Message channel 65535 will be used for
- * the flow control mechanism.
+ * The packets are injected, one by one, in the network through the network interface.
  */
-int32_t hf_sendack(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout)
+int32_t hf_send(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint32_t size, uint16_t channel)
 {
-	uint16_t id, source_cpu, source_port;
-	int32_t error, k;
-	uint32_t time;
-	int8_t ack[4];
-	uint16_t *buf_ptr;
+	struct noc_iov iov;
+	uint16_t id;
 	
-	error = hf_send(target_cpu, target_port, buf, size, channel);
-	if (error == ERR_OK){
-		id = hf_selfid();
-		time = _read_us() / 1000;
-		while (1){
-			k = hf_queue_count(pktdrv_tqueue[id]);
-			if (k){
-				buf_ptr = hf_queue_get(pktdrv_tqueue[id], 0);
-				if (buf_ptr)
-					if (buf_ptr[PKT_CHANNEL] == 0xffff && buf_ptr[PKT_MSG_SIZE] == 3) break;
-			}
-			if (((_read_us() / 1000) - time) > timeout) return ERR_COMM_TIMEOUT;
-		}
-		hf_recv(&source_cpu, &source_port, ack, &size, 0xffff);
-	}
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	iov.buf = buf;
+	iov.size = size;
+	ni_packets(pktdrv_ports[id], target_cpu, target_port, &iov, 1, channel, NULL, 0, 0);
 	
-	return error;
+	return ERR_OK;
+}
+
+/**
+ * @brief Sends a message gathered from several buffers to a task (blocking gather send).
+ * 
+ * @param target_cpu is the target processor
+ * @param target_port is the target task port
+ * @param iov is an array of buffers that hold the message, sent in order
+ * @param iovcnt is the number of buffers
+ * @param channel is the selected message channel of this message (must be the same as in the receiver)
+ * 
+ * @return ERR_OK when successful and ERR_COMM_UNFEASIBLE when no message queue (comm) was created.
+ * 
+ * The buffers are sent as a single message (their total size, of any length), copied straight
+ * to the packets, so a header and a payload held apart need no staging copy. The receiver gets
+ * a normal message, with hf_recv() or hf_recvv().
+ */
+int32_t hf_sendv(uint16_t target_cpu, uint16_t target_port, struct noc_iov *iov, uint16_t iovcnt, uint16_t channel)
+{
+	uint16_t id;
+	
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	ni_packets(pktdrv_ports[id], target_cpu, target_port, iov, iovcnt, channel, NULL, 0, 0);
+	
+	return ERR_OK;
+}
+
+/**
+ * @brief Sends a message to the same port on several cores (multicast / broadcast).
+ * 
+ * @param core_mask is the set of target cores, one bit per core (bit n is core n)
+ * @param target_port is the target task port (the same on all cores)
+ * @param buf is a pointer to a buffer that holds the message
+ * @param size is the size (in bytes) of the message
+ * @param channel is the selected message channel of this message (must be the same as in the receivers)
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created and
+ * ERR_INVALID_CPU if there are no cores other than this one on the mask.
+ * 
+ * The mesh routers have no multicast support, so the message is spread on a binary tree of
+ * cores: the sender splits the cores on the mask in two halves and sends the message once to
+ * the first core of each half, along with the half mask. Each receiving core forwards the
+ * packets to its own subtree inside hf_recv() (or hf_recvcr()), as the packets arrive, so the
+ * sender injects the message only twice and all cores have it after about log2(cores) hops.
+ * Receivers get a normal message (the mask is stripped) from the original sender. The calling
+ * core is never a target and meshes of up to 32 cores are supported. Multicast messages should
+ * not be received with hf_recvpkt(), as packets are not forwarded there.
+ */
+int32_t hf_multicast(uint32_t core_mask, uint16_t target_port, int8_t *buf, uint32_t size, uint16_t channel)
+{
+	struct noc_iov iov;
+	uint16_t id, child[2];
+	uint32_t cmask[2];
+	int32_t i, k;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	if (hf_ncores() < 32)
+		core_mask &= (1U << hf_ncores()) - 1;
+	k = ni_mcast_split(core_mask, child, cmask);
+	if (k == 0) return ERR_INVALID_CPU;
+	iov.buf = buf;
+	iov.size = size;
+	for (i = 0; i < k; i++)
+		ni_packets(pktdrv_ports[id], child[i], target_port, &iov, 1, channel, &cmask[i], 0, 0);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief NoC driver: transmission task.
+ * 
+ * Drains the transmission queue filled by hf_send_async(), injecting messages in the order
+ * they were queued (real time messages ahead of bulk ones). While the network interface is
+ * busy, the processor is given away.
+ * Once a message is sent, its completion semaphore (if any) is signaled.
+ */
+static void ni_tx(void)
+{
+	uint32_t status;
+	struct noc_tx *tx;
+	struct noc_rma_req req;
+	struct noc_iov iov, rma_iov[2];
+	int8_t tag[2], times[8];
+	int32_t i;
+
+	while (1){
+		hf_semwait(&pktdrv_txsem);
+		status = _di();
+		if (rma_tail != rma_head){
+			req = rma_req[rma_tail % NOC_RMA_PENDING];
+			rma_tail++;
+			_ei(status);
+			tag[0] = req.tag >> 8;
+			tag[1] = req.tag & 0xff;
+			rma_iov[0].buf = tag;
+			rma_iov[0].size = 2;
+			rma_iov[1].buf = req.buf;
+			rma_iov[1].size = req.size;
+			if (req.sync){
+				/* clock calibration: the request injection and arrival times */
+				for (i = 0; i < 4; i++){
+					times[i] = req.t0 >> (24 - i * 8);
+					times[i + 4] = req.t1 >> (24 - i * 8);
+				}
+				rma_iov[1].buf = times;
+				rma_iov[1].size = 8;
+			}
+			ni_packets(NOC_RMA_PORT, req.cpu, req.port, rma_iov, rma_iov[1].buf ? 2 : 1, NOC_RMA_CHANNEL, NULL, 1, 0);
+			continue;
+		}
+		tx = hf_queue_remhead(pktdrv_txqueue);
+		_ei(status);
+		if (tx == NULL) continue;
+
+		iov.buf = tx->buf;
+		iov.size = tx->size;
+		ni_packets(tx->source_port, tx->target_cpu, tx->target_port, &iov, 1, tx->channel, NULL, 1, tx->time);
+		if (tx->done)
+			hf_sempost(tx->done);
+		hf_free(tx);
+	}
+}
+
+/**
+ * @brief Sends a message to a task (asynchronous send).
+ * 
+ * @param target_cpu is the target processor
+ * @param target_port is the target task port
+ * @param buf is a pointer to a buffer that holds the message
+ * @param size is the size (in bytes) of the message
+ * @param channel is the selected message channel of this message (must be the same as in the receiver)
+ * @param done is a pointer to a semaphore signaled once the message is sent, or NULL
+ * 
+ * @return ERR_OK when the message is queued, ERR_COMM_UNFEASIBLE when no message queue (comm) was
+ * created, ERR_COMM_BUSY if the transmission queue is full and ERR_OUT_OF_MEMORY if the system
+ * runs out of memory.
+ * 
+ * The message is put on the transmission queue and the call returns at once, so the caller may
+ * go on computing while the message is injected in the network by the driver transmission task
+ * (ni_tx()). The message buffer is not copied, so it must not be modified or
+ * released before the message is sent (the done semaphore is signaled). Messages are sent in
+ * the order they were queued, but messages of the real time class (hf_comm_class()) are put
+ * ahead of the queued bulk ones, so a control message waits for the bulk message being sent at
+ * most.
+ */
+int32_t hf_send_async(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint32_t size, uint16_t channel, sem_t *done)
+{
+	uint16_t id;
+	uint32_t status;
+	int32_t i;
+	struct noc_tx *tx, *prev;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	tx = hf_malloc(sizeof(struct noc_tx));
+	if (tx == NULL) return ERR_OUT_OF_MEMORY;
+	tx->source_port = pktdrv_ports[id];
+	tx->target_cpu = target_cpu;
+	tx->target_port = target_port;
+	tx->size = size;
+	tx->channel = channel;
+	tx->cls = port_class[id];
+#if NOC_TIMESTAMP == 1
+	tx->time = _readcounter();
+	if (tx->time == 0)		/* 0 stands for a message sent at once */
+		tx->time = 1;
+#else
+	tx->time = 0;
+#endif
+	tx->buf = buf;
+	tx->done = done;
+
+	status = _di();
+	if (hf_queue_addtail(pktdrv_txqueue, tx)){
+		_ei(status);
+		hf_free(tx);
+		return ERR_COMM_BUSY;
+	}
+	for (i = hf_queue_count(pktdrv_txqueue) - 1; i > 0; i--){
+		prev = hf_queue_get(pktdrv_txqueue, i - 1);
+		if (prev->cls >= tx->cls)
+			break;
+		hf_queue_swap(pktdrv_txqueue, i - 1, i);
+	}
+	_ei(status);
+	hf_sempost(&pktdrv_txsem);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Receives a message from a task (blocking receive) with acknowledgement.
+ * 
+ * @param source_cpu is a pointer to a variable which will hold the source cpu
+ * @param source_port is a pointer to a variable which will hold the source port
+ * @param buf is a pointer to a buffer to hold the received message
+ * @param size a pointer to a variable which will hold the size (in bytes) of the received message
+ * @param channel is the selected message channel of this message (must be the same as in the sender)
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
+ * created and ERR_SEQ_ERROR when received packets arrive out of order, so the message
+ * is corrupted.
+ * 
+ * A message is build from packets received on the ni_isr() routine. Packets are decoded and
+ * combined in a complete message, returning the message, its size and source identification
+ * to the calling task. The buffer where the message will be stored must be large enough or
+ * we will have a problem that may not be noticed before its too late. After the reception
+ * of the whole message is completed, an acknowledgement is sent to the sender task. This works
+ * as a flow control mechanism, avoiding buffer/queue overflows common to the raw protocol. 
+ * Message channel 65535 will be used for the flow control mechanism.
+ */
+int32_t hf_recvack(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
+{
+	int32_t error;
+	
+	error = hf_recv(source_cpu, source_port, buf, size, channel);
+	if (error == ERR_OK){
+		hf_send(*source_cpu, *source_port, "ok", 3, 0xffff);
+	}
+	
+	return error;
+}
+
+/**
+ * @brief Sends a message to a task (blocking send) with acknowledgement.
+ * 
+ * @param target_cpu is the target processor
+ * @param target_port is the target task port
+ * @param buf is a pointer to a buffer that holds the message
+ * @param size is the size (in bytes) of the message
+ * @param channel is the selected message channel of this message (must be the same as in the receiver)
+ * @param timeout is the time (in ms) that the sender will wait for a reception acknowledgement
+ * 
+ * @return ERR_OK
+ * 
+ * A message is broken into packets containing a header and part of the message as the payload.
+ * The packets are injected, one by one, in the network through the network interface. After that, the
+ * sender will wait for an acknowledgement from the receiver. This works as a flow control mechanism,
+ * avoiding buffer/queue overflows common to the raw protocol. Message channel 65535 will be used for
+ * the flow control mechanism.
+ */
+int32_t hf_sendack(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout)
+{
+	uint16_t id, source_cpu, source_port;
+	int32_t error;
+	uint64_t time;
+	int8_t ack[4];
+	
+	error = hf_send(target_cpu, target_port, buf, size, channel);
+	if (error == ERR_OK){
+		id = hf_selfid();
+		time = _read_us();
+		while (ni_find(id, 0xffff) < 0)
+			if (_read_us() - time > (uint64_t)timeout * 1000) return ERR_COMM_TIMEOUT;
+		hf_recv(&source_cpu, &source_port, ack, &size, 0xffff);
+	}
+	
+	return error;
+}
+
+/*
+ * credit based flow control. a sender asks a receiver port for credits (a request packet on
+ * NOC_CREDIT_CHANNEL) and the receiver grants part of its reception ring. each packet sent costs
+ * one credit, and the receiver gives credits back (in batches) as it consumes packets, so the
+ * ring never overflows while several messages are in flight. control packets carry the control
+ * type and a credit count on the first two payload flits.
+ */
+#define CREDIT_REQUEST	0
+#define CREDIT_GRANT	1
+#define CREDIT_RETURN	2
+
+/* credit state of a task for a peer, allocated on first use (NULL if memory or peers run out) */
+static struct noc_peer *ni_peer(uint16_t id, uint16_t cpu, uint16_t port, int32_t alloc)
+{
+	struct noc_credit *cr;
+	int32_t i;
+
+	cr = pktdrv_credit[id];
+	if (cr == NULL){
+		if (!alloc) return NULL;
+		cr = hf_malloc(sizeof(struct noc_credit));
+		if (cr == NULL) return NULL;
+		for (i = 0; i < NOC_CREDIT_PEERS; i++)
+			cr->peer[i].port = 0;
+		cr->avail = pktdrv_tqueue[id]->size;
+		pktdrv_credit[id] = cr;
+	}
+	for (i = 0; i < NOC_CREDIT_PEERS; i++)
+		if (cr->peer[i].port == port && cr->peer[i].cpu == cpu)
+			return &cr->peer[i];
+	if (!alloc) return NULL;
+	for (i = 0; i < NOC_CREDIT_PEERS; i++){
+		if (cr->peer[i].port == 0){
+			cr->peer[i].cpu = cpu;
+			cr->peer[i].port = port;
+			cr->peer[i].credits = -1;
+			cr->peer[i].window = 0;
+			cr->peer[i].grant = 0;
+			cr->peer[i].consumed = 0;
+			return &cr->peer[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void ni_credit_send(uint16_t id, uint16_t cpu, uint16_t port, uint8_t type, uint16_t count)
+{
+	struct noc_iov iov;
+	int8_t msg[4];
+
+	msg[0] = 0;
+	msg[1] = type;
+	msg[2] = count >> 8;
+	msg[3] = count & 0xff;
+	iov.buf = msg;
+	iov.size = sizeof(msg);
+	ni_packets(pktdrv_ports[id], cpu, port, &iov, 1, NOC_CREDIT_CHANNEL, NULL, 0, 0);
+}
+
+/* takes all control packets from the reception ring of a task, updating its credit state */
+static void ni_credit_poll(uint16_t id)
+{
+	uint32_t status;
+	uint16_t cpu, port, type, count, share, *buf_ptr;
+	struct noc_peer *peer;
+	int32_t i;
+
+	while (1){
+		status = _di();
+		i = ni_find(id, NOC_CREDIT_CHANNEL);
+		if (i < 0){
+			_ei(status);
+			break;
+		}
+		buf_ptr = hf_ring_remove(pktdrv_tqueue[id], i);
+		cpu = buf_ptr[PKT_SOURCE_CPU];
+		port = buf_ptr[PKT_SOURCE_PORT];
+		type = buf_ptr[PKT_HEADER_SIZE];
+		count = buf_ptr[PKT_HEADER_SIZE + 1];
+		ni_release(id, buf_ptr);
+		_ei(status);
+
+		switch (type){
+		case CREDIT_REQUEST:
+			peer = ni_peer(id, cpu, port, 1);
+			if (peer && !peer->grant){
+				share = pktdrv_tqueue[id]->size / 4;
+				if (share == 0) share = 1;
+				peer->grant = share < pktdrv_credit[id]->avail ? share : pktdrv_credit[id]->avail;
+				pktdrv_credit[id]->avail -= peer->grant;
+			}
+			ni_credit_send(id, cpu, port, CREDIT_GRANT, peer ? peer->grant : 0);
+			break;
+		case CREDIT_GRANT:
+			peer = ni_peer(id, cpu, port, 0);
+			if (peer && peer->credits < 0){
+				peer->credits = count;
+				peer->window = count;
+			}
+			break;
+		case CREDIT_RETURN:
+			peer = ni_peer(id, cpu, port, 0);
+			if (peer && peer->credits >= 0)
+				peer->credits += count;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Receives a message from a task (blocking receive) with credit based flow control.
+ * 
+ * @param source_cpu is a pointer to a variable which will hold the source cpu
+ * @param source_port is a pointer to a variable which will hold the source port
+ * @param buf is a pointer to a buffer to hold the received message
+ * @param size a pointer to a variable which will hold the size (in bytes) of the received message
+ * @param channel is the selected message channel of this message (must be the same as in the sender)
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
+ * created and ERR_SEQ_ERROR when received packets arrive out of order, so the message
+ * is corrupted.
+ * 
+ * Works as hf_recv(), and also serves the credit requests of senders (hf_sendcr()) while the
+ * task waits. Each sender is granted a quarter of the reception queue (while there is room
+ * left), and the packets consumed from a sender are given back to it as credits once half of
+ * its window is used, in a single control packet.
+ */
+int32_t hf_recvcr(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
+{
+	uint16_t id;
+	uint32_t status;
+	uint32_t total;
+	int32_t error;
+	struct noc_iov iov;
+	struct noc_peer *peer;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	while (1){
+		ni_credit_poll(id);
+		status = _di();
+		if (ni_find(id, channel) >= 0){
+			_ei(status);
+			break;
+		}
+		if (ni_find(id, NOC_CREDIT_CHANNEL) < 0){
+			pktdrv_wait[id] = 1;
+			sched_block(&krnl_tcb[id]);
+			_ei(status);
+			hf_yield();
+		}else{
+			_ei(status);
+		}
+	}
+
+	iov.buf = buf;
+	iov.size = 0xffff;
+	error = ni_recv(id, source_cpu, source_port, &iov, 1, &total, channel);
+	*size = total > 0xffff ? 0xffff : total;
+
+	peer = ni_peer(id, *source_cpu, *source_port, 0);
+	if (peer && peer->grant){
+		peer->consumed += hf_noc_packets(total);
+		if (peer->consumed >= (peer->grant + 1) / 2){
+			ni_credit_send(id, *source_cpu, *source_port, CREDIT_RETURN, peer->consumed);
+			peer->consumed = 0;
+		}
+	}
+
+	return error;
+}
+
+/**
+ * @brief Sends a message to a task (blocking send) with credit based flow control.
+ * 
+ * @param target_cpu is the target processor
+ * @param target_port is the target task port
+ * @param buf is a pointer to a buffer that holds the message
+ * @param size is the size (in bytes) of the message
+ * @param channel is the selected message channel of this message (must be the same as in the receiver)
+ * @param timeout is the time (in ms) that the sender will wait for credits
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created or
+ * the message is larger than the window granted by the receiver, ERR_COMM_BUSY if the credit state
+ * can't be allocated and ERR_COMM_TIMEOUT if the receiver does not grant enough credits in time.
+ * 
+ * The receiver must use hf_recvcr(). On the first message to a target, credits are requested
+ * to the receiver (the request is repeated on the next call if it times out). A message costs
+ * one credit per packet and is only sent when there are enough credits, so, unlike hf_sendack(),
+ * several messages may be in flight without waiting for acknowledgements and without overflowing
+ * the receiver queue. While waiting for credits the processor is given away.
+ */
+int32_t hf_sendcr(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout)
+{
+	uint16_t id, packets;
+	uint64_t time;
+	struct noc_iov iov;
+	struct noc_peer *peer;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	packets = hf_noc_packets(size);
+
+	peer = ni_peer(id, target_cpu, target_port, 1);
+	if (peer == NULL) return ERR_COMM_BUSY;
+	if (peer->credits < 0)
+		ni_credit_send(id, target_cpu, target_port, CREDIT_REQUEST, 0);
+
+	time = _read_us();
+	while (1){
+		ni_credit_poll(id);
+		if (peer->credits >= 0 && packets > peer->window) return ERR_COMM_UNFEASIBLE;
+		if (peer->credits >= packets) break;
+		if (_read_us() - time > (uint64_t)timeout * 1000) return ERR_COMM_TIMEOUT;
+		hf_yield();
+	}
+	peer->credits -= packets;
+	iov.buf = buf;
+	iov.size = size;
+	ni_packets(pktdrv_ports[id], target_cpu, target_port, &iov, 1, channel, NULL, 0, 0);
+
+	return ERR_OK;
+}
+
+/*
+ * one-sided remote memory access. a core registers memory windows, and other cores read and
+ * write them with request packets to NOC_RMA_PORT, serviced by the driver: writes are copied
+ * to the window by the interrupt handler, and reads are replied by the transmission task
+ * straight from the window, so no task of the target core is involved. requests are single
+ * packets, and carry the window, a tag, the offset and the size (RMA_HDR_SIZE bytes) before
+ * the data of writes. replies carry the tag before the data (none if the read is denied).
+ * clock calibration requests (hf_noc_sync()) go the same way, and are replied with the times
+ * the request was injected and arrived.
+ */
+#define RMA_GET		0
+#define RMA_PUT		1
+#define RMA_TIME	2
+#define RMA_HDR_SIZE	12
+
+/* services a remote memory request (called by the interrupt handlers) */
+static void ni_rma(uint16_t *pkt)
+{
+	struct noc_rma_win *w = NULL;
+	struct noc_rma_req *req;
+	uint16_t *data = pkt + PKT_HEADER_SIZE, win, tag;
+	uint32_t off, size, bytes;
+	int32_t ts;
+
+	bytes = pkt[PKT_MSG_SIZE];
+	ts = ni_stamp_at(pkt);
+	if ((pkt[PKT_SEQ] & ~PKT_SEQ_TIME) != 1 || bytes < RMA_HDR_SIZE + (ts ? 4 : 0) || bytes > PKT_BYTES(pkt)){
+		pktdrv_stats.rma_denied++;
+		return;
+	}
+	if (ts){
+		data += 2;
+		bytes -= 4;
+	}
+	win = data[0];
+	tag = data[1];
+	off = ((uint32_t)data[2] << 16) | data[3];
+	size = pkt[PKT_CHANNEL] == RMA_PUT ? bytes - RMA_HDR_SIZE : ((uint32_t)data[4] << 16) | data[5];
+	if (win < NOC_RMA_WINDOWS && rma_win[win].base && off <= rma_win[win].size && size <= rma_win[win].size - off)
+		w = &rma_win[win];
+
+	switch (pkt[PKT_CHANNEL]){
+	case RMA_PUT:
+		if (w && (w->flags & RMA_WRITE)){
+			if (size)
+				ni_get(w->base + off, data, RMA_HDR_SIZE, size);
+			pktdrv_stats.rma_served++;
+		}else{
+			pktdrv_stats.rma_denied++;
+		}
+		break;
+	case RMA_GET:
+		if ((uint16_t)(rma_head - rma_tail) >= NOC_RMA_PENDING){
+			pktdrv_stats.rma_denied++;
+			break;
+		}
+		req = &rma_req[rma_head % NOC_RMA_PENDING];
+		req->cpu = pkt[PKT_SOURCE_CPU];
+		req->port = pkt[PKT_SOURCE_PORT];
+		req->tag = tag;
+		req->sync = 0;
+		if (w && (w->flags & RMA_READ)){
+			req->buf = w->base + off;
+			req->size = size;
+			pktdrv_stats.rma_served++;
+		}else{
+			req->buf = NULL;
+			req->size = 0;
+			pktdrv_stats.rma_denied++;
+		}
+		rma_head++;
+		hf_sempost_isr(&pktdrv_txsem);
+		break;
+#if NOC_TIMESTAMP == 1
+	case RMA_TIME:
+		if (!ts || (uint16_t)(rma_head - rma_tail) >= NOC_RMA_PENDING){
+			pktdrv_stats.rma_denied++;
+			break;
+		}
+		req = &rma_req[rma_head % NOC_RMA_PENDING];
+		req->cpu = pkt[PKT_SOURCE_CPU];
+		req->port = pkt[PKT_SOURCE_PORT];
+		req->tag = tag;
+		req->buf = NULL;
+		req->size = 0;
+		req->sync = 1;
+		req->t0 = ni_time(pkt + ts);
+		req->t1 = rx_time;
+		rma_head++;
+		hf_sempost_isr(&pktdrv_txsem);
+		break;
+#endif
+	default:
+		pktdrv_stats.rma_denied++;
+	}
+}
+
+/**
+ * @brief Registers (or removes) a remote memory window of this core.
+ * 
+ * @param win is the window number (0 to NOC_RMA_WINDOWS - 1)
+ * @param base is the window memory, or NULL to remove the window
+ * @param size is the window size, in bytes
+ * @param flags is RMA_READ, RMA_WRITE or both (access allowed to other cores)
+ * 
+ * @return ERR_OK when successful and ERR_INVALID_PARAMETER if the window number is invalid.
+ * 
+ * Other cores access the window with hf_rma_get() and hf_rma_put(), serviced by the driver
+ * without any task of this core. The memory must stay valid while the window is registered.
+ */
+int32_t hf_rma_window(uint16_t win, void *base, uint32_t size, uint16_t flags)
+{
+	uint32_t status;
+
+	if (win >= NOC_RMA_WINDOWS)
+		return ERR_INVALID_PARAMETER;
+	status = _di();
+	rma_win[win].base = base;
+	rma_win[win].size = base ? size : 0;
+	rma_win[win].flags = flags;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/* writes the header of a remote memory request */
+static void ni_rma_header(int8_t *hdr, uint16_t win, uint16_t tag, uint32_t off, uint32_t size)
+{
+	hdr[0] = win >> 8; hdr[1] = win & 0xff;
+	hdr[2] = tag >> 8; hdr[3] = tag & 0xff;
+	hdr[4] = off >> 24; hdr[5] = off >> 16; hdr[6] = off >> 8; hdr[7] = off;
+	hdr[8] = size >> 24; hdr[9] = size >> 16; hdr[10] = size >> 8; hdr[11] = size;
+}
+
+/**
+ * @brief Reads the memory of a window of another core (one-sided remote read).
+ * 
+ * @param cpu is the core which holds the window
+ * @param win is the window number
+ * @param off is the offset on the window, in bytes
+ * @param buf is a pointer to a buffer that receives the data
+ * @param size is the number of bytes to read
+ * @param timeout is the time (in ms) to wait for the reply, 0 to wait forever
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created
+ * or the read is denied (no such window, out of the window or not readable), ERR_COMM_TIMEOUT
+ * if there is no reply in time and ERR_INVALID_CPU if the core is invalid.
+ * 
+ * The data comes back as a message on NOC_RMA_CHANNEL of the calling task, straight to buf.
+ * Replies are tagged, so a reply which arrives after its read timed out is discarded.
+ */
+int32_t hf_rma_get(uint16_t cpu, uint16_t win, uint32_t off, void *buf, uint32_t size, uint32_t timeout)
+{
+	uint16_t id, tag, source_cpu, source_port;
+	uint32_t status, total;
+	uint64_t time;
+	int8_t hdr[RMA_HDR_SIZE], rtag[2];
+	struct noc_iov iov[2];
+	int32_t error;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	if (cpu >= hf_ncores()) return ERR_INVALID_CPU;
+
+	status = _di();
+	tag = rma_tag++;
+	_ei(status);
+	ni_rma_header(hdr, win, tag, off, size);
+	iov[0].buf = hdr;
+	iov[0].size = RMA_HDR_SIZE;
+	ni_packets(pktdrv_ports[id], cpu, NOC_RMA_PORT, iov, 1, RMA_GET, NULL, 0, 0);
+
+	time = _read_us();
+	while (1){
+		if (timeout){
+			while (ni_find(id, NOC_RMA_CHANNEL) < 0)
+				if (_read_us() - time > (uint64_t)timeout * 1000) return ERR_COMM_TIMEOUT;
+		}
+		iov[0].buf = rtag;
+		iov[0].size = 2;
+		iov[1].buf = buf;
+		iov[1].size = size;
+		error = ni_recv(id, &source_cpu, &source_port, iov, 2, &total, NOC_RMA_CHANNEL);
+		if (source_cpu != cpu || (((uint8_t)rtag[0] << 8) | (uint8_t)rtag[1]) != tag)
+			continue;
+		if (error) return error;
+
+		return total == size + 2 ? ERR_OK : ERR_COMM_UNFEASIBLE;
+	}
+}
+
+/**
+ * @brief Writes the memory of a window of another core (one-sided remote write).
+ * 
+ * @param cpu is the core which holds the window
+ * @param win is the window number
+ * @param off is the offset on the window, in bytes
+ * @param buf is a pointer to the data
+ * @param size is the number of bytes to write
+ * 
+ * @return ERR_OK, or ERR_INVALID_CPU if the core is invalid.
+ * 
+ * The data goes on requests of a packet each, copied to the window by the interrupt handler
+ * of the target core. Writes are not acknowledged: a write that is denied is only counted
+ * (rma_denied) by the target. A later read of the same window from this core is serviced
+ * after the write, as packets between two cores are kept in order.
+ */
+int32_t hf_rma_put(uint16_t cpu, uint16_t win, uint32_t off, void *buf, uint32_t size)
+{
+	uint32_t n, p = 0;
+	int8_t hdr[RMA_HDR_SIZE];
+	struct noc_iov iov[2];
+
+	if (cpu >= hf_ncores()) return ERR_INVALID_CPU;
+
+	do {
+		n = size - p > PKT_DATA_BYTES - RMA_HDR_SIZE ? PKT_DATA_BYTES - RMA_HDR_SIZE : size - p;
+		ni_rma_header(hdr, win, 0, off + p, n);
+		iov[0].buf = hdr;
+		iov[0].size = RMA_HDR_SIZE;
+		iov[1].buf = (int8_t *)buf + p;
+		iov[1].size = n;
+		ni_packets(pktdrv_ports[hf_selfid()], cpu, NOC_RMA_PORT, iov, 2, RMA_PUT, NULL, 0, 0);
+		p += n;
+	} while (p < size);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Reads the NoC traffic counters of this core.
+ * 
+ * @param stats is a pointer to a structure that receives the counters
+ * 
+ * @return ERR_OK.
+ * 
+ * Counters are kept since boot (or the last hf_noc_resetstats()). The low water mark of free
+ * shared packets (queue_min) tells how close the core came to dropping packets, and can be
+ * used to size NOC_PACKET_SLOTS.
+ */
+int32_t hf_noc_stats(struct noc_stats *stats)
+{
+	uint32_t status;
+
+	status = _di();
+	*stats = pktdrv_stats;
+	stats->queue_free = hf_queue_count(pktdrv_queue);
+	stats->reserved = reserve_left;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Reads the NoC traffic counters of a reception port.
+ * 
+ * @param port is the reception port
+ * @param stats is a pointer to a structure that receives the counters
+ * 
+ * @return ERR_OK when successful and ERR_COMM_ERROR if no task is bound to the port.
+ * 
+ * Counters of a port are cleared when its communication queue is created.
+ */
+int32_t hf_noc_portstats(uint16_t port, struct noc_port_stats *stats)
+{
+	uint32_t status;
+	uint16_t k;
+
+	status = _di();
+	k = port_find(port);
+	if (k){
+		*stats = pktdrv_pstats[k];
+		stats->held = port_held[k];
+	}
+	_ei(status);
+
+	return k ? ERR_OK : ERR_COMM_ERROR;
+}
+
+/**
+ * @brief Clears the NoC traffic counters of this core and of all ports.
+ */
+void hf_noc_resetstats(void)
+{
+	uint32_t status;
+
+	status = _di();
+	memset(&pktdrv_stats, 0, sizeof(struct noc_stats));
+	memset(pktdrv_pstats, 0, sizeof(pktdrv_pstats));
+	pktdrv_stats.queue_min = hf_queue_count(pktdrv_queue);
+	_ei(status);
+}
+
+/**
+ * @brief Calibrates the offset between the clock of another core and the clock of this one.
+ * 
+ * @param cpu is the other core
+ * @param offset is a pointer to a variable which will hold the offset (the counter of the other
+ * core minus the counter of this one, in cycles), or NULL
+ * @param timeout is the time (in ms) to wait for each reply, 0 to wait forever
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created
+ * or the driver is built without NOC_TIMESTAMP, ERR_COMM_TIMEOUT if there is no reply in time
+ * (the other core has no NOC_TIMESTAMP or denied the request) and ERR_INVALID_CPU if the core
+ * is invalid.
+ * 
+ * NOC_SYNC_ROUNDS requests go to the driver of the other core (on NOC_RMA_PORT), which replies
+ * with the time the request was injected (clock of this core) and arrived (its own clock).
+ * The reply carries the time it was injected, and its arrival is kept by this core, so each
+ * round gives the offset, if the transit takes the same both ways. The round with the shortest
+ * round trip (the one which waited the least on queues) is kept. The offset is used for the
+ * transit latency of the messages from the core; it drifts with the clocks of the cores, so
+ * the calibration should be repeated on long runs. Replies of remote reads which timed out
+ * are discarded meanwhile.
+ */
+int32_t hf_noc_sync(uint16_t cpu, int32_t *offset, uint32_t timeout)
+{
+#if NOC_TIMESTAMP == 1
+	uint16_t id, tag, *buf_ptr;
+	uint32_t status, t0 = 0, t1 = 0, t2 = 0, t3 = 0, rtt, best = 0xffffffff;
+	uint64_t time;
+	int32_t r, k, off = 0, match;
+	int8_t hdr[RMA_HDR_SIZE];
+	struct noc_iov iov;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	if (cpu >= hf_ncores()) return ERR_INVALID_CPU;
+
+	for (r = 0; r < NOC_SYNC_ROUNDS; r++){
+		status = _di();
+		tag = rma_tag++;
+		_ei(status);
+		ni_rma_header(hdr, 0, tag, 0, 0);
+		iov.buf = hdr;
+		iov.size = RMA_HDR_SIZE;
+		ni_packets(pktdrv_ports[id], cpu, NOC_RMA_PORT, &iov, 1, RMA_TIME, NULL, 0, 0);
+
+		/* reply: |tag |t0 |t1 | after its own timestamp (t2), arrived at t3 */
+		time = _read_us();
+		do {
+			if (timeout){
+				while (ni_find(id, NOC_RMA_CHANNEL) < 0)
+					if (_read_us() - time > (uint64_t)timeout * 1000) return ERR_COMM_TIMEOUT;
+			}
+			buf_ptr = ni_wait(id, NOC_RMA_CHANNEL);
+			k = ni_stamp_at(buf_ptr);
+			match = k && buf_ptr[PKT_SOURCE_CPU] == cpu && buf_ptr[PKT_MSG_SIZE] == 14 && buf_ptr[k + 2] == tag;
+			if (match){
+				t0 = ni_time(buf_ptr + k + 3);
+				t1 = ni_time(buf_ptr + k + 5);
+				t2 = ni_time(buf_ptr + k);
+				t3 = ni_time(buf_ptr + PKT_ARRIVAL);
+			}
+			status = _di();
+			ni_release(id, buf_ptr);
+			_ei(status);
+		} while (!match);
+
+		rtt = (t3 - t0) - (t2 - t1);
+		if (rtt < best){
+			best = rtt;
+			off = ((int32_t)(t1 - t0) + (int32_t)(t2 - t3)) / 2;
+		}
+	}
+
+	status = _di();
+	time_offset[cpu] = off;
+	time_synced[cpu] = 1;
+	_ei(status);
+	if (offset)
+		*offset = off;
+
+	return ERR_OK;
+#else
+	return ERR_COMM_UNFEASIBLE;
+#endif
+}
+
+/* loadable modules (sys/kernel/module.c), received from the NoC */
+struct noc_modrx {
+	uint16_t cpu, port, channel;
+	uint8_t started;
+	uint32_t pos, len;
+	int8_t buf[NOC_MODULE_CHUNK];
+};
+
+static const struct module_symbol noc_exports[] = {
+	{ "hf_cpuid", (void *)hf_cpuid },
+	{ "hf_ncores", (void *)hf_ncores },
+	{ "hf_comm_create", (void *)hf_comm_create },
+	{ "hf_comm_destroy", (void *)hf_comm_destroy },
+	{ "hf_recv", (void *)hf_recv },
+	{ "hf_recvprobe", (void *)hf_recvprobe },
+	{ "hf_send", (void *)hf_send },
+	{ "hf_multicast", (void *)hf_multicast },
+	{ "hf_recvack", (void *)hf_recvack },
+	{ "hf_sendack", (void *)hf_sendack },
+	{ NULL, NULL }
+};
+
+static int32_t noc_modread(void *arg, void *buf, uint32_t size)
+{
+	struct noc_modrx *rx = arg;
+	struct noc_iov iov;
+	uint16_t cpu, port;
+	uint32_t done = 0, n;
+
+	while (done < size){
+		if (rx->pos == rx->len){
+			iov.buf = rx->buf;
+			iov.size = NOC_MODULE_CHUNK;
+			if (hf_recvv(&cpu, &port, &iov, 1, &n, rx->channel))
+				break;
+			if (!rx->started){
+				rx->cpu = cpu;
+				rx->port = port;
+				rx->started = 1;
+			}else if (cpu != rx->cpu || port != rx->port){
+				continue;
+			}
+			rx->pos = 0;
+			rx->len = n;
+			continue;
+		}
+		n = rx->len - rx->pos;
+		if (n > size - done)
+			n = size - done;
+		memcpy((int8_t *)buf + done, rx->buf + rx->pos, n);
+		rx->pos += n;
+		done += n;
+	}
+
+	return done;
+}
+
+/**
+ * @brief Receives and loads a module (blocking receive).
+ * 
+ * @param m is a pointer to a module structure, filled by the loader
+ * @param channel is the message channel of the module transfer
+ * 
+ * @return ERR_OK on success, ERR_OUT_OF_MEMORY if no reception buffer could be allocated, or the
+ * error of hf_module_read().
+ * 
+ * The calling task must have a message queue (hf_comm_create()). The module file is received on
+ * messages of up to NOC_MODULE_CHUNK bytes sent by hf_module_nocsend(), from a single source:
+ * messages from other tasks on the same channel are dropped during the transfer. The NoC
+ * primitives are exported to modules on the first call.
+ */
+int32_t hf_module_noc(struct module *m, uint16_t channel)
+{
+	struct noc_modrx *rx;
+	int32_t val;
+
+	hf_module_export(noc_exports);
+	rx = (struct noc_modrx *)hf_malloc(sizeof(struct noc_modrx));
+	if (!rx)
+		return ERR_OUT_OF_MEMORY;
+	rx->channel = channel;
+	rx->started = 0;
+	rx->pos = rx->len = 0;
+	val = hf_module_read(m, noc_modread, rx);
+	hf_free(rx);
+
+	return val;
+}
+
+/**
+ * @brief Sends a module file to loaders on several cores.
+ * 
+ * @param core_mask is the set of target cores, one bit per core (bit n is core n)
+ * @param target_port is the port of the loader tasks (the same on all cores)
+ * @param buf is a pointer to the module file
+ * @param size is the size of the module file
+ * @param channel is the message channel of the module transfer
+ * 
+ * @return ERR_OK when successful, or the error of hf_multicast() or hf_send().
+ * 
+ * The file is sent on messages of NOC_MODULE_CHUNK bytes, with a multicast when there is more
+ * than one target, so a module is deployed to all cores of the mesh in about the time needed
+ * for one.
+ */
+int32_t hf_module_nocsend(uint32_t core_mask, uint16_t target_port, void *buf, uint32_t size, uint16_t channel)
+{
+	uint32_t off, n;
+	int32_t val, single;
+
+	core_mask &= ~(1U << hf_cpuid());
+	if (!core_mask)
+		return ERR_INVALID_CPU;
+	single = !(core_mask & (core_mask - 1));
+	for (off = 0; off < size; off += n){
+		n = size - off < NOC_MODULE_CHUNK ? size - off : NOC_MODULE_CHUNK;
+		if (single)
+			val = hf_send(__builtin_ctz(core_mask), target_port, (int8_t *)buf + off, n, channel);
+		else
+			val = hf_multicast(core_mask, target_port, (int8_t *)buf + off, n, channel);
+		if (val)
+			return val;
+	}
+
+	return ERR_OK;
 }
@@ -0,0 +1,431 @@
+/**
+ * @file rpc.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ * 
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Remote procedure calls on top of hf_send() and hf_recv(). A server task binds a port,
+ * registers handlers (procedures) and serves requests on a channel. A client queues calls on
+ * a batch, so several small calls travel on a single packet, and gets a future for each call.
+ * Calls are identified by a request id, so any number of calls may be outstanding and replies
+ * are matched in any order.
+ * 
+ * Message format (all fields are 16 or 32 bit, high byte first):
+ * 
+ \verbatim
+ request:  |reply channel| id | size | proc   | args ... | id | size | proc   | args ... | ...
+ reply:                  | id | size | result | res ...  | id | size | result | res ...  | ...
+ \endverbatim
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <lockstat.h>
+#include <semaphore.h>
+#include <kernel.h>
+#include <task.h>
+#include <ecodes.h>
+#include <noc.h>
+#include <rpc.h>
+
+static void rpc_put16(int8_t *p, uint16_t val)
+{
+	p[0] = val >> 8;
+	p[1] = val & 0xff;
+}
+
+static uint16_t rpc_get16(int8_t *p)
+{
+	return ((uint8_t)p[0] << 8) | (uint8_t)p[1];
+}
+
+static void rpc_put32(int8_t *p, uint32_t val)
+{
+	rpc_put16(p, val >> 16);
+	rpc_put16(p + 2, val & 0xffff);
+}
+
+static uint32_t rpc_get32(int8_t *p)
+{
+	return ((uint32_t)rpc_get16(p) << 16) | rpc_get16(p + 2);
+}
+
+/* writes a call record header */
+static void rpc_record(int8_t *p, uint16_t id, uint16_t size, uint32_t val)
+{
+	rpc_put16(p, id);
+	rpc_put16(p + 2, size);
+	rpc_put32(p + 4, val);
+}
+
+/**
+ * @brief Creates an RPC server, bound to a port of the calling task.
+ * 
+ * @param srv is a pointer to the server
+ * @param port is the reception port of the server (a communication queue is created)
+ * @param channel is the channel of the requests
+ * 
+ * @return ERR_OK when successful, ERR_OUT_OF_MEMORY if the message buffers could not be
+ * allocated, or the error of hf_comm_create().
+ */
+int32_t hf_rpc_server(struct rpc_server *srv, uint16_t port, uint16_t channel)
+{
+	int32_t i, error;
+
+	for (i = 0; i < RPC_PROCS; i++)
+		srv->procs[i] = NULL;
+	srv->channel = channel;
+	srv->req = hf_malloc(RPC_MSG_SIZE);
+	if (srv->req == NULL)
+		return ERR_OUT_OF_MEMORY;
+	srv->rep = hf_malloc(RPC_MSG_SIZE);
+	if (srv->rep == NULL){
+		hf_free(srv->req);
+		return ERR_OUT_OF_MEMORY;
+	}
+	error = hf_comm_create(hf_selfid(), port, 0);
+	if (error){
+		hf_free(srv->req);
+		hf_free(srv->rep);
+	}
+
+	return error;
+}
+
+/**
+ * @brief Registers (or removes) the handler of a procedure.
+ * 
+ * @param srv is a pointer to the server
+ * @param proc is the procedure number (0 to RPC_PROCS - 1)
+ * @param func is the handler, or NULL to remove it
+ * 
+ * @return ERR_OK when successful and ERR_INVALID_PARAMETER if the procedure number is invalid.
+ */
+int32_t hf_rpc_register(struct rpc_server *srv, uint16_t proc, rpc_proc_t func)
+{
+	if (proc >= RPC_PROCS)
+		return ERR_INVALID_PARAMETER;
+	srv->procs[proc] = func;
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Serves a request message.
+ * 
+ * @param srv is a pointer to the server
+ * 
+ * @return ERR_OK when successful, ERR_COMM_ERROR if the request is malformed, or the error of
+ * hf_recv() / hf_send().
+ * 
+ * The calling task (which created the server) blocks until a request arrives, then calls the
+ * handler of each call on the request and sends the results back on a single reply (or more,
+ * if the results do not fit a message). Calls to procedures without a handler return
+ * ERR_RPC_NO_PROC. The server task usually calls this in a loop.
+ */
+int32_t hf_rpc_serve(struct rpc_server *srv)
+{
+	uint16_t cpu, port, size, reply, id, len, proc, res_size;
+	int32_t p, r = 0, result, error;
+
+	error = hf_recv(&cpu, &port, srv->req, &size, srv->channel);
+	if (error) return error;
+	if (size < 2) return ERR_COMM_ERROR;
+
+	reply = rpc_get16(srv->req);
+	for (p = 2; p + RPC_HEADER_SIZE <= size; p += RPC_HEADER_SIZE + len){
+		id = rpc_get16(srv->req + p);
+		len = rpc_get16(srv->req + p + 2);
+		proc = rpc_get32(srv->req + p + 4);
+		if (p + RPC_HEADER_SIZE + len > size){
+			error = ERR_COMM_ERROR;
+			break;
+		}
+		if (r + RPC_HEADER_SIZE + RPC_RES_SIZE > RPC_MSG_SIZE){
+			error = hf_send(cpu, port, srv->rep, r, reply);
+			if (error) return error;
+			r = 0;
+		}
+		res_size = 0;
+		if (proc < RPC_PROCS && srv->procs[proc])
+			result = srv->procs[proc](srv->req + p + RPC_HEADER_SIZE, len, srv->rep + r + RPC_HEADER_SIZE, &res_size);
+		else
+			result = ERR_RPC_NO_PROC;
+		if (res_size > RPC_RES_SIZE)
+			res_size = RPC_RES_SIZE;
+		rpc_record(srv->rep + r, id, res_size, result);
+		r += RPC_HEADER_SIZE + res_size;
+	}
+	if (r){
+		result = hf_send(cpu, port, srv->rep, r, reply);
+		if (result) error = result;
+	}
+
+	return error;
+}
+
+/**
+ * @brief Creates an RPC client.
+ * 
+ * @param c is a pointer to the client
+ * @param cpu is the server processor
+ * @param port is the server port
+ * @param channel is the channel of the requests on the server
+ * @param reply is the channel of the replies on the calling task
+ * 
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when the calling task has no
+ * communication queue (comm) and ERR_OUT_OF_MEMORY if the reply buffer could not be allocated.
+ * 
+ * Replies arrive on the communication queue of the calling task, so it must be created first
+ * (hf_comm_create()). A task may have several clients, using different reply channels.
+ */
+int32_t hf_rpc_client(struct rpc_client *c, uint16_t cpu, uint16_t port, uint16_t channel, uint16_t reply)
+{
+	if (pktdrv_tqueue[hf_selfid()] == NULL)
+		return ERR_COMM_UNFEASIBLE;
+	c->buf = hf_malloc(RPC_MSG_SIZE);
+	if (c->buf == NULL)
+		return ERR_OUT_OF_MEMORY;
+	c->pending = NULL;
+	c->cpu = cpu;
+	c->port = port;
+	c->channel = channel;
+	c->reply = reply;
+	c->next_id = 0;
+	rpc_put16(c->batch, reply);
+	c->batch_size = 2;
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Destroys an RPC client.
+ * 
+ * @param c is a pointer to the client
+ * 
+ * @return ERR_OK when successful and ERR_ERROR if there are calls waiting for replies.
+ */
+int32_t hf_rpc_close(struct rpc_client *c)
+{
+	if (c->pending || c->batch_size > 2)
+		return ERR_ERROR;
+	hf_free(c->buf);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Queues a remote call (asynchronous call).
+ * 
+ * @param c is a pointer to the client
+ * @param proc is the procedure number
+ * @param arg is a pointer to the call arguments
+ * @param size is the size (in bytes) of the arguments
+ * @param res is a pointer to a buffer that receives the results
+ * @param res_max is the size of the result buffer
+ * @param f is a pointer to the future of the call, valid until it completes
+ * 
+ * @return ERR_OK when successful, ERR_RPC_OVERFLOW if the arguments do not fit a message, or
+ * the error of hf_send().
+ * 
+ * The call is put on the client batch and sent along with other calls when the batch is full
+ * or on hf_rpc_flush(), hf_rpc_poll() or hf_rpc_wait(). Calls larger than the batch are sent
+ * at once. The arguments are copied, so the buffer may be reused on return.
+ */
+int32_t hf_rpc_call_async(struct rpc_client *c, uint16_t proc, int8_t *arg, uint16_t size, int8_t *res, uint16_t res_max, struct rpc_future *f)
+{
+	int32_t error = ERR_OK;
+
+	if (2 + RPC_HEADER_SIZE + size > RPC_MSG_SIZE)
+		return ERR_RPC_OVERFLOW;
+
+	f->res = res;
+	f->res_max = res_max;
+	f->res_size = 0;
+	f->id = c->next_id++;
+	f->done = 0;
+	f->result = ERR_OK;
+
+	if (c->batch_size + RPC_HEADER_SIZE + size > RPC_BATCH_SIZE){
+		error = hf_rpc_flush(c);
+		if (error) return error;
+	}
+	if (2 + RPC_HEADER_SIZE + size > RPC_BATCH_SIZE){
+		rpc_put16(c->buf, c->reply);
+		rpc_record(c->buf + 2, f->id, size, proc);
+		memcpy(c->buf + 2 + RPC_HEADER_SIZE, arg, size);
+		error = hf_send(c->cpu, c->port, c->buf, 2 + RPC_HEADER_SIZE + size, c->channel);
+		if (error) return error;
+	}else{
+		rpc_record(c->batch + c->batch_size, f->id, size, proc);
+		memcpy(c->batch + c->batch_size + RPC_HEADER_SIZE, arg, size);
+		c->batch_size += RPC_HEADER_SIZE + size;
+	}
+	f->next = c->pending;
+	c->pending = f;
+
+	return error;
+}
+
+/**
+ * @brief Sends the calls queued on the client batch.
+ * 
+ * @param c is a pointer to the client
+ * 
+ * @return ERR_OK when successful, or the error of hf_send().
+ */
+int32_t hf_rpc_flush(struct rpc_client *c)
+{
+	int32_t error = ERR_OK;
+
+	if (c->batch_size > 2){
+		error = hf_send(c->cpu, c->port, c->batch, c->batch_size, c->channel);
+		c->batch_size = 2;
+	}
+
+	return error;
+}
+
+/**
+ * @brief Gives up on a pending call.
+ * 
+ * @param c is a pointer to the client
+ * @param f is a pointer to the future of the call
+ * 
+ * The future is removed from the pending calls (if it is there), so its memory may be reused
+ * even if the reply never arrives (after an error of hf_rpc_wait(), for example). A reply
+ * arriving later is discarded.
+ */
+void hf_rpc_cancel(struct rpc_client *c, struct rpc_future *f)
+{
+	struct rpc_future **prev;
+
+	for (prev = &c->pending; *prev; prev = &(*prev)->next){
+		if (*prev == f){
+			*prev = f->next;
+			break;
+		}
+	}
+}
+
+/* receives a reply message and completes the futures of its calls */
+static int32_t rpc_complete(struct rpc_client *c)
+{
+	uint16_t cpu, port, size, id, len, n;
+	int32_t p, error;
+	struct rpc_future *f, **prev;
+
+	error = hf_recv(&cpu, &port, c->buf, &size, c->reply);
+	if (error) return error;
+	if (cpu != c->cpu || port != c->port) return ERR_OK;
+
+	for (p = 0; p + RPC_HEADER_SIZE <= size; p += RPC_HEADER_SIZE + len){
+		id = rpc_get16(c->buf + p);
+		len = rpc_get16(c->buf + p + 2);
+		if (p + RPC_HEADER_SIZE + len > size)
+			return ERR_COMM_ERROR;
+		for (prev = &c->pending; *prev; prev = &(*prev)->next)
+			if ((*prev)->id == id) break;
+		f = *prev;
+		if (f == NULL) continue;
+		*prev = f->next;
+		f->result = rpc_get32(c->buf + p + 4);
+		f->res_size = len;
+		n = len;
+		if (n > f->res_max){
+			n = f->res_max;
+			f->result = ERR_RPC_OVERFLOW;
+		}
+		memcpy(f->res, c->buf + p + RPC_HEADER_SIZE, n);
+		f->done = 1;
+	}
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Completes the calls which already have replies (non blocking).
+ * 
+ * @param c is a pointer to the client
+ * 
+ * @return the number of calls still pending, or an error of hf_send() / hf_recv().
+ * 
+ * The batch is sent first. Futures are completed (done is set) as replies are found on the
+ * communication queue.
+ */
+int32_t hf_rpc_poll(struct rpc_client *c)
+{
+	struct rpc_future *f;
+	int32_t error, n = 0;
+
+	error = hf_rpc_flush(c);
+	if (error) return error;
+	while (hf_recvprobe(c->reply) > 0){
+		error = rpc_complete(c);
+		if (error) return error;
+	}
+	for (f = c->pending; f; f = f->next)
+		n++;
+
+	return n;
+}
+
+/**
+ * @brief Waits for a call to complete.
+ * 
+ * @param c is a pointer to the client
+ * @param f is a pointer to the future of the call
+ * 
+ * @return the value returned by the procedure, ERR_RPC_NO_PROC if the server has no handler
+ * for it, ERR_RPC_OVERFLOW if the results did not fit the buffer, or an error of hf_send() /
+ * hf_recv().
+ * 
+ * The batch is sent first. The calling task blocks until the reply arrives, completing the
+ * futures of other calls along the way.
+ */
+int32_t hf_rpc_wait(struct rpc_client *c, struct rpc_future *f)
+{
+	int32_t error;
+
+	error = hf_rpc_flush(c);
+	if (error) return error;
+	while (!f->done){
+		error = rpc_complete(c);
+		if (error) return error;
+	}
+
+	return f->result;
+}
+
+/**
+ * @brief Calls a remote procedure (synchronous call).
+ * 
+ * @param c is a pointer to the client
+ * @param proc is the procedure number
+ * @param arg is a pointer to the call arguments
+ * @param size is the size (in bytes) of the arguments
+ * @param res is a pointer to a buffer (RPC_RES_SIZE bytes) that receives the results
+ * @param res_size is a pointer to a variable which will hold the size of the results
+ * 
+ * @return the same as hf_rpc_wait().
+ */
+int32_t hf_rpc_call(struct rpc_client *c, uint16_t proc, int8_t *arg, uint16_t size, int8_t *res, uint16_t *res_size)
+{
+	struct rpc_future f;
+	int32_t error;
+
+	error = hf_rpc_call_async(c, proc, arg, size, res, RPC_RES_SIZE, &f);
+	if (error) return error;
+	error = hf_rpc_wait(c, &f);
+	if (!f.done)
+		hf_rpc_cancel(c, &f);
+	*res_size = f.res_size;
+
+	return error;
+}
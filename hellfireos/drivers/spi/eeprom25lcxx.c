@@ -31,30 +31,85 @@ uint8_t eeprom25lcxx_readbyte(uint16_t addr)
 
 void eeprom25lcxx_read(uint16_t addr, uint8_t *buf, uint16_t size)
 {
-	uint16_t i;
-	
 	spi_start();
 	spi_sendrecv(CMD_READ);
 	spi_sendrecv(addr >> 8);
 	spi_sendrecv(addr & 0xff);
-	for(i = 0; i < size; i++)
-		buf[i] = spi_sendrecv(0);
+	spi_transfer(NULL, buf, size);
 	spi_stop();
 }
 
-void eeprom25lcxx_writepage(uint16_t page, uint8_t page_size, uint8_t *data)
+uint8_t eeprom25lcxx_status(void)
 {
-	uint16_t i;
+	uint8_t data;
+	
+	spi_start();
+	spi_sendrecv(CMD_RDSR);
+	data = spi_sendrecv(0);
+	spi_stop();
 	
+	return data;
+}
+
+/*
+ * waits for the end of a write cycle, polling the write in progress bit of the status
+ * register. the processor is given away between polls when the scheduler is running.
+ * returns 0, or -1 if the cycle takes longer than EEPROM_WRITE_TIMEOUT ms.
+ */
+int32_t eeprom25lcxx_wait(void)
+{
+	uint64_t time;
+	
+	time = _read_us();
+	while (eeprom25lcxx_status() & SR_WIP){
+		if (_read_us() - time > EEPROM_WRITE_TIMEOUT * 1000)
+			return -1;
+		if (krnl_schedule)
+			hf_yield();
+	}
+	
+	return 0;
+}
+
+/* writes up to a page, from addr to the end of its page at most (a write wraps on the page) */
+static int32_t eeprom25lcxx_write_cycle(uint16_t addr, uint8_t *data, uint16_t size)
+{
 	spi_start();
 	spi_sendrecv(CMD_WREN);
 	spi_stop();
 	spi_start();
 	spi_sendrecv(CMD_WRITE);
-	spi_sendrecv((page * page_size) >> 8);
-	spi_sendrecv((page * page_size) & 0xff);
-	for (i = 0; i < page_size; i++)
-		spi_sendrecv(data[i]);
+	spi_sendrecv(addr >> 8);
+	spi_sendrecv(addr & 0xff);
+	spi_transfer(data, NULL, size);
 	spi_stop();
-	delay_ms(10);
+	
+	return eeprom25lcxx_wait();
+}
+
+void eeprom25lcxx_writepage(uint16_t page, uint8_t page_size, uint8_t *data)
+{
+	eeprom25lcxx_write_cycle(page * page_size, data, page_size);
+}
+
+/*
+ * writes size bytes from addr, in as many write cycles as the pages it spans (the first
+ * and last pages may be partial). returns 0, or -1 if a write cycle times out.
+ */
+int32_t eeprom25lcxx_write(uint16_t addr, uint8_t *buf, uint16_t size, uint8_t page_size)
+{
+	uint16_t n;
+	
+	while (size){
+		n = page_size - (addr & (page_size - 1));
+		if (n > size)
+			n = size;
+		if (eeprom25lcxx_write_cycle(addr, buf, n))
+			return -1;
+		addr += n;
+		buf += n;
+		size -= n;
+	}
+	
+	return 0;
 }
@@ -20,7 +20,9 @@
 
 static uint8_t encbank;
 static uint16_t encpktptr;
-mutex_t enclock;
+static uint8_t *encring[EN_RX_FRAMES];
+static int32_t encrings;
+mutex_t enclock;			// serializes access to the controller (transfers run with the scheduler unlocked)
 
 uint8_t enc28j60_readop(uint8_t op, uint8_t address)
 {
@@ -54,8 +56,7 @@ void enc28j60_readbuf(uint8_t *data, uint16_t len)
 	spi_start();
 	// issue read command
 	spi_sendrecv(ENC28J60_READ_BUF_MEM);
-	while(len--)
-		*data++ = spi_sendrecv(0x00);
+	spi_transfer(NULL, data, len);
 	spi_stop();
 }
 
@@ -64,8 +65,7 @@ void enc28j60_writebuf(uint8_t *data, uint16_t len)
 	spi_start();
 	// issue write command
 	spi_sendrecv(ENC28J60_WRITE_BUF_MEM);
-	while(len--)
-		spi_sendrecv(*data++);
+	spi_transfer(data, NULL, len);
 	spi_stop();
 }
 
@@ -259,7 +259,17 @@ int32_t en_init()
 	frame_out = (uint8_t *)malloc(MAX_FRAMELEN);
 	if (!frame_in || !frame_out) panic(PANIC_OOM);
 	
+	/* reception ring for batched input, frame_in is its first buffer */
+	encring[0] = frame_in;
+	for (encrings = 1; encrings < EN_RX_FRAMES; encrings++){
+		encring[encrings] = (uint8_t *)malloc(MAX_FRAMELEN);
+		if (!encring[encrings]) break;
+	}
+	
 	hf_mtxinit(&enclock);
+#if LOCK_STATS == 1
+	hf_mtxstat(&enclock, "enclock");
+#endif
 	
 	en_irqconfig();
 	
@@ -278,21 +288,117 @@ int32_t en_watchdog(void)
 	return 0;
 }
 
-int32_t en_ll_input(uint8_t *frame)
+#if USTACK_HW_CHKSUM == 1
+// UDP checksum offload (USTACK_HW_CHKSUM): the DMA checksum engine sums the datagram on the
+// copy of the frame in the controller buffer memory, so the CPU doesn't go over the data.
+// only IPv4 datagrams sent whole are handled, fragments are summed by the stack.
+
+// address on the controller buffer memory, the receive buffer wrapping around at its end
+static uint16_t en_rxaddr(uint16_t addr)
+{
+	if (addr > RXSTOP_INIT)
+		addr -= RXSTOP_INIT + 1 - RXSTART_INIT;
+	return addr;
+}
+
+// one's complement sum of len (> 0) bytes of the controller buffer memory at addr (the DMA
+// engine gives its complement, as on an IP header)
+static uint16_t en_dmasum(uint16_t addr, uint16_t len, int32_t rx)
+{
+	uint16_t end, sum;
+
+	end = addr + len - 1;
+	if (rx)
+		end = en_rxaddr(end);
+	enc28j60_write(EDMASTL, addr & 0xFF);
+	enc28j60_write(EDMASTH, addr >> 8);
+	enc28j60_write(EDMANDL, end & 0xFF);
+	enc28j60_write(EDMANDH, end >> 8);
+	enc28j60_writeop(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_CSUMEN);
+	enc28j60_writeop(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_DMAST);
+	while (enc28j60_read(ECON1) & ECON1_DMAST);
+	sum = enc28j60_read(EDMACSL);
+	sum |= enc28j60_read(EDMACSH) << 8;
+	enc28j60_writeop(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_CSUMEN);
+
+	return ~sum & 0xFFFF;
+}
+
+// offset of the UDP header of a frame holding a whole IPv4 datagram (0 if none), and its length
+static uint16_t en_udp(uint8_t *frame, uint16_t size, uint16_t *len)
+{
+	uint16_t ofs;
+
+	if (size < 14 + 20 + 8 || frame[12] != 0x08 || frame[13] != 0x00 || (frame[14] & 0x0F) < 5)
+		return 0;
+	// protocol, and no more fragments flag or fragment offset
+	if (frame[23] != 17 || (frame[20] & 0x3F) || frame[21])
+		return 0;
+	ofs = 14 + (frame[14] & 0x0F) * 4;
+	*len = (frame[ofs + 4] << 8) | frame[ofs + 5];
+	if (*len < 8 || ofs + *len > size)
+		return 0;
+
+	return ofs;
+}
+
+// verifies the UDP checksum of a frame still on the receive buffer (at addr). the checksum
+// field of a valid datagram is cleared, so the stack doesn't sum it again. returns 0 if the
+// checksum is invalid
+static int32_t en_rxchksum(uint8_t *frame, uint16_t size, uint16_t addr)
+{
+	uint16_t ofs, len;
+	uint32_t sum;
+
+	ofs = en_udp(frame, size, &len);
+	if (!ofs || (frame[ofs + 6] == 0 && frame[ofs + 7] == 0))
+		return 1;
+	// pseudo header: addresses, protocol and length
+	sum = 17 + len + ((frame[26] << 8) | frame[27]) + ((frame[28] << 8) | frame[29]) +
+		((frame[30] << 8) | frame[31]) + ((frame[32] << 8) | frame[33]);
+	sum += en_dmasum(en_rxaddr(addr + ofs), len, 1);
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	if (sum != 0xFFFF)
+		return 0;
+	frame[ofs + 6] = 0;
+	frame[ofs + 7] = 0;
+
+	return 1;
+}
+
+// completes the UDP checksum of a frame on the transmit buffer (at addr), which holds the
+// pseudo header sum
+static void en_txchksum(uint8_t *frame, uint16_t size, uint16_t addr)
+{
+	uint16_t ofs, len, sum;
+
+	ofs = en_udp(frame, size, &len);
+	if (!ofs)
+		return;
+	sum = ~en_dmasum(addr + ofs, len, 0) & 0xFFFF;
+	// a computed checksum of zero is sent as 0xffff, zero meaning no checksum
+	if (sum == 0)
+		sum = 0xFFFF;
+	enc28j60_write(EWRPTL, (addr + ofs + 6) & 0xFF);
+	enc28j60_write(EWRPTH, (addr + ofs + 6) >> 8);
+	enc28j60_writeop(ENC28J60_WRITE_BUF_MEM, 0, sum >> 8);
+	enc28j60_writeop(ENC28J60_WRITE_BUF_MEM, 0, sum & 0xFF);
+}
+#endif
+
+// copy the next frame from the receive buffer and release it (the frame count must be > 0)
+static int32_t en_ll_read(uint8_t *frame)
 {
 	uint16_t rxstat;
 	uint16_t size;
+#if USTACK_HW_CHKSUM == 1
+	uint16_t addr;
 	
-	hf_mtxlock(&enclock);
+	// the frame follows the next frame pointer, length and status (6 bytes)
+	addr = en_rxaddr(encpktptr + 6);
+#endif
 	
-	// check if a frame has been received
-	if(enc28j60_read(EPKTCNT) == 0){
-		hf_mtxunlock(&enclock);
-		return 0;
-	}
-
-	hf_schedlock(1);
-
 	// Set the read pointer to the start of the received frame
 	enc28j60_write(ERDPTL, (encpktptr));
 	enc28j60_write(ERDPTH, (encpktptr) >> 8);
@@ -318,6 +424,10 @@ int32_t en_ll_input(uint8_t *frame)
 		size = 0;
 	else				// copy frame from the receive buffer
 		enc28j60_readbuf(frame, size);
+#if USTACK_HW_CHKSUM == 1
+	if (size && !en_rxchksum(frame, size, addr))
+		size = 0;
+#endif
 
 	// Move the RX read pointer to the start of the next received frame, freeing memory
 	enc28j60_write(ERXRDPTL, (encpktptr));
@@ -325,7 +435,24 @@ int32_t en_ll_input(uint8_t *frame)
 	// decrement the packet counter indicates we are done with this frame
 	enc28j60_writeop(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
 
-	hf_schedlock(0);
+	return size;
+}
+
+int32_t en_ll_input(uint8_t *frame)
+{
+	uint16_t size;
+	
+	hf_mtxlock(&enclock);
+	
+	// check if a frame has been received
+	if(enc28j60_read(EPKTCNT) == 0){
+		hf_mtxunlock(&enclock);
+		// no frames left, so the INT pin is released (make sure its interrupt is unmasked)
+		en_irqack();
+		return 0;
+	}
+
+	size = en_ll_read(frame);
 	hf_mtxunlock(&enclock);
 	
 	en_irqack();
@@ -333,10 +460,41 @@ int32_t en_ll_input(uint8_t *frame)
 	return size;
 }
 
+// batched receive: takes up to max (and EN_RX_FRAMES) pending frames with a single lock,
+// frame count read and interrupt acknowledge. frames are read to the buffers given on
+// frames[] (MAX_FRAMELEN bytes each), or to the reception ring when an entry is NULL.
+// frames[] and sizes[] get the buffers and the frame sizes (0 for an invalid frame), ring
+// buffers being valid until the next call. returns the number of frames taken.
+int32_t en_ll_inputv(uint8_t **frames, int32_t *sizes, int32_t max)
+{
+	int32_t i, n;
+	
+	hf_mtxlock(&enclock);
+	
+	n = enc28j60_read(EPKTCNT);
+	if (n > max) n = max;
+	if (n > encrings) n = encrings;
+	if (n == 0){
+		hf_mtxunlock(&enclock);
+		en_irqack();
+		return 0;
+	}
+
+	for (i = 0; i < n; i++){
+		if (!frames[i])
+			frames[i] = encring[i];
+		sizes[i] = en_ll_read(frames[i]);
+	}
+	hf_mtxunlock(&enclock);
+	
+	en_irqack();
+	
+	return n;
+}
+
 void en_ll_output(uint8_t *frame, uint16_t size)
 {
 	hf_mtxlock(&enclock);
-	hf_schedlock(1);
 	
 	// Set the write pointer to start of transmit buffer area
 	enc28j60_write(EWRPTL, TXSTART_INIT & 0xFF);
@@ -351,6 +509,9 @@ void en_ll_output(uint8_t *frame, uint16_t size)
 	
 	// copy the frame into the transmit buffer
 	enc28j60_writebuf(frame, size);
+#if USTACK_HW_CHKSUM == 1
+	en_txchksum(frame, size, TXSTART_INIT + 1);
+#endif
 	
 	// Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
 	if ((enc28j60_read(EIR) & EIR_TXERIF)){
@@ -360,6 +521,5 @@ void en_ll_output(uint8_t *frame, uint16_t size)
 	// send the contents of the transmit buffer onto the network
 	enc28j60_writeop(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
 
-	hf_schedlock(0);
 	hf_mtxunlock(&enclock);
 }
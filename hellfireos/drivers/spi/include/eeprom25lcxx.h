@@ -18,6 +18,16 @@
 #define CMD_RDSR	0x05
 #define CMD_WRSR	0x01
 
+#define SR_WIP		0x01		/* write in progress */
+#define SR_WEL		0x02		/* write enable latch */
+
+#ifndef EEPROM_WRITE_TIMEOUT
+#define EEPROM_WRITE_TIMEOUT	20	/* ms, longest write cycle (5 ms typical) */
+#endif
+
 uint8_t eeprom25lcxx_readbyte(uint16_t addr);
 void eeprom25lcxx_read(uint16_t addr, uint8_t *buf, uint16_t size);
+uint8_t eeprom25lcxx_status(void);
+int32_t eeprom25lcxx_wait(void);
 void eeprom25lcxx_writepage(uint16_t page, uint8_t page_size, uint8_t *data);
+int32_t eeprom25lcxx_write(uint16_t addr, uint8_t *buf, uint16_t size, uint8_t page_size);
@@ -264,6 +264,10 @@
 #define TXSTOP_INIT		0x1FFF
 /* max frame length which the conroller will accept: */
 #define MAX_FRAMELEN		1518        // (note: maximum ethernet frame length would be 1518)
+/* frames taken from the controller on each en_ll_inputv() call (reception ring size) */
+#ifndef EN_RX_FRAMES
+#define EN_RX_FRAMES		4
+#endif
 
 uint8_t *frame_in, *frame_out;
 
@@ -273,3 +277,4 @@ int32_t en_init();
 int32_t en_watchdog(void);
 void en_ll_output(uint8_t *frame, uint16_t size);
 int32_t en_ll_input(uint8_t *frame);
+int32_t en_ll_inputv(uint8_t **frames, int32_t *sizes, int32_t max);
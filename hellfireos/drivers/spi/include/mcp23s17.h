@@ -44,3 +44,17 @@ void mcp23s17_write(uint8_t device, uint8_t bank, uint8_t reg);
 void mcp23s17_inten(uint8_t device, uint8_t bank, uint8_t reg);
 void mcp23s17_init(uint8_t device, uint8_t portdir_a, uint8_t portdir_b);
 
+/*
+ * interrupt-on-change events. pins enabled with mcp23s17_intconfig() raise the INT
+ * line, which the board handler masks before calling mcp23s17_irq(). the flags and
+ * captured values are read once per interrupt by deferred work (hf_defer()), which
+ * calls irqack() to unmask the line and sets INTFA (bits 0 - 7) and INTFB (bits
+ * 8 - 15) on the event group. tasks wait with hf_evwait(ev, mask, EVENT_ANY |
+ * EVENT_CLEAR) and read the pin values latched at the interrupt with mcp23s17_intcap().
+ * intcon selects, per pin, comparison against defval (1) or the previous value (0).
+ */
+void mcp23s17_intconfig(uint8_t device, uint8_t bank, uint8_t enable, uint8_t intcon, uint8_t defval);
+int32_t mcp23s17_irqinit(uint8_t device, event_t *ev, void (*irqack)(void));
+void mcp23s17_irq(uint8_t device);
+uint8_t mcp23s17_intcap(uint8_t device, uint8_t bank);
+
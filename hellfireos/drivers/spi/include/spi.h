@@ -8,3 +8,4 @@ void spi_setup(uint32_t select, uint8_t mode);
 void spi_start(void);
 void spi_stop(void);
 int8_t spi_sendrecv(int8_t data);
+void spi_transfer(const uint8_t *tx, uint8_t *rx, uint32_t len);
@@ -8,6 +8,13 @@
 #include <spi.h>
 #include <mcp23s17.h>
 
+// interrupt-on-change state, one per hardware address
+static struct {
+	event_t *ev;
+	void (*irqack)(void);
+	uint8_t cap_a, cap_b;
+} mcp_irq[8];
+
 void mcp23s17_dir(uint8_t device, uint8_t bank, uint8_t reg)
 {
 	spi_start();
@@ -60,6 +67,99 @@ void mcp23s17_inten(uint8_t device, uint8_t bank, uint8_t reg)
 	spi_stop();
 }
 
+// configures which pins of a bank raise an interrupt and how they are compared
+void mcp23s17_intconfig(uint8_t device, uint8_t bank, uint8_t enable, uint8_t intcon, uint8_t defval)
+{
+	spi_start();
+	spi_sendrecv(MCP23x17_ADDR | ((device & 0x07) << 1));
+	if (bank)
+		spi_sendrecv(MCP23x17_DEFVALB);
+	else
+		spi_sendrecv(MCP23x17_DEFVALA);
+	spi_sendrecv(defval);
+	spi_stop();
+
+	spi_start();
+	spi_sendrecv(MCP23x17_ADDR | ((device & 0x07) << 1));
+	if (bank)
+		spi_sendrecv(MCP23x17_INTCONB);
+	else
+		spi_sendrecv(MCP23x17_INTCONA);
+	spi_sendrecv(intcon);
+	spi_stop();
+
+	mcp23s17_inten(device, bank, enable);
+}
+
+// bottom half, reads INTFA, INTFB, INTCAPA and INTCAPB in one sequential transfer
+static void mcp23s17_irqwork(void *arg)
+{
+	uint8_t device = (uint32_t)arg;
+	uint8_t intf_a, intf_b;
+
+	spi_start();
+	spi_sendrecv(MCP23x17_ADDR | (device << 1) | 0x01);
+	spi_sendrecv(MCP23x17_INTFA);
+	intf_a = spi_sendrecv(0);
+	intf_b = spi_sendrecv(0);
+	mcp_irq[device].cap_a = spi_sendrecv(0);
+	mcp_irq[device].cap_b = spi_sendrecv(0);
+	spi_stop();
+
+	// reading INTCAP cleared the interrupt, the line can be enabled again
+	if (mcp_irq[device].irqack)
+		mcp_irq[device].irqack();
+	if (intf_a | intf_b)
+		hf_evset(mcp_irq[device].ev, intf_a | (intf_b << 8));
+}
+
+// enables interrupt-on-change events on a device, INTA and INTB are mirrored
+int32_t mcp23s17_irqinit(uint8_t device, event_t *ev, void (*irqack)(void))
+{
+	uint8_t iocon;
+
+	if (hf_defer_init())
+		return -1;
+	device &= 0x07;
+	mcp_irq[device].ev = ev;
+	mcp_irq[device].irqack = irqack;
+
+	spi_start();
+	spi_sendrecv(MCP23x17_ADDR | (device << 1) | 0x01);
+	spi_sendrecv(MCP23x17_IOCON);
+	iocon = spi_sendrecv(0);
+	spi_stop();
+
+	spi_start();
+	spi_sendrecv(MCP23x17_ADDR | (device << 1));
+	spi_sendrecv(MCP23x17_IOCON);
+	spi_sendrecv(iocon | (1 << MCP23x17_IOCON_MIRROR));
+	spi_stop();
+
+	// clear a pending interrupt, so the line is released
+	mcp23s17_irqwork((void *)(uint32_t)device);
+
+	return 0;
+}
+
+// called by the board interrupt handler, with the interrupt line masked
+void mcp23s17_irq(uint8_t device)
+{
+	device &= 0x07;
+	if (mcp_irq[device].ev == 0 || hf_defer(mcp23s17_irqwork, (void *)(uint32_t)device)){
+		if (mcp_irq[device].irqack)
+			mcp_irq[device].irqack();
+	}
+}
+
+// last pin values captured on an interrupt of a bank
+uint8_t mcp23s17_intcap(uint8_t device, uint8_t bank)
+{
+	device &= 0x07;
+
+	return bank ? mcp_irq[device].cap_b : mcp_irq[device].cap_a;
+}
+
 void mcp23s17_init(uint8_t device, uint8_t portdir_a, uint8_t portdir_b)
 {
 	// configure device, enable device addressing
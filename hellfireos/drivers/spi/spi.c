@@ -49,116 +49,63 @@ void spi_stop(void)
 	_port_write(SPI_OUTPORT, tmp);
 }
 
-int8_t spi_sendrecv(int8_t data)
+/*
+ * block transfer: len bytes are shifted out from tx (zeros if tx is NULL) while len
+ * bytes are shifted in to rx (discarded if rx is NULL), most significant bit first.
+ *
+ * the output port is read once per transfer and kept on a shadow copy (with the clock
+ * at its idle level), so each bit costs two port writes and one read of MISO. data is
+ * changed together with the clock edge on which the slave does not sample it (the
+ * trailing edge of the previous bit in modes 0 and 2, the leading edge in modes 1 and
+ * 3), and the bits of each byte are unrolled. the boards route SPI devices to general
+ * purpose pins, so there is no peripheral to hand the transfer to. the port belongs to
+ * the SPI driver while a transfer is in progress.
+ */
+#define SPI_BIT_CPHA0(m) \
+	o = (d & (m)) ? o | SPI_MOSI : o & ~SPI_MOSI; \
+	_port_write(SPI_OUTPORT, o); \
+	_port_write(SPI_OUTPORT, o ^ SPI_SCK); \
+	if (_port_read(SPI_INPORT) & SPI_MISO) r |= (m);
+
+#define SPI_BIT_CPHA1(m) \
+	o = (d & (m)) ? o | SPI_MOSI : o & ~SPI_MOSI; \
+	_port_write(SPI_OUTPORT, o ^ SPI_SCK); \
+	_port_write(SPI_OUTPORT, o); \
+	if (_port_read(SPI_INPORT) & SPI_MISO) r |= (m);
+
+void spi_transfer(const uint8_t *tx, uint8_t *rx, uint32_t len)
 {
-	int32_t i;
-	uint32_t tmp;
-	int8_t newdata = 0;
-
-	switch (port_mode){
-	case 0:
-		for (i = 0; i < 8; i++){
-			if (data & 0x80){
-				tmp = _port_read(SPI_OUTPORT);
-				tmp |= SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}else{
-				tmp = _port_read(SPI_OUTPORT);
-				tmp &= ~SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}
-			data <<= 1;
-			
-			tmp = _port_read(SPI_OUTPORT);
-			tmp |= SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-			
-			newdata <<= 1;
-			newdata |= ((_port_read(SPI_INPORT) & SPI_MISO) ? 1 : 0);
-			
-			tmp = _port_read(SPI_OUTPORT);
-			tmp &= ~SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-		}
-		break;
-	case 1:
-		for (i = 0; i < 8; i++){
-			tmp = _port_read(SPI_OUTPORT);
-			tmp |= SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-			
-			if (data & 0x80){
-				tmp = _port_read(SPI_OUTPORT);
-				tmp |= SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}else{
-				tmp = _port_read(SPI_OUTPORT);
-				tmp &= ~SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}
-			data <<= 1;
-			
-			tmp = _port_read(SPI_OUTPORT);
-			tmp &= ~SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-			
-			newdata <<= 1;
-			newdata |= ((_port_read(SPI_INPORT) & SPI_MISO) ? 1 : 0);
-		}
-		break;
-	case 2:
-		for (i = 0; i < 8; i++){
-			if (data & 0x80){
-				tmp = _port_read(SPI_OUTPORT);
-				tmp |= SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}else{
-				tmp = _port_read(SPI_OUTPORT);
-				tmp &= ~SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}
-			data <<= 1;
-			
-			tmp = _port_read(SPI_OUTPORT);
-			tmp &= ~SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-			
-			newdata <<= 1;
-			newdata |= ((_port_read(SPI_INPORT) & SPI_MISO) ? 1 : 0);
-			
-			tmp = _port_read(SPI_OUTPORT);
-			tmp |= SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-		}
-		break;
-	case 3:
-		for (i = 0; i < 8; i++){
-			tmp = _port_read(SPI_OUTPORT);
-			tmp &= ~SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-			
-			if (data & 0x80){
-				tmp = _port_read(SPI_OUTPORT);
-				tmp |= SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}else{
-				tmp = _port_read(SPI_OUTPORT);
-				tmp &= ~SPI_MOSI;
-				_port_write(SPI_OUTPORT, tmp);
-			}
-			data <<= 1;
-			
-			tmp = _port_read(SPI_OUTPORT);
-			tmp |= SPI_SCK;
-			_port_write(SPI_OUTPORT, tmp);
-			
-			newdata <<= 1;
-			newdata |= ((_port_read(SPI_INPORT) & SPI_MISO) ? 1 : 0);
+	uint32_t o;
+	uint8_t d, r;
+
+	o = _port_read(SPI_OUTPORT);
+	if (port_mode == 0 || port_mode == 1)
+		o &= ~SPI_SCK;
+	else
+		o |= SPI_SCK;
+
+	while (len--){
+		d = tx ? *tx++ : 0;
+		r = 0;
+		if (port_mode == 0 || port_mode == 2){
+			SPI_BIT_CPHA0(0x80) SPI_BIT_CPHA0(0x40) SPI_BIT_CPHA0(0x20) SPI_BIT_CPHA0(0x10)
+			SPI_BIT_CPHA0(0x08) SPI_BIT_CPHA0(0x04) SPI_BIT_CPHA0(0x02) SPI_BIT_CPHA0(0x01)
+		}else{
+			SPI_BIT_CPHA1(0x80) SPI_BIT_CPHA1(0x40) SPI_BIT_CPHA1(0x20) SPI_BIT_CPHA1(0x10)
+			SPI_BIT_CPHA1(0x08) SPI_BIT_CPHA1(0x04) SPI_BIT_CPHA1(0x02) SPI_BIT_CPHA1(0x01)
 		}
-		break;
-	default:
-		break;
+		if (rx) *rx++ = r;
 	}
+	/* back to the idle clock level */
+	_port_write(SPI_OUTPORT, o);
+}
+
+int8_t spi_sendrecv(int8_t data)
+{
+	uint8_t d, r;
+
+	d = data;
+	spi_transfer(&d, &r, 1);
 
-	return newdata;
+	return r;
 }
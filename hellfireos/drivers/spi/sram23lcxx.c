@@ -18,30 +18,24 @@
 
 void sram25lcxx_read(uint32_t addr, uint8_t hiaddr, uint8_t *buf, uint32_t size)
 {
-	uint32_t i;
-	
 	spi_start();
 	spi_sendrecv(CMD_READ);
 	if (hiaddr)
 		spi_sendrecv((addr >> 16) & 0xff);
 	spi_sendrecv((addr >> 8) & 0xff);
 	spi_sendrecv(addr & 0xff);
-	for(i = 0; i < size; i++)
-		buf[i] = spi_sendrecv(0);
+	spi_transfer(NULL, buf, size);
 	spi_stop();
 }
 
 void sram25lcxx_write(uint32_t addr, uint8_t hiaddr, uint8_t *buf, uint32_t size)
 {
-	uint32_t i;
-	
 	spi_start();
 	spi_sendrecv(CMD_WRITE);
 	if (hiaddr)
 		spi_sendrecv((addr >> 16) & 0xff);
 	spi_sendrecv((addr >> 8) & 0xff);
 	spi_sendrecv(addr & 0xff);
-	for(i = 0; i < size; i++)
-		spi_sendrecv(buf[i]);
+	spi_transfer(buf, NULL, size);
 	spi_stop();
 }
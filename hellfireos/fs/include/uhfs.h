@@ -1,5 +1,18 @@
 #define UHFS_DEBUG	1
 
+#ifndef UHFS_CACHE_BLOCKS
+#define UHFS_CACHE_BLOCKS	8		/* blocks kept in the buffer cache of a mounted volume (at least 1) */
+#endif
+#ifndef UHFS_DCACHE_SIZE
+#define UHFS_DCACHE_SIZE	16		/* directory entries kept in the dentry cache (power of 2) */
+#endif
+#ifndef UHFS_FSLOT_SIZE
+#define UHFS_FSLOT_SIZE		8		/* directories kept in the free entry index (power of 2) */
+#endif
+#ifndef UHFS_READAHEAD
+#define UHFS_READAHEAD		4		/* blocks read ahead on sequential file reads (up to half of the cache) */
+#endif
+
 #define UHFS_FIXDBLK	0xfffffffc		/* fixed / not allocatable */
 #define UHFS_DEADBLK	0xfffffffd		/* invalid (dead block) */
 #define UHFS_EOCHBLK	0xfffffffe		/* last block in the chain (end of file or end of chain of cluster map blocks) */
@@ -18,6 +31,7 @@
 #define UHFS_APPEND	0x0008
 #define UHFS_SYNC	0x0010
 #define UHFS_NONBLOCK	0x0020
+#define UHFS_MODIFIED	0x2000
 #define UHFS_EOF	0x4000
 #define UHFS_OPENFILE	0x8000
 
@@ -81,6 +95,28 @@ union fs_datablock {
 	struct fs_direntry *dir_data;
 };
 
+struct fs_cacheblk {
+	uint32_t block;				/* cached block, UHFS_FREEBLK if the slot is unused */
+	uint32_t age;				/* last use, for LRU replacement */
+	uint8_t dirty;				/* modified, not written to the device yet */
+	int8_t *data;
+};
+
+struct fs_dentry {
+	uint32_t parent;			/* first block of the directory, 0 if the slot is unused */
+	uint32_t block;				/* directory block and index of the entry */
+	uint32_t index;
+	uint32_t first_block;
+	uint8_t attributes;
+	int8_t name[39];
+};
+
+struct fs_fslot {
+	uint32_t dir;				/* first block of the directory, 0 if the slot is unused */
+	uint32_t block;				/* block and index of a free entry of the directory */
+	uint32_t index;
+};
+
 struct fs_blkdevice {
 	/* these structures remain fixed after the filesystem is initialized */
 	struct blk_info fsblk_info;
@@ -89,6 +125,21 @@ struct fs_blkdevice {
 	/* these structures change during filesystem usage */
 	struct fs_direntry fsdirentry;
 	union fs_datablock datablock;
+	/* block buffer cache (write back, flushed by hf_sync() and hf_umount()) */
+	struct fs_cacheblk cache[UHFS_CACHE_BLOCKS];
+	uint32_t cache_clock;
+	int8_t *cache_data;
+	uint8_t mapped;				/* memory backed device, blocks are read in place (DISK_MAP) */
+	/* directory entry lookup cache */
+	struct fs_dentry dcache[UHFS_DCACHE_SIZE];
+	/* free directory entry index */
+	struct fs_fslot fslot[UHFS_FSLOT_SIZE];
+	uint16_t handles;			/* open files and directories */
+	/* free space summary (built on mount) */
+	uint16_t *cmb_free;			/* free blocks on each cluster map block */
+	uint32_t cmb_count;
+	uint32_t free_blocks;
+	uint32_t free_hint;			/* no block below this one is free */
 };
 
 struct file {
@@ -98,12 +149,22 @@ struct file {
 	int32_t flags;
 	uint32_t block;
 	int64_t offset;
+	/* regular files only */
+	uint32_t blk_index;			/* position of block in the file chain */
+	int64_t size;
+	uint32_t dir_block;			/* directory block and entry of the file */
+	uint32_t dir_index;
+	uint32_t ra_index;			/* last block read, to detect sequential reads */
+	int8_t *buf;				/* block buffer, coalesces partial block writes */
+	uint32_t buf_block;			/* block held in buf, UHFS_FREEBLK if none */
+	uint8_t buf_dirty;
 };
 
 /* volume management */
 int32_t hf_mkfs(struct device *dev, uint32_t blk_size);
 int32_t hf_mount(struct device *dev);
 int32_t hf_umount(struct device *dev);
+int32_t hf_sync(struct device *dev);
 int32_t hf_getfree(struct device *dev);
 int32_t hf_getlabel(struct device *dev, int8_t *label);
 int32_t hf_setlabel(struct device *dev, int8_t *label);
@@ -130,3 +191,6 @@ size_t hf_fwrite(void *buf, int32_t isize, size_t items, struct file *desc);
 int32_t hf_fseek(struct file *desc, int64_t offset, int32_t whence);
 int64_t hf_ftell(struct file *desc);
 int32_t hf_feof(struct file *desc);
+
+/* loadable modules */
+int32_t hf_module_fload(struct device *dev, int8_t *path, struct module *m);
@@ -24,53 +24,351 @@ static int32_t test_pot(uint32_t val)
 	}
 }
 
+/* device transfers of whole blocks (a block is made of one or more sectors) */
+static int32_t dev_readblk(struct device *dev, uint32_t blk, void *buf, uint32_t count)
+{
+	struct fs_blkdevice *blk_device;
+	uint32_t spb;
+	
+	blk_device = dev->ptr;
+	spb = blk_device->fssblock.block_size / blk_device->fsblk_info.bytes_sector;
+	
+	return hf_dev_readblk(dev, blk * spb, buf, count * spb);
+}
+
+static int32_t dev_writeblk(struct device *dev, uint32_t blk, void *buf, uint32_t count)
+{
+	struct fs_blkdevice *blk_device;
+	uint32_t spb;
+	
+	blk_device = dev->ptr;
+	spb = blk_device->fssblock.block_size / blk_device->fsblk_info.bytes_sector;
+	
+	return hf_dev_writeblk(dev, blk * spb, buf, count * spb);
+}
+
+/* block buffer cache. blocks are copied from / to the cache, and written back to the
+ * device only when evicted (least recently used first) or on hf_sync(). */
+static struct fs_cacheblk *cache_find(struct fs_blkdevice *blk_device, uint32_t blk)
+{
+	uint32_t i;
+
+	for (i = 0; i < UHFS_CACHE_BLOCKS; i++)
+		if (blk_device->cache[i].block == blk)
+			return &blk_device->cache[i];
+
+	return 0;
+}
+
+static struct fs_cacheblk *cache_get(struct device *dev, uint32_t blk, int32_t fill)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb, *lru;
+	uint32_t i;
+
+	blk_device = dev->ptr;
+	lru = &blk_device->cache[0];
+	for (i = 0; i < UHFS_CACHE_BLOCKS; i++) {
+		cb = &blk_device->cache[i];
+		if (cb->block == blk) {
+			cb->age = ++blk_device->cache_clock;
+			return cb;
+		}
+		if (cb->block == UHFS_FREEBLK || (lru->block != UHFS_FREEBLK && cb->age < lru->age))
+			lru = cb;
+	}
+
+	/* miss: evict the least recently used block, writing it back if modified */
+	cb = lru;
+	if (cb->block != UHFS_FREEBLK && cb->dirty) {
+		if (dev_writeblk(dev, cb->block, cb->data, 1))
+			return 0;
+	}
+	cb->block = UHFS_FREEBLK;
+	cb->dirty = 0;
+	if (fill) {
+		if (dev_readblk(dev, blk, cb->data, 1))
+			return 0;
+	}
+	cb->block = blk;
+	cb->age = ++blk_device->cache_clock;
+
+	return cb;
+}
+
+/* read only access to a block: the cached copy, the device memory of memory backed
+ * devices or else a copy loaded into the cache. the pointer is valid until the next
+ * block access. */
+static int8_t *blk_map(struct device *dev, uint32_t blk)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb;
+	struct blk_map map;
+
+	blk_device = dev->ptr;
+	cb = cache_find(blk_device, blk);
+	if (cb) {
+		cb->age = ++blk_device->cache_clock;
+		return cb->data;
+	}
+	if (blk_device->mapped) {
+		map.sector = blk * (blk_device->fssblock.block_size / blk_device->fsblk_info.bytes_sector);
+		if (!hf_dev_ioctl(dev, DISK_MAP, &map))
+			return map.ptr;
+	}
+	cb = cache_get(dev, blk, 1);
+	if (!cb) return 0;
+
+	return cb->data;
+}
+
+static int32_t blk_read(struct device *dev, uint32_t blk, void *buf)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb;
+
+	blk_device = dev->ptr;
+	cb = cache_get(dev, blk, 1);
+	if (!cb) return -1;
+	memcpy(buf, cb->data, blk_device->fssblock.block_size);
+
+	return 0;
+}
+
+static int32_t blk_write(struct device *dev, uint32_t blk, void *buf)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb;
+
+	blk_device = dev->ptr;
+	/* the whole block is rewritten, so there is no need to read it on a miss */
+	cb = cache_get(dev, blk, 0);
+	if (!cb) return -1;
+	memcpy(cb->data, buf, blk_device->fssblock.block_size);
+	cb->dirty = 1;
+
+	return 0;
+}
+
+/* cluster map entry of a block (the next block of its chain) */
+static uint32_t nextblock(struct device *dev, uint32_t blk)
+{
+	struct fs_blkdevice *blk_device;
+	uint32_t n, *cmb_data;
+	
+	blk_device = dev->ptr;
+	n = blk_device->fssblock.block_size / sizeof(uint32_t);
+	cmb_data = (uint32_t *)blk_map(dev, ((blk - 1) & ~(n - 1)) + 1);
+	if (!cmb_data) return 0;
+	
+	return cmb_data[(blk - 1) & (n - 1)];
+}
+
+static int32_t setnextblock(struct device *dev, uint32_t blk, uint32_t next)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb;
+	uint32_t n, *entry;
+	
+	blk_device = dev->ptr;
+	n = blk_device->fssblock.block_size / sizeof(uint32_t);
+	cb = cache_get(dev, ((blk - 1) & ~(n - 1)) + 1, 1);
+	if (!cb) return -1;
+	entry = &((uint32_t *)cb->data)[(blk - 1) & (n - 1)];
+	
+	/* keep the free space summary */
+	if (*entry == UHFS_FREEBLK && next != UHFS_FREEBLK) {
+		blk_device->cmb_free[(blk - 1) / n]--;
+		blk_device->free_blocks--;
+	} else if (*entry != UHFS_FREEBLK && next == UHFS_FREEBLK) {
+		blk_device->cmb_free[(blk - 1) / n]++;
+		blk_device->free_blocks++;
+		if (blk < blk_device->free_hint)
+			blk_device->free_hint = blk;
+	}
+	*entry = next;
+	cb->dirty = 1;
+	
+	return 0;
+}
+
+/* allocate a block. the free space summary built on mount (free blocks per cluster map
+ * block and the lowest block that may be free) avoids scanning full storage regions. */
 static uint32_t getfreeblock(struct device *dev)
 {
 	struct fs_blkdevice *blk_device;
-	uint32_t j, chain_blk;
+	struct fs_cacheblk *cb;
+	uint32_t j, n, r, chain_blk;
 	
 	blk_device = dev->ptr;
+	n = blk_device->fssblock.block_size / sizeof(uint32_t);
 	
-	/* find a free block, starting from the first cluster map block */
-	chain_blk = blk_device->fssblock.first_cmb;
-	while (1) {
-		if (chain_blk == UHFS_EOCHBLK) {
+	if (blk_device->free_blocks) {
+		for (r = (blk_device->free_hint - 1) / n; r < blk_device->cmb_count; r++) {
+			if (!blk_device->cmb_free[r]) continue;
+			
+			chain_blk = r * n + 1;
+			cb = cache_get(dev, chain_blk, 1);
+			if (!cb) return 0;
+			j = blk_device->free_hint > chain_blk ? blk_device->free_hint - chain_blk : 1;
+			for (; j < n; j++)
+				if (((uint32_t *)cb->data)[j] == UHFS_FREEBLK) break;
+			if (j < n) {
 #if UHFS_DEBUG == 1
-			kprintf("\ngetfreeblock: storage device is full");
+				kprintf("\nfree blk at %d", chain_blk + j);
 #endif
-			return 0;
+				/* update the cluster map block */
+				if (setnextblock(dev, chain_blk + j, UHFS_EOCHBLK)) return 0;
+				blk_device->free_hint = chain_blk + j + 1;
+				
+				return chain_blk + j;
+			}
 		}
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk);
-		hf_dev_read(dev, blk_device->datablock.cmb_data, 1);
-		for (j = 1; j < blk_device->fssblock.block_size / sizeof(uint32_t); j++)
-			if (blk_device->datablock.cmb_data[j] == UHFS_FREEBLK) break;
-
-		if (j < blk_device->fssblock.block_size / sizeof(uint32_t)) break;
-						
-		chain_blk = blk_device->datablock.cmb_data[0];
 	}
 #if UHFS_DEBUG == 1
-	kprintf("\nfree blk at %d", chain_blk + j);
-#endif			
-	/* update the cluster map block */
-	blk_device->datablock.cmb_data[j] = UHFS_EOCHBLK;
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk);
-	hf_dev_write(dev, blk_device->datablock.cmb_data, 1);
+	kprintf("\ngetfreeblock: storage device is full");
+#endif
+	return 0;
+}
+
+/* allocate a block, preferring the goal block (the one after the last block of a file),
+ * so files grow in contiguous runs when the space allows */
+static uint32_t allocblock(struct device *dev, uint32_t goal)
+{
+	struct fs_blkdevice *blk_device;
+	uint32_t n;
+	
+	blk_device = dev->ptr;
+	n = blk_device->fssblock.block_size / sizeof(uint32_t);
+	
+	/* the first block of a storage region is its cluster map block, skip it */
+	if (((goal - 1) & (n - 1)) == 0)
+		goal++;
+	if (goal > blk_device->fssblock.first_cmb && goal < blk_device->fssblock.n_blocks && nextblock(dev, goal) == UHFS_FREEBLK) {
+		if (setnextblock(dev, goal, UHFS_EOCHBLK)) return 0;
+		if (goal == blk_device->free_hint)
+			blk_device->free_hint++;
+		
+		return goal;
+	}
+	
+	return getfreeblock(dev);
+}
+
+static void freechain(struct device *dev, uint32_t blk)
+{
+	uint32_t next;
+	
+	while (blk && blk != UHFS_EOCHBLK) {
+		next = nextblock(dev, blk);
+		setnextblock(dev, blk, UHFS_FREEBLK);
+		blk = next;
+	}
+}
+
+/* next element of a path (the path is modified, as with strtok(), but the position is kept
+ * by the caller) */
+static int8_t *pathname(int8_t **path)
+{
+	int8_t *s;
+	
+	s = *path;
+	while (*s == ' ' || *s == '/')
+		s++;
+	if (!*s) {
+		*path = s;
+		return 0;
+	}
+	*path = s;
+	while (**path && **path != ' ' && **path != '/')
+		(*path)++;
+	if (**path)
+		*(*path)++ = '\0';
 	
-	return chain_blk + j;
+	return s;
 }
 
-static int32_t searchdirectory(struct device *dev, int8_t *path, uint32_t *pblock, int8_t **ppath, uint32_t *lblock, int8_t **lpath)
+/* directory entry (dentry) cache. a direct mapped table, indexed by a hash of the
+ * directory (its first block) and the name. */
+static struct fs_dentry *dcache_slot(struct fs_blkdevice *blk_device, uint32_t dir_blk, int8_t *name)
+{
+	uint32_t h;
+	
+	h = dir_blk;
+	while (*name)
+		h = h * 31 + (uint8_t)*name++;
+	
+	return &blk_device->dcache[(h ^ (h >> 8)) & (UHFS_DCACHE_SIZE - 1)];
+}
+
+/* invalidate the cached dentry of an entry (block and index), and dentries of
+ * entries found on a directory (dir_blk) */
+static void dcache_drop(struct device *dev, uint32_t blk, uint32_t idx, uint32_t dir_blk)
 {
 	struct fs_blkdevice *blk_device;
-	int32_t found;
-	uint32_t i, chain_blk, dir_blk, dir_blk_next, first_dir_blk;
+	uint32_t i;
+	
+	blk_device = dev->ptr;
+	for (i = 0; i < UHFS_DCACHE_SIZE; i++) {
+		if ((blk_device->dcache[i].block == blk && blk_device->dcache[i].index == idx) ||
+			(dir_blk && blk_device->dcache[i].parent == dir_blk))
+			blk_device->dcache[i].parent = 0;
+	}
+}
+
+/* search a name in a directory (given its first block). returns the dentry (block and
+ * index of the entry, first block and attributes of the file). */
+static int32_t scandirectory(struct device *dev, uint32_t dir_blk, int8_t *name, struct fs_dentry *dentry)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_direntry *dir_data;
+	struct fs_dentry *slot;
+	uint32_t i, blk;
+	
+	blk_device = dev->ptr;
+	slot = dcache_slot(blk_device, dir_blk, name);
+	if (slot->parent == dir_blk && !strcmp(slot->name, name)) {
+		*dentry = *slot;
+		return 0;
+	}
+	
+	blk = dir_blk;
+	while (blk && blk != UHFS_EOCHBLK) {
+		dir_data = (struct fs_direntry *)blk_map(dev, blk);
+		if (!dir_data) return -1;
+		for (i = 0; i < blk_device->fssblock.block_size / sizeof(struct fs_direntry); i++) {
+			if (!(dir_data[i].attributes & UHFS_ATTRFREE) && !strcmp(dir_data[i].filename, name)) {
+				slot->parent = dir_blk;
+				slot->block = blk;
+				slot->index = i;
+				slot->first_block = dir_data[i].first_block;
+				slot->attributes = dir_data[i].attributes;
+				strcpy(slot->name, dir_data[i].filename);
+				*dentry = *slot;
+				return 0;
+			}
+		}
+		blk = nextblock(dev, blk);
+	}
+	
+	return -1;
+}
 
+/* follow a path of directories up to a missing last element. returns the block of the entry of
+ * the last directory found (pblock), the first block of the directory holding it (pdir), its
+ * name (ppath), the first block of the last directory (lblock) and the missing name (lpath). */
+static int32_t searchdirectory(struct device *dev, int8_t *path, uint32_t *pblock, uint32_t *pdir, int8_t **ppath, uint32_t *lblock, int8_t **lpath)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_dentry dentry;
+	int32_t found = 0;
+	uint32_t dir_blk;
+	int8_t *name;
 	
 	blk_device = dev->ptr;
-	path = strtok(path, " /");
+	name = pathname(&path);
 
-	if (!path) {
+	if (!name) {
 #if UHFS_DEBUG == 1
 		kprintf("\nsearchdirectory: path not found");
 #endif
@@ -78,59 +376,34 @@ static int32_t searchdirectory(struct device *dev, int8_t *path, uint32_t *pbloc
 	}
 	
 	/* search the path, following the directory tree */
-	chain_blk = blk_device->fssblock.first_cmb;
 	dir_blk = blk_device->fssblock.root_dir_block;
-	first_dir_blk = dir_blk;
 	*pblock = 0;
-	while (path != NULL) {
-		found = 0;
-		do {
-			hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk);
-			hf_dev_read(dev, blk_device->datablock.cmb_data, 1);
-			dir_blk_next = blk_device->datablock.cmb_data[(dir_blk - 1) & (blk_device->fssblock.block_size / sizeof(uint32_t) - 1)];
-#if UHFS_DEBUG == 1
-			kprintf("\nchain %d dir_blk_next: %d", chain_blk, dir_blk_next);
-#endif
-			hf_dev_ioctl(dev, DISK_SEEKSET, (void *)dir_blk);
-			hf_dev_read(dev, blk_device->datablock.dir_data, 1);
-
-			for (i = 0; i < blk_device->fssblock.block_size / sizeof(struct fs_direntry) && !found; i++) {
-				if (!(blk_device->datablock.dir_data[i].attributes & UHFS_ATTRFREE)) {
-					if (strcmp(blk_device->datablock.dir_data[i].filename, path) == 0) {
-						if (blk_device->datablock.dir_data[i].attributes & UHFS_ATTRDIR) {
-							found = 1;
-							*pblock = dir_blk;
-							*ppath = path;
-							dir_blk = blk_device->datablock.dir_data[i].first_block;
-							first_dir_blk = dir_blk;
-						} else {
-#if UHFS_DEBUG == 1
-							kprintf("\nsearchdirectory: %s is not a directory", blk_device->datablock.dir_data[i].filename);
-#endif
-							return -1;
-						}
-					}
-				}
+	*pdir = 0;
+	while (name) {
+		found = !scandirectory(dev, dir_blk, name, &dentry);
+		if (found) {
+			if (!(dentry.attributes & UHFS_ATTRDIR)) {
+#if UHFS_DEBUG == 1
+				kprintf("\nsearchdirectory: %s is not a directory", dentry.name);
+#endif
+				return -1;
 			}
-			if (found) break;
-
-			chain_blk = ((dir_blk_next-1) & ~(blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) + 1;
-			dir_blk = dir_blk_next;
-			if (dir_blk < 0 || (dir_blk > blk_device->fssblock.n_blocks * blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) break;
-			
-		} while (dir_blk_next != UHFS_EOCHBLK);
+			*pblock = dentry.block;
+			*pdir = dir_blk;
+			*ppath = name;
+			dir_blk = dentry.first_block;
+		}
 		
-		*lpath = path;
-		path = strtok(NULL, " /");
+		*lpath = name;
+		name = pathname(&path);
 		if (!found) {
-			if (path) {
+			if (name) {
 #if UHFS_DEBUG == 1
 				kprintf("\nsearchdirectory: path not found");
 #endif
 				return -1;
 			}
 			break;
-			
 		}
 	}
 	
@@ -141,17 +414,270 @@ static int32_t searchdirectory(struct device *dev, int8_t *path, uint32_t *pbloc
 		return -1;
 	}
 	
-	*lblock = first_dir_blk;
+	*lblock = dir_blk;
+	
+	return 0;
+}
+
+/* find the entry of a path. returns 0 if found, 1 if only the last element is missing (the
+ * parent directory and the name are returned) or -1 if the path is invalid. path is modified. */
+static int32_t findentry(struct device *dev, int8_t *path, uint32_t *parent, uint32_t *blk, uint32_t *idx, int8_t **name)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_dentry dentry;
+	uint32_t dir_blk;
+	int8_t *elem, *next;
+	
+	blk_device = dev->ptr;
+	dir_blk = blk_device->fssblock.root_dir_block;
+	elem = pathname(&path);
+	while (elem) {
+		next = pathname(&path);
+		if (scandirectory(dev, dir_blk, elem, &dentry)) {
+			if (next) return -1;
+			*parent = dir_blk;
+			*name = elem;
+			return 1;
+		}
+		if (!next) {
+			*parent = dir_blk;
+			*blk = dentry.block;
+			*idx = dentry.index;
+			*name = elem;
+			return 0;
+		}
+		if (!(dentry.attributes & UHFS_ATTRDIR)) {
+#if UHFS_DEBUG == 1
+			kprintf("\nfindentry: %s is not a directory", dentry.name);
+#endif
+			return -1;
+		}
+		dir_blk = dentry.first_block;
+		elem = next;
+	}
+
+	return -1;
+}
+
+/* free entry index. a direct mapped table, indexed by the directory (its first block), keeping
+ * a free entry of recently changed directories, so new entries don't scan them. */
+static struct fs_fslot *fslot_slot(struct fs_blkdevice *blk_device, uint32_t dir_blk)
+{
+	return &blk_device->fslot[(dir_blk ^ (dir_blk >> 4)) & (UHFS_FSLOT_SIZE - 1)];
+}
+
+/* invalidate free entries kept on a block (blk) or of a directory (dir_blk) */
+static void fslot_drop(struct fs_blkdevice *blk_device, uint32_t blk, uint32_t dir_blk)
+{
+	uint32_t i;
+	
+	for (i = 0; i < UHFS_FSLOT_SIZE; i++) {
+		if (blk_device->fslot[i].dir && (blk_device->fslot[i].block == blk || blk_device->fslot[i].dir == dir_blk))
+			blk_device->fslot[i].dir = 0;
+	}
+}
+
+/* find a free entry in a directory, extending it if full. the entry kept on the free entry
+ * index is taken first, and the next free entry of the same block is kept in its place. */
+static int32_t newentry(struct device *dev, uint32_t dir_blk, uint32_t *blk, uint32_t *idx)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb;
+	struct fs_direntry *dir_data;
+	struct fs_fslot *fs;
+	uint32_t i, j, k, n, first, last = 0;
+	
+	blk_device = dev->ptr;
+	n = blk_device->fssblock.block_size / sizeof(struct fs_direntry);
+	fs = fslot_slot(blk_device, dir_blk);
+	first = dir_blk;
+	if (fs->dir == dir_blk) {
+		fs->dir = 0;
+		dir_data = (struct fs_direntry *)blk_map(dev, fs->block);
+		if (dir_data && (dir_data[fs->index].attributes & UHFS_ATTRFREE)) {
+			*blk = fs->block;
+			*idx = fs->index;
+			for (j = fs->index + 1; j < n; j++) {
+				if (dir_data[j].attributes & UHFS_ATTRFREE) {
+					fs->dir = first;
+					fs->index = j;
+					break;
+				}
+			}
+			return 0;
+		}
+	}
+	
+	while (dir_blk && dir_blk != UHFS_EOCHBLK) {
+		cb = cache_get(dev, dir_blk, 1);
+		if (!cb) return -1;
+		dir_data = (struct fs_direntry *)cb->data;
+		for (i = 0; i < n; i++) {
+			if (dir_data[i].attributes & UHFS_ATTRFREE) {
+				*blk = dir_blk;
+				*idx = i;
+				for (j = i + 1; j < n; j++) {
+					if (dir_data[j].attributes & UHFS_ATTRFREE) {
+						fs->dir = first;
+						fs->block = dir_blk;
+						fs->index = j;
+						break;
+					}
+				}
+				return 0;
+			}
+		}
+		last = dir_blk;
+		dir_blk = nextblock(dev, dir_blk);
+	}
+	if (!last) return -1;
+	
+	/* directory is full, extend it with an empty block */
+	k = getfreeblock(dev);
+	if (!k) return -1;
+	cb = cache_get(dev, k, 0);
+	if (!cb) return -1;
+	memset(cb->data, 0, blk_device->fssblock.block_size);
+	dir_data = (struct fs_direntry *)cb->data;
+	for (i = 0; i < n; i++)
+		dir_data[i].attributes = UHFS_ATTRFREE;
+	cb->dirty = 1;
+	setnextblock(dev, last, k);
+	*blk = k;
+	*idx = 0;
+	if (n > 1) {
+		fs->dir = first;
+		fs->block = k;
+		fs->index = 1;
+	}
+	
+	return 0;
+}
+
+/* an entry (blk and idx) of a directory (dir_blk, its first block) was freed. the block is
+ * given back if it has no entries left and isn't the first one of the directory, otherwise
+ * the entry is kept on the free entry index. descriptors keep blocks of directories (the
+ * entry of a file, the next block of a listing), so blocks are not given back while files
+ * or directories of the volume are open. */
+static void freeentry(struct device *dev, uint32_t dir_blk, uint32_t blk, uint32_t idx)
+{
+	struct fs_blkdevice *blk_device;
+	struct fs_direntry *dir_data;
+	struct fs_fslot *fs;
+	uint32_t i, n, prev, next;
+	
+	blk_device = dev->ptr;
+	n = blk_device->fssblock.block_size / sizeof(struct fs_direntry);
+	if (blk != dir_blk && !blk_device->handles) {
+		dir_data = (struct fs_direntry *)blk_map(dev, blk);
+		if (dir_data) {
+			for (i = 0; i < n; i++)
+				if (!(dir_data[i].attributes & UHFS_ATTRFREE)) break;
+			if (i == n) {
+				/* unlink the block from the directory chain */
+				prev = dir_blk;
+				while (prev && prev != UHFS_EOCHBLK) {
+					next = nextblock(dev, prev);
+					if (next == blk) break;
+					prev = next;
+				}
+				if (prev && prev != UHFS_EOCHBLK) {
+#if UHFS_DEBUG == 1
+					kprintf("\nfreeentry: directory block %d is empty, freeing it", blk);
+#endif
+					setnextblock(dev, prev, nextblock(dev, blk));
+					setnextblock(dev, blk, UHFS_FREEBLK);
+					fslot_drop(blk_device, blk, 0);
+					return;
+				}
+			}
+		}
+	}
+	
+	fs = fslot_slot(blk_device, dir_blk);
+	fs->dir = dir_blk;
+	fs->block = blk;
+	fs->index = idx;
+}
+
+/* block of a file at a position of its chain, optionally extending the file */
+static uint32_t fileblock(struct file *desc, uint32_t index, int32_t alloc)
+{
+	uint32_t next;
+	
+	if (index < desc->blk_index) {
+		desc->block = desc->first_block;
+		desc->blk_index = 0;
+	}
+	while (desc->blk_index < index) {
+		next = nextblock(desc->dev, desc->block);
+		if (!next) return 0;
+		if (next == UHFS_EOCHBLK) {
+			if (!alloc) return 0;
+			next = allocblock(desc->dev, desc->block + 1);
+			if (!next || setnextblock(desc->dev, desc->block, next)) return 0;
+		}
+		desc->block = next;
+		desc->blk_index++;
+	}
+	
+	return desc->block;
+}
+
+/* write the file buffer back (to the block cache) */
+static int32_t fileflush(struct file *desc)
+{
+	if (desc->buf_dirty) {
+		if (blk_write(desc->dev, desc->buf_block, desc->buf)) return -1;
+		desc->buf_dirty = 0;
+	}
+	
+	return 0;
+}
+
+/* update the size on the directory entry of a file */
+static int32_t filesize(struct file *desc)
+{
+	struct fs_cacheblk *cb;
+	
+	cb = cache_get(desc->dev, desc->dir_block, 1);
+	if (!cb) return -1;
+	((struct fs_direntry *)cb->data)[desc->dir_index].size = desc->size;
+	cb->dirty = 1;
+	desc->flags &= ~UHFS_MODIFIED;
 	
 	return 0;
 }
 
+/* on sequential reads, bring the next blocks of the file to the cache */
+static void readahead(struct file *desc, uint32_t index, uint32_t blk)
+{
+	struct fs_blkdevice *blk_device;
+	uint32_t i, count, last;
+	
+	if (index == desc->ra_index) return;
+	i = desc->ra_index;
+	desc->ra_index = index;
+	if (index != i + 1) return;
+	
+	/* blocks of memory backed devices are read in place */
+	blk_device = desc->dev->ptr;
+	if (blk_device->mapped) return;
+	count = UHFS_READAHEAD < UHFS_CACHE_BLOCKS / 2 ? UHFS_READAHEAD : UHFS_CACHE_BLOCKS / 2;
+	last = (desc->size - 1) / blk_device->fssblock.block_size;
+	for (i = index + 1; i <= index + count && i <= last; i++) {
+		blk = nextblock(desc->dev, blk);
+		if (!blk || blk == UHFS_EOCHBLK) break;
+		if (!cache_get(desc->dev, blk, 1)) break;
+	}
+}
+
 /* volume management */
 int32_t hf_mkfs(struct device *dev, uint32_t blk_size)
 {
 	struct blk_info fsblk_info;
 	struct fs_blkdevice blk_device;
-	uint32_t i, k;
+	uint32_t i, k, spb;
 
 	if (dev->ptr) {
 #if UHFS_DEBUG == 1
@@ -184,6 +710,8 @@ int32_t hf_mkfs(struct device *dev, uint32_t blk_size)
 	strncpy(blk_device.fssblock.oem_id, "uhfs_uhfs_uhfs", sizeof(blk_device.fssblock.oem_id));
 	blk_device.fssblock.block_size = blk_size;
 	blk_device.fssblock.n_blocks = blk_device.vsize / blk_size;
+	/* a block may span several sectors, so sectors past the last whole block are not used */
+	blk_device.vsize = (uint64_t)blk_device.fssblock.n_blocks * blk_size;
 	strncpy(blk_device.fssblock.volume_label, "new volume", sizeof(blk_device.fssblock.volume_label));
 	blk_device.fssblock.vdate.day = 1;
 	blk_device.fssblock.vdate.month = 1;
@@ -204,8 +732,8 @@ int32_t hf_mkfs(struct device *dev, uint32_t blk_size)
 	/* write the superblock */
 	memcpy(blk_device.datablock.data, &blk_device.fssblock, sizeof(struct fs_superblock));
 	memset(blk_device.datablock.data + sizeof(struct fs_superblock), 0, blk_size - sizeof(struct fs_superblock));
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)0);
-	hf_dev_write(dev, blk_device.datablock.data, 1);
+	spb = blk_size / fsblk_info.bytes_sector;
+	hf_dev_writeblk(dev, 0, blk_device.datablock.data, spb);
 	
 	/* write cluster map blocks and data blocks (storage regions) */
 	for (k = 1; k < blk_device.fssblock.n_blocks; k += blk_size / (sizeof(uint32_t))) {
@@ -223,13 +751,13 @@ int32_t hf_mkfs(struct device *dev, uint32_t blk_size)
 				blk_device.datablock.cmb_data[i] = UHFS_FIXDBLK;
 		}
 		/* write cluster map block from this storage region */
-		hf_dev_write(dev, blk_device.datablock.data, 1);
+		hf_dev_write(dev, blk_device.datablock.data, spb);
 		
 		/* fill data with zeroes and write blocks of this storage region to disk */
 		memset(blk_device.datablock.data, 0, blk_size);
 		for (i = 1; i < blk_size / sizeof(uint32_t); i++)
 			if ((k - 1 + i) * blk_size < blk_device.vsize - blk_size)
-				hf_dev_write(dev, blk_device.datablock.data, 1);
+				hf_dev_write(dev, blk_device.datablock.data, spb);
 	}
 	
 	/* create root directory */
@@ -237,14 +765,11 @@ int32_t hf_mkfs(struct device *dev, uint32_t blk_size)
 	blk_device.fsdirentry.attributes = UHFS_ATTRFREE;
 	for (i = 0; i < blk_size / sizeof(struct fs_direntry); i++)
 		memcpy(blk_device.datablock.data + i * sizeof(struct fs_direntry), &blk_device.fsdirentry, sizeof(struct fs_direntry));
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)blk_device.fssblock.root_dir_block);
-	hf_dev_write(dev, blk_device.datablock.data, 1);
+	hf_dev_writeblk(dev, blk_device.fssblock.root_dir_block * spb, blk_device.datablock.data, spb);
 	
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)blk_device.fssblock.first_cmb);
-	hf_dev_read(dev, blk_device.datablock.data, 1);
+	hf_dev_readblk(dev, blk_device.fssblock.first_cmb * spb, blk_device.datablock.data, spb);
 	blk_device.datablock.cmb_data[blk_device.fssblock.first_cmb] = UHFS_EOCHBLK;
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)blk_device.fssblock.first_cmb);
-	hf_dev_write(dev, blk_device.datablock.data, 1);
+	hf_dev_writeblk(dev, blk_device.fssblock.first_cmb * spb, blk_device.datablock.data, spb);
 	
 	hf_free(blk_device.datablock.data);
 	
@@ -256,6 +781,8 @@ int32_t hf_mount(struct device *dev)
 	struct blk_info fsblk_info;
 	struct fs_blkdevice *blk_device;
 	struct fs_superblock *tmp_sblock;
+	struct blk_map map;
+	uint32_t i, n, chain_blk, *cmb_data;
 
 	if (dev->ptr) {
 #if UHFS_DEBUG == 1
@@ -282,8 +809,7 @@ int32_t hf_mount(struct device *dev)
 	tmp_sblock = (struct fs_superblock *)hf_malloc(fsblk_info.bytes_sector);
 	if (!tmp_sblock) return -1;
 	
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)0);
-	hf_dev_read(dev, tmp_sblock, 1);
+	hf_dev_readblk(dev, 0, tmp_sblock, 1);
 	memcpy(&blk_device->fssblock, tmp_sblock, sizeof(struct fs_superblock));
 	hf_free(tmp_sblock);
 	
@@ -297,8 +823,59 @@ int32_t hf_mount(struct device *dev)
 	blk_device->datablock.data = (int8_t *)hf_malloc(blk_device->fssblock.block_size);
 	if (!blk_device->datablock.data) return -1;
 	
+	/* allocate the block buffer cache */
+	blk_device->cache_data = (int8_t *)hf_malloc(UHFS_CACHE_BLOCKS * blk_device->fssblock.block_size);
+	if (!blk_device->cache_data) {
+		hf_free(blk_device->datablock.data);
+		hf_free(blk_device);
+		return -1;
+	}
+	for (i = 0; i < UHFS_CACHE_BLOCKS; i++) {
+		blk_device->cache[i].block = UHFS_FREEBLK;
+		blk_device->cache[i].age = 0;
+		blk_device->cache[i].dirty = 0;
+		blk_device->cache[i].data = blk_device->cache_data + i * blk_device->fssblock.block_size;
+	}
+	blk_device->cache_clock = 0;
+	map.sector = 0;
+	blk_device->mapped = !hf_dev_ioctl(dev, DISK_MAP, &map);
+	for (i = 0; i < UHFS_DCACHE_SIZE; i++)
+		blk_device->dcache[i].parent = 0;
+	for (i = 0; i < UHFS_FSLOT_SIZE; i++)
+		blk_device->fslot[i].dir = 0;
+	blk_device->handles = 0;
+	
 	/* attach filesystem structure (fs_blkdevice) to device */
 	dev->ptr = blk_device;
+	
+	/* build the free space summary, sweeping through all cluster map blocks */
+	n = blk_device->fssblock.block_size / sizeof(uint32_t);
+	blk_device->cmb_count = (blk_device->fssblock.n_blocks - 1 + n - 1) / n;
+	blk_device->cmb_free = (uint16_t *)hf_malloc(blk_device->cmb_count * sizeof(uint16_t));
+	if (!blk_device->cmb_free) {
+		dev->ptr = 0;
+		hf_free(blk_device->cache_data);
+		hf_free(blk_device->datablock.data);
+		hf_free(blk_device);
+		return -1;
+	}
+	memset(blk_device->cmb_free, 0, blk_device->cmb_count * sizeof(uint16_t));
+	blk_device->free_blocks = 0;
+	blk_device->free_hint = UHFS_FREEBLK;
+	chain_blk = blk_device->fssblock.first_cmb;
+	while (chain_blk != UHFS_EOCHBLK && (chain_blk - 1) / n < blk_device->cmb_count) {
+		cmb_data = (uint32_t *)blk_map(dev, chain_blk);
+		if (!cmb_data) break;
+		for (i = 1; i < n; i++) {
+			if (cmb_data[i] == UHFS_FREEBLK) {
+				blk_device->cmb_free[(chain_blk - 1) / n]++;
+				if (chain_blk + i < blk_device->free_hint)
+					blk_device->free_hint = chain_blk + i;
+			}
+		}
+		blk_device->free_blocks += blk_device->cmb_free[(chain_blk - 1) / n];
+		chain_blk = cmb_data[0];
+	}
 #if UHFS_DEBUG == 1
 	kprintf("\nhf_mount: block device mounted; sector size: %d, sectors %d, block size: %d, blocks: %d", 
 		blk_device->fsblk_info.bytes_sector, blk_device->fsblk_info.num_sectors, blk_device->fssblock.block_size, blk_device->fssblock.n_blocks); 
@@ -317,8 +894,18 @@ int32_t hf_umount(struct device *dev)
 		return -1;
 	}
 	
-	/* free data structures from device: data block and block device structure */
+	/* write back modified blocks */
+	if (hf_sync(dev)) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_umount: can't write back cached blocks");
+#endif
+		return -1;
+	}
+	
+	/* free data structures from device: free space summary, block cache, data block and block device structure */
 	blk_device = dev->ptr;
+	hf_free(blk_device->cmb_free);
+	hf_free(blk_device->cache_data);
 	hf_free(blk_device->datablock.data);
 	hf_free(blk_device);
 	
@@ -330,31 +917,44 @@ int32_t hf_umount(struct device *dev)
 	return 0;
 }
 
-int32_t hf_getfree(struct device *dev)
+int32_t hf_sync(struct device *dev)
 {
 	struct fs_blkdevice *blk_device;
-	uint32_t k, freeblks = 0;
+	struct fs_cacheblk *cb;
+	uint32_t i;
 
 	if (!dev->ptr) return -1;
 	
 	blk_device = dev->ptr;
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)blk_device->fssblock.first_cmb);
 	
-	/* sweep through all cluster map blocks, counting free blocks */
+	/* write back dirty blocks in ascending block order, so the device is swept only once */
 	while (1) {
-		hf_dev_read(dev, blk_device->datablock.cmb_data, 1);
-		
-		for (k = 1; k < blk_device->fssblock.block_size / sizeof(uint32_t); k++)
-			if (blk_device->datablock.cmb_data[k] == UHFS_FREEBLK)
-				freeblks++;
-		
-		if (blk_device->datablock.cmb_data[0] == UHFS_EOCHBLK)
+		cb = 0;
+		for (i = 0; i < UHFS_CACHE_BLOCKS; i++)
+			if (blk_device->cache[i].block != UHFS_FREEBLK && blk_device->cache[i].dirty)
+				if (!cb || blk_device->cache[i].block < cb->block)
+					cb = &blk_device->cache[i];
+		if (!cb)
 			break;
-			
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)blk_device->datablock.cmb_data[0]);
-	};
+		
+		if (dev_writeblk(dev, cb->block, cb->data, 1))
+			return -1;
+		cb->dirty = 0;
+	}
+	
+	return 0;
+}
+
+int32_t hf_getfree(struct device *dev)
+{
+	struct fs_blkdevice *blk_device;
+
+	if (!dev->ptr) return -1;
 	
-	return freeblks;
+	/* kept by the free space summary, no need to sweep the cluster map */
+	blk_device = dev->ptr;
+	
+	return blk_device->free_blocks;
 }
 
 int32_t hf_getlabel(struct device *dev, int8_t *label)
@@ -382,7 +982,9 @@ int32_t hf_setlabel(struct device *dev, int8_t *label)
 int32_t hf_mkdir(struct device *dev, int8_t *path)
 {
 	struct fs_blkdevice *blk_device;
-	uint32_t i, j, k, chain_blk, chain_blk_last, dir_blk, dir_blk_next, dir_blk_last, parent_dir_blk, first_dir_blk;
+	struct fs_cacheblk *cb;
+	struct fs_direntry *dir_data;
+	uint32_t i, k, blk, idx, parent_dir_blk, pdir_blk, first_dir_blk;
 	int8_t *ppath, *lpath;
 	int8_t *dirpath;
 	
@@ -393,12 +995,12 @@ int32_t hf_mkdir(struct device *dev, int8_t *path)
 		return -1;
 	}
 	
-	dirpath = (int8_t *)hf_malloc(strlen(path));
+	dirpath = (int8_t *)hf_malloc(strlen(path) + 1);
 	if (!dirpath)
 		return -1;
 	strcpy(dirpath, path);
 
-	if (searchdirectory(dev, dirpath, &parent_dir_blk, &ppath, &first_dir_blk, &lpath)) {
+	if (searchdirectory(dev, dirpath, &parent_dir_blk, &pdir_blk, &ppath, &first_dir_blk, &lpath)) {
 		kprintf("\nhf_mkdir: path not found");
 		hf_free(dirpath);
 		return -1;
@@ -407,91 +1009,51 @@ int32_t hf_mkdir(struct device *dev, int8_t *path)
 	kprintf("\npath / name is ok, now do it");
 #endif
 	blk_device = dev->ptr;
-	
-	/* find the first empty directory entry */
-	chain_blk = ((first_dir_blk-1) & ~(blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) + 1;
-	dir_blk = first_dir_blk;
 #if UHFS_DEBUG == 1
-	kprintf("\ndirectory at blk %d (pblock %d)", dir_blk, parent_dir_blk);
+	kprintf("\ndirectory at blk %d (pblock %d)", first_dir_blk, parent_dir_blk);
 #endif
-	while (1) {
-		do {
-			hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk);
-			hf_dev_read(dev, blk_device->datablock.cmb_data, 1);
-			dir_blk_next = blk_device->datablock.cmb_data[(dir_blk - 1) & (blk_device->fssblock.block_size / sizeof(uint32_t) - 1)];
-			hf_dev_ioctl(dev, DISK_SEEKSET, (void *)dir_blk);
-			hf_dev_read(dev, blk_device->datablock.dir_data, 1);
-#if UHFS_DEBUG == 1
-			kprintf("\nhf_mkdir: chain: %d blk: %d next %d", chain_blk, dir_blk, dir_blk_next);
-#endif
-			for (i = 0; i < blk_device->fssblock.block_size / sizeof(struct fs_direntry); i++) {
-				if (blk_device->datablock.dir_data[i].attributes & UHFS_ATTRFREE) {
-					/* get a free block, update the cluster map */
-					k = getfreeblock(dev);
-					if (!k) return -1;
-					
-					/* clean the block for empty directory entries */
-					hf_dev_ioctl(dev, DISK_SEEKSET, (void *)k);
-					memset(blk_device->datablock.dir_data, 0, blk_device->fssblock.block_size);
-					for (j = 0; j < blk_device->fssblock.block_size / sizeof(struct fs_direntry); j++)
-						blk_device->datablock.dir_data[j].attributes = UHFS_ATTRFREE;
-					hf_dev_write(dev, blk_device->datablock.dir_data, 1);
-					
-					/* update the directory entry, pointing to the new subdirectory file */
-					hf_dev_ioctl(dev, DISK_SEEKSET, (void *)dir_blk);
-					hf_dev_read(dev, blk_device->datablock.dir_data, 1);
-
-					strcpy(blk_device->datablock.dir_data[i].filename, lpath);
-					blk_device->datablock.dir_data[i].attributes = UHFS_ATTRDIR | UHFS_ATTRREAD | UHFS_ATTRWRITE;
-					blk_device->datablock.dir_data[i].metadata_block = 0;
-					blk_device->datablock.dir_data[i].first_block = k;
-					blk_device->datablock.dir_data[i].size = 0;
-					hf_dev_ioctl(dev, DISK_SEEKSET, (void *)dir_blk);
-					hf_dev_write(dev, blk_device->datablock.dir_data, 1);
-					
-					hf_free(dirpath);
-					
-					return 0;
-				}
-			}
-			
-			chain_blk_last = chain_blk;
-			chain_blk = ((dir_blk_next-1) & ~(blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) + 1;
-			dir_blk_last = dir_blk;
-			dir_blk = dir_blk_next;
-#if UHFS_DEBUG == 1
-			kprintf("\nhf_mkdir: jumping to next part of the directory (%d)", dir_blk_next);
-#endif
-		} while (dir_blk_next != UHFS_EOCHBLK);
-
-		/* we should create an extension of the directory file and not give up here */
+	
+	/* get a free block for the subdirectory and a free entry (the directory is extended if full) */
+	k = getfreeblock(dev);
+	if (!k) {
+		hf_free(dirpath);
+		return -1;
+	}
+	if (newentry(dev, first_dir_blk, &blk, &idx)) {
+		setnextblock(dev, k, UHFS_FREEBLK);
+		hf_free(dirpath);
+		return -1;
+	}
+	
+	/* clean the block for empty directory entries */
+	cb = cache_get(dev, k, 0);
+	if (!cb) {
+		hf_free(dirpath);
+		return -1;
+	}
+	memset(cb->data, 0, blk_device->fssblock.block_size);
+	dir_data = (struct fs_direntry *)cb->data;
+	for (i = 0; i < blk_device->fssblock.block_size / sizeof(struct fs_direntry); i++)
+		dir_data[i].attributes = UHFS_ATTRFREE;
+	cb->dirty = 1;
+	
+	/* update the directory entry, pointing to the new subdirectory file */
+	cb = cache_get(dev, blk, 1);
+	if (!cb) {
+		hf_free(dirpath);
+		return -1;
+	}
+	dir_data = &((struct fs_direntry *)cb->data)[idx];
+	memset(dir_data, 0, sizeof(struct fs_direntry));
+	strcpy(dir_data->filename, lpath);
+	dir_data->attributes = UHFS_ATTRDIR | UHFS_ATTRREAD | UHFS_ATTRWRITE;
+	dir_data->metadata_block = 0;
+	dir_data->first_block = k;
+	dir_data->size = 0;
+	cb->dirty = 1;
 #if UHFS_DEBUG == 1
-		kprintf("\nhf_mkdir: directory is full. extending it...");
+	kprintf("\nhf_mkdir: entry %d of blk %d", idx, blk);
 #endif
-		k = getfreeblock(dev);
-		if (!k){
-			hf_free(dirpath);
-			
-			return -1;
-		}
-			
-		/* clean the block for empty directory entries */
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)k);
-		memset(blk_device->datablock.dir_data, 0, blk_device->fssblock.block_size);
-		for (j = 0; j < blk_device->fssblock.block_size / sizeof(struct fs_direntry); j++)
-			blk_device->datablock.dir_data[j].attributes = UHFS_ATTRFREE;
-		hf_dev_write(dev, blk_device->datablock.dir_data, 1);
-
-		/* update the a cluster map block */
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk_last);
-		hf_dev_read(dev, blk_device->datablock.cmb_data, 1);
-		blk_device->datablock.cmb_data[(dir_blk_last - 1) & (blk_device->fssblock.block_size / sizeof(uint32_t) - 1)] = k;
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk_last);
-		hf_dev_write(dev, blk_device->datablock.cmb_data, 1);
-		
-		dir_blk = k;
-		chain_blk = ((k-1) & ~(blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) + 1;
-	}
 	
 	hf_free(dirpath);
 	
@@ -500,8 +1062,9 @@ int32_t hf_mkdir(struct device *dev, int8_t *path)
 
 struct file * hf_opendir(struct device *dev, int8_t *path)
 {
+	struct fs_blkdevice *blk_device;
 	struct file *fptr;
-	uint32_t parent_dir_blk, first_dir_blk;
+	uint32_t parent_dir_blk, pdir_blk, first_dir_blk;
 	int8_t *ppath, *lpath;
 	int8_t *dirpath;
 	
@@ -521,7 +1084,7 @@ struct file * hf_opendir(struct device *dev, int8_t *path)
 		return -1;
 	strcpy(dirpath, path);	
 	
-	if (searchdirectory(dev, dirpath, &parent_dir_blk, &ppath, &first_dir_blk, &lpath)) {
+	if (searchdirectory(dev, dirpath, &parent_dir_blk, &pdir_blk, &ppath, &first_dir_blk, &lpath)) {
 		hf_free(fptr);
 #if UHFS_DEBUG == 1
 		kprintf("\nhf_opendir: path not found");
@@ -536,6 +1099,8 @@ struct file * hf_opendir(struct device *dev, int8_t *path)
 	fptr->flags = UHFS_OPENFILE;
 	fptr->block = first_dir_blk;
 	fptr->offset = 0;
+	blk_device = dev->ptr;
+	blk_device->handles++;
 	
 	hf_free(dirpath);
 	
@@ -544,6 +1109,8 @@ struct file * hf_opendir(struct device *dev, int8_t *path)
 
 int32_t hf_closedir(struct file *desc)
 {
+	struct fs_blkdevice *blk_device;
+	
 	if (!(desc->flags & UHFS_OPENFILE)) {
 #if UHFS_DEBUG == 1
 		kprintf("\nhf_closedir: not an open directory");
@@ -551,6 +1118,8 @@ int32_t hf_closedir(struct file *desc)
 		return -1;
 	}
 
+	blk_device = desc->dev->ptr;
+	blk_device->handles--;
 	desc->flags = 0;
 	hf_free(desc);
 	
@@ -579,11 +1148,9 @@ int32_t hf_readdir(struct file *desc, struct fs_direntry *entry)
 		chain_blk = ((desc->block-1) & ~(blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) + 1;
 		dir_blk = desc->block;
 
-		hf_dev_ioctl(desc->dev, DISK_SEEKSET, (void *)chain_blk);
-		hf_dev_read(desc->dev, blk_device->datablock.cmb_data, 1);
+		blk_read(desc->dev, chain_blk, blk_device->datablock.cmb_data);
 		dir_blk_next = blk_device->datablock.cmb_data[(dir_blk - 1) & (blk_device->fssblock.block_size / sizeof(uint32_t) - 1)];
-		hf_dev_ioctl(desc->dev, DISK_SEEKSET, (void *)dir_blk);
-		hf_dev_read(desc->dev, blk_device->datablock.dir_data, 1);
+		blk_read(desc->dev, dir_blk, blk_device->datablock.dir_data);
 		desc->block = dir_blk_next;
 #if UHFS_DEBUG == 1
 		kprintf("\nhf_readdir: chain: %d blk: %d next %d", chain_blk, dir_blk, dir_blk_next);
@@ -603,7 +1170,7 @@ int32_t hf_readdir(struct file *desc, struct fs_direntry *entry)
 int32_t hf_rmdir(struct device *dev, int8_t *path)
 {
 	struct fs_blkdevice *blk_device;
-	uint32_t i, chain_blk, dir_blk, dir_blk_next, parent_dir_blk, first_dir_blk;
+	uint32_t i, chain_blk, dir_blk, dir_blk_next, parent_dir_blk, pdir_blk, first_dir_blk;
 	int8_t *ppath, *lpath;
 	int8_t *dirpath;
 	
@@ -619,7 +1186,7 @@ int32_t hf_rmdir(struct device *dev, int8_t *path)
 		return -1;
 	strcpy(dirpath, path);
 
-	if (searchdirectory(dev, dirpath, &parent_dir_blk, &ppath, &first_dir_blk, &lpath)) {
+	if (searchdirectory(dev, dirpath, &parent_dir_blk, &pdir_blk, &ppath, &first_dir_blk, &lpath)) {
 #if UHFS_DEBUG == 1
 		kprintf("\nhf_rmdir: path not found");
 #endif
@@ -639,11 +1206,9 @@ int32_t hf_rmdir(struct device *dev, int8_t *path)
 #endif
 	/* find a non-empty directory entry */
 	do {
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk);
-		hf_dev_read(dev, blk_device->datablock.cmb_data, 1);
+		blk_read(dev, chain_blk, blk_device->datablock.cmb_data);
 		dir_blk_next = blk_device->datablock.cmb_data[(dir_blk - 1) & (blk_device->fssblock.block_size / sizeof(uint32_t) - 1)];
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)dir_blk);
-		hf_dev_read(dev, blk_device->datablock.dir_data, 1);
+		blk_read(dev, dir_blk, blk_device->datablock.dir_data);
 #if UHFS_DEBUG == 1
 		kprintf("\nhf_rmdir: chain: %d blk: %d next %d", chain_blk, dir_blk, dir_blk_next);
 #endif
@@ -671,14 +1236,15 @@ int32_t hf_rmdir(struct device *dev, int8_t *path)
 	/* free directory entry on parent block */
 	dir_blk = parent_dir_blk;
 
-	hf_dev_ioctl(dev, DISK_SEEKSET, (void *)dir_blk);
-	hf_dev_read(dev, blk_device->datablock.dir_data, 1);
+	blk_read(dev, dir_blk, blk_device->datablock.dir_data);
 	for (i = 0; i < blk_device->fssblock.block_size / sizeof(struct fs_direntry); i++) {
 		/* directory is not empty */
-		if (!strcmp(blk_device->datablock.dir_data[i].filename, ppath)){
+		if (!(blk_device->datablock.dir_data[i].attributes & UHFS_ATTRFREE) && !strcmp(blk_device->datablock.dir_data[i].filename, ppath)){
 			blk_device->datablock.dir_data[i].attributes |= UHFS_ATTRFREE;
-			hf_dev_ioctl(dev, DISK_SEEKSET, (void *)dir_blk);
-			hf_dev_write(dev, blk_device->datablock.dir_data, 1);
+			blk_write(dev, dir_blk, blk_device->datablock.dir_data);
+			dcache_drop(dev, dir_blk, i, first_dir_blk);
+			fslot_drop(blk_device, 0, first_dir_blk);
+			freeentry(dev, pdir_blk, dir_blk, i);
 #if UHFS_DEBUG == 1
 			kprintf("\nhf_rmdir: freed directory entry");
 #endif
@@ -686,25 +1252,11 @@ int32_t hf_rmdir(struct device *dev, int8_t *path)
 		}
 	}
 
-	/* free directory blocks. FIXME: should avoid multiple writes to the same cluster map block */	
-	chain_blk = ((first_dir_blk-1) & ~(blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) + 1;
-	dir_blk = first_dir_blk;
+	/* free directory blocks */
 #if UHFS_DEBUG == 1
-	kprintf("\nhf_rmdir: chain %d block %d", chain_blk, dir_blk);
+	kprintf("\nhf_rmdir: freeing blocks from %d", first_dir_blk);
 #endif
-	do {
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk);
-		hf_dev_read(dev, blk_device->datablock.cmb_data, 1);
-		dir_blk_next = blk_device->datablock.cmb_data[(dir_blk - 1) & (blk_device->fssblock.block_size / sizeof(uint32_t) - 1)];
-		blk_device->datablock.cmb_data[(dir_blk - 1) & (blk_device->fssblock.block_size / sizeof(uint32_t) - 1)] = UHFS_FREEBLK;
-		hf_dev_ioctl(dev, DISK_SEEKSET, (void *)chain_blk);
-		hf_dev_write(dev, blk_device->datablock.cmb_data, 1);
-#if UHFS_DEBUG == 1
-		kprintf("\nhf_rmdir: freed block %d", dir_blk);
-#endif
-		chain_blk = ((dir_blk_next-1) & ~(blk_device->fssblock.block_size / sizeof(uint32_t) - 1)) + 1;
-		dir_blk = dir_blk_next;
-	} while (dir_blk_next != UHFS_EOCHBLK);
+	freechain(dev, first_dir_blk);
 	
 	hf_free(dirpath);
 	
@@ -714,16 +1266,135 @@ int32_t hf_rmdir(struct device *dev, int8_t *path)
 /* file management */
 int32_t hf_unlink(struct device *dev, int8_t *path)
 {
+	struct fs_cacheblk *cb;
+	struct fs_direntry *entry;
+	uint32_t parent_dir_blk, blk, idx, first_blk;
+	int8_t *lpath;
+	int8_t *filepath;
+	
+	if (!dev->ptr) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_unlink: filesystem not mounted");
+#endif
+		return -1;
+	}
+	
+	filepath = (int8_t *)hf_malloc(strlen(path) + 1);
+	if (!filepath)
+		return -1;
+	strcpy(filepath, path);
+	
+	if (findentry(dev, filepath, &parent_dir_blk, &blk, &idx, &lpath)) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_unlink: file not found");
+#endif
+		hf_free(filepath);
+		return -1;
+	}
+	hf_free(filepath);
+	
+	cb = cache_get(dev, blk, 1);
+	if (!cb) return -1;
+	entry = &((struct fs_direntry *)cb->data)[idx];
+	if (entry->attributes & UHFS_ATTRDIR) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_unlink: %s is a directory", entry->filename);
+#endif
+		return -1;
+	}
+	
+	/* free the directory entry and the blocks of the file */
+	first_blk = entry->first_block;
+	entry->attributes |= UHFS_ATTRFREE;
+	cb->dirty = 1;
+	dcache_drop(dev, blk, idx, 0);
+	freechain(dev, first_blk);
+	freeentry(dev, parent_dir_blk, blk, idx);
+	
 	return 0;
 }
 
 int64_t hf_size(struct device *dev, int8_t *path)
 {
-	return 0;
+	struct fs_direntry *dir_data;
+	uint32_t parent_dir_blk, blk, idx;
+	int8_t *lpath;
+	int8_t *filepath;
+	
+	if (!dev->ptr) return -1;
+	
+	filepath = (int8_t *)hf_malloc(strlen(path) + 1);
+	if (!filepath)
+		return -1;
+	strcpy(filepath, path);
+	
+	if (findentry(dev, filepath, &parent_dir_blk, &blk, &idx, &lpath)) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_size: file not found");
+#endif
+		hf_free(filepath);
+		return -1;
+	}
+	hf_free(filepath);
+	
+	dir_data = (struct fs_direntry *)blk_map(dev, blk);
+	if (!dir_data) return -1;
+	
+	return dir_data[idx].size;
 }
 
 int32_t hf_rename(struct device *dev, int8_t *path, int8_t *newname)
 {
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb;
+	struct fs_dentry dentry;
+	uint32_t parent_dir_blk, blk, idx;
+	int8_t *lpath;
+	int8_t *filepath;
+	
+	if (!dev->ptr) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_rename: filesystem not mounted");
+#endif
+		return -1;
+	}
+	
+	/* the new name is a name on the same directory, not a path */
+	blk_device = dev->ptr;
+	if (!*newname || strpbrk(newname, " /") || strlen(newname) >= sizeof(blk_device->fsdirentry.filename)) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_rename: invalid name");
+#endif
+		return -1;
+	}
+	
+	filepath = (int8_t *)hf_malloc(strlen(path) + 1);
+	if (!filepath)
+		return -1;
+	strcpy(filepath, path);
+	
+	if (findentry(dev, filepath, &parent_dir_blk, &blk, &idx, &lpath)) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_rename: path not found");
+#endif
+		hf_free(filepath);
+		return -1;
+	}
+	hf_free(filepath);
+	
+	if (!scandirectory(dev, parent_dir_blk, newname, &dentry)) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_rename: file/directory already exists");
+#endif
+		return -1;
+	}
+	
+	cb = cache_get(dev, blk, 1);
+	if (!cb) return -1;
+	strcpy(((struct fs_direntry *)cb->data)[idx].filename, newname);
+	cb->dirty = 1;
+	dcache_drop(dev, blk, idx, 0);
+	
 	return 0;
 }
 
@@ -740,35 +1411,350 @@ int32_t hf_touch(struct device *dev, int8_t *path, struct fs_date *ndate, struct
 /* file operations */
 struct file * hf_fopen(struct device *dev, int8_t *path, int8_t *mode)
 {
-	return 0;
+	struct fs_blkdevice *blk_device;
+	struct fs_cacheblk *cb;
+	struct fs_direntry entry;
+	struct file *fptr;
+	uint32_t parent_dir_blk, blk, idx, k;
+	int32_t access, r;
+	int8_t *lpath;
+	int8_t *filepath;
+	
+	if (!dev->ptr) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_fopen: filesystem not mounted");
+#endif
+		return 0;
+	}
+	blk_device = dev->ptr;
+	
+	switch (mode[0]) {
+	case 'r': access = UHFS_RDONLY; break;
+	case 'w': access = UHFS_WRONLY | UHFS_CREAT; break;
+	case 'a': access = UHFS_WRONLY | UHFS_CREAT | UHFS_APPEND; break;
+	default:
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_fopen: invalid mode");
+#endif
+		return 0;
+	}
+	if (strchr(mode, '+'))
+		access |= UHFS_RDWR;
+	
+	filepath = (int8_t *)hf_malloc(strlen(path) + 1);
+	if (!filepath)
+		return 0;
+	strcpy(filepath, path);
+	
+	r = findentry(dev, filepath, &parent_dir_blk, &blk, &idx, &lpath);
+	if (r < 0 || (r > 0 && !(access & UHFS_CREAT))) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_fopen: file not found");
+#endif
+		hf_free(filepath);
+		return 0;
+	}
+	
+	if (r > 0) {
+		/* create the file, with its first block */
+		if (strlen(lpath) >= sizeof(entry.filename)) {
+#if UHFS_DEBUG == 1
+			kprintf("\nhf_fopen: invalid name");
+#endif
+			hf_free(filepath);
+			return 0;
+		}
+		k = getfreeblock(dev);
+		if (!k) {
+			hf_free(filepath);
+			return 0;
+		}
+		if (newentry(dev, parent_dir_blk, &blk, &idx)) {
+			setnextblock(dev, k, UHFS_FREEBLK);
+			hf_free(filepath);
+			return 0;
+		}
+		memset(&entry, 0, sizeof(struct fs_direntry));
+		strcpy(entry.filename, lpath);
+		entry.attributes = UHFS_ATTRREAD | UHFS_ATTRWRITE;
+		entry.first_block = k;
+		entry.size = 0;
+		cb = cache_get(dev, blk, 1);
+		if (!cb) {
+			hf_free(filepath);
+			return 0;
+		}
+		((struct fs_direntry *)cb->data)[idx] = entry;
+		cb->dirty = 1;
+	} else {
+		cb = cache_get(dev, blk, 1);
+		if (!cb) {
+			hf_free(filepath);
+			return 0;
+		}
+		entry = ((struct fs_direntry *)cb->data)[idx];
+		if ((entry.attributes & UHFS_ATTRDIR) || ((access & UHFS_WRONLY) && !(entry.attributes & UHFS_ATTRWRITE))) {
+#if UHFS_DEBUG == 1
+			kprintf("\nhf_fopen: can't open %s", entry.filename);
+#endif
+			hf_free(filepath);
+			return 0;
+		}
+	}
+	hf_free(filepath);
+	
+	fptr = (struct file *)hf_malloc(sizeof(struct file));
+	if (!fptr)
+		return 0;
+	fptr->buf = (int8_t *)hf_malloc(blk_device->fssblock.block_size);
+	if (!fptr->buf) {
+		hf_free(fptr);
+		return 0;
+	}
+	
+	fptr->dev = dev;
+	fptr->first_block = entry.first_block;
+	fptr->mode = access;
+	fptr->flags = UHFS_OPENFILE;
+	fptr->block = entry.first_block;
+	fptr->offset = 0;
+	fptr->blk_index = 0;
+	fptr->size = entry.size;
+	fptr->dir_block = blk;
+	fptr->dir_index = idx;
+	fptr->ra_index = -1;
+	fptr->buf_block = UHFS_FREEBLK;
+	fptr->buf_dirty = 0;
+	blk_device->handles++;
+	
+	/* truncate the file, keeping its first block */
+	if (mode[0] == 'w' && fptr->size) {
+		freechain(dev, nextblock(dev, fptr->first_block));
+		setnextblock(dev, fptr->first_block, UHFS_EOCHBLK);
+		fptr->size = 0;
+		filesize(fptr);
+	}
+	
+	return fptr;
 }
 
 int32_t hf_fclose(struct file *desc)
 {
-	return 0;
+	struct fs_blkdevice *blk_device;
+	int32_t err = 0;
+	
+	if (!(desc->flags & UHFS_OPENFILE) || !desc->mode) {
+#if UHFS_DEBUG == 1
+		kprintf("\nhf_fclose: not an open file");
+#endif
+		return -1;
+	}
+	
+	if (fileflush(desc))
+		err = -1;
+	if ((desc->flags & UHFS_MODIFIED) && filesize(desc))
+		err = -1;
+	
+	blk_device = desc->dev->ptr;
+	blk_device->handles--;
+	desc->flags = 0;
+	hf_free(desc->buf);
+	hf_free(desc);
+	
+	return err;
 }
 
 size_t hf_fread(void *buf, int32_t isize, size_t items, struct file *desc)
 {
-	return 0;
+	struct fs_blkdevice *blk_device;
+	uint32_t index, off, blk, run, next, count;
+	size_t size, n, done = 0;
+	int8_t *ptr = buf, *data;
+	
+	if (!(desc->flags & UHFS_OPENFILE) || !(desc->mode & UHFS_RDONLY) || isize <= 0)
+		return 0;
+	
+	blk_device = desc->dev->ptr;
+	size = isize * items;
+	if (desc->offset + size > desc->size) {
+		size = desc->size - desc->offset;
+		desc->flags |= UHFS_EOF;
+	}
+	
+	while (done < size) {
+		index = desc->offset / blk_device->fssblock.block_size;
+		off = desc->offset & (blk_device->fssblock.block_size - 1);
+		n = blk_device->fssblock.block_size - off;
+		if (n > size - done)
+			n = size - done;
+		
+		blk = fileblock(desc, index, 0);
+		if (!blk) break;
+		
+		/* whole blocks, not cached (nor memory backed): find a run of contiguous blocks and read it from
+		 * the device straight to the caller buffer, in a single transfer */
+		if (!blk_device->mapped && !off && n == blk_device->fssblock.block_size && blk != desc->buf_block && !cache_find(blk_device, blk)) {
+			count = 1;
+			run = blk;
+			while (count < (size - done) / blk_device->fssblock.block_size) {
+				next = nextblock(desc->dev, run);
+				if (next != run + 1 || next == desc->buf_block || cache_find(blk_device, next)) break;
+				run = next;
+				count++;
+			}
+			if (dev_readblk(desc->dev, blk, ptr + done, count)) break;
+			
+			desc->block = run;
+			desc->blk_index = index + count - 1;
+			desc->ra_index = desc->blk_index;
+			done += count * blk_device->fssblock.block_size;
+			desc->offset += count * blk_device->fssblock.block_size;
+			continue;
+		}
+		
+		/* data not written back yet is on the file buffer */
+		if (blk == desc->buf_block) {
+			memcpy(ptr + done, desc->buf + off, n);
+		} else {
+			data = blk_map(desc->dev, blk);
+			if (!data) break;
+			memcpy(ptr + done, data + off, n);
+		}
+		readahead(desc, index, blk);
+		
+		done += n;
+		desc->offset += n;
+	}
+	
+	return done / isize;
 }
 
 size_t hf_fwrite(void *buf, int32_t isize, size_t items, struct file *desc)
 {
-	return 0;
+	struct fs_blkdevice *blk_device;
+	uint32_t index, off, blk;
+	size_t size, n, done = 0;
+	int8_t *ptr = buf;
+	
+	if (!(desc->flags & UHFS_OPENFILE) || !(desc->mode & UHFS_WRONLY) || isize <= 0)
+		return 0;
+	
+	blk_device = desc->dev->ptr;
+	size = isize * items;
+	if (desc->mode & UHFS_APPEND)
+		desc->offset = desc->size;
+	
+	while (done < size) {
+		index = desc->offset / blk_device->fssblock.block_size;
+		off = desc->offset & (blk_device->fssblock.block_size - 1);
+		n = blk_device->fssblock.block_size - off;
+		if (n > size - done)
+			n = size - done;
+		
+		blk = fileblock(desc, index, 1);
+		if (!blk) break;
+		
+		if (n == blk_device->fssblock.block_size) {
+			/* whole block, write it directly */
+			if (blk == desc->buf_block) {
+				desc->buf_block = UHFS_FREEBLK;
+				desc->buf_dirty = 0;
+			}
+			if (blk_write(desc->dev, blk, ptr + done)) break;
+		} else {
+			/* partial block, coalesce on the file buffer. a block past the end of
+			 * the file holds no data, so it doesn't have to be read. */
+			if (blk != desc->buf_block) {
+				if (fileflush(desc)) break;
+				desc->buf_block = UHFS_FREEBLK;
+				if ((int64_t)index * blk_device->fssblock.block_size >= desc->size)
+					memset(desc->buf, 0, blk_device->fssblock.block_size);
+				else if (blk_read(desc->dev, blk, desc->buf))
+					break;
+				desc->buf_block = blk;
+			}
+			memcpy(desc->buf + off, ptr + done, n);
+			desc->buf_dirty = 1;
+		}
+		
+		done += n;
+		desc->offset += n;
+		if (desc->offset > desc->size) {
+			desc->size = desc->offset;
+			desc->flags |= UHFS_MODIFIED;
+		}
+	}
+	
+	return done / isize;
 }
 
 int32_t hf_fseek(struct file *desc, int64_t offset, int32_t whence)
 {
+	int64_t pos;
+	
+	if (!(desc->flags & UHFS_OPENFILE) || !desc->mode)
+		return -1;
+	
+	switch (whence) {
+	case SEEK_SET: pos = offset; break;
+	case SEEK_CUR: pos = desc->offset + offset; break;
+	case SEEK_END: pos = desc->size + offset; break;
+	default: return -1;
+	}
+	
+	/* files have no holes, so the position can't move past the end of the file */
+	if (pos < 0 || pos > desc->size)
+		return -1;
+	
+	desc->offset = pos;
+	desc->flags &= ~UHFS_EOF;
+	
 	return 0;
 }
 
 int64_t hf_ftell(struct file *desc)
 {
-	return 0;
+	if (!(desc->flags & UHFS_OPENFILE) || !desc->mode)
+		return -1;
+	
+	return desc->offset;
 }
 
 int32_t hf_feof(struct file *desc)
 {
-	return 0;
+	return (desc->flags & UHFS_EOF) ? 1 : 0;
+}
+
+/* loadable modules (sys/kernel/module.c), read from a file. the file primitives are exported to modules */
+static const struct module_symbol uhfs_exports[] = {
+	{ "hf_fopen", (void *)hf_fopen },
+	{ "hf_fclose", (void *)hf_fclose },
+	{ "hf_fread", (void *)hf_fread },
+	{ "hf_fwrite", (void *)hf_fwrite },
+	{ "hf_fseek", (void *)hf_fseek },
+	{ "hf_ftell", (void *)hf_ftell },
+	{ "hf_feof", (void *)hf_feof },
+	{ "hf_size", (void *)hf_size },
+	{ "hf_unlink", (void *)hf_unlink },
+	{ NULL, NULL }
+};
+
+static int32_t module_fread(void *arg, void *buf, uint32_t size)
+{
+	return hf_fread(buf, 1, size, (struct file *)arg);
+}
+
+int32_t hf_module_fload(struct device *dev, int8_t *path, struct module *m)
+{
+	struct file *desc;
+	int32_t val;
+	
+	hf_module_export(uhfs_exports);
+	desc = hf_fopen(dev, path, "r");
+	if (!desc)
+		return ERR_INVALID_NAME;
+	val = hf_module_read(m, module_fread, desc);
+	hf_fclose(desc);
+	
+	return val;
 }
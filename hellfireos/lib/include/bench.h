@@ -0,0 +1,20 @@
+/*
+figures of a benchmark, in processor cycles (_readcounter()) or any other unit.
+samples are accumulated with bench_add() and each test prints one line:
+
+BENCH <test> <samples> <min> <avg> <max>
+
+bench_add() does not disable interrupts: samples taken by more than one task (or
+by an interrupt handler) are added with interrupts disabled by the caller.
+*/
+
+struct bench {
+	uint32_t min, max, n;
+	uint64_t sum;
+};
+
+void bench_init(struct bench *b);
+void bench_add(struct bench *b, uint32_t val);
+uint32_t bench_avg(struct bench *b);
+void bench_print(int8_t *name, struct bench *b);
+void bench_print_sub(int8_t *name, int8_t *sub, struct bench *b);
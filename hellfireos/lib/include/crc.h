@@ -0,0 +1,31 @@
+/*
+cyclic redundancy checks (CRC-16/CCITT-FALSE, CRC-32/MPEG-2 and CRC-64)
+
+CRC_METHOD selects the implementation: 0 computes bit by bit (no tables), 1 uses a
+256 entry table per crc and 2 uses four tables (slice-by-4, for RAM rich targets).
+tables are built on first use. a stream is checksummed with init / update / final:
+
+	crc = crc32_init();
+	while (...)
+		crc = crc32_update(crc, buf, len);
+	crc = crc32_final(crc);
+*/
+
+#ifndef CRC_METHOD
+#define CRC_METHOD		1
+#endif
+
+uint16_t crc16_init(void);
+uint16_t crc16_update(uint16_t crc, uint8_t *data, uint32_t len);
+uint16_t crc16_final(uint16_t crc);
+uint16_t crc16(uint8_t *data, uint32_t len);
+
+uint32_t crc32_init(void);
+uint32_t crc32_update(uint32_t crc, uint8_t *data, uint32_t len);
+uint32_t crc32_final(uint32_t crc);
+uint32_t crc32(uint8_t *data, uint32_t len);
+
+uint64_t crc64_init(void);
+uint64_t crc64_update(uint64_t crc, uint8_t *data, uint32_t len);
+uint64_t crc64_final(uint64_t crc);
+uint64_t crc64(uint8_t *data, uint32_t len);
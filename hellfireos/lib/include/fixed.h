@@ -0,0 +1,59 @@
+/*
+fixed point arithmetic library
+
+fix16_t is a signed Q16.16 number (16 integer bits, 16 fraction bits), q15_t is a
+signed Q1.15 number in [-1, 1). operations saturate to the range of the type instead
+of wrapping around (overflowed results are FIX16_MAX / FIX16_MIN). angles are in
+radians. sin, cos and atan2 use CORDIC, sqrt is computed bit by bit, exp and log use
+short series after a range reduction. none of them use floating point, results are
+within a few units of the last place.
+*/
+
+typedef int32_t fix16_t;
+typedef int16_t q15_t;
+
+#define FIX16_ONE		0x00010000
+#define FIX16_HALF		0x00008000
+#define FIX16_MAX		0x7fffffff
+#define FIX16_MIN		(-0x7fffffff - 1)
+#define FIX16_PI		205887
+#define FIX16_PI_2		102944
+#define FIX16_2PI		411775
+#define FIX16_E			178145
+#define FIX16_LN2		45426
+
+#define Q15_ONE			0x7fff
+#define Q15_MAX			0x7fff
+#define Q15_MIN			(-0x7fff - 1)
+
+/* conversion helpers */
+#define fix16_from_int(a)	((fix16_t)((a) * FIX16_ONE))
+#define fix16_to_int(a)		((a) >= 0 ? ((a) + FIX16_HALF) >> 16 : -((-(a) + FIX16_HALF) >> 16))
+#define fix16_from_float(a)	((fix16_t)((a) >= 0 ? (a) * 65536.0f + 0.5f : (a) * 65536.0f - 0.5f))
+#define fix16_to_float(a)	((float)(a) / 65536.0f)
+#define fix16_frac(a)		((a) & 0xffff)
+#define fix16_floor(a)		((a) & ~0xffff)
+#define q15_from_float(a)	((q15_t)((a) * 32768.0f))
+#define q15_to_float(a)		((float)(a) / 32768.0f)
+
+fix16_t fix16_from_q15(q15_t a);
+q15_t fix16_to_q15(fix16_t a);
+
+/* saturating arithmetic */
+fix16_t fix16_add(fix16_t a, fix16_t b);
+fix16_t fix16_sub(fix16_t a, fix16_t b);
+fix16_t fix16_mul(fix16_t a, fix16_t b);
+fix16_t fix16_div(fix16_t a, fix16_t b);
+fix16_t fix16_abs(fix16_t a);
+q15_t q15_add(q15_t a, q15_t b);
+q15_t q15_sub(q15_t a, q15_t b);
+q15_t q15_mul(q15_t a, q15_t b);
+
+/* functions */
+fix16_t fix16_sqrt(fix16_t a);
+fix16_t fix16_sin(fix16_t rad);
+fix16_t fix16_cos(fix16_t rad);
+void fix16_sincos(fix16_t rad, fix16_t *s, fix16_t *c);
+fix16_t fix16_atan2(fix16_t y, fix16_t x);
+fix16_t fix16_exp(fix16_t a);
+fix16_t fix16_log(fix16_t a);
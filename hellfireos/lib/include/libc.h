@@ -51,6 +51,7 @@ int8_t *strchr(const int8_t *s, int32_t c);
 int8_t *strpbrk(int8_t *str, int8_t *set);
 int8_t *strsep(int8_t **pp, int8_t *delim);
 int8_t *strtok(int8_t *s, const int8_t *delim);
+int8_t *strtok_r(int8_t *s, const int8_t *delim, int8_t **last);
 void *memcpy(void *dst, const void *src, uint32_t n);
 void *memmove(void *dst, const void *src, uint32_t n);
 int32_t memcmp(const void *cs, const void *ct, uint32_t n);
@@ -63,15 +64,38 @@ int32_t puts(const int8_t *str);
 int8_t *gets(int8_t *s);
 int32_t abs(int32_t n);
 int32_t random(void);
+int32_t rand_r(uint32_t *seed);
 void srand(uint32_t seed);
+uint32_t xorshift32(uint32_t *state);
+uint32_t random32(void);
+uint32_t random_below(uint32_t n);
+uint32_t random_below_r(uint32_t *state, uint32_t n);
 int32_t hexdump(int8_t *buf, uint32_t size);
 int32_t printf(const int8_t *fmt, ...);
 int32_t sprintf(int8_t *out, const int8_t *fmt, ...);
+int32_t snprintf(int8_t *out, uint32_t size, const int8_t *fmt, ...);
+int32_t vprintf(const int8_t *fmt, va_list args);
+int32_t vsprintf(int8_t *out, const int8_t *fmt, va_list args);
+int32_t vsnprintf(int8_t *out, uint32_t size, const int8_t *fmt, va_list args);
+/* formatted output to a sink, called for every character (with arg) */
+int32_t printf_sink(void (*sink)(void *arg, int32_t c), void *arg, const int8_t *fmt, ...);
+int32_t vprintf_sink(void (*sink)(void *arg, int32_t c), void *arg, const int8_t *fmt, va_list args);
 void *malloc(size_t size);
 void free(void *ptr);
 void *calloc(uint32_t qty, uint32_t type_size);
 void *realloc(void *ptr, uint32_t size);
 
+/* repeated division by the same divisor (div_init(), then div_u32() / mod_u32()) */
+struct divider {
+	uint32_t den;
+	uint32_t mul;
+	uint8_t shift1, shift2;
+};
+
+void div_init(struct divider *d, uint32_t den);
+uint32_t div_u32(struct divider *d, uint32_t num);
+uint32_t mod_u32(struct divider *d, uint32_t num);
+
 /* IEEE single-precision definitions */
 #define SNG_EXPBITS	8
 #define SNG_FRACBITS	23
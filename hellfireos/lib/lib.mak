@@ -2,4 +2,6 @@ libc:
 	$(CC) $(CFLAGS) \
 		$(SRC_DIR)/lib/libc/libc.c \
 		$(SRC_DIR)/lib/libc/math.c \
-		$(SRC_DIR)/lib/misc/crc.c
+		$(SRC_DIR)/lib/libc/fixed.c \
+		$(SRC_DIR)/lib/misc/crc.c \
+		$(SRC_DIR)/lib/misc/bench.c
@@ -0,0 +1,301 @@
+#include <hal.h>
+#include <libc.h>
+#include <fixed.h>
+
+static fix16_t fix16_sat(int64_t a){
+	if (a > FIX16_MAX)
+		return FIX16_MAX;
+	if (a < FIX16_MIN)
+		return FIX16_MIN;
+	return (fix16_t)a;
+}
+
+fix16_t fix16_from_q15(q15_t a){
+	return (fix16_t)a << 1;
+}
+
+q15_t fix16_to_q15(fix16_t a){
+	a >>= 1;
+	if (a > Q15_MAX)
+		return Q15_MAX;
+	if (a < Q15_MIN)
+		return Q15_MIN;
+	return (q15_t)a;
+}
+
+/*
+saturating arithmetic
+*/
+fix16_t fix16_add(fix16_t a, fix16_t b){
+	return fix16_sat((int64_t)a + b);
+}
+
+fix16_t fix16_sub(fix16_t a, fix16_t b){
+	return fix16_sat((int64_t)a - b);
+}
+
+/* product rounded to the nearest */
+fix16_t fix16_mul(fix16_t a, fix16_t b){
+	int64_t p;
+
+	p = (int64_t)a * b;
+	p += FIX16_HALF;
+
+	return fix16_sat(p >> 16);
+}
+
+/* quotient rounded to the nearest, division by zero saturates */
+fix16_t fix16_div(fix16_t a, fix16_t b){
+	int64_t n;
+	int32_t neg;
+	uint64_t q, d;
+
+	if (b == 0)
+		return a >= 0 ? FIX16_MAX : FIX16_MIN;
+	neg = (a < 0) ^ (b < 0);
+	n = (int64_t)a << 16;
+	q = n < 0 ? -n : n;
+	d = b < 0 ? -(int64_t)b : b;
+	q = (q + (d >> 1)) / d;
+
+	return fix16_sat(neg ? -(int64_t)q : (int64_t)q);
+}
+
+fix16_t fix16_abs(fix16_t a){
+	if (a == FIX16_MIN)
+		return FIX16_MAX;
+	return a < 0 ? -a : a;
+}
+
+q15_t q15_add(q15_t a, q15_t b){
+	int32_t r = (int32_t)a + b;
+
+	if (r > Q15_MAX)
+		return Q15_MAX;
+	if (r < Q15_MIN)
+		return Q15_MIN;
+	return (q15_t)r;
+}
+
+q15_t q15_sub(q15_t a, q15_t b){
+	int32_t r = (int32_t)a - b;
+
+	if (r > Q15_MAX)
+		return Q15_MAX;
+	if (r < Q15_MIN)
+		return Q15_MIN;
+	return (q15_t)r;
+}
+
+/* product rounded to the nearest (-1 * -1 saturates) */
+q15_t q15_mul(q15_t a, q15_t b){
+	int32_t r = ((int32_t)a * b + 0x4000) >> 15;
+
+	if (r > Q15_MAX)
+		return Q15_MAX;
+	return (q15_t)r;
+}
+
+/*
+square root, bit by bit (of a << 16, so the result has 16 fraction bits). negative
+numbers have no root, and return 0.
+*/
+fix16_t fix16_sqrt(fix16_t a){
+	uint64_t num, res = 0, bit;
+
+	if (a <= 0)
+		return 0;
+	num = (uint64_t)a << 16;
+	bit = (uint64_t)1 << 46;
+	while (bit > num)
+		bit >>= 2;
+	while (bit){
+		if (num >= res + bit){
+			num -= res + bit;
+			res = (res >> 1) + bit;
+		}else{
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+	/* round to the nearest */
+	if (num > res)
+		res++;
+
+	return (fix16_t)res;
+}
+
+/*
+CORDIC, with angles as Q2.29 radians (atan(2^-i) for each iteration) and vectors
+as Q2.29 as well. CORDIC_K is the inverse of the gain of the iterations.
+*/
+#define CORDIC_ITER		24
+#define CORDIC_K		0x136e9db5
+#define CORDIC_PI		0x6487ed51
+
+static const int32_t cordic_atan[CORDIC_ITER] = {
+	0x1921fb54, 0x0ed63383, 0x07d6dd7e, 0x03fab753, 0x01ff55bb, 0x00ffeaae, 0x007ffd55, 0x003fffab,
+	0x001ffff5, 0x000fffff, 0x00080000, 0x00040000, 0x00020000, 0x00010000, 0x00008000, 0x00004000,
+	0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100, 0x00000080, 0x00000040
+};
+
+/*
+sine and cosine of an angle. the angle is reduced to [-pi, pi], then to [-pi/2, pi/2]
+(where the rotation converges), flipping the sign of the cosine.
+*/
+void fix16_sincos(fix16_t rad, fix16_t *s, fix16_t *c){
+	int32_t x, y, z, t, i, neg = 0;
+
+	rad %= FIX16_2PI;
+	if (rad > FIX16_PI)
+		rad -= FIX16_2PI;
+	if (rad < -FIX16_PI)
+		rad += FIX16_2PI;
+	if (rad > FIX16_PI_2){
+		rad = FIX16_PI - rad;
+		neg = 1;
+	}else if (rad < -FIX16_PI_2){
+		rad = -FIX16_PI - rad;
+		neg = 1;
+	}
+
+	x = CORDIC_K;
+	y = 0;
+	z = rad << 13;
+	for (i = 0; i < CORDIC_ITER; i++){
+		t = x;
+		if (z >= 0){
+			x -= y >> i;
+			y += t >> i;
+			z -= cordic_atan[i];
+		}else{
+			x += y >> i;
+			y -= t >> i;
+			z += cordic_atan[i];
+		}
+	}
+	/* back to 16 fraction bits, rounded */
+	x = (x + (1 << 12)) >> 13;
+	y = (y + (1 << 12)) >> 13;
+	if (s)
+		*s = y;
+	if (c)
+		*c = neg ? -x : x;
+}
+
+fix16_t fix16_sin(fix16_t rad){
+	fix16_t s;
+
+	fix16_sincos(rad, &s, NULL);
+
+	return s;
+}
+
+fix16_t fix16_cos(fix16_t rad){
+	fix16_t c;
+
+	fix16_sincos(rad, NULL, &c);
+
+	return c;
+}
+
+/*
+angle of the vector (x, y), in [-pi, pi]. the vector is rotated to the right half
+plane and scaled (both coordinates by the same shift, so the angle is kept) to use the
+most bits without overflowing on the iteration gain.
+*/
+fix16_t fix16_atan2(fix16_t y, fix16_t x){
+	int64_t xl = x, yl = y;
+	int32_t xi, yi, z = 0, t, i;
+
+	if (x == 0 && y == 0)
+		return 0;
+	if (xl < 0){
+		xl = -xl;
+		yl = -yl;
+		z = y >= 0 ? CORDIC_PI : -CORDIC_PI;
+	}
+	while ((xl > 1 << 29) || (yl > 1 << 29) || (yl < -(1 << 29))){
+		xl >>= 1;
+		yl >>= 1;
+	}
+	while (xl < 1 << 28 && yl < 1 << 28 && yl > -(1 << 28)){
+		xl <<= 1;
+		yl <<= 1;
+	}
+
+	xi = (int32_t)xl;
+	yi = (int32_t)yl;
+	for (i = 0; i < CORDIC_ITER; i++){
+		t = xi;
+		if (yi < 0){
+			xi -= yi >> i;
+			yi += t >> i;
+			z -= cordic_atan[i];
+		}else{
+			xi += yi >> i;
+			yi -= t >> i;
+			z += cordic_atan[i];
+		}
+	}
+
+	return (z + (1 << 12)) >> 13;
+}
+
+/*
+exponential. a = k * ln(2) + r, with r in [0, ln(2)), so e^a = 2^k * e^r. e^r is
+summed as a series (Horner) with 30 fraction bits, exact to the last place of the
+result. results above FIX16_MAX saturate.
+*/
+fix16_t fix16_exp(fix16_t a){
+	int32_t k, i;
+	int64_t r, e;
+
+	if (a == 0)
+		return FIX16_ONE;
+	if (a > 681391)			/* ln(32768) */
+		return FIX16_MAX;
+	if (a < -772243)		/* ln(2^-17), rounds to 0 */
+		return 0;
+
+	k = a / FIX16_LN2;
+	if (a < 0 && k * FIX16_LN2 != a)
+		k--;
+	r = ((int64_t)a << 14) - (int64_t)k * 744261118;	/* ln(2) with 30 fraction bits */
+
+	e = 1 << 30;
+	for (i = 9; i > 0; i--)
+		e = (1 << 30) + ((e * r) >> 30) / i;
+
+	/* times 2^k, with 17 fraction bits, then rounded */
+	e = k > 13 ? e << (k - 13) : e >> (13 - k);
+
+	return fix16_sat((e + 1) >> 1);
+}
+
+/*
+natural logarithm. a = m * 2^k, with m in [1, 2), so ln(a) = k * ln(2) + ln(m), and
+ln(m) = 2 * atanh(y) = 2 * (y + y^3 / 3 + y^5 / 5 + ...), with y = (m - 1) / (m + 1)
+in [0, 1/3), summed with 30 fraction bits. a <= 0 returns FIX16_MIN.
+*/
+fix16_t fix16_log(fix16_t a){
+	int32_t k, i;
+	int64_t m, y, y2, p, sum;
+
+	if (a <= 0)
+		return FIX16_MIN;
+
+	k = 15 - __builtin_clz(a);
+	m = (int64_t)a << (14 - k);		/* 30 fraction bits */
+	y = ((m - (1 << 30)) << 30) / (m + (1 << 30));
+	y2 = (y * y) >> 30;
+	sum = 0;
+	p = y;
+	for (i = 1; i < 16; i += 2){
+		sum += p / i;
+		p = (p * y2) >> 30;
+	}
+	sum = 2 * sum + (int64_t)k * 744261118;
+
+	return (fix16_t)((sum + (1 << 13)) >> 14);
+}
@@ -53,20 +53,66 @@ int8_t *strncat(int8_t *s1, int8_t *s2, int32_t n){
 	return(os1);
 }
 
+/*
+word at a time string routines. once aligned, a whole word is tested for a zero byte
+with ((w - 0x01010101) & ~w & 0x80808080), which is nonzero when any byte of w is zero
+(and a byte equal to c is a zero byte of w ^ (c * 0x01010101)). loads are aligned and
+stop at the word holding the terminator, so they never cross into memory past the end
+of the string. the final bytes are handled one at a time, as before.
+*/
+#define STR_ONES		0x01010101
+#define STR_HIGHS		0x80808080
+#define STR_HASZERO(w)		(((w) - STR_ONES) & ~(w) & STR_HIGHS)
+#define STR_ALIGNED(p)		(((size_t)(p) & 3) == 0)
+
 int32_t strcmp(const int8_t *s1, const int8_t *s2){
-	while (*s1 == *s2++)
-		if (*s1++ == '\0')
-			return(0);
+	const uint32_t *w1, *w2;
+
+	if (STR_ALIGNED((size_t)s1 ^ (size_t)s2)){
+		for (; !STR_ALIGNED(s1); s1++, s2++)
+			if (*s1 != *s2 || *s1 == '\0')
+				return(*s1 - *s2);
+		w1 = (const uint32_t *)s1;
+		w2 = (const uint32_t *)s2;
+		while (*w1 == *w2 && !STR_HASZERO(*w1)){
+			w1++;
+			w2++;
+		}
+		s1 = (const int8_t *)w1;
+		s2 = (const int8_t *)w2;
+	}
+	while (*s1 == *s2 && *s1 != '\0'){
+		s1++;
+		s2++;
+	}
 
-	return(*s1 - *--s2);
+	return(*s1 - *s2);
 }
 
 int32_t strncmp(int8_t *s1, int8_t *s2, int32_t n){
-	while (--n >= 0 && *s1 == *s2++)
-		if (*s1++ == '\0')
-			return(0);
+	const uint32_t *w1, *w2;
+
+	if (STR_ALIGNED((size_t)s1 ^ (size_t)s2)){
+		for (; n > 0 && !STR_ALIGNED(s1); s1++, s2++, n--)
+			if (*s1 != *s2 || *s1 == '\0')
+				return(*s1 - *s2);
+		w1 = (const uint32_t *)s1;
+		w2 = (const uint32_t *)s2;
+		while (n >= 4 && *w1 == *w2 && !STR_HASZERO(*w1)){
+			w1++;
+			w2++;
+			n -= 4;
+		}
+		s1 = (int8_t *)w1;
+		s2 = (int8_t *)w2;
+	}
+	while (n > 0 && *s1 == *s2 && *s1 != '\0'){
+		s1++;
+		s2++;
+		n--;
+	}
 
-	return(n<0 ? 0 : *s1 - *--s2);
+	return(n <= 0 ? 0 : *s1 - *s2);
 }
 
 int8_t *strstr(const int8_t *string, const int8_t *find){
@@ -82,16 +128,37 @@ int8_t *strstr(const int8_t *string, const int8_t *find){
 }
 
 int32_t strlen(const int8_t *s){
-	int32_t n;
+	const int8_t *p;
+	const uint32_t *w;
 
-	n = 0;
-	while (*s++)
-		n++;
+	for (p = s; !STR_ALIGNED(p); p++)
+		if (*p == '\0')
+			return(p - s);
+	w = (const uint32_t *)p;
+	while (!STR_HASZERO(*w))
+		w++;
+	p = (const int8_t *)w;
+	while (*p)
+		p++;
 
-	return(n);
+	return(p - s);
 }
 
 int8_t *strchr(const int8_t *s, int32_t c){
+	const uint32_t *w;
+	uint32_t mask;
+
+	for (; !STR_ALIGNED(s); s++){
+		if (*s == (int8_t)c)
+			return (int8_t *)s;
+		if (!*s)
+			return 0;
+	}
+	mask = (uint8_t)c * STR_ONES;
+	w = (const uint32_t *)s;
+	while (!STR_HASZERO(*w) && !STR_HASZERO(*w ^ mask))
+		w++;
+	s = (const int8_t *)w;
 	while (*s != (int8_t)c) 
 		if (!*s++)
 			return 0; 
@@ -126,13 +193,13 @@ int8_t *strsep(int8_t **pp, int8_t *delim){
 	return p;
 }
 
-int8_t *strtok(int8_t *s, const int8_t *delim){
+/* strtok_r() keeps the position in *last, strtok() in a static (shared by all tasks) */
+int8_t *strtok_r(int8_t *s, const int8_t *delim, int8_t **last){
 	const int8_t *spanp;
 	int32_t c, sc;
 	int8_t *tok;
-	static int8_t *last;
 
-	if (s == NULL && (s = last) == NULL)
+	if (s == NULL && (s = *last) == NULL)
 		return (NULL);
 
 	cont:
@@ -143,7 +210,7 @@ int8_t *strtok(int8_t *s, const int8_t *delim){
 	}
 
 	if (c == 0){
-		last = NULL;
+		*last = NULL;
 		return (NULL);
 	}
 	tok = s - 1;
@@ -157,44 +224,177 @@ int8_t *strtok(int8_t *s, const int8_t *delim){
 					s = NULL;
 				else
 					s[-1] = 0;
-				last = s;
+				*last = s;
 				return (tok);
 			}
 		}while (sc != 0);
 	}
 }
 
-void *memcpy(void *dst, const void *src, uint32_t n){
-	int8_t *r1 = dst;
-	const int8_t *r2 = src;
+int8_t *strtok(int8_t *s, const int8_t *delim){
+	static int8_t *last;
+
+	return strtok_r(s, delim, &last);
+}
+
+/*
+block memory routines. the destination is aligned first, then whole machine words (MEM_WORD)
+are moved, four at a time, and the tail is moved byte by byte. a source that is not aligned to
+the destination is either read with unaligned loads (MEM_UNALIGNED == 1, on cores that have them,
+such as lwl / lwr on MIPS32) or as aligned words merged by shifts. an arch may also provide its
+own routines, defining ARCH_MEMCPY, ARCH_MEMMOVE, ARCH_MEMCMP or ARCH_MEMSET in hal.h.
+*/
+#ifndef MEM_WORD
+#define MEM_WORD		uint32_t
+#endif
+#ifndef MEM_UNALIGNED
+#define MEM_UNALIGNED		0
+#endif
+
+typedef MEM_WORD mword_t;
 
+#define MWSIZE			sizeof(mword_t)
+#define MWMASK			(MWSIZE - 1)
+#define MWBITS			(MWSIZE * 8)
+#define MEM_THRESHOLD		(4 * MWSIZE)
+
+#if MEM_UNALIGNED == 1
+struct mword_u {
+	mword_t w;
+} __attribute__((packed));
+#endif
+
+/* forward copy, also safe for overlapping buffers when dst is below src */
+static void mem_fwd(uint8_t *d, const uint8_t *s, uint32_t n){
+	mword_t *dw, a, b;
+	const mword_t *sw;
+#if MEM_UNALIGNED == 0
+	uint32_t shift;
+#endif
+
+	if (n >= MEM_THRESHOLD){
+		while ((size_t)d & MWMASK){
+			*d++ = *s++;
+			n--;
+		}
+		dw = (mword_t *)d;
+		if (((size_t)s & MWMASK) == 0){
+			sw = (const mword_t *)s;
+			for (; n >= 4 * MWSIZE; n -= 4 * MWSIZE, dw += 4, sw += 4){
+				a = sw[0]; b = sw[1];
+				dw[0] = a; dw[1] = b;
+				a = sw[2]; b = sw[3];
+				dw[2] = a; dw[3] = b;
+			}
+			for (; n >= MWSIZE; n -= MWSIZE)
+				*dw++ = *sw++;
+			s = (const uint8_t *)sw;
+		}else{
+#if MEM_UNALIGNED == 1
+			const struct mword_u *su = (const struct mword_u *)s;
+
+			for (; n >= 4 * MWSIZE; n -= 4 * MWSIZE, dw += 4, su += 4){
+				dw[0] = su[0].w; dw[1] = su[1].w;
+				dw[2] = su[2].w; dw[3] = su[3].w;
+			}
+			for (; n >= MWSIZE; n -= MWSIZE)
+				*dw++ = (su++)->w;
+			s = (const uint8_t *)su;
+#else
+			/* every aligned word loaded holds bytes to be copied, so no read goes past src + n */
+			shift = ((size_t)s & MWMASK) * 8;
+			sw = (const mword_t *)((size_t)s & ~(size_t)MWMASK);
+			a = *sw++;
+			for (; n >= MWSIZE; n -= MWSIZE){
+				b = *sw++;
+#if LITTLE_ENDIAN
+				*dw++ = (a >> shift) | (b << (MWBITS - shift));
+#else
+				*dw++ = (a << shift) | (b >> (MWBITS - shift));
+#endif
+				a = b;
+			}
+			s = (const uint8_t *)(sw - 1) + (shift >> 3);
+#endif
+		}
+		d = (uint8_t *)dw;
+	}
 	while (n--)
-		*r1++ = *r2++;
+		*d++ = *s++;
+}
+
+#ifndef ARCH_MEMCPY
+void *memcpy(void *dst, const void *src, uint32_t n){
+	mem_fwd((uint8_t *)dst, (const uint8_t *)src, n);
 
 	return dst;
 }
+#endif
 
+#ifndef ARCH_MEMMOVE
 void *memmove(void *dst, const void *src, uint32_t n){
-	int8_t *s = (int8_t *)dst;
-	const int8_t *p = (const int8_t *)src;
+	uint8_t *d = (uint8_t *)dst;
+	const uint8_t *s = (const uint8_t *)src;
+	mword_t *dw;
+	const mword_t *sw;
+
+	if (s >= d || s + n <= d){
+		mem_fwd(d, s, n);
+		return dst;
+	}
 
-	if (p >= s){
-		while (n--)
-			*s++ = *p++;
-	}else{
-		s += n;
-		p += n;
-		while (n--)
-			*--s = *--p;
+	/* overlapping, dst above src: copy backwards (by words if both ends agree on alignment) */
+	d += n;
+	s += n;
+	if (n >= MEM_THRESHOLD && (((size_t)d ^ (size_t)s) & MWMASK) == 0){
+		while ((size_t)d & MWMASK){
+			*--d = *--s;
+			n--;
+		}
+		dw = (mword_t *)d;
+		sw = (const mword_t *)s;
+		for (; n >= 4 * MWSIZE; n -= 4 * MWSIZE){
+			dw -= 4; sw -= 4;
+			dw[3] = sw[3]; dw[2] = sw[2];
+			dw[1] = sw[1]; dw[0] = sw[0];
+		}
+		for (; n >= MWSIZE; n -= MWSIZE)
+			*--dw = *--sw;
+		d = (uint8_t *)dw;
+		s = (const uint8_t *)sw;
 	}
+	while (n--)
+		*--d = *--s;
 
 	return dst;
 }
+#endif
 
+#ifndef ARCH_MEMCMP
 int32_t memcmp(const void *cs, const void *ct, uint32_t n){
 	const uint8_t *r1 = (const uint8_t *)cs;
 	const uint8_t *r2 = (const uint8_t *)ct;
-
+	const mword_t *w1, *w2;
+
+	/* skip equal words, the first difference is then found byte by byte */
+	if (n >= MEM_THRESHOLD && (((size_t)r1 ^ (size_t)r2) & MWMASK) == 0){
+		while (((size_t)r1 & MWMASK) && *r1 == *r2){
+			++r1;
+			++r2;
+			--n;
+		}
+		if (((size_t)r1 & MWMASK) == 0){
+			w1 = (const mword_t *)r1;
+			w2 = (const mword_t *)r2;
+			while (n >= MWSIZE && *w1 == *w2){
+				++w1;
+				++w2;
+				n -= MWSIZE;
+			}
+			r1 = (const uint8_t *)w1;
+			r2 = (const uint8_t *)w2;
+		}
+	}
 	while (n && (*r1 == *r2)) {
 		++r1;
 		++r2;
@@ -203,15 +403,38 @@ int32_t memcmp(const void *cs, const void *ct, uint32_t n){
 
 	return (n == 0) ? 0 : ((*r1 < *r2) ? -1 : 1);
 }
+#endif
 
+#ifndef ARCH_MEMSET
 void *memset(void *s, int32_t c, uint32_t n){
 	uint8_t *p = (uint8_t *)s;
+	mword_t *pw, w;
 
+	if (n >= MEM_THRESHOLD){
+		while ((size_t)p & MWMASK){
+			*p++ = (uint8_t)c;
+			n--;
+		}
+		w = (uint8_t)c;
+		w |= w << 8;
+		w |= w << 16;
+		if (MWSIZE > 4)
+			w |= w << (MWBITS / 2);
+		pw = (mword_t *)p;
+		for (; n >= 4 * MWSIZE; n -= 4 * MWSIZE, pw += 4){
+			pw[0] = w; pw[1] = w;
+			pw[2] = w; pw[3] = w;
+		}
+		for (; n >= MWSIZE; n -= MWSIZE)
+			*pw++ = w;
+		p = (uint8_t *)pw;
+	}
 	while (n--)
 		*p++ = (uint8_t)c;
 
 	return s;
 }
+#endif
 
 int32_t strtol(const int8_t *s, int8_t **end, int32_t base){
 	int32_t i;
@@ -343,13 +566,57 @@ int32_t abs(int32_t n){
 
 static uint32_t rand1=0xbaadf00d;
 
+/* rand_r() keeps the state in *seed, random() in rand1 (shared by all tasks) */
+int32_t rand_r(uint32_t *seed){
+	*seed = *seed * 1103515245 + 12345;
+	return (uint32_t)(*seed >> 16) & 32767;
+}
+
 int32_t random(void){
-	rand1 = rand1 * 1103515245 + 12345;
-	return (uint32_t)(rand1 >> 16) & 32767;
+	return rand_r(&rand1);
+}
+
+/*
+xorshift32 (Marsaglia): a full period (2^32 - 1) generator with 32 bit outputs, made
+of shifts and xors only, so it is cheap on cores without a multiplier. the state must
+not be zero. random32() / random_below() use a shared state: concurrent callers may
+at worst return the same value, so tasks that need independent streams keep their
+own state (xorshift32() / random_below_r()).
+*/
+static uint32_t rand2 = 0x2545f491;
+
+uint32_t xorshift32(uint32_t *state){
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/* uniform in [0, n), scaling by n instead of a modulo (no division) */
+uint32_t random_below_r(uint32_t *state, uint32_t n){
+	uint32_t x = xorshift32(state);
+
+	if (n <= 0x10000)
+		return ((x >> 16) * n) >> 16;
+
+	return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+uint32_t random32(void){
+	return xorshift32(&rand2);
+}
+
+uint32_t random_below(uint32_t n){
+	return random_below_r(&rand2, n);
 }
 
 void srand(uint32_t seed){
 	rand1 = seed;
+	rand2 = seed ? seed : 0x2545f491;
 }
 
 int32_t hexdump(int8_t *buf, uint32_t size){
@@ -377,21 +644,39 @@ int32_t hexdump(int8_t *buf, uint32_t size){
 }
 
 /*
-printf() and sprintf()
+printf() and friends. the formatter keeps all of its state in a struct print_out
+on the caller's stack, so it is reentrant: output goes either to a buffer (bounded by
+size, for snprintf()) or to a sink callback, one character at a time (putchar() for
+printf(), or any other stream, such as a trace buffer). numbers are converted without
+divisions (shifts for hex, a shift and add division by 10 for decimal), as division
+is done in software on some targets.
 */
 #define PAD_RIGHT 1
 #define PAD_ZERO 2
 #define PRINT_BUF_LEN 30
 
-static void printchar(int8_t **str, int32_t c){
-	if (str){
-		**str = c;
-		++(*str);
-	} else
-		(void)putchar(c);
+struct print_out {
+	int8_t *buf;
+	uint32_t size, len;
+	void (*sink)(void *arg, int32_t c);
+	void *arg;
+};
+
+static void printchar(struct print_out *out, int32_t c){
+	if (out->sink){
+		out->sink(out->arg, c);
+	}else{
+		if (out->len + 1 < out->size)
+			out->buf[out->len] = c;
+		out->len++;
+	}
 }
 
-static int32_t prints(int8_t **out, const int8_t *string, int32_t width, int32_t pad){
+static void print_putchar(void *arg, int32_t c){
+	(void)putchar(c);
+}
+
+static int32_t prints(struct print_out *out, const int8_t *string, int32_t width, int32_t pad){
 	int32_t pc = 0, padchar = ' ';
 	int32_t len = 0;
 	const int8_t *ptr;
@@ -424,11 +709,30 @@ static int32_t prints(int8_t **out, const int8_t *string, int32_t width, int32_t
 	return pc;
 }
 
-static int32_t printi(int8_t **out, int32_t i, int32_t b, int32_t sg, int32_t width, int32_t pad, int32_t letbase){
+/* u / 10, with shifts and adds (Hacker's Delight, divu10) */
+static uint32_t print_div10(uint32_t u, uint32_t *rem){
+	uint32_t q, r;
+
+	q = (u >> 1) + (u >> 2);
+	q += q >> 4;
+	q += q >> 8;
+	q += q >> 16;
+	q >>= 3;
+	r = u - ((q << 2) + q) * 2;
+	if (r > 9){
+		q++;
+		r -= 10;
+	}
+	*rem = r;
+
+	return q;
+}
+
+static int32_t printi(struct print_out *out, int32_t i, int32_t b, int32_t sg, int32_t width, int32_t pad, int32_t letbase){
 	int8_t print_buf[PRINT_BUF_LEN];
 	int8_t *s;
-	int32_t t, neg = 0, pc = 0;
-	uint32_t u = i;
+	int32_t neg = 0, pc = 0;
+	uint32_t t, u = i;
 
 	if (i == 0){
 		print_buf[0] = '0';
@@ -444,11 +748,15 @@ static int32_t printi(int8_t **out, int32_t i, int32_t b, int32_t sg, int32_t wi
 	*s = '\0';
 
 	while (u){
-		t = u % b;
+		if (b == 16){
+			t = u & 0xf;
+			u >>= 4;
+		}else{
+			u = print_div10(u, &t);
+		}
 		if (t >= 10)
 			t += letbase - '0' - 10;
 		*--s = t + '0';
-		u /= b;
 	}
 
 	if (neg){
@@ -464,14 +772,13 @@ static int32_t printi(int8_t **out, int32_t i, int32_t b, int32_t sg, int32_t wi
 	return pc + prints(out, s, width, pad);
 }
 
-static int32_t print(int8_t **out, const int8_t *format, va_list args){
+static int32_t print(struct print_out *out, const int8_t *format, va_list args){
 	int32_t width, pad;
 	int32_t pc = 0;
 	int8_t scr[2];
 	int8_t *s;
 #if FLOATING_POINT == 1
 	int32_t i,j;
-	int8_t buf[30];
 	int32_t f1, precision_n = 6, precision_v = 1;
 	float f;
 #endif
@@ -524,7 +831,9 @@ static int32_t print(int8_t **out, const int8_t *format, va_list args){
 					i = *++format - '0';
 					precision_n = i;
 					precision_v = 1;
-					pc++;
+					/* skip the conversion character (%.3f) */
+					if (*(format + 1))
+						++format;
 				case 'e':
 				case 'E':
 				case 'g':
@@ -532,34 +841,17 @@ static int32_t print(int8_t **out, const int8_t *format, va_list args){
 				case 'f':
 					f = va_arg(args, double);
 					if (f < 0.0f){
-						putchar('-');
+						printchar(out, '-');
 						f = -f;
 						pc++;
 					}
-					itoa((int32_t)f,buf,10);
-					j=0;
-					while (buf[j]){
-						putchar(buf[j++]);
-						pc++;
-					}
-					putchar('.');
+					pc += printi(out, (int32_t)f, 10, 0, 0, 0, 'a');
+					printchar(out, '.');
+					pc++;
 					for(j = 0; j < precision_n; j++)
 						precision_v *= 10;
 					f1 = (f - (int32_t)f) * precision_v;
-					i = precision_v / 10;
-					while (i > f1){
-						printchar(out, '0');
-						pc++;
-						i /= 10;
-					}
-					itoa(f1, buf, 10);
-					j = 0;
-					if (f1 != 0){
-						while (buf[j]){
-							printchar(out, buf[j++]);
-							pc++;
-						}
-					}
+					pc += printi(out, f1, 10, 0, precision_n, PAD_ZERO, 'a');
 					precision_n = 6;
 					precision_v = 1;
 					break;
@@ -571,24 +863,75 @@ static int32_t print(int8_t **out, const int8_t *format, va_list args){
 			++pc;
 		}
 	}
-	if (out) **out = '\0';
-	va_end( args );
-	
+	if (!out->sink && out->size)
+		out->buf[out->len < out->size ? out->len : out->size - 1] = '\0';
+
 	return pc;
 }
 
+int32_t vprintf_sink(void (*sink)(void *arg, int32_t c), void *arg, const int8_t *fmt, va_list args){
+	struct print_out out = {NULL, 0, 0, sink, arg};
+
+	return print(&out, fmt, args);
+}
+
+int32_t printf_sink(void (*sink)(void *arg, int32_t c), void *arg, const int8_t *fmt, ...){
+	va_list args;
+	int32_t r;
+
+	va_start(args, fmt);
+	r = vprintf_sink(sink, arg, fmt, args);
+	va_end(args);
+
+	return r;
+}
+
+int32_t vprintf(const int8_t *fmt, va_list args){
+	return vprintf_sink(print_putchar, NULL, fmt, args);
+}
+
 int32_t printf(const int8_t *fmt, ...){
-        va_list args;
-        
-        va_start(args, fmt);
-        return print(0, fmt, args);
+	va_list args;
+	int32_t r;
+
+	va_start(args, fmt);
+	r = vprintf(fmt, args);
+	va_end(args);
+
+	return r;
+}
+
+/* at most size - 1 characters are stored, and the output is always terminated (if size > 0) */
+int32_t vsnprintf(int8_t *out, uint32_t size, const int8_t *fmt, va_list args){
+	struct print_out o = {out, size, 0, NULL, NULL};
+
+	return print(&o, fmt, args);
+}
+
+int32_t snprintf(int8_t *out, uint32_t size, const int8_t *fmt, ...){
+	va_list args;
+	int32_t r;
+
+	va_start(args, fmt);
+	r = vsnprintf(out, size, fmt, args);
+	va_end(args);
+
+	return r;
+}
+
+int32_t vsprintf(int8_t *out, const int8_t *fmt, va_list args){
+	return vsnprintf(out, 0xffffffff, fmt, args);
 }
 
 int32_t sprintf(int8_t *out, const int8_t *fmt, ...){
-        va_list args;
-        
-        va_start(args, fmt);
-        return print(&out, fmt, args);
+	va_list args;
+	int32_t r;
+
+	va_start(args, fmt);
+	r = vsprintf(out, fmt, args);
+	va_end(args);
+
+	return r;
 }
 
 void *malloc(size_t size){
@@ -624,15 +967,42 @@ typedef union{
 	} s;
 } dwords;
 
+/*
+software multiply and divide, for cores without the instructions (cores that have them
+never call these). multiply takes four bits of the smaller operand per step, using a
+table of multiples of the other. divide normalizes the divisor with a count leading
+zeros, so only the significant quotient bits are computed.
+*/
+int32_t __clzsi2(uint32_t a);
+
 int32_t __mulsi3(uint32_t a, uint32_t b){
-	uint32_t answer = 0;
+	uint32_t answer = 0, m[16], t;
+	int32_t i;
 
-	while(b){
-		if(b & 1)
-			answer += a;
-		a <<= 1;
-		b >>= 1;
+	if (a < b){
+		t = a;
+		a = b;
+		b = t;
+	}
+	if (b < 256){
+		while(b){
+			if(b & 1)
+				answer += a;
+			a <<= 1;
+			b >>= 1;
+		}
+		return answer;
 	}
+
+	m[0] = 0;
+	m[1] = a;
+	for (i = 2; i < 16; i += 2){
+		m[i] = m[i >> 1] << 1;
+		m[i + 1] = m[i] + a;
+	}
+	for (i = (31 - __clzsi2(b)) & ~3; i >= 0; i -= 4)
+		answer = (answer << 4) + m[(b >> i) & 0xf];
+
 	return answer;
 }
 
@@ -670,22 +1040,51 @@ int64_t __muldi3(int64_t a, int64_t b){
 	return r.all;
 }
 
-uint32_t __udivmodsi4(uint32_t num, uint32_t den, int32_t modwanted){
-	uint32_t bit = 1;
-	uint32_t res = 0;
+int32_t __clzsi2(uint32_t a){
+	static const uint8_t clz_nibble[16] = {4, 3, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+	int32_t n = 0;
 
-	while (den < num && bit && !(den & (1L << 31))) {
-		den <<= 1;
-		bit <<= 1;
+	if (!(a & 0xffff0000)){
+		n += 16;
+		a <<= 16;
+	}
+	if (!(a & 0xff000000)){
+		n += 8;
+		a <<= 8;
+	}
+	if (!(a & 0xf0000000)){
+		n += 4;
+		a <<= 4;
 	}
-	while (bit){
+	return n + clz_nibble[a >> 28];
+}
+
+int32_t __ctzsi2(uint32_t a){
+	if (a == 0)
+		return 32;
+	return 31 - __clzsi2(a & -a);
+}
+
+uint32_t __udivmodsi4(uint32_t num, uint32_t den, int32_t modwanted){
+	uint32_t bit, res = 0;
+	int32_t shift;
+
+	if (den == 0 || den > num)
+		return modwanted ? num : 0;
+	if ((den & (den - 1)) == 0)
+		return modwanted ? num & (den - 1) : num >> (31 - __clzsi2(den));
+
+	shift = __clzsi2(den) - __clzsi2(num);
+	den <<= shift;
+	bit = 1U << shift;
+	do{
 		if (num >= den){
 			num -= den;
 			res |= bit;
 		}
 		bit >>= 1;
 		den >>= 1;
-	}
+	}while (bit);
 	if (modwanted)
 		return num;
 	return res;
@@ -741,6 +1140,53 @@ uint32_t __umodsi3 (uint32_t a, uint32_t b){
 	return __udivmodsi4(a, b, 1);
 }
 
+/*
+repeated division by the same divisor. div_init() picks a shift for powers of 2, and on
+cores with a multiplier but no divider (NO_HW_DIV) a reciprocal, so each division is a
+multiply high and two shifts (Granlund and Montgomery, round up method). other cores
+just divide.
+*/
+void div_init(struct divider *d, uint32_t den){
+	uint32_t l;
+
+	d->den = den;
+	d->mul = 0;
+	d->shift1 = 0;
+	d->shift2 = 0;
+	if (den == 0)
+		return;
+	if ((den & (den - 1)) == 0){
+		d->shift2 = 31 - __clzsi2(den);
+		return;
+	}
+#if defined(NO_HW_DIV) && !defined(NO_HW_MUL)
+	l = 32 - __clzsi2(den - 1);
+	d->mul = (uint32_t)(((((uint64_t)1 << l) - den) << 32) / den) + 1;
+	d->shift1 = 1;
+	d->shift2 = l - 1;
+#else
+	(void)l;
+#endif
+}
+
+uint32_t div_u32(struct divider *d, uint32_t num){
+	uint32_t t;
+
+	if (d->mul){
+		t = (uint32_t)(((uint64_t)d->mul * num) >> 32);
+		return (t + ((num - t) >> d->shift1)) >> d->shift2;
+	}
+	if ((d->den & (d->den - 1)) == 0)
+		return num >> d->shift2;
+	return num / d->den;
+}
+
+uint32_t mod_u32(struct divider *d, uint32_t num){
+	if ((d->den & (d->den - 1)) == 0)
+		return num & (d->den - 1);
+	return num - div_u32(d, num) * d->den;
+}
+
 int64_t __ashldi3(int64_t u, uint32_t b){
 	dwords uu, w;
 	uint32_t bm;
@@ -811,18 +1257,35 @@ int64_t __lshrdi3(int64_t u, uint32_t b){
 	return w.all;
 }
 
+static int32_t clz64(uint64_t a){
+	uint32_t high = a >> 32;
+
+	return high ? __clzsi2(high) : 32 + __clzsi2((uint32_t)a);
+}
+
 uint64_t __udivmoddi4(uint64_t num, uint64_t den, uint64_t *rem_p){
-	uint64_t quot = 0, qbit = 1;
+	uint64_t quot = 0, qbit;
+	int32_t shift;
 
 	if (den == 0){
 		return 1 / ((uint32_t)den);
 	}
 
-	while ((int64_t)den >= 0){
-		den <<= 1;
-		qbit <<= 1;
+	if (den > num){
+		if (rem_p)
+			*rem_p = num;
+		return 0;
+	}
+	if ((num >> 32) == 0){
+		quot = __udivmodsi4((uint32_t)num, (uint32_t)den, 0);
+		if (rem_p)
+			*rem_p = (uint32_t)num - (uint32_t)quot * (uint32_t)den;
+		return quot;
 	}
 
+	shift = clz64(den) - clz64(num);
+	den <<= shift;
+	qbit = (uint64_t)1 << shift;
 	while (qbit){
 		if (den <= num){
 			num -= den;
@@ -901,7 +1364,7 @@ software implementation of IEEE single-precision floating point
 float __addsf3(float a1, float a2){
 	int32_t mant1, mant2;
 	union float_long fl1, fl2;
-	int32_t exp1, exp2;
+	int32_t exp1, exp2, shift;
 	int32_t sign = 0;
 
 	fl1.f = a1;
@@ -934,10 +1397,13 @@ float __addsf3(float a1, float a2){
 	if (SIGN (fl2.l))
 		mant2 = -mant2;
 
+	/* align, keeping a sticky bit for the bits shifted out (for correct rounding) */
 	if (exp1 > exp2){
-		mant2 >>= exp1 - exp2;
+		shift = exp1 - exp2;
+		mant2 = (mant2 >> shift) | ((mant2 & ((1 << shift) - 1)) != 0);
 	}else{
-		mant1 >>= exp2 - exp1;
+		shift = exp2 - exp1;
+		mant1 = (mant1 >> shift) | ((mant1 & ((1 << shift) - 1)) != 0);
 		exp1 = exp2;
 	}
 	mant1 += mant2;
@@ -952,15 +1418,16 @@ float __addsf3(float a1, float a2){
   		}
 	}
 
-	/* normalize up */
-	while (!(mant1 & 0xE0000000)){
-		mant1 <<= 1;
-		exp1--;
+	/* normalize up (leading one on bit 29 or above) */
+	shift = __clzsi2(mant1) - 2;
+	if (shift > 0){
+		mant1 <<= shift;
+		exp1 -= shift;
 	}
 
 	/* normalize down? */
 	if (mant1 & (1 << 30)){
-		mant1 >>= 1;
+		mant1 = (mant1 >> 1) | (mant1 & 1);
 		exp1++;
 	}
 
@@ -1055,10 +1522,11 @@ int32_t __nesf2(float a, float b){
 	return *(int32_t *) & a != *(int32_t *) & b;
 }
 
-/* multiply two floats */
+/* multiply two floats (24x24 bit mantissa product, rounded to the nearest even) */
 float __mulsf3(float a1, float a2){
 	union float_long fl1, fl2;
-	uint32_t result;
+	uint64_t product;
+	uint32_t result, rem, half, shift;
 	int32_t exp;
 	int32_t sign;
 
@@ -1075,25 +1543,18 @@ float __mulsf3(float a1, float a2){
 	exp = EXP(fl1.l) - EXCESS;
 	exp += EXP(fl2.l);
 
-	fl1.l = MANT (fl1.l);
-	fl2.l = MANT (fl2.l);
-
-	/* the multiply is done as one 16x16 multiply and two 16x8 multiplies */
-	result = (fl1.l >> 8) * (fl2.l >> 8);
-	result += ((fl1.l & 0xFF) * (fl2.l >> 8)) >> 8;
-	result += ((fl2.l & 0xFF) * (fl1.l >> 8)) >> 8;
-
-	result >>= 2;
-	if (result & 0x20000000){
-		/* round */
-		result += 0x20;
-		result >>= 6;
+	product = (uint64_t)MANT(fl1.l) * MANT(fl2.l);
+	if (product & ((uint64_t)1 << 47)){
+		shift = 24;
 	}else{
-		/* round */
-		result += 0x10;
-		result >>= 5;
+		shift = 23;
 		exp--;
 	}
+	result = (uint32_t)(product >> shift);
+	rem = (uint32_t)product & ((1 << shift) - 1);
+	half = 1 << (shift - 1);
+	if (rem > half || (rem == half && (result & 1)))
+		result++;
 	if (result & (HIDDEN<<1)){
 		result >>= 1;
 		exp++;
@@ -1227,48 +1688,40 @@ uint32_t __fixunssfsi(float a_fp){
 	return af;
 }
 
-/* convert int32_t to float */
-float __floatsisf(int32_t af){
-	uint32_t a;
-	uint32_t as, ae;
+/* convert an integer magnitude to float (rounded to the nearest even) */
+static float uint2float(uint32_t af, uint32_t as){
+	uint32_t a, ae, rem, half;
+	int32_t shift;
 
-	as = af>=0 ? 0: 1;
-	af = af>=0 ? af: -af;
-	ae = 0x80 + 22;
-	if(af == 0) 
+	if(af == 0)
 		return LtoF(af);
-	while(af & 0xff000000){
-		++ae;
-		af >>= 1;
-	}
-	while((af & 0xff800000) == 0){
-		--ae;
-		af <<= 1;
+	shift = 8 - __clzsi2(af);
+	if (shift > 0){
+		rem = af & ((1 << shift) - 1);
+		half = 1 << (shift - 1);
+		af >>= shift;
+		if (rem > half || (rem == half && (af & 1))){
+			af++;
+			if (af & (HIDDEN << 1)){
+				af >>= 1;
+				shift++;
+			}
+		}
+	}else{
+		af <<= -shift;
 	}
+	ae = 0x80 + 22 + shift;
 	a = (as << 31) | (ae << 23) | (af & 0x007fffff);
 
 	return LtoF(a);
 }
 
-float __floatunsisf(uint32_t af){
-	uint32_t a;
-	uint32_t as, ae;
-
-	as = af>=0 ? 0: 1;
-	af = af>=0 ? af: -af;
-	ae = 0x80 + 22;
-	if(af == 0) 
-		return LtoF(af);
-	while(af & 0xff000000){
-		++ae;
-		af >>= 1;
-	}
-	while((af & 0xff800000) == 0){
-		--ae;
-		af <<= 1;
-	}
-	a = (as << 31) | (ae << 23) | (af & 0x007fffff);
+/* convert int32_t to float */
+float __floatsisf(int32_t af){
+	return af >= 0 ? uint2float(af, 0) : uint2float(-(uint32_t)af, 1);
+}
 
-	return LtoF(a);
+float __floatunsisf(uint32_t af){
+	return uint2float(af, 0);
 }
 #endif
@@ -0,0 +1,39 @@
+#include <hal.h>
+#include <libc.h>
+#include <bench.h>
+
+void bench_init(struct bench *b)
+{
+	b->min = 0xffffffff;
+	b->max = 0;
+	b->n = 0;
+	b->sum = 0;
+}
+
+void bench_add(struct bench *b, uint32_t val)
+{
+	if (val < b->min) b->min = val;
+	if (val > b->max) b->max = val;
+	b->sum += val;
+	b->n++;
+}
+
+/* average of the samples, 0 with no samples */
+uint32_t bench_avg(struct bench *b)
+{
+	return b->n ? (uint32_t)(b->sum / b->n) : 0;
+}
+
+/* a test with no samples is printed as a single sample of 0 */
+void bench_print(int8_t *name, struct bench *b)
+{
+	if (b->n == 0) bench_add(b, 0);
+	printf("\nBENCH %s %d %d %d %d", name, b->n, b->min, bench_avg(b), b->max);
+}
+
+/* the same, for a figure of a test (printed as <name>_<sub>) */
+void bench_print_sub(int8_t *name, int8_t *sub, struct bench *b)
+{
+	if (b->n == 0) bench_add(b, 0);
+	printf("\nBENCH %s_%s %d %d %d %d", name, sub, b->n, b->min, bench_avg(b), b->max);
+}
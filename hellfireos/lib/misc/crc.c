@@ -1,51 +1,207 @@
 #include <hal.h>
 #include <libc.h>
+#include <crc.h>
+
+#if CRC_METHOD == 2
+#define CRC_TABLES		4
+#else
+#define CRC_TABLES		1
+#endif
 
 /*
 crc16 implementation:
 width=16 poly=0x1021 init=0xffff refin=false refout=false xorout=0x0000 check=0x29b1 name="CRC-16/CCITT-FALSE"
 */
-uint16_t crc16(uint8_t *data, uint32_t len){
-	uint16_t crc = 0xffff, i;
+#define CRC16_POLY		0x1021
+
+#if CRC_METHOD > 0
+static uint16_t crc16_table[CRC_TABLES][256];
+static volatile uint8_t crc16_ready = 0;
+
+/* table k holds the crc of a byte followed by k zero bytes */
+static void crc16_mktable(void){
+	uint16_t crc, i, j;
+
+	for(i = 0; i < 256; ++i){
+		crc = i << 8;
+		for(j = 0; j < 8; ++j)
+			crc = crc << 1 ^ (crc & 0x8000 ? CRC16_POLY : 0x0000);
+		crc16_table[0][i] = crc;
+	}
+	for(j = 1; j < CRC_TABLES; ++j)
+		for(i = 0; i < 256; ++i)
+			crc16_table[j][i] = crc16_table[j - 1][i] << 8 ^ crc16_table[0][crc16_table[j - 1][i] >> 8];
+	crc16_ready = 1;
+}
+#endif
 
-	while(len--){ 
-		crc ^= (uint16_t)*data++ << 8; 
+uint16_t crc16_init(void){
+	return 0xffff;
+}
+
+uint16_t crc16_update(uint16_t crc, uint8_t *data, uint32_t len){
+#if CRC_METHOD == 0
+	uint16_t i;
+
+	while(len--){
+		crc ^= (uint16_t)*data++ << 8;
 
-		for(i = 0; i < 8; ++i) 
-			crc = crc << 1 ^ (crc & 0x8000 ? 0x1021 : 0x0000); 
+		for(i = 0; i < 8; ++i)
+			crc = crc << 1 ^ (crc & 0x8000 ? CRC16_POLY : 0x0000);
+	}
+#else
+	if (!crc16_ready)
+		crc16_mktable();
+#if CRC_METHOD == 2
+	for(; len >= 4; len -= 4, data += 4){
+		crc ^= (uint16_t)data[0] << 8 | data[1];
+		crc = crc16_table[3][crc >> 8] ^ crc16_table[2][crc & 0xff] ^
+			crc16_table[1][data[2]] ^ crc16_table[0][data[3]];
 	}
+#endif
+	while(len--)
+		crc = crc << 8 ^ crc16_table[0][(crc >> 8) ^ *data++];
+#endif
+	return crc;
+}
+
+uint16_t crc16_final(uint16_t crc){
 	return crc;
 }
 
+uint16_t crc16(uint8_t *data, uint32_t len){
+	return crc16_final(crc16_update(crc16_init(), data, len));
+}
+
 /*
 crc32 implementation:
 width=32 poly=0x04c11db7 init=0xffffffff refin=false refout=false xorout=0x00000000 check=0x0376e6e7 name="CRC-32/MPEG-2"
 */
-uint32_t crc32(uint8_t *data, uint32_t len){
-	uint32_t crc = ~0, i;
+#define CRC32_POLY		0x04c11db7
+
+#if CRC_METHOD > 0
+static uint32_t crc32_table[CRC_TABLES][256];
+static volatile uint8_t crc32_ready = 0;
+
+static void crc32_mktable(void){
+	uint32_t crc, i, j;
+
+	for(i = 0; i < 256; ++i){
+		crc = i << 24;
+		for(j = 0; j < 8; ++j)
+			crc = crc << 1 ^ (crc & 0x80000000 ? CRC32_POLY : 0x00000000);
+		crc32_table[0][i] = crc;
+	}
+	for(j = 1; j < CRC_TABLES; ++j)
+		for(i = 0; i < 256; ++i)
+			crc32_table[j][i] = crc32_table[j - 1][i] << 8 ^ crc32_table[0][crc32_table[j - 1][i] >> 24];
+	crc32_ready = 1;
+}
+#endif
+
+uint32_t crc32_init(void){
+	return ~0;
+}
+
+uint32_t crc32_update(uint32_t crc, uint8_t *data, uint32_t len){
+#if CRC_METHOD == 0
+	uint32_t i;
 
 	while(len--){
-		crc ^= (uint32_t)*data++ << 24; 
+		crc ^= (uint32_t)*data++ << 24;
 
 		for(i = 0; i < 8; ++i)
-			crc = crc << 1 ^ (crc & 0x80000000 ? 0x04c11db7 : 0x00000000); 
+			crc = crc << 1 ^ (crc & 0x80000000 ? CRC32_POLY : 0x00000000);
+	}
+#else
+	if (!crc32_ready)
+		crc32_mktable();
+#if CRC_METHOD == 2
+	for(; len >= 4; len -= 4, data += 4){
+		crc ^= (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+		crc = crc32_table[3][crc >> 24] ^ crc32_table[2][(crc >> 16) & 0xff] ^
+			crc32_table[1][(crc >> 8) & 0xff] ^ crc32_table[0][crc & 0xff];
 	}
+#endif
+	while(len--)
+		crc = crc << 8 ^ crc32_table[0][(crc >> 24) ^ *data++];
+#endif
 	return crc;
 }
 
+uint32_t crc32_final(uint32_t crc){
+	return crc;
+}
+
+uint32_t crc32(uint8_t *data, uint32_t len){
+	return crc32_final(crc32_update(crc32_init(), data, len));
+}
+
 /*
 crc64 implementation:
 width=64 poly=0x42f0e1eba9ea3693 init=0x0000000000000000 refin=false refout=false xorout=0x0000000000000000 check=0x6c40df5f0b497347 name="CRC-64"
 */
-uint64_t crc64(uint8_t *data, uint32_t len){
-	uint64_t crc = 0;
+#define CRC64_POLY		0x42f0e1eba9ea3693ull
+
+#if CRC_METHOD > 0
+static uint64_t crc64_table[CRC_TABLES][256];
+static volatile uint8_t crc64_ready = 0;
+
+static void crc64_mktable(void){
+	uint64_t crc;
+	uint32_t i, j;
+
+	for(i = 0; i < 256; ++i){
+		crc = (uint64_t)i << 56;
+		for(j = 0; j < 8; ++j)
+			crc = crc << 1 ^ (crc & 0x8000000000000000ull ? CRC64_POLY : 0x0000000000000000ull);
+		crc64_table[0][i] = crc;
+	}
+	for(j = 1; j < CRC_TABLES; ++j)
+		for(i = 0; i < 256; ++i)
+			crc64_table[j][i] = crc64_table[j - 1][i] << 8 ^ crc64_table[0][crc64_table[j - 1][i] >> 56];
+	crc64_ready = 1;
+}
+#endif
+
+uint64_t crc64_init(void){
+	return 0;
+}
+
+uint64_t crc64_update(uint64_t crc, uint8_t *data, uint32_t len){
+#if CRC_METHOD == 0
 	uint32_t i;
 
 	while(len--){
-		crc ^= (uint64_t)*data++ << 56; 
+		crc ^= (uint64_t)*data++ << 56;
 
 		for(i = 0; i < 8; ++i)
-			crc = crc << 1 ^ (crc & 0x8000000000000000 ? 0x42f0e1eba9ea3693 : 0x0000000000000000); 
+			crc = crc << 1 ^ (crc & 0x8000000000000000ull ? CRC64_POLY : 0x0000000000000000ull);
+	}
+#else
+	uint32_t top;
+
+	if (!crc64_ready)
+		crc64_mktable();
+#if CRC_METHOD == 2
+	for(; len >= 4; len -= 4, data += 4){
+		top = (uint32_t)(crc >> 32) ^ ((uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3]);
+		crc = crc << 32 ^ crc64_table[3][top >> 24] ^ crc64_table[2][(top >> 16) & 0xff] ^
+			crc64_table[1][(top >> 8) & 0xff] ^ crc64_table[0][top & 0xff];
+	}
+#endif
+	while(len--){
+		top = (uint32_t)(crc >> 56) ^ *data++;
+		crc = crc << 8 ^ crc64_table[0][top];
 	}
+#endif
 	return crc;
 }
+
+uint64_t crc64_final(uint64_t crc){
+	return crc;
+}
+
+uint64_t crc64(uint8_t *data, uint32_t len){
+	return crc64_final(crc64_update(crc64_init(), data, len));
+}
@@ -0,0 +1,4 @@
+# UDP to NoC gateway, for platforms including both ustack.mak and noc.mak
+bridge:
+	$(CC) $(CFLAGS) \
+		$(SRC_DIR)/net/uudp/noc_bridge.c
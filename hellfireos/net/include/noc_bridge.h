@@ -0,0 +1,22 @@
+/* UDP to NoC gateway (net/uudp/noc_bridge.c), ustack.h, uudp.h and noc.h must be included first */
+
+#ifndef BRIDGE_MAPS
+#define BRIDGE_MAPS		8		/* UDP ports mapped at once */
+#endif
+#define BRIDGE_STACK		1024		/* stack of the bridge task */
+
+/* UDP port mapped to a NoC endpoint */
+struct noc_bridge {
+	struct uudp comm;		/* socket on the UDP port (must be the first field) */
+	uint16_t cpu;			/* NoC endpoint */
+	uint16_t port;
+	uint16_t channel;		/* channel of the messages sent to the endpoint */
+	uint8_t peer_ip[4];		/* destination of messages from the endpoint (source of the last datagram) */
+	uint16_t peer_port;
+	uint32_t to_noc, to_udp;	/* datagrams forwarded each way */
+	uint32_t dropped;
+};
+
+int32_t hf_bridge_init(uint16_t port, uint16_t channel, uint16_t packets);
+int32_t hf_bridge_map(struct noc_bridge *b, uint16_t udp_port, uint16_t cpu, uint16_t port, uint16_t channel);
+int32_t hf_bridge_unmap(struct noc_bridge *b);
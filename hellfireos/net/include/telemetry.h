@@ -0,0 +1,27 @@
+/* trace and metrics export over UDP (net/uudp/telemetry.c), ustack.h and uudp.h must be included first */
+
+#ifndef TELEMETRY_PERIOD
+#define TELEMETRY_PERIOD	100		/* ms between sends */
+#endif
+#ifndef TELEMETRY_STATS_PERIOD
+#define TELEMETRY_STATS_PERIOD	1000		/* ms between stats datagrams */
+#endif
+#define TELEMETRY_MTU		512		/* maximum datagram size */
+#define TELEMETRY_STACK		1024		/* stack of the telemetry task */
+
+#define TELEMETRY_MAGIC		"HFTM"
+#define TELEMETRY_VERSION	1
+#define TELEMETRY_HEADER	16		/* magic, version, type, cpu, sequence, time */
+
+/* datagram types */
+#define TELEMETRY_STATS		1
+#define TELEMETRY_TRACE		2
+
+/* sections of a stats datagram (tag and length, 16 bit each, then the data) */
+#define TELEMETRY_HEAP		1
+#define TELEMETRY_SCHED		2
+#define TELEMETRY_TASKS		3
+#define TELEMETRY_NET		4
+#define TELEMETRY_NOC		5
+
+int32_t hf_telemetry_init(uint8_t dst_ip[4], uint16_t dst_port, uint32_t rate);
@@ -1,7 +1,47 @@
 /* general configuration definitions */
 #define PACKET_SIZE		1518		/* must be even! between 576 and 1518 (max. for Ethernet) */
-#define ARP_CACHE_SIZE		16		/* number of entries on the ARP cache */
+#define ARP_CACHE_SIZE		16		/* number of entries on the ARP cache (up to 254) */
+#define ARP_HASH_SIZE		16		/* ARP cache hash buckets (power of 2) */
+#define ARP_MAX_AGE		600		/* ARP cache entry lifetime, in network service periods (~500ms) */
+#define ARP_PENDING_HOSTS	4		/* destinations with packets waiting for address resolution */
+#define ARP_PENDING		4		/* packets held for each destination */
+#define ARP_PENDING_TIMEOUT	4		/* periods a destination is resolved (one request per period) */
 #define IP_CFG_PING		113
+#define NETIF_RX_BATCH		4		/* frames handled on each pass of the network service */
+#ifndef PBUF_COUNT
+#define PBUF_COUNT		16		/* packet buffers shared by the stack and all sockets */
+#endif
+#ifndef IP_MAX_DATAGRAM
+#define IP_MAX_DATAGRAM		8192		/* largest IP datagram sent or reassembled from fragments */
+#endif
+#ifndef IP_REASS_SLOTS
+#define IP_REASS_SLOTS		2		/* datagrams being reassembled at once */
+#endif
+#define IP_REASS_TIMEOUT	10		/* network service periods (~500ms) to receive all fragments */
+#ifndef NETIF_TX_QUEUE
+#define NETIF_TX_QUEUE		8		/* frames waiting for transmission (packet buffers) */
+#endif
+#ifndef TCP_CONNS
+#define TCP_CONNS		4		/* TCP connections, including listening ones */
+#endif
+#ifndef TCP_SNDBUF
+#define TCP_SNDBUF		4096		/* TCP send buffer, per connection (power of 2, up to 32768) */
+#endif
+#ifndef TCP_RCVBUF
+#define TCP_RCVBUF		4096		/* TCP receive buffer and window, per connection (power of 2, up to 32768) */
+#endif
+#ifndef USTACK_STATS
+#define USTACK_STATS		0		/* cycles spent on each layer of the stack (ustack_stats[]) */
+#endif
+#ifndef USTACK_HW_CHKSUM
+#define USTACK_HW_CHKSUM	0		/* UDP checksums of frames sent whole computed by the link layer */
+#endif
+#define TCP_TICK		100		/* TCP timer period (ms) */
+#define TCP_RTO			10		/* initial retransmission timeout (ticks) */
+#define TCP_RTO_MAX		320		/* retransmission timeout backoff limit (ticks) */
+#define TCP_RETRIES		8		/* retransmissions before a connection is dropped */
+#define TCP_DELACK		2		/* delayed ACK timeout (ticks) */
+#define TCP_2MSL		20		/* TIME-WAIT state duration, twice the maximum segment lifetime (ticks) */
 
 /* SLIP link definitions */
 #define SLIP_END		192
@@ -111,6 +151,52 @@
 #define UDP_DATA_OFS		28
 #define UDP_HEADER_SIZE		8
 
+/* TCP definitions */
+#define TCP_HDR_SRCPORT1	20
+#define TCP_HDR_SRCPORT2	21
+#define TCP_HDR_DESTPORT1	22
+#define TCP_HDR_DESTPORT2	23
+#define TCP_HDR_SEQ1		24
+#define TCP_HDR_ACK1		28
+#define TCP_HDR_OFFSET		32
+#define TCP_HDR_FLAGS		33
+#define TCP_HDR_WIN1		34
+#define TCP_HDR_WIN2		35
+#define TCP_HDR_CHKSUM1		36
+#define TCP_HDR_CHKSUM2		37
+#define TCP_HDR_URG1		38
+#define TCP_HDR_URG2		39
+#define TCP_DATA_OFS		40
+#define TCP_HEADER_SIZE		20
+#define TCP_MSS			(PACKET_SIZE - ETH_HEADER_SIZE - IP_HEADER_SIZE - TCP_HEADER_SIZE)
+#define TCP_MSS_DEFAULT		536
+
+#define TCP_FIN			0x01
+#define TCP_SYN			0x02
+#define TCP_RST			0x04
+#define TCP_PSH			0x08
+#define TCP_ACK			0x10
+#define TCP_URG			0x20
+#define TCP_OPT_END		0
+#define TCP_OPT_NOP		1
+#define TCP_OPT_MSS		2
+
+#define TCP_CLOSED		0
+#define TCP_LISTEN		1
+#define TCP_SYN_SENT		2
+#define TCP_SYN_RCVD		3
+#define TCP_ESTABLISHED		4
+#define TCP_FIN_WAIT1		5
+#define TCP_FIN_WAIT2		6
+#define TCP_CLOSE_WAIT		7
+#define TCP_CLOSING		8
+#define TCP_LAST_ACK		9
+#define TCP_TIME_WAIT		10
+
+#define TCP_F_NODELAY		0x01		/* Nagle algorithm disabled */
+#define TCP_F_FIN		0x02		/* connection closed by the application, FIN follows the data */
+#define TCP_F_ACKNOW		0x04		/* an ACK must be sent right away */
+
 /* standard ports */
 #define PORT_ECHO		7
 #define PORT_DISCARD		9
@@ -118,9 +204,69 @@
 #define PORT_QOTD		17
 #define PORT_CHARGEN		19
 
+/* TCP connection (the send and receive buffers are rings, sized TCP_SNDBUF and TCP_RCVBUF) */
+struct tcb {
+	uint8_t state;
+	uint8_t flags;
+	uint8_t open;			/* held by the application */
+	uint8_t parent;			/* listening connection (+ 1) of a connection not accepted yet, 0 if none */
+	int8_t err;			/* error of a connection reset or timed out */
+	uint8_t retries;
+	uint16_t rto, rto_timer;	/* retransmission timeout and timer, 0 if stopped (ticks) */
+	uint16_t ack_timer;		/* delayed ACK timer, 0 if no ACK is pending (ticks) */
+	uint8_t remote_ip[4];
+	uint16_t local_port, remote_port;
+	uint16_t mss;			/* peer maximum segment size */
+	uint32_t iss, snd_una, snd_nxt, snd_max;
+	uint16_t snd_wnd;		/* peer receive window */
+	uint16_t snd_head, snd_len;	/* data on the send buffer, from snd_una (not acknowledged yet) */
+	uint32_t rcv_nxt;
+	uint16_t rcv_head, rcv_len;	/* data on the receive buffer, not read by the application yet */
+	uint16_t rcv_adv;		/* last advertised window */
+	uint8_t *sndbuf, *rcvbuf;
+	sem_t event;			/* signaled on new data, acknowledgements and state changes */
+};
+
 struct arp_entry {
 	uint8_t ip[4];
 	uint8_t mac[6];
+	uint8_t valid;
+	uint8_t next;			/* next entry (+ 1) on the hash bucket, 0 if none */
+	uint32_t learned;		/* time the address was learned */
+	uint32_t used;			/* time of the last lookup */
+};
+
+/*
+ * cycles spent on each layer, with USTACK_STATS. figures include the layers above (ip_in
+ * includes udp_in, which includes udp_callback, and ip_out includes netif_send), and
+ * netif_recv is the link layer input of a batch, divided by its frames.
+ */
+enum {
+	STAT_NETIF_RECV, STAT_IP_IN, STAT_UDP_IN, STAT_UDP_CALLBACK, STAT_IP_OUT, STAT_NETIF_SEND,
+	USTACK_STAT_LAYERS
+};
+
+struct ustack_stat {
+	uint32_t count;
+	uint32_t min, max;		/* per frame (packet) */
+	uint64_t cycles;
+};
+
+#if USTACK_STATS == 1
+#define USTACK_STAT(layer, stmt)	do { uint32_t stat_time = _readcounter(); stmt; \
+						ustack_stat_add(layer, _readcounter() - stat_time, 1); } while (0)
+#else
+#define USTACK_STAT(layer, stmt)	stmt
+#endif
+
+/* packet buffer, a whole frame (UDP data starts PBUF_HEADROOM bytes into it) */
+#define PBUF_HEADROOM		(ETH_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE)
+
+struct pbuf {
+	volatile uint32_t ref;
+	uint16_t len;			/* frame size, while queued for transmission */
+	uint16_t size;			/* frame buffer size (PACKET_SIZE, or larger for reassembled datagrams) */
+	uint8_t frame[];
 };
 
 extern uint8_t myip[4];
@@ -128,6 +274,8 @@ extern uint8_t mynm[4];
 extern uint8_t mygw[4];
 extern uint8_t mymac[6];
 extern struct arp_entry arp_cache[ARP_CACHE_SIZE];
+extern struct ustack_stat ustack_stats[USTACK_STAT_LAYERS];
+extern const int8_t *ustack_stat_names[USTACK_STAT_LAYERS];
 
 /* layer 1 */
 extern uint8_t *frame_in, *frame_out;
@@ -137,13 +285,36 @@ extern int32_t en_init();
 extern int32_t en_watchdog(void);
 extern void en_ll_output(uint8_t *frame, uint16_t size);
 extern int32_t en_ll_input(uint8_t *frame);
+extern int32_t en_ll_inputv(uint8_t **frames, int32_t *sizes, int32_t max);
+
+/* packet buffers */
+int32_t pbuf_init(uint32_t count, uint32_t large);
+struct pbuf *pbuf_alloc(void);
+struct pbuf *pbuf_alloc_large(void);
+void pbuf_ref(struct pbuf *p);
+void pbuf_free(struct pbuf *p);
+struct pbuf *pbuf_get(uint8_t *ptr);
+
+/* layer statistics */
+void ustack_stat_add(int32_t layer, uint32_t cycles, uint32_t count);
+void ustack_resetstats(void);
+
+/* checksums */
+uint32_t chksum_add(uint32_t sum, uint8_t *buf, uint16_t len);
+uint16_t chksum_fold(uint32_t sum);
+uint16_t chksum_update(uint16_t chksum, uint16_t old, uint16_t new);
 
 /* layer 2 */
 void ustack_init(void);
 uint16_t netif_send(uint8_t *packet, uint16_t len);
+int32_t netif_sendv(uint8_t **packets, uint16_t *lens, int32_t n);
 uint16_t netif_recv(uint8_t *packet);
+int32_t netif_recvv(uint8_t **packets, uint16_t *lens, int32_t max);
+void netif_rxirq(void);
 int32_t arp_reply(uint8_t *frame);
 int32_t arp_request(uint8_t *frame);
+void arp_init(void);
+void arp_age(void);
 int32_t arp_update(uint8_t *ip, uint8_t *mac);
 int32_t arp_check(uint8_t *ip, uint8_t *mac);
 
@@ -154,11 +325,28 @@ int32_t ip_addr_isany(uint8_t addr[4]);
 int32_t ip_addr_isbroadcast(uint8_t addr[4], uint8_t mask[4]);
 int32_t ip_addr_ismulticast(uint8_t addr[4]);
 int32_t ip_out(uint8_t dst_addr[4], uint8_t *packet, uint16_t len);
+int32_t ip_outv(uint8_t dst_addr[4], uint8_t **packets, uint16_t *lens, int32_t n);
+int32_t ip_outfrag(uint8_t dst_addr[4], uint8_t proto, uint8_t *hdr, uint16_t hdr_len, uint8_t *data, uint16_t len);
 int32_t ip_in(uint8_t dst_addr[4], uint8_t *packet, uint16_t len);
+void ip_reass_age(void);
 int32_t icmp_echo_reply(uint8_t *packet, uint16_t len);
 
 /* layer 4 */
 int32_t udp_out(uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port, uint8_t *packet, uint16_t len);
+int32_t udp_outv(uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port, uint8_t *data, uint16_t len);
+int32_t udp_outm(uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port, uint8_t **packets, uint16_t *lens, int32_t n);
 int32_t udp_in(uint8_t *packet);
 void udp_set_callback(void (*callback)(uint8_t *packet));
 void *udp_get_callback(void);
+int32_t tcp_init(void);
+int32_t tcp_in(uint8_t *packet, uint16_t len);
+void tcp_timer(void);
+
+/* TCP sockets */
+int32_t hf_tcp_listen(uint16_t port);
+int32_t hf_tcp_accept(int32_t id);
+int32_t hf_tcp_connect(uint8_t dst_addr[4], uint16_t port);
+int32_t hf_tcp_send(int32_t id, uint8_t *buf, uint16_t len);
+int32_t hf_tcp_recv(int32_t id, uint8_t *buf, uint16_t size);
+int32_t hf_tcp_close(int32_t id);
+int32_t hf_tcp_nodelay(int32_t id, int32_t on);
@@ -1,13 +1,39 @@
 #define UUDP_RETRIES		5
 #define UUDP_DELAY_ON_RETRY	200		/* delay (in ms) */
 
+#define UUDP_BATCH		8		/* datagrams handed to the stack at once by hf_uudp_sendm() */
+
+#define UUDP_MODULE_CHUNK	1024		/* module file data per datagram (hf_module_uudp()) */
+#define UUDP_MODULE_TIMEOUT	2000		/* ms without a datagram to abort a module transfer */
+
+#ifndef UUDP_HASH_SIZE
+#define UUDP_HASH_SIZE		16		/* port hash buckets, must be a power of 2 */
+#endif
+
 struct uudp {
+	struct ilist link;
 	uint16_t listen_port;
-	struct queue *free_buffers;
+	uint16_t owner;			/* task which created the socket, destroyed if it is killed (0: kept) */
 	struct queue *pkt_queue;
+	sem_t pkt_sem;			/* counts the datagrams on the packet queue */
+	void (*forward)(struct uudp *comm, uint8_t *packet);	/* takes datagrams in place of the queue, if set */
+};
+
+/* datagram of a batch (hf_uudp_sendm() / hf_uudp_recvm()) */
+struct uudp_msg {
+	uint8_t *buf;
+	uint16_t len;			/* data size (on receive, the buffer size and then the data size) */
+	uint8_t ip[4];			/* source address (receive only) */
+	uint16_t port;			/* source port (receive only) */
 };
 
 int32_t hf_uudp_create(struct uudp *comm, uint16_t listen_port, uint32_t qsize);
 int32_t hf_uudp_destroy(struct uudp *comm);
+int32_t hf_uudp_recvn(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf, uint16_t size);
 int32_t hf_uudp_recv(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf);
+int32_t hf_uudp_recvwait(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf, uint16_t size);
+int32_t hf_uudp_recv_timeout(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf, uint16_t size, uint32_t timeout);
+int32_t hf_uudp_recvm(struct uudp *comm, struct uudp_msg *msgs, int32_t n, uint32_t timeout);
 int32_t hf_uudp_send(struct uudp *comm, uint8_t dst_ip[4], uint16_t dst_port, uint8_t *buf, uint16_t len);
+int32_t hf_uudp_sendm(struct uudp *comm, uint8_t dst_ip[4], uint16_t dst_port, struct uudp_msg *msgs, int32_t n);
+int32_t hf_module_uudp(struct uudp *comm, struct module *m);
@@ -1,8 +1,13 @@
 ustack:
 	$(CC) $(CFLAGS) \
 		$(SRC_DIR)/net/ustack/arp.c \
+		$(SRC_DIR)/net/ustack/chksum.c \
 		$(SRC_DIR)/net/ustack/eth_netif.c \
+		$(SRC_DIR)/net/ustack/pbuf.c \
+		$(SRC_DIR)/net/ustack/stats.c \
 		$(SRC_DIR)/net/ustack/ip.c \
 		$(SRC_DIR)/net/ustack/icmp.c \
 		$(SRC_DIR)/net/ustack/udp.c \
-		$(SRC_DIR)/net/uudp/uudp.c
+		$(SRC_DIR)/net/ustack/tcp.c \
+		$(SRC_DIR)/net/uudp/uudp.c \
+		$(SRC_DIR)/net/uudp/telemetry.c
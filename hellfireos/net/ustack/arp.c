@@ -8,7 +8,8 @@
 #include <ustack.h>
 
 struct arp_entry arp_cache[ARP_CACHE_SIZE];
-static uint32_t arp_index = 0;
+static uint8_t arp_hash[ARP_HASH_SIZE];		/* first entry (+ 1) of each bucket, 0 if empty */
+static uint32_t arp_clock = 0;			/* network service periods (arp_age()) */
 
 int32_t arp_reply(uint8_t *frame)
 {
@@ -64,39 +65,97 @@ int32_t arp_request(uint8_t *frame)
 	return ETH_HEADER_SIZE + ARP_FRAME_SIZE;
 }
 
-int32_t arp_update(uint8_t *ip, uint8_t *mac)
+/*
+ * ARP cache
+ * 
+ * entries are chained on ARP_HASH_SIZE buckets (hashed on the IP address), so a lookup only
+ * compares the entries of a bucket. each entry keeps the time it was learned (it expires
+ * after ARP_MAX_AGE) and the time of its last use. when the cache is full, the least recently
+ * used entry is replaced.
+ */
+static uint32_t arp_bucket(uint8_t *ip)
+{
+	return (ip[0] ^ ip[1] ^ (ip[2] << 1) ^ ip[3]) & (ARP_HASH_SIZE - 1);
+}
+
+static int32_t arp_find(uint8_t *ip)
 {
 	int32_t i;
 	
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
+	for (i = arp_hash[arp_bucket(ip)] - 1; i >= 0; i = arp_cache[i].next - 1)
 		if (!memcmp(ip, arp_cache[i].ip, 4)) break;
 	
-	if (i < ARP_CACHE_SIZE){
+	return i;
+}
+
+static void arp_unlink(int32_t e)
+{
+	uint8_t *l;
+	
+	for (l = &arp_hash[arp_bucket(arp_cache[e].ip)]; *l; l = &arp_cache[*l - 1].next){
+		if (*l - 1 == e){
+			*l = arp_cache[e].next;
+			break;
+		}
+	}
+	arp_cache[e].valid = 0;
+}
+
+void arp_init(void)
+{
+	memset(arp_cache, 0, sizeof(arp_cache));
+	memset(arp_hash, 0, sizeof(arp_hash));
+}
+
+void arp_age(void)
+{
+	arp_clock++;
+}
+
+int32_t arp_update(uint8_t *ip, uint8_t *mac)
+{
+	int32_t i, b;
+	
+	i = arp_find(ip);
+	if (i >= 0){
 		memcpy(arp_cache[i].mac, mac, 6);
+		arp_cache[i].learned = arp_cache[i].used = arp_clock;
 		
 		return 1;
-	}else{
-		memcpy(arp_cache[arp_index].ip, ip, 4);
-		memcpy(arp_cache[arp_index].mac, mac, 6);
-		i = arp_index;
-		arp_index = (arp_index + 1) % ARP_CACHE_SIZE;
-		
-		return 0;
 	}
+	
+	for (i = 0; i < ARP_CACHE_SIZE && arp_cache[i].valid; i++);
+	if (i == ARP_CACHE_SIZE){
+		for (i = 0, b = 1; b < ARP_CACHE_SIZE; b++)
+			if (arp_clock - arp_cache[b].used > arp_clock - arp_cache[i].used)
+				i = b;
+		arp_unlink(i);
+	}
+	memcpy(arp_cache[i].ip, ip, 4);
+	memcpy(arp_cache[i].mac, mac, 6);
+	arp_cache[i].learned = arp_cache[i].used = arp_clock;
+	arp_cache[i].valid = 1;
+	b = arp_bucket(ip);
+	arp_cache[i].next = arp_hash[b];
+	arp_hash[b] = i + 1;
+	
+	return 0;
 }
 
 int32_t arp_check(uint8_t *ip, uint8_t *mac)
 {
 	int32_t i;
 	
-	for (i = 0; i < ARP_CACHE_SIZE; i++)
-		if (!memcmp(ip, arp_cache[i].ip, 4)) break;
-	
-	if (i < ARP_CACHE_SIZE){
-		memcpy(mac, arp_cache[i].mac, 6);
+	i = arp_find(ip);
+	if (i < 0)
+		return 0;
+	if (arp_clock - arp_cache[i].learned > ARP_MAX_AGE){
+		arp_unlink(i);
 		
-		return 1;
-	}else{
 		return 0;
 	}
+	arp_cache[i].used = arp_clock;
+	memcpy(mac, arp_cache[i].mac, 6);
+	
+	return 1;
 }
@@ -0,0 +1,86 @@
+/* file:          chksum.c
+ * description:   Internet checksum (RFC1071) and incremental update (RFC1624)
+ * date:          10/2026
+ */
+
+#include <hellfire.h>
+#include <ustack.h>
+
+/*
+ * add the 16 bit words of a buffer to a running sum. the sum is kept as an integer (the
+ * sum of big endian words, not folded), so pseudo header fields may be added to it
+ * directly. the buffer is read 32 bits at a time from an aligned address, counting the
+ * carries and folding them once at the end. the buffer may start at any address, but its
+ * length must be even unless it is the last one of a sum.
+ */
+uint32_t chksum_add(uint32_t sum, uint8_t *buf, uint16_t len)
+{
+	uint32_t s = 0, c = 0, w, lead = 0;
+	int32_t odd = 0;
+
+	/* an odd start address shifts the bytes of all words, so swap the partial sum below */
+	if (len && ((uint32_t)buf & 1)){
+		lead = (uint32_t)*buf++ << 8;
+		len--;
+		odd = 1;
+	}
+	if (len >= 2 && ((uint32_t)buf & 2)){
+		s = *(uint16_t *)buf;
+		buf += 2;
+		len -= 2;
+	}
+	for (; len >= 4; len -= 4, buf += 4){
+		w = *(uint32_t *)buf;
+		s += w;
+		c += s < w;
+	}
+	if (len >= 2){
+		w = *(uint16_t *)buf;
+		s += w;
+		c += s < w;
+		buf += 2;
+		len -= 2;
+	}
+	if (len){
+#ifdef LITTLE_ENDIAN
+		w = *buf;
+#else
+		w = (uint32_t)*buf << 8;
+#endif
+		s += w;
+		c += s < w;
+	}
+
+	/* each carry out of a 32 bit word weighs 1 on a one's complement 16 bit sum */
+	s = (s >> 16) + (s & 0xffff) + c;
+	s = (s >> 16) + (s & 0xffff);
+	s = (s >> 16) + (s & 0xffff);
+#ifdef LITTLE_ENDIAN
+	s = ((s >> 8) | (s << 8)) & 0xffff;
+#endif
+	if (odd)
+		s = ((s >> 8) | (s << 8)) & 0xffff;
+
+	return sum + s + lead;
+}
+
+/*
+ * fold a running sum to 16 bits (a valid packet folds to 0xffff, the checksum field is
+ * the complement of the folded sum)
+ */
+uint16_t chksum_fold(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+
+	return (uint16_t)sum;
+}
+
+/*
+ * update a checksum field after a 16 bit word of the data is rewritten from old to new,
+ * without summing the data again (RFC1624, eqn. 3: HC' = ~(~HC + ~m + m'))
+ */
+uint16_t chksum_update(uint16_t chksum, uint16_t old, uint16_t new)
+{
+	return ~chksum_fold((~chksum & 0xffff) + (~old & 0xffff) + new);
+}
@@ -5,6 +5,31 @@ uint8_t myip[4] = {0, 0, 0, 0};
 uint8_t mynm[4] = {0, 0, 0, 0};
 uint8_t mygw[4] = {0, 0, 0, 0};
 
+static struct pbuf *netif_rxbufs[NETIF_RX_BATCH];
+static struct queue *netif_txqueue;
+static sem_t netif_txsem, netif_txfree;
+static mutex_t netif_txlock;
+
+/* packets waiting for the resolution of a destination (next hop) address */
+struct netif_pending {
+	uint8_t ip[4];
+	uint8_t count;			/* packets held, 0 if the entry is free */
+	uint8_t age;			/* network service periods since the first request */
+	struct pbuf *p[ARP_PENDING];
+};
+
+static struct netif_pending netif_pend[ARP_PENDING_HOSTS];
+static mutex_t netif_arplock;
+
+#if USTACK_IRQ == 1
+static sem_t netif_rxsem;
+static volatile uint8_t netif_ready;
+#endif
+#if STATIC_TASKS == 1
+static HF_STACK(ustack_stack, 2048);
+static HF_STACK(netif_tx_stack, 1024);
+#endif
+
 static int32_t is_broadcast_mac(uint8_t *frame)
 {
 	uint8_t bcast_addr[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
@@ -34,6 +59,147 @@ static int32_t is_local_mac(uint8_t *frame)
 }
 
 
+/*
+ * frame transmission: frames placed on packet buffers are queued (the queue holds a reference
+ * to each buffer) and sent by the transmission task, so senders do not wait for the link layer
+ * driver. senders wait only when the queue is full. other frames are sent right away, as their
+ * buffers may be reused once this returns.
+ */
+static void netif_output(uint8_t *frame, uint16_t size)
+{
+	struct pbuf *p;
+	int32_t err;
+	
+	p = pbuf_get(frame);
+	if (p && frame == p->frame && netif_txqueue){
+		hf_semwait(&netif_txfree);
+		pbuf_ref(p);
+		p->len = size;
+		hf_mtxlock(&netif_txlock);
+		err = hf_queue_addtail(netif_txqueue, p);
+		hf_mtxunlock(&netif_txlock);
+		if (!err){
+			hf_sempost(&netif_txsem);
+			return;
+		}
+		pbuf_free(p);
+		hf_sempost(&netif_txfree);
+	}
+	en_ll_output(frame, size);
+}
+
+/*
+ * transmission task: drains the transmission queue to the link layer driver
+ */
+static void netif_tx(void)
+{
+	struct pbuf *p;
+	
+	while (1){
+		hf_semwait(&netif_txsem);
+		hf_mtxlock(&netif_txlock);
+		p = hf_queue_remhead(netif_txqueue);
+		hf_mtxunlock(&netif_txlock);
+		if (!p) continue;
+		en_ll_output(p->frame, p->len);
+		pbuf_free(p);
+		hf_sempost(&netif_txfree);
+	}
+}
+
+/*
+ * address resolution: ARP requests get a buffer of their own (frame is used only if there
+ * is no free packet buffer and may be NULL). packets to a destination being resolved are
+ * held on a small queue (with a reference to their packet buffers) and sent once the reply
+ * arrives. a destination is dropped, with its packets, after ARP_PENDING_TIMEOUT requests.
+ * netif_arplock must be held.
+ */
+static void netif_arprequest(uint8_t *ip, uint8_t *frame)
+{
+	struct pbuf *p;
+	int32_t l;
+	
+	p = pbuf_alloc();
+	if (p) frame = p->frame;
+	if (!frame) return;
+	l = arp_request(frame);
+	memcpy(&frame[ARP_TARGET_IP_OFS], ip, 4);
+	netif_output(frame, l + ETH_HEADER_SIZE);
+	if (p) pbuf_free(p);
+}
+
+/* returns 2 if the packet is held for a new destination, 1 if for one already being resolved, 0 if not held */
+static int32_t netif_hold(uint8_t *ip, uint8_t *frame, uint16_t size)
+{
+	struct netif_pending *e = NULL;
+	struct pbuf *p;
+	int32_t i, n = 2;
+	
+	p = pbuf_get(frame);
+	if (!p || frame != p->frame)
+		return 0;
+	for (i = 0; i < ARP_PENDING_HOSTS; i++){
+		if (netif_pend[i].count && !memcmp(netif_pend[i].ip, ip, 4)){
+			e = &netif_pend[i];
+			n = 1;
+			break;
+		}
+		if (!netif_pend[i].count && !e)
+			e = &netif_pend[i];
+	}
+	if (!e || e->count == ARP_PENDING)
+		return 0;
+	if (n == 2){
+		memcpy(e->ip, ip, 4);
+		e->age = 0;
+	}
+	pbuf_ref(p);
+	p->len = size;
+	e->p[e->count++] = p;
+	
+	return n;
+}
+
+static void netif_release(uint8_t *ip, uint8_t *mac)
+{
+	struct netif_pending *e;
+	uint8_t *frame;
+	int32_t i, j;
+	
+	for (i = 0; i < ARP_PENDING_HOSTS; i++){
+		e = &netif_pend[i];
+		if (!e->count || memcmp(e->ip, ip, 4)) continue;
+		for (j = 0; j < e->count; j++){
+			frame = e->p[j]->frame;
+			memcpy(&frame[ETH_SA_OFS], mymac, 6);
+			memcpy(&frame[ETH_DA_OFS], mac, 6);
+			netif_output(frame, e->p[j]->len);
+			pbuf_free(e->p[j]);
+		}
+		e->count = 0;
+	}
+}
+
+static void netif_pending_age(void)
+{
+	struct netif_pending *e;
+	int32_t i, j;
+	
+	hf_mtxlock(&netif_arplock);
+	for (i = 0; i < ARP_PENDING_HOSTS; i++){
+		e = &netif_pend[i];
+		if (!e->count) continue;
+		if (++e->age < ARP_PENDING_TIMEOUT){
+			netif_arprequest(e->ip, NULL);
+		}else{
+			for (j = 0; j < e->count; j++)
+				pbuf_free(e->p[j]);
+			e->count = 0;
+		}
+	}
+	hf_mtxunlock(&netif_arplock);
+}
+
 /*
  * network interface send() / receive()
  * 
@@ -42,11 +208,16 @@ static int32_t is_local_mac(uint8_t *frame)
  * -handle broadcast frames
  * -handle ARP protocol
  */ 
-uint16_t netif_send(uint8_t *packet, uint16_t len)
+
+/*
+ * find the link layer destination of a packet. returns 1 if mac is known, 2 if the packet is
+ * held while the address is resolved and 0 if it is lost (the sender may retry).
+ */
+static int32_t netif_resolve(uint8_t *packet, uint16_t len, uint8_t mac[6])
 {
-	uint8_t mac[6], ip[4];
+	uint8_t ip[4];
 	uint8_t *frame;
-	int32_t l, arp_r = 0;
+	int32_t held, arp_r = 0;
 	
 	frame = packet - ETH_HEADER_SIZE;
 	memcpy(ip, &packet[IP_HDR_DESTADDR1], 4);
@@ -64,35 +235,75 @@ uint16_t netif_send(uint8_t *packet, uint16_t len)
 			if (!ip_addr_maskcmp(ip, myip, mynm))
 				memcpy(ip, mygw, 4);
 				
+			hf_mtxlock(&netif_arplock);
 			arp_r = arp_check(ip, mac);
+			if (!arp_r){
+				frame[ETH_TYPE_OFS] = FRAME_IP >> 8;
+				frame[ETH_TYPE_OFS + 1] = FRAME_IP & 0xff;
+				held = netif_hold(ip, frame, len + ETH_HEADER_SIZE);
+				if (held != 1)
+					netif_arprequest(ip, held ? NULL : frame);
+				hf_mtxunlock(&netif_arplock);
+				
+				/* a packet which is not held is lost, and the sender may retry */
+				return held ? 2 : 0;
+			}
+			hf_mtxunlock(&netif_arplock);
 		}
 	}
-
-	if (arp_r){
-		memcpy(&frame[ETH_SA_OFS], mymac, 6);
-		memcpy(&frame[ETH_DA_OFS], mac, 6);
-		frame[ETH_TYPE_OFS] = FRAME_IP >> 8;
-		frame[ETH_TYPE_OFS + 1] = FRAME_IP & 0xff;
-		en_ll_output(frame, len + ETH_HEADER_SIZE);
-			
-		return len + ETH_HEADER_SIZE;
-	}else{
-		l = arp_request(frame);
-		memcpy(&frame[ARP_TARGET_IP_OFS], ip, 4);
-		en_ll_output(frame, l + ETH_HEADER_SIZE);
 	
-		return 0;
-	}
+	return 1;
 }
 
-uint16_t netif_recv(uint8_t *packet)
+static void netif_frame(uint8_t *packet, uint16_t len, uint8_t mac[6])
 {
-	int32_t len = 0, ll_len;
-	uint16_t type;
 	uint8_t *frame;
 	
 	frame = packet - ETH_HEADER_SIZE;
-	ll_len = en_ll_input(frame);
+	memcpy(&frame[ETH_SA_OFS], mymac, 6);
+	memcpy(&frame[ETH_DA_OFS], mac, 6);
+	frame[ETH_TYPE_OFS] = FRAME_IP >> 8;
+	frame[ETH_TYPE_OFS + 1] = FRAME_IP & 0xff;
+	netif_output(frame, len + ETH_HEADER_SIZE);
+}
+
+uint16_t netif_send(uint8_t *packet, uint16_t len)
+{
+	uint8_t mac[6];
+	int32_t r;
+	
+	r = netif_resolve(packet, len, mac);
+	if (r == 1)
+		netif_frame(packet, len, mac);
+	
+	return r ? len + ETH_HEADER_SIZE : 0;
+}
+
+/*
+ * send a batch of packets to the same destination, resolving its link layer address once.
+ * returns the number of packets taken (sent or held).
+ */
+int32_t netif_sendv(uint8_t **packets, uint16_t *lens, int32_t n)
+{
+	uint8_t mac[6];
+	int32_t i, r = 0;
+	
+	for (i = 0; i < n; i++){
+		if (r != 1)
+			r = netif_resolve(packets[i], lens[i], mac);
+		if (r == 0)
+			break;
+		if (r == 1)
+			netif_frame(packets[i], lens[i], mac);
+	}
+	
+	return i;
+}
+
+static uint16_t netif_input(uint8_t *frame, int32_t ll_len)
+{
+	int32_t len = 0;
+	uint16_t type;
 	
 	if (ll_len > 0){
 		if (is_local_mac(frame) || is_broadcast_mac(frame) || is_any_mac(frame)){
@@ -106,13 +317,16 @@ uint16_t netif_recv(uint8_t *packet)
 							if ((frame[ARP_OPCODE_OFS] << 8 | frame[ARP_OPCODE_OFS + 1]) == OP_ARP_REQUEST){
 								if (!memcmp(&frame[ARP_TARGET_IP_OFS], myip, 4)){
 									len = arp_reply(frame);
-									en_ll_output(frame, len);
+									netif_output(frame, len);
 									
 									return 0;
 								}
 							}
 							if ((frame[ARP_OPCODE_OFS] << 8 | frame[ARP_OPCODE_OFS + 1]) == OP_ARP_ANSWER){
+								hf_mtxlock(&netif_arplock);
 								arp_update(&frame[ARP_SENDER_IP_OFS], &frame[ARP_SENDER_HA_OFS]);
+								netif_release(&frame[ARP_SENDER_IP_OFS], &frame[ARP_SENDER_HA_OFS]);
+								hf_mtxunlock(&netif_arplock);
 							}
 						}
 					}
@@ -137,12 +351,78 @@ uint16_t netif_recv(uint8_t *packet)
 		return len;
 }
 
+uint16_t netif_recv(uint8_t *packet)
+{
+	uint8_t *frame;
+	
+	frame = packet - ETH_HEADER_SIZE;
+	
+	return netif_input(frame, en_ll_input(frame));
+}
+
+/*
+ * batched receive: up to max frames are taken from the interface at once (so the link
+ * layer driver locks the device and checks for frames only once), and handled in order.
+ * the driver gets a packet buffer for each frame (a driver which receives in place may
+ * hand out its own buffers instead). packets[] and lens[] get the IP packets (valid until
+ * the next call) and their sizes (0 when there is nothing to pass upstream). a layer which
+ * keeps a packet takes a reference to its buffer, and the buffer is replaced on the next
+ * call. returns the number of frames taken.
+ */
+int32_t netif_recvv(uint8_t **packets, uint16_t *lens, int32_t max)
+{
+	uint8_t *frames[NETIF_RX_BATCH];
+	int32_t sizes[NETIF_RX_BATCH];
+	int32_t i, n;
+#if USTACK_STATS == 1
+	uint32_t time;
+	
+	time = _readcounter();
+#endif
+	
+	if (max > NETIF_RX_BATCH) max = NETIF_RX_BATCH;
+	for (i = 0; i < max; i++){
+		if (netif_rxbufs[i] && netif_rxbufs[i]->ref > 1){
+			pbuf_free(netif_rxbufs[i]);
+			netif_rxbufs[i] = NULL;
+		}
+		if (!netif_rxbufs[i])
+			netif_rxbufs[i] = pbuf_alloc();
+		frames[i] = netif_rxbufs[i] ? netif_rxbufs[i]->frame : NULL;
+	}
+	n = en_ll_inputv(frames, sizes, max);
+	for (i = 0; i < n; i++){
+		packets[i] = frames[i] + ETH_HEADER_SIZE;
+		lens[i] = netif_input(frames[i], sizes[i]);
+	}
+#if USTACK_STATS == 1
+	if (n > 0)
+		ustack_stat_add(STAT_NETIF_RECV, _readcounter() - time, n);
+#endif
+	
+	return n;
+}
+
+#if USTACK_IRQ == 1
+/* 
+ * frame arrival, called by an interrupt driven link layer driver from its interrupt handler
+ */
+void netif_rxirq(void)
+{
+	if (netif_ready)
+		hf_sempost_isr(&netif_rxsem);
+}
+#endif
+
 /* 
  * network stack service
  * 
  * the job of this service includes:
- * -pass a received packet upstream using netif_recv()
+ * -pass received packets upstream using netif_recvv(), a batch of frames at a time
  * -poll the interface for link status each ~500ms
+ * -age the ARP cache and retry pending address resolutions on the same period
+ * -drop IP datagrams which were not reassembled in time
+ * -run the TCP timers each TCP_TICK ms
  * 
  * we have some issues here. for this mechanism to work with the rest of the network stack,
  * a whole packet should be handled at once (while the ustack_service thread is running).
@@ -153,21 +433,44 @@ uint16_t netif_recv(uint8_t *packet)
  * mechanism implemented in the BE scheduler works as expected.
  * 
  * an interrupt driven network driver should mark this thread as critical when a packet
- * arrives.
+ * arrives. with USTACK_IRQ, the driver also calls netif_rxirq() from its interrupt handler
+ * and this thread sleeps on a semaphore between frames, instead of polling the interface.
+ * the semaphore is signaled at least once per batch (the driver interrupt is masked until
+ * frames are read, and raised again while there are frames left), and the wait times out to
+ * keep the link status checks going while the network is idle.
  */
 static void ustack_service(void)
 {
-	uint16_t len;
-	uint32_t time, timeout = 500 * (CPU_SPEED / 2000);
+	uint8_t *packets[NETIF_RX_BATCH];
+	uint16_t lens[NETIF_RX_BATCH];
+	int32_t i, n;
+	uint32_t time, tcp_time, timeout = 500 * (CPU_SPEED / 2000), tcp_timeout = TCP_TICK * (CPU_SPEED / 2000);
+#if USTACK_IRQ == 1
+	uint32_t ticks;
+
+	ticks = hf_ticktime() ? TCP_TICK * 1000 / hf_ticktime() : 1;
+	if (ticks == 0) ticks = 1;
+#endif
 
 	time = _readcounter();
+	tcp_time = time;
 	while(1){
-		len = netif_recv(frame_in + ETH_HEADER_SIZE);
-		if (len > 0){
-			ip_in(myip, frame_in + ETH_HEADER_SIZE, len);
+#if USTACK_IRQ == 1
+		hf_semwait_timeout(&netif_rxsem, ticks);
+#endif
+		n = netif_recvv(packets, lens, NETIF_RX_BATCH);
+		for (i = 0; i < n; i++)
+			if (lens[i] > 0)
+				USTACK_STAT(STAT_IP_IN, ip_in(myip, packets[i], lens[i]));
+		if (_readcounter() - tcp_time > tcp_timeout){
+			tcp_timer();
+			tcp_time = _readcounter();
 		}
 		if (_readcounter() - time > timeout) {		// check link status each ~500ms
 			en_watchdog();
+			arp_age();
+			netif_pending_age();
+			ip_reass_age();
 			time = _readcounter();
 		}
 	}
@@ -193,9 +496,45 @@ void ustack_init(void)
 	kprintf("\nKERNEL: IP: %d.%d.%d.%d, netmask: %d.%d.%d.%d, gateway: %d.%d.%d.%d",
 		myip[0], myip[1], myip[2], myip[3], mynm[0], mynm[1], mynm[2], mynm[3], mygw[0], mygw[1], mygw[2], mygw[3]);
 	
-	memset(arp_cache, 0, sizeof(arp_cache));
+	arp_init();
+	hf_mtxinit(&netif_arplock);
 	udp_set_callback(NULL);
+	if (pbuf_init(PBUF_COUNT, IP_REASS_SLOTS)){
+		kprintf("\nKERNEL: ustack, could not create the packet buffers");
+		return;
+	}
+	if (tcp_init()){
+		kprintf("\nKERNEL: ustack, could not initialize TCP");
+		return;
+	}
+	if (hf_seminit(&netif_txsem, 0) || hf_seminit(&netif_txfree, NETIF_TX_QUEUE)){
+		kprintf("\nKERNEL: ustack, could not create the transmission queue");
+		return;
+	}
+	hf_mtxinit(&netif_txlock);
+#if LOCK_STATS == 1
+	hf_mtxstat(&netif_txlock, "netif_txlock");
+#endif
+	netif_txqueue = hf_queue_create(NETIF_TX_QUEUE);
+	if (!netif_txqueue){
+		kprintf("\nKERNEL: ustack, could not create the transmission queue");
+		return;
+	}
 	
-	/* add the network service */
+#if USTACK_IRQ == 1
+	/* frames which arrived before this point are taken on the first pass of the service */
+	if (hf_seminit(&netif_rxsem, 1)){
+		kprintf("\nKERNEL: ustack, could not create the receive semaphore");
+		return;
+	}
+	netif_ready = 1;
+#endif
+	/* add the network service and the transmission task */
+#if STATIC_TASKS == 1
+	hf_spawn_static(ustack_service, 0, 0, 0, "ustack", ustack_stack, sizeof(ustack_stack));
+	hf_spawn_static(netif_tx, 0, 0, 0, "ustack_tx", netif_tx_stack, sizeof(netif_tx_stack));
+#else
 	hf_spawn(ustack_service, 0, 0, 0, "ustack", 2048);
+	hf_spawn(netif_tx, 0, 0, 0, "ustack_tx", 1024);
+#endif
 }
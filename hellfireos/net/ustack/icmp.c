@@ -15,11 +15,7 @@ int32_t icmp_echo_reply(uint8_t *packet, uint16_t len)
 	if (packet[ICMP_HDR_TYPE] == ICMP_ECHO){
 		packet[ICMP_HDR_TYPE] = ICMP_ECHO_REPLY;
 		chksum = (packet[ICMP_HDR_CHKSUM1] << 8) + packet[ICMP_HDR_CHKSUM2];
-		if (chksum > (0xffff - (ICMP_ECHO << 8))){
-			chksum += (ICMP_ECHO << 8) + 1;
-		}else{
-			chksum += (ICMP_ECHO << 8);
-		}
+		chksum = chksum_update(chksum, ICMP_ECHO << 8 | packet[ICMP_HDR_CODE], ICMP_ECHO_REPLY << 8 | packet[ICMP_HDR_CODE]);
 		packet[ICMP_HDR_CHKSUM1] = chksum >> 8;
 		packet[ICMP_HDR_CHKSUM2] = chksum & 0xff;
 		
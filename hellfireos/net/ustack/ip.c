@@ -7,16 +7,24 @@
 #include <hellfire.h>
 #include <ustack.h>
 
+/* datagram being reassembled, one bit of map per 8 byte block of data */
+struct ip_reass {
+	struct pbuf *p;
+	uint8_t src[4];
+	uint16_t id;
+	uint8_t proto;
+	uint8_t age;
+	uint16_t total;			/* data size, known once the last fragment arrives (0 before) */
+	uint16_t blocks;		/* blocks received */
+	uint8_t map[IP_MAX_DATAGRAM / 64];
+};
+
+static struct ip_reass ip_reass_slots[IP_REASS_SLOTS];
+static uint16_t ip_id;
+
 static uint32_t ipchksum(uint8_t *packet)
 {
-	uint32_t sum=0;
-	uint16_t i;
-
-	for(i = 0; i < 20; i += 2)
-		sum += ((uint32_t)packet[i] << 8) | (uint32_t)packet[i + 1];
-	while (sum & 0xffff0000)
-		sum = (sum & 0xffff) + (sum >> 16);
-	return sum;
+	return chksum_fold(chksum_add(0, packet, IP_HEADER_SIZE));
 }
 
 int32_t ip_addr_maskcmp(uint8_t addr1[4], uint8_t addr2[4], uint8_t mask[4])
@@ -86,19 +94,18 @@ int32_t ip_addr_ismulticast(uint8_t addr[4])
 		return 0;
 }
 
-int32_t ip_out(uint8_t dst_addr[4], uint8_t *packet, uint16_t len)
+static void ip_header(uint8_t dst_addr[4], uint8_t *packet, uint16_t len, uint16_t id, uint16_t frag)
 {
 	uint32_t sum;
-	int32_t val;
 	
 	packet[IP_HDR_VHL] = IP_VER_IHL >> 8;
 	packet[IP_HDR_TOS] = 0x00;
 	packet[IP_HDR_LEN1] = len >> 8;
 	packet[IP_HDR_LEN2] = len & 0xff;
-	packet[IP_HDR_IPID1] = 0x00;
-	packet[IP_HDR_IPID2] = 0x00;
-	packet[IP_HDR_FLAGS1] = 0x00;
-	packet[IP_HDR_FLAGS2] = 0x00;
+	packet[IP_HDR_IPID1] = id >> 8;
+	packet[IP_HDR_IPID2] = id & 0xff;
+	packet[IP_HDR_FLAGS1] = frag >> 8;
+	packet[IP_HDR_FLAGS2] = frag & 0xff;
 	packet[IP_HDR_TTL] = IP_DEFAULT_TTL;
 	packet[IP_HDR_SRCADDR1] = myip[0];
 	packet[IP_HDR_SRCADDR2] = myip[1];
@@ -108,42 +115,225 @@ int32_t ip_out(uint8_t dst_addr[4], uint8_t *packet, uint16_t len)
 	packet[IP_HDR_DESTADDR2] = dst_addr[1];
 	packet[IP_HDR_DESTADDR3] = dst_addr[2];
 	packet[IP_HDR_DESTADDR4] = dst_addr[3];
-	packet[IP_HDR_CHKSUM1] = packet[IP_HDR_CHKSUM2] = 0;
-	sum = (~ipchksum(packet)) & 0xffff;
+	/* the header is built from these values, so sum them instead of reading it back */
+	sum = IP_VER_IHL + len + id + frag + (IP_DEFAULT_TTL << 8 | packet[IP_HDR_PROTO]) +
+		(myip[0] << 8 | myip[1]) + (myip[2] << 8 | myip[3]) +
+		(dst_addr[0] << 8 | dst_addr[1]) + (dst_addr[2] << 8 | dst_addr[3]);
+	sum = ~chksum_fold(sum) & 0xffff;
 	packet[IP_HDR_CHKSUM1] = sum >> 8;
 	packet[IP_HDR_CHKSUM2] = sum & 0xff;
+}
+
+int32_t ip_out(uint8_t dst_addr[4], uint8_t *packet, uint16_t len)
+{
+	int32_t val;
+	
+	/* a datagram larger than a frame (such as a reply to a reassembled one) is fragmented */
+	if (len + ETH_HEADER_SIZE > PACKET_SIZE)
+		return ip_outfrag(dst_addr, packet[IP_HDR_PROTO], NULL, 0, packet + IP_HEADER_SIZE, len - IP_HEADER_SIZE);
 	
-	val = netif_send(packet, len);
+	ip_header(dst_addr, packet, len, 0, 0);
+	USTACK_STAT(STAT_NETIF_SEND, val = netif_send(packet, len));
 
 	return val;
 }
 
+/*
+ * send a batch of datagrams (each one fitting a frame) to the same destination. returns
+ * the number of datagrams taken by the link layer.
+ */
+int32_t ip_outv(uint8_t dst_addr[4], uint8_t **packets, uint16_t *lens, int32_t n)
+{
+	int32_t i;
+	
+	for (i = 0; i < n; i++){
+		if (lens[i] + ETH_HEADER_SIZE > PACKET_SIZE)
+			break;
+		ip_header(dst_addr, packets[i], lens[i], 0, 0);
+	}
+	
+	return netif_sendv(packets, lens, i);
+}
+
+/*
+ * send a datagram in fragments (RFC791 and RFC815). the upper layer header (hdr, may be NULL)
+ * and data are gathered into the fragments, each one built on a packet buffer of its own.
+ * all fragments but the last carry a multiple of 8 bytes of data. a datagram which fits a
+ * frame is sent whole. returns 0 if the datagram is too large or a fragment could not be sent
+ * (the sender may retry the whole datagram).
+ */
+int32_t ip_outfrag(uint8_t dst_addr[4], uint8_t proto, uint8_t *hdr, uint16_t hdr_len, uint8_t *data, uint16_t len)
+{
+	struct pbuf *p;
+	uint8_t *packet;
+	uint32_t total, off, n, h, max;
+	uint16_t id;
+	int32_t val;
+	
+	total = hdr_len + len;
+	if (total > IP_MAX_DATAGRAM - IP_HEADER_SIZE)
+		return 0;
+	max = (PACKET_SIZE - ETH_HEADER_SIZE - IP_HEADER_SIZE) & ~7;
+	id = total > max ? ++ip_id : 0;
+	
+	for (off = 0; off < total; off += n){
+		n = total - off > max ? max : total - off;
+		p = pbuf_alloc();
+		if (!p)
+			return 0;
+		packet = p->frame + ETH_HEADER_SIZE;
+		h = 0;
+		if (off < hdr_len){
+			h = hdr_len - off < n ? hdr_len - off : n;
+			memcpy(packet + IP_HEADER_SIZE, hdr + off, h);
+		}
+		if (n > h)
+			memcpy(packet + IP_HEADER_SIZE + h, data + off + h - hdr_len, n - h);
+		packet[IP_HDR_PROTO] = proto;
+		ip_header(dst_addr, packet, n + IP_HEADER_SIZE, id,
+			(off >> 3) | (off + n < total ? IP_FLAG_MOREFRAG : 0));
+		val = netif_send(packet, n + IP_HEADER_SIZE);
+		pbuf_free(p);
+		if (!val)
+			return 0;
+	}
+
+	return total + IP_HEADER_SIZE;
+}
+
+/*
+ * reassembly of fragmented datagrams. fragments are copied to a large packet buffer, on their
+ * place in the datagram, and the received blocks are marked on a bitmap. up to IP_REASS_SLOTS
+ * datagrams are reassembled at once (others are dropped), and a datagram is dropped if it is not
+ * complete after IP_REASS_TIMEOUT service periods. fragments which go past the end of the datagram
+ * (once the last fragment is known) are dropped, so the datagram is complete only with no holes. returns the buffer of a complete datagram
+ * (the caller drops its reference), or NULL.
+ */
+static struct pbuf *ip_reass(uint8_t *packet, uint16_t len)
+{
+	struct ip_reass *r = NULL;
+	struct pbuf *p;
+	uint16_t id, frag, off, dlen, b, last;
+	int32_t i;
+	
+	if (len <= IP_HEADER_SIZE) return NULL;
+	id = (packet[IP_HDR_IPID1] << 8) | packet[IP_HDR_IPID2];
+	frag = (packet[IP_HDR_FLAGS1] << 8) | packet[IP_HDR_FLAGS2];
+	off = (frag & IP_FRAGOFS_MASK) << 3;
+	dlen = len - IP_HEADER_SIZE;
+	if (off + dlen > IP_MAX_DATAGRAM - IP_HEADER_SIZE) return NULL;
+	if ((frag & IP_FLAG_MOREFRAG) && (dlen & 7)) return NULL;
+	
+	for (i = 0; i < IP_REASS_SLOTS; i++){
+		if (ip_reass_slots[i].p && ip_reass_slots[i].id == id && ip_reass_slots[i].proto == packet[IP_HDR_PROTO] &&
+			ip_addr_cmp(ip_reass_slots[i].src, &packet[IP_HDR_SRCADDR1])){
+			r = &ip_reass_slots[i];
+			break;
+		}
+	}
+	if (!r){
+		for (i = 0; i < IP_REASS_SLOTS; i++)
+			if (!ip_reass_slots[i].p) break;
+		if (i == IP_REASS_SLOTS) return NULL;
+		r = &ip_reass_slots[i];
+		r->p = pbuf_alloc_large();
+		if (!r->p) return NULL;
+		memcpy(r->src, &packet[IP_HDR_SRCADDR1], 4);
+		r->id = id;
+		r->proto = packet[IP_HDR_PROTO];
+		r->age = 0;
+		r->total = 0;
+		r->blocks = 0;
+		memset(r->map, 0, sizeof(r->map));
+	}
+	
+	if (!(frag & IP_FLAG_MOREFRAG)){
+		if (r->total && r->total != off + dlen) return NULL;
+		if (!r->total){
+			/* blocks past the end of the datagram would be counted as its own */
+			for (b = (off + dlen + 7) >> 3; b < sizeof(r->map) * 8; b++)
+				if (r->map[b >> 3] & (1 << (b & 7))) return NULL;
+		}
+		r->total = off + dlen;
+	}else if (r->total && off + dlen > r->total){
+		return NULL;
+	}
+	if (off == 0)
+		memcpy(r->p->frame + ETH_HEADER_SIZE, packet, IP_HEADER_SIZE);
+	memcpy(r->p->frame + ETH_HEADER_SIZE + IP_HEADER_SIZE + off, packet + IP_HEADER_SIZE, dlen);
+	last = (off + dlen + 7) >> 3;
+	for (b = off >> 3; b < last; b++){
+		if (!(r->map[b >> 3] & (1 << (b & 7)))){
+			r->map[b >> 3] |= 1 << (b & 7);
+			r->blocks++;
+		}
+	}
+	
+	if (!r->total || r->blocks != (r->total + 7) >> 3)
+		return NULL;
+	
+	p = r->p;
+	r->p = NULL;
+	packet = p->frame + ETH_HEADER_SIZE;
+	packet[IP_HDR_LEN1] = (r->total + IP_HEADER_SIZE) >> 8;
+	packet[IP_HDR_LEN2] = (r->total + IP_HEADER_SIZE) & 0xff;
+	packet[IP_HDR_FLAGS1] = 0x00;
+	packet[IP_HDR_FLAGS2] = 0x00;
+	
+	return p;
+}
+
+/* drop datagrams which are not complete in time (called from the network service) */
+void ip_reass_age(void)
+{
+	int32_t i;
+	
+	for (i = 0; i < IP_REASS_SLOTS; i++){
+		if (ip_reass_slots[i].p && ++ip_reass_slots[i].age > IP_REASS_TIMEOUT){
+			pbuf_free(ip_reass_slots[i].p);
+			ip_reass_slots[i].p = NULL;
+		}
+	}
+}
+
 int32_t ip_in(uint8_t dst_addr[4], uint8_t *packet, uint16_t len)
 {
-	uint8_t configured;
+	struct pbuf *p = NULL;
+	uint8_t configured, frag;
 	int32_t val = 0;
 
 	configured = myip[0] | myip[1] | myip[2] | myip[3];
+	frag = (((packet[IP_HDR_FLAGS1] << 8) | (packet[IP_HDR_FLAGS2])) &
+		(IP_FLAG_MOREFRAG | IP_FRAGOFS_MASK)) != 0;
 	if (packet[IP_HDR_VHL] != (IP_VER_IHL >> 8)) return -1;				/* IP version / options error (not supported) */
-	if (((packet[IP_HDR_FLAGS1] << 8) | (packet[IP_HDR_FLAGS2])) &
-		(IP_FLAG_MOREFRAG | IP_FRAGOFS_MASK)) return -1;			/* IP fragmented frames not supported */
 	if (packet[IP_HDR_TTL] == 0) return -1;						/* TP TTL has expired */
 	if (configured){								/* if already configured by a magic ping */
 		if (!ip_addr_cmp(&packet[IP_HDR_DESTADDR1], dst_addr)) return -1; 	/* IP destination address error */
 		if (ipchksum(packet) != 0xffff) return -1;				/* IP checksum error */
+		if (frag){								/* IP fragment, wait for the whole datagram */
+			p = ip_reass(packet, len);
+			if (!p) return 0;
+			packet = p->frame + ETH_HEADER_SIZE;
+			len = (packet[IP_HDR_LEN1] << 8) | packet[IP_HDR_LEN2];
+		}
 
 		switch(packet[IP_HDR_PROTO]){
 			case IP_PROTO_ICMP:
 				val = icmp_echo_reply(packet, len);
 				break;
 			case IP_PROTO_UDP:
-				val = udp_in(packet);
+				USTACK_STAT(STAT_UDP_IN, val = udp_in(packet));
+				break;
+			case IP_PROTO_TCP:
+				val = tcp_in(packet, len);
 				break;
 			default:							/* IP protocol error */
-				return -1;
+				val = -1;
 		}
+		if (p)
+			pbuf_free(p);
 	}else{
-		if (packet[IP_HDR_PROTO] == IP_PROTO_ICMP && ~configured && 
+		if (!frag && packet[IP_HDR_PROTO] == IP_PROTO_ICMP && ~configured && 
 			len == IP_CFG_PING + IP_HEADER_SIZE + ICMP_HDR_SIZE){		/* configure the IP address */
 			myip[0] = packet[IP_HDR_DESTADDR1];
 			myip[1] = packet[IP_HDR_DESTADDR2];
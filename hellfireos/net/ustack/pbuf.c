@@ -0,0 +1,101 @@
+/* file:          pbuf.c
+ * description:   reference counted packet buffers, shared by all layers of the stack
+ * date:          10/2026
+ */
+
+#include <hellfire.h>
+#include <ustack.h>
+
+static struct pool *pbuf_pool;
+static struct pool *pbuf_pool_large;
+
+/*
+ * packet buffer pool
+ *
+ * all buffers hold a whole frame, so a packet is built (or received) once and passed
+ * by pointer between the link layer driver, the stack and the sockets. headers are
+ * placed on their fixed offsets of the frame (PBUF_HEADROOM bytes before UDP data).
+ * each holder of a buffer owns a reference, and the buffer goes back to the pool when
+ * the last one is dropped. a second (small) pool holds large buffers, for datagrams
+ * reassembled from fragments (up to IP_MAX_DATAGRAM bytes).
+ */
+int32_t pbuf_init(uint32_t count, uint32_t large)
+{
+	pbuf_pool = hf_pool_create(sizeof(struct pbuf) + PACKET_SIZE, count);
+	if (!pbuf_pool)
+		return ERR_OUT_OF_MEMORY;
+	if (large){
+		pbuf_pool_large = hf_pool_create(sizeof(struct pbuf) + ETH_HEADER_SIZE + IP_MAX_DATAGRAM, large);
+		if (!pbuf_pool_large)
+			return ERR_OUT_OF_MEMORY;
+	}
+
+	return ERR_OK;
+}
+
+static struct pbuf *pbuf_take(struct pool *pool, uint16_t size)
+{
+	struct pbuf *p;
+
+	if (!pool)
+		return NULL;
+	p = (struct pbuf *)hf_pool_alloc(pool);
+	if (p){
+		p->ref = 1;
+		p->size = size;
+	}
+
+	return p;
+}
+
+struct pbuf *pbuf_alloc(void)
+{
+	return pbuf_take(pbuf_pool, PACKET_SIZE);
+}
+
+struct pbuf *pbuf_alloc_large(void)
+{
+	return pbuf_take(pbuf_pool_large, ETH_HEADER_SIZE + IP_MAX_DATAGRAM);
+}
+
+void pbuf_ref(struct pbuf *p)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	p->ref++;
+	_ei(status);
+}
+
+void pbuf_free(struct pbuf *p)
+{
+	volatile uint32_t status;
+	uint32_t ref;
+
+	status = _di();
+	ref = --p->ref;
+	_ei(status);
+	if (ref == 0)
+		hf_pool_free(p->size > PACKET_SIZE ? pbuf_pool_large : pbuf_pool, p);
+}
+
+/*
+ * find the buffer holding a frame or packet (any pointer into the buffer data).
+ * returns NULL if the data is not placed on a packet buffer (such as a link layer
+ * driver buffer).
+ */
+struct pbuf *pbuf_get(uint8_t *ptr)
+{
+	struct pool *pool;
+	uint32_t i;
+
+	if (pbuf_pool && hf_pool_owns(pbuf_pool, ptr))
+		pool = pbuf_pool;
+	else if (pbuf_pool_large && hf_pool_owns(pbuf_pool_large, ptr))
+		pool = pbuf_pool_large;
+	else
+		return NULL;
+	i = ((uint8_t *)ptr - pool->area) / pool->size;
+
+	return (struct pbuf *)(pool->area + i * pool->size);
+}
@@ -0,0 +1,38 @@
+/* file:          stats.c
+ * description:   cycles spent on each layer of the stack (USTACK_STATS)
+ * date:          10/2026
+ */
+
+#include <hellfire.h>
+#include <ustack.h>
+
+struct ustack_stat ustack_stats[USTACK_STAT_LAYERS];
+
+const int8_t *ustack_stat_names[USTACK_STAT_LAYERS] = {
+	"netif_recv", "ip_in", "udp_in", "udp_callback", "ip_out", "netif_send"
+};
+
+/* count frames (packets) took cycles on a layer. layers are entered by the network service and the senders */
+void ustack_stat_add(int32_t layer, uint32_t cycles, uint32_t count)
+{
+	struct ustack_stat *s;
+	uint32_t status, each;
+
+	s = &ustack_stats[layer];
+	each = cycles / count;
+	status = _di();
+	if (s->count == 0 || each < s->min) s->min = each;
+	if (each > s->max) s->max = each;
+	s->count += count;
+	s->cycles += cycles;
+	_ei(status);
+}
+
+void ustack_resetstats(void)
+{
+	uint32_t status;
+
+	status = _di();
+	memset(ustack_stats, 0, sizeof(ustack_stats));
+	_ei(status);
+}
@@ -0,0 +1,860 @@
+/* file:          tcp.c
+ * description:   TCP protocol implementation (RFC793, RFC1122) with a small socket interface
+ * date:          10/2026
+ */
+
+#include <hellfire.h>
+#include <ustack.h>
+
+#define SEQ_LT(a, b)		((int32_t)((a) - (b)) < 0)
+#define SEQ_GT(a, b)		((int32_t)((a) - (b)) > 0)
+#define SEQ_GE(a, b)		((int32_t)((a) - (b)) >= 0)
+
+/*
+ * a fixed table of connections, shared by the network service (segment input and timers)
+ * and the application tasks (socket calls), under tcp_lock. a listening connection takes a
+ * slot of its own, and each connection it accepts takes another one. connections keep their
+ * buffers (allocated on first use) when they are reused.
+ *
+ * the sender keeps up to a window of segments in flight (the smallest of the peer window and
+ * the data on the send buffer), and goes back to the first unacknowledged byte when the
+ * retransmission timer expires. small segments are held while data is in flight (Nagle, RFC896)
+ * unless disabled with hf_tcp_nodelay(). the receiver accepts in order segments only, and
+ * acknowledges every second segment or after TCP_DELACK ticks (delayed ACK, RFC1122).
+ */
+static struct tcb tcp_conns[TCP_CONNS];
+static mutex_t tcp_lock;
+static uint8_t tcp_ready;
+
+static uint32_t tcp_get32(uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void tcp_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+/* sum of the pseudo header and the segment, including its checksum field (0xffff if valid) */
+static uint16_t tcpchksum(uint8_t *packet, uint16_t len)
+{
+	uint32_t sum;
+
+	sum = chksum_add(IP_PROTO_TCP + len, &packet[IP_HDR_SRCADDR1], 8);
+	sum = chksum_add(sum, &packet[IP_HEADER_SIZE], len);
+
+	return chksum_fold(sum);
+}
+
+static void tcp_ring_put(uint8_t *ring, uint16_t size, uint16_t pos, uint8_t *buf, uint16_t len)
+{
+	uint16_t n;
+
+	pos &= size - 1;
+	n = size - pos < len ? size - pos : len;
+	memcpy(ring + pos, buf, n);
+	memcpy(ring, buf + n, len - n);
+}
+
+static void tcp_ring_get(uint8_t *ring, uint16_t size, uint16_t pos, uint8_t *buf, uint16_t len)
+{
+	uint16_t n;
+
+	pos &= size - 1;
+	n = size - pos < len ? size - pos : len;
+	memcpy(buf, ring + pos, n);
+	memcpy(buf + n, ring, len - n);
+}
+
+static void tcp_header(uint8_t *packet, uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port,
+	uint32_t seq, uint32_t ack, uint8_t flags, uint16_t win, uint16_t hlen, uint16_t len)
+{
+	uint16_t chksum;
+
+	memcpy(&packet[IP_HDR_SRCADDR1], myip, 4);
+	memcpy(&packet[IP_HDR_DESTADDR1], dst_addr, 4);
+	packet[IP_HDR_PROTO] = IP_PROTO_TCP;
+
+	packet[TCP_HDR_SRCPORT1] = src_port >> 8;
+	packet[TCP_HDR_SRCPORT2] = src_port & 0xff;
+	packet[TCP_HDR_DESTPORT1] = dst_port >> 8;
+	packet[TCP_HDR_DESTPORT2] = dst_port & 0xff;
+	tcp_put32(&packet[TCP_HDR_SEQ1], seq);
+	tcp_put32(&packet[TCP_HDR_ACK1], ack);
+	packet[TCP_HDR_OFFSET] = (hlen >> 2) << 4;
+	packet[TCP_HDR_FLAGS] = flags;
+	packet[TCP_HDR_WIN1] = win >> 8;
+	packet[TCP_HDR_WIN2] = win & 0xff;
+	packet[TCP_HDR_CHKSUM1] = 0;
+	packet[TCP_HDR_CHKSUM2] = 0;
+	packet[TCP_HDR_URG1] = 0;
+	packet[TCP_HDR_URG2] = 0;
+
+	chksum = ~tcpchksum(packet, hlen + len) & 0xffff;
+	packet[TCP_HDR_CHKSUM1] = chksum >> 8;
+	packet[TCP_HDR_CHKSUM2] = chksum & 0xff;
+}
+
+/*
+ * build and send a segment on a packet buffer of its own. data is taken from the send buffer,
+ * off bytes after snd_una. returns 0 if the segment could not be sent.
+ */
+static int32_t tcp_output(struct tcb *t, uint32_t seq, uint8_t flags, uint16_t off, uint16_t len)
+{
+	struct pbuf *p;
+	uint8_t *packet;
+	uint16_t hlen = TCP_HEADER_SIZE, win;
+	int32_t val;
+
+	p = pbuf_alloc();
+	if (!p)
+		return 0;
+	packet = p->frame + ETH_HEADER_SIZE;
+	if (flags & TCP_SYN){
+		packet[TCP_DATA_OFS] = TCP_OPT_MSS;
+		packet[TCP_DATA_OFS + 1] = 4;
+		packet[TCP_DATA_OFS + 2] = TCP_MSS >> 8;
+		packet[TCP_DATA_OFS + 3] = TCP_MSS & 0xff;
+		hlen += 4;
+	}
+	if (len)
+		tcp_ring_get(t->sndbuf, TCP_SNDBUF, t->snd_head + off, packet + IP_HEADER_SIZE + hlen, len);
+	win = TCP_RCVBUF - t->rcv_len;
+	tcp_header(packet, t->remote_ip, t->local_port, t->remote_port, seq,
+		(flags & TCP_ACK) ? t->rcv_nxt : 0, flags, win, hlen, len);
+	val = ip_out(t->remote_ip, packet, IP_HEADER_SIZE + hlen + len);
+	pbuf_free(p);
+	if (val && (flags & TCP_ACK)){
+		t->rcv_adv = win;
+		t->ack_timer = 0;
+		t->flags &= ~TCP_F_ACKNOW;
+	}
+
+	return val;
+}
+
+/* answer a segment which belongs to no connection */
+static void tcp_reset(uint8_t *in, uint16_t dlen)
+{
+	struct pbuf *p;
+	uint8_t *packet, dst_addr[4], flags;
+	uint16_t src_port, dst_port;
+	uint32_t seq = 0, ack = 0;
+
+	flags = in[TCP_HDR_FLAGS];
+	if (flags & TCP_RST)
+		return;
+	p = pbuf_alloc();
+	if (!p)
+		return;
+	packet = p->frame + ETH_HEADER_SIZE;
+	memcpy(dst_addr, &in[IP_HDR_SRCADDR1], 4);
+	src_port = (in[TCP_HDR_DESTPORT1] << 8) | in[TCP_HDR_DESTPORT2];
+	dst_port = (in[TCP_HDR_SRCPORT1] << 8) | in[TCP_HDR_SRCPORT2];
+	if (flags & TCP_ACK){
+		seq = tcp_get32(&in[TCP_HDR_ACK1]);
+		flags = TCP_RST;
+	}else{
+		ack = tcp_get32(&in[TCP_HDR_SEQ1]) + dlen + ((flags & TCP_SYN) ? 1 : 0) + ((flags & TCP_FIN) ? 1 : 0);
+		flags = TCP_RST | TCP_ACK;
+	}
+	tcp_header(packet, dst_addr, src_port, dst_port, seq, ack, flags, 0, TCP_HEADER_SIZE, 0);
+	ip_out(dst_addr, packet, IP_HEADER_SIZE + TCP_HEADER_SIZE);
+	pbuf_free(p);
+}
+
+/* peer maximum segment size, from the options of a SYN segment */
+static uint16_t tcp_mss(uint8_t *packet, uint16_t hlen)
+{
+	uint8_t *opt, *end;
+	uint16_t mss = TCP_MSS_DEFAULT;
+
+	opt = packet + TCP_DATA_OFS;
+	end = packet + IP_HEADER_SIZE + hlen;
+	while (opt < end && *opt != TCP_OPT_END){
+		if (*opt == TCP_OPT_NOP){
+			opt++;
+			continue;
+		}
+		if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+			break;
+		if (opt[0] == TCP_OPT_MSS && opt[1] == 4)
+			mss = (opt[2] << 8) | opt[3];
+		opt += opt[1];
+	}
+	if (mss > TCP_MSS) mss = TCP_MSS;
+	if (mss == 0) mss = TCP_MSS_DEFAULT;
+
+	return mss;
+}
+
+static uint32_t tcp_iss(void)
+{
+	return _readcounter() ^ ((uint32_t)random() << 16);
+}
+
+static struct tcb *tcp_find(uint8_t src_addr[4], uint16_t src_port, uint16_t dst_port)
+{
+	struct tcb *t;
+	int32_t i;
+
+	for (i = 0; i < TCP_CONNS; i++){
+		t = &tcp_conns[i];
+		if (t->state != TCP_CLOSED && t->state != TCP_LISTEN && t->local_port == dst_port &&
+			t->remote_port == src_port && ip_addr_cmp(t->remote_ip, src_addr))
+			return t;
+	}
+	for (i = 0; i < TCP_CONNS; i++){
+		t = &tcp_conns[i];
+		if (t->state == TCP_LISTEN && t->local_port == dst_port)
+			return t;
+	}
+
+	return NULL;
+}
+
+static int32_t tcp_port_used(uint16_t port)
+{
+	int32_t i;
+
+	for (i = 0; i < TCP_CONNS; i++)
+		if ((tcp_conns[i].state != TCP_CLOSED || tcp_conns[i].open) && tcp_conns[i].local_port == port)
+			return 1;
+
+	return 0;
+}
+
+/* take a free connection (with its buffers, unless it will listen) */
+static struct tcb *tcp_alloc(int32_t buffers)
+{
+	struct tcb *t;
+	int32_t i;
+
+	for (i = 0; i < TCP_CONNS; i++){
+		t = &tcp_conns[i];
+		if (t->state == TCP_CLOSED && !t->open && !t->parent)
+			break;
+	}
+	if (i == TCP_CONNS)
+		return NULL;
+	if (buffers){
+		if (!t->sndbuf)
+			t->sndbuf = hf_malloc(TCP_SNDBUF);
+		if (!t->rcvbuf)
+			t->rcvbuf = hf_malloc(TCP_RCVBUF);
+		if (!t->sndbuf || !t->rcvbuf)
+			return NULL;
+	}
+	t->flags = 0;
+	t->err = ERR_OK;
+	t->retries = 0;
+	t->rto = TCP_RTO;
+	t->rto_timer = 0;
+	t->ack_timer = 0;
+	t->mss = TCP_MSS_DEFAULT;
+	t->snd_wnd = 0;
+	t->snd_head = 0;
+	t->snd_len = 0;
+	t->rcv_head = 0;
+	t->rcv_len = 0;
+	t->rcv_adv = TCP_RCVBUF;
+	t->iss = tcp_iss();
+	t->snd_una = t->iss;
+	t->snd_nxt = t->iss + 1;
+	t->snd_max = t->iss + 1;
+
+	return t;
+}
+
+/* the connection is closed. a connection not held by the application is free again */
+static void tcp_drop(struct tcb *t, int8_t err)
+{
+	t->state = TCP_CLOSED;
+	t->err = err;
+	t->rto_timer = 0;
+	t->ack_timer = 0;
+	if (!t->open)
+		t->parent = 0;
+	hf_sempost(&t->event);
+}
+
+/*
+ * send what the window and the send buffer allow (and the FIN, after the data). a forced
+ * pass sends a first segment regardless of Nagle and of a closed window (a window probe).
+ */
+static void tcp_push(struct tcb *t, int32_t force)
+{
+	uint16_t inflight, avail, win, n;
+
+	if (t->state != TCP_ESTABLISHED && t->state != TCP_CLOSE_WAIT && t->state != TCP_FIN_WAIT1 &&
+		t->state != TCP_CLOSING && t->state != TCP_LAST_ACK)
+		return;
+
+	while (1){
+		inflight = t->snd_nxt - t->snd_una;
+		if (inflight >= t->snd_len)
+			break;
+		avail = t->snd_len - inflight;
+		win = t->snd_wnd > inflight ? t->snd_wnd - inflight : 0;
+		if (force && win == 0) win = 1;
+		n = avail;
+		if (n > t->mss) n = t->mss;
+		if (n > win) n = win;
+		if (n == 0)
+			break;
+		if (n < t->mss && inflight && !force && !(t->flags & TCP_F_NODELAY))
+			break;
+		if (!tcp_output(t, t->snd_nxt, TCP_ACK | (n == avail ? TCP_PSH : 0), inflight, n))
+			break;
+		t->snd_nxt += n;
+		if (SEQ_GT(t->snd_nxt, t->snd_max)) t->snd_max = t->snd_nxt;
+		if (!t->rto_timer) t->rto_timer = t->rto;
+		force = 0;
+	}
+	if ((t->flags & TCP_F_FIN) && t->snd_nxt == t->snd_una + t->snd_len){
+		if (tcp_output(t, t->snd_nxt, TCP_FIN | TCP_ACK, 0, 0)){
+			t->snd_nxt++;
+			if (SEQ_GT(t->snd_nxt, t->snd_max)) t->snd_max = t->snd_nxt;
+		}
+	}
+
+	/* anything left to send is retried (or the closed window probed) by the timer */
+	if (!t->rto_timer && (t->snd_len || (t->flags & TCP_F_FIN)))
+		t->rto_timer = t->rto;
+}
+
+/* segment on a synchronized connection (SYN-RECEIVED and after) */
+static void tcp_segment(struct tcb *t, uint8_t *packet, uint8_t flags, uint32_t seq, uint32_t ack,
+	uint16_t win, uint8_t *data, uint16_t dlen)
+{
+	uint32_t acked, c;
+	int32_t fin_acked = 0;
+
+	/* the peer did not see our SYN,ACK */
+	if (t->state == TCP_SYN_RCVD && (flags & TCP_SYN) && !(flags & TCP_ACK) && seq + 1 == t->rcv_nxt){
+		tcp_output(t, t->iss, TCP_SYN | TCP_ACK, 0, 0);
+		return;
+	}
+
+	/* trim data we already have, drop out of order segments (acknowledging again what we have) */
+	if (SEQ_LT(seq, t->rcv_nxt) && SEQ_GT(seq + dlen, t->rcv_nxt)){
+		c = t->rcv_nxt - seq;
+		data += c;
+		dlen -= c;
+		seq = t->rcv_nxt;
+		flags &= ~TCP_SYN;
+	}
+	if (seq != t->rcv_nxt){
+		if (!(flags & TCP_RST) && (dlen || (flags & (TCP_SYN | TCP_FIN))))
+			tcp_output(t, t->snd_nxt, TCP_ACK, 0, 0);
+		return;
+	}
+	if (flags & TCP_RST){
+		tcp_drop(t, ERR_ERROR);
+		return;
+	}
+	if (flags & TCP_SYN){
+		tcp_reset(packet, dlen);
+		tcp_drop(t, ERR_ERROR);
+		return;
+	}
+	if (!(flags & TCP_ACK))
+		return;
+
+	if (t->state == TCP_SYN_RCVD){
+		if (ack != t->iss + 1){
+			tcp_reset(packet, dlen);
+			return;
+		}
+		t->snd_una = ack;
+		t->snd_wnd = win;
+		t->state = TCP_ESTABLISHED;
+		t->rto_timer = 0;
+		t->retries = 0;
+		t->rto = TCP_RTO;
+		if (t->parent)
+			hf_sempost(&tcp_conns[t->parent - 1].event);
+	}
+
+	/* acknowledgement and window update */
+	if (SEQ_GT(ack, t->snd_max)){
+		tcp_output(t, t->snd_nxt, TCP_ACK, 0, 0);
+		return;
+	}
+	if (SEQ_GE(ack, t->snd_una))
+		t->snd_wnd = win;
+	if (SEQ_GT(ack, t->snd_una)){
+		acked = ack - t->snd_una;
+		if (acked > t->snd_len){
+			fin_acked = 1;
+			acked = t->snd_len;
+		}
+		t->snd_head = (t->snd_head + acked) & (TCP_SNDBUF - 1);
+		t->snd_len -= acked;
+		t->snd_una = ack;
+		if (SEQ_LT(t->snd_nxt, t->snd_una)) t->snd_nxt = t->snd_una;
+		t->retries = 0;
+		t->rto = TCP_RTO;
+		t->rto_timer = t->snd_una != t->snd_max ? t->rto : 0;
+		hf_sempost(&t->event);
+	}
+	if (fin_acked){
+		switch (t->state){
+		case TCP_FIN_WAIT1:
+			t->state = TCP_FIN_WAIT2;
+			break;
+		case TCP_CLOSING:
+			t->state = TCP_TIME_WAIT;
+			t->rto_timer = TCP_2MSL;
+			break;
+		case TCP_LAST_ACK:
+			tcp_drop(t, ERR_OK);
+			return;
+		}
+	}
+
+	/* data, in order, up to the free space on the receive buffer */
+	if (dlen && (t->state == TCP_ESTABLISHED || t->state == TCP_FIN_WAIT1 || t->state == TCP_FIN_WAIT2)){
+		c = TCP_RCVBUF - t->rcv_len;
+		if (c > dlen) c = dlen;
+		tcp_ring_put(t->rcvbuf, TCP_RCVBUF, t->rcv_head + t->rcv_len, data, c);
+		t->rcv_len += c;
+		t->rcv_nxt += c;
+		if (c < dlen){
+			flags &= ~TCP_FIN;
+			t->flags |= TCP_F_ACKNOW;
+		}else if (t->ack_timer){
+			t->flags |= TCP_F_ACKNOW;
+		}else{
+			t->ack_timer = TCP_DELACK;
+		}
+		hf_sempost(&t->event);
+	}
+
+	if (flags & TCP_FIN){
+		t->rcv_nxt++;
+		t->flags |= TCP_F_ACKNOW;
+		switch (t->state){
+		case TCP_ESTABLISHED:
+			t->state = TCP_CLOSE_WAIT;
+			break;
+		case TCP_FIN_WAIT1:
+			t->state = TCP_CLOSING;
+			break;
+		case TCP_FIN_WAIT2:
+			t->state = TCP_TIME_WAIT;
+			t->rto_timer = TCP_2MSL;
+			break;
+		}
+		hf_sempost(&t->event);
+	}
+
+	tcp_push(t, 0);
+	if (t->flags & TCP_F_ACKNOW)
+		tcp_output(t, t->snd_nxt, TCP_ACK, 0, 0);
+}
+
+/*
+ * segment input, called from ip_in() on the network service
+ */
+int32_t tcp_in(uint8_t *packet, uint16_t len)
+{
+	struct tcb *t, *n;
+	uint32_t seq, ack;
+	uint16_t src_port, dst_port, hlen, dlen, win;
+	uint8_t flags;
+
+	if (!tcp_ready || len < IP_HEADER_SIZE + TCP_HEADER_SIZE) return -1;
+	hlen = (packet[TCP_HDR_OFFSET] >> 4) << 2;
+	if (hlen < TCP_HEADER_SIZE || IP_HEADER_SIZE + hlen > len) return -1;
+	if (tcpchksum(packet, len - IP_HEADER_SIZE) != 0xffff) return -1;
+
+	dlen = len - IP_HEADER_SIZE - hlen;
+	src_port = (packet[TCP_HDR_SRCPORT1] << 8) | packet[TCP_HDR_SRCPORT2];
+	dst_port = (packet[TCP_HDR_DESTPORT1] << 8) | packet[TCP_HDR_DESTPORT2];
+	seq = tcp_get32(&packet[TCP_HDR_SEQ1]);
+	ack = tcp_get32(&packet[TCP_HDR_ACK1]);
+	flags = packet[TCP_HDR_FLAGS];
+	win = (packet[TCP_HDR_WIN1] << 8) | packet[TCP_HDR_WIN2];
+
+	hf_mtxlock(&tcp_lock);
+	t = tcp_find(&packet[IP_HDR_SRCADDR1], src_port, dst_port);
+	if (!t){
+		tcp_reset(packet, dlen);
+		hf_mtxunlock(&tcp_lock);
+		return -1;
+	}
+
+	switch (t->state){
+	case TCP_LISTEN:
+		if (flags & TCP_RST)
+			break;
+		if (flags & TCP_ACK){
+			tcp_reset(packet, dlen);
+			break;
+		}
+		if (!(flags & TCP_SYN))
+			break;
+		n = tcp_alloc(1);
+		if (!n)
+			break;
+		memcpy(n->remote_ip, &packet[IP_HDR_SRCADDR1], 4);
+		n->remote_port = src_port;
+		n->local_port = dst_port;
+		n->parent = (t - tcp_conns) + 1;
+		n->rcv_nxt = seq + 1;
+		n->snd_wnd = win;
+		n->mss = tcp_mss(packet, hlen);
+		n->state = TCP_SYN_RCVD;
+		tcp_output(n, n->iss, TCP_SYN | TCP_ACK, 0, 0);
+		n->rto_timer = n->rto;
+		break;
+	case TCP_SYN_SENT:
+		if ((flags & TCP_ACK) && ack != t->iss + 1){
+			tcp_reset(packet, dlen);
+			break;
+		}
+		if (flags & TCP_RST){
+			if (flags & TCP_ACK)
+				tcp_drop(t, ERR_ERROR);
+			break;
+		}
+		if ((flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK))
+			break;
+		t->rcv_nxt = seq + 1;
+		t->snd_una = ack;
+		t->snd_wnd = win;
+		t->mss = tcp_mss(packet, hlen);
+		t->state = TCP_ESTABLISHED;
+		t->rto_timer = 0;
+		t->retries = 0;
+		t->rto = TCP_RTO;
+		tcp_output(t, t->snd_nxt, TCP_ACK, 0, 0);
+		hf_sempost(&t->event);
+		break;
+	default:
+		tcp_segment(t, packet, flags, seq, ack, win, packet + IP_HEADER_SIZE + hlen, dlen);
+	}
+	hf_mtxunlock(&tcp_lock);
+
+	return dlen;
+}
+
+/*
+ * delayed ACK, retransmission and TIME-WAIT timers, called each TCP_TICK ms from the
+ * network service
+ */
+void tcp_timer(void)
+{
+	struct tcb *t;
+	int32_t i;
+
+	if (!tcp_ready) return;
+
+	hf_mtxlock(&tcp_lock);
+	for (i = 0; i < TCP_CONNS; i++){
+		t = &tcp_conns[i];
+		if (t->state == TCP_CLOSED || t->state == TCP_LISTEN)
+			continue;
+		if (t->ack_timer && --t->ack_timer == 0)
+			tcp_output(t, t->snd_nxt, TCP_ACK, 0, 0);
+		if (!t->rto_timer || --t->rto_timer)
+			continue;
+		if (t->state == TCP_TIME_WAIT){
+			tcp_drop(t, ERR_OK);
+			continue;
+		}
+		if (++t->retries > TCP_RETRIES){
+			tcp_drop(t, ERR_TIMEOUT);
+			continue;
+		}
+		t->rto = t->rto * 2 > TCP_RTO_MAX ? TCP_RTO_MAX : t->rto * 2;
+		t->rto_timer = t->rto;
+		switch (t->state){
+		case TCP_SYN_SENT:
+			tcp_output(t, t->iss, TCP_SYN, 0, 0);
+			break;
+		case TCP_SYN_RCVD:
+			tcp_output(t, t->iss, TCP_SYN | TCP_ACK, 0, 0);
+			break;
+		default:
+			/* go back to the first unacknowledged byte */
+			t->snd_nxt = t->snd_una;
+			tcp_push(t, 1);
+		}
+	}
+	hf_mtxunlock(&tcp_lock);
+}
+
+int32_t tcp_init(void)
+{
+	int32_t i;
+
+	hf_mtxinit(&tcp_lock);
+#if LOCK_STATS == 1
+	hf_mtxstat(&tcp_lock, "tcp_lock");
+#endif
+	for (i = 0; i < TCP_CONNS; i++)
+		if (hf_seminit(&tcp_conns[i].event, 0))
+			return ERR_OUT_OF_MEMORY;
+	tcp_ready = 1;
+
+	return ERR_OK;
+}
+
+/*
+ * TCP sockets
+
+ * these are called from the application layer, and return a connection id (or an error).
+ * calls which wait (accept, connect, send and recv) sleep on the connection semaphore, so
+ * each connection is used by a single task at a time.
+ */
+static struct tcb *tcp_get(int32_t id)
+{
+	if (!tcp_ready || id < 0 || id >= TCP_CONNS || !tcp_conns[id].open)
+		return NULL;
+
+	return &tcp_conns[id];
+}
+
+/* wait for an event on a connection, tcp_lock held */
+static void tcp_wait(struct tcb *t)
+{
+	hf_mtxunlock(&tcp_lock);
+	hf_semwait(&t->event);
+	hf_mtxlock(&tcp_lock);
+}
+
+int32_t hf_tcp_listen(uint16_t port)
+{
+	struct tcb *t;
+
+	if (!tcp_ready)
+		return ERR_ERROR;
+	hf_mtxlock(&tcp_lock);
+	if (tcp_port_used(port)){
+		hf_mtxunlock(&tcp_lock);
+		return ERR_ERROR;
+	}
+	t = tcp_alloc(0);
+	if (!t){
+		hf_mtxunlock(&tcp_lock);
+		return ERR_EXCEED_MAX_NUM;
+	}
+	t->local_port = port;
+	t->remote_port = 0;
+	t->state = TCP_LISTEN;
+	t->open = 1;
+	hf_mtxunlock(&tcp_lock);
+
+	return t - tcp_conns;
+}
+
+/* wait for a connection on a listening connection, and return its id */
+int32_t hf_tcp_accept(int32_t id)
+{
+	struct tcb *t, *c;
+	int32_t i;
+
+	t = tcp_get(id);
+	if (!t || t->state != TCP_LISTEN)
+		return ERR_INVALID_ID;
+	hf_mtxlock(&tcp_lock);
+	while (t->state == TCP_LISTEN){
+		for (i = 0; i < TCP_CONNS; i++){
+			c = &tcp_conns[i];
+			if (c->parent == id + 1 && (c->state == TCP_ESTABLISHED || c->state == TCP_CLOSE_WAIT)){
+				c->parent = 0;
+				c->open = 1;
+				hf_mtxunlock(&tcp_lock);
+				return i;
+			}
+		}
+		tcp_wait(t);
+	}
+	hf_mtxunlock(&tcp_lock);
+
+	return ERR_INVALID_STATE;
+}
+
+/* open a connection, and wait until it is established (or refused, or timed out) */
+int32_t hf_tcp_connect(uint8_t dst_addr[4], uint16_t port)
+{
+	struct tcb *t;
+	uint16_t local_port;
+	int32_t err;
+
+	if (!tcp_ready)
+		return ERR_ERROR;
+	hf_mtxlock(&tcp_lock);
+	t = tcp_alloc(1);
+	if (!t){
+		hf_mtxunlock(&tcp_lock);
+		return ERR_EXCEED_MAX_NUM;
+	}
+	do {
+		local_port = (uint16_t)(((uint32_t)random() % 16383) + 49152);
+	} while (tcp_port_used(local_port));
+	t->local_port = local_port;
+	memcpy(t->remote_ip, dst_addr, 4);
+	t->remote_port = port;
+	t->rcv_nxt = 0;
+	t->state = TCP_SYN_SENT;
+	t->open = 1;
+	tcp_output(t, t->iss, TCP_SYN, 0, 0);
+	t->rto_timer = t->rto;
+	while (t->state == TCP_SYN_SENT)
+		tcp_wait(t);
+	if (t->state == TCP_CLOSED){
+		err = t->err ? t->err : ERR_ERROR;
+		t->open = 0;
+		hf_mtxunlock(&tcp_lock);
+		return err;
+	}
+	hf_mtxunlock(&tcp_lock);
+
+	return t - tcp_conns;
+}
+
+/*
+ * copy data to the send buffer, waiting for room as it is acknowledged. returns the number of
+ * bytes taken, or an error if the connection is closed before any was.
+ */
+int32_t hf_tcp_send(int32_t id, uint8_t *buf, uint16_t len)
+{
+	struct tcb *t;
+	uint16_t sent = 0, n;
+	int32_t err = ERR_OK;
+
+	t = tcp_get(id);
+	if (!t)
+		return ERR_INVALID_ID;
+	hf_mtxlock(&tcp_lock);
+	while (sent < len){
+		if ((t->state != TCP_ESTABLISHED && t->state != TCP_CLOSE_WAIT) || (t->flags & TCP_F_FIN)){
+			err = t->err ? t->err : ERR_INVALID_STATE;
+			break;
+		}
+		n = TCP_SNDBUF - t->snd_len;
+		if (n == 0){
+			tcp_wait(t);
+			continue;
+		}
+		if (n > len - sent) n = len - sent;
+		tcp_ring_put(t->sndbuf, TCP_SNDBUF, t->snd_head + t->snd_len, buf + sent, n);
+		t->snd_len += n;
+		sent += n;
+		tcp_push(t, 0);
+	}
+	hf_mtxunlock(&tcp_lock);
+
+	return sent ? sent : err;
+}
+
+/*
+ * wait for data and copy up to size bytes of it. returns the number of bytes, 0 once the peer
+ * has closed the connection (and all data was read) or an error if it was reset.
+ */
+int32_t hf_tcp_recv(int32_t id, uint8_t *buf, uint16_t size)
+{
+	struct tcb *t;
+	uint16_t n;
+	int32_t err;
+
+	t = tcp_get(id);
+	if (!t)
+		return ERR_INVALID_ID;
+	hf_mtxlock(&tcp_lock);
+	while (t->rcv_len == 0){
+		if (t->state != TCP_ESTABLISHED && t->state != TCP_FIN_WAIT1 && t->state != TCP_FIN_WAIT2){
+			err = t->err;
+			hf_mtxunlock(&tcp_lock);
+			return err;
+		}
+		tcp_wait(t);
+	}
+	n = t->rcv_len < size ? t->rcv_len : size;
+	tcp_ring_get(t->rcvbuf, TCP_RCVBUF, t->rcv_head, buf, n);
+	t->rcv_head = (t->rcv_head + n) & (TCP_RCVBUF - 1);
+	t->rcv_len -= n;
+
+	/* tell the peer once the window has opened by a segment (receiver silly window avoidance) */
+	if (t->state != TCP_CLOSED && TCP_RCVBUF - t->rcv_len - t->rcv_adv >= (t->mss < TCP_RCVBUF / 2 ? t->mss : TCP_RCVBUF / 2))
+		tcp_output(t, t->snd_nxt, TCP_ACK, 0, 0);
+	hf_mtxunlock(&tcp_lock);
+
+	return n;
+}
+
+/*
+ * close a connection. data on the send buffer is still sent, followed by a FIN. the connection
+ * id is not valid after this call. closing a listening connection resets the connections it
+ * received and were not accepted yet.
+ */
+int32_t hf_tcp_close(int32_t id)
+{
+	struct tcb *t, *c;
+	int32_t i;
+
+	t = tcp_get(id);
+	if (!t)
+		return ERR_INVALID_ID;
+	hf_mtxlock(&tcp_lock);
+	t->open = 0;
+	switch (t->state){
+	case TCP_LISTEN:
+		for (i = 0; i < TCP_CONNS; i++){
+			c = &tcp_conns[i];
+			if (c->parent == id + 1){
+				if (c->state != TCP_CLOSED)
+					tcp_output(c, c->snd_nxt, TCP_RST | TCP_ACK, 0, 0);
+				tcp_drop(c, ERR_ERROR);
+			}
+		}
+		tcp_drop(t, ERR_OK);
+		break;
+	case TCP_SYN_SENT:
+		tcp_drop(t, ERR_OK);
+		break;
+	case TCP_ESTABLISHED:
+		t->flags |= TCP_F_FIN;
+		t->state = TCP_FIN_WAIT1;
+		tcp_push(t, 0);
+		break;
+	case TCP_CLOSE_WAIT:
+		t->flags |= TCP_F_FIN;
+		t->state = TCP_LAST_ACK;
+		tcp_push(t, 0);
+		break;
+	case TCP_CLOSED:
+		t->parent = 0;
+		break;
+	}
+	hf_mtxunlock(&tcp_lock);
+
+	return ERR_OK;
+}
+
+/* disable (on = 1) or enable (on = 0) the Nagle algorithm on a connection */
+int32_t hf_tcp_nodelay(int32_t id, int32_t on)
+{
+	struct tcb *t;
+
+	t = tcp_get(id);
+	if (!t)
+		return ERR_INVALID_ID;
+	hf_mtxlock(&tcp_lock);
+	if (on){
+		t->flags |= TCP_F_NODELAY;
+		tcp_push(t, 0);
+	}else{
+		t->flags &= ~TCP_F_NODELAY;
+	}
+	hf_mtxunlock(&tcp_lock);
+
+	return ERR_OK;
+}
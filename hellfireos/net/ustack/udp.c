@@ -10,26 +10,27 @@
 
 static void (*udp_callback)(uint8_t *packet);
 
+/*
+ * with USTACK_HW_CHKSUM, a datagram sent whole (not fragmented) carries only the pseudo header
+ * sum on its checksum field, and the link layer driver completes it over the datagram (the
+ * ENC28J60 sums it with its DMA checksum engine, on the copy of the frame in the controller).
+ * the driver also verifies datagrams received whole and clears their checksum field.
+ */
+#if USTACK_HW_CHKSUM == 1
+#define UDP_HW_CHKSUM(len)	((len) + IP_HEADER_SIZE + ETH_HEADER_SIZE <= PACKET_SIZE)
+#else
+#define UDP_HW_CHKSUM(len)	0
+#endif
+
+/* sum of the pseudo header and the datagram, including its checksum field (0xffff if valid) */
 static uint16_t udpchksum(uint8_t *packet, uint16_t len)
 {
-	uint32_t sum = 0;
-	uint16_t i;
-
-	sum += ((uint32_t)packet[IP_HDR_SRCADDR1] << 8) | (uint32_t)packet[IP_HDR_SRCADDR2];
-	sum += ((uint32_t)packet[IP_HDR_SRCADDR3] << 8) | (uint32_t)packet[IP_HDR_SRCADDR4];
-	sum += ((uint32_t)packet[IP_HDR_DESTADDR1] << 8) | (uint32_t)packet[IP_HDR_DESTADDR2];
-	sum += ((uint32_t)packet[IP_HDR_DESTADDR3] << 8) |(uint32_t)packet[IP_HDR_DESTADDR4];
-	sum += IP_PROTO_UDP;
-	sum += len;
-	for(i = IP_HEADER_SIZE; i < len + IP_HEADER_SIZE-1; i += 2)
-		sum += ((uint32_t)packet[i] << 8) | (uint32_t)packet[i + 1];
-	if (len & 1)
-		sum += (uint32_t)packet[len + IP_HEADER_SIZE-1] << 8;
-    	while (sum & 0xffff0000)
-		sum = (sum & 0xffff) + (sum >> 16);
-	sum = ~sum & 0xffff;
-
-	return (uint16_t)sum;
+	uint32_t sum;
+
+	sum = chksum_add(IP_PROTO_UDP + len, &packet[IP_HDR_SRCADDR1], 8);
+	sum = chksum_add(sum, &packet[IP_HEADER_SIZE], len);
+
+	return chksum_fold(sum);
 }
 
 int32_t udp_out(uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port, uint8_t *packet, uint16_t len)
@@ -56,15 +57,111 @@ int32_t udp_out(uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port, uint8
 	packet[UDP_HDR_CHKSUM2] = 0;
 	packet[IP_HDR_PROTO] = IP_PROTO_UDP;
 
-	chksum = udpchksum(packet, len);
+	/* a computed checksum of zero is sent as 0xffff, zero meaning no checksum */
+	if (UDP_HW_CHKSUM(len)){
+		chksum = chksum_fold(chksum_add(IP_PROTO_UDP + len, &packet[IP_HDR_SRCADDR1], 8));
+	}else{
+		chksum = ~udpchksum(packet, len) & 0xffff;
+		if (chksum == 0)
+			chksum = 0xffff;
+	}
 	packet[UDP_HDR_CHKSUM1] = chksum >> 8;
 	packet[UDP_HDR_CHKSUM2] = chksum & 0xff;
 
-	val = ip_out(dst_addr, packet, len + IP_HEADER_SIZE);
+	USTACK_STAT(STAT_IP_OUT, val = ip_out(dst_addr, packet, len + IP_HEADER_SIZE));
 
 	return val;
 }
 
+/*
+ * send a datagram which may be larger than a frame. the header is built on its own and the
+ * data is gathered into the IP fragments, so the caller's buffer is not copied first.
+ */
+int32_t udp_outv(uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port, uint8_t *data, uint16_t len)
+{
+	uint8_t hdr[UDP_HEADER_SIZE];
+	uint32_t sum;
+	uint16_t chksum, ulen;
+	
+	ulen = len + UDP_HEADER_SIZE;
+	hdr[0] = src_port >> 8;
+	hdr[1] = src_port & 0xff;
+	hdr[2] = dst_port >> 8;
+	hdr[3] = dst_port & 0xff;
+	hdr[4] = ulen >> 8;
+	hdr[5] = ulen & 0xff;
+	hdr[6] = 0;
+	hdr[7] = 0;
+	
+	sum = IP_PROTO_UDP + ulen + (myip[0] << 8 | myip[1]) + (myip[2] << 8 | myip[3]) +
+		(dst_addr[0] << 8 | dst_addr[1]) + (dst_addr[2] << 8 | dst_addr[3]);
+	if (UDP_HW_CHKSUM(ulen)){
+		chksum = chksum_fold(sum);
+	}else{
+		sum = chksum_add(sum, hdr, UDP_HEADER_SIZE);
+		sum = chksum_add(sum, data, len);
+		chksum = ~chksum_fold(sum) & 0xffff;
+		if (chksum == 0)
+			chksum = 0xffff;
+	}
+	hdr[6] = chksum >> 8;
+	hdr[7] = chksum & 0xff;
+	
+	return ip_outfrag(dst_addr, IP_PROTO_UDP, hdr, UDP_HEADER_SIZE, data, len);
+}
+
+/*
+ * send a batch of datagrams from the same port to the same destination. the header and the
+ * pseudo header sum are built once and copied to each datagram, which adds only its length and
+ * data to the checksum. lens[] are the UDP datagram sizes, as in udp_out(), and become the IP
+ * packet sizes. returns the number of datagrams taken by the link layer.
+ */
+int32_t udp_outm(uint8_t dst_addr[4], uint16_t src_port, uint16_t dst_port, uint8_t **packets, uint16_t *lens, int32_t n)
+{
+	uint8_t *packet;
+	uint32_t base, sum;
+	uint16_t chksum, len;
+	int32_t i;
+	
+	if (n <= 0)
+		return 0;
+	packet = packets[0];
+	memcpy(&packet[IP_HDR_SRCADDR1], myip, 4);
+	memcpy(&packet[IP_HDR_DESTADDR1], dst_addr, 4);
+	packet[IP_HDR_PROTO] = IP_PROTO_UDP;
+	packet[UDP_HDR_SRCPORT1] = src_port >> 8;
+	packet[UDP_HDR_SRCPORT2] = src_port & 0xff;
+	packet[UDP_HDR_DESTPORT1] = dst_port >> 8;
+	packet[UDP_HDR_DESTPORT2] = dst_port & 0xff;
+	base = IP_PROTO_UDP + src_port + dst_port + (myip[0] << 8 | myip[1]) + (myip[2] << 8 | myip[3]) +
+		(dst_addr[0] << 8 | dst_addr[1]) + (dst_addr[2] << 8 | dst_addr[3]);
+	
+	for (i = 0; i < n; i++){
+		packet = packets[i];
+		len = lens[i];
+		if (i > 0)
+			memcpy(&packet[IP_HDR_SRCADDR1], &packets[0][IP_HDR_SRCADDR1], UDP_HDR_LEN1 - IP_HDR_SRCADDR1);
+		packet[IP_HDR_PROTO] = IP_PROTO_UDP;
+		packet[UDP_HDR_LEN1] = len >> 8;
+		packet[UDP_HDR_LEN2] = len & 0xff;
+		
+		/* the length appears on both the pseudo header and the header */
+		if (UDP_HW_CHKSUM(len)){
+			chksum = chksum_fold(base - src_port - dst_port + len);
+		}else{
+			sum = chksum_add(base + len + len, &packet[UDP_DATA_OFS], len - UDP_HEADER_SIZE);
+			chksum = ~chksum_fold(sum) & 0xffff;
+			if (chksum == 0)
+				chksum = 0xffff;
+		}
+		packet[UDP_HDR_CHKSUM1] = chksum >> 8;
+		packet[UDP_HDR_CHKSUM2] = chksum & 0xff;
+		lens[i] = len + IP_HEADER_SIZE;
+	}
+	
+	return ip_outv(dst_addr, packets, lens, n);
+}
+
 int32_t udp_in(uint8_t *packet)
 {
 	uint8_t dst_addr[4];
@@ -74,9 +171,7 @@ int32_t udp_in(uint8_t *packet)
 	datalen = (packet[UDP_HDR_LEN1] << 8) | packet[UDP_HDR_LEN2];
 
 	if (chksum){
-		packet[UDP_HDR_CHKSUM1] = 0;
-		packet[UDP_HDR_CHKSUM2] = 0;
-		if (chksum != udpchksum(packet, datalen)){
+		if (udpchksum(packet, datalen) != 0xffff){
 			return -1;
 		}
 	}
@@ -96,7 +191,7 @@ int32_t udp_in(uint8_t *packet)
 			break;
 		default:
 			if (udp_callback)
-				udp_callback(packet);
+				USTACK_STAT(STAT_UDP_CALLBACK, udp_callback(packet));
 
 			return datalen;
 	}
@@ -0,0 +1,184 @@
+#include <hellfire.h>
+#include <ustack.h>
+#include <uudp.h>
+#include <noc.h>
+#include <noc_bridge.h>
+
+/*
+UDP to NoC gateway
+
+a core with a network interface bridges UDP ports to NoC endpoints (cpu, port). datagrams received on a
+mapped port are sent as messages to the endpoint on the map channel, straight from the buffer holding the
+frame, by the network service (ustack_service) itself: the socket forward hook takes the datagram before
+it is queued, so no copy to an application buffer and no switch to another task are needed. the network
+service sends from its own port (the bridge port + 1), which receives nothing.
+
+messages from the endpoints are sent to the bridge port on the bridge channel. the bridge task receives
+each one straight into the payload of a packet buffer (hf_recvv()), finds the map of its source (cpu, port)
+and sends the buffer as a datagram from the mapped port to the source of the last datagram of the map. a
+message from an unmapped endpoint, larger than a frame or sent before any datagram arrived is dropped.
+*/
+
+static struct noc_bridge *bridge_maps[BRIDGE_MAPS];
+static uint16_t bridge_channel;
+static int32_t bridge_id = -1;
+
+static struct noc_bridge *bridge_find(uint16_t cpu, uint16_t port)
+{
+	int32_t i;
+
+	for (i = 0; i < BRIDGE_MAPS; i++)
+		if (bridge_maps[i] && bridge_maps[i]->cpu == cpu && bridge_maps[i]->port == port)
+			return bridge_maps[i];
+
+	return NULL;
+}
+
+/* UDP to NoC, called from the UDP layer (udp_callback()) on the network service */
+static void bridge_forward(struct uudp *comm, uint8_t *packet)
+{
+	struct noc_bridge *b = (struct noc_bridge *)comm;
+	uint32_t status;
+	uint16_t len;
+
+	len = (packet[UDP_HDR_LEN1] << 8) | (packet[UDP_HDR_LEN2] & 0xff);
+	if (len < UDP_HEADER_SIZE){
+		b->dropped++;
+		return;
+	}
+
+	status = _di();
+	memcpy(b->peer_ip, &packet[IP_HDR_SRCADDR1], 4);
+	b->peer_port = (packet[UDP_HDR_SRCPORT1] << 8) | (packet[UDP_HDR_SRCPORT2] & 0xff);
+	_ei(status);
+
+	if (hf_send(b->cpu, b->port, (int8_t *)&packet[UDP_DATA_OFS], len - UDP_HEADER_SIZE, b->channel))
+		b->dropped++;
+	else
+		b->to_noc++;
+}
+
+/* NoC to UDP */
+static void bridge_task(void)
+{
+	struct noc_bridge *b;
+	struct noc_iov iov;
+	struct pbuf *p;
+	uint32_t size, status;
+	uint16_t cpu, port, peer_port;
+	uint8_t peer_ip[4];
+	int32_t val;
+
+	while (1){
+		p = pbuf_alloc();
+		if (!p){
+			hf_yield();
+			continue;
+		}
+		iov.buf = (int8_t *)p->frame + PBUF_HEADROOM;
+		iov.size = PACKET_SIZE - PBUF_HEADROOM;
+		val = hf_recvv(&cpu, &port, &iov, 1, &size, bridge_channel);
+
+		status = _di();
+		b = bridge_find(cpu, port);
+		if (b){
+			memcpy(peer_ip, b->peer_ip, 4);
+			peer_port = b->peer_port;
+		}
+		_ei(status);
+
+		if (!b){
+			pbuf_free(p);
+			continue;
+		}
+		if (val || peer_port == 0 || udp_out(peer_ip, b->comm.listen_port, peer_port, p->frame + ETH_HEADER_SIZE, size + UDP_HEADER_SIZE) <= 0)
+			b->dropped++;
+		else
+			b->to_udp++;
+		pbuf_free(p);
+	}
+}
+
+/*
+starts the bridge task, which receives messages from the endpoints on port and channel (with a ring of
+packets packets), and binds the network service to port + 1. must be called after the network stack is up.
+*/
+int32_t hf_bridge_init(uint16_t port, uint16_t channel, uint16_t packets)
+{
+	int32_t net;
+
+	if (bridge_id >= 0)
+		return ERR_ERROR;
+	net = hf_id("ustack");
+	if (net < 0 || net >= MAX_TASKS)
+		return ERR_ERROR;
+	if (hf_comm_create(net, port + 1, 1))
+		return ERR_COMM_ERROR;
+
+	bridge_channel = channel;
+	bridge_id = hf_spawn(bridge_task, 0, 0, 0, "bridge", BRIDGE_STACK);
+	if (bridge_id < 0){
+		hf_comm_destroy(net);
+		return ERR_ERROR;
+	}
+	if (hf_comm_create(bridge_id, port, packets)){
+		hf_kill(bridge_id);
+		hf_comm_destroy(net);
+		bridge_id = -1;
+		return ERR_COMM_ERROR;
+	}
+
+	return ERR_OK;
+}
+
+/* maps udp_port to the endpoint (cpu, port), messages to the endpoint go on channel */
+int32_t hf_bridge_map(struct noc_bridge *b, uint16_t udp_port, uint16_t cpu, uint16_t port, uint16_t channel)
+{
+	uint32_t status;
+	int32_t i, val;
+
+	if (bridge_id < 0 || udp_port == 0 || cpu >= hf_ncores())
+		return ERR_ERROR;
+	if (bridge_find(cpu, port))
+		return ERR_ERROR;
+	for (i = 0; i < BRIDGE_MAPS; i++)
+		if (bridge_maps[i] == NULL)
+			break;
+	if (i == BRIDGE_MAPS)
+		return ERR_ERROR;
+
+	b->cpu = cpu;
+	b->port = port;
+	b->channel = channel;
+	b->peer_port = 0;
+	b->to_noc = b->to_udp = b->dropped = 0;
+	val = hf_uudp_create(&b->comm, udp_port, 1);
+	if (val)
+		return val;
+	b->comm.forward = bridge_forward;
+	b->comm.owner = 0;		/* used by the bridge, not by the task mapping it */
+
+	status = _di();
+	bridge_maps[i] = b;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+int32_t hf_bridge_unmap(struct noc_bridge *b)
+{
+	uint32_t status;
+	int32_t i;
+
+	for (i = 0; i < BRIDGE_MAPS; i++)
+		if (bridge_maps[i] == b)
+			break;
+	if (i == BRIDGE_MAPS)
+		return ERR_ERROR;
+
+	status = _di();
+	bridge_maps[i] = NULL;
+	_ei(status);
+
+	return hf_uudp_destroy(&b->comm);
+}
@@ -0,0 +1,238 @@
+#include <hellfire.h>
+#include <ustack.h>
+#include <uudp.h>
+#include <telemetry.h>
+#ifdef NOC_INTERCONNECT
+#include <noc.h>
+#endif
+
+/* sections after the task list */
+#define TELEMETRY_TAIL		(4 + USTACK_STAT_LAYERS * 8 + 4 + 10 * 4)
+
+#ifndef COUNTER_SPEED
+#define COUNTER_SPEED		CPU_SPEED
+#endif
+
+/*
+trace and metrics export
+
+a best effort task sends kernel stats (heap, scheduler, tasks), network stack and NoC counters every
+TELEMETRY_STATS_PERIOD ms, and drains the binary trace ring (KERNEL_LOG 3) every TELEMETRY_PERIOD ms,
+to a collector over UDP. the task takes the trace ring from the idle task (hf_traceclaim()), and never
+sends more than rate bytes per second on average (a token bucket, which holds up to one second of
+traffic or a datagram), so real time tasks and the network are not disturbed. events that do not fit
+the rate stay on the ring, and are counted as lost once it is full.
+
+datagrams start with a TELEMETRY_HEADER bytes header: the magic "HFTM", the version and type (8 bit
+each), the cpu (16 bit), a sequence number and the cycle counter (32 bit each). stats datagrams hold
+sections (a 16 bit tag and length, then 32 bit words), and trace datagrams hold the lost event count,
+the counter frequency and 8 byte records, as in the debug port stream (hf_traceflush()). all words are
+little endian.
+*/
+
+static struct uudp telemetry_comm;
+static uint8_t telemetry_ip[4];
+static uint16_t telemetry_port;
+static uint32_t telemetry_rate, telemetry_seq;
+static int32_t telemetry_id = -1;
+
+static uint8_t *put16(uint8_t *p, uint16_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = val >> 8;
+
+	return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = val >> 24;
+
+	return p + 4;
+}
+
+static uint8_t *telemetry_header(uint8_t *p, uint8_t type)
+{
+	memcpy(p, TELEMETRY_MAGIC, 4);
+	p[4] = TELEMETRY_VERSION;
+	p[5] = type;
+#ifdef NOC_INTERCONNECT
+	p = put16(p + 6, hf_cpuid());
+#else
+	p = put16(p + 6, 0);
+#endif
+	p = put32(p, telemetry_seq++);
+
+	return put32(p, _readcounter());
+}
+
+static uint8_t *telemetry_section(uint8_t *p, uint16_t tag, uint16_t len)
+{
+	p = put16(p, tag);
+
+	return put16(p, len);
+}
+
+static int32_t telemetry_stats(uint8_t *buf)
+{
+	struct heap_stats h;
+	uint8_t *p, *tasks;
+	int32_t i, n = 0;
+#ifdef NOC_INTERCONNECT
+	struct noc_stats s;
+#endif
+
+	p = telemetry_header(buf, TELEMETRY_STATS);
+
+	hf_heapstats(&h);
+	p = telemetry_section(p, TELEMETRY_HEAP, 6 * 4);
+	p = put32(p, h.free);
+	p = put32(p, h.largest);
+	p = put32(p, h.used);
+	p = put32(p, h.peak);
+	p = put32(p, h.allocs);
+	p = put32(p, h.failed);
+
+	p = telemetry_section(p, TELEMETRY_SCHED, 4 * 4);
+	p = put32(p, krnl_pcb.coop_cswitch);
+	p = put32(p, krnl_pcb.preempt_cswitch);
+	p = put32(p, krnl_pcb.interrupts);
+	p = put32(p, (uint32_t)krnl_pcb.sched_cycles);
+
+	/* id, state and priority (8 bit each, and a pad byte), cycles and deadline misses per task */
+	tasks = p;
+	p += 4;
+	for (i = 0; i < MAX_TASKS && p + 12 <= buf + TELEMETRY_MTU - TELEMETRY_TAIL; i++){
+		if (!krnl_tcb[i].ptask)
+			continue;
+		p[0] = krnl_tcb[i].id;
+		p[1] = krnl_tcb[i].state;
+		p[2] = krnl_tcb[i].priority;
+		p[3] = 0;
+		p = put32(p + 4, (uint32_t)krnl_tcb[i].cycles);
+		p = put32(p, krnl_tcb[i].deadline_misses);
+		n++;
+	}
+	telemetry_section(tasks, TELEMETRY_TASKS, n * 12);
+
+	/* frames (packets) and cycles per layer */
+	p = telemetry_section(p, TELEMETRY_NET, USTACK_STAT_LAYERS * 8);
+	for (i = 0; i < USTACK_STAT_LAYERS; i++){
+		p = put32(p, ustack_stats[i].count);
+		p = put32(p, (uint32_t)ustack_stats[i].cycles);
+	}
+
+#ifdef NOC_INTERCONNECT
+	hf_noc_stats(&s);
+	p = telemetry_section(p, TELEMETRY_NOC, 10 * 4);
+	p = put32(p, s.tx_packets);
+	p = put32(p, s.rx_packets);
+	p = put32(p, s.drop_noc_full);
+	p = put32(p, s.drop_task_full);
+	p = put32(p, s.drop_no_port);
+	p = put32(p, s.drop_no_flow);
+	p = put32(p, s.drop_quota);
+	p = put32(p, s.rma_served);
+	p = put32(p, s.rma_denied);
+	p = put16(p, s.queue_free);
+	p = put16(p, s.queue_min);
+#endif
+
+	return p - buf;
+}
+
+static int32_t telemetry_trace(uint8_t *buf, int32_t max)
+{
+	struct trace_entry e[8];
+	uint8_t *p;
+	int32_t i, n, left;
+
+	p = telemetry_header(buf, TELEMETRY_TRACE);
+	p = put32(p, hf_tracelost());
+	p = put32(p, COUNTER_SPEED);
+	left = (max - (p - buf)) / sizeof(struct trace_entry);
+	while (left > 0){
+		n = hf_traceread(e, left > 8 ? 8 : left);
+		if (n == 0)
+			break;
+		for (i = 0; i < n; i++){
+			p = put32(p, e[i].time);
+			p[0] = e[i].event;
+			p[1] = e[i].task;
+			p = put16(p + 2, e[i].arg);
+		}
+		left -= n;
+	}
+	if (p - buf == TELEMETRY_HEADER + 8){
+		telemetry_seq--;
+		return 0;
+	}
+
+	return p - buf;
+}
+
+static void telemetry_task(void)
+{
+	uint8_t buf[TELEMETRY_MTU];
+	uint32_t tokens, burst, elapsed = TELEMETRY_STATS_PERIOD;
+	int32_t len;
+
+	burst = telemetry_rate > TELEMETRY_MTU ? telemetry_rate : TELEMETRY_MTU;
+	tokens = burst;
+	hf_traceclaim();
+
+	while (1){
+		hf_msleep(TELEMETRY_PERIOD);
+		tokens += telemetry_rate * TELEMETRY_PERIOD / 1000;
+		if (tokens > burst)
+			tokens = burst;
+		elapsed += TELEMETRY_PERIOD;
+
+		if (elapsed >= TELEMETRY_STATS_PERIOD && tokens >= TELEMETRY_MTU){
+			len = telemetry_stats(buf);
+			if (hf_uudp_send(&telemetry_comm, telemetry_ip, telemetry_port, buf, len) > 0)
+				tokens -= len;
+			elapsed = 0;
+		}
+#if KERNEL_LOG == 3
+		while (tokens >= TELEMETRY_HEADER + 8 + sizeof(struct trace_entry)){
+			len = telemetry_trace(buf, tokens < TELEMETRY_MTU ? tokens : TELEMETRY_MTU);
+			if (len == 0)
+				break;
+			tokens -= len;
+			if (hf_uudp_send(&telemetry_comm, telemetry_ip, telemetry_port, buf, len) <= 0)
+				break;
+		}
+#endif
+	}
+}
+
+/*
+starts the telemetry task, which sends to a collector at dst_ip and dst_port at most rate bytes per
+second (at least a stats datagram per second should fit). must be called after the network stack is up.
+*/
+int32_t hf_telemetry_init(uint8_t dst_ip[4], uint16_t dst_port, uint32_t rate)
+{
+	int32_t val;
+
+	if (telemetry_id >= 0)
+		return ERR_ERROR;
+	val = hf_uudp_create(&telemetry_comm, 0, 1);
+	if (val)
+		return val;
+	memcpy(telemetry_ip, dst_ip, 4);
+	telemetry_port = dst_port;
+	telemetry_rate = rate;
+
+	telemetry_id = hf_spawn(telemetry_task, 0, 0, 0, "telemetry", TELEMETRY_STACK + TELEMETRY_MTU);
+	if (telemetry_id < 0){
+		hf_uudp_destroy(&telemetry_comm);
+		return ERR_ERROR;
+	}
+	telemetry_comm.owner = telemetry_id;
+
+	return ERR_OK;
+}
@@ -2,129 +2,137 @@
 #include <ustack.h>
 #include <uudp.h>
 
-static struct list *comm_list;
-mutex_t uudplock;
+/* sockets, hashed by listen port */
+static struct ilist comm_hash[UUDP_HASH_SIZE];
+
+static struct ilist *uudp_bucket(uint16_t port)
+{
+	return &comm_hash[(port ^ (port >> 8)) & (UUDP_HASH_SIZE - 1)];
+}
+
+static struct uudp *uudp_find(uint16_t port)
+{
+	struct ilist *l, *bucket;
+	struct uudp *comm_node;
+
+	bucket = uudp_bucket(port);
+	hf_ilist_foreach(l, bucket){
+		comm_node = hf_ilist_entry(l, struct uudp, link);
+		if (comm_node->listen_port == port)
+			return comm_node;
+	}
+
+	return NULL;
+}
 
 /*
 this is called from the UDP layer. this all happens inside the network service (ustack_service), as it
 calls the ip stack upstream on the reception of data. find the correct packet queue based on port, take
-a free buffer from the pool, copy data from the input packet and add the buffer to the correct packet queue.
-if no port is configured for reception or there are no more free buffers, data is lost.
+a reference to the packet buffer holding the input packet and add the packet to the correct packet queue.
+packets received on a link layer driver buffer are copied to a packet buffer from the shared pool first.
+if no port is configured for reception, the packet queue is full or there are no free buffers, data is lost.
+a receiver blocked on the socket is woken up by the socket semaphore. sockets with a forward hook (such
+as the bridge, net/uudp/noc_bridge.c) get the datagram in place, wherever it is buffered, and are not queued.
 */
 static void udp_callback(uint8_t *packet){
-	int32_t i, k;
 	uint16_t port, len;
 	struct uudp *comm_node;
-	void *buff;
+	struct pbuf *p;
 	
 	port = (packet[UDP_HDR_DESTPORT1] << 8) | (packet[UDP_HDR_DESTPORT2] & 0xff);
-	k = hf_list_count(comm_list);
-	for (i = 0; i < k; i++){
-		comm_node = (struct uudp *)hf_list_get(comm_list, i);
-		if (comm_node->listen_port == port)
-			break;
-	}
+	comm_node = uudp_find(port);
 	
-	if (i < k){
-		buff = hf_queue_remhead(comm_node->free_buffers);
-		if (buff){
+	if (comm_node && comm_node->forward){
+		comm_node->forward(comm_node, packet);
+	}else if (comm_node){
+		p = pbuf_get(packet);
+		if (p){
+			pbuf_ref(p);
+		}else{
+			p = pbuf_alloc();
+			if (!p) return;
 			len = (packet[IP_HDR_LEN1] << 8) | (packet[IP_HDR_LEN2] & 0xff);
-			memcpy(buff, packet, len);
-			hf_queue_addtail(comm_node->pkt_queue, buff);
+			if (len > p->size - ETH_HEADER_SIZE) len = p->size - ETH_HEADER_SIZE;
+			memcpy(p->frame + ETH_HEADER_SIZE, packet, len);
+			packet = p->frame + ETH_HEADER_SIZE;
 		}
+		if (hf_queue_addtail(comm_node->pkt_queue, packet))
+			pbuf_free(p);
+		else
+			hf_sempost(&comm_node->pkt_sem);
 	}
 	
 }
 
-int32_t hf_uudp_create(struct uudp *comm, uint16_t listen_port, uint32_t qsize)
+/*
+sockets of a task which is killed are destroyed (hf_killhook()), dropping the datagrams on their queues.
+a socket lives on memory of its owner, which is still valid when this is called.
+*/
+static void uudp_kill(uint16_t id)
 {
-	int32_t i, k;
-	void *ptr;
+	struct ilist *l, *n;
 	struct uudp *comm_node;
-	
+	int32_t i;
+
+	for (i = 0; i < UUDP_HASH_SIZE; i++){
+		hf_ilist_foreach_safe(l, n, &comm_hash[i]){
+			comm_node = hf_ilist_entry(l, struct uudp, link);
+			if (comm_node->owner == id)
+				hf_uudp_destroy(comm_node);
+		}
+	}
+}
+
+int32_t hf_uudp_create(struct uudp *comm, uint16_t listen_port, uint32_t qsize)
+{
+	int32_t i;
+
 	if (udp_get_callback() == NULL){
-		comm_list = hf_list_init();
-		if (!comm_list)
-			return ERR_OUT_OF_MEMORY;
+		for (i = 0; i < UUDP_HASH_SIZE; i++)
+			hf_ilist_init(&comm_hash[i]);
 		udp_set_callback(udp_callback);
-		hf_mtxinit(&uudplock);
+		hf_killhook(uudp_kill);
 	}
 
 	if (listen_port == 0)
 		comm->listen_port = (uint16_t)(((uint32_t)random() % 16383) + 49152);
 	else
 		comm->listen_port = listen_port;
+	comm->forward = NULL;
+	comm->owner = hf_selfid();
 		
-	k = hf_list_count(comm_list);
-	for (i = 0; i < k; i++){
-		comm_node = (struct uudp *)hf_list_get(comm_list, i);
-		if (comm_node->listen_port == comm->listen_port)
-			return ERR_ERROR;
-	}
-	
-	if (hf_list_append(comm_list, comm))
-		return ERR_OUT_OF_MEMORY;
+	if (uudp_find(comm->listen_port))
+		return ERR_ERROR;
 
-	comm->free_buffers = hf_queue_create(qsize);
-	if (!comm->free_buffers)
-		return ERR_OUT_OF_MEMORY;
-		
 	comm->pkt_queue = hf_queue_create(qsize);
 	if (!comm->pkt_queue)
 		return ERR_OUT_OF_MEMORY;
-
-	for (i = 0; i < qsize; i++){
-		ptr = hf_malloc(PACKET_SIZE);
-		if (ptr == NULL){
-			while (hf_queue_count(comm->free_buffers))
-				hf_free(hf_queue_remhead(comm->free_buffers));
-			hf_queue_destroy(comm->free_buffers);
-			
-			while (hf_queue_count(comm->pkt_queue))
-				hf_free(hf_queue_remhead(comm->pkt_queue));
-			hf_queue_destroy(comm->pkt_queue);
-			
-			k = hf_list_count(comm_list);
-			hf_list_remove(comm_list, k - 1);
-			
-			return ERR_OUT_OF_MEMORY;
-		}
-		hf_queue_addtail(comm->free_buffers, ptr);
+	if (hf_seminit(&comm->pkt_sem, 0)){
+		hf_queue_destroy(comm->pkt_queue);
+		return ERR_OUT_OF_MEMORY;
 	}
 
+	hf_ilist_addtail(uudp_bucket(comm->listen_port), &comm->link);
+
 	return ERR_OK;
 }
 
 int32_t hf_uudp_destroy(struct uudp *comm)
 {
-	int32_t i, k;
-	struct uudp *comm_node = NULL;
-	
-	if (!comm_list)
-		return ERR_ERROR;
-		
-	k = hf_list_count(comm_list);
-	for (i = 0; i < k; i++){
-		comm_node = (struct uudp *)hf_list_get(comm_list, i);
-		if (comm_node->listen_port == comm->listen_port)
-			break;
-	}
+	struct uudp *comm_node;
 	
-	if (!comm_node)
+	if (!comm_hash[0].next)
 		return ERR_ERROR;
 		
-	if (comm_node->listen_port != comm->listen_port)
+	comm_node = uudp_find(comm->listen_port);
+	if (comm_node != comm)
 		return ERR_ERROR;
 		
-	while (hf_queue_count(comm->free_buffers))
-		hf_free(hf_queue_remhead(comm->free_buffers));
-	hf_queue_destroy(comm->free_buffers);
-			
+	hf_ilist_remove(&comm->link);
 	while (hf_queue_count(comm->pkt_queue))
-		hf_free(hf_queue_remhead(comm->pkt_queue));
+		pbuf_free(pbuf_get(hf_queue_remhead(comm->pkt_queue)));
 	hf_queue_destroy(comm->pkt_queue);
-			
-	hf_list_remove(comm_list, i);
+	hf_semdestroy(&comm->pkt_sem);
 	
 	return ERR_OK;
 }
@@ -133,52 +141,270 @@ int32_t hf_uudp_destroy(struct uudp *comm)
 UDP receive
 
 this is called from the application layer. since the network service (ustack_service) task is the only
-task that calls netif_recv() and accesses the low level input buffer (frame_in), we can do this without locks.
-take a UDP datagram reference from the packet queue, copy data to an output buffer and free the reference
-(put it back on the pool of free reception buffers).
+task that adds packets to the packet queues, we can do this without locks. take a UDP datagram from the
+packet queue, copy data to an output buffer (of size bytes) and drop the reference to its packet buffer.
+datagrams reassembled from fragments may be larger than a frame. a datagram which does not fit the buffer
+is dropped. receivers may poll the socket, or sleep on its semaphore until a datagram arrives (with an
+optional timeout, in ms). the semaphore counts the datagrams on the packet queue, so one is taken from
+it in all cases.
 */
-int32_t hf_uudp_recv(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf)
+static int32_t uudp_recv(uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf, uint16_t size, uint8_t *ptr)
 {
 	uint16_t len;
-	uint8_t *ptr;
-	
-	if (hf_queue_count(comm->pkt_queue) == 0) return 0;
 	
-	ptr = (uint8_t *)hf_queue_remhead(comm->pkt_queue);
 	len = (ptr[UDP_HDR_LEN1] << 8) | (ptr[UDP_HDR_LEN2] & 0xff);
 	
-	if (len > PACKET_SIZE - ETH_HEADER_SIZE - UDP_HEADER_SIZE)
+	if (len < UDP_HEADER_SIZE || len - UDP_HEADER_SIZE > size){
+		pbuf_free(pbuf_get(ptr));
 		return ERR_ERROR;
+	}
 	
 	memcpy(src_ip, &ptr[IP_HDR_SRCADDR1], 4);
 	*src_port = (ptr[UDP_HDR_SRCPORT1] << 8) | (ptr[UDP_HDR_SRCPORT2] & 0xff);
 	memcpy(buf, &ptr[UDP_DATA_OFS], len - UDP_HEADER_SIZE);
-	hf_queue_addtail(comm->free_buffers, ptr);
+	pbuf_free(pbuf_get(ptr));
 	
 	return len - UDP_HEADER_SIZE;
 }
 
+int32_t hf_uudp_recvn(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf, uint16_t size)
+{
+	if (hf_semwait_timeout(&comm->pkt_sem, 0)) return 0;
+	
+	return uudp_recv(src_ip, src_port, buf, size, hf_queue_remhead(comm->pkt_queue));
+}
+
+int32_t hf_uudp_recvwait(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf, uint16_t size)
+{
+	hf_semwait(&comm->pkt_sem);
+	
+	return uudp_recv(src_ip, src_port, buf, size, hf_queue_remhead(comm->pkt_queue));
+}
+
+static uint32_t uudp_ticks(uint32_t timeout)
+{
+	uint32_t ticks;
+	
+	if (timeout > 4000000) timeout = 4000000;
+	ticks = timeout * 1000 / hf_ticktime();
+	if (ticks == 0 && timeout) ticks = 1;
+	
+	return ticks;
+}
+
+/* returns ERR_TIMEOUT if no datagram arrives in timeout ms (up to 4000000) */
+int32_t hf_uudp_recv_timeout(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf, uint16_t size, uint32_t timeout)
+{
+	if (hf_semwait_timeout(&comm->pkt_sem, uudp_ticks(timeout))) return ERR_TIMEOUT;
+	
+	return uudp_recv(src_ip, src_port, buf, size, hf_queue_remhead(comm->pkt_queue));
+}
+
+/*
+receive a batch of up to n datagrams. waits up to timeout ms (0 polls) for the first one, and takes the
+others already queued. datagrams which do not fit their buffers are dropped. returns the number of
+datagrams received.
+*/
+int32_t hf_uudp_recvm(struct uudp *comm, struct uudp_msg *msgs, int32_t n, uint32_t timeout)
+{
+	int32_t i = 0, len;
+	uint32_t ticks;
+	
+	ticks = uudp_ticks(timeout);
+	while (i < n && hf_semwait_timeout(&comm->pkt_sem, i ? 0 : ticks) == ERR_OK){
+		len = uudp_recv(msgs[i].ip, &msgs[i].port, msgs[i].buf, msgs[i].len, hf_queue_remhead(comm->pkt_queue));
+		if (len >= 0)
+			msgs[i++].len = len;
+	}
+	
+	return i;
+}
+
+/* receive a datagram of up to a frame of data (buf must hold PACKET_SIZE - PBUF_HEADROOM bytes) */
+int32_t hf_uudp_recv(struct uudp *comm, uint8_t src_ip[4], uint16_t *src_port, uint8_t *buf)
+{
+	return hf_uudp_recvn(comm, src_ip, src_port, buf, PACKET_SIZE - PBUF_HEADROOM);
+}
+
 /*
 UDP send
 
 this is called from the application layer. any task can be trying to send data (accessing the network
-stack downstream), so we need to synchronize the access to the low level output buffer (frame_out).
-copy data to the low level output buffer and try to send it through the network.
+stack downstream), so each datagram is built on its own packet buffer, which is queued for transmission
+(the sender returns without waiting for the link layer driver). copy data to a packet buffer and try to
+send it through the network. datagrams larger than a frame (up to IP_MAX_DATAGRAM) are sent in IP fragments,
+gathered from the data buffer.
 */
 int32_t hf_uudp_send(struct uudp *comm, uint8_t dst_ip[4], uint16_t dst_port, uint8_t *buf, uint16_t len)
 {
 	int32_t val, tries = 0;
+	struct pbuf *p;
 
-	if (len > PACKET_SIZE - ETH_HEADER_SIZE - UDP_HEADER_SIZE)
+	if (len > IP_MAX_DATAGRAM - IP_HEADER_SIZE - UDP_HEADER_SIZE)
 		return ERR_ERROR;
 	
-	hf_mtxlock(&uudplock);
-	memcpy(frame_out + ETH_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE, buf, len);
+	if (len > PACKET_SIZE - PBUF_HEADROOM){
+		do {
+			val = udp_outv(dst_ip, comm->listen_port, dst_port, buf, len);
+			if (val == 0) hf_msleep(UUDP_DELAY_ON_RETRY);
+		} while (val == 0 && tries++ < UUDP_RETRIES);
+		
+		return val;
+	}
+	
+	p = pbuf_alloc();
+	if (!p)
+		return ERR_OUT_OF_MEMORY;
+	memcpy(p->frame + PBUF_HEADROOM, buf, len);
 	do {
-		val = udp_out(dst_ip, comm->listen_port, dst_port, frame_out + ETH_HEADER_SIZE, len + UDP_HEADER_SIZE);
-		if (val == 0) delay_ms(UUDP_DELAY_ON_RETRY);
+		val = udp_out(dst_ip, comm->listen_port, dst_port, p->frame + ETH_HEADER_SIZE, len + UDP_HEADER_SIZE);
+		if (val == 0) hf_msleep(UUDP_DELAY_ON_RETRY);
 	} while (val == 0 && tries++ < UUDP_RETRIES);
-	hf_mtxunlock(&uudplock);
+	pbuf_free(p);
+
+	return val;
+}
+
+/*
+send a batch of datagrams (each one fitting a frame) to the same destination. up to UUDP_BATCH datagrams
+are copied to packet buffers and handed to the stack at once, which builds the headers from a template and
+resolves the destination once. returns the number of datagrams sent (fewer than n if the stack runs out of
+buffers or a datagram is too large), or an error if none was.
+*/
+int32_t hf_uudp_sendm(struct uudp *comm, uint8_t dst_ip[4], uint16_t dst_port, struct uudp_msg *msgs, int32_t n)
+{
+	struct pbuf *p[UUDP_BATCH];
+	uint8_t *packets[UUDP_BATCH];
+	uint16_t lens[UUDP_BATCH];
+	int32_t i, k, sent = 0, val, tries = 0;
+	
+	if (n <= 0)
+		return 0;
+	while (sent < n){
+		for (k = 0; k < UUDP_BATCH && sent + k < n; k++){
+			if (msgs[sent + k].len > PACKET_SIZE - PBUF_HEADROOM)
+				break;
+			p[k] = pbuf_alloc();
+			if (!p[k])
+				break;
+			memcpy(p[k]->frame + PBUF_HEADROOM, msgs[sent + k].buf, msgs[sent + k].len);
+			packets[k] = p[k]->frame + ETH_HEADER_SIZE;
+			lens[k] = msgs[sent + k].len + UDP_HEADER_SIZE;
+		}
+		if (k == 0)
+			break;
+		val = udp_outm(dst_ip, comm->listen_port, dst_port, packets, lens, k);
+		for (i = 0; i < k; i++)
+			pbuf_free(p[i]);
+		sent += val;
+		if (val < k){
+			if (val > 0 || tries++ >= UUDP_RETRIES)
+				break;
+			hf_msleep(UUDP_DELAY_ON_RETRY);
+		}
+	}
+	
+	return sent ? sent : ERR_ERROR;
+}
+
+/*
+loadable modules (sys/kernel/module.c), received over UDP
+
+the module file is sent on datagrams holding the file offset of their data (4 bytes, network byte order) and
+up to UUDP_MODULE_CHUNK bytes of the file, one at a time (usr/module/modsend.c). each datagram is
+acked with the file offset expected next, so the sender retransmits lost datagrams (and acks), and duplicates
+are dropped. the first datagram (offset 0) selects the sender, datagrams from other hosts are ignored until
+the transfer ends. the transfer is aborted if the sender is silent for UUDP_MODULE_TIMEOUT ms.
+*/
+struct uudp_modrx {
+	struct uudp *comm;
+	uint8_t ip[4];
+	uint16_t port;
+	uint32_t next;			/* file offset expected next */
+	uint16_t pos, len;		/* data of the last datagram, on buf + 4 */
+	uint8_t buf[UUDP_MODULE_CHUNK + 4];
+};
+
+static const struct module_symbol uudp_exports[] = {
+	{ "hf_uudp_create", (void *)hf_uudp_create },
+	{ "hf_uudp_destroy", (void *)hf_uudp_destroy },
+	{ "hf_uudp_recvn", (void *)hf_uudp_recvn },
+	{ "hf_uudp_recvwait", (void *)hf_uudp_recvwait },
+	{ "hf_uudp_recv_timeout", (void *)hf_uudp_recv_timeout },
+	{ "hf_uudp_send", (void *)hf_uudp_send },
+	{ NULL, NULL }
+};
+
+static void uudp_modack(struct uudp_modrx *rx)
+{
+	uint8_t ack[4];
+	
+	ack[0] = rx->next >> 24; ack[1] = rx->next >> 16;
+	ack[2] = rx->next >> 8; ack[3] = rx->next;
+	hf_uudp_send(rx->comm, rx->ip, rx->port, ack, sizeof(ack));
+}
+
+static int32_t uudp_modread(void *arg, void *buf, uint32_t size)
+{
+	struct uudp_modrx *rx = arg;
+	uint8_t ip[4];
+	uint16_t port;
+	uint32_t offset, done = 0, n;
+	int32_t len;
+	
+	while (done < size){
+		if (rx->pos == rx->len){
+			if (rx->next == 0)
+				len = hf_uudp_recvwait(rx->comm, ip, &port, rx->buf, sizeof(rx->buf));
+			else
+				len = hf_uudp_recv_timeout(rx->comm, ip, &port, rx->buf, sizeof(rx->buf), UUDP_MODULE_TIMEOUT);
+			if (len == ERR_TIMEOUT)
+				break;
+			if (len < 4)
+				continue;
+			offset = (rx->buf[0] << 24) | (rx->buf[1] << 16) | (rx->buf[2] << 8) | rx->buf[3];
+			if (rx->next == 0){
+				if (offset != 0)
+					continue;
+				memcpy(rx->ip, ip, 4);
+				rx->port = port;
+			}else if (memcmp(rx->ip, ip, 4) || rx->port != port){
+				continue;
+			}
+			if (offset == rx->next){
+				rx->pos = 0;
+				rx->len = len - 4;
+				rx->next += len - 4;
+			}
+			uudp_modack(rx);
+			continue;
+		}
+		n = rx->len - rx->pos;
+		if (n > size - done)
+			n = size - done;
+		memcpy((uint8_t *)buf + done, rx->buf + 4 + rx->pos, n);
+		rx->pos += n;
+		done += n;
+	}
+	
+	return done;
+}
 
+/* receives and loads a module on a socket. blocks until a transfer starts. the socket primitives are exported to modules */
+int32_t hf_module_uudp(struct uudp *comm, struct module *m)
+{
+	struct uudp_modrx *rx;
+	int32_t val;
+	
+	hf_module_export(uudp_exports);
+	rx = hf_malloc(sizeof(struct uudp_modrx));
+	if (!rx)
+		return ERR_OUT_OF_MEMORY;
+	rx->comm = comm;
+	rx->next = 0;
+	rx->pos = rx->len = 0;
+	val = hf_module_read(m, uudp_modread, rx);
+	hf_free(rx);
+	
 	return val;
 }
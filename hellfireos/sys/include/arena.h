@@ -0,0 +1,16 @@
+/**
+ * @brief Per task heap arena data structure.
+ */
+struct arena {
+	uint32_t size;					/*!< arena size, in bytes */
+	uint32_t used;					/*!< bytes already allocated */
+	uint32_t allocs;				/*!< allocations not yet released */
+	uint8_t *area;					/*!< arena storage */
+};
+
+int32_t hf_arena(uint16_t id, uint32_t size);
+void *hf_arena_alloc(uint32_t size);
+void hf_arena_free(void *ptr);
+void hf_arena_reset(void);
+int32_t hf_arena_avail(void);
+void arena_release(uint16_t id);
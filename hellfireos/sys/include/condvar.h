@@ -11,5 +11,6 @@ typedef volatile struct condvar cond_t;
 int32_t hf_condinit(cond_t *c);
 int32_t hf_conddestroy(cond_t *c);
 void hf_condwait(cond_t *c, mutex_t *m);
+int32_t hf_condwait_timeout(cond_t *c, mutex_t *m, uint32_t timeout);
 void hf_condsignal(cond_t *c);
 void hf_condbroadcast(cond_t *c);
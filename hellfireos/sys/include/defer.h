@@ -0,0 +1,24 @@
+/**
+ * @brief Deferred work item.
+ */
+struct defer_work {
+	void (*fn)(void *);				/*!< work function */
+	void *arg;					/*!< argument of the work function */
+	uint32_t time;					/*!< cycle count when the item was queued */
+};
+
+/**
+ * @brief Deferred work statistics.
+ */
+struct defer_stats {
+	uint32_t queued;				/*!< work items queued */
+	uint32_t run;					/*!< work items executed */
+	uint32_t dropped;				/*!< work items dropped (full ring) */
+	uint32_t direct;				/*!< switches to the worker at the end of an interrupt */
+	uint32_t max_latency;				/*!< longest time from queueing to execution (cycles) */
+};
+
+int32_t hf_defer_init(void);
+int32_t hf_defer(void (*fn)(void *), void *arg);
+void hf_defer_stats(struct defer_stats *s);
+void defer_dispatch(void);
@@ -4,6 +4,7 @@ error codes
 /* generic */
 #define	ERR_OK			0			/*!< no error */
 #define ERR_ERROR		-1			/*!< generic error */
+#define ERR_TIMEOUT		-2			/*!< timed wait expired */
 /* task errors */
 #define ERR_INVALID_ID		-100			/*!< invalid task id number */
 #define ERR_INVALID_PARAMETER	-101			/*!< invalid task parameters */
@@ -11,3 +12,4 @@ error codes
 #define ERR_EXCEED_MAX_NUM	-103			/*!< maximum defined number of system tasks exceeded */
 #define ERR_OUT_OF_MEMORY	-104			/*!< out of heap memory */
 #define ERR_INVALID_NAME	-105			/*!< invalid task name / unknown task */
+#define ERR_NOT_SCHEDULABLE	-106			/*!< RT task set would not be schedulable */
@@ -0,0 +1,22 @@
+/* event wait modes, combined with OR */
+#define EVENT_ANY		0x00		/*!< wait for any of the flags on the mask */
+#define EVENT_ALL		0x01		/*!< wait for all of the flags on the mask */
+#define EVENT_CLEAR		0x02		/*!< clear the flags which released the wait */
+
+/**
+ * @brief Event flag group data structure.
+ */
+struct evgroup {
+	struct queue *ev_queue;				/*!< queue for tasks waiting for events */
+	uint32_t flags;					/*!< event flags currently set */
+};
+
+typedef volatile struct evgroup event_t;
+
+int32_t hf_evinit(event_t *ev);
+int32_t hf_evdestroy(event_t *ev);
+void hf_evset(event_t *ev, uint32_t mask);
+void hf_evclear(event_t *ev, uint32_t mask);
+uint32_t hf_evget(event_t *ev);
+uint32_t hf_evwait(event_t *ev, uint32_t mask, uint8_t mode);
+uint32_t hf_evwait_timeout(event_t *ev, uint32_t mask, uint8_t mode, uint32_t timeout);
@@ -0,0 +1,31 @@
+/**
+ * @file governor.h
+ * @date October 2026
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Core clock governor (clock scaling driven by the measured load and real time slack).
+ */
+
+#ifndef GOVERNOR_WINDOW
+#define GOVERNOR_WINDOW			100		/*!< ticks between clock decisions */
+#endif
+#ifndef GOVERNOR_LOAD
+#define GOVERNOR_LOAD			75		/*!< busy time allowed at a lower clock, in % of the window */
+#endif
+#ifndef GOVERNOR_MARGIN
+#define GOVERNOR_MARGIN			80		/*!< share of its capacity a RT job may take at a lower clock, in % */
+#endif
+
+#define GOVERNOR_FULL			0xffffffff	/*!< job demand of a task whose job did not finish on its period */
+
+int32_t hf_governor(int32_t enable);
+int32_t hf_cpulevel(void);
+uint32_t hf_cpulevel_ticks(uint32_t level);
+void sched_gov_release(struct tcb_entry *task);
+void sched_governor(uint32_t now, uint32_t ticks);
@@ -0,0 +1,22 @@
+/**
+ * @brief Best effort task group (CPU reservation) data structure.
+ */
+struct be_group {
+	struct be_group *next;				/*!< next group with a reservation */
+	uint32_t budget;				/*!< processor cycles per period */
+	uint32_t period;				/*!< replenishment period, in cycles */
+	int32_t left;					/*!< cycles left on the current period */
+	uint32_t start;					/*!< cycle count at the start of the current period */
+	uint32_t throttled;				/*!< periods in which the budget was exhausted */
+	uint64_t used;					/*!< processor cycles consumed by the tasks of the group */
+	uint16_t tasks;					/*!< number of tasks in the group */
+};
+
+int32_t hf_group_init(struct be_group *g, uint32_t budget_us, uint32_t period_us);
+int32_t hf_group_destroy(struct be_group *g);
+int32_t hf_group_join(uint16_t id, struct be_group *g);
+int32_t hf_group_leave(uint16_t id);
+int32_t hf_group_stats(struct be_group *g, uint64_t *used, uint32_t *throttled, int32_t *left);
+void sched_group_charge(struct tcb_entry *task, uint32_t cycles);
+void sched_group_replenish(uint32_t now);
+int32_t sched_group_eligible(struct tcb_entry *task);
@@ -25,14 +25,30 @@ include default stuff
 #include <kprintf.h>
 #include <malloc.h>
 #include <queue.h>
+#include <pqueue.h>
+#include <ring.h>
 #include <list.h>
+#include <ilist.h>
+#include <pool.h>
+#include <arena.h>
+#include <lockstat.h>
 #include <semaphore.h>
 #include <mutex.h>
 #include <condvar.h>
+#include <mailbox.h>
+#include <rwlock.h>
+#include <event.h>
+#include <workpool.h>
+#include <timer.h>
+#include <defer.h>
 #include <kernel.h>
+#include <group.h>
+#include <governor.h>
 #include <panic.h>
 #include <scheduler.h>
 #include <task.h>
+#include <module.h>
 #include <processor.h>
+#include <trace.h>
 #include <main.h>
 #include <ecodes.h>
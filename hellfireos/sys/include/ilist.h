@@ -0,0 +1,31 @@
+/**
+ * @brief Intrusive list link, embedded in the objects that are kept on a list.
+ *
+ * A list is a struct ilist used as the head (sentinel) of a circular doubly linked list,
+ * and is empty when the head points to itself.
+ */
+struct ilist {
+	struct ilist *next;				/*!< next link (or the list head) */
+	struct ilist *prev;				/*!< previous link (or the list head) */
+};
+
+/**
+ * @brief Returns the object that embeds a link.
+ */
+#define hf_ilist_entry(ptr, type, member)	((type *)((int8_t *)(ptr) - (size_t)&((type *)0)->member))
+
+/**
+ * @brief Iterates over the links of a list. The current link must not be removed.
+ */
+#define hf_ilist_foreach(pos, head)		for ((pos) = (head)->next; (pos) != (head); (pos) = (pos)->next)
+
+/**
+ * @brief Iterates over the links of a list, allowing the current link to be removed.
+ */
+#define hf_ilist_foreach_safe(pos, n, head)	for ((pos) = (head)->next, (n) = (pos)->next; (pos) != (head); (pos) = (n), (n) = (pos)->next)
+
+void hf_ilist_init(struct ilist *head);
+void hf_ilist_addhead(struct ilist *head, struct ilist *node);
+void hf_ilist_addtail(struct ilist *head, struct ilist *node);
+void hf_ilist_remove(struct ilist *node);
+int32_t hf_ilist_empty(struct ilist *head);
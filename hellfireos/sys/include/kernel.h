@@ -23,30 +23,72 @@
 #define TASK_DELAYED			4		/*!< task being delayed (on delay queue) */
 #define TASK_WAITING			5		/*!< task waiting for an event (on event queue) */
 
+#define STACK_PAINT_WORD		0xa5a5a5a5	/*!< unused stack word pattern (STACK_PAINT) */
+
+/**
+ * @brief Scheduler statistics (SCHED_STATS), in cycles.
+ */
+struct sched_stat {
+	uint32_t min;					/*!< minimum sample */
+	uint32_t max;					/*!< maximum sample */
+	uint64_t sum;					/*!< sum of samples (for the average) */
+	uint32_t count;					/*!< number of samples */
+	uint32_t hist[32];				/*!< log2 histogram, hist[n] counts samples in [2^n, 2^(n+1)) */
+};
+
 /**
  * @brief Task control block (TCB) and processor control block (PCB) entry data structures.
  */
 struct tcb_entry {
-	uint16_t id;					/*!< task id */
-	int8_t name[20];				/*!< task description (or name) */
+	/* hot: read by the schedulers on every tick, for every task on a queue (kept together, first line(s) of the entry) */
 	uint8_t state;					/*!< 0 - idle,  1 - ready,  2 - running, 3 - blocked, 4 - delayed, 5 - waiting */
 	uint8_t priority;				/*!< [1 .. 29] - critical, [30 .. 99] - system, [100 .. 255] - application */
 	uint8_t priority_rem;				/*!< remaining priority */
 	uint8_t critical;				/*!< critical event, interrupt request */
-	uint32_t delay;					/*!< delay to enter in the run/RT queue */
-	uint32_t rtjobs;				/*!< total RT task jobs executed */
-	uint32_t bgjobs;				/*!< total BE task jobs executed */
-	uint32_t deadline_misses;			/*!< task realtime deadline misses */
+	uint16_t id;					/*!< task id */
 	uint16_t period;				/*!< task period */
 	uint16_t capacity;				/*!< task capacity */
 	uint16_t deadline;				/*!< task deadline */
 	uint16_t capacity_rem;				/*!< remaining capacity on period */
 	uint16_t deadline_rem;				/*!< remaining time slices on period */
-	context task_context;				/*!< task context */
-	void (*ptask)(void);				/*!< task entry point, pointer to function */
+	uint32_t delay;					/*!< delay to enter in the run/RT queue, relative to the previous task on the delay queue */
+	struct tcb_entry *rq_next;			/*!< next task on the same priority ready list (bitmap scheduler) */
+	struct tcb_entry *rq_prev;			/*!< previous task on the same priority ready list (bitmap scheduler) */
+	struct tcb_entry *dq_next;			/*!< next task on the delay queue */
+	struct tcb_entry *dq_prev;			/*!< previous task on the delay queue */
+	/* warm: updated once per job / context switch of the selected task */
+	uint32_t rtjobs;				/*!< total RT task jobs executed */
+	uint32_t bgjobs;				/*!< total BE task jobs executed */
+	uint32_t deadline_misses;			/*!< task realtime deadline misses */
+	struct be_group *group;				/*!< CPU reservation group (best effort tasks), NULL if none */
 	size_t *pstack;					/*!< task stack area (bottom) */
+	uint64_t cycles;				/*!< processor cycles consumed by the task */
+	uint64_t job_start;				/*!< cycles consumed by the task when the current job was released (governor) */
+	uint32_t job_peak;				/*!< largest job on the current governor window, in cycles */
+	uint32_t job_last;				/*!< largest job on the previous governor window */
+	uint8_t job_done;				/*!< current job finished (hf_waitperiod()) */
+	uint8_t job_seen;				/*!< jobs released on the current governor window */
+	/* cold: spawn / kill, blocking primitives and reports */
+	void (*ptask)(void);				/*!< task entry point, pointer to function */
 	uint32_t stack_size;				/*!< task stack size */
+	uint8_t stack_static;				/*!< stack given by the caller (hf_spawn_static()), not freed */
+	struct arena *arena;				/*!< private heap arena (hf_arena()), NULL if none */
 	void *other_data;				/*!< pointer to other data related to this task */
+	struct mtx *mtx_wait;				/*!< mutex the task is waiting for (MUTEX_TYPE 2) */
+	struct mtx *cond_mtx;				/*!< mutex of the condition the task is waiting on (MUTEX_TYPE 2) */
+	struct queue *wait_queue;			/*!< queue of the primitive the task is blocked on, NULL if none */
+	volatile int32_t *wait_count;			/*!< counter given back if the wait is abandoned (timeout or hf_kill()), NULL if none */
+	uint32_t ev_mask;				/*!< event flags the task is waiting for (event groups) */
+	uint32_t ev_flags;				/*!< event flags which released the task */
+	uint8_t ev_mode;				/*!< event wait mode (EVENT_ALL, EVENT_CLEAR) */
+	uint8_t timedout;				/*!< last timed wait expired */
+	int8_t name[20];				/*!< task description (or name) */
+	context task_context;				/*!< task context */
+#if SCHED_STATS == 1
+	uint8_t woken;					/*!< task made ready, latency not yet accounted */
+	uint32_t wakeup_time;				/*!< cycle count when the task was made ready */
+	struct sched_stat latency;			/*!< wakeup latency (ready to running) */
+#endif
 };
 
 struct pcb_entry {
@@ -54,34 +96,18 @@ struct pcb_entry {
 	int32_t (*sched_be)();				/*!< pointer to the best effort scheduler */
 	uint32_t coop_cswitch;				/*!< cooperative context switches */
 	uint32_t preempt_cswitch;			/*!< preeptive context switches */
+	uint32_t same_cswitch;				/*!< of those, the running task selected again (no context saved) */
 	uint32_t interrupts;				/*!< number of non-masked interrupts */
 	uint32_t tick_time;				/*!< tick time in microsseconds */
+	uint32_t cycles_last;				/*!< cycle count when the running task was dispatched */
+	uint64_t sched_cycles;				/*!< processor cycles spent on the dispatcher */
+#if SCHED_STATS == 1
+	struct sched_stat dispatch;			/*!< dispatcher (dispatch_isr() and hf_yield()) cycles */
+	struct sched_stat latency;			/*!< wakeup latency of all tasks */
+#endif
 	/* much more stuff should be here! */
 };
 
-struct aperiodic_entry {
-	uint16_t id;					/*!< task id */
-	int8_t name[20];				/*!< task description (or name) */
-	uint8_t state;					/*!< 0 - idle,  1 - ready,  2 - running, 3 - blocked, 4 - delayed, 5 - waiting */
-	uint8_t priority;				/*!< [1 .. 29] - critical, [30 .. 99] - system, [100 .. 255] - application */
-	uint8_t priority_rem;				/*!< remaining priority */
-	uint8_t critical;				/*!< critical event, interrupt request */
-	uint32_t delay;					/*!< delay to enter in the run/RT queue */
-	uint32_t rtjobs;				/*!< total RT task jobs executed */
-	uint32_t bgjobs;				/*!< total BE task jobs executed */
-	uint32_t deadline_misses;			/*!< task realtime deadline misses */
-	uint16_t period;				/*!< task period */
-	uint16_t capacity;				/*!< task capacity */
-	uint16_t deadline;				/*!< task deadline */
-	uint16_t capacity_rem;				/*!< remaining capacity on period */
-	uint16_t deadline_rem;				/*!< remaining time slices on period */
-	context task_context;				/*!< task context */
-	void (*ptask)(void);				/*!< task entry point, pointer to function */
-	size_t *pstack;					/*!< task stack area (bottom) */
-	uint32_t stack_size;				/*!< task stack size */
-	void *other_data;				/*!< pointer to other data related to this task */
-};
-
 /**
  * @brief The task control block and processor control block
  */
@@ -92,10 +118,12 @@ struct tcb_entry *krnl_task;				/*!< pointer to a task control block entry */
 uint16_t krnl_tasks;					/*!< number of tasks in the system */
 uint16_t krnl_current_task;				/*!< the current running task id */
 uint16_t krnl_schedule;					/*!< scheduler enable / disable flag */
+uint16_t krnl_resched;					/*!< reschedule requested by an interrupt handler (hf_sempost_isr()) */
 struct queue *krnl_run_queue;				/*!< pointer to a queue of best effort tasks */
-struct queue *krnl_delay_queue;				/*!< pointer to a queue of delayed tasks */
+struct tcb_entry *krnl_delay_list;			/*!< head of the delay queue (delta list of delayed tasks) */
 struct queue *krnl_rt_queue;				/*!< pointer to a queue of real time tasks */
 struct queue *krnl_event_queue;				/*!< pointer to a queue of tasks waiting for an event */
 struct queue *krnl_aperiodic_queue;			/*!< pointer to a queue of aperiodic tasks */
+struct tcb_entry *krnl_server;				/*!< aperiodic (deferrable) server, serves the aperiodic queue */
 uint8_t krnl_heap[HEAP_SIZE];				/*!< contiguous heap memory area to be used as a memory pool. the memory allocator (malloc() and free()) controls this data structure */
 uint32_t krnl_free;					/*!< amount of free heap memory, in bytes */
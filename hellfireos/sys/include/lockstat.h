@@ -0,0 +1,26 @@
+#if LOCK_STATS == 1
+/**
+ * @brief Lock contention statistics, kept on each mutex and semaphore (LOCK_STATS = 1).
+ */
+struct lock_stat {
+	int8_t *name;					/*!< lock name, NULL if not registered */
+	struct lock_stat *next;				/*!< next registered lock */
+	uint32_t acquired;				/*!< number of acquisitions */
+	uint32_t contended;				/*!< acquisitions which had to spin or block */
+	uint64_t wait_total;				/*!< total wait on contended acquisitions (cycles) */
+	uint32_t wait_max;				/*!< longest wait on a single acquisition (cycles) */
+	uint32_t queue_max;				/*!< longest queue of waiting tasks (semaphores) */
+	int16_t holder;					/*!< id of the last task to take the lock, -1 if released (mutexes) */
+};
+
+#define hf_mtxstat(m, name)	hf_lockstat_register((struct lock_stat *)&(m)->stat, name)
+#define hf_semstat(s, name)	hf_lockstat_register((struct lock_stat *)&(s)->stat, name)
+
+void lockstat_init(struct lock_stat *st);
+void lockstat_acquire(struct lock_stat *st, uint32_t wait, int32_t contended);
+void lockstat_remove(struct lock_stat *st);
+void hf_lockstat_register(struct lock_stat *st, int8_t *name);
+struct lock_stat *hf_lockstat_list(void);
+void hf_lockstat_reset(void);
+void hf_lockstat_dump(void);
+#endif
@@ -0,0 +1,28 @@
+/**
+ * @brief Mailbox message slot.
+ */
+struct mbox_msg {
+	void *msg;					/*!< message buffer, owned by the mailbox while queued */
+	uint16_t size;					/*!< message size, in bytes */
+	uint16_t source;				/*!< id of the sender task */
+};
+
+/**
+ * @brief Mailbox data structure.
+ */
+struct mbox {
+	struct queue *mbox_queue;			/*!< queue for tasks waiting for messages */
+	struct mbox_msg *msgs;				/*!< ring of message slots */
+	int32_t size;					/*!< maximum number of queued messages */
+	int32_t elem;					/*!< number of queued messages */
+	int32_t head;					/*!< oldest message */
+};
+
+typedef volatile struct mbox mbox_t;
+
+int32_t hf_mboxinit(mbox_t *mb, int32_t size);
+int32_t hf_mboxdestroy(mbox_t *mb);
+int32_t hf_mboxsend(mbox_t *mb, void *msg, uint16_t size);
+int32_t hf_mboxrecv(mbox_t *mb, uint16_t *source, void **msg, uint16_t *size);
+int32_t hf_mboxtryrecv(mbox_t *mb, uint16_t *source, void **msg, uint16_t *size);
+int32_t hf_mboxcount(mbox_t *mb);
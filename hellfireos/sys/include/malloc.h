@@ -67,8 +67,65 @@ struct mem_block *first_free;
 struct mem_block *last_free;
 #endif
 
+#if MEM_ALLOC == 4
+#define align4(x) ((((x) + 3) >> 2) << 2)
+
+#define TLSF_SL_BITS	4			/* second level: 16 size classes per power of 2 */
+#define TLSF_SL_COUNT	(1 << TLSF_SL_BITS)
+#define TLSF_FL_SHIFT	(TLSF_SL_BITS + 2)	/* sizes below 2^TLSF_FL_SHIFT use the first level 0 */
+#define TLSF_FL_COUNT	(32 - TLSF_FL_SHIFT + 1)
+#define TLSF_FREE	1			/* block is free */
+#define TLSF_PREV_FREE	2			/* previous physical block is free */
+
+struct tlsf_block {
+	struct tlsf_block *prev_phys;	/* previous block in memory */
+	size_t size;			/* aligned block size (without the header) and the flags above */
+	struct tlsf_block *next_free;	/* free list links, only valid in free blocks */
+	struct tlsf_block *prev_free;
+};
+
+struct tlsf_control {
+	uint32_t fl_bitmap;					/* first level lists with free blocks */
+	uint32_t sl_bitmap[TLSF_FL_COUNT];			/* second level lists with free blocks */
+	struct tlsf_block *blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];	/* free lists heads */
+};
+
+struct tlsf_control tlsf;
+#endif
+
+#define HEAP_IDLE_BLOCKS	32			/* blocks visited by each hf_heapidle() call */
+
+#define HEAP_CLASS_SHIFT	4			/* allocation size classes: up to 16 bytes, 32, 64 .. */
+#define HEAP_CLASSES		12			/* .. and above 16KB */
+
+/**
+ * @brief Heap statistics, see hf_heapstats(). Sizes are in bytes, not counting block headers.
+ */
+struct heap_stats {
+	uint32_t free;					/*!< free memory */
+	uint32_t largest;				/*!< largest free block, the biggest request that may succeed */
+	uint32_t free_blocks;				/*!< number of free blocks */
+	uint32_t used;					/*!< memory allocated */
+	uint32_t peak;					/*!< high water mark of allocated memory */
+	uint32_t allocs;				/*!< number of allocated blocks */
+	uint32_t failed;				/*!< number of failed allocations */
+	uint32_t classes[HEAP_CLASSES];			/*!< allocated blocks per size class (powers of 2) */
+};
+
+#ifndef HEAP_REGIONS
+#define HEAP_REGIONS		2			/* heap regions, counting the kernel heap */
+#endif
+
+#define HEAP_INTERNAL		0			/*!< kernel heap (krnl_heap), usually on chip SRAM */
+#define HEAP_EXTERNAL		1			/*!< external memory, registered with hf_heapregion() */
+
 void hf_free(void *ptr);
 void *hf_malloc(uint32_t size);
 void heapinit(void *heap, uint32_t len);
 void *hf_calloc(uint32_t qty, uint32_t type_size);
 void *hf_realloc(void *ptr, uint32_t size);
+void hf_heapstats(struct heap_stats *s);
+void hf_heapidle(void);
+int32_t hf_heapregion(uint16_t region, void *base, uint32_t len);
+void *hf_malloc_region(uint32_t size, uint16_t region);
+int32_t hf_heapstats_region(uint16_t region, struct heap_stats *s);
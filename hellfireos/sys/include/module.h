@@ -0,0 +1,75 @@
+#define MODULE_MAGIC		0x48464d31	/*!< 'HFM1' */
+#define MODULE_NAMELEN		16		/*!< module name, on the header */
+#define MODULE_SYMLEN		24		/*!< imported symbol name, on the import table */
+#define MODULE_LOCAL		0xffff		/*!< relocation against the module itself (not an import) */
+#define MODULE_TABLES		4		/*!< export tables registered with hf_module_export() */
+
+/* relocation types, applied to the word at the relocation offset (S is the target address) */
+#define RELOC_32		1		/*!< S */
+#define RELOC_MIPS_26		2		/*!< jal / j, (S >> 2) on the low 26 bits */
+#define RELOC_MIPS_HI16		3		/*!< lui, high half of S (adjusted for the sign of the low half) */
+#define RELOC_MIPS_LO16		4		/*!< addiu / load / store, low half of S */
+#define RELOC_RISCV_HI20	5		/*!< lui, high 20 bits of S (adjusted for the sign of the low 12 bits) */
+#define RELOC_RISCV_LO12_I	6		/*!< addi / load, low 12 bits of S */
+#define RELOC_RISCV_LO12_S	7		/*!< store, low 12 bits of S */
+#define RELOC_RISCV_CALL	8		/*!< auipc + jalr pair, S relative to the auipc */
+#define RELOC_RISCV_JAL		9		/*!< jal, S relative to the jal */
+
+/**
+ * @brief Module file header. All fields are in the byte order of the target.
+ *
+ * A module file is the header, the import table (imports names of MODULE_SYMLEN bytes), the
+ * image (code, read only data and data, linked at address 0) and the relocations.
+ */
+struct module_header {
+	uint32_t magic;					/*!< MODULE_MAGIC */
+	uint32_t machine;				/*!< ELF machine of the code (8 - MIPS, 243 - RISC-V) */
+	uint32_t image_size;				/*!< image size, in bytes */
+	uint32_t bss_size;				/*!< zeroed memory after the image, in bytes */
+	uint32_t entry;					/*!< entry point (task body), offset on the image */
+	uint32_t stack_size;				/*!< stack size of the module task */
+	uint32_t imports;				/*!< number of imported symbols */
+	uint32_t relocs;				/*!< number of relocations */
+	uint32_t crc;					/*!< CRC-32 of the file after the header */
+	int8_t name[MODULE_NAMELEN];			/*!< module name (also the name of its task) */
+};
+
+/**
+ * @brief Module relocation.
+ */
+struct module_reloc {
+	uint32_t offset;				/*!< offset of the relocated word on the image */
+	uint32_t value;					/*!< offset on the image (MODULE_LOCAL) or addend of the import */
+	uint16_t type;					/*!< relocation type (RELOC_*) */
+	uint16_t sym;					/*!< import index, or MODULE_LOCAL */
+};
+
+/**
+ * @brief Symbol exported by the kernel to modules.
+ */
+struct module_symbol {
+	const int8_t *name;				/*!< symbol name */
+	void *addr;					/*!< symbol address */
+};
+
+/**
+ * @brief Loaded module.
+ */
+struct module {
+	int8_t name[MODULE_NAMELEN];			/*!< module name */
+	void *base;					/*!< code and data of the module */
+	uint32_t size;					/*!< memory size (image and bss) */
+	void (*entry)(void);				/*!< entry point */
+	uint32_t stack_size;				/*!< stack size of the module task */
+	int32_t task;					/*!< task id of the module, -1 if not spawned */
+};
+
+#define MODULE_HDRSIZE		sizeof(struct module_header)
+#define MODULE_FILESIZE(h)	(MODULE_HDRSIZE + (h)->imports * MODULE_SYMLEN + (h)->image_size + (h)->relocs * sizeof(struct module_reloc))
+
+int32_t hf_module_export(const struct module_symbol *table);
+void *hf_module_sym(int8_t *name);
+int32_t hf_module_read(struct module *m, int32_t (*read)(void *arg, void *buf, uint32_t size), void *arg);
+int32_t hf_module_load(struct module *m, void *buf, uint32_t size);
+int32_t hf_module_spawn(struct module *m, uint16_t period, uint16_t capacity, uint16_t deadline);
+int32_t hf_module_unload(struct module *m);
@@ -4,6 +4,9 @@
  */
 struct mtx {
 	int32_t lock;					/*!< mutex lock, atomically modified */
+#if LOCK_STATS == 1
+	struct lock_stat stat;				/*!< contention statistics */
+#endif
 };
 
 typedef volatile struct mtx mutex_t;
@@ -13,11 +16,37 @@ typedef volatile struct mtx mutex_t;
 struct mtx {
 	uint8_t level[MAX_TASKS];
 	uint8_t waiting[MAX_TASKS - 1];
+#if LOCK_STATS == 1
+	struct lock_stat stat;
+#endif
 };
 
 typedef volatile struct mtx mutex_t;
 #endif
 
+#if MUTEX_TYPE == 2
+/**
+ * @brief Blocking mutex data structure, with priority inheritance.
+ */
+struct mtx {
+	int32_t lock;					/*!< mutex lock */
+	uint16_t owner;					/*!< id of the task holding the lock */
+	uint8_t priority;				/*!< owner priority before the lock was taken */
+	uint32_t waiting[(MAX_TASKS + 31) / 32];	/*!< tasks waiting for the lock, one bit per task id */
+#if LOCK_STATS == 1
+	struct lock_stat stat;				/*!< contention statistics */
+#endif
+};
+
+typedef volatile struct mtx mutex_t;
+#endif
+
+#if MUTEX_TYPE == 2
+struct tcb_entry;
+int32_t mtx_requeue(mutex_t *m, struct tcb_entry *task);
+#endif
+
 void hf_mtxinit(mutex_t *m);
 void hf_mtxlock(mutex_t *m);
+int32_t hf_mtxtrylock(mutex_t *m);
 void hf_mtxunlock(mutex_t *m);
@@ -0,0 +1,17 @@
+/**
+ * @brief Fixed size object pool data structure.
+ */
+struct pool {
+	uint32_t size;					/*!< object size (aligned) */
+	uint32_t count;					/*!< number of objects */
+	uint32_t free;					/*!< number of free objects */
+	void *free_list;				/*!< first free object, linked through its first word */
+	uint8_t *area;					/*!< object storage */
+};
+
+struct pool *hf_pool_create(uint32_t size, uint32_t count);
+int32_t hf_pool_destroy(struct pool *p);
+void *hf_pool_alloc(struct pool *p);
+void hf_pool_free(struct pool *p, void *ptr);
+int32_t hf_pool_owns(struct pool *p, void *ptr);
+int32_t hf_pool_count(struct pool *p);
@@ -0,0 +1,25 @@
+/**
+ * @brief Priority queue node, embedded in the queued objects.
+ */
+struct pq_node {
+	uint32_t key;					/*!< priority, lower keys are extracted first */
+	int32_t index;					/*!< position on the heap, -1 if not queued */
+};
+
+/**
+ * @brief Priority queue (binary min heap) data structure.
+ */
+struct pqueue {
+	int32_t size;					/*!< maximum number of nodes */
+	int32_t elem;					/*!< number of nodes queued */
+	struct pq_node **data;				/*!< heap array of pointers to nodes */
+};
+
+struct pqueue *hf_pq_create(int32_t size);
+int32_t hf_pq_destroy(struct pqueue *pq);
+int32_t hf_pq_count(struct pqueue *pq);
+int32_t hf_pq_insert(struct pqueue *pq, struct pq_node *node, uint32_t key);
+struct pq_node *hf_pq_peek(struct pqueue *pq);
+struct pq_node *hf_pq_extract(struct pqueue *pq);
+int32_t hf_pq_remove(struct pqueue *pq, struct pq_node *node);
+int32_t hf_pq_update(struct pqueue *pq, struct pq_node *node, uint32_t key);
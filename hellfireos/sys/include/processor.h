@@ -3,3 +3,12 @@ int32_t hf_freecpu(void);
 int32_t hf_cpuload(uint16_t id);
 uint32_t hf_freemem(void);
 uint32_t hf_ticktime(void);
+int32_t hf_cputime(uint16_t id, uint64_t *cycles);
+uint64_t hf_schedtime(void);
+#if SCHED_STATS == 1
+int32_t hf_schedstats(uint16_t id, struct sched_stat *dispatch, struct sched_stat *latency);
+#endif
+#if STACK_PAINT == 1
+int32_t hf_stackusage(uint16_t id);
+#endif
+uint64_t hf_cycles(void);
@@ -3,6 +3,7 @@
  */
 struct queue {
 	int32_t size;					/*!< queue size (maximum number of elements) */
+	int32_t mask;					/*!< number of slots - 1 (slots are a power of 2) */
 	int32_t elem;					/*!< number of elements queued */
 	int32_t head;					/*!< first element of the queue */
 	int32_t tail;					/*!< last element of the queue */
@@ -10,6 +11,7 @@ struct queue {
 };
 
 struct queue *hf_queue_create(int32_t size);
+void hf_queue_init(struct queue *q, void **data, int32_t size);
 int32_t hf_queue_destroy(struct queue *q);
 int32_t hf_queue_count(struct queue *q);
 int32_t hf_queue_addtail(struct queue *q, void *ptr);
@@ -18,3 +20,7 @@ void *hf_queue_remtail(struct queue *q);
 void *hf_queue_get(struct queue *q, int32_t elem);
 int32_t hf_queue_set(struct queue *q, int32_t elem, void *ptr);
 int32_t hf_queue_swap(struct queue *q, int32_t elem1, int32_t elem2);
+int32_t hf_queue_remn(struct queue *q, void **buf, int32_t n);
+int32_t hf_queue_addn(struct queue *q, void **buf, int32_t n);
+int32_t hf_queue_splice(struct queue *dst, struct queue *src, int32_t n);
+int32_t hf_queue_moveall(struct queue *dst, struct queue *src);
@@ -0,0 +1,20 @@
+/**
+ * @brief Single producer, single consumer ring data structure.
+ */
+struct ring {
+	uint32_t size;					/*!< ring size (maximum number of elements) */
+	uint32_t mask;					/*!< number of slots - 1 (slots are a power of 2) */
+	volatile uint32_t head;				/*!< elements put, only written by the producer */
+	volatile uint32_t tail;				/*!< elements taken, only written by the consumer */
+	void **data;					/*!< pointer to an array of pointers to element data */
+};
+
+struct ring *hf_ring_create(uint32_t size);
+int32_t hf_ring_destroy(struct ring *r);
+int32_t hf_ring_count(struct ring *r);
+int32_t hf_ring_put(struct ring *r, void *ptr);
+void *hf_ring_get(struct ring *r);
+int32_t hf_ring_getn(struct ring *r, void **buf, int32_t n);
+void *hf_ring_peek(struct ring *r);
+void *hf_ring_at(struct ring *r, int32_t i);
+void *hf_ring_remove(struct ring *r, int32_t i);
@@ -0,0 +1,19 @@
+/**
+ * @brief Reader-writer lock data structure.
+ */
+struct rwlock {
+	struct queue *rd_queue;				/*!< queue for readers waiting on the lock */
+	struct queue *wr_queue;				/*!< queue for writers waiting on the lock */
+	int32_t readers;				/*!< number of readers holding the lock */
+	int32_t writer;					/*!< a writer holds the lock */
+};
+
+typedef volatile struct rwlock rwlock_t;
+
+int32_t hf_rwinit(rwlock_t *rw);
+int32_t hf_rwdestroy(rwlock_t *rw);
+void hf_rwrdlock(rwlock_t *rw);
+int32_t hf_rwtryrdlock(rwlock_t *rw);
+void hf_rwwrlock(rwlock_t *rw);
+int32_t hf_rwtrywrlock(rwlock_t *rw);
+void hf_rwunlock(rwlock_t *rw);
@@ -1,4 +1,78 @@
+void sched_be_insert(struct tcb_entry *task);
+void sched_be_remove(struct tcb_entry *task);
+void sched_block(struct tcb_entry *task);
+int32_t sched_wakeup(struct tcb_entry *task);
+void sched_rt_insert(struct tcb_entry *task);
+struct tcb_entry *sched_rt_remove(struct tcb_entry *task);
+void sched_rt_jobdone(struct tcb_entry *task);
+void sched_delay_insert(struct tcb_entry *task, uint32_t delay);
+uint32_t sched_delay_remove(struct tcb_entry *task);
+void sched_wait_remove(struct tcb_entry *task);
+#if SCHED_STATS == 1
+void sched_stat_add(struct sched_stat *stat, uint32_t val);
+void sched_stat_wakeup(struct tcb_entry *task);
+void sched_stat_dispatch(uint32_t start, uint32_t now);
+#endif
 void dispatch_isr(void *arg);
+void dispatch_resched(void);
+int32_t sched_be_pick(void);
+int32_t sched_rr(void);
 int32_t sched_lottery(void);
 int32_t sched_priorityrr(void);
+int32_t sched_bitmap(void);
 int32_t sched_rma(void);
+int32_t sched_edf(void);
+
+/*
+ * scheduler policies. with SCHED_RT / SCHED_BE set (kernel.mak), the dispatcher calls the
+ * selected scheduler directly (so it may be inlined) and the krnl_pcb pointers are only
+ * informative. with 0 (the default), the schedulers are called through the krnl_pcb pointers,
+ * which may be changed at runtime.
+ */
+#ifndef SCHED_RT
+#define SCHED_RT		0
+#endif
+#ifndef SCHED_BE
+#define SCHED_BE		0
+#endif
+
+#if SCHED_RT == 1
+#define SCHED_RT_DEFAULT	sched_rma
+#define sched_rt_call()		sched_rma()
+#define sched_rt_edf()		0
+#elif SCHED_RT == 2
+#define SCHED_RT_DEFAULT	sched_edf
+#define sched_rt_call()		sched_edf()
+#define sched_rt_edf()		1
+#else
+#define SCHED_RT_DEFAULT	sched_rma
+#define sched_rt_call()		krnl_pcb.sched_rt()
+#define sched_rt_edf()		(krnl_pcb.sched_rt == sched_edf)
+#endif
+
+#if SCHED_BE == 1
+#define SCHED_BE_DEFAULT	sched_rr
+#define sched_be_call()		sched_rr()
+#define sched_be_bitmap()	0
+#define sched_be_critical()	0
+#elif SCHED_BE == 2
+#define SCHED_BE_DEFAULT	sched_priorityrr
+#define sched_be_call()		sched_priorityrr()
+#define sched_be_bitmap()	0
+#define sched_be_critical()	1
+#elif SCHED_BE == 3
+#define SCHED_BE_DEFAULT	sched_lottery
+#define sched_be_call()		sched_lottery()
+#define sched_be_bitmap()	0
+#define sched_be_critical()	0
+#elif SCHED_BE == 4
+#define SCHED_BE_DEFAULT	sched_bitmap
+#define sched_be_call()		sched_bitmap()
+#define sched_be_bitmap()	1
+#define sched_be_critical()	1
+#else
+#define SCHED_BE_DEFAULT	sched_priorityrr
+#define sched_be_call()		krnl_pcb.sched_be()
+#define sched_be_bitmap()	(krnl_pcb.sched_be == sched_bitmap)
+#define sched_be_critical()	(krnl_pcb.sched_be == sched_priorityrr || krnl_pcb.sched_be == sched_bitmap)
+#endif
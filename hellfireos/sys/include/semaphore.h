@@ -4,6 +4,9 @@
 struct sem {
 	struct queue *sem_queue;			/*!< queue for tasks waiting on the semaphore */
 	int32_t count;					/*!< semaphore counter */
+#if LOCK_STATS == 1
+	struct lock_stat stat;				/*!< contention statistics */
+#endif
 };
 
 typedef volatile struct sem sem_t;
@@ -11,4 +14,6 @@ typedef volatile struct sem sem_t;
 int32_t hf_seminit(sem_t *s, int32_t value);
 int32_t hf_semdestroy(sem_t *s);
 void hf_semwait(sem_t *s);
+int32_t hf_semwait_timeout(sem_t *s, uint32_t timeout);
 void hf_sempost(sem_t *s);
+void hf_sempost_isr(sem_t *s);
@@ -1,3 +1,16 @@
+/* static task stacks (hf_spawn_static()), placed on the .stacks section, which is not cleared at boot */
+#define HF_STACK(name, size)	size_t name[((size) + sizeof(size_t) - 1) / sizeof(size_t)] __attribute__((section(".stacks"), aligned(8)))
+
+/* functions called by hf_kill() to release resources held by a task (hf_killhook()) */
+#ifndef KILL_HOOKS
+#define KILL_HOOKS		8
+#endif
+
+/* STATIC_TASKS 1: kernel tasks and queues are created on static memory and the boot banner is not printed */
+#ifndef STATIC_TASKS
+#define STATIC_TASKS		0
+#endif
+
 int32_t hf_id(int8_t *name);
 int8_t *hf_name(uint16_t id);
 uint16_t hf_selfid(void);
@@ -7,9 +20,15 @@ int32_t hf_jobs(uint16_t id);
 int32_t hf_dlm(uint16_t id);
 int32_t hf_priorityset(uint16_t id, uint8_t priority);
 int32_t hf_priorityget(uint16_t id);
+int32_t hf_rtadmit(uint16_t period, uint16_t capacity);
 int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t deadline, int8_t *name, uint32_t stack_size);
+int32_t hf_spawn_static(void (*task)(), uint16_t period, uint16_t capacity, uint16_t deadline, int8_t *name, size_t *stack, uint32_t stack_size);
 void hf_yield(void);
+int32_t hf_waitperiod(void);
 int32_t hf_block(uint16_t id);
 int32_t hf_resume(uint16_t id);
 int32_t hf_kill(uint16_t id);
+int32_t hf_killhook(void (*fn)(uint16_t id));
 int32_t hf_delay(uint16_t id, uint32_t delay);
+int32_t hf_usleep(uint32_t usec);
+int32_t hf_msleep(uint32_t msec);
@@ -0,0 +1,17 @@
+/**
+ * @brief Software timer data structure.
+ */
+struct timer {
+	struct timer *next;				/*!< next timer to expire */
+	uint64_t expires;				/*!< expiry time (_read_us()) */
+	uint32_t period;				/*!< period (us), 0 for a one-shot timer */
+	uint32_t overruns;				/*!< periods skipped because the callback ran late */
+	void (*fn)(void *);				/*!< callback */
+	void *arg;					/*!< argument of the callback */
+	int8_t active;					/*!< timer started and not expired or stopped */
+};
+
+int32_t hf_timer_init(struct timer *t, void (*fn)(void *), void *arg);
+int32_t hf_timer_start(struct timer *t, uint32_t msec, uint32_t period_msec);
+int32_t hf_timer_stop(struct timer *t);
+int32_t hf_timer_active(struct timer *t);
@@ -0,0 +1,28 @@
+/* binary kernel trace events */
+#define TRACE_DISPATCH			0x01		/* dispatcher entry (preemption) */
+#define TRACE_YIELD			0x02		/* hf_yield() entry */
+#define TRACE_RUN			0x03		/* task selected to run */
+#define TRACE_IRQ			0x04		/* interrupt served, arg: interrupt line */
+#define TRACE_NOC_TX			0x05		/* NoC packet injected, arg: target cpu */
+#define TRACE_NOC_RX			0x06		/* NoC packet received, arg: target port */
+#define TRACE_NOC_DROP			0x07		/* NoC packet dropped, arg: target port */
+#define TRACE_RELEASE			0x08		/* RT job released (period boundary), arg: task id */
+#define TRACE_MISS			0x09		/* RT job missed its deadline, arg: task id */
+#define TRACE_JOBDONE			0x0a		/* RT job finished (hf_waitperiod()), arg: task id */
+#define TRACE_IRQ_DONE			0x0b		/* interrupt handler returned, arg: interrupt line */
+
+#define TRACE_MAGIC			"HFTR"
+#define TRACE_VERSION			1
+
+struct trace_entry {
+	uint32_t time;					/*!< cycle counter (low 32 bits) */
+	uint8_t event;					/*!< event id */
+	uint8_t task;					/*!< running task id */
+	uint16_t arg;					/*!< event argument */
+};
+
+void trace_event(uint8_t event, uint16_t arg);
+int32_t hf_traceread(struct trace_entry *buf, int32_t n);
+void hf_traceclaim(void);
+uint32_t hf_tracelost(void);
+void hf_traceflush(void);
@@ -0,0 +1,40 @@
+/**
+ * @brief Work pool job.
+ */
+struct wp_job {
+	void (*fn)(void *);				/*!< job function */
+	void *arg;					/*!< argument of the job function */
+};
+
+/**
+ * @brief Work pool worker, and its job deque.
+ */
+struct wp_worker {
+	struct wp_job *jobs;				/*!< ring of queued jobs (owner end at the tail) */
+	int32_t head;					/*!< oldest job, taken by thieves */
+	int32_t count;					/*!< number of queued jobs */
+	uint16_t task;					/*!< id of the worker task */
+	uint32_t done;					/*!< jobs executed by the worker */
+	uint32_t stolen;				/*!< of those, jobs taken from other workers */
+};
+
+/**
+ * @brief Work pool data structure.
+ */
+struct wpool {
+	struct wp_worker *workers;			/*!< workers */
+	int32_t nworkers;				/*!< number of workers */
+	int32_t depth;					/*!< capacity of each deque */
+	int32_t next;					/*!< next deque for jobs submitted from outside the pool */
+	int32_t pending;				/*!< jobs submitted and not finished */
+	int32_t waiters;				/*!< tasks waiting for the pool to become idle */
+	volatile int32_t stopping;			/*!< workers not stopped yet, on hf_wpool_destroy() */
+	sem_t jobs;					/*!< queued jobs, on all deques */
+	sem_t idle;					/*!< posted to waiters when no job is pending */
+};
+
+struct wpool *hf_wpool_create(int32_t workers, int32_t depth, uint32_t stack_size);
+int32_t hf_wpool_destroy(struct wpool *p);
+int32_t hf_wpool_submit(struct wpool *p, void (*fn)(void *), void *arg);
+int32_t hf_wpool_wait(struct wpool *p);
+int32_t hf_wpool_pending(struct wpool *p);
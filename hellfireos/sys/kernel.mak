@@ -1,5 +1,14 @@
 KERNEL_VER = v2.17.03
 
+# static scheduler selection, may be set on the platform makefile.
+# SCHED_RT: 0 - chosen at runtime (krnl_pcb.sched_rt, RM by default), 1 - RM, 2 - EDF
+# SCHED_BE: 0 - chosen at runtime (krnl_pcb.sched_be, priority RR by default), 1 - RR, 2 - priority RR, 3 - lottery, 4 - bitmap
+SCHED_RT ?= 0
+SCHED_BE ?= 0
+# STATIC_TASKS: 1 - kernel tasks (idle, aperiodic server, ustack) and queues on static memory, no boot banner
+STATIC_TASKS ?= 0
+CFLAGS += -DSCHED_RT=$(SCHED_RT) -DSCHED_BE=$(SCHED_BE) -DSTATIC_TASKS=$(STATIC_TASKS)
+
 kernel:
 	$(CC) $(CFLAGS) \
 		$(SRC_DIR)/sys/lib/kprintf.c \
@@ -8,9 +17,25 @@ kernel:
 		$(SRC_DIR)/sys/sync/mutex.c \
 		$(SRC_DIR)/sys/sync/semaphore.c \
 		$(SRC_DIR)/sys/sync/condvar.c \
+		$(SRC_DIR)/sys/sync/mailbox.c \
+		$(SRC_DIR)/sys/sync/rwlock.c \
+		$(SRC_DIR)/sys/sync/event.c \
+		$(SRC_DIR)/sys/sync/workpool.c \
+		$(SRC_DIR)/sys/sync/lockstat.c \
 		$(SRC_DIR)/sys/lib/queue.c \
+		$(SRC_DIR)/sys/lib/pqueue.c \
+		$(SRC_DIR)/sys/lib/ring.c \
 		$(SRC_DIR)/sys/lib/list.c \
+		$(SRC_DIR)/sys/lib/ilist.c \
+		$(SRC_DIR)/sys/lib/pool.c \
+		$(SRC_DIR)/sys/lib/arena.c \
 		$(SRC_DIR)/sys/kernel/task.c \
 		$(SRC_DIR)/sys/kernel/scheduler.c \
 		$(SRC_DIR)/sys/kernel/processor.c \
+		$(SRC_DIR)/sys/kernel/trace.c \
+		$(SRC_DIR)/sys/kernel/timer.c \
+		$(SRC_DIR)/sys/kernel/defer.c \
+		$(SRC_DIR)/sys/kernel/group.c \
+		$(SRC_DIR)/sys/kernel/governor.c \
+		$(SRC_DIR)/sys/kernel/module.c \
 		$(SRC_DIR)/sys/kernel/main.c
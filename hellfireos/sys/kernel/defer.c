@@ -0,0 +1,199 @@
+/**
+ * @file defer.c
+ * @date October 2026
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Deferred work (bottom halves). Interrupt handlers queue a small work item (a function and
+ * its argument) with hf_defer() and return, and a kernel worker task runs the item with
+ * interrupts enabled, so the time spent with interrupts disabled stays short. The worker is
+ * a best effort task of a high priority (DEFER_PRIORITY), marked as critical when an item
+ * is queued, so the best effort scheduler selects it next.
+ *
+ * When the interrupted task is a best effort task, the interrupt handler of the architecture
+ * switches to the worker at once (defer_dispatch(), without IRQ_NESTING), so the work runs
+ * right after the interrupt instead of on the next scheduler tick. Real time tasks are not
+ * preempted: the work runs when the processor is given to best effort tasks.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <queue.h>
+#include <lockstat.h>
+#include <semaphore.h>
+#include <defer.h>
+#include <kernel.h>
+#include <panic.h>
+#include <scheduler.h>
+#include <task.h>
+#include <group.h>
+#include <ecodes.h>
+
+#ifndef DEFER_SLOTS
+#define DEFER_SLOTS	16
+#endif
+#ifndef DEFER_PRIORITY
+#define DEFER_PRIORITY	10
+#endif
+#ifndef DEFER_STACK
+#define DEFER_STACK	1024
+#endif
+
+static struct defer_work defer_ring[DEFER_SLOTS];
+static int32_t defer_head, defer_count;
+static volatile int32_t defer_pending;
+static int32_t defer_task = -1;
+static struct defer_stats defer_stat;
+static sem_t defer_sem;
+
+static void defer_worker(void)
+{
+	volatile uint32_t status;
+	struct defer_work w;
+	uint32_t t;
+
+	for (;;){
+		hf_semwait(&defer_sem);
+		status = _di();
+		if (defer_count == 0){
+			_ei(status);
+			continue;
+		}
+		w = defer_ring[defer_head];
+		if (++defer_head == DEFER_SLOTS)
+			defer_head = 0;
+		defer_count--;
+		t = _readcounter() - w.time;
+		if (t > defer_stat.max_latency)
+			defer_stat.max_latency = t;
+		defer_stat.run++;
+		_ei(status);
+		w.fn(w.arg);
+	}
+}
+
+/**
+ * @brief Creates the deferred work worker.
+ *
+ * @return ERR_OK on success and ERR_ERROR if the worker could not be created.
+ *
+ * Must be called from a task (app_main() or the initialization of a driver) before
+ * interrupt handlers use hf_defer(). Further calls do nothing.
+ */
+int32_t hf_defer_init(void)
+{
+	if (defer_task >= 0)
+		return ERR_OK;
+	if (hf_seminit(&defer_sem, 0))
+		return ERR_ERROR;
+	defer_task = hf_spawn(defer_worker, 0, 0, 0, "defer", DEFER_STACK);
+	if (defer_task < 0){
+		hf_semdestroy(&defer_sem);
+		return ERR_ERROR;
+	}
+	hf_priorityset(defer_task, DEFER_PRIORITY);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Queues deferred work.
+ *
+ * @param fn is the work function.
+ * @param arg is the argument of the work function.
+ *
+ * @return ERR_OK on success and ERR_ERROR if the ring of work items is full (or the worker
+ * was not created).
+ *
+ * May be called from interrupt handlers (this is the intended use) and from tasks. Items
+ * are executed in order, one at a time.
+ */
+int32_t hf_defer(void (*fn)(void *), void *arg)
+{
+	volatile uint32_t status;
+	int32_t i;
+
+	status = _di();
+	if (defer_task < 0 || defer_count == DEFER_SLOTS){
+		defer_stat.dropped++;
+		_ei(status);
+		return ERR_ERROR;
+	}
+	i = defer_head + defer_count;
+	if (i >= DEFER_SLOTS)
+		i -= DEFER_SLOTS;
+	defer_ring[i].fn = fn;
+	defer_ring[i].arg = arg;
+	defer_ring[i].time = _readcounter();
+	defer_count++;
+	defer_stat.queued++;
+	defer_pending = 1;
+	krnl_tcb[defer_task].critical = 1;
+	hf_sempost_isr(&defer_sem);
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Returns deferred work statistics.
+ *
+ * @param s is a pointer to a structure filled with the statistics.
+ */
+void hf_defer_stats(struct defer_stats *s)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	*s = defer_stat;
+	_ei(status);
+}
+
+/**
+ * @internal
+ * @brief Switches to the deferred work worker at the end of an interrupt.
+ *
+ * Called by the interrupt handler of the architecture, with interrupts disabled, after
+ * all pending sources were served. If work was queued, the interrupted task is a best
+ * effort task and the worker is ready, the context of the interrupted task is saved and
+ * the worker is restored, as the dispatcher does (the interrupted task is returned to
+ * when it is scheduled again). Otherwise the worker waits for the scheduler, marked as
+ * critical by hf_defer().
+ */
+void defer_dispatch(void)
+{
+	struct tcb_entry *prev;
+	uint32_t now;
+
+	if (!defer_pending || !krnl_schedule)
+		return;
+	prev = &krnl_tcb[krnl_current_task];
+	if (prev->period || prev->capacity || prev->id == defer_task || krnl_tcb[defer_task].state != TASK_READY)
+		return;
+	defer_pending = 0;
+	now = _readcounter();
+	prev->cycles += now - krnl_pcb.cycles_last;
+	sched_group_charge(prev, now - krnl_pcb.cycles_last);
+	if (prev->state == TASK_RUNNING)
+		prev->state = TASK_READY;
+	if (prev->pstack[0] != STACK_MAGIC)
+		panic(PANIC_STACK_OVERFLOW);
+	if (setjmp(prev->task_context))
+		return;
+	krnl_current_task = defer_task;
+	krnl_task = &krnl_tcb[defer_task];
+	krnl_task->state = TASK_RUNNING;
+	krnl_task->critical = 0;
+	krnl_task->bgjobs++;
+	krnl_pcb.preempt_cswitch++;
+	defer_stat.direct++;
+	krnl_pcb.cycles_last = _readcounter();
+	krnl_pcb.sched_cycles += krnl_pcb.cycles_last - now;
+	_restoreexec(krnl_task->task_context, 1, krnl_current_task);
+	panic(PANIC_UNKNOWN);
+}
@@ -0,0 +1,245 @@
+/**
+ * @file governor.c
+ * @date October 2026
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Core clock governor. The dispatcher measures, over windows of GOVERNOR_WINDOW ticks, the
+ * cycles run by the tasks (the idle task included) and the cycles taken by each job of every
+ * real time task (from its release to the next one, ended by hf_waitperiod()). At the end of
+ * a window the slowest clock level of the HAL (_cpu_level(), level n runs at CPU_SPEED >> n)
+ * is chosen such that:
+ *	- the busy (non idle) time of the window fits GOVERNOR_LOAD % of the window at that clock;
+ *	- the largest job of each real time task on the last two windows fits GOVERNOR_MARGIN % of
+ *	  its capacity, in ticks at that clock.
+ *
+ * The tick keeps its length on a lower clock, so periods and deadlines are the same and the
+ * reservations (capacity ticks per period) the task set was admitted with still hold. As
+ * each job fits its capacity at the chosen clock, the task set stays schedulable. A job which
+ * does not finish on its period (because it used its whole capacity, missed its deadline or
+ * never calls hf_waitperiod()) has an unknown demand: the clock goes back to full speed at
+ * once, and stays there until the demand is measured again for two windows. Cycles are work
+ * units: the cycle counter slows down with the core, so a job takes the same cycles on any
+ * clock level (a little less, when it waits for memory).
+ *
+ * The choice is based on measured jobs: a job much larger than the ones before it (beyond the
+ * margin) may still miss its deadline on a lower clock, after which the clock is raised.
+ *
+ * Jobs of a task blocked on a mutex run (in part) on the owner of the mutex, which is charged
+ * for them, and the aperiodic server has no jobs of its own: the margins cover both. On cores
+ * with a single clock level (CPU_LEVELS is 1) the governor just accounts the load.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <kernel.h>
+#include <governor.h>
+#include <ecodes.h>
+
+static uint8_t gov_enabled;				/* governor running (hf_governor()) */
+static uint8_t gov_urgent;				/* a job did not finish, back to full speed */
+static uint32_t gov_level;				/* current clock level */
+static uint32_t gov_ticks;				/* ticks on the current window */
+static uint32_t gov_last;				/* cycle count at the last tick */
+static uint64_t gov_cycles;				/* cycles on the current window */
+static uint64_t gov_idle;				/* cycles of the idle task at the start of the window */
+static uint32_t gov_misses;				/* deadline misses of all tasks at the start of the window */
+static uint32_t gov_level_ticks[CPU_LEVELS];		/* ticks spent on each clock level */
+
+/**
+ * @internal
+ * @brief Sets the clock level.
+ *
+ * @param level is the clock level (0 is CPU_SPEED).
+ */
+static void gov_set(uint32_t level)
+{
+	if (level != gov_level && !_cpu_level(level))
+		gov_level = level;
+}
+
+/**
+ * @internal
+ * @brief Returns the deadline misses of all tasks.
+ */
+static uint32_t gov_missed(void)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < MAX_TASKS; i++)
+		if (krnl_tcb[i].ptask)
+			n += krnl_tcb[i].deadline_misses;
+
+	return n;
+}
+
+/**
+ * @internal
+ * @brief Starts a measurement window.
+ *
+ * @param now is the current cycle count.
+ */
+static void gov_window(uint32_t now)
+{
+	gov_ticks = 0;
+	gov_cycles = 0;
+	gov_last = now;
+	gov_idle = krnl_tcb[0].cycles;
+	gov_misses = gov_missed();
+	gov_urgent = 0;
+}
+
+/**
+ * @brief Starts or stops the clock governor.
+ *
+ * @param enable is 1 to start the governor and 0 to stop it.
+ *
+ * @return ERR_OK on success and ERR_ERROR if the clock could not be set back to full speed.
+ *
+ * Stopping the governor puts the core back at full speed (CPU_SPEED). Jobs are measured from
+ * the start, so the clock is only lowered after two windows.
+ */
+int32_t hf_governor(int32_t enable)
+{
+	volatile uint32_t status;
+	int32_t i;
+
+	status = _di();
+	gov_set(0);
+	if (gov_level){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	gov_enabled = enable ? 1 : 0;
+	if (gov_enabled){
+		for (i = 0; i < MAX_TASKS; i++){
+			krnl_tcb[i].job_start = krnl_tcb[i].cycles;
+			krnl_tcb[i].job_peak = GOVERNOR_FULL;
+			krnl_tcb[i].job_last = GOVERNOR_FULL;
+			krnl_tcb[i].job_done = 0;
+			krnl_tcb[i].job_seen = 0;
+		}
+		gov_window(_readcounter());
+	}
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Returns the current clock level.
+ *
+ * @return clock level, the core runs at CPU_SPEED >> level.
+ */
+int32_t hf_cpulevel(void)
+{
+	return gov_level;
+}
+
+/**
+ * @brief Returns the time spent on a clock level, while the governor was running.
+ *
+ * @param level is the clock level.
+ *
+ * @return number of ticks spent on the level, 0 if the level does not exist.
+ */
+uint32_t hf_cpulevel_ticks(uint32_t level)
+{
+	if (level >= CPU_LEVELS)
+		return 0;
+
+	return gov_level_ticks[level];
+}
+
+/**
+ * @internal
+ * @brief Accounts the job of a real time task which ends on its period boundary. Interrupts
+ * disabled.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * Called by the real time schedulers when the next job of the task is released. The job
+ * length is the cycles run by the task since the last release, if the job finished
+ * (hf_waitperiod()), or unknown (GOVERNOR_FULL) otherwise.
+ */
+void sched_gov_release(struct tcb_entry *task)
+{
+	uint64_t c;
+
+	if (!gov_enabled)
+		return;
+	c = task->cycles - task->job_start;
+	task->job_start = task->cycles;
+	if (!task->job_done || c >= GOVERNOR_FULL)
+		c = GOVERNOR_FULL;
+	task->job_done = 0;
+	if (!task->job_seen || c > task->job_peak)
+		task->job_peak = c;
+	task->job_seen = 1;
+	if (c == GOVERNOR_FULL && task != krnl_server)
+		gov_urgent = 1;
+}
+
+/**
+ * @internal
+ * @brief Clock governor, called by the dispatcher on every tick. Interrupts disabled.
+ *
+ * @param now is the current cycle count.
+ * @param ticks is the number of ticks since the last call (more than one after a tickless idle).
+ */
+void sched_governor(uint32_t now, uint32_t ticks)
+{
+	struct tcb_entry *task;
+	uint64_t busy, idle, tick, need;
+	uint32_t i, level;
+
+	if (!gov_enabled)
+		return;
+	gov_cycles += now - gov_last;
+	gov_last = now;
+	gov_ticks += ticks;
+	gov_level_ticks[gov_level] += ticks;
+	if (gov_urgent && gov_level)
+		gov_set(0);
+	if (gov_ticks < GOVERNOR_WINDOW)
+		return;
+
+	/* busy cycles of the window, and full speed cycles of a tick */
+	idle = krnl_tcb[0].cycles - gov_idle;
+	busy = gov_cycles > idle ? gov_cycles - idle : 0;
+	tick = (gov_cycles << gov_level) / gov_ticks;
+
+	/* the slowest clock where the load and every job fit */
+	level = 0;
+	if (!gov_urgent && gov_missed() == gov_misses){
+		for (level = CPU_LEVELS - 1; level > 0; level--){
+			if (busy * 100 > ((gov_cycles << gov_level) >> level) * GOVERNOR_LOAD)
+				continue;
+			for (i = 1; i < MAX_TASKS; i++){
+				task = &krnl_tcb[i];
+				if (!task->ptask || !task->period || task == krnl_server)
+					continue;
+				need = task->job_peak > task->job_last ? task->job_peak : task->job_last;
+				if (need == GOVERNOR_FULL || need * 100 > ((task->capacity * tick) >> level) * GOVERNOR_MARGIN)
+					break;
+			}
+			if (i == MAX_TASKS)
+				break;
+		}
+	}
+	gov_set(level);
+
+	for (i = 0; i < MAX_TASKS; i++){
+		task = &krnl_tcb[i];
+		if (task->job_seen){
+			task->job_last = task->job_peak;
+			task->job_seen = 0;
+		}
+	}
+	gov_window(now);
+}
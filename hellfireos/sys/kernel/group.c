@@ -0,0 +1,223 @@
+/**
+ * @file group.c
+ * @date October 2026
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * CPU reservations for groups of best effort tasks. A group gets a budget of processor time
+ * per replenishment period, in the style of a constant bandwidth server with hard reservations:
+ * the cycles run by the tasks of the group are charged to its budget when they are switched out
+ * (dispatch_isr() and hf_yield()), and once the budget is exhausted the tasks of the group are
+ * not selected by the best effort scheduler until the budget is replenished, at the end of the
+ * period. So a busy group (a network tenant under load, for example) is held to its share, and
+ * the processor time left goes to the other tasks. Tasks out of any group are not limited.
+ *
+ * A task runs at least until the next tick once selected, so a group may overrun its budget by
+ * up to a tick; the overrun is taken from the next period.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <kernel.h>
+#include <group.h>
+#include <ecodes.h>
+
+static struct be_group *group_list;
+
+/**
+ * @brief Initializes a task group with a CPU reservation.
+ *
+ * @param g is a pointer to a task group.
+ * @param budget_us is the processor time of the group on each period, in microseconds.
+ * @param period_us is the replenishment period, in microseconds.
+ *
+ * @return ERR_OK on success and ERR_ERROR if the budget is zero or larger than the period.
+ *
+ * Periods should be a few ticks long or more, as budgets are enforced on scheduling decisions.
+ */
+int32_t hf_group_init(struct be_group *g, uint32_t budget_us, uint32_t period_us)
+{
+	volatile uint32_t status;
+
+	if (!budget_us || budget_us > period_us)
+		return ERR_ERROR;
+	g->budget = budget_us * (CPU_SPEED / 1000000);
+	g->period = period_us * (CPU_SPEED / 1000000);
+	g->left = g->budget;
+	g->throttled = 0;
+	g->used = 0;
+	g->tasks = 0;
+	status = _di();
+	g->start = _readcounter();
+	g->next = group_list;
+	group_list = g;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Destroys a task group.
+ *
+ * @param g is a pointer to a task group.
+ *
+ * @return ERR_OK on success and ERR_ERROR if tasks are still in the group.
+ */
+int32_t hf_group_destroy(struct be_group *g)
+{
+	volatile uint32_t status;
+	struct be_group **p;
+
+	status = _di();
+	if (g->tasks){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	for (p = &group_list; *p; p = &(*p)->next){
+		if (*p == g){
+			*p = g->next;
+			break;
+		}
+	}
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Places a task in a group.
+ *
+ * @param id is a task id number.
+ * @param g is a pointer to a task group.
+ *
+ * @return ERR_OK on success and ERR_INVALID_ID if the task does not exist or is not a best
+ * effort task.
+ *
+ * A task is in one group at most, joining a group leaves the previous one.
+ */
+int32_t hf_group_join(uint16_t id, struct be_group *g)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	if (id == 0 || id >= MAX_TASKS)
+		return ERR_INVALID_ID;
+	status = _di();
+	krnl_task2 = &krnl_tcb[id];
+	if (!krnl_task2->ptask || krnl_task2->period || krnl_task2->capacity){
+		_ei(status);
+		return ERR_INVALID_ID;
+	}
+	if (krnl_task2->group)
+		krnl_task2->group->tasks--;
+	krnl_task2->group = g;
+	g->tasks++;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Takes a task out of its group.
+ *
+ * @param id is a task id number.
+ *
+ * @return ERR_OK on success and ERR_INVALID_ID if the task does not exist or is in no group.
+ */
+int32_t hf_group_leave(uint16_t id)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	if (id >= MAX_TASKS)
+		return ERR_INVALID_ID;
+	status = _di();
+	krnl_task2 = &krnl_tcb[id];
+	if (!krnl_task2->ptask || !krnl_task2->group){
+		_ei(status);
+		return ERR_INVALID_ID;
+	}
+	krnl_task2->group->tasks--;
+	krnl_task2->group = NULL;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Returns the processor time accounting of a task group.
+ *
+ * @param g is a pointer to a task group.
+ * @param used is a pointer to the cycles consumed by the group (may be NULL).
+ * @param throttled is a pointer to the number of periods the budget was exhausted (may be NULL).
+ * @param left is a pointer to the cycles left on the current period (may be NULL, negative
+ * on an overrun).
+ *
+ * @return ERR_OK.
+ */
+int32_t hf_group_stats(struct be_group *g, uint64_t *used, uint32_t *throttled, int32_t *left)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (used)
+		*used = g->used;
+	if (throttled)
+		*throttled = g->throttled;
+	if (left)
+		*left = g->left;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @internal
+ * @brief Charges the cycles run by a task to its group. Interrupts disabled.
+ */
+void sched_group_charge(struct tcb_entry *task, uint32_t cycles)
+{
+	struct be_group *g = task->group;
+
+	if (!g)
+		return;
+	g->used += cycles;
+	if (g->left > 0 && (int32_t)(g->left - cycles) <= 0)
+		g->throttled++;
+	g->left -= cycles;
+}
+
+/**
+ * @internal
+ * @brief Replenishes the budget of groups at the end of their period. Interrupts disabled.
+ *
+ * An overrun of the budget is taken from the new period. If whole periods went by (the
+ * processor was given to RT tasks, for example), the period is restarted.
+ */
+void sched_group_replenish(uint32_t now)
+{
+	struct be_group *g;
+
+	for (g = group_list; g; g = g->next){
+		if (now - g->start < g->period)
+			continue;
+		g->start += g->period;
+		if (now - g->start >= g->period)
+			g->start = now;
+		g->left = (g->left < 0 ? g->left : 0) + g->budget;
+	}
+}
+
+/**
+ * @internal
+ * @brief Checks if a task may be selected, i.e. its group still has budget.
+ */
+int32_t sched_group_eligible(struct tcb_entry *task)
+{
+	return !task->group || task->group->left > 0;
+}
@@ -24,6 +24,7 @@
 #include <scheduler.h>
 #include <task.h>
 #include <processor.h>
+#include <trace.h>
 #include <main.h>
 #include <ecodes.h>
 
@@ -56,6 +57,7 @@ static void clear_tcb(void)
     krnl_task->rtjobs = 0;
     krnl_task->bgjobs = 0;
     krnl_task->deadline_misses = 0;
+    krnl_task->cycles = 0;
     krnl_task->period = 0;
     krnl_task->capacity = 0;
     krnl_task->deadline = 0;
@@ -64,34 +66,72 @@ static void clear_tcb(void)
     krnl_task->ptask = NULL;
     krnl_task->pstack = NULL;
     krnl_task->stack_size = 0;
+    krnl_task->stack_static = 0;
+    krnl_task->arena = NULL;
     krnl_task->other_data = 0;
+    krnl_task->rq_next = NULL;
+    krnl_task->rq_prev = NULL;
+    krnl_task->dq_next = NULL;
+    krnl_task->dq_prev = NULL;
+    krnl_task->mtx_wait = NULL;
+    krnl_task->cond_mtx = NULL;
+    krnl_task->wait_queue = NULL;
+    krnl_task->wait_count = NULL;
+    krnl_task->timedout = 0;
   }
 
   krnl_tasks = 0;
+  krnl_server = NULL;
   krnl_current_task = 0;
   krnl_schedule = 0;
+  krnl_resched = 0;
 }
 
 static void clear_pcb(void)
 {
-  krnl_pcb.sched_rt = sched_rma;
-  krnl_pcb.sched_be = sched_priorityrr;
+  krnl_pcb.sched_rt = SCHED_RT_DEFAULT;
+  krnl_pcb.sched_be = SCHED_BE_DEFAULT;
   krnl_pcb.coop_cswitch = 0;
   krnl_pcb.preempt_cswitch = 0;
+  krnl_pcb.same_cswitch = 0;
   krnl_pcb.interrupts = 0;
   krnl_pcb.tick_time = 0;
+  krnl_pcb.cycles_last = 0;
+  krnl_pcb.sched_cycles = 0;
+#if SCHED_STATS == 1
+  memset(&krnl_pcb.dispatch, 0, sizeof(struct sched_stat));
+  memset(&krnl_pcb.latency, 0, sizeof(struct sched_stat));
+#endif
 }
 
+#if STATIC_TASKS == 1
+static struct queue run_queue, rt_queue, aperiodic_queue;
+static void *run_queue_data[MAX_TASKS * 2], *rt_queue_data[MAX_TASKS * 2], *aperiodic_queue_data[MAX_TASKS * 2];
+
+static HF_STACK(idle_stack, 1024);
+static HF_STACK(server_stack, 1024);
+static HF_STACK(generator_stack, 1024);
+#endif
+
 static void init_queues(void)
 {
+#if STATIC_TASKS == 1
+  hf_queue_init(&run_queue, run_queue_data, MAX_TASKS);
+  krnl_run_queue = &run_queue;
+  krnl_delay_list = NULL;
+  hf_queue_init(&rt_queue, rt_queue_data, MAX_TASKS);
+  krnl_rt_queue = &rt_queue;
+  hf_queue_init(&aperiodic_queue, aperiodic_queue_data, MAX_TASKS);
+  krnl_aperiodic_queue = &aperiodic_queue;
+#else
   krnl_run_queue = hf_queue_create(MAX_TASKS);
   if (krnl_run_queue == NULL) panic(PANIC_OOM);
-  krnl_delay_queue = hf_queue_create(MAX_TASKS);
-  if (krnl_delay_queue == NULL) panic(PANIC_OOM);
+  krnl_delay_list = NULL;
   krnl_rt_queue = hf_queue_create(MAX_TASKS);
   if (krnl_rt_queue == NULL) panic(PANIC_OOM);
   krnl_aperiodic_queue = hf_queue_create(MAX_TASKS);
   if (krnl_aperiodic_queue == NULL) panic(PANIC_OOM);
+#endif
 }
 
 static void idletask(void)
@@ -102,57 +142,26 @@ static void idletask(void)
   hf_schedlock(0);
 
   for (;;){
+#if KERNEL_LOG == 3
+    hf_traceflush();
+#endif
+    hf_heapidle();
     _cpu_idle();
   }
 }
 
-static void polling_server_task(void)
+/**
+ * @internal
+ * @brief Aperiodic server task.
+ *
+ * This task only reserves the server bandwidth (period and capacity) on the real time
+ * task set. The real time scheduler never executes it: the processor time of the server
+ * is given to the tasks on the aperiodic queue.
+ */
+static void aperiodic_server_task(void)
 {
-  int32_t polling_id = hf_selfid();
-  struct aperiodic_entry *polling_task;
-  polling_task = &krnl_tcb[polling_id];
-	int16_t SERVER_CAPACITY = polling_task->capacity;
-	int16_t server_fuel = SERVER_CAPACITY;
-  int32_t rc;
-  int32_t status;
-
-  for(;;)
-  {
-  	if(server_fuel == 0)
-  		server_fuel = SERVER_CAPACITY;
-
-    kprintf("\n-- POLLING SERVER  --\n");
-
-    struct aperiodic_entry *next_aperiodic;
-
-    if(hf_queue_count(krnl_aperiodic_queue)==0){
-    	kprintf("No aperiodic task to run\n");
-    	hf_yield();
-    	continue;
-    }
-    next_aperiodic = polling_server_scheduler();
-
-    if(server_fuel >= next_aperiodic->capacity){
-    	server_fuel -= next_aperiodic->capacity;
-    }
-    else{
-    	next_aperiodic->capacity -= server_fuel;
-    	server_fuel = 0;
-    	hf_queue_addtail(krnl_aperiodic_queue, next_aperiodic);
-    }
-
-    polling_task->state = TASK_READY;
-    next_aperiodic->state = TASK_RUNNING;
-    status = _di();
-    krnl_task = next_aperiodic;
-    krnl_current_task = next_aperiodic->id;
-    rc = setjmp(polling_task->task_context);
-    if(rc != 0){
-    	continue;
-    	_ei(status);
-    }
-    kprintf("Running aperiodic task - id:%d\n", krnl_current_task);
-    _restoreexec(krnl_task->task_context, 1, krnl_current_task);
+  for (;;){
+    _cpu_idle();
   }
 }
 
@@ -160,6 +169,7 @@ static void dummy_task(void)
 {
 	int i;
   for(i=0;i<20000;++i){}
+  hf_kill(hf_selfid());
 }
 
 static void aperiodic_task_generator(void)
@@ -169,7 +179,7 @@ static void aperiodic_task_generator(void)
     int random_delay = random() % 140 + 60;
     kprintf("\nGenerating Aperiodic Task\n");
     hf_spawn(dummy_task, 0, 18, 0, "dummy task", 1024);
-    delay_ms(random_delay);
+    hf_msleep(random_delay);
   }
 }
 
@@ -191,6 +201,7 @@ static void aperiodic_task_generator(void)
 int main(void)
 {
   static uint32_t oops=0xbaadd00d;
+  int32_t id;
 
   _hardware_init();
   hf_schedlock(1);
@@ -198,7 +209,9 @@ int main(void)
   kprintf("\nKERNEL: booting...");
   if (oops == 0xbaadd00d){
     oops = 0;
+#if STATIC_TASKS == 0
     print_config();
+#endif
     _vm_init();
     clear_tcb();
     clear_pcb();
@@ -207,9 +220,20 @@ int main(void)
     _irq_init();
     _timer_init();
     _timer_reset();
+#if STATIC_TASKS == 1
+    hf_spawn_static(idletask, 0, 0, 0, "idle task", idle_stack, sizeof(idle_stack));
+    id = hf_spawn_static(aperiodic_server_task, 20, 6, 20, "aperiodic server", server_stack, sizeof(server_stack));
+#else
     hf_spawn(idletask, 0, 0, 0, "idle task", 1024);
-    hf_spawn(polling_server_task, 20, 6, 20, "polling server", 1024);
+    id = hf_spawn(aperiodic_server_task, 20, 6, 20, "aperiodic server", 1024);
+#endif
+    if (id >= 0)
+      krnl_server = &krnl_tcb[id];
+#if STATIC_TASKS == 1
+    hf_spawn_static(aperiodic_task_generator, 10, 2, 10, "aperiodic task generator", generator_stack, sizeof(generator_stack));
+#else
     hf_spawn(aperiodic_task_generator, 10, 2, 10, "aperiodic task generator", 1024);
+#endif
     _device_init();
     _task_init();
     app_main();
@@ -0,0 +1,503 @@
+/**
+ * @file module.c
+ * @date October 2026
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Loadable application modules. A module is a task body (and the code and data it uses)
+ * linked at address 0 and converted from ELF by usr/module/mkmodule, which keeps the
+ * relocations and lists the kernel symbols the module uses. The loader copies the image
+ * to memory allocated from the heap, resolves the imports against the symbols exported
+ * by the kernel (a table here, plus tables registered by drivers with hf_module_export()),
+ * applies the relocations and checks the CRC of the file. The module is then spawned as
+ * a task, so new application code is deployed to a running system without a new kernel
+ * image.
+ *
+ * Modules are read as a stream (hf_module_read()), from memory (hf_module_load()), a
+ * file on uhfs (hf_module_fload()), UDP (hf_module_uudp()) or the NoC (hf_module_noc()),
+ * and the file is not kept in memory: each part is processed as it arrives.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <crc.h>
+#include <kprintf.h>
+#include <malloc.h>
+#include <queue.h>
+#include <lockstat.h>
+#include <semaphore.h>
+#include <mutex.h>
+#include <condvar.h>
+#include <mailbox.h>
+#include <kernel.h>
+#include <task.h>
+#include <processor.h>
+#include <module.h>
+#include <ecodes.h>
+
+#ifndef MODULE_STACK
+#define MODULE_STACK	2048
+#endif
+#define MODULE_BATCH	16
+
+#if defined(__mips__)
+#define MODULE_MACHINE	8
+#elif defined(__riscv)
+#define MODULE_MACHINE	243
+#define MODULE_ALIGN	2		/* compressed code, instructions on halfwords */
+#else
+#define MODULE_MACHINE	0
+#endif
+#ifndef MODULE_ALIGN
+#define MODULE_ALIGN	4
+#endif
+
+/* compiler support routines (lib/libc/libc.c), used by modules built for processors without a multiplier / divider */
+int32_t __mulsi3(uint32_t a, uint32_t b);
+int64_t __muldi3(int64_t a, int64_t b);
+int32_t __divsi3(int32_t a, int32_t b);
+int32_t __modsi3(int32_t a, int32_t b);
+uint32_t __udivsi3(uint32_t a, uint32_t b);
+uint32_t __umodsi3(uint32_t a, uint32_t b);
+uint64_t __udivdi3(uint64_t num, uint64_t den);
+uint64_t __umoddi3(uint64_t num, uint64_t den);
+int64_t __divdi3(int64_t num, int64_t den);
+int64_t __moddi3(int64_t num, int64_t den);
+int64_t __ashldi3(int64_t u, uint32_t b);
+int64_t __ashrdi3(int64_t u, uint32_t b);
+int64_t __lshrdi3(int64_t u, uint32_t b);
+#if FLOATING_POINT == 1
+float __addsf3(float a1, float a2);
+float __subsf3(float a1, float a2);
+float __mulsf3(float a1, float a2);
+float __divsf3(float a1, float a2);
+float __negsf2(float a1);
+int32_t __cmpsf2(float a1, float a2);
+int32_t __ltsf2(float a, float b);
+int32_t __lesf2(float a, float b);
+int32_t __gtsf2(float a, float b);
+int32_t __gesf2(float a, float b);
+int32_t __eqsf2(float a, float b);
+int32_t __nesf2(float a, float b);
+int32_t __fixsfsi(float a_fp);
+uint32_t __fixunssfsi(float a_fp);
+float __floatsisf(int32_t af);
+float __floatunsisf(uint32_t af);
+#endif
+
+#define EXPORT(sym)	{ (const int8_t *)#sym, (void *)sym }
+
+/* kernel and C library symbols available to modules */
+static const struct module_symbol module_kernel[] = {
+	EXPORT(hf_spawn),
+	EXPORT(hf_kill),
+	EXPORT(hf_yield),
+	EXPORT(hf_waitperiod),
+	EXPORT(hf_block),
+	EXPORT(hf_resume),
+	EXPORT(hf_delay),
+	EXPORT(hf_usleep),
+	EXPORT(hf_msleep),
+	EXPORT(hf_id),
+	EXPORT(hf_name),
+	EXPORT(hf_selfid),
+	EXPORT(hf_selfname),
+	EXPORT(hf_state),
+	EXPORT(hf_jobs),
+	EXPORT(hf_dlm),
+	EXPORT(hf_priorityset),
+	EXPORT(hf_priorityget),
+	EXPORT(hf_cpuload),
+	EXPORT(hf_freemem),
+	EXPORT(hf_ticktime),
+	EXPORT(hf_seminit),
+	EXPORT(hf_semdestroy),
+	EXPORT(hf_semwait),
+	EXPORT(hf_semwait_timeout),
+	EXPORT(hf_sempost),
+	EXPORT(hf_mtxinit),
+	EXPORT(hf_mtxlock),
+	EXPORT(hf_mtxtrylock),
+	EXPORT(hf_mtxunlock),
+	EXPORT(hf_queue_create),
+	EXPORT(hf_queue_destroy),
+	EXPORT(hf_queue_count),
+	EXPORT(hf_queue_addtail),
+	EXPORT(hf_queue_remhead),
+	EXPORT(hf_malloc),
+	EXPORT(hf_free),
+	EXPORT(hf_calloc),
+	EXPORT(hf_realloc),
+	EXPORT(hf_malloc_region),
+	EXPORT(malloc),
+	EXPORT(free),
+	EXPORT(calloc),
+	EXPORT(realloc),
+	EXPORT(kprintf),
+	EXPORT(printf),
+	EXPORT(sprintf),
+	EXPORT(snprintf),
+	EXPORT(memcpy),
+	EXPORT(memset),
+	EXPORT(strcpy),
+	EXPORT(strncpy),
+	EXPORT(strcmp),
+	EXPORT(strlen),
+	EXPORT(random),
+	EXPORT(_readcounter),
+	EXPORT(_read_us),
+	EXPORT(delay_ms),
+	EXPORT(__mulsi3),
+	EXPORT(__muldi3),
+	EXPORT(__divsi3),
+	EXPORT(__modsi3),
+	EXPORT(__udivsi3),
+	EXPORT(__umodsi3),
+	EXPORT(__udivdi3),
+	EXPORT(__umoddi3),
+	EXPORT(__divdi3),
+	EXPORT(__moddi3),
+	EXPORT(__ashldi3),
+	EXPORT(__ashrdi3),
+	EXPORT(__lshrdi3),
+#if FLOATING_POINT == 1
+	EXPORT(__addsf3),
+	EXPORT(__subsf3),
+	EXPORT(__mulsf3),
+	EXPORT(__divsf3),
+	EXPORT(__negsf2),
+	EXPORT(__cmpsf2),
+	EXPORT(__ltsf2),
+	EXPORT(__lesf2),
+	EXPORT(__gtsf2),
+	EXPORT(__gesf2),
+	EXPORT(__eqsf2),
+	EXPORT(__nesf2),
+	EXPORT(__fixsfsi),
+	EXPORT(__fixunssfsi),
+	EXPORT(__floatsisf),
+	EXPORT(__floatunsisf),
+#endif
+	{ NULL, NULL }
+};
+
+static const struct module_symbol *module_tables[MODULE_TABLES];
+
+struct module_buf {
+	uint8_t *p;
+	uint32_t left;
+};
+
+static int32_t module_memread(void *arg, void *buf, uint32_t size)
+{
+	struct module_buf *b = arg;
+
+	if (size > b->left)
+		size = b->left;
+	memcpy(buf, b->p, size);
+	b->p += size;
+	b->left -= size;
+
+	return size;
+}
+
+/* makes the new code visible to instruction fetches (processors with caches) */
+static void module_sync(void *base, uint32_t size)
+{
+#if defined(__mips_isa_rev) && __mips_isa_rev >= 2
+	size_t a;
+
+	/* 16 byte cache lines (PIC32MZ) */
+	for (a = (size_t)base & ~15; a < (size_t)base + size; a += 16)
+		__asm__ volatile ("synci 0(%0)" : : "r" (a));
+	__asm__ volatile ("sync\n\tehb");
+#endif
+}
+
+static int32_t module_reloc(uint8_t *base, uint32_t image_size, struct module_reloc *r, uint32_t s)
+{
+	uint32_t p[2];
+	uint32_t size = r->type == RELOC_RISCV_CALL ? 8 : 4;
+	int32_t off;
+
+	if (r->offset + size > image_size || (r->offset & (MODULE_ALIGN - 1)))
+		return ERR_ERROR;
+	/* the words may be on halfwords, copied as the processor has no unaligned accesses */
+	memcpy(p, base + r->offset, size);
+	off = s - (size_t)(base + r->offset);
+
+	switch (r->type){
+	case RELOC_32:
+		*p = s;
+		break;
+	case RELOC_MIPS_26:
+		if ((s ^ (size_t)(base + r->offset)) & 0xf0000000)
+			return ERR_ERROR;
+		*p = (*p & 0xfc000000) | ((s >> 2) & 0x03ffffff);
+		break;
+	case RELOC_MIPS_HI16:
+		*p = (*p & 0xffff0000) | (((s + 0x8000) >> 16) & 0xffff);
+		break;
+	case RELOC_MIPS_LO16:
+		*p = (*p & 0xffff0000) | (s & 0xffff);
+		break;
+	case RELOC_RISCV_HI20:
+		*p = (*p & 0xfff) | ((s + 0x800) & 0xfffff000);
+		break;
+	case RELOC_RISCV_LO12_I:
+		*p = (*p & 0xfffff) | ((s & 0xfff) << 20);
+		break;
+	case RELOC_RISCV_LO12_S:
+		*p = (*p & 0x1fff07f) | ((s & 0x1f) << 7) | ((s & 0xfe0) << 20);
+		break;
+	case RELOC_RISCV_CALL:
+		p[0] = (p[0] & 0xfff) | ((off + 0x800) & 0xfffff000);
+		p[1] = (p[1] & 0xfffff) | ((off & 0xfff) << 20);
+		break;
+	case RELOC_RISCV_JAL:
+		if (off < -(1 << 20) || off >= (1 << 20))
+			return ERR_ERROR;
+		*p = (*p & 0xfff) | (off & 0xff000) | ((off & 0x800) << 9) | ((off & 0x7fe) << 20) | ((off & 0x100000) << 11);
+		break;
+	default:
+		return ERR_ERROR;
+	}
+	memcpy(base + r->offset, p, size);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Registers a table of symbols exported to modules.
+ *
+ * @param table is an array of symbols, ended by an entry with a NULL name.
+ *
+ * @return ERR_OK on success and ERR_EXCEED_MAX_NUM if MODULE_TABLES tables are registered.
+ *
+ * The kernel and C library symbols are always available. Drivers and subsystems (the NoC
+ * driver or the network stack, for example) register their own symbols.
+ */
+int32_t hf_module_export(const struct module_symbol *table)
+{
+	volatile uint32_t status;
+	int32_t i;
+
+	status = _di();
+	for (i = 0; i < MODULE_TABLES; i++){
+		if (module_tables[i] == table || !module_tables[i]){
+			module_tables[i] = table;
+			_ei(status);
+			return ERR_OK;
+		}
+	}
+	_ei(status);
+
+	return ERR_EXCEED_MAX_NUM;
+}
+
+/**
+ * @brief Finds a symbol exported to modules.
+ *
+ * @param name is the symbol name.
+ *
+ * @return the address of the symbol, or NULL if it is not exported.
+ */
+void *hf_module_sym(int8_t *name)
+{
+	const struct module_symbol *s;
+	int32_t i;
+
+	for (s = module_kernel; s->name; s++)
+		if (!strcmp(s->name, name))
+			return s->addr;
+	for (i = 0; i < MODULE_TABLES && module_tables[i]; i++)
+		for (s = module_tables[i]; s->name; s++)
+			if (!strcmp(s->name, name))
+				return s->addr;
+
+	return NULL;
+}
+
+/**
+ * @brief Loads a module from a stream.
+ *
+ * @param m is a pointer to a module structure, filled by the loader.
+ * @param read is a function which reads the next size bytes of the module file to buf and
+ * returns the number of bytes read (less than size, or negative, on an error).
+ * @param arg is the first argument of the read function.
+ *
+ * @return ERR_OK on success, ERR_INVALID_PARAMETER if the file is not a module for this
+ * processor, ERR_OUT_OF_MEMORY if there is no memory for the module, ERR_INVALID_NAME if
+ * a symbol imported by the module is not exported by the kernel and ERR_ERROR if the file
+ * is truncated, corrupted (CRC) or has an invalid relocation.
+ *
+ * The module memory (image and bss) is allocated from the heap. The file is processed as
+ * it is read, only the addresses of the imports are kept until the module is loaded.
+ */
+int32_t hf_module_read(struct module *m, int32_t (*read)(void *arg, void *buf, uint32_t size), void *arg)
+{
+	struct module_header h;
+	struct module_reloc r[MODULE_BATCH];
+	int8_t sym[MODULE_SYMLEN];
+	void **imp = NULL;
+	uint8_t *base = NULL;
+	uint32_t crc, i, k, n, s;
+	int32_t err = ERR_ERROR;
+
+	m->base = NULL;
+	m->task = -1;
+	if (read(arg, &h, MODULE_HDRSIZE) != MODULE_HDRSIZE)
+		return ERR_ERROR;
+	if (h.magic != MODULE_MAGIC || h.machine != MODULE_MACHINE || h.entry >= h.image_size)
+		return ERR_INVALID_PARAMETER;
+	h.name[MODULE_NAMELEN - 1] = '\0';
+
+	if (h.imports){
+		imp = (void **)hf_malloc(h.imports * sizeof(void *));
+		if (!imp)
+			return ERR_OUT_OF_MEMORY;
+	}
+	base = (uint8_t *)hf_malloc(h.image_size + h.bss_size);
+	if (!base){
+		err = ERR_OUT_OF_MEMORY;
+		goto fail;
+	}
+
+	crc = crc32_init();
+	for (i = 0; i < h.imports; i++){
+		if (read(arg, sym, MODULE_SYMLEN) != MODULE_SYMLEN)
+			goto fail;
+		crc = crc32_update(crc, (uint8_t *)sym, MODULE_SYMLEN);
+		sym[MODULE_SYMLEN - 1] = '\0';
+		imp[i] = hf_module_sym(sym);
+		if (!imp[i]){
+			kprintf("\nKERNEL: module %s, unresolved symbol %s", h.name, sym);
+			err = ERR_INVALID_NAME;
+			goto fail;
+		}
+	}
+
+	if (read(arg, base, h.image_size) != h.image_size)
+		goto fail;
+	crc = crc32_update(crc, base, h.image_size);
+	memset(base + h.image_size, 0, h.bss_size);
+
+	for (i = 0; i < h.relocs; i += n){
+		n = h.relocs - i < MODULE_BATCH ? h.relocs - i : MODULE_BATCH;
+		if (read(arg, r, n * sizeof(struct module_reloc)) != n * sizeof(struct module_reloc))
+			goto fail;
+		crc = crc32_update(crc, (uint8_t *)r, n * sizeof(struct module_reloc));
+		for (k = 0; k < n; k++){
+			if (r[k].sym == MODULE_LOCAL){
+				if (r[k].value > h.image_size + h.bss_size)
+					goto fail;
+				s = (size_t)base + r[k].value;
+			}else{
+				if (r[k].sym >= h.imports)
+					goto fail;
+				s = (size_t)imp[r[k].sym] + r[k].value;
+			}
+			if (module_reloc(base, h.image_size, &r[k], s))
+				goto fail;
+		}
+	}
+	if (crc32_final(crc) != h.crc){
+		kprintf("\nKERNEL: module %s, bad CRC", h.name);
+		goto fail;
+	}
+	if (imp)
+		hf_free(imp);
+	module_sync(base, h.image_size);
+
+	memcpy(m->name, h.name, MODULE_NAMELEN);
+	m->base = base;
+	m->size = h.image_size + h.bss_size;
+	m->entry = (void (*)(void))(base + h.entry);
+	m->stack_size = h.stack_size ? h.stack_size : MODULE_STACK;
+	kprintf("\nKERNEL: module %s loaded, addr: %x, size: %d bytes", m->name, base, m->size);
+
+	return ERR_OK;
+
+fail:
+	if (base)
+		hf_free(base);
+	if (imp)
+		hf_free(imp);
+
+	return err;
+}
+
+/**
+ * @brief Loads a module from memory.
+ *
+ * @param m is a pointer to a module structure, filled by the loader.
+ * @param buf is a pointer to the module file.
+ * @param size is the size of the module file.
+ *
+ * @return the same as hf_module_read().
+ *
+ * The module is copied, so the buffer may be released after the call.
+ */
+int32_t hf_module_load(struct module *m, void *buf, uint32_t size)
+{
+	struct module_buf b;
+
+	b.p = buf;
+	b.left = size;
+
+	return hf_module_read(m, module_memread, &b);
+}
+
+/**
+ * @brief Spawns the task of a module.
+ *
+ * @param m is a pointer to a loaded module.
+ * @param period is the task RT period (in quantum / tick units).
+ * @param capacity is the amount of work to be executed in a period (in quantum / tick units).
+ * @param deadline is the task deadline to complete the work in the period (in quantum / tick units).
+ *
+ * @return task id if the task is created, ERR_INVALID_STATE if the module is not loaded or its
+ * task is already running, or the error of hf_spawn().
+ *
+ * The task is named after the module, and its stack size is the one on the module header.
+ */
+int32_t hf_module_spawn(struct module *m, uint16_t period, uint16_t capacity, uint16_t deadline)
+{
+	int32_t id;
+
+	if (!m->base || (m->task >= 0 && krnl_tcb[m->task].ptask == m->entry))
+		return ERR_INVALID_STATE;
+	id = hf_spawn(m->entry, period, capacity, deadline, m->name, m->stack_size);
+	if (id >= 0)
+		m->task = id;
+
+	return id;
+}
+
+/**
+ * @brief Unloads a module.
+ *
+ * @param m is a pointer to a loaded module.
+ *
+ * @return ERR_OK on success and ERR_INVALID_STATE if the module is not loaded or if it is
+ * called by the task of the module.
+ *
+ * If the task of the module is still running, it is killed. The module memory is freed.
+ */
+int32_t hf_module_unload(struct module *m)
+{
+	if (!m->base || (m->task >= 0 && m->task == hf_selfid()))
+		return ERR_INVALID_STATE;
+	if (m->task >= 0 && krnl_tcb[m->task].ptask == m->entry)
+		hf_kill(m->task);
+	hf_free(m->base);
+	m->base = NULL;
+	m->task = -1;
+
+	return ERR_OK;
+}
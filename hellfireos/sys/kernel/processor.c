@@ -125,3 +125,146 @@ uint32_t hf_ticktime(void)
 #endif
 	return krnl_pcb.tick_time;
 }
+
+/**
+ * @brief Returns the processor time consumed by a task, in cycles.
+ * 
+ * @param id is the task id number
+ * @param cycles is a pointer to the cycle count to be returned
+ * 
+ * @return ERR_OK on success or ERR_INVALID_ID if the referenced task does not exist.
+ * 
+ * Cycles are charged to a task when it is switched out, either preempted or yielding (interrupt handlers
+ * that run on its behalf included), so the running task does not account its current time slice. The
+ * value is reset when the task is spawned.
+ */
+int32_t hf_cputime(uint16_t id, uint64_t *cycles)
+{
+	volatile uint32_t status;
+
+#if KERNEL_LOG == 2
+	dprintf("hf_cputime() %d ", (uint32_t)_read_us());
+#endif
+	if (id >= MAX_TASKS || !krnl_tcb[id].ptask)
+		return ERR_INVALID_ID;
+	status = _di();
+	*cycles = krnl_tcb[id].cycles;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Returns the processor time spent on the dispatcher (context switches and scheduling
+ * decisions), in cycles.
+ * 
+ * @return dispatcher overhead, in cycles.
+ */
+uint64_t hf_schedtime(void)
+{
+	volatile uint32_t status;
+	uint64_t cycles;
+
+#if KERNEL_LOG == 2
+	dprintf("hf_schedtime() %d ", (uint32_t)_read_us());
+#endif
+	status = _di();
+	cycles = krnl_pcb.sched_cycles;
+	_ei(status);
+
+	return cycles;
+}
+
+#if SCHED_STATS == 1
+/**
+ * @brief Returns scheduler statistics (SCHED_STATS), in cycles.
+ * 
+ * @param id is a task id number (for its wakeup latency)
+ * @param dispatch is a pointer to the dispatcher statistics to be returned (may be NULL)
+ * @param latency is a pointer to the wakeup latency statistics of the task to be returned (may be NULL)
+ * 
+ * @return ERR_OK on success or ERR_INVALID_ID if the referenced task does not exist.
+ * 
+ * The dispatcher statistic covers dispatch_isr() and hf_yield() from their entry to the context restore.
+ * The wakeup latency is the time from a task being made ready (delay expired, resumed or signaled) to
+ * its context being restored. The latency of all tasks is merged on krnl_pcb.latency.
+ */
+int32_t hf_schedstats(uint16_t id, struct sched_stat *dispatch, struct sched_stat *latency)
+{
+	volatile uint32_t status;
+
+#if KERNEL_LOG == 2
+	dprintf("hf_schedstats() %d ", (uint32_t)_read_us());
+#endif
+	if (latency && (id >= MAX_TASKS || !krnl_tcb[id].ptask))
+		return ERR_INVALID_ID;
+	status = _di();
+	if (dispatch)
+		*dispatch = krnl_pcb.dispatch;
+	if (latency)
+		*latency = krnl_tcb[id].latency;
+	_ei(status);
+
+	return ERR_OK;
+}
+#endif
+
+#if STACK_PAINT == 1
+/**
+ * @brief Returns the peak stack usage of a task.
+ * 
+ * @param id is the task id number
+ * 
+ * @return stack usage high water mark in bytes or ERR_INVALID_ID if the referenced task does not exist.
+ * 
+ * Stacks are painted with STACK_PAINT_WORD when tasks are spawned, and the deepest word that
+ * does not hold the pattern anymore marks the peak usage. The stack is scanned from its bottom,
+ * so the call takes longer for tasks that use little of their stacks.
+ */
+int32_t hf_stackusage(uint16_t id)
+{
+	volatile uint32_t status;
+	uint32_t i, words;
+
+#if KERNEL_LOG == 2
+	dprintf("hf_stackusage() %d ", (uint32_t)_read_us());
+#endif
+	status = _di();
+	if (id >= MAX_TASKS || !krnl_tcb[id].ptask){
+		_ei(status);
+		return ERR_INVALID_ID;
+	}
+	words = krnl_tcb[id].stack_size / sizeof(size_t);
+	for (i = 1; i < words && krnl_tcb[id].pstack[i] == STACK_PAINT_WORD; i++);
+	_ei(status);
+
+	return (words - i) * sizeof(size_t);
+}
+#endif
+
+/**
+ * @brief Returns the number of cycles elapsed since boot, as a 64 bit value.
+ * 
+ * @return the 64 bit cycle count.
+ * 
+ * The 32 bit hardware counter is extended in software: a wrap is detected when the counter reads below its
+ * last value. The scheduler tick reads the clock (_timer_reset() calls _read_us()), so no wrap is lost as long
+ * as the tick period is shorter than one counter period. The call takes constant time and may be used from
+ * tasks or interrupt handlers.
+ */
+uint64_t hf_cycles(void)
+{
+	static uint32_t clock_hi = 0, clock_last = 0;
+	volatile uint32_t status;
+	uint32_t now, hi;
+
+	status = _di();
+	now = _readcounter();
+	if (now < clock_last)
+		clock_hi++;
+	clock_last = now;
+	hi = clock_hi;
+	_ei(status);
+
+	return ((uint64_t)hi << 32) | now;
+}
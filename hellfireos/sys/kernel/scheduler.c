@@ -18,29 +18,612 @@
 #include <libc.h>
 #include <kprintf.h>
 #include <queue.h>
+#include <lockstat.h>
+#include <mutex.h>
 #include <kernel.h>
 #include <panic.h>
 #include <scheduler.h>
+#include <group.h>
+#include <governor.h>
+#include <trace.h>
+
+#if SCHED_STATS == 1
+/**
+ * @internal
+ * @brief Adds a sample to a scheduler statistic.
+ *
+ * @param stat is a pointer to the statistic.
+ * @param val is the sample, in cycles.
+ */
+void sched_stat_add(struct sched_stat *stat, uint32_t val)
+{
+	if (!stat->count || val < stat->min)
+		stat->min = val;
+	if (val > stat->max)
+		stat->max = val;
+	stat->sum += val;
+	stat->count++;
+	stat->hist[31 - __builtin_clz(val | 1)]++;
+}
+
+/**
+ * @internal
+ * @brief Marks a task as made ready, so its wakeup latency is accounted when it runs.
+ *
+ * @param task is a pointer to a task control block entry.
+ */
+void sched_stat_wakeup(struct tcb_entry *task)
+{
+	task->woken = 1;
+	task->wakeup_time = _readcounter();
+}
+
+/**
+ * @internal
+ * @brief Accounts the dispatcher cycles and the wakeup latency of the task being dispatched.
+ *
+ * @param start is the cycle count at the dispatcher entry.
+ * @param now is the current cycle count.
+ */
+void sched_stat_dispatch(uint32_t start, uint32_t now)
+{
+	struct tcb_entry *task = &krnl_tcb[krnl_current_task];
+
+	sched_stat_add(&krnl_pcb.dispatch, now - start);
+	if (task->woken){
+		task->woken = 0;
+		sched_stat_add(&task->latency, now - task->wakeup_time);
+		sched_stat_add(&krnl_pcb.latency, now - task->wakeup_time);
+	}
+}
+#endif
+
+static struct tcb_entry *prio_queue[256];		/* per priority circular ready lists (bitmap scheduler) */
+static uint32_t prio_map[8];				/* one bit per priority level, MSB first */
+static uint32_t prio_grp;				/* one bit per non empty prio_map[] word, MSB first */
+static uint16_t delay_tasks;				/* number of tasks on the delay queue */
+#if TICKLESS == 1
+static uint32_t tickless_ticks = 1;			/* ticks elapsed since the last dispatch */
+#endif
+static uint32_t lottery_tree[MAX_TASKS + 1];		/* Fenwick tree of the tickets of ready tasks, by task id + 1 */
+static uint16_t lottery_tickets[MAX_TASKS];		/* tickets held by each task on the tree */
+static uint32_t lottery_total;				/* tickets of all ready best effort tasks */
+static uint32_t lottery_seed = 0x9e3779b9;		/* ticket generator state */
+
+/**
+ * @internal
+ * @brief Adds (or removes, if negative) tickets of a task on the lottery tree.
+ *
+ * @param id is the task id.
+ * @param tickets is the amount of tickets.
+ */
+static void lottery_update(uint16_t id, int32_t tickets)
+{
+	uint32_t i;
+
+	lottery_total += tickets;
+	for (i = id + 1; i <= MAX_TASKS; i += i & -i)
+		lottery_tree[i] += tickets;
+}
+
+/**
+ * @internal
+ * @brief Places a best effort task on the priority ready lists.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is appended to the tail of the circular list of its priority level and
+ * the level is marked on the priority bitmap. Only best effort tasks which are not
+ * blocked nor delayed are placed. The idle task is never placed, as it is the
+ * fallback when the bitmap is empty. Placing an already placed task has no effect.
+ */
+void sched_be_insert(struct tcb_entry *task)
+{
+	struct tcb_entry *head;
+	uint8_t p;
+
+	if (task->rq_next || task->id == 0 || task->period || task->capacity) return;
+	if (task->state == TASK_BLOCKED || task->dq_prev || krnl_delay_list == task) return;
+
+	p = task->priority;
+	head = prio_queue[p];
+	if (head){
+		task->rq_next = head;
+		task->rq_prev = head->rq_prev;
+		head->rq_prev->rq_next = task;
+		head->rq_prev = task;
+	}else{
+		task->rq_next = task;
+		task->rq_prev = task;
+		prio_queue[p] = task;
+		prio_map[p >> 5] |= 0x80000000 >> (p & 31);
+		prio_grp |= 0x80000000 >> (p >> 5);
+	}
+	lottery_tickets[task->id] = 256 - p;
+	lottery_update(task->id, lottery_tickets[task->id]);
+}
+
+/**
+ * @internal
+ * @brief Removes a task from the priority ready lists.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is unlinked from the list of its priority level. If the list becomes empty,
+ * the level is cleared on the priority bitmap. Removing a task which is not placed on
+ * the ready lists has no effect.
+ */
+void sched_be_remove(struct tcb_entry *task)
+{
+	uint8_t p;
+
+	if (!task->rq_next) return;
+
+	p = task->priority;
+	if (task->rq_next == task){
+		prio_queue[p] = NULL;
+		prio_map[p >> 5] &= ~(0x80000000 >> (p & 31));
+		if (!prio_map[p >> 5])
+			prio_grp &= ~(0x80000000 >> (p >> 5));
+	}else{
+		task->rq_prev->rq_next = task->rq_next;
+		task->rq_next->rq_prev = task->rq_prev;
+		if (prio_queue[p] == task)
+			prio_queue[p] = task->rq_next;
+	}
+	task->rq_next = NULL;
+	task->rq_prev = NULL;
+	lottery_update(task->id, -(int32_t)lottery_tickets[task->id]);
+	lottery_tickets[task->id] = 0;
+}
+
+/**
+ * @internal
+ * @brief Blocks a task.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is marked as blocked and a best effort task is taken off the run queue and
+ * the ready lists, so the best effort schedulers only visit runnable tasks. Real time
+ * and aperiodic tasks are kept on their queues, as the period of real time tasks is
+ * accounted by the real time scheduler even while they are blocked.
+ */
+void sched_block(struct tcb_entry *task)
+{
+	int32_t i, j, k;
+
+	if (task->state == TASK_BLOCKED) return;
+	if (!task->period && !task->capacity && !task->dq_prev && krnl_delay_list != task){
+		k = hf_queue_count(krnl_run_queue);
+		for (i = 0; i < k; i++)
+			if (hf_queue_get(krnl_run_queue, i) == task) break;
+		if (!k || i == k) panic(PANIC_NO_TASKS_RUN);
+		for (j = i; j > 0; j--)
+			if (hf_queue_swap(krnl_run_queue, j, j-1)) panic(PANIC_CANT_SWAP);
+		hf_queue_remhead(krnl_run_queue);
+	}
+	task->state = TASK_BLOCKED;
+	sched_be_remove(task);
+}
+
+/**
+ * @internal
+ * @brief Wakes up a task blocked on a synchronization primitive.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * @return 1 if the caller should yield the processor to the woken task, 0 otherwise.
+ *
+ * The task is made ready and placed back on the run queue and on the best effort
+ * ready lists (unless it is still delayed, in which case it is placed back when its
+ * delay expires). Tasks which are not blocked are not affected. With
+ * WAKEUP_BOOST enabled, a best effort task with a higher priority than the current
+ * best effort task is marked as critical, so the next best effort scheduling decision
+ * selects it at once instead of waiting for its turn on the run queue. If the tick was
+ * stopped (TICKLESS), it is started again from the next tick boundary.
+ */
+int32_t sched_wakeup(struct tcb_entry *task)
+{
+#if WAKEUP_BOOST == 1
+	struct tcb_entry *krnl_task2;
+#endif
+
+	if (task->state != TASK_BLOCKED) return 0;
+	if (task->wait_queue){
+		sched_delay_remove(task);
+		task->wait_queue = NULL;
+		task->wait_count = NULL;
+	}
+	task->state = TASK_READY;
+#if TICKLESS == 1
+	if (tickless_ticks > 1)
+		tickless_ticks = _timer_tickless_end();
+#endif
+#if SCHED_STATS == 1
+	sched_stat_wakeup(task);
+#endif
+	if (!task->period && !task->capacity && !task->dq_prev && krnl_delay_list != task)
+		if (hf_queue_addtail(krnl_run_queue, task)) panic(PANIC_CANT_PLACE_RUN);
+	sched_be_insert(task);
+#if WAKEUP_BOOST == 1
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	if (!task->period && !task->capacity && !krnl_task2->period && !krnl_task2->capacity &&
+	task->priority < krnl_task2->priority){
+		task->critical = 1;
+		return 1;
+	}
+#endif
+
+	return 0;
+}
+
+/*
+ * EDF state: RT tasks are indexed by their absolute deadline (the end of the current period,
+ * in ticks). edf_period holds every task on the RT queue and drives the period accounting,
+ * while edf_ready holds only tasks which still have capacity to execute on the period.
+ */
+struct edf_heap {
+	struct tcb_entry *task[MAX_TASKS];		/* binary min-heap of tasks, by absolute deadline */
+	uint16_t pos[MAX_TASKS];			/* heap position + 1 of each task (by id), 0 if absent */
+	int32_t elem;					/* number of tasks on the heap */
+};
+
+static struct edf_heap edf_period, edf_ready;
+static uint32_t edf_deadline[MAX_TASKS];		/* absolute deadline of each task (by id) */
+static uint32_t edf_ticks;				/* ticks processed by the EDF scheduler */
+
+#define EDF_BEFORE(a, b)	((int32_t)(edf_deadline[(a)->id] - edf_deadline[(b)->id]) < 0)
+
+static void edf_place(struct edf_heap *h, int32_t i, struct tcb_entry *task)
+{
+	h->task[i] = task;
+	h->pos[task->id] = i + 1;
+}
+
+static void edf_siftup(struct edf_heap *h, int32_t i)
+{
+	struct tcb_entry *task = h->task[i];
+
+	while (i > 0 && EDF_BEFORE(task, h->task[(i - 1) >> 1])){
+		edf_place(h, i, h->task[(i - 1) >> 1]);
+		i = (i - 1) >> 1;
+	}
+	edf_place(h, i, task);
+}
+
+static void edf_siftdown(struct edf_heap *h, int32_t i)
+{
+	struct tcb_entry *task = h->task[i];
+	int32_t c;
+
+	while ((c = (i << 1) + 1) < h->elem){
+		if (c + 1 < h->elem && EDF_BEFORE(h->task[c + 1], h->task[c]))
+			c++;
+		if (!EDF_BEFORE(h->task[c], task))
+			break;
+		edf_place(h, i, h->task[c]);
+		i = c;
+	}
+	edf_place(h, i, task);
+}
+
+static void edf_push(struct edf_heap *h, struct tcb_entry *task)
+{
+	if (h->pos[task->id]) return;
+	h->elem++;
+	edf_place(h, h->elem - 1, task);
+	edf_siftup(h, h->elem - 1);
+}
+
+static void edf_delete(struct edf_heap *h, struct tcb_entry *task)
+{
+	int32_t i;
+
+	if (!h->pos[task->id]) return;
+	i = h->pos[task->id] - 1;
+	h->pos[task->id] = 0;
+	if (i == --h->elem) return;
+	edf_place(h, i, h->task[h->elem]);
+	edf_siftdown(h, i);
+	edf_siftup(h, h->pos[h->task[i]->id] - 1);
+}
+
+/**
+ * @internal
+ * @brief Places a real time task on the RT queue, keeping rate monotonic order.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is added to the tail of the RT queue and moved towards the head until
+ * it is behind the tasks with a period shorter or equal to its own. Tasks with the
+ * same period keep their arrival order.
+ */
+void sched_rt_insert(struct tcb_entry *task)
+{
+	int32_t i;
+	struct tcb_entry *krnl_task2;
+
+	if (hf_queue_addtail(krnl_rt_queue, task)) panic(PANIC_CANT_PLACE_RT);
+	for (i = hf_queue_count(krnl_rt_queue) - 1; i > 0; i--){
+		krnl_task2 = hf_queue_get(krnl_rt_queue, i - 1);
+		if (krnl_task2->period <= task->period) break;
+		if (hf_queue_swap(krnl_rt_queue, i, i - 1)) panic(PANIC_CANT_SWAP);
+	}
+
+	edf_deadline[task->id] = edf_ticks + task->deadline_rem;
+	edf_push(&edf_period, task);
+	if (task->capacity_rem > 0)
+		edf_push(&edf_ready, task);
+}
+
+/**
+ * @internal
+ * @brief Removes a real time task from the RT queue.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * @return pointer to the removed task.
+ *
+ * The task is moved to the head of the RT queue (the order of the remaining tasks
+ * is preserved) and removed. The remaining time on the current period is kept on
+ * the task deadline_rem field, so the period is resumed when the task is placed back.
+ */
+struct tcb_entry *sched_rt_remove(struct tcb_entry *task)
+{
+	int32_t i, j, k;
+
+	k = hf_queue_count(krnl_rt_queue);
+	for (i = 0; i < k; i++)
+		if (hf_queue_get(krnl_rt_queue, i) == task) break;
+	if (!k || i == k) panic(PANIC_NO_TASKS_RT);
+	for (j = i; j > 0; j--)
+		if (hf_queue_swap(krnl_rt_queue, j, j-1)) panic(PANIC_CANT_SWAP);
+
+	if (edf_period.pos[task->id]){
+		if (sched_rt_edf())
+			task->deadline_rem = edf_deadline[task->id] - edf_ticks;
+		edf_delete(&edf_period, task);
+		edf_delete(&edf_ready, task);
+	}
+
+	return hf_queue_remhead(krnl_rt_queue);
+}
+
+/**
+ * @internal
+ * @brief Ends the current job of a real time task.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The capacity left on the period is given up, so the task is not selected again
+ * (by sched_rma() or sched_edf()) until its next period, when the capacity is
+ * replenished. Finishing early is not a deadline miss.
+ */
+void sched_rt_jobdone(struct tcb_entry *task)
+{
+	task->capacity_rem = 0;
+	task->job_done = 1;
+	edf_delete(&edf_ready, task);
+#if KERNEL_LOG == 3
+	trace_event(TRACE_JOBDONE, task->id);
+#endif
+}
+
+/**
+ * @internal
+ * @brief Places a task on the delay queue.
+ *
+ * @param task is a pointer to a task control block entry.
+ * @param delay is the amount of time (in quantum / tick units), at least one.
+ *
+ * The delay queue is a delta list: tasks are sorted by expiry time and the delay field
+ * of each task holds the number of ticks after the expiry of the previous task on the
+ * list. Tasks with the same expiry time keep their arrival order.
+ */
+void sched_delay_insert(struct tcb_entry *task, uint32_t delay)
+{
+	struct tcb_entry *prev = NULL, *next = krnl_delay_list;
+
+	while (next && next->delay <= delay){
+		delay -= next->delay;
+		prev = next;
+		next = next->dq_next;
+	}
+	task->delay = delay;
+	task->dq_prev = prev;
+	task->dq_next = next;
+	if (next){
+		next->delay -= delay;
+		next->dq_prev = task;
+	}
+	if (prev)
+		prev->dq_next = task;
+	else
+		krnl_delay_list = task;
+	delay_tasks++;
+}
+
+/**
+ * @internal
+ * @brief Removes a task from the delay queue before its delay expires.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * @return remaining delay of the task (in quantum / tick units), or 0 if the task is
+ * not on the delay queue.
+ */
+uint32_t sched_delay_remove(struct tcb_entry *task)
+{
+	struct tcb_entry *krnl_task2;
+	uint32_t delay = 0;
+
+	if (!task->dq_prev && krnl_delay_list != task) return 0;
+
+	for (krnl_task2 = krnl_delay_list; krnl_task2 != task; krnl_task2 = krnl_task2->dq_next)
+		delay += krnl_task2->delay;
+	delay += task->delay;
+
+	if (task->dq_next){
+		task->dq_next->delay += task->delay;
+		task->dq_next->dq_prev = task->dq_prev;
+	}
+	if (task->dq_prev)
+		task->dq_prev->dq_next = task->dq_next;
+	else
+		krnl_delay_list = task->dq_next;
+	task->dq_next = NULL;
+	task->dq_prev = NULL;
+	task->delay = 0;
+	delay_tasks--;
+
+	return delay;
+}
+
+/**
+ * @internal
+ * @brief Takes a task off the queue of the timed wait it is blocked on.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is moved to the head of the wait queue (the order of the remaining tasks
+ * is preserved) and removed. The wait counter, if any, is incremented, giving back the
+ * unit taken by the task when it started to wait.
+ */
+void sched_wait_remove(struct tcb_entry *task)
+{
+	int32_t i, j, k;
+
+	k = hf_queue_count(task->wait_queue);
+	for (i = 0; i < k; i++)
+		if (hf_queue_get(task->wait_queue, i) == task) break;
+	if (i < k){
+		for (j = i; j > 0; j--)
+			if (hf_queue_swap(task->wait_queue, j, j-1)) panic(PANIC_CANT_SWAP);
+		hf_queue_remhead(task->wait_queue);
+		if (task->wait_count)
+			(*task->wait_count)++;
+	}
+	task->wait_queue = NULL;
+	task->wait_count = NULL;
+}
 
 static void process_delay_queue(void)
+{
+	struct tcb_entry *krnl_task2;
+#if TICKLESS == 1
+	uint32_t ticks;
+
+	ticks = tickless_ticks;
+	tickless_ticks = 1;
+	if (!krnl_delay_list) return;
+	if (krnl_delay_list->delay > ticks)
+		krnl_delay_list->delay -= ticks;
+	else
+		krnl_delay_list->delay = 0;
+#else
+	if (!krnl_delay_list) return;
+	krnl_delay_list->delay--;
+#endif
+	while ((krnl_task2 = krnl_delay_list) && krnl_task2->delay == 0){
+		krnl_delay_list = krnl_task2->dq_next;
+		if (krnl_delay_list)
+			krnl_delay_list->dq_prev = NULL;
+		krnl_task2->dq_next = NULL;
+		delay_tasks--;
+		if (krnl_task2->wait_queue){
+			sched_wait_remove(krnl_task2);
+			krnl_task2->timedout = 1;
+			sched_wakeup(krnl_task2);
+			continue;
+		}
+		if (krnl_task2->state == TASK_DELAYED)
+			krnl_task2->state = TASK_READY;
+#if SCHED_STATS == 1
+		if (krnl_task2->state == TASK_READY)
+			sched_stat_wakeup(krnl_task2);
+#endif
+		if (krnl_task2->period){
+			sched_rt_insert(krnl_task2);
+		}else if (krnl_task2->capacity){
+			if (hf_queue_addtail(krnl_aperiodic_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RT);
+		}else if (krnl_task2->state != TASK_BLOCKED){
+			if (hf_queue_addtail(krnl_run_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RUN);
+			sched_be_insert(krnl_task2);
+		}
+	}
+}
+
+#if TICKLESS == 1
+/**
+ * @internal
+ * @brief Stops the periodic tick while all tasks (but the idle task) are delayed.
+ *
+ * When the idle task is selected and every other task is on the delay queue, nothing can
+ * run before the first delay expires. In this case, the timer is programmed to interrupt
+ * only when the task at the head of the delay queue expires, and the skipped ticks are
+ * accounted for on the next dispatch. Ready real time and aperiodic tasks are not on the
+ * delay queue, so they keep the tick running. If an interrupt makes a task ready before
+ * that, sched_wakeup() programs the timer to the next tick boundary, and only the ticks
+ * elapsed up to it are accounted.
+ */
+static void tickless_idle(void)
+{
+	if (krnl_current_task || !krnl_delay_list || delay_tasks != krnl_tasks - 1) return;
+	if (krnl_delay_list->delay > 1)
+		tickless_ticks = _timer_tickless(krnl_delay_list->delay);
+}
+#endif
+
+/**
+ * @internal
+ * @brief Selects the aperiodic job to be executed on the aperiodic server time.
+ *
+ * @return pointer to the first non blocked task on the aperiodic queue (in arrival
+ * order), or NULL if there is no pending aperiodic work.
+ */
+static struct tcb_entry *server_next(void)
 {
 	int32_t i, k;
 	struct tcb_entry *krnl_task2;
 
-	k = hf_queue_count(krnl_delay_queue);
+	k = hf_queue_count(krnl_aperiodic_queue);
 	for (i = 0; i < k; i++){
-		krnl_task2 = hf_queue_remhead(krnl_delay_queue);
-		if (!krnl_task2) panic(PANIC_NO_TASKS_DELAY);
-		if (--krnl_task2->delay == 0){
-			if (krnl_task2->period){
-				if (hf_queue_addtail(krnl_rt_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RT);
-			}else{
-				if (hf_queue_addtail(krnl_run_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RUN);
-			}
-		}else{
-			if (hf_queue_addtail(krnl_delay_queue, krnl_task2)) panic(PANIC_CANT_PLACE_DELAY);
-		}
+		krnl_task2 = hf_queue_get(krnl_aperiodic_queue, i);
+		if (krnl_task2->state != TASK_BLOCKED)
+			return krnl_task2;
 	}
+
+	return NULL;
+}
+
+/**
+ * @internal
+ * @brief Selects the task to be executed on behalf of a real time task.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * @return the task itself if it is not blocked. If the task is blocked waiting for a mutex
+ * (MUTEX_TYPE 2), the owner of the mutex (or the owner of the mutex the owner is waiting
+ * for, and so on) inherits the task time, so it is returned if it can execute. Otherwise,
+ * NULL is returned.
+ */
+static struct tcb_entry *sched_inherit(struct tcb_entry *task)
+{
+#if MUTEX_TYPE == 2
+	int32_t i;
+#endif
+
+	if (task->state != TASK_BLOCKED)
+		return task;
+#if MUTEX_TYPE == 2
+	for (i = 0; i < MAX_TASKS && task->mtx_wait; i++){
+		task = &krnl_tcb[task->mtx_wait->owner];
+		if (task->state != TASK_BLOCKED)
+			return task->dq_prev || krnl_delay_list == task ? NULL : task;
+	}
+#endif
+
+	return NULL;
 }
 
 static void run_queue_next()
@@ -52,61 +635,95 @@ static void run_queue_next()
 		panic(PANIC_CANT_PLACE_RUN);
 }
 
-static void rt_queue_next()
-{
-	krnl_task = hf_queue_remhead(krnl_rt_queue);
-	if (!krnl_task)
-		panic(PANIC_NO_TASKS_RT);
-	if (hf_queue_addtail(krnl_rt_queue, krnl_task))
-		panic(PANIC_CANT_PLACE_RT);
-}
-
 
 /**
  * @brief Task dispatcher.
  *
- * The job of the dispatcher is simple: save the current task context on the TCB,
- * update its state to ready and check its stack for overflow. If there are
- * tasks to be scheduled, process the delay queue and invoke the real-time scheduler.
- * If no RT tasks are ready to be scheduled, invoke the best effort scheduler.
- * Update the scheduled task state to running and restore the context of the task.
- *
- * Delayed tasks are in the delay queue, and are processed in the following way:
- *	- The number of elements (tasks) in queue is counted;
- *	- The a task from the head of the queue is removed and its delay is decremented;
- * 		- If the decremented delay of a task reaches 0, it is put on RT or BE run queue;
- * 		- It is put it back on the tail of the delay queue otherwise;
- *	- Repeat until the whole queue is processed;
+ * The job of the dispatcher is simple: update the current task state to ready and
+ * check its stack for overflow. If there are tasks to be scheduled, process the delay
+ * queue and invoke the real-time scheduler. If no RT tasks are ready to be scheduled,
+ * invoke the best effort scheduler. Update the scheduled task state to running and, if
+ * it is not the task that was running, save the current task context on the TCB and
+ * restore the context of the scheduled task. When the running task is selected again,
+ * the dispatcher just returns from the interrupt (no context is saved or restored).
+ *
+ * Delayed tasks are in the delay queue (a delta list sorted by expiry time), and are
+ * processed in the following way:
+ *	- The delay of the task at the head of the queue is decremented;
+ *	- While the delay of the task at the head of the queue is 0, it is removed and
+ *	  put on RT or BE run queue;
+ *	- Only expiring tasks are touched, no matter how many tasks are delayed;
+ *
+ * With IRQ_NESTING, device interrupts are enabled during the scheduling decision, so
+ * they are not delayed by it. The scheduler may be walking the kernel queues, so the
+ * sources whose handlers change them (by waking up tasks or signaling semaphores, as
+ * declared by drivers with _irq_wakeup()) are kept masked meanwhile.
+ *
+ * The cycles run since the last dispatch are charged to the preempted task, and the
+ * time spent on the dispatcher itself is accounted on the PCB (sched_cycles). The clock
+ * governor (governor.c), when running, is called on every tick with the cycle count.
  */
 
 void dispatch_isr(void *arg)
 {
-	int32_t rc;
+	struct tcb_entry *prev;
+	uint32_t now;
 
-#if KERNEL_LOG >= 1
+#if KERNEL_LOG == 3
+	trace_event(TRACE_DISPATCH, 0);
+#elif KERNEL_LOG >= 1
 	dprintf("dispatch %d ", (uint32_t)_read_us());
 #endif
 	_timer_reset();
 	if (krnl_schedule == 0) return;
+	krnl_resched = 0;
 	krnl_task = &krnl_tcb[krnl_current_task];
-	rc = setjmp(krnl_task->task_context);
-	if (rc){
-		return;
-	}
+	prev = krnl_task;
+	now = _readcounter();
+	krnl_task->cycles += now - krnl_pcb.cycles_last;
+	sched_group_charge(krnl_task, now - krnl_pcb.cycles_last);
 	if (krnl_task->state == TASK_RUNNING)
 		krnl_task->state = TASK_READY;
 	if (krnl_task->pstack[0] != STACK_MAGIC)
 		panic(PANIC_STACK_OVERFLOW);
+#if TICKLESS == 1
+	sched_governor(now, tickless_ticks);
+#else
+	sched_governor(now, 1);
+#endif
 	if (krnl_tasks > 0){
+#if IRQ_NESTING == 1
+		_irq_sched_open();
+#endif
 		process_delay_queue();
-		krnl_current_task = krnl_pcb.sched_rt();
+		sched_group_replenish(now);
+		krnl_current_task = sched_rt_call();
 		if (krnl_current_task == 0)
-			krnl_current_task = krnl_pcb.sched_be();
+			krnl_current_task = sched_be_pick();
+#if TICKLESS == 1
+		tickless_idle();
+#endif
+#if IRQ_NESTING == 1
+		_irq_sched_close();
+#endif
 		krnl_task->state = TASK_RUNNING;
 		krnl_pcb.preempt_cswitch++;
-#if KERNEL_LOG >= 1
+		krnl_pcb.cycles_last = _readcounter();
+		krnl_pcb.sched_cycles += krnl_pcb.cycles_last - now;
+#if SCHED_STATS == 1
+		sched_stat_dispatch(now, krnl_pcb.cycles_last);
+#endif
+#if KERNEL_LOG == 3
+		trace_event(TRACE_RUN, 0);
+#elif KERNEL_LOG >= 1
 		dprintf("\n%d %d %d %d %d ", krnl_current_task, krnl_task->period, krnl_task->capacity, krnl_task->deadline, (uint32_t)_read_us());
 #endif
+		if (krnl_task == prev){
+			krnl_pcb.same_cswitch++;
+			return;
+		}
+		if (setjmp(prev->task_context))
+			return;
 		_restoreexec(krnl_task->task_context, 1, krnl_current_task);
 		panic(PANIC_UNKNOWN);
 	}else{
@@ -114,43 +731,129 @@ void dispatch_isr(void *arg)
 	}
 }
 
-void dispatch_aperiodics()
+/**
+ * @internal
+ * @brief Reschedules at the end of an interrupt, if a handler woke up a task.
+ *
+ * Called by the interrupt handler of the architecture, with interrupts disabled, after
+ * all pending sources were served. If hf_sempost_isr() woke up a best effort task while the
+ * idle task was running, or a task of a higher priority than the interrupted best effort
+ * task with a scheduler which honors the critical flag (see hf_sempost_isr()), the best
+ * effort scheduler is invoked and the selected task (the woken one) is dispatched at once,
+ * instead of on the next tick. The tick work (timer, delay
+ * queue and real time scheduler) is left to dispatch_isr(), so real time tasks are never
+ * preempted here.
+ */
+void dispatch_resched(void)
 {
-	kprintf("tamanho da fila atual: %d\n", hf_queue_count(krnl_aperiodic_queue));
-	struct aperiodic_entry *krnl_task2;
-	int32_t rc;
-#if KERNEL_LOG >= 1
-	dprintf("dispatch %d ", (uint32_t)_read_us());
-#endif
-	_timer_reset();
-	if (krnl_schedule == 0) return;
+	struct tcb_entry *prev;
+	uint32_t now;
+
+	if (!krnl_resched || !krnl_schedule)
+		return;
+	krnl_resched = 0;
 	krnl_task = &krnl_tcb[krnl_current_task];
-	// krnl_task = &krnl_tcb[hf_selfid()];
-	kprintf("krnl_task->id: %d", krnl_task->id);
-	rc = setjmp(krnl_task->task_context);
-	if (rc){
+	prev = krnl_task;
+	if (prev->period || prev->capacity)
 		return;
-	}
+	now = _readcounter();
+	krnl_task->cycles += now - krnl_pcb.cycles_last;
+	sched_group_charge(krnl_task, now - krnl_pcb.cycles_last);
 	if (krnl_task->state == TASK_RUNNING)
 		krnl_task->state = TASK_READY;
 	if (krnl_task->pstack[0] != STACK_MAGIC)
 		panic(PANIC_STACK_OVERFLOW);
-	if (krnl_tasks > 0){
-		process_delay_queue();
-		krnl_task2 = hf_queue_remhead(krnl_aperiodic_queue);
-		krnl_current_task = krnl_task2->id;
-		if (krnl_current_task == 0)
-			panic(PANIC_NO_TASKS_LEFT);
-		krnl_task2->state = TASK_RUNNING;
-		krnl_pcb.preempt_cswitch++;
-#if KERNEL_LOG >= 1
-		dprintf("\n%d %d %d %d %d ", krnl_current_task, krnl_task2->period, krnl_task2->capacity, krnl_task2->deadline, (uint32_t)_read_us());
+	krnl_current_task = sched_be_pick();
+	krnl_task->state = TASK_RUNNING;
+	krnl_pcb.preempt_cswitch++;
+	krnl_pcb.cycles_last = _readcounter();
+	krnl_pcb.sched_cycles += krnl_pcb.cycles_last - now;
+#if SCHED_STATS == 1
+	sched_stat_dispatch(now, krnl_pcb.cycles_last);
 #endif
-		_restoreexec(krnl_task2->task_context, 1, krnl_current_task);
-		panic(PANIC_UNKNOWN);
-	}else{
-		panic(PANIC_NO_TASKS_LEFT);
+#if KERNEL_LOG == 3
+	trace_event(TRACE_RUN, 0);
+#endif
+	if (krnl_task == prev){
+		krnl_pcb.same_cswitch++;
+		return;
 	}
+	if (setjmp(prev->task_context))
+		return;
+	_restoreexec(krnl_task->task_context, 1, krnl_current_task);
+	panic(PANIC_UNKNOWN);
+}
+
+/**
+ * @internal
+ * @brief Selects the highest priority ready task in no group or in a group with budget
+ * left, for the bitmap scheduler.
+ *
+ * @return Best effort task id, 0 (the idle task) if no such task is ready.
+ *
+ * Non empty levels are visited from the highest priority down, and the list of each level
+ * is walked once, skipping the tasks of groups out of budget. The head of the level is
+ * advanced past the selected task, so the tasks of a level keep taking turns.
+ */
+static int32_t sched_bitmap_eligible(void)
+{
+	struct tcb_entry *task;
+	uint32_t g, p, grp, map;
+
+	for (grp = prio_grp; grp; grp &= ~(0x80000000 >> g)){
+		g = __builtin_clz(grp);
+		for (map = prio_map[g]; map; map &= ~(0x80000000 >> (p & 31))){
+			p = (g << 5) + __builtin_clz(map);
+			task = prio_queue[p];
+			do {
+				if (sched_group_eligible(task)){
+					prio_queue[p] = task->rq_next;
+					krnl_task = task;
+					krnl_task->critical = 0;
+					krnl_task->bgjobs++;
+
+					return krnl_task->id;
+				}
+				task = task->rq_next;
+			} while (task != prio_queue[p]);
+		}
+	}
+	krnl_task = &krnl_tcb[0];
+
+	return 0;
+}
+
+/**
+ * @internal
+ * @brief Selects a best effort task, skipping tasks of groups out of budget.
+ *
+ * @return Best effort task id.
+ *
+ * The best effort scheduler is invoked until it selects a task which is in no group or
+ * in a group with budget left (see group.c), at most once per task on the run queue (so
+ * every runnable task is visited by the round robin schedulers). The bitmap scheduler only
+ * takes turns within the highest priority level, so its ready lists are searched instead,
+ * down to the lower levels. If no such task is found, the idle task is selected. With no
+ * task groups, this is just a call to the scheduler.
+ */
+int32_t sched_be_pick(void)
+{
+	int32_t i, k, id;
+
+	id = sched_be_call();
+	if (sched_group_eligible(krnl_task))
+		return id;
+	if (sched_be_bitmap())
+		return sched_bitmap_eligible();
+	k = hf_queue_count(krnl_run_queue);
+	for (i = 0; i < k; i++){
+		id = sched_be_call();
+		if (sched_group_eligible(krnl_task))
+			return id;
+	}
+	krnl_task = &krnl_tcb[0];
+
+	return 0;
 }
 
 /**
@@ -160,20 +863,16 @@ void dispatch_aperiodics()
  *
  * The algorithm is Round Robin.
  * 	- Take a task from the run queue, copy its entry and put it back at the tail of the run queue.
- * 	- If the task is in the blocked state (it may be simply blocked or waiting in a semaphore), it is
- * 	  put back at the tail of the run queue and the next task is picked up.
+ * 	- Tasks in the blocked state (they may be simply blocked or waiting in a semaphore) are
+ *	  not on the run queue (sched_block()), so the task taken is always runnable.
  * 	- So, if all tasks are blocked, at least the idle task can execute (it is never
  *	  blocked, at least it is what we hope!).
- * 	- Tasks in the blocked state are never removed from the run queue (they are
- *	  ignored), although they may be in another queue waiting for a resource.
  */
 int32_t sched_rr(void)
 {
 	if (hf_queue_count(krnl_run_queue) == 0)
 		panic(PANIC_NO_TASKS_RUN);
-	do {
-		run_queue_next();
-	} while (krnl_task->state == TASK_BLOCKED);
+	run_queue_next();
 	krnl_task->bgjobs++;
 
 	return krnl_task->id;
@@ -184,21 +883,32 @@ int32_t sched_rr(void)
  *
  * @return Best effort task id.
  *
- * The algorithm is Lottery Scheduling.
- * 	- Take a task from the run queue, copy its entry and put it back at the tail of the run queue.
- * 	- If the task is in the blocked state (it may be simply blocked or waiting in a semaphore) or
- * its not the ticket, it is put back at the tail of the run queue and the next task is picked up.
+ * The algorithm is Lottery Scheduling, with proportional shares.
+ * 	- Each ready (non blocked, non delayed) best effort task holds 256 - priority tickets,
+ * 	  so a task with priority 100 gets about 1.56 times the processor of a task with priority 156.
+ * 	- Tickets are kept on a Fenwick (binary indexed) tree by task id, updated as tasks are
+ * 	  placed on and removed from the ready lists (sched_be_insert() / sched_be_remove()).
+ * 	- A ticket is drawn (without a modulo) from a generator state of its own (the scheduler runs
+ * 	  with interrupts disabled), and the winner is found descending the tree, in O(log n).
+ * 	- If no task is ready, the idle task is selected.
  */
 int32_t sched_lottery(void)
 {
-	int32_t r, i = 0;
+	uint32_t r, pos = 0, step;
 
-	r = random() % krnl_tasks;
-	if (hf_queue_count(krnl_run_queue) == 0)
-		panic(PANIC_NO_TASKS_RUN);
-	do {
-		run_queue_next();
-	} while ((krnl_task->state == TASK_BLOCKED) || ((i++ % krnl_tasks) != r));
+	if (lottery_total){
+		r = random_below_r(&lottery_seed, lottery_total);
+		for (step = 0x80000000 >> __builtin_clz(MAX_TASKS); step; step >>= 1){
+			if (pos + step <= MAX_TASKS && lottery_tree[pos + step] <= r){
+				pos += step;
+				r -= lottery_tree[pos];
+			}
+		}
+		krnl_task = &krnl_tcb[pos];
+		krnl_task->critical = 0;
+	}else{
+		krnl_task = &krnl_tcb[0];
+	}
 	krnl_task->bgjobs++;
 
 	return krnl_task->id;
@@ -211,7 +921,8 @@ int32_t sched_lottery(void)
  *
  * The algorithm is priority based Round Robin.
  * 	- Take the first task and put it at the end of the run queue (to advance the queue and avoid deadlocks)
- * 	- Perform a run in the queue, searching for the task with the highest priority (non blocked, lowest remaining priority)
+ * 	- Perform a run in the queue, searching for the task with the highest priority (lowest remaining priority,
+ * 	  blocked tasks are not on the run queue)
  * 		- While we are at it, check if there is a critical task. If so, schedule it, and get out.
  * 	- Perform another run in the queue, updating the remaining priorities of all tasks by subtracting the priority
  * 	  of the task with the lowest remaining priority (task with the highest priority) from the remaining priority of
@@ -234,11 +945,11 @@ int32_t sched_priorityrr(void)
 	for (i = 0; i < k; i++){
 		run_queue_next();
 		/* critical event, bypass the queue */
-		if (krnl_task->critical && krnl_task->state != TASK_BLOCKED){
+		if (krnl_task->critical){
 			krnl_task->critical = 0;
 			goto done;
 		}
-		if (highestp > krnl_task->priority_rem && krnl_task->state != TASK_BLOCKED){
+		if (highestp > krnl_task->priority_rem){
 			highestp = krnl_task->priority_rem;
 			krnl_task2 = krnl_task;
 		}
@@ -259,50 +970,94 @@ done:
 	return krnl_task->id;
 }
 
+/**
+ * @brief Best effort (BE) scheduler.
+ *
+ * @return Best effort task id.
+ *
+ * The algorithm is priority based Round Robin, in constant time.
+ * 	- Ready (non blocked, non delayed) best effort tasks are kept on a circular list per
+ * 	  priority level, and non empty levels are marked on a two level priority bitmap.
+ * 	- The highest priority level (lowest priority value) is found with two count leading
+ * 	  zeros operations on the bitmap, and the task at the head of its list is selected.
+ * 	- The head of the list is advanced, so tasks with the same priority share the processor
+ * 	  in a round robin fashion.
+ * 	- If no task is ready, the idle task is selected.
+ *
+ * Unlike sched_priorityrr(), priorities are strict: a lower priority task only executes when
+ * all higher priority tasks are blocked or delayed. Selection cost does not depend on the number
+ * of tasks in the system, nor on how many of them are blocked.
+ */
+int32_t sched_bitmap(void)
+{
+	uint32_t g, p;
+
+	if (prio_grp){
+		g = __builtin_clz(prio_grp);
+		p = (g << 5) + __builtin_clz(prio_map[g]);
+		krnl_task = prio_queue[p];
+		prio_queue[p] = krnl_task->rq_next;
+		krnl_task->critical = 0;
+	}else{
+		krnl_task = &krnl_tcb[0];
+	}
+	krnl_task->bgjobs++;
+
+	return krnl_task->id;
+}
+
 /**
  * @brief Real time (RT) scheduler.
  *
  * @return Real time task id.
  *
  * The scheduling algorithm is Rate Monotonic.
- * 	- Sort the queue of RT tasks by period;
- * 	- Update real time information (remaining deadline and capacity) of the
- * whole task set.
- * 	- If the task at the head of the queue fits the requirements to be scheduled
- * (not blocked, has jobs to execute and no task with higher priority according to RM
- * was selected) then register the task to be scheduled.
+ * 	- The queue of RT tasks is kept sorted by period when tasks are placed on it
+ * (sched_rt_insert()), so no sorting is performed here;
+ * 	- Walk the queue from the head (shortest period) updating real time information
+ * (remaining deadline and capacity) of the whole task set.
+ * 	- The first task that fits the requirements to be scheduled (not blocked, has jobs
+ * to execute) is the one with the highest priority according to RM, so it is registered
+ * to be scheduled. If it is blocked on a mutex, the mutex owner executes instead.
+ * 	- The aperiodic server (krnl_server) is scheduled as any other RT task, but its time
+ * is given to the first pending aperiodic task. The server is a deferrable server: its
+ * capacity is only consumed when aperiodic work is executed, it is preserved while there
+ * is no aperiodic work pending and it is replenished at the end of its period (unused
+ * capacity is not a deadline miss).
  */
 
 int32_t sched_rma(void)
 {
-	int32_t i, j, k;
+	int32_t i, k;
 	uint16_t id = 0;
-	struct tcb_entry *e1, *e2;
+	struct tcb_entry *krnl_task2;
 
 	k = hf_queue_count(krnl_rt_queue);
 	if (k == 0)
 		return 0;
 
-	for (i = 0; i < k-1; i++){
-		for (j = i + 1; j < k; j++){
-			e1 = hf_queue_get(krnl_rt_queue, i);
-			e2 = hf_queue_get(krnl_rt_queue, j);
-			if (e1->period > e2->period)
-				if (hf_queue_swap(krnl_rt_queue, i, j))
-					panic(PANIC_CANT_SWAP);
-		}
-	}
-
 	for (i = 0; i < k; i++){
-		rt_queue_next();
-		if (krnl_task->state != TASK_BLOCKED && krnl_task->capacity_rem > 0 && !id){
-			id = krnl_task->id;
-			--krnl_task->capacity_rem;
+		krnl_task = hf_queue_get(krnl_rt_queue, i);
+		if (krnl_task->capacity_rem > 0 && !id){
+			krnl_task2 = krnl_task == krnl_server ? server_next() : sched_inherit(krnl_task);
+			if (krnl_task2){
+				id = krnl_task2->id;
+				--krnl_task->capacity_rem;
+			}
 		}
 		if (--krnl_task->deadline_rem == 0){
 			krnl_task->deadline_rem = krnl_task->period;
-			if (krnl_task->capacity_rem > 0) krnl_task->deadline_misses++;
+			if (krnl_task->capacity_rem > 0 && krnl_task != krnl_server){
+				krnl_task->deadline_misses++;
+#if KERNEL_LOG == 3
+				trace_event(TRACE_MISS, krnl_task->id);
+#endif
+			}
 			krnl_task->capacity_rem = krnl_task->capacity;
+			sched_gov_release(krnl_task);
+#if KERNEL_LOG == 3
+			trace_event(TRACE_RELEASE, krnl_task->id);
+#endif
 		}
 	}
 
@@ -317,10 +1072,86 @@ int32_t sched_rma(void)
 	}
 }
 
-struct krnl_aperiodic_entry* polling_server_scheduler(void)
+/**
+ * @brief Real time (RT) scheduler.
+ *
+ * @return Real time task id.
+ *
+ * The scheduling algorithm is Earliest Deadline First.
+ * 	- RT tasks are kept on two binary heaps, ordered by absolute deadline (the
+ * end of the current period): one with the whole RT task set and another with
+ * tasks that still have capacity left on their period (sched_rt_insert()).
+ * 	- The task with the earliest deadline which is not blocked is registered to
+ * be scheduled, and its remaining capacity is decremented. If the capacity is
+ * exhausted, the task leaves the ready heap until its next period.
+ * 	- Tasks that reach the end of their period are taken from the head of the
+ * whole set heap: a deadline miss is accounted if capacity is left (just as in
+ * sched_rma()), capacity and deadline are replenished and the task is placed
+ * back on both heaps.
+ *
+ * Each decision is O(log n) on the number of RT tasks, plus the cost of skipping
+ * blocked tasks with earlier deadlines. Remaining deadlines (deadline_rem) are
+ * updated for the selected task and on period boundaries. The scheduler should
+ * be selected before the system starts scheduling, as in app_main().
+ *
+ * The aperiodic server is handled as in sched_rma(): its time is given to pending
+ * aperiodic tasks, and it is skipped (keeping its capacity) when there are none.
+ */
+int32_t sched_edf(void)
 {
-  struct krnl_aperiodic_entry *next_task;
-  next_task = hf_queue_remhead(krnl_aperiodic_queue);
+	struct tcb_entry *skipped[MAX_TASKS];
+	struct tcb_entry *krnl_task2, *krnl_task3;
+	int32_t i, k = 0;
+	uint16_t id = 0;
+
+	if (edf_period.elem == 0)
+		return 0;
+
+	while (edf_ready.elem){
+		krnl_task2 = edf_ready.task[0];
+		krnl_task3 = krnl_task2 == krnl_server ? server_next() : sched_inherit(krnl_task2);
+		if (krnl_task3){
+			id = krnl_task3->id;
+			krnl_task2->deadline_rem = edf_deadline[krnl_task2->id] - edf_ticks;
+			if (--krnl_task2->capacity_rem == 0)
+				edf_delete(&edf_ready, krnl_task2);
+			break;
+		}
+		skipped[k++] = krnl_task2;
+		edf_delete(&edf_ready, krnl_task2);
+	}
+	for (i = 0; i < k; i++)
+		edf_push(&edf_ready, skipped[i]);
+
+	edf_ticks++;
+	while (edf_period.elem && (int32_t)(edf_deadline[edf_period.task[0]->id] - edf_ticks) <= 0){
+		krnl_task2 = edf_period.task[0];
+		if (krnl_task2->capacity_rem > 0 && krnl_task2 != krnl_server){
+			krnl_task2->deadline_misses++;
+#if KERNEL_LOG == 3
+			trace_event(TRACE_MISS, krnl_task2->id);
+#endif
+		}
+		krnl_task2->capacity_rem = krnl_task2->capacity;
+		sched_gov_release(krnl_task2);
+#if KERNEL_LOG == 3
+		trace_event(TRACE_RELEASE, krnl_task2->id);
+#endif
+		krnl_task2->deadline_rem = krnl_task2->period;
+		edf_deadline[krnl_task2->id] = edf_ticks + krnl_task2->period;
+		edf_siftdown(&edf_period, 0);
+		edf_delete(&edf_ready, krnl_task2);
+		if (krnl_task2->capacity_rem > 0)
+			edf_push(&edf_ready, krnl_task2);
+	}
 
-  return next_task;
+	if (id){
+		krnl_task = &krnl_tcb[id];
+		krnl_task->rtjobs++;
+		return id;
+	}else{
+		/* no RT task to run */
+		krnl_task = &krnl_tcb[0];
+		return 0;
+	}
 }
@@ -22,15 +22,160 @@
 #include <kernel.h>
 #include <panic.h>
 #include <scheduler.h>
+#include <group.h>
+#include <governor.h>
 #include <task.h>
+#include <lockstat.h>
+#include <mutex.h>
+#include <arena.h>
+#include <trace.h>
 #include <ecodes.h>
 
+#define NAME_HASH_SIZE	32				/* task name hash buckets (power of two) */
+
+static uint32_t tcb_map[(MAX_TASKS + 31) / 32];		/* one bit per used TCB slot */
+static uint16_t name_hash[NAME_HASH_SIZE];		/* first task (id + 1) on each bucket, 0 if empty */
+static uint16_t name_next[MAX_TASKS];			/* next task (id + 1) on the same bucket */
+static void (*kill_hooks[KILL_HOOKS])(uint16_t id);	/* resource release functions (hf_killhook()) */
+
+/**
+ * @internal
+ * @brief Allocates the free TCB slot with the lowest id.
+ *
+ * @return slot (task id) or MAX_TASKS if all slots are in use.
+ */
+static uint16_t tcb_alloc(void)
+{
+	uint16_t i, j;
+
+	for (i = 0; i < (MAX_TASKS + 31) / 32; i++){
+		if (~tcb_map[i]){
+			j = (i << 5) + __builtin_ctz(~tcb_map[i]);
+			if (j >= MAX_TASKS) break;
+			tcb_map[i] |= 1U << (j & 31);
+			return j;
+		}
+	}
+
+	return MAX_TASKS;
+}
+
+static void tcb_free(uint16_t id)
+{
+	tcb_map[id >> 5] &= ~(1U << (id & 31));
+}
+
+static uint8_t name_hash_key(int8_t *name)
+{
+	uint32_t h = 5381;
+	int32_t i;
+
+	for (i = 0; i < sizeof(krnl_tcb[0].name) && name[i]; i++)
+		h = (h << 5) + h + name[i];
+
+	return h & (NAME_HASH_SIZE - 1);
+}
+
+static void name_hash_add(uint16_t id)
+{
+	uint8_t k;
+
+	k = name_hash_key(krnl_tcb[id].name);
+	name_next[id] = name_hash[k];
+	name_hash[k] = id + 1;
+}
+
+static void name_hash_del(uint16_t id)
+{
+	uint16_t *p;
+
+	p = &name_hash[name_hash_key(krnl_tcb[id].name)];
+	while (*p && *p != id + 1)
+		p = &name_next[*p - 1];
+	if (*p)
+		*p = name_next[id];
+	name_next[id] = 0;
+}
+
+#if STACK_POOL > 0
+#define STACK_CLASS_MIN	512				/* smallest pooled stack size, in bytes */
+#define STACK_CLASSES	6				/* pooled stack sizes: 512 to 16384 bytes */
+
+static size_t *stack_pool[STACK_CLASSES];		/* free stacks of each size class, linked by the second word */
+static uint16_t stack_pool_count[STACK_CLASSES];	/* number of free stacks of each size class */
+
+/**
+ * @internal
+ * @brief Allocates a task stack from the stack pool.
+ *
+ * @param size is a pointer to the required stack size, updated to the allocated size.
+ *
+ * @return pointer to the stack area or NULL if out of memory.
+ *
+ * Sizes up to the largest class are rounded up to a power of two size class. A free
+ * stack of that class is reused if available, otherwise a new stack is taken from the
+ * heap. Larger stacks are not pooled.
+ */
+static size_t *stack_alloc(uint32_t *size)
+{
+	size_t *stack;
+	uint32_t c, csize;
+
+	for (c = 0, csize = STACK_CLASS_MIN; c < STACK_CLASSES; c++, csize <<= 1)
+		if (*size <= csize) break;
+	if (c == STACK_CLASSES)
+		return (size_t *)hf_malloc(*size);
+
+	*size = csize;
+	stack = stack_pool[c];
+	if (stack){
+		stack_pool[c] = (size_t *)stack[1];
+		stack_pool_count[c]--;
+		return stack;
+	}
+
+	return (size_t *)hf_malloc(csize);
+}
+
+/**
+ * @internal
+ * @brief Returns a task stack to the stack pool.
+ *
+ * @param stack is a pointer to the stack area.
+ * @param size is the stack size, as returned by stack_alloc().
+ *
+ * Up to STACK_POOL free stacks are kept for each size class, the others are given back
+ * to the heap. The link to the next free stack is kept on the second word: a task which
+ * kills itself still runs on its stack until hf_yield() switches away from it, and the
+ * first word must keep STACK_MAGIC for the overflow checks until then.
+ */
+static void stack_free(size_t *stack, uint32_t size)
+{
+	uint32_t c, csize;
+
+	for (c = 0, csize = STACK_CLASS_MIN; c < STACK_CLASSES; c++, csize <<= 1)
+		if (size == csize) break;
+	if (c == STACK_CLASSES || stack_pool_count[c] >= STACK_POOL){
+		hf_free(stack);
+		return;
+	}
+
+	stack[1] = (size_t)stack_pool[c];
+	stack_pool[c] = stack;
+	stack_pool_count[c]++;
+}
+#endif
+
 /**
  * @brief Get a task id by its name.
  *
  * @param name is a pointer to an array holding the task name.
  *
  * @return task id if the task is found and ERR_INVALID_NAME otherwise.
+ *
+ * Names are kept on a hash index by hf_spawn() and hf_kill(), so the search does
+ * not depend on the number of tasks. If more than one task has the same name, the
+ * most recently spawned is found.
  */
 int32_t hf_id(int8_t *name)
 {
@@ -39,11 +184,9 @@ int32_t hf_id(int8_t *name)
 #if KERNEL_LOG == 2
 	dprintf("hf_id() %d ", (uint32_t)_read_us());
 #endif
-	for (i = 0; i < MAX_TASKS; i++){
-		if (krnl_tcb[i].ptask){
-			if (strcmp(krnl_tcb[i].name, name) == 0)
-				return krnl_tcb[i].id;
-		}
+	for (i = name_hash[name_hash_key(name)]; i; i = name_next[i - 1]){
+		if (strcmp(krnl_tcb[i - 1].name, name) == 0)
+			return krnl_tcb[i - 1].id;
 	}
 	return ERR_INVALID_NAME;
 }
@@ -160,6 +303,7 @@ int32_t hf_dlm(uint16_t id){
 int32_t hf_priorityset(uint16_t id, uint8_t priority)
 {
 	struct tcb_entry *krnl_task2;
+	volatile uint32_t status;
 
 #if KERNEL_LOG == 2
 	dprintf("hf_priorityset() %d ", (uint32_t)_read_us());
@@ -168,8 +312,12 @@ int32_t hf_priorityset(uint16_t id, uint8_t priority)
 		krnl_task2 = &krnl_tcb[id];
 		if (krnl_task2->ptask){
 			if (krnl_task2->period == 0){
+				status = _di();
+				sched_be_remove(krnl_task2);
 				krnl_task2->priority = priority;
 				krnl_task2->priority_rem = priority;
+				sched_be_insert(krnl_task2);
+				_ei(status);
 
 				return ERR_OK;
 			}
@@ -202,6 +350,84 @@ int32_t hf_priorityget(uint16_t id)
 	return ERR_INVALID_ID;
 }
 
+#ifndef RT_ADMISSION
+#define RT_ADMISSION	0
+#endif
+
+/**
+ * @brief Checks if a new real time task keeps the RT task set schedulable.
+ *
+ * @param period is the period of the new task (in quantum / tick units).
+ * @param capacity is the capacity of the new task (in quantum / tick units).
+ *
+ * @return ERR_OK if the RT task set (the aperiodic server included) plus the new task is
+ * schedulable and ERR_NOT_SCHEDULABLE otherwise.
+ *
+ * The test matches the real time scheduler in use, so the scheduler should be selected
+ * before RT tasks are spawned. For sched_rma(), it is an exact response time analysis:
+ * tasks are taken in rate monotonic order and the worst case response time of each one
+ * (its capacity plus the interference of the tasks of shorter periods, found as a fixed
+ * point) must not exceed its period. For sched_edf(), the total utilization must not
+ * exceed one. Both schedulers replenish capacity and account deadline misses at the end
+ * of each period, so deadlines are taken as equal to periods (the deadline given to
+ * hf_spawn() only places the end of the first period).
+ */
+int32_t hf_rtadmit(uint16_t period, uint16_t capacity)
+{
+	volatile uint32_t status;
+	uint16_t t[MAX_TASKS + 1], c[MAX_TASKS + 1];
+	struct tcb_entry *krnl_task2;
+	int32_t i, j, k, n = 0;
+	uint64_t u = 0;
+	uint32_t r, w;
+
+	if (!period || !capacity || capacity > period)
+		return ERR_NOT_SCHEDULABLE;
+	status = _di();
+	k = hf_queue_count(krnl_rt_queue);
+	for (i = 0; i < k; i++){
+		krnl_task2 = hf_queue_get(krnl_rt_queue, i);
+		/* the RT queue is sorted by period, the new task goes after the ones of the same period */
+		if (n == i && krnl_task2->period > period){
+			t[n] = period;
+			c[n++] = capacity;
+		}
+		t[n] = krnl_task2->period;
+		c[n++] = krnl_task2->capacity;
+	}
+	if (n == k){
+		t[n] = period;
+		c[n++] = capacity;
+	}
+	_ei(status);
+
+	if (sched_rt_edf()){
+		for (i = 0; i < n; i++)
+			u += ((uint64_t)c[i] << 32) / t[i];
+
+		return u <= (1ULL << 32) ? ERR_OK : ERR_NOT_SCHEDULABLE;
+	}
+
+	for (i = 0; i < n; i++){
+		r = c[i];
+		for (;;){
+			w = c[i];
+			for (j = 0; j < i; j++)
+				w += ((r + t[j] - 1) / t[j]) * c[j];
+			if (w > t[i])
+				return ERR_NOT_SCHEDULABLE;
+			if (w == r)
+				break;
+			r = w;
+		}
+	}
+
+	return ERR_OK;
+}
+
+/* creates a task, on a given stack or (stack NULL) on an allocated one */
+static int32_t task_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t deadline, int8_t *name, size_t *stack, uint32_t stack_size);
+
 /**
  * @brief Spawn a new task.
  *
@@ -217,21 +443,70 @@ int32_t hf_priorityget(uint16_t id)
  * the system fails to allocate memory for the task resources.
  *
  * If a task has defined realtime parameters, it is put on the RT queue, if not
- * (period 0, capacity 0 and deadline 0), it is put on the BE queue.
+ * (period 0, capacity 0 and deadline 0), it is put on the BE queue. Aperiodic tasks
+ * (period 0 and some capacity) are put on the aperiodic queue, and execute on the
+ * time of the aperiodic server.
  * WARNING: Task stack size should be always configured correctly, considering data
  * declared on the auto region (local variables) and around 1024 of spare memory for the OS.
  * For example, if you declare a buffer of 5000 bytes, stack size should be at least 6000.
+ * With STACK_PAINT, the stack is filled with a known pattern and hf_stackusage() reports
+ * the peak usage of the task, so stacks can be sized from measurements.
+ * With RT_ADMISSION 1, a warning is printed for a RT task which makes the RT task set not
+ * schedulable (hf_rtadmit()), and with RT_ADMISSION 2 the task is not added and
+ * ERR_NOT_SCHEDULABLE is returned.
  */
 int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t deadline, int8_t *name, uint32_t stack_size)
 {
-	volatile uint32_t status, i = 0;
+	return task_spawn(task, period, capacity, deadline, name, NULL, stack_size);
+}
+
+/**
+ * @brief Spawn a new task on a static stack.
+ *
+ * @param task is a pointer to a task function / body.
+ * @param period is the task RT period (in quantum / tick units).
+ * @param capacity is the amount of work to be executed in a period (in quantum / tick units).
+ * @param deadline is the task deadline to complete the work in the period (in quantum / tick units).
+ * @param name is a string used to identify a task.
+ * @param stack is the stack memory of the task, usually declared with HF_STACK().
+ * @param stack_size is the size of the stack memory, in bytes.
+ *
+ * @return task id if the task is created, ERR_EXCEED_MAX_NUM if the maximum number of tasks in the system
+ * is exceeded, ERR_INVALID_PARAMETER if no stack is given or ERR_NOT_SCHEDULABLE (see hf_spawn()).
+ *
+ * Same as hf_spawn(), but no memory is allocated: the stack is given by the caller, and
+ * it is not freed when the task is killed (so it may be used again by another task). Stacks
+ * declared with HF_STACK() are placed by the linker on a section of their own, which is not
+ * cleared at boot, and the heap is not fragmented by the stacks of tasks created at boot.
+ */
+int32_t hf_spawn_static(void (*task)(), uint16_t period, uint16_t capacity, uint16_t deadline, int8_t *name, size_t *stack, uint32_t stack_size)
+{
+	if (!stack || stack_size < 4 * sizeof(size_t))
+		return ERR_INVALID_PARAMETER;
+
+	return task_spawn(task, period, capacity, deadline, name, stack, stack_size);
+}
+
+static int32_t task_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t deadline, int8_t *name, size_t *stack, uint32_t stack_size)
+{
+	volatile uint32_t status, i;
+#if STACK_PAINT == 1
+	uint32_t w;
+#endif
 
 #if KERNEL_LOG == 2
 	dprintf("hf_spawn() %d ", (uint32_t)_read_us());
+#endif
+#if RT_ADMISSION > 0
+	if (period && hf_rtadmit(period, capacity) != ERR_OK){
+		kprintf("\nKERNEL: [%s] p:%d, c:%d makes the RT task set not schedulable", name, period, capacity);
+#if RT_ADMISSION == 2
+		return ERR_NOT_SCHEDULABLE;
+#endif
+	}
 #endif
 	status = _di();
-	while ((krnl_tcb[i].ptask != 0) && (i < MAX_TASKS))
-		i++;
+	i = tcb_alloc();
 	if (i == MAX_TASKS){
 		kprintf("\nKERNEL: task not added - MAX_TASKS: %d", MAX_TASKS);
 		_ei(status);
@@ -244,6 +519,7 @@ int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t de
 	krnl_task->state = TASK_IDLE;
 	krnl_task->priority = 100;
 	krnl_task->priority_rem = 100;
+	krnl_task->critical = 0;
 	krnl_task->delay = 0;
 	krnl_task->period = period;
 	krnl_task->capacity = capacity;
@@ -252,31 +528,71 @@ int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t de
 	krnl_task->deadline_rem = deadline;
 	krnl_task->rtjobs = 0;
 	krnl_task->bgjobs = 0;
+	krnl_task->cycles = 0;
+	krnl_task->job_start = 0;
+	krnl_task->job_peak = GOVERNOR_FULL;
+	krnl_task->job_last = GOVERNOR_FULL;
+	krnl_task->job_done = 0;
+	krnl_task->job_seen = 0;
+#if SCHED_STATS == 1
+	krnl_task->woken = 0;
+	memset(&krnl_task->latency, 0, sizeof(struct sched_stat));
+#endif
 	krnl_task->deadline_misses = 0;
 	krnl_task->ptask = task;
-	stack_size += 3;
-	stack_size >>= 2;
-	stack_size <<= 2;
+	krnl_task->rq_next = NULL;
+	krnl_task->rq_prev = NULL;
+	krnl_task->dq_next = NULL;
+	krnl_task->dq_prev = NULL;
+	krnl_task->mtx_wait = NULL;
+	krnl_task->cond_mtx = NULL;
+	krnl_task->wait_queue = NULL;
+	krnl_task->wait_count = NULL;
+	krnl_task->timedout = 0;
+	krnl_task->arena = NULL;
+	krnl_task->group = NULL;
+	krnl_task->stack_static = stack != NULL;
+	if (stack){
+		stack_size &= ~3;
+		krnl_task->pstack = stack;
+	}else{
+		stack_size += 3;
+		stack_size >>= 2;
+		stack_size <<= 2;
+#if STACK_POOL > 0
+		krnl_task->pstack = stack_alloc(&stack_size);
+#else
+		krnl_task->pstack = (size_t *)hf_malloc(stack_size);
+#endif
+	}
 	krnl_task->stack_size = stack_size;
-	krnl_task->pstack = (size_t *)hf_malloc(stack_size);
 	_set_task_sp(krnl_task->id, (size_t)krnl_task->pstack + (stack_size - 4));
 	_set_task_tp(krnl_task->id, krnl_task->ptask);
 	if (krnl_task->pstack){
 		krnl_task->pstack[0] = STACK_MAGIC;
+#if STACK_PAINT == 1
+		for (w = 1; w < stack_size / sizeof(size_t); w++)
+			krnl_task->pstack[w] = STACK_PAINT_WORD;
+#endif
+		name_hash_add(i);
 		kprintf("\nKERNEL: [%s], id: %d, p:%d, c:%d, d:%d, addr: %x, sp: %x, ss: %d bytes", krnl_task->name, krnl_task->id, krnl_task->period, krnl_task->capacity, krnl_task->deadline, krnl_task->ptask, _get_task_sp(krnl_task->id), stack_size);
 		if (period){
-			if (hf_queue_addtail(krnl_rt_queue, krnl_task)) panic(PANIC_CANT_PLACE_RT);
+			sched_rt_insert(krnl_task);
 		}else{
       if (capacity != 0)
       {
           if(hf_queue_addtail(krnl_aperiodic_queue, krnl_task)) panic(PANIC_CANT_PLACE_RT); //mudar para aperiodic
       }
-      else if (hf_queue_addtail(krnl_run_queue, krnl_task))
-      	panic(PANIC_CANT_PLACE_RUN);
+      else{
+        if (hf_queue_addtail(krnl_run_queue, krnl_task))
+          panic(PANIC_CANT_PLACE_RUN);
+        sched_be_insert(krnl_task);
+      }
 		}
 	}else{
 		krnl_task->ptask = 0;
 		krnl_tasks--;
+		tcb_free(i);
 		kprintf("\nKERNEL: task not added (out of memory)");
 		i = ERR_OUT_OF_MEMORY;
 	}
@@ -290,33 +606,54 @@ int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t de
  * @brief Yields the current task.
  *
  * The current task gives up execution and the best effort scheduler is invoked.
+ * The context of the task is saved only when another task is selected: if the
+ * scheduler picks the current task again (it is the only one ready, for example),
+ * hf_yield() just returns.
  */
 void hf_yield(void)
 {
-	int32_t rc;
+	struct tcb_entry *prev;
 	volatile int32_t status;
+	uint32_t now;
 
 	status = _di();
-#if KERNEL_LOG >= 1
+#if KERNEL_LOG == 3
+	trace_event(TRACE_YIELD, 0);
+#elif KERNEL_LOG >= 1
 		dprintf("hf_yield() %d ", (uint32_t)_read_us());
 #endif
 	krnl_task = &krnl_tcb[krnl_current_task];
-	rc = setjmp(krnl_task->task_context);
-	if (rc){
-		_ei(status);
-		return;
-	}
+	prev = krnl_task;
+	now = _readcounter();
+	krnl_task->cycles += now - krnl_pcb.cycles_last;
+	sched_group_charge(krnl_task, now - krnl_pcb.cycles_last);
 	if (krnl_task->state == TASK_RUNNING)
 		krnl_task->state = TASK_READY;
 	if (krnl_task->pstack[0] != STACK_MAGIC)
 		panic(PANIC_STACK_OVERFLOW);
 	if (krnl_tasks > 0){
-		krnl_current_task = krnl_pcb.sched_be();
+		krnl_current_task = sched_be_pick();
 		krnl_task->state = TASK_RUNNING;
 		krnl_pcb.coop_cswitch++;
-#if KERNEL_LOG >= 1
+		krnl_pcb.cycles_last = _readcounter();
+		krnl_pcb.sched_cycles += krnl_pcb.cycles_last - now;
+#if SCHED_STATS == 1
+		sched_stat_dispatch(now, krnl_pcb.cycles_last);
+#endif
+#if KERNEL_LOG == 3
+		trace_event(TRACE_RUN, 0);
+#elif KERNEL_LOG >= 1
 		dprintf("\n%d %d %d %d %d ", krnl_current_task, krnl_task->period, krnl_task->capacity, krnl_task->deadline, (uint32_t)_read_us());
 #endif
+		if (krnl_task == prev){
+			krnl_pcb.same_cswitch++;
+			_ei(status);
+			return;
+		}
+		if (setjmp(prev->task_context)){
+			_ei(status);
+			return;
+		}
 		_restoreexec(krnl_task->task_context, status, krnl_current_task);
 		panic(PANIC_UNKNOWN);
 	}else{
@@ -324,6 +661,35 @@ void hf_yield(void)
 	}
 }
 
+/**
+ * @brief Ends the current job of a periodic task.
+ *
+ * @return ERR_OK when the next job starts and ERR_ERROR if the calling task is not a
+ * real time (periodic) task.
+ *
+ * The capacity left on the current period is given back to the scheduler and the task
+ * does not execute again until its next period, so the remaining time goes to other
+ * tasks instead of a busy wait on hf_jobs(). Finishing a job early is not a deadline miss.
+ * The typical periodic task is a loop of a job followed by hf_waitperiod().
+ */
+int32_t hf_waitperiod(void)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	status = _di();
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	if (!krnl_task2->period){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	sched_rt_jobdone(krnl_task2);
+	_ei(status);
+	hf_yield();
+
+	return ERR_OK;
+}
+
 /**
  * @brief Blocks a task.
  *
@@ -332,8 +698,8 @@ void hf_yield(void)
  * @return ERR_OK on success, ERR_INVALID_ID if the referenced task does not exist or ERR_ERROR if the task is already in the blocked state.
  *
  * The task is marked as TASK_BLOCKED so the scheduler doesn't select it as a candidate for scheduling.
- * The blocking state is acomplished without removing the task from the run queue, reducing the cost of
- * the operation in cases where the task state is switched frequently (such as in semaphore primitives).
+ * Best effort tasks are taken off the run queue while blocked, so the cost of scheduling decisions
+ * depends only on the number of runnable tasks.
  */
 int32_t hf_block(uint16_t id)
 {
@@ -361,7 +727,7 @@ int32_t hf_block(uint16_t id)
 		_ei(status);
 		return ERR_ERROR;
 	}
-	krnl_task->state = TASK_BLOCKED;
+	sched_block(krnl_task);
 	krnl_task = &krnl_tcb[krnl_current_task];
 	_ei(status);
 
@@ -376,9 +742,7 @@ int32_t hf_block(uint16_t id)
  * @return ERR_OK on success, ERR_INVALID_ID if the referenced task does not exist or ERR_ERROR if the task is not in the blocked state.
  *
  * The task must be in the TASK_BLOCKED state in order to be resumed.
- * The task is marked as TASK_BLOCKED so the scheduler doesn't select it as a candidate for scheduling.
- * The blocking state is acomplished without removing the task from the run queue, reducing the cost of
- * the operation in cases where the task state is switched frequently (such as in semaphore primitives).
+ * The task is marked as TASK_READY and a best effort task is placed back on the run queue.
  */
 int32_t hf_resume(uint16_t id)
 {
@@ -406,7 +770,7 @@ int32_t hf_resume(uint16_t id)
 		_ei(status);
 		return ERR_ERROR;
 	}
-	krnl_task->state = TASK_READY;
+	sched_wakeup(krnl_task);
 	krnl_task = &krnl_tcb[krnl_current_task];
 	_ei(status);
 
@@ -421,7 +785,10 @@ int32_t hf_resume(uint16_t id)
  * @return ERR_OK on success or ERR_INVALID_ID if the referenced task does not exist.
  *
  * All memory allocated during the task initialization is freed, the TCB entry is cleared and
- * the task is removed from its run queue.
+ * the task is removed from its run queue. A task blocked on a synchronization primitive is
+ * taken off its wait queue (a semaphore gets back the unit it was waiting for), and the
+ * functions registered with hf_killhook() release the resources the task held on other
+ * subsystems.
  */
 int32_t hf_kill(uint16_t id)
 {
@@ -446,22 +813,25 @@ int32_t hf_kill(uint16_t id)
 		return ERR_INVALID_ID;
 	}
 
-	krnl_task->id = -1;
-	krnl_task->ptask = 0;
-	hf_free(krnl_task->pstack);
-	_set_task_sp(krnl_task->id, 0);
-	_set_task_tp(krnl_task->id, 0);
-	krnl_task->state = TASK_IDLE;
-	krnl_tasks--;
-
-	if (krnl_task->period){
-		k = hf_queue_count(krnl_rt_queue);
+	sched_be_remove(krnl_task);
+	if (krnl_task->wait_queue){
+		sched_wait_remove(krnl_task);
+		sched_delay_remove(krnl_task);
+	}
+	if (sched_delay_remove(krnl_task)){
+		krnl_task2 = krnl_task;
+	}else if (krnl_task->period){
+		krnl_task2 = sched_rt_remove(krnl_task);
+	}else if (krnl_task->capacity){
+		k = hf_queue_count(krnl_aperiodic_queue);
 		for (i = 0; i < k; i++)
-			if (hf_queue_get(krnl_rt_queue, i) == krnl_task) break;
-		if (!k || i == k) panic(PANIC_NO_TASKS_RT);
+			if (hf_queue_get(krnl_aperiodic_queue, i) == krnl_task) break;
+		if (!k || i == k) panic(PANIC_NO_TASKS_RUN);
 		for (j = i; j > 0; j--)
-			if (hf_queue_swap(krnl_rt_queue, j, j-1)) panic(PANIC_CANT_SWAP);
-		krnl_task2 = hf_queue_remhead(krnl_rt_queue);
+			if (hf_queue_swap(krnl_aperiodic_queue, j, j-1)) panic(PANIC_CANT_SWAP);
+		krnl_task2 = hf_queue_remhead(krnl_aperiodic_queue);
+	}else if (krnl_task->state == TASK_BLOCKED){
+		krnl_task2 = krnl_task;
 	}else{
 		k = hf_queue_count(krnl_run_queue);
 		for (i = 0; i < k; i++)
@@ -472,10 +842,41 @@ int32_t hf_kill(uint16_t id)
 		krnl_task2 = hf_queue_remhead(krnl_run_queue);
 	}
 	if (!krnl_task2 || krnl_task2 != krnl_task) panic(PANIC_UNKNOWN_TASK_STATE);
+#if MUTEX_TYPE == 2
+	if (krnl_task->mtx_wait){
+		krnl_task->mtx_wait->waiting[id >> 5] &= ~(1U << (id & 31));
+		krnl_task->mtx_wait = NULL;
+	}
+#endif
+	if (krnl_server == krnl_task)
+		krnl_server = NULL;
+	if (krnl_task->group){
+		krnl_task->group->tasks--;
+		krnl_task->group = NULL;
+	}
+	for (i = 0; i < KILL_HOOKS && kill_hooks[i]; i++)
+		kill_hooks[i](id);
+
+	name_hash_del(id);
+	tcb_free(id);
+	arena_release(id);
+	krnl_task->id = -1;
+	krnl_task->ptask = 0;
+	if (!krnl_task->stack_static){
+#if STACK_POOL > 0
+		stack_free(krnl_task->pstack, krnl_task->stack_size);
+#else
+		hf_free(krnl_task->pstack);
+#endif
+	}
+	_set_task_sp(id, 0);
+	_set_task_tp(id, 0);
+	krnl_task->state = TASK_IDLE;
+	krnl_tasks--;
 
 	krnl_task = &krnl_tcb[krnl_current_task];
 	kprintf("\nKERNEL: task died, id: %d, tasks left: %d", id, krnl_tasks);
-	if (hf_selfid() == id){
+	if (krnl_current_task == id){
 		_ei(status);
 		hf_yield();
 	}else{
@@ -485,17 +886,52 @@ int32_t hf_kill(uint16_t id)
 	return ERR_OK;
 }
 
+/**
+ * @brief Registers a function which releases the resources held by a task when it is killed.
+ *
+ * @param fn is the function, called with the id of the task.
+ *
+ * @return ERR_OK on success and ERR_ERROR if KILL_HOOKS functions are already registered.
+ *
+ * Subsystems which keep resources on behalf of tasks (receive queues, sockets, buffers)
+ * register a function to give them back, so tasks killed while holding them don't drain
+ * the buffer pools and the heap. The functions are called by hf_kill() with interrupts
+ * disabled, before the task is removed (its stack and TCB entry are still valid), and must
+ * not block. Registering a function again does nothing.
+ */
+int32_t hf_killhook(void (*fn)(uint16_t id))
+{
+	volatile uint32_t status;
+	int32_t i;
+
+	status = _di();
+	for (i = 0; i < KILL_HOOKS; i++){
+		if (kill_hooks[i] == fn)
+			break;
+		if (!kill_hooks[i]){
+			kill_hooks[i] = fn;
+			break;
+		}
+	}
+	_ei(status);
+
+	return i < KILL_HOOKS ? ERR_OK : ERR_ERROR;
+}
+
 /**
  * @brief Delays a task for an amount of time.
  *
  * @param id is a task id number.
  * @param delay is the amount of time (in quantum / tick units).
  *
- * @return ERR_OK on success or ERR_INVALID_ID if the referenced task does not exist.
+ * @return ERR_OK on success, ERR_INVALID_ID if the referenced task does not exist or ERR_ERROR if
+ * the task is blocked on a timed wait (hf_semwait_timeout(), for example).
  *
- * A task is removed from its run queue and its state is marked as TASK_DELAYED. The task is put on the delay queue
+ * A task is removed from its run queue and its state is marked as TASK_DELAYED. A blocked task which
+ * is already delayed has its delay replaced. The task is put on the delay queue
  * and remains there until the dispatcher places it back to its run queue. Time is managed by the task dispatcher, which
- * counts down delays, controls the delay queue by cycling the tasks and removing them when the task delay has passed.
+ * counts down the delay of the task at the head of the delay queue (a delta list sorted by expiry time) and removes
+ * tasks when their delay has passed.
  */
 int32_t hf_delay(uint16_t id, uint32_t delay)
 {
@@ -521,16 +957,14 @@ int32_t hf_delay(uint16_t id, uint32_t delay)
 		_ei(status);
 		return ERR_INVALID_ID;
 	}
+	if (krnl_task->wait_queue){
+		kprintf("\nKERNEL: can't delay a task on a timed wait");
+		krnl_task = &krnl_tcb[krnl_current_task];
+		_ei(status);
+		return ERR_ERROR;
+	}
 	if (krnl_task->period){
-		k = hf_queue_count(krnl_rt_queue);
-		for (i = 0; i < k; i++){
-			// kprintf("hf_queue_get no delay: %d", hf_queue_get(krnl_rt_queue, i));
-			if (hf_queue_get(krnl_rt_queue, i) == krnl_task) break;
-		}
-		if (!k || i == k) panic(PANIC_NO_TASKS_RT);
-		for (j = i; j > 0; j--)
-			if (hf_queue_swap(krnl_rt_queue, j, j-1)) panic(PANIC_CANT_SWAP);
-		krnl_task2 = hf_queue_remhead(krnl_rt_queue);
+		krnl_task2 = sched_rt_remove(krnl_task);
 	}else{
 		if (krnl_task->capacity != 0){
 			k = hf_queue_count(krnl_aperiodic_queue);
@@ -541,6 +975,10 @@ int32_t hf_delay(uint16_t id, uint32_t delay)
 				if (hf_queue_swap(krnl_aperiodic_queue, j, j-1)) panic(PANIC_CANT_SWAP);
 			krnl_task2 = hf_queue_remhead(krnl_aperiodic_queue);
 		}
+		else if (krnl_task->state == TASK_BLOCKED){
+			sched_delay_remove(krnl_task);
+			krnl_task2 = krnl_task;
+		}
 		else{
 			k = hf_queue_count(krnl_run_queue);
 			for (i = 0; i < k; i++)
@@ -552,11 +990,67 @@ int32_t hf_delay(uint16_t id, uint32_t delay)
 		}
 	}
 
+	sched_be_remove(krnl_task);
 	krnl_task->state = TASK_DELAYED;
-	krnl_task->delay = delay;
-	if (hf_queue_addtail(krnl_delay_queue, krnl_task2)) panic(PANIC_CANT_PLACE_DELAY);
+	sched_delay_insert(krnl_task2, delay);
 	krnl_task = &krnl_tcb[krnl_current_task];
 	_ei(status);
 
 	return ERR_OK;
 }
+
+/**
+ * @brief Puts the current task to sleep for an amount of time.
+ *
+ * @param usec is the amount of time, in microsseconds.
+ *
+ * @return ERR_OK.
+ *
+ * Whole ticks are spent on the delay queue, so the processor is given to other tasks (or idles) meanwhile.
+ * Only the remainder shorter than one tick is busy-waited with delay_us(). While the scheduler is not running
+ * (or for the idle task) the whole amount is busy-waited. The task may oversleep if a higher priority task
+ * is running when its delay expires.
+ */
+int32_t hf_usleep(uint32_t usec)
+{
+	uint64_t start;
+	uint32_t elapsed, tick;
+
+	start = _read_us();
+	elapsed = 0;
+	while (elapsed < usec){
+#if TICKLESS == 1
+		tick = TIME_SLICE;
+#else
+		tick = krnl_pcb.tick_time;
+#endif
+		if (!krnl_schedule || !krnl_current_task || !tick || usec - elapsed < tick ||
+		    hf_delay(krnl_current_task, (usec - elapsed) / tick) != ERR_OK){
+			delay_us(usec - elapsed);
+			break;
+		}
+		hf_yield();
+		elapsed = _read_us() - start;
+	}
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Puts the current task to sleep for an amount of time.
+ *
+ * @param msec is the amount of time, in milliseconds.
+ *
+ * @return ERR_OK.
+ *
+ * This is hf_usleep() with a millisecond argument.
+ */
+int32_t hf_msleep(uint32_t msec)
+{
+	while (msec > 4000000){
+		hf_usleep(4000000000U);
+		msec -= 4000000;
+	}
+
+	return hf_usleep(msec * 1000);
+}
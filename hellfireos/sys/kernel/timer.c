@@ -0,0 +1,227 @@
+/**
+ * @file timer.c
+ * @date October 2026
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Software timers: one-shot and periodic callbacks, all run by a single timer task, so
+ * housekeeping actions (link checks, watchdogs, blinkers) do not need a task (TCB and
+ * stack) each. Active timers are kept on a list sorted by expiry time. The timer task
+ * sleeps on a semaphore until the first expiry (hf_semwait_timeout()), and is woken up
+ * early when a timer that expires sooner is started.
+ *
+ * Callbacks run on the timer task, with interrupts enabled, one at a time. They should be
+ * short and must not block for long, as they delay the other timers. The timer task is
+ * a best effort task, created on the first call to hf_timer_init() (from a task, usually
+ * app_main()), and its priority may be changed with hf_priorityset() (hf_id("timer")).
+ * Timer resolution is the scheduler tick.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <queue.h>
+#include <lockstat.h>
+#include <semaphore.h>
+#include <timer.h>
+#include <kernel.h>
+#include <task.h>
+#include <ecodes.h>
+
+#ifndef TIMER_STACK
+#define TIMER_STACK	1024
+#endif
+
+static struct timer *timer_list;
+static sem_t timer_sem;
+static int32_t timer_task = -1;
+
+/* places a timer on the list, by expiry time. interrupts disabled */
+static void timer_insert(struct timer *t)
+{
+	struct timer **p = &timer_list;
+
+	while (*p && (int64_t)((*p)->expires - t->expires) <= 0)
+		p = &(*p)->next;
+	t->next = *p;
+	*p = t;
+	t->active = 1;
+}
+
+/* takes a timer off the list, if it is there. interrupts disabled */
+static void timer_remove(struct timer *t)
+{
+	struct timer **p = &timer_list;
+
+	while (*p && *p != t)
+		p = &(*p)->next;
+	if (*p)
+		*p = t->next;
+	t->next = NULL;
+	t->active = 0;
+}
+
+/* ticks until a point in time, rounded up (at least one) */
+static uint32_t timer_ticks(uint64_t expires, uint64_t now)
+{
+	uint32_t tick;
+	uint64_t delta;
+
+#if TICKLESS == 1
+	tick = TIME_SLICE;
+#else
+	tick = krnl_pcb.tick_time;
+#endif
+	if (!tick)
+		return 1;
+	delta = expires - now;
+	delta = (delta + tick - 1) / tick;
+
+	return delta > 0 ? (delta < 0x7fffffff ? delta : 0x7fffffff) : 1;
+}
+
+static void timer_service(void)
+{
+	volatile uint32_t status;
+	struct timer *t;
+	void (*fn)(void *);
+	void *arg;
+	uint64_t now;
+	uint32_t ticks;
+
+	for (;;){
+		status = _di();
+		now = _read_us();
+		t = timer_list;
+		if (t && (int64_t)(t->expires - now) <= 0){
+			timer_list = t->next;
+			t->next = NULL;
+			t->active = 0;
+			if (t->period){
+				t->expires += t->period;
+				if ((int64_t)(t->expires - now) <= 0){
+					t->overruns += (now - t->expires) / t->period + 1;
+					t->expires = now + t->period;
+				}
+				timer_insert(t);
+			}
+			fn = t->fn;
+			arg = t->arg;
+			_ei(status);
+			fn(arg);
+			continue;
+		}
+		ticks = t ? timer_ticks(t->expires, now) : 0;
+		_ei(status);
+		if (ticks)
+			hf_semwait_timeout(&timer_sem, ticks);
+		else
+			hf_semwait(&timer_sem);
+	}
+}
+
+/**
+ * @brief Initializes a software timer.
+ *
+ * @param t is a pointer to a timer.
+ * @param fn is the function called when the timer expires.
+ * @param arg is the argument of the function.
+ *
+ * @return ERR_OK on success and ERR_ERROR if the timer task could not be created.
+ *
+ * The timer task is created on the first call.
+ */
+int32_t hf_timer_init(struct timer *t, void (*fn)(void *), void *arg)
+{
+	if (timer_task < 0){
+		if (hf_seminit(&timer_sem, 0))
+			return ERR_ERROR;
+		timer_task = hf_spawn(timer_service, 0, 0, 0, "timer", TIMER_STACK);
+		if (timer_task < 0){
+			hf_semdestroy(&timer_sem);
+			return ERR_ERROR;
+		}
+	}
+	t->next = NULL;
+	t->expires = 0;
+	t->period = 0;
+	t->overruns = 0;
+	t->fn = fn;
+	t->arg = arg;
+	t->active = 0;
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Starts (or restarts) a software timer.
+ *
+ * @param t is a pointer to a timer.
+ * @param msec is the time until the first expiry, in milliseconds.
+ * @param period_msec is the period of the timer (milliseconds), or 0 for a one-shot timer.
+ *
+ * @return ERR_OK.
+ *
+ * A periodic timer keeps its phase: expiry times are multiples of the period from the
+ * first one. If a callback runs so late that whole periods are lost, they are counted
+ * on the overruns field and the timer is resynchronized. May be called from callbacks.
+ */
+int32_t hf_timer_start(struct timer *t, uint32_t msec, uint32_t period_msec)
+{
+	volatile uint32_t status;
+	int32_t first;
+
+	status = _di();
+	if (t->active)
+		timer_remove(t);
+	t->expires = _read_us() + (uint64_t)msec * 1000;
+	t->period = period_msec * 1000;
+	timer_insert(t);
+	first = timer_list == t;
+	_ei(status);
+	if (first)
+		hf_sempost(&timer_sem);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Stops a software timer.
+ *
+ * @param t is a pointer to a timer.
+ *
+ * @return ERR_OK if the timer was active and ERR_ERROR otherwise.
+ *
+ * The callback is not called anymore, unless it is already running. May be called from
+ * callbacks (a periodic timer may stop itself).
+ */
+int32_t hf_timer_stop(struct timer *t)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (!t->active){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	timer_remove(t);
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Checks if a software timer is active.
+ *
+ * @param t is a pointer to a timer.
+ *
+ * @return 1 if the timer is started (and will expire) and 0 otherwise.
+ */
+int32_t hf_timer_active(struct timer *t)
+{
+	return t->active;
+}
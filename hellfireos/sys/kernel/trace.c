@@ -0,0 +1,150 @@
+/**
+ * @file trace.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Binary kernel trace (KERNEL_LOG 3). Events are fixed size records kept on a ring
+ * in memory, and are drained to the debug port by the idle task or read by a task.
+ * 
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <kprintf.h>
+#include <kernel.h>
+#include <trace.h>
+
+#ifndef COUNTER_SPEED
+#define COUNTER_SPEED			CPU_SPEED	/* cycle counter frequency */
+#endif
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE			1024		/* ring entries (power of 2) */
+#endif
+
+static struct trace_entry trace_ring[TRACE_SIZE];
+static volatile uint32_t trace_head, trace_tail, trace_lost;
+static volatile int32_t trace_claimed;
+
+/**
+ * @internal
+ * @brief Records a kernel event on the trace ring.
+ * 
+ * @param event is the event id.
+ * @param arg is the event argument.
+ * 
+ * Must be called with interrupts disabled (the dispatcher, hf_yield() and interrupt handlers
+ * already are). There is a single writer and a single reader, so the ring needs no lock: the
+ * writer only moves the head after the record is complete, and the reader only moves the tail.
+ * The event is dropped (and counted as lost) when the ring is full.
+ */
+void trace_event(uint8_t event, uint16_t arg)
+{
+	struct trace_entry *e;
+	uint32_t head;
+
+	head = trace_head;
+	if (head - trace_tail >= TRACE_SIZE){
+		trace_lost++;
+		return;
+	}
+	e = &trace_ring[head & (TRACE_SIZE - 1)];
+	e->time = _readcounter();
+	e->event = event;
+	e->task = krnl_current_task;
+	e->arg = arg;
+	trace_head = head + 1;
+}
+
+/**
+ * @brief Reads events from the trace ring.
+ * 
+ * @param buf is a pointer to an array of trace entries.
+ * @param n is the size of the array, in entries.
+ * 
+ * @return the number of entries copied to the array.
+ * 
+ * The oldest events are returned first, and are removed from the ring. Only one task may
+ * drain the ring (either with this call or with hf_traceflush()).
+ */
+int32_t hf_traceread(struct trace_entry *buf, int32_t n)
+{
+	uint32_t tail;
+	int32_t i;
+
+	tail = trace_tail;
+	for (i = 0; i < n && tail != trace_head; i++, tail++)
+		buf[i] = trace_ring[tail & (TRACE_SIZE - 1)];
+	trace_tail = tail;
+
+	return i;
+}
+
+/**
+ * @brief Takes the trace ring away from the idle task.
+ * 
+ * The calling task becomes the only reader (with hf_traceread()), and hf_traceflush() does
+ * nothing afterwards, so a task may send the events elsewhere (such as over the network).
+ */
+void hf_traceclaim(void)
+{
+	trace_claimed = 1;
+}
+
+/**
+ * @brief Returns the number of events dropped because the trace ring was full.
+ * 
+ * @return lost events.
+ */
+uint32_t hf_tracelost(void)
+{
+	return trace_lost;
+}
+
+static void trace_put32(uint32_t val)
+{
+	dputchar(val & 0xff);
+	dputchar((val >> 8) & 0xff);
+	dputchar((val >> 16) & 0xff);
+	dputchar((val >> 24) & 0xff);
+}
+
+/**
+ * @brief Drains the trace ring to the debug port.
+ * 
+ * The stream starts with a header: the magic "HFTR", the format version, the record size
+ * (8 bytes) and the cycle counter frequency, as 32 bit words. Each record
+ * follows as the time (32 bit), event and task (8 bit each) and argument (16 bit). All words
+ * are little endian, regardless of the processor. Kprofiler decodes this stream. Nothing is
+ * done once a task has claimed the ring (hf_traceclaim()).
+ */
+void hf_traceflush(void)
+{
+	static int32_t header = 0;
+	struct trace_entry e;
+	int32_t i;
+
+	if (trace_claimed)
+		return;
+	if (!header){
+		for (i = 0; i < 4; i++)
+			dputchar(TRACE_MAGIC[i]);
+		trace_put32(TRACE_VERSION);
+		trace_put32(sizeof(struct trace_entry));
+		trace_put32(COUNTER_SPEED);
+		header = 1;
+	}
+	while (hf_traceread(&e, 1)){
+		trace_put32(e.time);
+		dputchar(e.event);
+		dputchar(e.task);
+		dputchar(e.arg & 0xff);
+		dputchar(e.arg >> 8);
+	}
+}
@@ -0,0 +1,147 @@
+/**
+ * @file arena.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Per task heap arenas. A task may own a private region, taken from the heap at once,
+ * from which it allocates without taking the heap lock (krnl_malloc). Allocation is
+ * a pointer bump, and the arena is rewound when all its allocations are released.
+ * The whole arena goes back to the heap when the task is killed, so memory leaked by
+ * a task does not outlive it.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <queue.h>
+#include <kernel.h>
+#include <arena.h>
+#include <ecodes.h>
+
+/**
+ * @brief Creates the heap arena of a task.
+ * 
+ * @param id is the task id, usually the one returned by hf_spawn().
+ * @param size is the arena size, in bytes.
+ * 
+ * @return ERR_OK on success, ERR_INVALID_ID if the task does not exist, ERR_ERROR if
+ * the task already has an arena and ERR_OUT_OF_MEMORY if the heap is exhausted.
+ */
+int32_t hf_arena(uint16_t id, uint32_t size)
+{
+	struct arena *a;
+
+	if (id >= MAX_TASKS || krnl_tcb[id].ptask == 0)
+		return ERR_INVALID_ID;
+	if (krnl_tcb[id].arena)
+		return ERR_ERROR;
+	size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	a = hf_malloc(sizeof(struct arena) + size);
+	if (a == NULL)
+		return ERR_OUT_OF_MEMORY;
+	a->size = size;
+	a->used = 0;
+	a->allocs = 0;
+	a->area = (uint8_t *)(a + 1);
+	krnl_tcb[id].arena = a;
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Allocates memory from the arena of the current task.
+ * 
+ * @param size is the number of bytes.
+ * 
+ * @return pointer to the memory or NULL if the task has no arena or the arena is exhausted.
+ * 
+ * No lock is taken, as only the owner task allocates from its arena. Must not be called
+ * from interrupt handlers.
+ */
+void *hf_arena_alloc(uint32_t size)
+{
+	struct arena *a;
+	void *ptr;
+
+	a = krnl_tcb[krnl_current_task].arena;
+	if (a == NULL)
+		return NULL;
+	size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	if (size > a->size - a->used)
+		return NULL;
+	ptr = a->area + a->used;
+	a->used += size;
+	a->allocs++;
+
+	return ptr;
+}
+
+/**
+ * @brief Releases memory allocated from the arena of the current task.
+ * 
+ * @param ptr is a pointer returned by hf_arena_alloc().
+ * 
+ * Space is reclaimed only when every allocation of the arena was released.
+ */
+void hf_arena_free(void *ptr)
+{
+	struct arena *a;
+
+	a = krnl_tcb[krnl_current_task].arena;
+	if (a == NULL || ptr == NULL)
+		return;
+	if (a->allocs && --a->allocs == 0)
+		a->used = 0;
+}
+
+/**
+ * @brief Releases all allocations of the arena of the current task at once.
+ */
+void hf_arena_reset(void)
+{
+	struct arena *a;
+
+	a = krnl_tcb[krnl_current_task].arena;
+	if (a){
+		a->used = 0;
+		a->allocs = 0;
+	}
+}
+
+/**
+ * @brief Returns the free space of the arena of the current task.
+ * 
+ * @return number of free bytes or ERR_ERROR if the task has no arena.
+ */
+int32_t hf_arena_avail(void)
+{
+	struct arena *a;
+
+	a = krnl_tcb[krnl_current_task].arena;
+	if (a == NULL)
+		return ERR_ERROR;
+
+	return a->size - a->used;
+}
+
+/**
+ * @internal
+ * @brief Returns the arena of a task to the heap, in a single operation.
+ * 
+ * @param id is the task id.
+ * 
+ * Called by hf_kill().
+ */
+void arena_release(uint16_t id)
+{
+	if (krnl_tcb[id].arena){
+		hf_free(krnl_tcb[id].arena);
+		krnl_tcb[id].arena = NULL;
+	}
+}
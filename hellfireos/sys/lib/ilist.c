@@ -0,0 +1,85 @@
+/**
+ * @file ilist.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Intrusive doubly linked lists. Links are embedded in the listed objects, so lists
+ * never allocate memory, and insertion or removal of a known object takes constant
+ * time. Objects are found from their links with hf_ilist_entry(), and lists are
+ * traversed with hf_ilist_foreach(). No locking is done, callers must synchronize.
+ */
+
+#include <hal.h>
+#include <ilist.h>
+
+/**
+ * @brief Initializes a list (or a link not on a list).
+ * 
+ * @param head is a pointer to the list head.
+ */
+void hf_ilist_init(struct ilist *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+/**
+ * @brief Adds a link to the head of a list.
+ * 
+ * @param head is a pointer to the list head.
+ * @param node is a pointer to the link.
+ */
+void hf_ilist_addhead(struct ilist *head, struct ilist *node)
+{
+	node->next = head->next;
+	node->prev = head;
+	head->next->prev = node;
+	head->next = node;
+}
+
+/**
+ * @brief Adds a link to the tail of a list.
+ * 
+ * @param head is a pointer to the list head.
+ * @param node is a pointer to the link.
+ */
+void hf_ilist_addtail(struct ilist *head, struct ilist *node)
+{
+	node->next = head;
+	node->prev = head->prev;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+/**
+ * @brief Removes a link from its list.
+ * 
+ * @param node is a pointer to the link.
+ * 
+ * The link is left pointing to itself, so removing it twice is harmless.
+ */
+void hf_ilist_remove(struct ilist *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->next = node;
+	node->prev = node;
+}
+
+/**
+ * @brief Checks if a list is empty.
+ * 
+ * @param head is a pointer to the list head.
+ * 
+ * @return 1 if the list is empty and 0 otherwise.
+ */
+int32_t hf_ilist_empty(struct ilist *head)
+{
+	return head->next == head;
+}
@@ -11,15 +11,55 @@
  * @section DESCRIPTION
  * 
  * List manipulation primitives and auxiliary functions. List structures are allocated
- * dynamically at runtime, which makes them very flexible. Memory is allocated / deallocated
- * on demand, so additional memory management penalties are incurred.
+ * dynamically at runtime, which makes them very flexible. Nodes are taken from a pool shared
+ * by all lists (LIST_POOL nodes), and from the heap when the pool is exhausted.
  */
 
 #include <hal.h>
 #include <libc.h>
 #include <malloc.h>
+#include <pool.h>
 #include <list.h>
 
+#ifndef LIST_POOL
+#define LIST_POOL			64
+#endif
+
+static struct pool *list_pool;
+
+static struct list *list_alloc(void)
+{
+	volatile uint32_t status;
+	struct pool *p;
+	struct list *n = NULL;
+
+	if (!list_pool){
+		p = hf_pool_create(sizeof(struct list), LIST_POOL);
+		status = _di();
+		if (!list_pool){
+			list_pool = p;
+			p = NULL;
+		}
+		_ei(status);
+		if (p)
+			hf_pool_destroy(p);
+	}
+	if (list_pool)
+		n = hf_pool_alloc(list_pool);
+	if (!n)
+		n = hf_malloc(sizeof(struct list));
+
+	return n;
+}
+
+static void list_free(struct list *n)
+{
+	if (list_pool && hf_pool_owns(list_pool, n))
+		hf_pool_free(list_pool, n);
+	else
+		hf_free(n);
+}
+
 /**
  * @brief Initializes a list.
  * 
@@ -29,7 +69,7 @@ struct list *hf_list_init(void)
 {
 	struct list *lst;
 	
-	lst = (struct list *)hf_malloc(sizeof(struct list));
+	lst = list_alloc();
 	
 	if (lst){
 		lst->next = NULL;
@@ -51,7 +91,7 @@ int32_t hf_list_append(struct list *lst, void *item)
 {
 	struct list *t1, *t2;
 
-	t1 = (struct list *)hf_malloc(sizeof(struct list));
+	t1 = list_alloc();
 	if (t1){
 		t1->elem = item;
 		t1->next = NULL;
@@ -82,7 +122,7 @@ int32_t hf_list_insert(struct list *lst, void *item, int32_t pos)
 	struct list *t1, *t2;
 	int32_t i = 0;
 
-	t1 = (struct list *)hf_malloc(sizeof(struct list));
+	t1 = list_alloc();
 	if (t1){
 		t1->elem = item;
 		t1->next = NULL;
@@ -120,7 +160,7 @@ int32_t hf_list_remove(struct list *lst, int32_t pos)
 	while ((t1 = t1->next)){
 		if (i++ == pos){
 			t2->next = t1->next;
-			hf_free(t1);
+			list_free(t1);
 			return 0;
 		}
 		t2 = t1;
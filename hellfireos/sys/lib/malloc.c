@@ -1,10 +1,48 @@
 #include <hal.h>
 #include <libc.h>
 #include <malloc.h>
+#include <lockstat.h>
 #include <mutex.h>
 #include <kernel.h>
+#include <ecodes.h>
 
 static mutex_t krnl_malloc;
+static struct heap_stats heap_count;
+#if MEM_ALLOC == 3
+static struct mem_block *idle_pos;		/* next block of hf_heapidle() */
+static uint32_t heap_ops;			/* heap operations, for hf_heapidle() */
+#endif
+
+static void heap_lock_init(void)
+{
+	hf_mtxinit(&krnl_malloc);
+#if LOCK_STATS == 1
+	hf_mtxstat(&krnl_malloc, "krnl_malloc");
+#endif
+}
+
+/* allocation accounting, for hf_heapstats() and hf_heapstats_region(). size is the usable size of the block */
+static void heap_account(struct heap_stats *s, uint32_t size, int32_t n)
+{
+	int32_t c;
+
+	c = size > (1 << HEAP_CLASS_SHIFT) ? 32 - __builtin_clz(size - 1) - HEAP_CLASS_SHIFT : 0;
+	if (c >= HEAP_CLASSES) c = HEAP_CLASSES - 1;
+	s->classes[c] += n;
+	s->allocs += n;
+	s->used += n * (int32_t)size;
+	if (s->used > s->peak)
+		s->peak = s->used;
+}
+
+static void heap_free_block(struct heap_stats *s, uint32_t size)
+{
+	if (size == 0) return;
+	s->free += size;
+	s->free_blocks++;
+	if (size > s->largest)
+		s->largest = size;
+}
 
 #if MEM_ALLOC == 0
 /*
@@ -44,13 +82,14 @@ static mem_chunk *compact(mem_chunk *p, uint32_t nsize)
 	return NULL;
 }
 
-void hf_free(void *ptr)
+static void heap_free(void *ptr)
 {
 	mem_chunk *p;
 
 	hf_mtxlock(&krnl_malloc);
 	if(ptr){
 		p = (mem_chunk *)((uint32_t)ptr - sizeof(mem_chunk));
+		heap_account(&heap_count, (p->size & ~1) - sizeof(mem_chunk), -1);
 		p->size &= ~1;
 	}
 	hf_mtxunlock(&krnl_malloc);
@@ -72,6 +111,7 @@ void *hf_malloc(uint32_t size)
 	if((krnl_heap_ptr.free == 0) || (size >krnl_heap_ptr.free->size)){
 		krnl_heap_ptr.free = compact(krnl_heap_ptr.heap, size);
 		if(krnl_heap_ptr.free == 0){
+			heap_count.failed++;
 			hf_mtxunlock(&krnl_malloc);
 			return NULL;
 		}
@@ -89,12 +129,76 @@ void *hf_malloc(uint32_t size)
 	}
 
 	p->size = size | 1;
+	heap_account(&heap_count, size - sizeof(mem_chunk), 1);
 	hf_mtxunlock(&krnl_malloc);
 	krnl_free = krnl_heap_ptr.free->size;
 
 	return (void *)((uint32_t)p + sizeof(mem_chunk));
 }
 
+static int32_t mem_resize(void *ptr, uint32_t size, uint32_t *old)
+{
+	uint32_t psize, nsize;
+	mem_chunk *p, *n;
+
+	hf_mtxlock(&krnl_malloc);
+	p = (mem_chunk *)((uint32_t)ptr - sizeof(mem_chunk));
+	psize = p->size & ~1;
+	*old = psize - sizeof(mem_chunk);
+	size  += 3 + sizeof(mem_chunk);
+	size >>= 2;
+	size <<= 2;
+
+	/* take the free chunks that follow, if growing */
+	nsize = psize;
+	for (n = (mem_chunk *)((uint32_t)p + nsize); nsize < size && n->size && !(n->size & 1); n = (mem_chunk *)((uint32_t)p + nsize))
+		nsize += n->size;
+	if (nsize < size){
+		hf_mtxunlock(&krnl_malloc);
+		return 0;
+	}
+	if (krnl_heap_ptr.free > p && krnl_heap_ptr.free < (mem_chunk *)((uint32_t)p + nsize))
+		krnl_heap_ptr.free = 0;
+
+	if (nsize >= size + sizeof(mem_chunk)){
+		n = (mem_chunk *)((uint32_t)p + size);
+		n->size = nsize - size;
+		if (krnl_heap_ptr.free == 0)
+			krnl_heap_ptr.free = n;
+	}else{
+		size = nsize;
+	}
+	p->size = size | 1;
+	heap_account(&heap_count, *old, -1);
+	heap_account(&heap_count, size - sizeof(mem_chunk), 1);
+	hf_mtxunlock(&krnl_malloc);
+	if (krnl_heap_ptr.free)
+		krnl_free = krnl_heap_ptr.free->size;
+
+	return 1;
+}
+
+static void heap_walk(struct heap_stats *s)
+{
+	uint32_t psize, run;
+	mem_chunk *p;
+
+	/* adjacent free chunks are merged on demand, so count runs of them */
+	run = 0;
+	for (p = krnl_heap_ptr.heap; (psize = p->size); p = (mem_chunk *)((uint32_t)p + (psize & ~1))){
+		if (!(psize & 1)){
+			run += psize;
+			continue;
+		}
+		if (run){
+			heap_free_block(s, run - sizeof(mem_chunk));
+			run = 0;
+		}
+	}
+	if (run)
+		heap_free_block(s, run - sizeof(mem_chunk));
+}
+
 void heapinit(void *heap, uint32_t len)
 {
 	len  += 3;
@@ -104,7 +208,7 @@ void heapinit(void *heap, uint32_t len)
 	krnl_heap_ptr.free->size = krnl_heap_ptr.heap->size = len - sizeof(mem_chunk);
 	*(uint32_t *)((int8_t *)heap + len - 4) = 0;
 	krnl_free = krnl_heap_ptr.free->size;
-	hf_mtxinit(&krnl_malloc);
+	heap_lock_init();
 }
 #endif
 
@@ -179,9 +283,10 @@ static void free2(void *ptr)
 	freep = p;
 }
 
-void hf_free(void *ptr)
+static void heap_free(void *ptr)
 {
 	hf_mtxlock(&krnl_malloc);
+	heap_account(&heap_count, (((mem_header_t *)ptr) - 1)->s.size * sizeof(mem_header_t) - sizeof(mem_header_t), -1);
 	free2(ptr);
 	hf_mtxunlock(&krnl_malloc);
 }
@@ -231,12 +336,14 @@ void *hf_malloc(uint32_t size)
 			}
 			freep = prevp;
 			krnl_free -= p->s.size * sizeof(mem_header_t);
+			heap_account(&heap_count, (p->s.size - 1) * sizeof(mem_header_t), 1);
 			hf_mtxunlock(&krnl_malloc);
 			
 			return (void*) (p + 1);
 		}else{
 			if (p == freep){
 				if ((p = morecore(nquantas)) == 0){
+					heap_count.failed++;
 					hf_mtxunlock(&krnl_malloc);
 					return 0;
 				}
@@ -245,6 +352,74 @@ void *hf_malloc(uint32_t size)
 	}
 }
 
+static int32_t mem_resize(void *ptr, uint32_t size, uint32_t *old)
+{
+	mem_header_t *block, *p, *q, *r;
+	uint32_t qsize, nquantas = (size + sizeof(mem_header_t) - 1) / sizeof(mem_header_t) + 1;
+
+	hf_mtxlock(&krnl_malloc);
+	block = ((mem_header_t *)ptr) - 1;
+	*old = (block->s.size - 1) * sizeof(mem_header_t);
+
+	/* shrink, the tail goes back to the free list */
+	if (nquantas <= block->s.size){
+		if (nquantas < block->s.size){
+			r = block + nquantas;
+			r->s.size = block->s.size - nquantas;
+			block->s.size = nquantas;
+			krnl_free += r->s.size * sizeof(mem_header_t);
+			free2((void *)(r + 1));
+			heap_account(&heap_count, *old, -1);
+			heap_account(&heap_count, (nquantas - 1) * sizeof(mem_header_t), 1);
+		}
+		hf_mtxunlock(&krnl_malloc);
+		return 1;
+	}
+
+	/* grow, if the next block is free and large enough */
+	p = freep;
+	do{
+		if (p->s.next == block + block->s.size)
+			break;
+		p = p->s.next;
+	}while (p != freep);
+	q = p->s.next;
+	if (q != block + block->s.size || block->s.size + q->s.size < nquantas){
+		hf_mtxunlock(&krnl_malloc);
+		return 0;
+	}
+	qsize = q->s.size - (nquantas - block->s.size);
+	if (qsize == 0){
+		p->s.next = q->s.next;
+	}else{
+		r = block + nquantas;
+		r->s.next = q->s.next;
+		r->s.size = qsize;
+		p->s.next = r;
+	}
+	krnl_free -= (nquantas - block->s.size) * sizeof(mem_header_t);
+	block->s.size = nquantas;
+	freep = p;
+	heap_account(&heap_count, *old, -1);
+	heap_account(&heap_count, (nquantas - 1) * sizeof(mem_header_t), 1);
+	hf_mtxunlock(&krnl_malloc);
+
+	return 1;
+}
+
+static void heap_walk(struct heap_stats *s)
+{
+	mem_header_t *p;
+
+	if (freep){
+		for (p = base.s.next; p != &base; p = p->s.next)
+			heap_free_block(s, (p->s.size - 1) * sizeof(mem_header_t));
+	}
+	/* memory not yet taken by morecore() */
+	if (pool_free_pos + sizeof(mem_header_t) < HEAP_SIZE)
+		heap_free_block(s, HEAP_SIZE - pool_free_pos - sizeof(mem_header_t));
+}
+
 void heapinit(void *heap, uint32_t len)
 {
 	base.s.next = 0;
@@ -252,7 +427,7 @@ void heapinit(void *heap, uint32_t len)
 	freep = 0;
 	pool_free_pos = 0;
 	krnl_free = HEAP_SIZE;
-	hf_mtxinit(&krnl_malloc);
+	heap_lock_init();
 }
 #endif
 
@@ -266,12 +441,13 @@ void heapinit(void *heap, uint32_t len)
  * allocator performs better on the average case.
  */
  
-void hf_free(void *ptr)
+static void heap_free(void *ptr)
 {
 	struct mem_block *p, *q;
 	
 	hf_mtxlock(&krnl_malloc);
 	p = ((struct mem_block *)ptr) - 1;
+	heap_account(&heap_count, p->size & 0xfffffffe, -1);
 	p->size &= 0xfffffffe;
 	krnl_free += p->size + sizeof(struct mem_block);
 
@@ -306,6 +482,7 @@ void *hf_malloc(uint32_t size)
 	p = ff;
 	while (p->size < size + sizeof(struct mem_block) || p->size & 1){
 		if (p->next == NULL && p->size < size){
+			heap_count.failed++;
 			hf_mtxunlock(&krnl_malloc);
 			return 0;
 		}
@@ -322,11 +499,69 @@ void *hf_malloc(uint32_t size)
 	n.size = psize;
 	*p->next = n;
 	krnl_free -= size + sizeof(struct mem_block);
+	heap_account(&heap_count, size, 1);
 	hf_mtxunlock(&krnl_malloc);
 
 	return (void *)(p + 1);
 }
 
+static int32_t mem_resize(void *ptr, uint32_t size, uint32_t *old)
+{
+	struct mem_block *p, *q, *n;
+	size_t avail;
+
+	size = align4(size);
+
+	hf_mtxlock(&krnl_malloc);
+	p = ((struct mem_block *)ptr) - 1;
+	*old = p->size & ~1L;
+	if (size <= *old && *old < size + sizeof(struct mem_block)){
+		hf_mtxunlock(&krnl_malloc);
+		return 1;
+	}
+
+	/* take the free blocks that follow, if growing. as in hf_malloc(), a block is always
+	 * left between the resized block and the next used one (or the end of the heap) */
+	for (q = p->next; q->next && !(q->size & 1) && (size_t)q - (size_t)(p + 1) < size + sizeof(struct mem_block); q = q->next);
+	avail = (size_t)q - (size_t)(p + 1);
+	if (avail < size + sizeof(struct mem_block)){
+		hf_mtxunlock(&krnl_malloc);
+		return 0;
+	}
+	if (ff > p && ff < q)
+		ff = (struct mem_block *)krnl_heap;
+
+	n = (struct mem_block *)((size_t)(p + 1) + size);
+	n->next = q;
+	n->size = avail - size - sizeof(struct mem_block);
+	p->next = n;
+	p->size = size | 1;
+	krnl_free += *old;
+	krnl_free -= size;
+	heap_account(&heap_count, *old, -1);
+	heap_account(&heap_count, size, 1);
+	hf_mtxunlock(&krnl_malloc);
+
+	return 1;
+}
+
+static void heap_walk(struct heap_stats *s)
+{
+	struct mem_block *p, *q;
+
+	/* adjacent free blocks are merged on demand, so count runs of them */
+	p = (struct mem_block *)krnl_heap;
+	while (p->next){
+		if (p->size & 1){
+			p = p->next;
+			continue;
+		}
+		for (q = p; q->next && !(q->size & 1); q = q->next);
+		heap_free_block(s, (size_t)q - (size_t)(p + 1));
+		p = q;
+	}
+}
+
 void heapinit(void *heap, uint32_t len)
 {
 	struct mem_block *p = (struct mem_block *)heap;
@@ -339,7 +574,7 @@ void heapinit(void *heap, uint32_t len)
 	q->size = 0;
 	ff = (struct mem_block *)krnl_heap;
 	krnl_free = p->size;
-	hf_mtxinit(&krnl_malloc);
+	heap_lock_init();
 }
 #endif
 
@@ -351,14 +586,17 @@ void heapinit(void *heap, uint32_t len)
  * are searched from the beginning of the heap and are coalesced on demand. yet,
  * just one sweep through memory areas is performed, making it faster than the
  * previous allocator on the average case. hf_free() is very fast, as memory areas
- * are just marked as unused.
+ * are just marked as unused. the idle task coalesces them in the background
+ * (hf_heapidle()), so the merging done by malloc() is usually short.
  */
-void hf_free(void *ptr)
+static void heap_free(void *ptr)
 {
 	struct mem_block *p;
 	
 	hf_mtxlock(&krnl_malloc);
+	heap_ops++;
 	p = ((struct mem_block *)ptr) - 1;
+	heap_account(&heap_count, p->size & ~1L, -1);
 	p->size &= ~1L;
 	last_free = first_free;
 	krnl_free += p->size + sizeof(struct mem_block);
@@ -372,6 +610,7 @@ void *hf_malloc(uint32_t size)
 	size = align4(size);
 	
 	hf_mtxlock(&krnl_malloc);
+	heap_ops++;
 
 	p = last_free;
 	q = p;
@@ -386,6 +625,8 @@ void *hf_malloc(uint32_t size)
 		if (p){
 			q->size = (size_t)p - (size_t)q - sizeof(struct mem_block);
 			q->next = p;
+			if (idle_pos > q && idle_pos < p)
+				idle_pos = q;
 		}
 		if (q->size >= size + sizeof(struct mem_block)){
 			p = q;
@@ -394,6 +635,7 @@ void *hf_malloc(uint32_t size)
 	}
 
 	if (p->next == NULL){
+		heap_count.failed++;
 		hf_mtxunlock(&krnl_malloc);
 		return 0;
 	}
@@ -406,12 +648,73 @@ void *hf_malloc(uint32_t size)
 	n.size = (p->size & ~1L) - size - sizeof(struct mem_block);
 	*p->next = n;
 	krnl_free -= size + sizeof(struct mem_block);
+	heap_account(&heap_count, size, 1);
 	
 	hf_mtxunlock(&krnl_malloc);
 
 	return (void *)(p + 1);
 }
 
+static int32_t mem_resize(void *ptr, uint32_t size, uint32_t *old)
+{
+	struct mem_block *p, *q, *n;
+	size_t avail;
+
+	size = align4(size);
+
+	hf_mtxlock(&krnl_malloc);
+	heap_ops++;
+	p = ((struct mem_block *)ptr) - 1;
+	*old = p->size & ~1L;
+	if (size <= *old && *old < size + sizeof(struct mem_block)){
+		hf_mtxunlock(&krnl_malloc);
+		return 1;
+	}
+
+	/* take the free blocks that follow, if growing. as in hf_malloc(), a block is always
+	 * left between the resized block and the next used one (or the end of the heap) */
+	for (q = p->next; q->next && !(q->size & 1) && (size_t)q - (size_t)(p + 1) < size + sizeof(struct mem_block); q = q->next);
+	avail = (size_t)q - (size_t)(p + 1);
+	if (avail < size + sizeof(struct mem_block)){
+		hf_mtxunlock(&krnl_malloc);
+		return 0;
+	}
+	if (last_free > p && last_free < q)
+		last_free = first_free;
+	if (idle_pos > p && idle_pos < q)
+		idle_pos = p;
+
+	n = (struct mem_block *)((size_t)(p + 1) + size);
+	n->next = q;
+	n->size = avail - size - sizeof(struct mem_block);
+	p->next = n;
+	p->size = size | 1;
+	krnl_free += *old;
+	krnl_free -= size;
+	heap_account(&heap_count, *old, -1);
+	heap_account(&heap_count, size, 1);
+	hf_mtxunlock(&krnl_malloc);
+
+	return 1;
+}
+
+static void heap_walk(struct heap_stats *s)
+{
+	struct mem_block *p, *q;
+
+	/* adjacent free blocks are merged on demand, so count runs of them */
+	p = first_free;
+	while (p->next){
+		if (p->size & 1){
+			p = p->next;
+			continue;
+		}
+		for (q = p; q->next && !(q->size & 1); q = q->next);
+		heap_free_block(s, (size_t)q - (size_t)(p + 1));
+		p = q;
+	}
+}
+
 void heapinit(void *heap, uint32_t len)
 {
 	struct mem_block *p = (struct mem_block *)heap;
@@ -425,10 +728,488 @@ void heapinit(void *heap, uint32_t len)
 	first_free = (struct mem_block *)heap;
 	last_free = (struct mem_block *)heap;
 	krnl_free = p->size;
-	hf_mtxinit(&krnl_malloc);
+	heap_lock_init();
 }
 #endif
 
+#if MEM_ALLOC == 4
+/*
+ * memory allocator using two level segregated fit (TLSF)
+ * 
+ * free blocks are kept on segregated lists, by size class. the first level splits
+ * sizes by powers of 2 and the second level splits each power of 2 in 16 classes.
+ * two bitmaps tell which lists hold free blocks, so a suitable list is found with
+ * a couple of bit scans and hf_malloc() / hf_free() take constant time, however
+ * fragmented the heap is. blocks are split on allocation and their physical
+ * neighbours are coalesced on release. searches round the request up to the next
+ * size class, so any block on the list found is large enough (good fit).
+ */
+#define TLSF_HDR	(sizeof(struct tlsf_block *) + sizeof(size_t))
+#define TLSF_MIN	(sizeof(struct tlsf_block) - TLSF_HDR)
+
+#define tlsf_size(b)	((b)->size & ~(TLSF_FREE | TLSF_PREV_FREE))
+#define tlsf_next(b)	((struct tlsf_block *)((size_t)(b) + TLSF_HDR + tlsf_size(b)))
+
+static void tlsf_mapping(size_t size, int32_t *fl, int32_t *sl)
+{
+	int32_t f;
+
+	if (size < (1 << TLSF_FL_SHIFT)){
+		*fl = 0;
+		*sl = size >> 2;
+	}else{
+		f = 31 - __builtin_clz(size);
+		*fl = f - TLSF_FL_SHIFT + 1;
+		*sl = (size >> (f - TLSF_SL_BITS)) ^ TLSF_SL_COUNT;
+	}
+}
+
+static void tlsf_insert(struct tlsf_block *b)
+{
+	int32_t fl, sl;
+
+	tlsf_mapping(tlsf_size(b), &fl, &sl);
+	b->prev_free = NULL;
+	b->next_free = tlsf.blocks[fl][sl];
+	if (b->next_free)
+		b->next_free->prev_free = b;
+	tlsf.blocks[fl][sl] = b;
+	tlsf.fl_bitmap |= 1U << fl;
+	tlsf.sl_bitmap[fl] |= 1U << sl;
+}
+
+static void tlsf_remove(struct tlsf_block *b)
+{
+	int32_t fl, sl;
+
+	tlsf_mapping(tlsf_size(b), &fl, &sl);
+	if (b->prev_free)
+		b->prev_free->next_free = b->next_free;
+	else
+		tlsf.blocks[fl][sl] = b->next_free;
+	if (b->next_free)
+		b->next_free->prev_free = b->prev_free;
+	if (!tlsf.blocks[fl][sl]){
+		tlsf.sl_bitmap[fl] &= ~(1U << sl);
+		if (!tlsf.sl_bitmap[fl])
+			tlsf.fl_bitmap &= ~(1U << fl);
+	}
+}
+
+static void heap_free(void *ptr)
+{
+	struct tlsf_block *b, *n;
+
+	if (!ptr) return;
+	hf_mtxlock(&krnl_malloc);
+	b = (struct tlsf_block *)((size_t)ptr - TLSF_HDR);
+	krnl_free += tlsf_size(b) + TLSF_HDR;
+	heap_account(&heap_count, tlsf_size(b), -1);
+	b->size |= TLSF_FREE;
+	if (b->size & TLSF_PREV_FREE){
+		n = b->prev_phys;
+		tlsf_remove(n);
+		n->size += tlsf_size(b) + TLSF_HDR;
+		b = n;
+	}
+	n = tlsf_next(b);
+	if (n->size & TLSF_FREE){
+		tlsf_remove(n);
+		b->size += tlsf_size(n) + TLSF_HDR;
+		n = tlsf_next(b);
+	}
+	n->prev_phys = b;
+	n->size |= TLSF_PREV_FREE;
+	tlsf_insert(b);
+	hf_mtxunlock(&krnl_malloc);
+}
+
+void *hf_malloc(uint32_t size)
+{
+	struct tlsf_block *b, *r;
+	uint32_t map;
+	int32_t fl, sl;
+
+	size = align4(size);
+	if (size < TLSF_MIN) size = TLSF_MIN;
+	if (size > 0x7fffffff) return 0;
+
+	hf_mtxlock(&krnl_malloc);
+	/* round up to the next size class, so any block on the selected list fits */
+	if (size >= (1 << TLSF_FL_SHIFT))
+		tlsf_mapping(size + (1 << (31 - __builtin_clz(size) - TLSF_SL_BITS)) - 1, &fl, &sl);
+	else
+		tlsf_mapping(size, &fl, &sl);
+	map = fl < TLSF_FL_COUNT ? tlsf.sl_bitmap[fl] & (~0U << sl) : 0;
+	if (!map){
+		map = fl + 1 < TLSF_FL_COUNT ? tlsf.fl_bitmap & (~0U << (fl + 1)) : 0;
+		if (!map){
+			heap_count.failed++;
+			hf_mtxunlock(&krnl_malloc);
+			return 0;
+		}
+		fl = __builtin_ctz(map);
+		map = tlsf.sl_bitmap[fl];
+	}
+	sl = __builtin_ctz(map);
+	b = tlsf.blocks[fl][sl];
+	tlsf_remove(b);
+
+	if (tlsf_size(b) >= size + TLSF_HDR + TLSF_MIN){
+		r = (struct tlsf_block *)((size_t)b + TLSF_HDR + size);
+		r->size = (tlsf_size(b) - size - TLSF_HDR) | TLSF_FREE;
+		r->prev_phys = b;
+		tlsf_next(r)->prev_phys = r;
+		b->size = size | (b->size & TLSF_PREV_FREE);
+		tlsf_insert(r);
+	}else{
+		b->size &= ~TLSF_FREE;
+		tlsf_next(b)->size &= ~TLSF_PREV_FREE;
+	}
+	krnl_free -= tlsf_size(b) + TLSF_HDR;
+	heap_account(&heap_count, tlsf_size(b), 1);
+	hf_mtxunlock(&krnl_malloc);
+
+	return (void *)((size_t)b + TLSF_HDR);
+}
+
+static int32_t mem_resize(void *ptr, uint32_t size, uint32_t *old)
+{
+	struct tlsf_block *b, *n, *r;
+
+	size = align4(size);
+	if (size < TLSF_MIN) size = TLSF_MIN;
+	if (size > 0x7fffffff) return 0;
+
+	hf_mtxlock(&krnl_malloc);
+	b = (struct tlsf_block *)((size_t)ptr - TLSF_HDR);
+	*old = tlsf_size(b);
+
+	/* grow, taking the next block if it is free and large enough */
+	if (size > tlsf_size(b)){
+		n = tlsf_next(b);
+		if (!(n->size & TLSF_FREE) || tlsf_size(b) + TLSF_HDR + tlsf_size(n) < size){
+			hf_mtxunlock(&krnl_malloc);
+			return 0;
+		}
+		tlsf_remove(n);
+		b->size += tlsf_size(n) + TLSF_HDR;
+		n = tlsf_next(b);
+		n->prev_phys = b;
+		n->size &= ~TLSF_PREV_FREE;
+	}
+
+	/* give back the tail, merged with the next block if that one is free */
+	if (tlsf_size(b) >= size + TLSF_HDR + TLSF_MIN){
+		r = (struct tlsf_block *)((size_t)b + TLSF_HDR + size);
+		r->size = (tlsf_size(b) - size - TLSF_HDR) | TLSF_FREE;
+		r->prev_phys = b;
+		b->size = size | (b->size & TLSF_PREV_FREE);
+		n = tlsf_next(r);
+		if (n->size & TLSF_FREE){
+			tlsf_remove(n);
+			r->size += tlsf_size(n) + TLSF_HDR;
+			n = tlsf_next(r);
+		}
+		n->prev_phys = r;
+		n->size |= TLSF_PREV_FREE;
+		tlsf_insert(r);
+	}
+	krnl_free += *old;
+	krnl_free -= tlsf_size(b);
+	heap_account(&heap_count, *old, -1);
+	heap_account(&heap_count, tlsf_size(b), 1);
+	hf_mtxunlock(&krnl_malloc);
+
+	return 1;
+}
+
+static void heap_walk(struct heap_stats *s)
+{
+	struct tlsf_block *b;
+	uint32_t fl, sl;
+
+	for (fl = 0; fl < TLSF_FL_COUNT; fl++){
+		if (!(tlsf.fl_bitmap & (1U << fl)))
+			continue;
+		for (sl = 0; sl < TLSF_SL_COUNT; sl++)
+			for (b = tlsf.blocks[fl][sl]; b; b = b->next_free)
+				heap_free_block(s, tlsf_size(b));
+	}
+}
+
+void heapinit(void *heap, uint32_t len)
+{
+	struct tlsf_block *b, *s;
+
+	memset(&tlsf, 0, sizeof(tlsf));
+	b = (struct tlsf_block *)align4((size_t)heap);
+	len = (len - ((size_t)b - (size_t)heap)) & ~3;
+	s = (struct tlsf_block *)((size_t)b + len - TLSF_HDR);	/* sentinel, never free */
+	b->prev_phys = NULL;
+	b->size = (len - TLSF_HDR - TLSF_HDR) | TLSF_FREE;
+	s->prev_phys = b;
+	s->size = TLSF_PREV_FREE;
+	tlsf_insert(b);
+	krnl_free = tlsf_size(b);
+	heap_lock_init();
+}
+#endif
+
+#if MEM_ALLOC == 3
+/*
+ * idle time heap maintenance
+ *
+ * the idle task walks the heap a few blocks at a time, merging each free block with the
+ * free blocks that follow it. the mutex is only tried, so the idle task never blocks, and
+ * each call holds it for at most HEAP_IDLE_BLOCKS steps. hf_malloc() and mem_resize() move
+ * the walk back if they merge the block it stopped at. after a full pass without other heap
+ * operations, searches that would start at the beginning of the heap are set to start at
+ * the first free block instead.
+ */
+static struct mem_block *idle_low;
+static uint32_t idle_ops;
+static int32_t idle_clean;
+
+void hf_heapidle(void)
+{
+	struct mem_block *p, *q;
+	int32_t i;
+
+	if (hf_mtxtrylock(&krnl_malloc))
+		return;
+
+	if (idle_ops != heap_ops){
+		idle_ops = heap_ops;
+		idle_clean = 0;
+	}
+	if (!idle_pos){
+		idle_pos = first_free;
+		idle_low = NULL;
+		idle_clean = 1;
+	}
+
+	p = idle_pos;
+	for (i = 0; i < HEAP_IDLE_BLOCKS && p->next; i++){
+		if (p->size & 1){
+			p = p->next;
+			continue;
+		}
+		q = p->next;
+		if (q->next && !(q->size & 1)){
+			p->next = q->next;
+			p->size = (size_t)q->next - (size_t)p - sizeof(struct mem_block);
+			if (last_free == q)
+				last_free = p;
+			continue;
+		}
+		if (!idle_low)
+			idle_low = p;
+		p = q;
+	}
+
+	if (p->next){
+		idle_pos = p;
+	} else {
+		if (idle_clean && idle_low && last_free == first_free)
+			last_free = idle_low;
+		idle_pos = NULL;
+	}
+	hf_mtxunlock(&krnl_malloc);
+}
+#else
+void hf_heapidle(void)
+{
+}
+#endif
+
+#if HEAP_REGIONS > 1
+/*
+ * heap regions
+ *
+ * memory other than the kernel heap (external SRAM or SDRAM, for example) is registered
+ * with hf_heapregion() and allocated from with hf_malloc_region(). each region has its own
+ * lock and statistics, so slow bulk allocations don't hold the kernel heap. blocks are kept
+ * by a first-fit allocator with a free list in address order, and are coalesced with their
+ * free neighbours when freed. hf_free() and hf_realloc() find the region of a block by its
+ * address, so regions must not overlap the kernel heap.
+ */
+#define region_align(x) (((x) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+
+struct region_block {
+	struct region_block *next;	/* next free block, in address order (NULL on used blocks) */
+	size_t size;			/* aligned block size, without the header */
+};
+
+struct heap_region {
+	mutex_t lock;					/* region lock */
+	struct region_block *free;			/* free list */
+	size_t base;					/* start of the region (0 if not registered) */
+	size_t end;					/* end of the region */
+	struct heap_stats count;			/* allocation counters */
+};
+
+static struct heap_region heap_regions[HEAP_REGIONS - 1];
+
+static struct heap_region *region_of(void *ptr)
+{
+	int32_t i;
+
+	for (i = 0; i < HEAP_REGIONS - 1; i++)
+		if ((size_t)ptr >= heap_regions[i].base && (size_t)ptr < heap_regions[i].end)
+			return &heap_regions[i];
+
+	return NULL;
+}
+
+static void *region_malloc(struct heap_region *r, uint32_t size)
+{
+	struct region_block *p, *prev;
+
+	size = region_align(size);
+
+	hf_mtxlock(&r->lock);
+	for (prev = NULL, p = r->free; p; prev = p, p = p->next)
+		if (p->size >= size) break;
+
+	if (!p){
+		r->count.failed++;
+		hf_mtxunlock(&r->lock);
+		return NULL;
+	}
+
+	if (p->size >= size + 2 * sizeof(struct region_block)){
+		/* split, taking the end of the free block (the free list is left as is) */
+		p->size -= size + sizeof(struct region_block);
+		p = (struct region_block *)((size_t)(p + 1) + p->size);
+		p->size = size;
+	} else {
+		if (prev)
+			prev->next = p->next;
+		else
+			r->free = p->next;
+	}
+	p->next = NULL;
+	heap_account(&r->count, p->size, 1);
+	hf_mtxunlock(&r->lock);
+
+	return (void *)(p + 1);
+}
+
+static void region_free(struct heap_region *r, void *ptr)
+{
+	struct region_block *p, *q, *prev;
+
+	p = ((struct region_block *)ptr) - 1;
+
+	hf_mtxlock(&r->lock);
+	heap_account(&r->count, p->size, -1);
+	for (prev = NULL, q = r->free; q && q < p; prev = q, q = q->next);
+
+	if (q && (size_t)(p + 1) + p->size == (size_t)q){
+		p->size += q->size + sizeof(struct region_block);
+		p->next = q->next;
+	} else {
+		p->next = q;
+	}
+	if (prev && (size_t)(prev + 1) + prev->size == (size_t)p){
+		prev->size += p->size + sizeof(struct region_block);
+		prev->next = p->next;
+	} else if (prev) {
+		prev->next = p;
+	} else {
+		r->free = p;
+	}
+	hf_mtxunlock(&r->lock);
+}
+#endif
+
+/**
+ * @brief Registers a heap region.
+ * 
+ * @param region is the region number, HEAP_EXTERNAL or another below HEAP_REGIONS.
+ * @param base is the start of the memory area.
+ * @param len is the size of the memory area, in bytes.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if the region number is invalid or already
+ * registered, or if the area is too small.
+ * 
+ * The region must not be part of the kernel heap or of another region. Regions can't be
+ * removed, so this is usually done once on the board initialization (after the memory
+ * controller, an EBI for example, is set up).
+ */
+int32_t hf_heapregion(uint16_t region, void *base, uint32_t len)
+{
+#if HEAP_REGIONS > 1
+	struct heap_region *r;
+	struct region_block *p;
+	size_t start, end;
+
+	if (region == HEAP_INTERNAL || region >= HEAP_REGIONS)
+		return ERR_ERROR;
+	r = &heap_regions[region - 1];
+	if (r->end)
+		return ERR_ERROR;
+
+	start = region_align((size_t)base);
+	end = ((size_t)base + len) & ~(sizeof(size_t) - 1);
+	if (end < start + 2 * sizeof(struct region_block))
+		return ERR_ERROR;
+
+	p = (struct region_block *)start;
+	p->next = NULL;
+	p->size = end - start - sizeof(struct region_block);
+	memset(&r->count, 0, sizeof(struct heap_stats));
+	hf_mtxinit(&r->lock);
+#if LOCK_STATS == 1
+	hf_mtxstat(&r->lock, "heap_region");
+#endif
+	r->free = p;
+	r->base = start;
+	r->end = end;
+
+	return ERR_OK;
+#else
+	return ERR_ERROR;
+#endif
+}
+
+/**
+ * @brief Allocates memory from a heap region.
+ * 
+ * @param size is the size of the block, in bytes.
+ * @param region is the region number, HEAP_INTERNAL for the kernel heap.
+ * 
+ * @return a pointer to the block or NULL if the region has no room for it.
+ * 
+ * The region is a placement hint: if it was not registered with hf_heapregion() (the board
+ * has no such memory) the block comes from the kernel heap, as hf_malloc() does. Blocks
+ * are released with hf_free().
+ */
+void *hf_malloc_region(uint32_t size, uint16_t region)
+{
+#if HEAP_REGIONS > 1
+	if (region != HEAP_INTERNAL && region < HEAP_REGIONS && heap_regions[region - 1].end)
+		return region_malloc(&heap_regions[region - 1], size);
+#endif
+
+	return hf_malloc(size);
+}
+
+void hf_free(void *ptr)
+{
+#if HEAP_REGIONS > 1
+	struct heap_region *r;
+
+	r = region_of(ptr);
+	if (r){
+		region_free(r, ptr);
+		return;
+	}
+#endif
+	heap_free(ptr);
+}
+
 void *hf_calloc(uint32_t qty, uint32_t type_size)
 {
 	void *buf;
@@ -442,17 +1223,102 @@ void *hf_calloc(uint32_t qty, uint32_t type_size)
 
 void *hf_realloc(void *ptr, uint32_t size){
 	void *buf;
+	uint32_t old;
+#if HEAP_REGIONS > 1
+	struct heap_region *r;
+#endif
 
 	if ((int32_t)size < 0) return NULL;
 	if (ptr == NULL)
 		return (void *)hf_malloc(size);
 
+#if HEAP_REGIONS > 1
+	/* blocks of a region stay there, and are not resized in place */
+	r = region_of(ptr);
+	if (r){
+		old = (((struct region_block *)ptr) - 1)->size;
+		if (size <= old)
+			return ptr;
+		buf = region_malloc(r, size);
+		if (buf){
+			memcpy(buf, ptr, old);
+			region_free(r, ptr);
+		}
+		return buf;
+	}
+#endif
+
+	if (mem_resize(ptr, size, &old))
+		return ptr;
+
 	buf = (void *)hf_malloc(size);
 	if (buf){
-		memcpy(buf, ptr, size);
+		memcpy(buf, ptr, old < size ? old : size);
 		hf_free(ptr);
 	}
 
 	return (void *)buf;
 }
 
+
+/**
+ * @brief Returns heap usage statistics.
+ * 
+ * @param s is a pointer to a structure filled with the statistics.
+ * 
+ * Free memory figures (free, largest and free_blocks) come from a walk through the free
+ * blocks (or the whole heap for MEM_ALLOC 0, 2 and 3), which is made with the heap locked.
+ * The allocation counters are kept by hf_malloc() and hf_free() and are just copied.
+ */
+void hf_heapstats(struct heap_stats *s)
+{
+	hf_mtxlock(&krnl_malloc);
+	memcpy(s, &heap_count, sizeof(struct heap_stats));
+	s->free = 0;
+	s->largest = 0;
+	s->free_blocks = 0;
+	heap_walk(s);
+	hf_mtxunlock(&krnl_malloc);
+}
+
+/**
+ * @brief Returns usage statistics of a heap region.
+ * 
+ * @param region is the region number, HEAP_INTERNAL for the kernel heap.
+ * @param s is a pointer to a structure filled with the statistics.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if the region was not registered.
+ * 
+ * Same as hf_heapstats(), for the given region. The free blocks of a region are always
+ * coalesced, so free_blocks is the actual fragmentation of the region.
+ */
+int32_t hf_heapstats_region(uint16_t region, struct heap_stats *s)
+{
+#if HEAP_REGIONS > 1
+	struct heap_region *r;
+	struct region_block *p;
+#endif
+
+	if (region == HEAP_INTERNAL){
+		hf_heapstats(s);
+		return ERR_OK;
+	}
+#if HEAP_REGIONS > 1
+	if (region >= HEAP_REGIONS || !heap_regions[region - 1].end)
+		return ERR_ERROR;
+	r = &heap_regions[region - 1];
+
+	hf_mtxlock(&r->lock);
+	memcpy(s, &r->count, sizeof(struct heap_stats));
+	s->free = 0;
+	s->largest = 0;
+	s->free_blocks = 0;
+	for (p = r->free; p; p = p->next)
+		heap_free_block(s, p->size);
+	hf_mtxunlock(&r->lock);
+
+	return ERR_OK;
+#else
+	return ERR_ERROR;
+#endif
+}
@@ -0,0 +1,137 @@
+/**
+ * @file pool.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Fixed size object pools. All objects of a pool are allocated from the heap at once, on the
+ * creation of the pool, and are kept on a free list linked through the free objects themselves.
+ * Allocation and release take constant time and objects carry no header.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <pool.h>
+
+/**
+ * @brief Creates a pool of objects.
+ * 
+ * @param size is the size of each object, in bytes.
+ * @param count is the number of objects.
+ * 
+ * @return pointer to the pool on success and NULL otherwise.
+ */
+struct pool *hf_pool_create(uint32_t size, uint32_t count)
+{
+	struct pool *p;
+	uint32_t i;
+
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	p = hf_malloc(sizeof(struct pool) + size * count);
+	if (p == NULL)
+		return NULL;
+	p->size = size;
+	p->count = count;
+	p->free = count;
+	p->area = (uint8_t *)(p + 1);
+	p->free_list = NULL;
+	for (i = count; i > 0; i--){
+		*(void **)(p->area + (i - 1) * size) = p->free_list;
+		p->free_list = p->area + (i - 1) * size;
+	}
+
+	return p;
+}
+
+/**
+ * @brief Destroys a pool.
+ * 
+ * @param p is a pointer to a pool.
+ * 
+ * @return 0 when successful and -1 if objects of the pool are still in use.
+ */
+int32_t hf_pool_destroy(struct pool *p)
+{
+	if (p->free != p->count)
+		return -1;
+	hf_free(p);
+
+	return 0;
+}
+
+/**
+ * @brief Allocates an object from a pool.
+ * 
+ * @param p is a pointer to a pool.
+ * 
+ * @return pointer to the object or NULL if the pool is exhausted.
+ * 
+ * May be called from interrupt handlers.
+ */
+void *hf_pool_alloc(struct pool *p)
+{
+	volatile uint32_t status;
+	void *ptr;
+
+	status = _di();
+	ptr = p->free_list;
+	if (ptr){
+		p->free_list = *(void **)ptr;
+		p->free--;
+	}
+	_ei(status);
+
+	return ptr;
+}
+
+/**
+ * @brief Returns an object to its pool.
+ * 
+ * @param p is a pointer to a pool.
+ * @param ptr is a pointer to an object allocated from the pool.
+ * 
+ * May be called from interrupt handlers.
+ */
+void hf_pool_free(struct pool *p, void *ptr)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	*(void **)ptr = p->free_list;
+	p->free_list = ptr;
+	p->free++;
+	_ei(status);
+}
+
+/**
+ * @brief Checks if an object belongs to a pool.
+ * 
+ * @param p is a pointer to a pool.
+ * @param ptr is a pointer to an object.
+ * 
+ * @return 1 if the object is part of the pool storage and 0 otherwise.
+ */
+int32_t hf_pool_owns(struct pool *p, void *ptr)
+{
+	return (uint8_t *)ptr >= p->area && (uint8_t *)ptr < p->area + p->size * p->count;
+}
+
+/**
+ * @brief Returns the number of free objects of a pool.
+ * 
+ * @param p is a pointer to a pool.
+ * 
+ * @return number of free objects.
+ */
+int32_t hf_pool_count(struct pool *p)
+{
+	return p->free;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file pqueue.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Priority queues, implemented as binary min heaps of fixed capacity. Nodes are embedded
+ * in the queued objects and keep their position on the heap, so a queued node can have its
+ * key changed or be removed in logarithmic time, without a search. Memory is allocated only
+ * on the creation of queues (the queue and its heap array as a single block), so these
+ * primitives may be called from interrupt handlers, or with interrupts disabled. No locking
+ * is done, callers must synchronize.
+ * 
+ * Keys are compared as (int32_t)(a - b) < 0, so they may be absolute times (or deadlines)
+ * on a wrapping counter, as long as queued keys are less than 2^31 apart.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <pqueue.h>
+
+#define pq_less(a, b)	((int32_t)((a)->key - (b)->key) < 0)
+
+static void pq_place(struct pqueue *pq, struct pq_node *node, int32_t i)
+{
+	pq->data[i] = node;
+	node->index = i;
+}
+
+static void pq_up(struct pqueue *pq, int32_t i)
+{
+	struct pq_node *node = pq->data[i];
+	int32_t parent;
+
+	while (i > 0){
+		parent = (i - 1) >> 1;
+		if (!pq_less(node, pq->data[parent]))
+			break;
+		pq_place(pq, pq->data[parent], i);
+		i = parent;
+	}
+	pq_place(pq, node, i);
+}
+
+static void pq_down(struct pqueue *pq, int32_t i)
+{
+	struct pq_node *node = pq->data[i];
+	int32_t child;
+
+	for (;;){
+		child = (i << 1) + 1;
+		if (child >= pq->elem)
+			break;
+		if (child + 1 < pq->elem && pq_less(pq->data[child + 1], pq->data[child]))
+			child++;
+		if (!pq_less(pq->data[child], node))
+			break;
+		pq_place(pq, pq->data[child], i);
+		i = child;
+	}
+	pq_place(pq, node, i);
+}
+
+/**
+ * @brief Creates a priority queue of specified size.
+ * 
+ * @param size is the maximum number of nodes.
+ * 
+ * @return pointer to the queue on success and NULL otherwise.
+ */
+struct pqueue *hf_pq_create(int32_t size)
+{
+	struct pqueue *pq = hf_malloc(sizeof(struct pqueue) + size * sizeof(struct pq_node *));
+
+	if (pq == NULL)
+		return NULL;
+	pq->size = size;
+	pq->elem = 0;
+	pq->data = (struct pq_node **)(pq + 1);
+
+	return pq;
+}
+
+/**
+ * @brief Destroys a priority queue.
+ * 
+ * @param pq is a pointer to a priority queue.
+ * 
+ * @return 0 when successful and -1 if the queue is not empty.
+ */
+int32_t hf_pq_destroy(struct pqueue *pq)
+{
+	if (pq->elem)
+		return -1;
+	hf_free(pq);
+
+	return 0;
+}
+
+/**
+ * @brief Counts the number of nodes in a priority queue.
+ * 
+ * @param pq is a pointer to a priority queue.
+ * 
+ * @return the number of nodes.
+ */
+int32_t hf_pq_count(struct pqueue *pq)
+{
+	return pq->elem;
+}
+
+/**
+ * @brief Inserts a node on a priority queue.
+ * 
+ * @param pq is a pointer to a priority queue.
+ * @param node is a pointer to a node, which must not be queued.
+ * @param key is the node priority.
+ * 
+ * @return 0 when successful and -1 if the queue is full.
+ */
+int32_t hf_pq_insert(struct pqueue *pq, struct pq_node *node, uint32_t key)
+{
+	if (pq->elem >= pq->size)
+		return -1;
+	node->key = key;
+	pq->data[pq->elem] = node;
+	pq_up(pq, pq->elem++);
+
+	return 0;
+}
+
+/**
+ * @brief Returns the node with the lowest key, without removing it.
+ * 
+ * @param pq is a pointer to a priority queue.
+ * 
+ * @return pointer to the node or NULL if the queue is empty.
+ */
+struct pq_node *hf_pq_peek(struct pqueue *pq)
+{
+	return pq->elem ? pq->data[0] : NULL;
+}
+
+/**
+ * @brief Removes the node with the lowest key.
+ * 
+ * @param pq is a pointer to a priority queue.
+ * 
+ * @return pointer to the node or NULL if the queue is empty.
+ */
+struct pq_node *hf_pq_extract(struct pqueue *pq)
+{
+	struct pq_node *node;
+
+	if (pq->elem == 0)
+		return NULL;
+	node = pq->data[0];
+	hf_pq_remove(pq, node);
+
+	return node;
+}
+
+/**
+ * @brief Removes a node from a priority queue.
+ * 
+ * @param pq is a pointer to a priority queue.
+ * @param node is a pointer to a queued node.
+ * 
+ * @return 0 when successful and -1 if the node is not on the queue.
+ */
+int32_t hf_pq_remove(struct pqueue *pq, struct pq_node *node)
+{
+	int32_t i = node->index;
+
+	if (i < 0 || i >= pq->elem || pq->data[i] != node)
+		return -1;
+	node->index = -1;
+	if (i == --pq->elem)
+		return 0;
+	pq->data[i] = pq->data[pq->elem];
+	if (i > 0 && pq_less(pq->data[i], pq->data[(i - 1) >> 1]))
+		pq_up(pq, i);
+	else
+		pq_down(pq, i);
+
+	return 0;
+}
+
+/**
+ * @brief Changes the key of a queued node (decrease or increase key).
+ * 
+ * @param pq is a pointer to a priority queue.
+ * @param node is a pointer to a queued node.
+ * @param key is the new node priority.
+ * 
+ * @return 0 when successful and -1 if the node is not on the queue.
+ */
+int32_t hf_pq_update(struct pqueue *pq, struct pq_node *node, uint32_t key)
+{
+	int32_t i = node->index;
+	uint32_t old = node->key;
+
+	if (i < 0 || i >= pq->elem || pq->data[i] != node)
+		return -1;
+	node->key = key;
+	if ((int32_t)(key - old) < 0)
+		pq_up(pq, i);
+	else
+		pq_down(pq, i);
+
+	return 0;
+}
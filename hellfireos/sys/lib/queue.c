@@ -11,8 +11,10 @@
  * @section DESCRIPTION
  * 
  * Queue manipulation primitives and auxiliary functions. Queue structures are allocated
- * only on the creation of queues, so little additional overhead regarding memory management
- * is incurred at runtime.
+ * only on the creation of queues (the queue and its array of elements as a single block),
+ * so little additional overhead regarding memory management is incurred at runtime.
+ * The array of elements has a power of 2 number of slots, so ring indexes wrap with a
+ * mask instead of a division (which is a library call on processors without a divider).
  */
 
 #include <hal.h>
@@ -29,23 +31,45 @@
  */
 struct queue *hf_queue_create(int32_t size)
 {
-	struct queue *q = hf_malloc(sizeof(struct queue));
-	
+	struct queue *q;
+	int32_t slots;
+
+	for (slots = 1; slots < size; slots <<= 1);
+	q = hf_malloc(sizeof(struct queue) + slots * sizeof(void *));
 	if (q==NULL){
 		return NULL;
 	}
-	q->size = size + 1;
-	q->data = hf_malloc(q->size * sizeof(void *));
-	if (q->data == NULL){
-		hf_free(q);
-		return NULL;
-	}
+	q->size = size;
+	q->mask = slots - 1;
+	q->data = (void **)(q + 1);
 	q->head = q->tail = 0;
 	q->elem = 0;
 	
 	return q;
 }
 
+/**
+ * @brief Initializes a queue on static memory.
+ *
+ * @param q is a pointer to a queue structure.
+ * @param data is an array of pointers, used as the queue slots.
+ * @param size is the maximum number of elements.
+ *
+ * The array must have room for size rounded up to a power of 2 (twice the size is always
+ * enough). A queue initialized this way must not be destroyed with hf_queue_destroy().
+ */
+void hf_queue_init(struct queue *q, void **data, int32_t size)
+{
+	int32_t slots;
+
+	for (slots = 1; slots < size; slots <<= 1);
+	q->size = size;
+	q->mask = slots - 1;
+	q->data = data;
+	q->head = q->tail = 0;
+	q->elem = 0;
+}
+
 /**
  * @brief Destroys a queue.
  * 
@@ -55,8 +79,7 @@ struct queue *hf_queue_create(int32_t size)
  */
 int32_t hf_queue_destroy(struct queue *q)
 {
-	if (q->head == q->tail){
-		hf_free(q->data);
+	if (q->elem == 0){
 		hf_free(q);
 		return 0;
 	}
@@ -86,13 +109,9 @@ int32_t hf_queue_count(struct queue *q)
  */
 int32_t hf_queue_addtail(struct queue *q, void *ptr)
 {
-	int32_t next;
-
-	if (q->size == 0) return -1;
-	next = (q->tail + 1) % q->size;
-	if (next == q->head) return -1;
+	if (q->elem >= q->size) return -1;
 	q->data[q->tail] = ptr;
-	q->tail = next;
+	q->tail = (q->tail + 1) & q->mask;
 	q->elem++;
 	
 	return 0;
@@ -109,10 +128,9 @@ void *hf_queue_remhead(struct queue *q)
 {
 	void *ret;
 	
-	if (q->size == 0) return NULL;
-	if (q->head == q->tail) return NULL;
+	if (q->elem == 0) return NULL;
 	ret = q->data[q->head];
-	q->head = (q->head + 1) % q->size;
+	q->head = (q->head + 1) & q->mask;
 	q->elem--;
 	
 	return ret;
@@ -129,10 +147,9 @@ void *hf_queue_remtail(struct queue *q)
 {
 	void *ret;
 	
-	if (q->size == 0) return NULL;
-	if (q->head == q->tail) return NULL;
+	if (q->elem == 0) return NULL;
+	q->tail = (q->tail - 1) & q->mask;
 	ret = q->data[q->tail];
-	q->tail = (q->tail - 1) % q->size;
 	q->elem--;
 	
 	return ret;
@@ -150,8 +167,8 @@ void *hf_queue_get(struct queue *q, int32_t elem)
 {
 	void *ret;
 
-	if (q->size == 0 || q->elem <= elem || q->head == q->tail) return 0;
-	ret = q->data[(q->head + elem) % q->size];
+	if (q->elem <= elem) return 0;
+	ret = q->data[(q->head + elem) & q->mask];
 	
 	return ret;
 }
@@ -167,8 +184,8 @@ void *hf_queue_get(struct queue *q, int32_t elem)
  */
 int32_t hf_queue_set(struct queue *q, int32_t elem, void *ptr)
 {
-	if (q->size == 0 || q->elem <= elem || q->head == q->tail) return -1;
-	q->data[(q->head + elem) % q->size] = ptr;
+	if (q->elem <= elem) return -1;
+	q->data[(q->head + elem) & q->mask] = ptr;
 	
 	return 0;
 }
@@ -186,10 +203,118 @@ int32_t hf_queue_swap(struct queue *q, int32_t elem1, int32_t elem2)
 {
 	void *t;
 	
-	if (q->size == 0 || q->elem <= elem1 || q->elem <= elem2 || q->head == q->tail) return -1;
-	t = q->data[(q->head + elem1) % q->size];
-	q->data[(q->head + elem1) % q->size] = q->data[(q->head + elem2) % q->size];
-	q->data[(q->head + elem2) % q->size] = t;
+	if (q->elem <= elem1 || q->elem <= elem2) return -1;
+	elem1 = (q->head + elem1) & q->mask;
+	elem2 = (q->head + elem2) & q->mask;
+	t = q->data[elem1];
+	q->data[elem1] = q->data[elem2];
+	q->data[elem2] = t;
+	
+	return 0;
+}
+
+/* copies n elements (at most q->elem) from the head of the queue to an array */
+static void queue_copyout(struct queue *q, void **buf, int32_t n)
+{
+	int32_t first;
+
+	first = q->mask + 1 - q->head;
+	if (first > n) first = n;
+	memcpy(buf, q->data + q->head, first * sizeof(void *));
+	memcpy(buf + first, q->data, (n - first) * sizeof(void *));
+	q->head = (q->head + n) & q->mask;
+	q->elem -= n;
+}
+
+/* copies n elements (at most q->size - q->elem) from an array to the tail of the queue */
+static void queue_copyin(struct queue *q, void **buf, int32_t n)
+{
+	int32_t first;
+
+	first = q->mask + 1 - q->tail;
+	if (first > n) first = n;
+	memcpy(q->data + q->tail, buf, first * sizeof(void *));
+	memcpy(q->data, buf + first, (n - first) * sizeof(void *));
+	q->tail = (q->tail + n) & q->mask;
+	q->elem += n;
+}
+
+/**
+ * @brief Removes several nodes from the head of the queue.
+ * 
+ * @param q is a pointer to a queue structure.
+ * @param buf is an array which receives pointers to node data, in queue order.
+ * @param n is the maximum number of nodes to remove.
+ * 
+ * @return the number of nodes removed (less than n if the queue had less nodes).
+ * 
+ * Nodes are copied from the (one or two) contiguous segments of the ring at once, instead
+ * of one hf_queue_remhead() at a time.
+ */
+int32_t hf_queue_remn(struct queue *q, void **buf, int32_t n)
+{
+	if (n > q->elem) n = q->elem;
+	if (n <= 0) return 0;
+	queue_copyout(q, buf, n);
+	
+	return n;
+}
+
+/**
+ * @brief Adds several nodes to the tail of the queue.
+ * 
+ * @param q is a pointer to a queue structure.
+ * @param buf is an array of pointers to node data.
+ * @param n is the number of nodes to add.
+ * 
+ * @return 0 when successful and -1 otherwise (the nodes do not fit, and none is added).
+ */
+int32_t hf_queue_addn(struct queue *q, void **buf, int32_t n)
+{
+	if (n < 0 || q->elem + n > q->size) return -1;
+	queue_copyin(q, buf, n);
+	
+	return 0;
+}
+
+/**
+ * @brief Moves nodes from the head of a queue to the tail of another.
+ * 
+ * @param dst is a pointer to the destination queue.
+ * @param src is a pointer to the source queue.
+ * @param n is the number of nodes to move.
+ * 
+ * @return 0 when successful and -1 otherwise (src has less than n nodes, they do not fit
+ * dst or both are the same queue), in which case no node is moved.
+ * 
+ * The order of the nodes is kept. Each contiguous segment of the source ring is copied at
+ * once, with no intermediate array.
+ */
+int32_t hf_queue_splice(struct queue *dst, struct queue *src, int32_t n)
+{
+	int32_t first;
+
+	if (dst == src || n < 0 || n > src->elem || dst->elem + n > dst->size) return -1;
+	first = src->mask + 1 - src->head;
+	if (first > n) first = n;
+	queue_copyin(dst, src->data + src->head, first);
+	queue_copyin(dst, src->data, n - first);
+	src->head = (src->head + n) & src->mask;
+	src->elem -= n;
 	
 	return 0;
 }
+
+/**
+ * @brief Moves all nodes of a queue to the tail of another.
+ * 
+ * @param dst is a pointer to the destination queue.
+ * @param src is a pointer to the source queue, empty on return.
+ * 
+ * @return 0 when successful and -1 otherwise (the nodes do not fit dst), as in
+ * hf_queue_splice().
+ */
+int32_t hf_queue_moveall(struct queue *dst, struct queue *src)
+{
+	return hf_queue_splice(dst, src, src->elem);
+}
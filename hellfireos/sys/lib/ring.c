@@ -0,0 +1,221 @@
+/**
+ * @file ring.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Wait-free single producer, single consumer rings of pointers, used to move data between
+ * an interrupt handler and a task (or between two tasks) without disabling interrupts.
+ * The producer only writes the head and the consumer only writes the tail. Both are free
+ * running counters, so the number of elements is their difference. An element slot is
+ * written before the head moves past it and read before the tail does, and _mb() keeps
+ * these accesses in order. The supported processors are in-order single cores, so a
+ * compiler barrier suffices, but a port may define a real memory barrier in hal.h.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <ring.h>
+
+#ifndef _mb
+#define _mb()		__asm__ __volatile__ ("" : : : "memory")
+#endif
+
+/**
+ * @brief Creates a ring of specified size.
+ * 
+ * @param size is the maximum number of elements.
+ * 
+ * @return pointer to the ring on success and NULL otherwise.
+ */
+struct ring *hf_ring_create(uint32_t size)
+{
+	struct ring *r;
+	uint32_t slots;
+
+	for (slots = 1; slots < size; slots <<= 1);
+	r = hf_malloc(sizeof(struct ring) + slots * sizeof(void *));
+	if (r == NULL)
+		return NULL;
+	r->size = size;
+	r->mask = slots - 1;
+	r->head = r->tail = 0;
+	r->data = (void **)(r + 1);
+
+	return r;
+}
+
+/**
+ * @brief Destroys a ring.
+ * 
+ * @param r is a pointer to a ring.
+ * 
+ * @return 0 when successful and -1 if the ring is not empty.
+ */
+int32_t hf_ring_destroy(struct ring *r)
+{
+	if (r->head != r->tail)
+		return -1;
+	hf_free(r);
+
+	return 0;
+}
+
+/**
+ * @brief Counts the number of elements in a ring.
+ * 
+ * @param r is a pointer to a ring.
+ * 
+ * @return the number of elements. May be called by either side.
+ */
+int32_t hf_ring_count(struct ring *r)
+{
+	return r->head - r->tail;
+}
+
+/**
+ * @brief Adds an element to a ring (producer side).
+ * 
+ * @param r is a pointer to a ring.
+ * @param ptr is a pointer to element data.
+ * 
+ * @return 0 when successful and -1 if the ring is full.
+ */
+int32_t hf_ring_put(struct ring *r, void *ptr)
+{
+	uint32_t head = r->head;
+
+	if (head - r->tail >= r->size)
+		return -1;
+	r->data[head & r->mask] = ptr;
+	_mb();
+	r->head = head + 1;
+
+	return 0;
+}
+
+/**
+ * @brief Removes the oldest element from a ring (consumer side).
+ * 
+ * @param r is a pointer to a ring.
+ * 
+ * @return pointer to element data or NULL if the ring is empty.
+ */
+void *hf_ring_get(struct ring *r)
+{
+	uint32_t tail = r->tail;
+	void *ptr;
+
+	if (r->head == tail)
+		return NULL;
+	_mb();
+	ptr = r->data[tail & r->mask];
+	_mb();
+	r->tail = tail + 1;
+
+	return ptr;
+}
+
+/**
+ * @brief Takes several elements from a ring (consumer side).
+ * 
+ * @param r is a pointer to a ring.
+ * @param buf is an array which receives pointers to element data, oldest first.
+ * @param n is the maximum number of elements to take.
+ * 
+ * @return the number of elements taken.
+ * 
+ * The elements are copied from the (one or two) contiguous segments of the ring, and the
+ * tail moves once, past all of them.
+ */
+int32_t hf_ring_getn(struct ring *r, void **buf, int32_t n)
+{
+	uint32_t tail = r->tail, first;
+
+	if (n > (int32_t)(r->head - tail))
+		n = r->head - tail;
+	if (n <= 0)
+		return 0;
+	_mb();
+	first = r->mask + 1 - (tail & r->mask);
+	if (first > (uint32_t)n)
+		first = n;
+	memcpy(buf, r->data + (tail & r->mask), first * sizeof(void *));
+	memcpy(buf + first, r->data, (n - first) * sizeof(void *));
+	_mb();
+	r->tail = tail + n;
+
+	return n;
+}
+
+/**
+ * @brief Returns the oldest element from a ring, without removing it (consumer side).
+ * 
+ * @param r is a pointer to a ring.
+ * 
+ * @return pointer to element data or NULL if the ring is empty.
+ */
+void *hf_ring_peek(struct ring *r)
+{
+	uint32_t tail = r->tail;
+
+	if (r->head == tail)
+		return NULL;
+	_mb();
+
+	return r->data[tail & r->mask];
+}
+
+/**
+ * @brief Returns an element from a ring, without removing it (consumer side).
+ * 
+ * @param r is a pointer to a ring.
+ * @param i is the element position (0 is the oldest element).
+ * 
+ * @return pointer to element data or NULL if there is no such element.
+ */
+void *hf_ring_at(struct ring *r, int32_t i)
+{
+	uint32_t tail = r->tail;
+
+	if (i < 0 || (uint32_t)i >= r->head - tail)
+		return NULL;
+	_mb();
+
+	return r->data[(tail + i) & r->mask];
+}
+
+/**
+ * @brief Removes an element from any position of a ring (consumer side).
+ * 
+ * @param r is a pointer to a ring.
+ * @param i is the element position (0 is the oldest element).
+ * 
+ * @return pointer to element data or NULL if there is no such element.
+ * 
+ * Older elements are moved one slot ahead, keeping their order, and the tail moves past
+ * the freed slot for the producer. Only slots the consumer owns are touched, so this is
+ * safe against a concurrent hf_ring_put().
+ */
+void *hf_ring_remove(struct ring *r, int32_t i)
+{
+	uint32_t tail = r->tail;
+	void *ptr;
+
+	if (i < 0 || (uint32_t)i >= r->head - tail)
+		return NULL;
+	_mb();
+	ptr = r->data[(tail + i) & r->mask];
+	for (; i > 0; i--)
+		r->data[(tail + i) & r->mask] = r->data[(tail + i - 1) & r->mask];
+	_mb();
+	r->tail = tail + 1;
+
+	return ptr;
+}
@@ -17,10 +17,12 @@
 #include <hal.h>
 #include <libc.h>
 #include <queue.h>
+#include <lockstat.h>
 #include <mutex.h>
 #include <condvar.h>
 #include <kernel.h>
 #include <panic.h>
+#include <scheduler.h>
 #include <task.h>
 #include <ecodes.h>
 
@@ -78,6 +80,8 @@ int32_t hf_conddestroy(cond_t *c)
  * with the mutex locked. The current task is put in a queue on the condition variable,
  * its state is set to blocked and unlocks the mutex atomically, then yields the
  * processor. When woke up (by a signalling task), the task locks the mutex and returns.
+ * With MUTEX_TYPE 2, a task released by hf_condbroadcast() is moved to the wait of the
+ * mutex instead, and is only woken up when the mutex is handed over to it.
  */
 void hf_condwait(cond_t *c, mutex_t *m)
 {
@@ -89,11 +93,73 @@ void hf_condwait(cond_t *c, mutex_t *m)
 	if (hf_queue_addtail(c->cond_queue, krnl_task2))
 		panic(PANIC_NUTS_SEM);
 	else
-		krnl_task2->state = TASK_BLOCKED;
+		sched_block(krnl_task2);
+	krnl_task2->wait_queue = c->cond_queue;
+	krnl_task2->wait_count = NULL;
+#if MUTEX_TYPE == 2
+	krnl_task2->cond_mtx = (struct mtx *)m;
+#endif
 	hf_mtxunlock(m);
 	_ei(status);
 	hf_yield();
+#if MUTEX_TYPE == 2
+	status = _di();
+	if (krnl_task2->cond_mtx){
+		/* signaled, the mutex was not handed over */
+		krnl_task2->cond_mtx = NULL;
+		_ei(status);
+		hf_mtxlock(m);
+		return;
+	}
+	while (krnl_task2->mtx_wait){
+		_ei(status);
+		hf_yield();
+		status = _di();
+	}
+#if LOCK_STATS == 1
+	lockstat_acquire((struct lock_stat *)&m->stat, 0, 1);
+#endif
+	_ei(status);
+#else
 	hf_mtxlock(m);
+#endif
+}
+
+/**
+ * @brief Wait on a condition variable, with a timeout.
+ * 
+ * @param c is a pointer to a condition variable.
+ * @param m is a pointer to a mutex.
+ * @param timeout is the maximum amount of time to wait (in quantum / tick units), at least one.
+ * 
+ * @return ERR_OK if the condition was signaled and ERR_TIMEOUT if the timeout expired first.
+ * 
+ * Like hf_condwait(), but the calling task is also placed on the delay queue while it
+ * waits. If the delay expires before the condition is signaled, the task is removed
+ * from the condition queue. In both cases the mutex is locked again before returning.
+ */
+int32_t hf_condwait_timeout(cond_t *c, mutex_t *m, uint32_t timeout)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	if (timeout == 0) return ERR_TIMEOUT;
+
+	status = _di();
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	if (hf_queue_addtail(c->cond_queue, krnl_task2))
+		panic(PANIC_NUTS_SEM);
+	sched_block(krnl_task2);
+	krnl_task2->wait_queue = c->cond_queue;
+	krnl_task2->wait_count = NULL;
+	krnl_task2->timedout = 0;
+	sched_delay_insert(krnl_task2, timeout);
+	hf_mtxunlock(m);
+	_ei(status);
+	hf_yield();
+	hf_mtxlock(m);
+
+	return krnl_task2->timedout ? ERR_TIMEOUT : ERR_OK;
 }
 
 /**
@@ -103,18 +169,22 @@ void hf_condwait(cond_t *c, mutex_t *m)
  * 
  * Implements the condition signal operation for one waiting task. The call removes a
  * task from the waiting queue and unblocks it. If no tasks are waiting for the condition,
- * the signal is lost.
+ * the signal is lost. If WAKEUP_BOOST is enabled and the unblocked task has a higher
+ * priority, the processor is handed over to it at once.
  */
 void hf_condsignal(cond_t *c)
 {
 	volatile uint32_t status;
 	struct tcb_entry *krnl_task2;
+	int32_t yield = 0;
 
 	status = _di();
 	krnl_task2 = hf_queue_remhead(c->cond_queue);
 	if (krnl_task2)
-		krnl_task2->state = TASK_READY;
+		yield = sched_wakeup(krnl_task2);
 	_ei(status);
+	if (yield)
+		hf_yield();
 }
 
 /**
@@ -125,17 +195,40 @@ void hf_condsignal(cond_t *c)
  * Implements the condition signal broadcast operation for all waiting tasks. The call
  * unblocks and removes all tasks from the waiting queue. If no tasks are waiting for the
  * condition, the signal is lost.
+ * 
+ * With MUTEX_TYPE 2, tasks waiting with hf_condwait() are not made ready at once, to
+ * contend for the mutex. They are moved to the wait of the mutex (wait morphing), which
+ * is handed over to them one at a time by hf_mtxunlock(). Tasks waiting with
+ * hf_condwait_timeout() are just unblocked.
  */
 void hf_condbroadcast(cond_t *c)
 {
 	volatile uint32_t status;
-	struct tcb_entry *krnl_task2;
+	struct tcb_entry *krnl_task2, *waiting[MAX_TASKS];
+#if MUTEX_TYPE == 2
+	mutex_t *m;
+#endif
+	int32_t i, n, yield = 0;
 		
 	status = _di();
-	while (hf_queue_count(c->cond_queue)){
-		krnl_task2 = hf_queue_remhead(c->cond_queue);
-		if (krnl_task2)
-			krnl_task2->state = TASK_READY;
+	while ((n = hf_queue_remn(c->cond_queue, (void **)waiting, MAX_TASKS)) > 0){
+		for (i = 0; i < n; i++){
+			krnl_task2 = waiting[i];
+			if (!krnl_task2)
+				continue;
+#if MUTEX_TYPE == 2
+			if (krnl_task2->cond_mtx){
+				m = (mutex_t *)krnl_task2->cond_mtx;
+				krnl_task2->cond_mtx = NULL;
+				krnl_task2->wait_queue = NULL;
+				if (!mtx_requeue(m, krnl_task2))
+					continue;
+			}
+#endif
+			yield |= sched_wakeup(krnl_task2);
+		}
 	}
 	_ei(status);
+	if (yield)
+		hf_yield();
 }
@@ -0,0 +1,210 @@
+/**
+ * @file event.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Event flag groups. A group holds 32 event flags, which are set by tasks or interrupt
+ * handlers. A task may wait for any or for all of the flags on a mask, blocked off the
+ * run queue, so a single task can wait on several event sources (NoC packets, timers,
+ * network datagrams, I/O pins) at once instead of polling each of them.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <queue.h>
+#include <event.h>
+#include <kernel.h>
+#include <panic.h>
+#include <scheduler.h>
+#include <task.h>
+#include <ecodes.h>
+
+static int32_t ev_match(uint32_t flags, uint32_t mask, uint8_t mode)
+{
+	if (mode & EVENT_ALL)
+		return (flags & mask) == mask;
+	else
+		return (flags & mask) != 0;
+}
+
+/**
+ * @brief Initializes an event flag group, with all flags cleared.
+ * 
+ * @param ev is a pointer to an event flag group.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if the group could not be allocated in memory.
+ */
+int32_t hf_evinit(event_t *ev)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	ev->ev_queue = hf_queue_create(MAX_TASKS);
+	if (ev->ev_queue == NULL){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	ev->flags = 0;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Destroys an event flag group.
+ * 
+ * @param ev is a pointer to an event flag group.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if tasks are waiting on the group.
+ */
+int32_t hf_evdestroy(event_t *ev)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (hf_queue_count(ev->ev_queue) || hf_queue_destroy(ev->ev_queue)){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Sets event flags.
+ * 
+ * @param ev is a pointer to an event flag group.
+ * @param mask is the set of flags to be set.
+ * 
+ * Every waiting task whose condition is met by the new flags is unblocked, in the order
+ * the tasks started to wait. Flags consumed by EVENT_CLEAR waits are cleared only after
+ * all waiters are checked, so all tasks waiting for the same event are released. The
+ * call never yields the processor, so it may be used from interrupt handlers.
+ */
+void hf_evset(event_t *ev, uint32_t mask)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+	uint32_t clear = 0;
+	int32_t i, k;
+
+	status = _di();
+	ev->flags |= mask;
+	k = hf_queue_count(ev->ev_queue);
+	for (i = 0; i < k; i++){
+		krnl_task2 = hf_queue_remhead(ev->ev_queue);
+		if (ev_match(ev->flags, krnl_task2->ev_mask, krnl_task2->ev_mode)){
+			krnl_task2->ev_flags = ev->flags & krnl_task2->ev_mask;
+			if (krnl_task2->ev_mode & EVENT_CLEAR)
+				clear |= krnl_task2->ev_flags;
+			sched_wakeup(krnl_task2);
+		}else{
+			if (hf_queue_addtail(ev->ev_queue, krnl_task2))
+				panic(PANIC_NUTS_SEM);
+		}
+	}
+	ev->flags &= ~clear;
+	_ei(status);
+}
+
+/**
+ * @brief Clears event flags.
+ * 
+ * @param ev is a pointer to an event flag group.
+ * @param mask is the set of flags to be cleared.
+ */
+void hf_evclear(event_t *ev, uint32_t mask)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	ev->flags &= ~mask;
+	_ei(status);
+}
+
+/**
+ * @brief Returns the event flags currently set.
+ * 
+ * @param ev is a pointer to an event flag group.
+ * 
+ * @return event flags.
+ */
+uint32_t hf_evget(event_t *ev)
+{
+	return ev->flags;
+}
+
+/**
+ * @brief Waits for event flags, with a timeout.
+ * 
+ * @param ev is a pointer to an event flag group.
+ * @param mask is the set of flags to wait for.
+ * @param mode is EVENT_ANY or EVENT_ALL, optionally combined with EVENT_CLEAR.
+ * @param timeout is the maximum amount of time to wait (in quantum / tick units). A zero
+ * timeout only polls the flags, and 0xffffffff waits forever.
+ * 
+ * @return flags on the mask which released the wait, or 0 if the timeout expired.
+ * 
+ * If the condition is already met, the call returns at once. Otherwise, the calling task
+ * is blocked until another task or an interrupt handler sets the flags (hf_evset()) or
+ * the timeout expires. With EVENT_CLEAR, the flags returned are cleared on the group.
+ */
+uint32_t hf_evwait_timeout(event_t *ev, uint32_t mask, uint8_t mode, uint32_t timeout)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+	uint32_t flags;
+
+	status = _di();
+	if (ev_match(ev->flags, mask, mode)){
+		flags = ev->flags & mask;
+		if (mode & EVENT_CLEAR)
+			ev->flags &= ~flags;
+		_ei(status);
+		return flags;
+	}
+	if (timeout == 0){
+		_ei(status);
+		return 0;
+	}
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	krnl_task2->ev_mask = mask;
+	krnl_task2->ev_mode = mode;
+	krnl_task2->ev_flags = 0;
+	if (hf_queue_addtail(ev->ev_queue, krnl_task2))
+		panic(PANIC_NUTS_SEM);
+	sched_block(krnl_task2);
+	krnl_task2->wait_queue = ev->ev_queue;
+	krnl_task2->wait_count = NULL;
+	if (timeout != 0xffffffff){
+		krnl_task2->timedout = 0;
+		sched_delay_insert(krnl_task2, timeout);
+	}
+	_ei(status);
+	hf_yield();
+
+	return krnl_task2->ev_flags;
+}
+
+/**
+ * @brief Waits for event flags.
+ * 
+ * @param ev is a pointer to an event flag group.
+ * @param mask is the set of flags to wait for.
+ * @param mode is EVENT_ANY or EVENT_ALL, optionally combined with EVENT_CLEAR.
+ * 
+ * @return flags on the mask which released the wait.
+ * 
+ * Same as hf_evwait_timeout(), without a timeout.
+ */
+uint32_t hf_evwait(event_t *ev, uint32_t mask, uint8_t mode)
+{
+	return hf_evwait_timeout(ev, mask, mode, 0xffffffff);
+}
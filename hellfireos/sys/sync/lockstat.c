@@ -0,0 +1,151 @@
+/**
+ * @file lockstat.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Lock contention statistics (LOCK_STATS = 1). Every mutex and semaphore counts its
+ * acquisitions and the time (in cycles, from _readcounter()) spent spinning or blocked
+ * to take it. Locks of interest are registered by name with hf_mtxstat() or hf_semstat()
+ * after being initialized, and the registered locks may be listed or dumped, so hot
+ * locks can be found at run time.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <lockstat.h>
+#include <kernel.h>
+#include <ecodes.h>
+
+#if LOCK_STATS == 1
+static struct lock_stat *lockstat_list;
+
+/**
+ * @internal
+ * @brief Clears the statistics of a lock (when the lock is initialized).
+ *
+ * @param st is a pointer to the lock statistics.
+ */
+void lockstat_init(struct lock_stat *st)
+{
+	memset(st, 0, sizeof(struct lock_stat));
+	st->holder = -1;
+}
+
+/**
+ * @internal
+ * @brief Accounts for a lock acquisition.
+ *
+ * @param st is a pointer to the lock statistics.
+ * @param wait is the time spent to acquire the lock (in cycles).
+ * @param contended is 1 if the caller had to spin or block.
+ *
+ * Must be called holding the lock (or with interrupts disabled).
+ */
+void lockstat_acquire(struct lock_stat *st, uint32_t wait, int32_t contended)
+{
+	st->acquired++;
+	st->holder = krnl_current_task;
+	if (!contended) return;
+	st->contended++;
+	st->wait_total += wait;
+	if (wait > st->wait_max)
+		st->wait_max = wait;
+}
+
+/**
+ * @internal
+ * @brief Removes a lock from the list of registered locks (when the lock is destroyed).
+ *
+ * @param st is a pointer to the lock statistics.
+ */
+void lockstat_remove(struct lock_stat *st)
+{
+	volatile uint32_t status;
+	struct lock_stat **p;
+
+	status = _di();
+	for (p = &lockstat_list; *p; p = &(*p)->next){
+		if (*p == st){
+			*p = st->next;
+			break;
+		}
+	}
+	st->name = NULL;
+	st->next = NULL;
+	_ei(status);
+}
+
+/**
+ * @brief Registers a lock, so its statistics are listed.
+ *
+ * @param st is a pointer to the lock statistics.
+ * @param name is the lock name.
+ *
+ * Usually invoked as hf_mtxstat(&mutex, name) or hf_semstat(&semaphore, name), after
+ * the lock is initialized (initialization clears the statistics and the registration).
+ */
+void hf_lockstat_register(struct lock_stat *st, int8_t *name)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (!st->name){
+		st->next = lockstat_list;
+		lockstat_list = st;
+	}
+	st->name = name;
+	_ei(status);
+}
+
+/**
+ * @brief Returns the list of registered locks.
+ *
+ * @return first registered lock (others follow on the next field), or NULL if none.
+ */
+struct lock_stat *hf_lockstat_list(void)
+{
+	return lockstat_list;
+}
+
+/**
+ * @brief Clears the statistics of all registered locks.
+ */
+void hf_lockstat_reset(void)
+{
+	volatile uint32_t status;
+	struct lock_stat *st;
+
+	status = _di();
+	for (st = lockstat_list; st; st = st->next){
+		st->acquired = 0;
+		st->contended = 0;
+		st->wait_total = 0;
+		st->wait_max = 0;
+		st->queue_max = 0;
+	}
+	_ei(status);
+}
+
+/**
+ * @brief Prints the statistics of all registered locks.
+ *
+ * One line is printed per lock: name, acquisitions, contended acquisitions, total,
+ * average and maximum wait (in cycles), longest queue and holder task id.
+ */
+void hf_lockstat_dump(void)
+{
+	struct lock_stat *st;
+
+	printf("\nLOCK name acquired contended wait_total wait_avg wait_max queue_max holder");
+	for (st = lockstat_list; st; st = st->next)
+		printf("\nLOCK %s %d %d %d %d %d %d %d", st->name, st->acquired, st->contended,
+			(uint32_t)st->wait_total, st->contended ? (uint32_t)(st->wait_total / st->contended) : 0,
+			st->wait_max, st->queue_max, st->holder);
+}
+#endif
@@ -0,0 +1,216 @@
+/**
+ * @file mailbox.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Mailbox (message queue) primitives, for communication between tasks on the same core.
+ * Messages are passed by reference: the sender hands a buffer (usually taken from a pool)
+ * over to the mailbox, and the receiver becomes its owner, so message data is never copied.
+ * Receivers block on an empty mailbox and are woken up directly by the sender. Calls mirror
+ * hf_send() and hf_recv() of the NoC driver, so the same code maps to both cases.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <queue.h>
+#include <mailbox.h>
+#include <kernel.h>
+#include <panic.h>
+#include <scheduler.h>
+#include <task.h>
+#include <ecodes.h>
+
+/**
+ * @brief Initializes a mailbox.
+ * 
+ * @param mb is a pointer to a mailbox.
+ * @param size is the maximum number of queued messages.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if the mailbox could not be allocated in memory.
+ */
+int32_t hf_mboxinit(mbox_t *mb, int32_t size)
+{
+	volatile uint32_t status;
+
+	if (size <= 0)
+		return ERR_ERROR;
+	mb->msgs = hf_malloc(size * sizeof(struct mbox_msg));
+	if (mb->msgs == NULL)
+		return ERR_ERROR;
+	status = _di();
+	mb->mbox_queue = hf_queue_create(MAX_TASKS);
+	if (mb->mbox_queue == NULL){
+		_ei(status);
+		hf_free(mb->msgs);
+		return ERR_ERROR;
+	}
+	mb->size = size;
+	mb->elem = 0;
+	mb->head = 0;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Destroys a mailbox.
+ * 
+ * @param mb is a pointer to a mailbox.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if messages are still queued or tasks are waiting
+ * on the mailbox.
+ */
+int32_t hf_mboxdestroy(mbox_t *mb)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (mb->elem || hf_queue_destroy(mb->mbox_queue)){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	_ei(status);
+	hf_free(mb->msgs);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Sends a message to a mailbox (non blocking send).
+ * 
+ * @param mb is a pointer to a mailbox.
+ * @param msg is a pointer to the message buffer.
+ * @param size is the size (in bytes) of the message.
+ * 
+ * @return ERR_OK when successful and ERR_ERROR if the mailbox is full.
+ * 
+ * The buffer is not copied, the receiver takes its ownership and must not be touched by the
+ * sender after the call succeeds. A task waiting on the mailbox is woken up. If WAKEUP_BOOST
+ * is enabled and that task has a higher priority, the processor is handed over to it at once
+ * (so, in this mode, messages should not be sent from interrupt handlers).
+ */
+int32_t hf_mboxsend(mbox_t *mb, void *msg, uint16_t size)
+{
+	volatile uint32_t status;
+	volatile struct mbox_msg *m;
+	struct tcb_entry *krnl_task2;
+	int32_t i, yield = 0;
+
+	status = _di();
+	if (mb->elem >= mb->size){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	i = mb->head + mb->elem;
+	if (i >= mb->size)
+		i -= mb->size;
+	m = &mb->msgs[i];
+	m->msg = msg;
+	m->size = size;
+	m->source = krnl_current_task;
+	mb->elem++;
+	krnl_task2 = hf_queue_remhead(mb->mbox_queue);
+	if (krnl_task2)
+		yield = sched_wakeup(krnl_task2);
+	_ei(status);
+	if (yield)
+		hf_yield();
+
+	return ERR_OK;
+}
+
+static void mbox_take(mbox_t *mb, uint16_t *source, void **msg, uint16_t *size)
+{
+	volatile struct mbox_msg *m;
+
+	m = &mb->msgs[mb->head];
+	*msg = m->msg;
+	if (source)
+		*source = m->source;
+	if (size)
+		*size = m->size;
+	if (++mb->head == mb->size)
+		mb->head = 0;
+	mb->elem--;
+}
+
+/**
+ * @brief Receives a message from a mailbox (blocking receive).
+ * 
+ * @param mb is a pointer to a mailbox.
+ * @param source is a pointer to a variable which will hold the id of the sender task (may be NULL).
+ * @param msg is a pointer to a variable which will hold the message buffer.
+ * @param size is a pointer to a variable which will hold the message size (may be NULL).
+ * 
+ * @return ERR_OK.
+ * 
+ * The calling task is blocked until a message arrives, and becomes the owner of the
+ * message buffer.
+ */
+int32_t hf_mboxrecv(mbox_t *mb, uint16_t *source, void **msg, uint16_t *size)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	status = _di();
+	while (mb->elem == 0){
+		krnl_task2 = &krnl_tcb[krnl_current_task];
+		if (hf_queue_addtail(mb->mbox_queue, krnl_task2))
+			panic(PANIC_NUTS_SEM);
+		else
+			sched_block(krnl_task2);
+		krnl_task2->wait_queue = mb->mbox_queue;
+		krnl_task2->wait_count = NULL;
+		_ei(status);
+		hf_yield();
+		status = _di();
+	}
+	mbox_take(mb, source, msg, size);
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Receives a message from a mailbox (non blocking receive).
+ * 
+ * @param mb is a pointer to a mailbox.
+ * @param source is a pointer to a variable which will hold the id of the sender task (may be NULL).
+ * @param msg is a pointer to a variable which will hold the message buffer.
+ * @param size is a pointer to a variable which will hold the message size (may be NULL).
+ * 
+ * @return ERR_OK when a message was received and ERR_ERROR if the mailbox is empty.
+ */
+int32_t hf_mboxtryrecv(mbox_t *mb, uint16_t *source, void **msg, uint16_t *size)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (mb->elem == 0){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	mbox_take(mb, source, msg, size);
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Returns the number of messages queued on a mailbox.
+ * 
+ * @param mb is a pointer to a mailbox.
+ * 
+ * @return the number of messages.
+ */
+int32_t hf_mboxcount(mbox_t *mb)
+{
+	return mb->elem;
+}
@@ -16,9 +16,18 @@
 
 #include <hal.h>
 #include <libc.h>
+#include <queue.h>
+#include <lockstat.h>
 #include <mutex.h>
+#include <kernel.h>
+#include <scheduler.h>
+#include <task.h>
 #include <ecodes.h>
 
+#if LOCK_STATS == 1
+#define MTX_STAT(m)	((struct lock_stat *)&(m)->stat)
+#endif
+
 #if MUTEX_TYPE == 0
 /* type 0: spinlock
  */
@@ -42,6 +51,9 @@ static int32_t tsl(mutex_t *m)
 void hf_mtxinit(mutex_t *m)
 {
 	m->lock = 0;
+#if LOCK_STATS == 1
+	lockstat_init(MTX_STAT(m));
+#endif
 }
 
 /**
@@ -54,7 +66,37 @@ void hf_mtxinit(mutex_t *m)
  */
 void hf_mtxlock(mutex_t *m)
 {
+#if LOCK_STATS == 1
+	uint32_t t;
+
+	if (tsl(m) == 1){
+		t = _readcounter();
+		while (tsl(m) == 1);
+		lockstat_acquire(MTX_STAT(m), _readcounter() - t, 1);
+	}else{
+		lockstat_acquire(MTX_STAT(m), 0, 0);
+	}
+#else
 	while (tsl(m) == 1);
+#endif
+}
+
+/**
+ * @brief Tries to lock a mutex, without spinning.
+ * 
+ * @param m is a pointer to a mutex.
+ * 
+ * @return ERR_OK if the mutex was locked by the call and ERR_ERROR if it was already locked.
+ */
+int32_t hf_mtxtrylock(mutex_t *m)
+{
+	if (tsl(m) == 1)
+		return ERR_ERROR;
+#if LOCK_STATS == 1
+	lockstat_acquire(MTX_STAT(m), 0, 0);
+#endif
+
+	return ERR_OK;
 }
 
 /**
@@ -64,6 +106,9 @@ void hf_mtxlock(mutex_t *m)
  */
 void hf_mtxunlock(mutex_t *m)
 {
+#if LOCK_STATS == 1
+	m->stat.holder = -1;
+#endif
 	m->lock = 0;
 }
 #endif
@@ -79,11 +124,22 @@ void hf_mtxinit(mutex_t *m)
 		m->level[i] = 0;
 	for (i = 0; i < MAX_TASKS-1; i++)
 		m->waiting[i] = 0;
+#if LOCK_STATS == 1
+	lockstat_init(MTX_STAT(m));
+#endif
 }
 
 void hf_mtxlock(mutex_t *m)
 {
 	int32_t i, k, l;
+#if LOCK_STATS == 1
+	uint32_t t;
+	int32_t contended = 0;
+
+	t = _readcounter();
+	for (k = 0; k < MAX_TASKS; k++)
+		if (m->level[k]) contended = 1;
+#endif
 
 	i = hf_selfid();
 	for (l = 1; l < MAX_TASKS; ++l){
@@ -92,6 +148,33 @@ void hf_mtxlock(mutex_t *m)
 		for (k = 0; k < MAX_TASKS; k++)
 			while (k != i && m->level[k] >= l && m->waiting[l] == i);
 	}
+#if LOCK_STATS == 1
+	lockstat_acquire(MTX_STAT(m), _readcounter() - t, contended);
+#endif
+}
+
+/* Peterson's algorithm has no trylock of its own: the lock is only taken if no other
+ * task is competing for it, and the climb is done with interrupts disabled, so it
+ * never spins. A task which is still climbing (preempted on a lower level) makes the
+ * call fail, even if the mutex is not held yet.
+ */
+int32_t hf_mtxtrylock(mutex_t *m)
+{
+	volatile uint32_t status;
+	int32_t i, k;
+
+	status = _di();
+	i = hf_selfid();
+	for (k = 0; k < MAX_TASKS; k++){
+		if (k != i && m->level[k]){
+			_ei(status);
+			return ERR_ERROR;
+		}
+	}
+	hf_mtxlock(m);
+	_ei(status);
+
+	return ERR_OK;
 }
 
 void hf_mtxunlock(mutex_t *m)
@@ -99,7 +182,213 @@ void hf_mtxunlock(mutex_t *m)
 	int32_t i;
 
 	i = hf_selfid();
+#if LOCK_STATS == 1
+	m->stat.holder = -1;
+#endif
 	m->level[i] = 0;
 }
 #endif
 
+#if MUTEX_TYPE == 2
+/* type 2: blocking mutex with priority inheritance
+ */
+/**
+ * @brief Initializes a mutex, defining its initial value.
+ * 
+ * @param m is a pointer to a mutex.
+ */
+void hf_mtxinit(mutex_t *m)
+{
+	int32_t i;
+
+	m->lock = 0;
+	m->owner = 0;
+	m->priority = 0;
+	for (i = 0; i < (MAX_TASKS + 31) / 32; i++)
+		m->waiting[i] = 0;
+#if LOCK_STATS == 1
+	lockstat_init(MTX_STAT(m));
+#endif
+}
+
+/**
+ * @brief Locks a mutex.
+ * 
+ * @param m is a pointer to a mutex.
+ * 
+ * If the mutex is not locked, the calling task continues execution. Otherwise,
+ * the task is blocked and put to wait for the mutex, and the processor is given
+ * away. If the owner of the mutex is a best effort task with a lower priority than
+ * the calling (best effort) task, the owner inherits the priority of the caller
+ * until the mutex is unlocked. Real time tasks waiting for a mutex lend their time
+ * to the owner of the mutex directly on the real time scheduler. When the mutex is
+ * unlocked, it is handed over to a waiting task, so the task only continues its
+ * execution as the owner of the mutex.
+ */
+void hf_mtxlock(mutex_t *m)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2, *owner;
+#if LOCK_STATS == 1
+	uint32_t t, n = 0;
+	int32_t i;
+#endif
+
+	status = _di();
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	if (m->lock == 0){
+		m->lock = 1;
+		m->owner = krnl_task2->id;
+		m->priority = krnl_task2->priority;
+#if LOCK_STATS == 1
+		lockstat_acquire(MTX_STAT(m), 0, 0);
+#endif
+		_ei(status);
+		return;
+	}
+#if LOCK_STATS == 1
+	t = _readcounter();
+#endif
+	owner = &krnl_tcb[m->owner];
+	m->waiting[krnl_task2->id >> 5] |= 1U << (krnl_task2->id & 31);
+#if LOCK_STATS == 1
+	for (i = 0; i < (MAX_TASKS + 31) / 32; i++)
+		n += __builtin_popcount(m->waiting[i]);
+	if (n > m->stat.queue_max)
+		m->stat.queue_max = n;
+#endif
+	krnl_task2->mtx_wait = (struct mtx *)m;
+	sched_block(krnl_task2);
+	if (!krnl_task2->period && !owner->period && krnl_task2->priority < owner->priority){
+		sched_be_remove(owner);
+		owner->priority = krnl_task2->priority;
+		owner->priority_rem = krnl_task2->priority;
+		sched_be_insert(owner);
+	}
+	while (krnl_task2->mtx_wait){
+		_ei(status);
+		hf_yield();
+		status = _di();
+	}
+#if LOCK_STATS == 1
+	lockstat_acquire(MTX_STAT(m), _readcounter() - t, 1);
+#endif
+	_ei(status);
+}
+
+/**
+ * @brief Tries to lock a mutex, without blocking.
+ * 
+ * @param m is a pointer to a mutex.
+ * 
+ * @return ERR_OK if the mutex was locked by the call and ERR_ERROR if it is held by
+ * another task (no priority is inherited in this case).
+ */
+int32_t hf_mtxtrylock(mutex_t *m)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	status = _di();
+	if (m->lock){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	m->lock = 1;
+	m->owner = krnl_task2->id;
+	m->priority = krnl_task2->priority;
+#if LOCK_STATS == 1
+	lockstat_acquire(MTX_STAT(m), 0, 0);
+#endif
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Unlocks a mutex.
+ * 
+ * @param m is a pointer to a mutex.
+ * 
+ * The priority of the owner is restored. If there are tasks waiting for the mutex, it is
+ * handed over to the one with the highest priority (real time tasks with the shortest
+ * period first, then best effort tasks with the lowest priority value), which is unblocked.
+ */
+void hf_mtxunlock(mutex_t *m)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2, *next = NULL;
+	int32_t i, j, yield = 0;
+
+	status = _di();
+#if LOCK_STATS == 1
+	m->stat.holder = -1;
+#endif
+	krnl_task2 = &krnl_tcb[m->owner];
+	if (krnl_task2->priority != m->priority){
+		sched_be_remove(krnl_task2);
+		krnl_task2->priority = m->priority;
+		krnl_task2->priority_rem = m->priority;
+		sched_be_insert(krnl_task2);
+	}
+	for (i = 0; i < (MAX_TASKS + 31) / 32; i++){
+		for (j = 0; j < 32; j++){
+			if (!(m->waiting[i] & (1U << j))) continue;
+			krnl_task2 = &krnl_tcb[(i << 5) + j];
+			if (!next || (krnl_task2->period && (!next->period || krnl_task2->period < next->period)) ||
+			(!krnl_task2->period && !next->period && krnl_task2->priority < next->priority))
+				next = krnl_task2;
+		}
+	}
+	if (next){
+		m->waiting[next->id >> 5] &= ~(1U << (next->id & 31));
+		m->owner = next->id;
+		m->priority = next->priority;
+		next->mtx_wait = NULL;
+		yield = sched_wakeup(next);
+	}else{
+		m->lock = 0;
+	}
+	_ei(status);
+	if (yield)
+		hf_yield();
+}
+
+/**
+ * @internal
+ * @brief Puts a blocked task to wait for a mutex (wait morphing).
+ * 
+ * @param m is a pointer to a mutex.
+ * @param task is a pointer to a blocked task.
+ * 
+ * @return 1 if the mutex was free and is now held by the task, which must be woken up
+ * by the caller, and 0 if the task was put to wait for the mutex.
+ * 
+ * Called with interrupts disabled by hf_condbroadcast(). The task is handled as if it
+ * had called hf_mtxlock() itself, without being made ready in between, so it is only
+ * woken up by hf_mtxunlock() when the mutex is handed over to it.
+ */
+int32_t mtx_requeue(mutex_t *m, struct tcb_entry *task)
+{
+	struct tcb_entry *owner;
+
+	if (m->lock == 0){
+		m->lock = 1;
+		m->owner = task->id;
+		m->priority = task->priority;
+		return 1;
+	}
+	owner = &krnl_tcb[m->owner];
+	m->waiting[task->id >> 5] |= 1U << (task->id & 31);
+	task->mtx_wait = (struct mtx *)m;
+	if (!task->period && !owner->period && task->priority < owner->priority){
+		sched_be_remove(owner);
+		owner->priority = task->priority;
+		owner->priority_rem = task->priority;
+		sched_be_insert(owner);
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,219 @@
+/**
+ * @file rwlock.c
+ * @date October 2026
+ * 
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Reader-writer lock primitives. Any number of readers or a single writer may hold the
+ * lock. Taking or releasing a read lock with no writer around is a single update of the
+ * reader count. Writers are preferred: once a writer waits for the lock, new readers
+ * are blocked until it is done, so writers are never starved by a stream of readers.
+ * The lock is handed over directly to the tasks it wakes up, so woken tasks never have
+ * to compete for it again.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <queue.h>
+#include <rwlock.h>
+#include <kernel.h>
+#include <panic.h>
+#include <scheduler.h>
+#include <task.h>
+#include <ecodes.h>
+
+/**
+ * @brief Initializes a reader-writer lock.
+ * 
+ * @param rw is a pointer to a reader-writer lock.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if the lock could not be allocated in memory.
+ */
+int32_t hf_rwinit(rwlock_t *rw)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	rw->rd_queue = hf_queue_create(MAX_TASKS);
+	rw->wr_queue = hf_queue_create(MAX_TASKS);
+	if (rw->rd_queue == NULL || rw->wr_queue == NULL){
+		if (rw->rd_queue) hf_queue_destroy(rw->rd_queue);
+		if (rw->wr_queue) hf_queue_destroy(rw->wr_queue);
+		_ei(status);
+		return ERR_ERROR;
+	}
+	rw->readers = 0;
+	rw->writer = 0;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Destroys a reader-writer lock.
+ * 
+ * @param rw is a pointer to a reader-writer lock.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if the lock is held or tasks are waiting on it.
+ */
+int32_t hf_rwdestroy(rwlock_t *rw)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (rw->readers || rw->writer || hf_queue_count(rw->rd_queue) || hf_queue_count(rw->wr_queue)){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	hf_queue_destroy(rw->rd_queue);
+	hf_queue_destroy(rw->wr_queue);
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Locks a reader-writer lock for reading.
+ * 
+ * @param rw is a pointer to a reader-writer lock.
+ * 
+ * If no writer holds or waits for the lock, the calling task becomes one more reader and
+ * continues its execution. Otherwise, the task is blocked until the writers are done.
+ */
+void hf_rwrdlock(rwlock_t *rw)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	status = _di();
+	if (!rw->writer && !hf_queue_count(rw->wr_queue)){
+		rw->readers++;
+		_ei(status);
+		return;
+	}
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	if (hf_queue_addtail(rw->rd_queue, krnl_task2))
+		panic(PANIC_NUTS_SEM);
+	sched_block(krnl_task2);
+	krnl_task2->wait_queue = rw->rd_queue;
+	krnl_task2->wait_count = NULL;
+	_ei(status);
+	hf_yield();
+}
+
+/**
+ * @brief Tries to lock a reader-writer lock for reading, without blocking.
+ * 
+ * @param rw is a pointer to a reader-writer lock.
+ * 
+ * @return ERR_OK if the lock was taken and ERR_ERROR if a writer holds or waits for it.
+ */
+int32_t hf_rwtryrdlock(rwlock_t *rw)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (rw->writer || hf_queue_count(rw->wr_queue)){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	rw->readers++;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Locks a reader-writer lock for writing.
+ * 
+ * @param rw is a pointer to a reader-writer lock.
+ * 
+ * If the lock is free, the calling task becomes its writer and continues its execution.
+ * Otherwise, the task is blocked until the current readers (or writer) release the lock.
+ */
+void hf_rwwrlock(rwlock_t *rw)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	status = _di();
+	if (!rw->writer && !rw->readers){
+		rw->writer = 1;
+		_ei(status);
+		return;
+	}
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	if (hf_queue_addtail(rw->wr_queue, krnl_task2))
+		panic(PANIC_NUTS_SEM);
+	sched_block(krnl_task2);
+	krnl_task2->wait_queue = rw->wr_queue;
+	krnl_task2->wait_count = NULL;
+	_ei(status);
+	hf_yield();
+}
+
+/**
+ * @brief Tries to lock a reader-writer lock for writing, without blocking.
+ * 
+ * @param rw is a pointer to a reader-writer lock.
+ * 
+ * @return ERR_OK if the lock was taken and ERR_ERROR if it is held.
+ */
+int32_t hf_rwtrywrlock(rwlock_t *rw)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (rw->writer || rw->readers){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	rw->writer = 1;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Unlocks a reader-writer lock.
+ * 
+ * @param rw is a pointer to a reader-writer lock.
+ * 
+ * Releases the lock held by the calling task, either for reading or writing. When the
+ * last reader or the writer leaves, the lock is handed over to the first waiting writer
+ * or, if there are none, to all waiting readers at once. If WAKEUP_BOOST is enabled and
+ * a woken task has a higher priority, the processor is handed over to it at once.
+ */
+void hf_rwunlock(rwlock_t *rw)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+	int32_t yield = 0;
+
+	status = _di();
+	if (rw->writer)
+		rw->writer = 0;
+	else if (rw->readers > 0)
+		rw->readers--;
+	if (rw->readers == 0){
+		if (hf_queue_count(rw->wr_queue)){
+			krnl_task2 = hf_queue_remhead(rw->wr_queue);
+			rw->writer = 1;
+			yield = sched_wakeup(krnl_task2);
+		}else{
+			while (hf_queue_count(rw->rd_queue)){
+				krnl_task2 = hf_queue_remhead(rw->rd_queue);
+				rw->readers++;
+				yield |= sched_wakeup(krnl_task2);
+			}
+		}
+	}
+	_ei(status);
+	if (yield)
+		hf_yield();
+}
@@ -17,12 +17,37 @@
 #include <hal.h>
 #include <libc.h>
 #include <queue.h>
+#include <lockstat.h>
 #include <semaphore.h>
 #include <kernel.h>
 #include <panic.h>
+#include <scheduler.h>
 #include <task.h>
 #include <ecodes.h>
 
+#if LOCK_STATS == 1
+#define SEM_STAT(s)	((struct lock_stat *)&(s)->stat)
+
+static void sem_stat_queue(sem_t *s)
+{
+	uint32_t n;
+
+	n = hf_queue_count(s->sem_queue);
+	if (n > s->stat.queue_max)
+		s->stat.queue_max = n;
+}
+
+/* accounts for a task which blocked on the semaphore at time t, once it is woken up */
+static void sem_stat_blocked(sem_t *s, uint32_t t)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	lockstat_acquire(SEM_STAT(s), _readcounter() - t, 1);
+	_ei(status);
+}
+#endif
+
 /**
  * @brief Initializes a semaphore and defines its initial value.
  * 
@@ -43,6 +68,9 @@ int32_t hf_seminit(sem_t *s, int32_t value)
 		return ERR_ERROR;
 	}else{
 		s->count = value;
+#if LOCK_STATS == 1
+		lockstat_init(SEM_STAT(s));
+#endif
 		_ei(status);
 		return ERR_OK;
 	}
@@ -64,6 +92,9 @@ int32_t hf_semdestroy(sem_t *s)
 		_ei(status);
 		return ERR_ERROR;
 	}else{
+#if LOCK_STATS == 1
+		lockstat_remove(SEM_STAT(s));
+#endif
 		_ei(status);
 		return ERR_OK;
 	}
@@ -82,6 +113,9 @@ void hf_semwait(sem_t *s)
 {
 	volatile uint32_t status;
 	struct tcb_entry *krnl_task2;
+#if LOCK_STATS == 1
+	uint32_t t;
+#endif
 	
 	status = _di();
 	s->count--;
@@ -90,12 +124,82 @@ void hf_semwait(sem_t *s)
 		if (hf_queue_addtail(s->sem_queue, krnl_task2))
 			panic(PANIC_NUTS_SEM);
 		else
-			krnl_task2->state = TASK_BLOCKED;
+			sched_block(krnl_task2);
+		krnl_task2->wait_queue = s->sem_queue;
+		krnl_task2->wait_count = &s->count;
+#if LOCK_STATS == 1
+		sem_stat_queue(s);
+		t = _readcounter();
+#endif
 		_ei(status);
 		hf_yield();
+#if LOCK_STATS == 1
+		sem_stat_blocked(s, t);
+#endif
 	}else{
+#if LOCK_STATS == 1
+		lockstat_acquire(SEM_STAT(s), 0, 0);
+#endif
+		_ei(status);
+	}
+}
+
+/**
+ * @brief Wait on a semaphore, with a timeout.
+ * 
+ * @param s is a pointer to a semaphore.
+ * @param timeout is the maximum amount of time to wait (in quantum / tick units).
+ * 
+ * @return ERR_OK if the semaphore was taken and ERR_TIMEOUT if the timeout expired first.
+ * 
+ * Like hf_semwait(), but the calling task is also placed on the delay queue while it
+ * waits. If the delay expires before the semaphore is signaled, the task is removed
+ * from the semaphore queue and the count it took is given back. A zero timeout only
+ * polls the semaphore, never blocking.
+ */
+int32_t hf_semwait_timeout(sem_t *s, uint32_t timeout)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+#if LOCK_STATS == 1
+	uint32_t t;
+#endif
+
+	status = _di();
+	if (s->count > 0){
+		s->count--;
+#if LOCK_STATS == 1
+		lockstat_acquire(SEM_STAT(s), 0, 0);
+#endif
+		_ei(status);
+		return ERR_OK;
+	}
+	if (timeout == 0){
 		_ei(status);
+		return ERR_TIMEOUT;
 	}
+	s->count--;
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	if (hf_queue_addtail(s->sem_queue, krnl_task2))
+		panic(PANIC_NUTS_SEM);
+	sched_block(krnl_task2);
+	krnl_task2->wait_queue = s->sem_queue;
+	krnl_task2->wait_count = &s->count;
+	krnl_task2->timedout = 0;
+	sched_delay_insert(krnl_task2, timeout);
+#if LOCK_STATS == 1
+	sem_stat_queue(s);
+	t = _readcounter();
+#endif
+	_ei(status);
+	hf_yield();
+	if (krnl_task2->timedout)
+		return ERR_TIMEOUT;
+#if LOCK_STATS == 1
+	sem_stat_blocked(s, t);
+#endif
+
+	return ERR_OK;
 }
 
 /**
@@ -105,12 +209,15 @@ void hf_semwait(sem_t *s)
  * 
  * Implements the atomic V() operation. The semaphore count is incremented and
  * the task from the head of the semaphore queue is unblocked if the count is less
- * than or equal to zero.
+ * than or equal to zero. If WAKEUP_BOOST is enabled and the unblocked task has a higher
+ * priority, the processor is handed over to it at once (so, in this mode, semaphores
+ * should not be signaled from interrupt handlers).
  */
 void hf_sempost(sem_t *s)
 {
 	volatile uint32_t status;
 	struct tcb_entry *krnl_task2;
+	int32_t yield = 0;
 
 	status = _di();
 	s->count++;
@@ -119,7 +226,46 @@ void hf_sempost(sem_t *s)
 		if (krnl_task2 == NULL)
 			panic(PANIC_NUTS_SEM);
 		else
-			krnl_task2->state = TASK_READY;
+			yield = sched_wakeup(krnl_task2);
+	}
+	_ei(status);
+	if (yield)
+		hf_yield();
+}
+
+/**
+ * @brief Signal a semaphore from an interrupt handler.
+ * 
+ * @param s is a pointer to a semaphore.
+ * 
+ * Like hf_sempost(), but the processor is not handed over inside the handler. If the task
+ * woken up is a best effort task and the idle task was interrupted, or the task has a higher
+ * priority than the interrupted best effort task and the best effort scheduler honors the
+ * critical flag (sched_priorityrr(), and sched_bitmap() with its strict priorities), it is
+ * marked as critical and a reschedule is requested. The reschedule is performed by the
+ * interrupt handler of the architecture when it returns (dispatch_resched()), so the task
+ * runs right after the interrupt. Otherwise, it runs on the next scheduling decision (the
+ * round robin and lottery schedulers would just select the next task in their order, so
+ * preempting the interrupted task would not run the woken one sooner).
+ */
+void hf_sempost_isr(sem_t *s)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2, *cur;
+
+	status = _di();
+	s->count++;
+	if (s->count <= 0){
+		krnl_task2 = hf_queue_remhead(s->sem_queue);
+		if (krnl_task2 == NULL)
+			panic(PANIC_NUTS_SEM);
+		sched_wakeup(krnl_task2);
+		cur = &krnl_tcb[krnl_current_task];
+		if (!krnl_task2->period && !krnl_task2->capacity && !cur->period && !cur->capacity &&
+		(krnl_current_task == 0 || (sched_be_critical() && krnl_task2->priority < cur->priority))){
+			krnl_task2->critical = 1;
+			krnl_resched = 1;
+		}
 	}
 	_ei(status);
 }
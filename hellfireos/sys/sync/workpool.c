@@ -0,0 +1,300 @@
+/**
+ * @file workpool.c
+ * @date October 2026
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Work pools, for data parallel jobs. A pool is a fixed set of best effort worker tasks,
+ * created once, which execute short jobs (a function and its argument) submitted to the
+ * pool, so a job does not pay for the creation of a task (TCB, stack allocation) as it
+ * would with hf_spawn(). Each worker has a deque of jobs: jobs submitted by a worker go
+ * to its own deque and are taken back in LIFO order (the data of the last job is likely
+ * still in cache), jobs submitted from outside the pool are spread over the deques, and
+ * an idle worker steals the oldest job of another worker. A semaphore counts the queued
+ * jobs of all deques, so a worker that passes it always finds a job.
+ */
+
+#include <hal.h>
+#include <libc.h>
+#include <malloc.h>
+#include <queue.h>
+#include <lockstat.h>
+#include <semaphore.h>
+#include <workpool.h>
+#include <kernel.h>
+#include <task.h>
+#include <ecodes.h>
+
+/* pool of each worker task, by task id */
+static struct wpool *wpool_of[MAX_TASKS];
+static int16_t wpool_slot[MAX_TASKS];
+
+/* takes a job: the newest of the own deque, or the oldest of another. interrupts disabled */
+static int32_t wpool_take(struct wpool *p, int32_t self, struct wp_job *job)
+{
+	struct wp_worker *w, *v;
+	int32_t i;
+
+	w = &p->workers[self];
+	if (w->count){
+		w->count--;
+		i = w->head + w->count;
+		if (i >= p->depth)
+			i -= p->depth;
+		*job = w->jobs[i];
+
+		return 1;
+	}
+	for (i = 1; i < p->nworkers; i++){
+		v = &p->workers[(self + i) % p->nworkers];
+		if (v->count){
+			*job = v->jobs[v->head];
+			if (++v->head == p->depth)
+				v->head = 0;
+			v->count--;
+			w->stolen++;
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void wpool_worker(void)
+{
+	volatile uint32_t status;
+	struct wpool *p;
+	struct wp_job job;
+	int32_t self, waiters;
+
+	/* the pool registers the worker once hf_spawn() returns */
+	while ((p = wpool_of[hf_selfid()]) == NULL)
+		hf_yield();
+	self = wpool_slot[hf_selfid()];
+
+	for (;;){
+		hf_semwait(&p->jobs);
+		status = _di();
+		if (p->nworkers == 0){
+			wpool_of[hf_selfid()] = NULL;
+			p->stopping--;
+			_ei(status);
+			hf_kill(hf_selfid());
+		}
+		if (!wpool_take(p, self, &job)){
+			_ei(status);
+			continue;
+		}
+		_ei(status);
+
+		job.fn(job.arg);
+
+		status = _di();
+		p->workers[self].done++;
+		waiters = 0;
+		if (--p->pending == 0){
+			waiters = p->waiters;
+			p->waiters = 0;
+		}
+		_ei(status);
+		while (waiters--)
+			hf_sempost(&p->idle);
+	}
+}
+
+/**
+ * @brief Creates a work pool.
+ *
+ * @param workers is the number of worker tasks.
+ * @param depth is the maximum number of queued jobs on each worker.
+ * @param stack_size is the stack size of the workers, in bytes.
+ *
+ * @return pointer to the pool on success and NULL otherwise.
+ *
+ * Workers are best effort tasks with the default priority, which may be changed with
+ * hf_priorityset() on the ids kept in the pool (workers[i].task).
+ */
+struct wpool *hf_wpool_create(int32_t workers, int32_t depth, uint32_t stack_size)
+{
+	volatile uint32_t status;
+	struct wpool *p;
+	int32_t i, id;
+
+	if (workers <= 0 || depth <= 0)
+		return NULL;
+	p = hf_malloc(sizeof(struct wpool) + workers * (sizeof(struct wp_worker) + depth * sizeof(struct wp_job)));
+	if (p == NULL)
+		return NULL;
+	if (hf_seminit(&p->jobs, 0)){
+		hf_free(p);
+		return NULL;
+	}
+	if (hf_seminit(&p->idle, 0)){
+		hf_semdestroy(&p->jobs);
+		hf_free(p);
+		return NULL;
+	}
+	p->workers = (struct wp_worker *)(p + 1);
+	p->nworkers = 0;
+	p->depth = depth;
+	p->next = 0;
+	p->pending = 0;
+	p->waiters = 0;
+	p->stopping = 0;
+	for (i = 0; i < workers; i++){
+		p->workers[i].jobs = (struct wp_job *)(p->workers + workers) + i * depth;
+		p->workers[i].head = 0;
+		p->workers[i].count = 0;
+		p->workers[i].done = 0;
+		p->workers[i].stolen = 0;
+	}
+	for (i = 0; i < workers; i++){
+		id = hf_spawn(wpool_worker, 0, 0, 0, "worker", stack_size);
+		if (id < 0)
+			break;
+		p->workers[i].task = id;
+		status = _di();
+		wpool_slot[id] = i;
+		wpool_of[id] = p;
+		p->nworkers++;
+		_ei(status);
+	}
+	if (p->nworkers < workers){
+		hf_wpool_destroy(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+/**
+ * @brief Destroys a work pool.
+ *
+ * @param p is a pointer to a work pool.
+ *
+ * @return ERR_OK on success and ERR_ERROR if jobs are still pending or the caller is a
+ * worker of the pool.
+ *
+ * The workers are stopped (they kill themselves) and the memory of the pool is freed.
+ */
+int32_t hf_wpool_destroy(struct wpool *p)
+{
+	volatile uint32_t status;
+	int32_t i, n;
+
+	status = _di();
+	if (p->pending || wpool_of[hf_selfid()] == p){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	n = p->nworkers;
+	p->nworkers = 0;
+	p->stopping = n;
+	_ei(status);
+	for (i = 0; i < n; i++)
+		hf_sempost(&p->jobs);
+	while (p->stopping)
+		hf_yield();
+	hf_semdestroy(&p->idle);
+	hf_semdestroy(&p->jobs);
+	hf_free(p);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Submits a job to a work pool.
+ *
+ * @param p is a pointer to a work pool.
+ * @param fn is the job function.
+ * @param arg is the argument of the job function.
+ *
+ * @return ERR_OK on success and ERR_ERROR if all deques are full.
+ *
+ * A job submitted by a worker of the pool goes to the deque of that worker (and may be
+ * stolen by another one), so jobs may submit jobs. Other tasks spread jobs over the deques
+ * in turn. The submitter is not blocked, a full pool should be retried later, after
+ * hf_wpool_wait() for example.
+ */
+int32_t hf_wpool_submit(struct wpool *p, void (*fn)(void *), void *arg)
+{
+	volatile uint32_t status;
+	struct wp_worker *w;
+	int32_t i, k = -1;
+
+	status = _di();
+	if (wpool_of[hf_selfid()] == p && p->workers[wpool_slot[hf_selfid()]].count < p->depth){
+		k = wpool_slot[hf_selfid()];
+	}else{
+		for (i = 0; i < p->nworkers; i++){
+			if (p->workers[p->next].count < p->depth)
+				k = p->next;
+			if (++p->next == p->nworkers)
+				p->next = 0;
+			if (k >= 0)
+				break;
+		}
+	}
+	if (k < 0){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	w = &p->workers[k];
+	i = w->head + w->count;
+	if (i >= p->depth)
+		i -= p->depth;
+	w->jobs[i].fn = fn;
+	w->jobs[i].arg = arg;
+	w->count++;
+	p->pending++;
+	_ei(status);
+	hf_sempost(&p->jobs);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Waits until all jobs submitted to a work pool are finished.
+ *
+ * @param p is a pointer to a work pool.
+ *
+ * @return ERR_OK when the pool is idle and ERR_ERROR if the caller is a worker of the pool
+ * (it would wait for itself).
+ */
+int32_t hf_wpool_wait(struct wpool *p)
+{
+	volatile uint32_t status;
+
+	status = _di();
+	if (wpool_of[hf_selfid()] == p){
+		_ei(status);
+		return ERR_ERROR;
+	}
+	if (p->pending == 0){
+		_ei(status);
+		return ERR_OK;
+	}
+	p->waiters++;
+	_ei(status);
+	hf_semwait(&p->idle);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Returns the number of pending jobs of a work pool.
+ *
+ * @param p is a pointer to a work pool.
+ *
+ * @return jobs submitted to the pool and not finished (queued or running).
+ */
+int32_t hf_wpool_pending(struct wpool *p)
+{
+	return p->pending;
+}
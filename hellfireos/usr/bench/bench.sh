@@ -0,0 +1,140 @@
+#!/bin/sh
+# batch benchmark runner, driven by the makefile in this directory.
+#
+#   bench.sh cell <out> <platform>-m<MEM_ALLOC>-x<MUTEX_TYPE>
+#	builds the platform in <out>/<cell> with the given settings, runs the image
+#	in the simulator of its architecture (headless, until the benchmark is done
+#	or TIMEOUT seconds) and writes the figures to <out>/<cell>/result.csv
+#   bench.sh csv <result.csv>...
+#	merges cell results, one "config,metric,value" row each
+#   bench.sh json <results.csv>
+#	the same rows, as a JSON array
+#   bench.sh compare <baseline.csv> <results.csv> [threshold %]
+#	prints the change of each metric, and fails if one got worse than the
+#	threshold (cycles: higher is worse, *_per_sec: lower is worse)
+#
+# metrics are <test>_min / <test>_avg for BENCH lines (sched_bench, uhfs_bench,
+# malloc_bench, with <test>_max for the worst case of the allocator),
+# total_ticks / iterations_per_sec for coremark, and a status row per cell (ok,
+# build, nosim, timeout or error).
+
+SRC_DIR=${SRC_DIR:-$(cd "$(dirname "$0")/../.." && pwd)}
+TIMEOUT=${TIMEOUT:-600}
+DONE='BENCH done|Correct operation validated|Errors detected|Cannot validate'
+
+cell() {
+	out=$(cd "$1" && pwd)
+	name=$2
+	plat=${name%-m*-x*}
+	rest=${name#"$plat"-m}
+	mem=${rest%-x*}
+	mtx=${rest#*-x}
+	dir=$out/$name
+
+	rm -rf "$dir"
+	mkdir -p "$dir"
+	if [ ! -f "$SRC_DIR/platform/$plat/makefile" ]; then
+		echo "$name: no platform $plat" >&2
+		echo "$name,status,build" > "$dir/result.csv"
+		return 0
+	fi
+	arch=$(sed -n 's/^ARCH *= *//p' "$SRC_DIR/platform/$plat/makefile")
+	case $arch in
+		mips/hf-risc)	sim=$out/sim/hf_risc_sim ;;
+		riscv/hf-riscv)	sim=$out/sim/hf_riscv_sim ;;
+		*)		echo "$name,status,nosim" > "$dir/result.csv"; return 0 ;;
+	esac
+
+	if ! make -C "$dir" -f "$SRC_DIR/platform/$plat/makefile" SRC_DIR="$SRC_DIR" \
+	    MEM_ALLOC="$mem" MUTEX_TYPE="$mtx" image > "$dir/build.log" 2>&1; then
+		echo "$name: build failed, see $dir/build.log" >&2
+		echo "$name,status,build" > "$dir/result.csv"
+		return 0
+	fi
+
+	# hf_risc_sim prints the console on stdout, hf_riscv_sim on stderr
+	(cd "$dir" && exec stdbuf -oL "$sim" image.bin > console.txt 2>&1) &
+	pid=$!
+	status=timeout
+	t=0
+	while [ $t -lt "$TIMEOUT" ]; do
+		if grep -Eq "$DONE" "$dir/console.txt" 2>/dev/null; then
+			status=ok
+			break
+		fi
+		if ! kill -0 $pid 2>/dev/null; then
+			status=error
+			break
+		fi
+		sleep 1
+		t=$((t + 1))
+	done
+	kill $pid 2>/dev/null
+	wait $pid 2>/dev/null
+
+	awk -v c="$name" -v status=$status '
+		/^BENCH / && NF == 6 && $3 ~ /^[0-9]+$/ { print c "," $2 "_min," $4; print c "," $2 "_avg," $5 }
+		/^BENCH / && NF == 6 && $2 ~ /_(malloc|free)$/ { print c "," $2 "_max," $6 }
+		/^Total ticks/ { print c ",total_ticks," $NF }
+		/^Iterations\/Sec/ { print c ",iterations_per_sec," $NF }
+		/^Errors detected|^Cannot validate/ { status = "error" }
+		END { print c ",status," status }
+	' "$dir/console.txt" > "$dir/result.csv"
+	echo "$name: $status" >&2
+}
+
+csv() {
+	echo "config,metric,value"
+	cat "$@"
+}
+
+json() {
+	awk -F, '
+		BEGIN { printf "[" }
+		NR > 1 {
+			v = $3 ~ /^-?[0-9.]+$/ ? $3 : "\"" $3 "\""
+			printf "%s\n  {\"config\": \"%s\", \"metric\": \"%s\", \"value\": %s}", (NR > 2 ? "," : ""), $1, $2, v
+		}
+		END { print "\n]" }
+	' "$1"
+}
+
+compare() {
+	awk -F, -v th="${3:-2}" '
+		NR == FNR { if (FNR > 1) base[$1 "," $2] = $3; next }
+		FNR == 1 { printf "%-28s %-24s %12s %12s %9s\n", "config", "metric", "baseline", "current", "change"; next }
+		{
+			k = $1 "," $2
+			seen[k] = 1
+			if (!(k in base)) {
+				printf "%-28s %-24s %12s %12s %9s\n", $1, $2, "-", $3, "new"
+				next
+			}
+			b = base[k]
+			if ($2 == "status") {
+				if (b != $3) { printf "%-28s %-24s %12s %12s %9s\n", $1, $2, b, $3, "CHANGED"; bad++ }
+				next
+			}
+			d = b != 0 ? ($3 - b) * 100.0 / b : 0
+			worse = $2 ~ /_per_sec$/ ? -d : d
+			flag = (worse > th) ? " <-- WORSE" : ((worse < -th) ? " (better)" : "")
+			if (worse > th) bad++
+			printf "%-28s %-24s %12s %12s %+8.2f%%%s\n", $1, $2, b, $3, d, flag
+		}
+		END {
+			for (k in base)
+				if (!(k in seen)) { split(k, f, ","); printf "%-28s %-24s %12s %12s %9s\n", f[1], f[2], base[k], "-", "missing" }
+			if (bad) { printf "\n%d metric(s) worse than %s%% (or status changed)\n", bad, th; exit 1 }
+		}
+	' "$1" "$2"
+}
+
+cmd=$1
+shift
+case $cmd in
+	cell)		cell "$@" ;;
+	csv)		csv "$@" ;;
+	json)		json "$@" ;;
+	compare)	compare "$@" ;;
+	*)		echo "usage: bench.sh cell|csv|json|compare ..." >&2; exit 1 ;;
+esac
@@ -0,0 +1,258 @@
+/*
+ * host load generator for app/ustack_bench.
+ *
+ *	udp_load <ip> echo [-n count] [-s size] [-w window]
+ *		datagrams to the echo port, up to window of them in flight. prints the
+ *		round trip distribution (us) and the rate of replies
+ *	udp_load <ip> sink [-n count] [-s size] [-r rate]
+ *		datagrams to the sink port, at rate per second (0: as fast as possible).
+ *		the node tells how many it got and in how many cycles
+ *	udp_load <ip> source [-n count] [-s size]
+ *		the node sends count datagrams to us, as fast as it can
+ *	udp_load <ip> stats | reset
+ *		figures of the node (per layer cycles, with USTACK_STATS=1), or clear them
+ *
+ * each test clears the figures of the node first and prints them after, so the per
+ * layer cycles are the ones of the test. results are printed one per line, as
+ * "RESULT <test> <metric> <value>", next to the BENCH lines of the node.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define ECHO_PORT	30100
+#define SINK_PORT	30101
+#define CTRL_PORT	30102
+#define MAX_SIZE	1472
+#define TIMEOUT		1000		/* ms, for replies */
+
+static int sock;
+static struct sockaddr_in node;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sendto_port(int port, void *buf, int len)
+{
+	struct sockaddr_in to = node;
+
+	to.sin_port = htons(port);
+	if (sendto(sock, buf, len, 0, (struct sockaddr *)&to, sizeof(to)) < 0)
+		perror("sendto");
+}
+
+/* a datagram from a port of the node, or -1 after timeout ms (late ones of other tests are skipped) */
+static int recv_timeout(void *buf, int size, int timeout, int port)
+{
+	struct pollfd p = {sock, POLLIN, 0};
+	struct sockaddr_in from;
+	socklen_t len;
+	int n;
+
+	while (poll(&p, 1, timeout) > 0){
+		len = sizeof(from);
+		n = recvfrom(sock, buf, size, 0, (struct sockaddr *)&from, &len);
+		if (n >= 0 && from.sin_port == htons(port))
+			return n;
+	}
+
+	return -1;
+}
+
+/* a control command, and its answer (printed if print) */
+static int command(const char *cmd, char *answer, int size, int print)
+{
+	int len;
+
+	sendto_port(CTRL_PORT, (void *)cmd, strlen(cmd));
+	len = recv_timeout(answer, size - 1, TIMEOUT, CTRL_PORT);
+	if (len < 0){
+		fprintf(stderr, "no answer to \"%s\"\n", cmd);
+		return -1;
+	}
+	answer[len] = '\0';
+	if (print)
+		fputs(answer, stdout);
+
+	return len;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static uint32_t get32(uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void echo(int count, int size, int window)
+{
+	uint8_t buf[MAX_SIZE];
+	uint64_t *sent, start, t;
+	uint32_t *rtt, seq;
+	int len, next = 0, got = 0, inflight = 0;
+
+	sent = calloc(count, sizeof(*sent));
+	rtt = calloc(count, sizeof(*rtt));
+	if (!sent || !rtt) exit(1);
+	memset(buf, 0, sizeof(buf));
+
+	start = now_us();
+	while (next < count || inflight > 0){
+		while (next < count && inflight < window){
+			put32(buf, next);
+			sent[next] = now_us();
+			sendto_port(ECHO_PORT, buf, size);
+			next++;
+			inflight++;
+		}
+		len = recv_timeout(buf, sizeof(buf), TIMEOUT, ECHO_PORT);
+		if (len < 0){
+			inflight = 0;		/* the rest is lost */
+			continue;
+		}
+		t = now_us();
+		seq = get32(buf);
+		if (len < 4 || seq >= (uint32_t)count || !sent[seq]) continue;
+		rtt[got++] = t - sent[seq];
+		sent[seq] = 0;
+		if (inflight > 0) inflight--;
+	}
+	t = now_us() - start;
+
+	qsort(rtt, got, sizeof(*rtt), cmp);
+	printf("RESULT echo sent %d\nRESULT echo received %d\nRESULT echo lost %d\n", count, got, count - got);
+	if (got){
+		printf("RESULT echo rtt_min_us %u\nRESULT echo rtt_p50_us %u\nRESULT echo rtt_p90_us %u\n",
+			rtt[0], rtt[got / 2], rtt[got * 9 / 10]);
+		printf("RESULT echo rtt_p99_us %u\nRESULT echo rtt_max_us %u\n", rtt[got * 99 / 100], rtt[got - 1]);
+	}
+	printf("RESULT echo pps %.1f\n", t ? got * 1e6 / t : 0.0);
+	free(sent);
+	free(rtt);
+}
+
+static void sink(int count, int size, int rate)
+{
+	uint8_t buf[MAX_SIZE];
+	uint64_t start, t;
+	int i;
+
+	memset(buf, 0, sizeof(buf));
+	start = now_us();
+	for (i = 0; i < count; i++){
+		if (rate)
+			while (now_us() - start < (uint64_t)i * 1000000 / rate);
+		put32(buf, i);
+		sendto_port(SINK_PORT, buf, size);
+	}
+	t = now_us() - start;
+	printf("RESULT sink sent %d\nRESULT sink offered_pps %.1f\n", count, t ? count * 1e6 / t : 0.0);
+	usleep(200000);
+}
+
+static void source(int count, int size)
+{
+	uint8_t buf[MAX_SIZE];
+	char cmd[64];
+	uint64_t start = 0, last = 0;
+	int len, got = 0, reorder = 0;
+	uint32_t seq, expect = 0;
+
+	snprintf(cmd, sizeof(cmd), "tx %d %d", count, size);
+	sendto_port(CTRL_PORT, cmd, strlen(cmd));
+	while ((len = recv_timeout(buf, sizeof(buf) - 1, TIMEOUT, CTRL_PORT)) >= 0){
+		if (len >= 5 && !memcmp(buf, "done ", 5)){
+			buf[len] = '\0';
+			printf("RESULT source node %s", buf + 5);
+			break;
+		}
+		last = now_us();
+		if (!got) start = last;
+		seq = get32(buf);
+		if (seq != expect) reorder++;
+		expect = seq + 1;
+		got++;
+	}
+	printf("RESULT source received %d\nRESULT source lost %d\nRESULT source gaps %d\n", got, count - got, reorder);
+	printf("RESULT source pps %.1f\n", got > 1 && last > start ? (got - 1) * 1e6 / (last - start) : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	char answer[2048];
+	char *test;
+	int opt, count = 1000, size = 64, window = 1, rate = 0;
+
+	if (argc < 3){
+		fprintf(stderr, "usage: %s <ip> echo|sink|source|stats|reset [-n count] [-s size] [-w window] [-r rate]\n", argv[0]);
+		return 1;
+	}
+	memset(&node, 0, sizeof(node));
+	node.sin_family = AF_INET;
+	if (inet_pton(AF_INET, argv[1], &node.sin_addr) != 1){
+		fprintf(stderr, "bad address %s\n", argv[1]);
+		return 1;
+	}
+	test = argv[2];
+	optind = 3;
+	while ((opt = getopt(argc, argv, "n:s:w:r:")) != -1){
+		switch (opt){
+		case 'n': count = atoi(optarg); break;
+		case 's': size = atoi(optarg); break;
+		case 'w': window = atoi(optarg); break;
+		case 'r': rate = atoi(optarg); break;
+		default: return 1;
+		}
+	}
+	if (size < 4) size = 4;
+	if (size > MAX_SIZE) size = MAX_SIZE;
+	if (window < 1) window = 1;
+	if (count < 1) count = 1;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0){
+		perror("socket");
+		return 1;
+	}
+
+	if (!strcmp(test, "stats") || !strcmp(test, "reset"))
+		return command(test, answer, sizeof(answer), 1) < 0;
+
+	if (command("reset", answer, sizeof(answer), 0) < 0)
+		return 1;
+	printf("RESULT %s size %d\n", test, size);
+	if (!strcmp(test, "echo"))
+		echo(count, size, window);
+	else if (!strcmp(test, "sink"))
+		sink(count, size, rate);
+	else if (!strcmp(test, "source"))
+		source(count, size);
+	else{
+		fprintf(stderr, "unknown test %s\n", test);
+		return 1;
+	}
+
+	return command("stats", answer, sizeof(answer), 1) < 0;
+}
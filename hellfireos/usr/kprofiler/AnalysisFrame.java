@@ -0,0 +1,34 @@
+import javax.swing.JInternalFrame;
+import javax.swing.JOptionPane;
+import javax.swing.JScrollPane;
+import javax.swing.JTextArea;
+import java.awt.*;
+import java.io.*;
+
+
+public class AnalysisFrame extends JInternalFrame {
+	static int openFrameCount = 0;
+
+	public AnalysisFrame(File[] files) {
+		super("Trace analysis #" + (++openFrameCount) + " [" + files.length + " core(s)]",
+			true, //resizable
+			true, //closable
+			true, //maximizable
+			true);//iconifiable
+
+		JTextArea text = new JTextArea();
+		text.setEditable(false);
+		text.setFont(new Font(Font.MONOSPACED, Font.PLAIN, 12));
+		for (int i = 0; i < files.length; i++){
+			try{
+				text.append(new TraceAnalysis(files[i]).report());
+				text.append("\n");
+			} catch (IOException e){
+				JOptionPane.showMessageDialog(this, "Could not load " + files[i].getName() + ": " + e.getMessage());
+			}
+		}
+		text.setCaretPosition(0);
+		add(new JScrollPane(text));
+		setSize(792, 492);
+	}
+}
@@ -15,6 +15,7 @@ import java.awt.GridLayout;
 public class Kprofiler extends JFrame implements ActionListener {
 	JDesktopPane desktop;
 	File file;
+	File[] files;
 
 	public Kprofiler() {
 		super("HellfireOS Kernel Profiler");
@@ -92,44 +93,32 @@ public class Kprofiler extends JFrame implements ActionListener {
 	public void actionPerformed(ActionEvent e) {
 		if ("file_opentrace".equals(e.getActionCommand())) {
 		JFileChooser fc = new JFileChooser();
+		fc.setMultiSelectionEnabled(true);	// one binary trace per core
 		int returnVal = fc.showOpenDialog(Kprofiler.this);
 		if (returnVal == JFileChooser.APPROVE_OPTION) {
-			file = fc.getSelectedFile();
+			files = fc.getSelectedFiles();
+			file = files.length > 0 ? files[0] : null;
 		}
 	}
 	if ("file_closetrace".equals(e.getActionCommand())) {
 		file = null;
+		files = null;
 	}
 
 	if ("trace_analyze".equals(e.getActionCommand())) {
 		if (file == null){
 			JOptionPane.showMessageDialog(desktop, "You should open a kernel trace file first!");
+		}else if (TraceIndex.isBinary(file)){
+			createAnalysis(files);
 		}else{
-			String[] items = {"One", "Two", "Three", "Four", "Five"};
-			JComboBox combo = new JComboBox(items);
-			JTextField field1 = new JTextField("1234.56");
-			JTextField field2 = new JTextField("9876.54");
-			JPanel panel = new JPanel(new GridLayout(0, 1));
-			panel.add(field1);
-			panel.add(combo);
-			panel.add(new JLabel("Field 1:"));
-			panel.add(field1);
-			panel.add(new JLabel("Field 2:"));
-			panel.add(field2);
-			int result = JOptionPane.showConfirmDialog(null, panel, "Test",
-			JOptionPane.OK_CANCEL_OPTION, JOptionPane.PLAIN_MESSAGE);
-			if (result == JOptionPane.OK_OPTION) {
-				System.out.println(combo.getSelectedItem()
-					+ " " + field1.getText()
-					+ " " + field2.getText());
-			} else {
-				System.out.println("Cancelled");
-			}
+			JOptionPane.showMessageDialog(desktop, "Trace analysis needs a binary kernel trace (KERNEL_LOG = 3).");
 		}
 	}
 	if ("trace_plot".equals(e.getActionCommand())) {
 		if (file == null){
 			JOptionPane.showMessageDialog(desktop, "You should open a kernel trace file first!");
+		}else if (TraceIndex.isBinary(file)){
+			createTimeline(files);
 		}else{
 			String[] items = {"0.1ms", "0.5ms", "1ms", "2ms", "10ms"};
 			JComboBox combo = new JComboBox(items);
@@ -169,6 +158,30 @@ public class Kprofiler extends JFrame implements ActionListener {
 		} catch (java.beans.PropertyVetoException e) {}
 	}
 
+	//Create a timeline frame for binary traces (one file per core).
+	protected void createTimeline(File[] traces) {
+		TimelineFrame frame;
+
+		frame = new TimelineFrame(traces);
+		frame.setVisible(true);
+		desktop.add(frame);
+		try {
+			frame.setSelected(true);
+		} catch (java.beans.PropertyVetoException e) {}
+	}
+
+	//Create an analysis frame for binary traces (one report per core).
+	protected void createAnalysis(File[] traces) {
+		AnalysisFrame frame;
+
+		frame = new AnalysisFrame(traces);
+		frame.setVisible(true);
+		desktop.add(frame);
+		try {
+			frame.setSelected(true);
+		} catch (java.beans.PropertyVetoException e) {}
+	}
+
 	//Quit the application.
 	protected void quit() {
 		System.exit(0);
@@ -194,6 +207,10 @@ public class Kprofiler extends JFrame implements ActionListener {
 	}
 
 	public static void main(String[] args) {
+		//Headless analysis: Kprofiler -a trace.bin [trace.bin ...]
+		if (args.length > 0 && "-a".equals(args[0])) {
+			System.exit(TraceAnalysis.analyze(java.util.Arrays.copyOfRange(args, 1, args.length)));
+		}
 		//Schedule a job for the event-dispatching thread:
 		//creating and showing this application's GUI.
 		javax.swing.SwingUtilities.invokeLater(new Runnable() {
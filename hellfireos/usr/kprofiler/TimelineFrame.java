@@ -0,0 +1,156 @@
+import javax.swing.JPanel;
+import javax.swing.JInternalFrame;
+import javax.swing.JOptionPane;
+import java.awt.event.*;
+import java.awt.*;
+import java.io.*;
+
+
+public class TimelineFrame extends JInternalFrame {
+	static int openFrameCount = 0;
+
+	public TimelineFrame(File[] files) {
+		super("Execution timeline #" + (++openFrameCount) + " [" + files.length + " core(s)]",
+			true, //resizable
+			true, //closable
+			true, //maximizable
+			true);//iconifiable
+
+		TraceIndex[] cores = new TraceIndex[files.length];
+		for (int i = 0; i < files.length; i++){
+			try{
+				cores[i] = new TraceIndex(files[i]);
+				System.out.printf("\n%s: %d slices, %d tasks", files[i].getName(), cores[i].n_slices, cores[i].n_tasks);
+			} catch (IOException e){
+				JOptionPane.showMessageDialog(this, "Could not load " + files[i].getName() + ": " + e.getMessage());
+				cores[i] = null;
+			}
+		}
+		add(new TimelinePanel(cores));
+		setSize(792, 292);
+	}
+}
+
+/*
+timeline of one or more cores (one track per task and core, side by side). each pixel
+column is drawn from the trace index (TraceIndex.tasksAt()), so drawing costs the same
+at any zoom level. the mouse wheel zooms around the pointer, dragging pans.
+*/
+class TimelinePanel extends JPanel {
+	static final int LABEL = 130, ROW = 16, AXIS = 28;
+	TraceIndex[] cores;
+	double origin;					// time at the first column (us)
+	double scale = 1.0;				// microsseconds per pixel
+	int dragX;
+	double dragOrigin;
+
+	// http://www.rapidtables.com/web/color/RGB_Color.htm
+	static final Color task_colors[] = {	new Color(153, 0, 0), new Color(153, 76, 0), new Color(153, 153, 0),
+						new Color(76, 153, 0), new Color(0, 153, 0), new Color(0, 153, 76),
+						new Color(0, 153, 153), new Color(0, 76, 153), new Color(0, 0, 153),
+						new Color(76, 0, 153), new Color(153, 0, 153), new Color(153, 0, 76)
+		};
+
+	public TimelinePanel(TraceIndex[] cores) {
+		double first = Double.MAX_VALUE, last = 0;
+
+		this.cores = cores;
+		for (TraceIndex c : cores){
+			if (c == null || c.n_slices == 0) continue;
+			first = Math.min(first, toUs(c, c.firstTime()));
+			last = Math.max(last, toUs(c, c.lastTime()));
+		}
+		if (first > last)
+			first = last = 0;
+		origin = first;
+		scale = Math.max((last - first) / 640.0, 0.001);
+
+		addMouseWheelListener(new MouseWheelListener() {
+			public void mouseWheelMoved(MouseWheelEvent e) {
+				double t = origin + (e.getX() - LABEL) * scale;
+				scale *= Math.pow(1.25, e.getWheelRotation());
+				scale = Math.max(scale, 0.001);
+				origin = t - (e.getX() - LABEL) * scale;
+				repaint();
+			}
+		});
+		addMouseListener(new MouseAdapter() {
+			public void mousePressed(MouseEvent e) {
+				dragX = e.getX();
+				dragOrigin = origin;
+			}
+		});
+		addMouseMotionListener(new MouseMotionAdapter() {
+			public void mouseDragged(MouseEvent e) {
+				origin = dragOrigin - (e.getX() - dragX) * scale;
+				repaint();
+			}
+		});
+	}
+
+	static double toUs(TraceIndex c, long cycles) {
+		return cycles / (c.freq / 1000000.0);
+	}
+
+	static long toCycles(TraceIndex c, double us) {
+		return (long)(us * (c.freq / 1000000.0));
+	}
+
+	public void paintComponent(Graphics g) {
+		Graphics2D g2d = (Graphics2D)g;
+		int width = getWidth(), y = AXIS;
+		double step;
+
+		super.paintComponent(g);
+		g2d.setFont(new Font(null, Font.PLAIN, 11));
+
+		// time axis, a grid line each 1, 2 or 5 x 10^n microsseconds (at least 80 pixels apart)
+		step = Math.pow(10, Math.ceil(Math.log10(scale * 80)));
+		if (step / 5 >= scale * 80)
+			step /= 5;
+		else if (step / 2 >= scale * 80)
+			step /= 2;
+		for (double t = Math.ceil(origin / step) * step; t < origin + (width - LABEL) * scale; t += step){
+			int x = LABEL + (int)((t - origin) / scale);
+			g2d.setColor(Color.lightGray);
+			g2d.drawLine(x, AXIS - 6, x, getHeight());
+			g2d.setColor(Color.black);
+			g2d.drawString(String.format("%.3fms", t / 1000.0), x + 2, AXIS - 10);
+		}
+
+		for (int c = 0; c < cores.length; c++){
+			TraceIndex core = cores[c];
+			if (core == null) continue;
+
+			g2d.setColor(Color.black);
+			g2d.drawString("Core " + c + " (" + core.name + ")", 4, y + 12);
+			y += ROW;
+			for (int j = 0; j < core.n_tasks; j++){
+				g2d.setColor(Color.lightGray);
+				g2d.drawLine(LABEL, y + j * ROW + ROW - 1, width, y + j * ROW + ROW - 1);
+				g2d.setColor(Color.black);
+				g2d.drawString("Task " + j, 14, y + j * ROW + 12);
+			}
+			for (int x = LABEL; x < width; x++){
+				double t0 = origin + (x - LABEL) * scale;
+				long m = core.tasksAt(toCycles(core, t0), toCycles(core, t0 + scale) + 1);
+				for (int j = 0; m != 0 && j < core.n_tasks; j++){
+					if ((m & (1L << (j & 63))) == 0) continue;
+					g2d.setColor(task_colors[j % 12]);
+					g2d.fillRect(x, y + j * ROW + 2, 1, ROW - 4);
+				}
+			}
+			y += core.n_tasks * ROW + ROW / 2;
+		}
+	}
+
+	public Dimension getPreferredSize() {
+		int h = AXIS;
+
+		for (TraceIndex c : cores)
+			if (c != null)
+				h += (c.n_tasks + 1) * ROW + ROW / 2;
+
+		return new Dimension(LABEL + 640, h);
+	}
+}
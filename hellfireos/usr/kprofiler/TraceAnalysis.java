@@ -0,0 +1,334 @@
+import java.io.*;
+import java.nio.ByteOrder;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
+import java.util.Arrays;
+import java.util.Formatter;
+
+/*
+real time analysis of a binary kernel trace (KERNEL_LOG = 3) of a single core. the trace
+is read once (in chunks, as in TraceIndex) and reduced to samples of:
+	- release to start latency of each RT job (period boundary to the first time the task
+	is selected to run)
+	- response time of each RT job (release to hf_waitperiod(), or to the end of the last
+	slice of the job if the task used its whole capacity)
+	- dispatcher overhead (tick or hf_yield() to the selected task) and interrupt handler
+	time, by interrupt line
+	- deadline misses, each reported with the events that came just before it.
+jitter is the spread (max - min) of the samples. the first job of each task is not
+accounted, as it is released when the task is spawned, before the first period boundary.
+*/
+public class TraceAnalysis {
+	static final long CHUNK = 64 << 20;		// bytes mapped at a time
+	static final int CONTEXT = 12;			// events kept before each deadline miss
+	static final int MAX_MISSES = 32;		// deadline misses reported in detail
+	static final int TASKS = 256, LINES = 32;
+	static final String[] EVENTS = {"?", "dispatch", "yield", "run", "irq", "noc tx", "noc rx",
+					"noc drop", "release", "miss", "job done", "irq done"};
+
+	String name;
+	long freq;					// counter frequency (Hz)
+	long n_events, first = -1, last;
+	Samples[] latency = new Samples[TASKS];
+	Samples[] response = new Samples[TASKS];
+	int[] jobs = new int[TASKS];
+	int[] misses = new int[TASKS];
+	Samples dispatch = new Samples(), yield = new Samples();
+	Samples[] isr = new Samples[LINES];
+	int n_misses;
+	StringBuilder missed = new StringBuilder();
+
+	// current job of each task
+	long[] release = new long[TASKS];		// release time (-1: no job yet)
+	long[] begin = new long[TASKS];			// first execution (-1: not started)
+	long[] end = new long[TASKS];			// end of the last slice
+	boolean[] closed = new boolean[TASKS];		// finished or missed
+
+	// last events, for the deadline miss context
+	long[] ctime = new long[CONTEXT];
+	int[] cevent = new int[CONTEXT], ctask = new int[CONTEXT], carg = new int[CONTEXT];
+	int chead;
+
+	public TraceAnalysis(File file) throws IOException {
+		RandomAccessFile raf = new RandomAccessFile(file, "r");
+		FileChannel ch = raf.getChannel();
+		MappedByteBuffer buf;
+		long size, pos, len, time, prev = 0, base = 0;
+		int recsize;
+
+		name = file.getName();
+		for (int i = 0; i < TASKS; i++){
+			latency[i] = new Samples();
+			response[i] = new Samples();
+			release[i] = -1;
+		}
+		for (int i = 0; i < LINES; i++)
+			isr[i] = new Samples();
+		try{
+			buf = ch.map(FileChannel.MapMode.READ_ONLY, 0, 16);
+			buf.order(ByteOrder.LITTLE_ENDIAN);
+			buf.position(8);
+			recsize = buf.getInt();
+			freq = buf.getInt() & 0xffffffffL;
+			if (recsize < 8 || freq == 0)
+				throw new IOException("bad trace header");
+
+			size = ch.size();
+			for (pos = 16; pos + recsize <= size; pos += len){
+				len = Math.min(CHUNK - CHUNK % recsize, size - pos);
+				len -= len % recsize;
+				buf = ch.map(FileChannel.MapMode.READ_ONLY, pos, len);
+				buf.order(ByteOrder.LITTLE_ENDIAN);
+				while (buf.remaining() >= recsize){
+					int p = buf.position();
+					time = buf.getInt() & 0xffffffffL;
+					int event = buf.get() & 0xff;
+					int t = buf.get() & 0xff;
+					int arg = buf.getShort() & 0xffff;
+					buf.position(p + recsize);
+					if (time < prev)		// the 32 bit cycle counter wrapped
+						base += 1L << 32;
+					prev = time;
+					time += base;
+
+					event(time, event, t, arg);
+					last = time;
+				}
+			}
+		} finally {
+			raf.close();
+		}
+	}
+
+	// state between events
+	int cur = -1;					// running task
+	long open = -1;					// start of the running slice
+	long sw = -1;					// dispatcher or hf_yield() entry
+	int swkind;
+	int irq = -1;					// interrupt line being served
+	long irq_t0;
+
+	void event(long time, int event, int t, int arg) {
+		int id = arg & (TASKS - 1);
+
+		n_events++;
+		if (first < 0)
+			first = time;
+		switch (event){
+		case 1:						// dispatcher (tick)
+		case 2:						// hf_yield()
+			if (open >= 0 && cur >= 0)
+				end[cur] = time;
+			open = -1;
+			if (event == 1 && irq >= 0){		// the tick handler is the dispatcher
+				isr[irq].add(time - irq_t0);
+				irq = -1;
+			}
+			sw = time;
+			swkind = event;
+			break;
+		case 3:						// task selected to run
+			if (sw >= 0)
+				(swkind == 1 ? dispatch : yield).add(time - sw);
+			sw = -1;
+			cur = t;
+			open = time;
+			if (release[t] >= 0 && begin[t] < 0 && !closed[t]){
+				begin[t] = time;
+				latency[t].add(time - release[t]);
+			}
+			break;
+		case 4:						// interrupt
+			irq = arg & (LINES - 1);
+			irq_t0 = time;
+			break;
+		case 11:					// interrupt handler returned
+			if (irq == (arg & (LINES - 1)))
+				isr[irq].add(time - irq_t0);
+			irq = -1;
+			break;
+		case 8:						// job released
+			finish(id);
+			release[id] = time;
+			begin[id] = -1;
+			closed[id] = false;
+			break;
+		case 9:						// deadline missed
+			misses[id]++;
+			closed[id] = true;
+			if (release[id] >= 0)
+				jobs[id]++;
+			if (n_misses++ < MAX_MISSES)
+				missReport(time, id);
+			break;
+		case 10:					// job finished
+			if (release[id] >= 0 && !closed[id]){
+				response[id].add(time - release[id]);
+				jobs[id]++;
+				closed[id] = true;
+			}
+			break;
+		}
+		ctime[chead] = time;
+		cevent[chead] = event;
+		ctask[chead] = t;
+		carg[chead] = arg;
+		chead = (chead + 1) % CONTEXT;
+	}
+
+	// job of a task which used the whole capacity (no hf_waitperiod()), ends on its last slice
+	void finish(int id) {
+		if (release[id] < 0 || closed[id] || begin[id] < 0)
+			return;
+		response[id].add(end[id] - release[id]);
+		jobs[id]++;
+		closed[id] = true;
+	}
+
+	void missReport(long time, int id) {
+		Formatter f = new Formatter(missed);
+
+		f.format("%12.1f us: task %d", us(time - first), id);
+		if (release[id] >= 0){
+			f.format(", released at %.1f us", us(release[id] - first));
+			if (begin[id] >= 0)
+				f.format(", started after %.1f us", us(begin[id] - release[id]));
+			else
+				f.format(", never started");
+		}
+		f.format("\n");
+		for (int i = 0; i < CONTEXT; i++){
+			int k = (chead + i) % CONTEXT;
+			if (cevent[k] == 0)
+				continue;
+			f.format("%14.1f us  %-9s task %-3d", -us(time - ctime[k]), cevent[k] < EVENTS.length ?
+				EVENTS[cevent[k]] : "event " + cevent[k], ctask[k]);
+			if (cevent[k] >= 4)		// events with an argument
+				f.format(" arg %d", carg[k]);
+			f.format("\n");
+		}
+	}
+
+	double us(long cycles) {
+		return cycles * 1e6 / freq;
+	}
+
+	public String report() {
+		StringBuilder sb = new StringBuilder();
+		Formatter f = new Formatter(sb);
+		long total = Math.max(last - first, 1);
+		boolean rt = false;
+
+		f.format("%s: %d events, %.3f s, counter at %d Hz\n", name, n_events, us(last - first) / 1e6, freq);
+
+		for (int i = 0; i < TASKS; i++)
+			rt |= jobs[i] > 0 || misses[i] > 0;
+		if (!rt){
+			f.format("\nno real time jobs on the trace (no release events)\n");
+		}else{
+			f.format("\nrelease to start latency (us)\n");
+			f.format("%6s %8s %10s %10s %10s %10s %10s\n", "task", "jobs", "p50", "p90", "p99", "max", "jitter");
+			for (int i = 0; i < TASKS; i++)
+				if (jobs[i] > 0 || misses[i] > 0){
+					row(f, i, latency[i], jobs[i]);
+					f.format("\n");
+				}
+			f.format("\nresponse time (us)\n");
+			f.format("%6s %8s %10s %10s %10s %10s %10s %8s\n", "task", "jobs", "p50", "p90", "p99", "max", "jitter", "misses");
+			for (int i = 0; i < TASKS; i++)
+				if (jobs[i] > 0 || misses[i] > 0){
+					row(f, i, response[i], jobs[i]);
+					f.format(" %8d\n", misses[i]);
+				}
+		}
+
+		f.format("\noverhead (us)\n");
+		f.format("%-12s %8s %10s %10s %10s %8s\n", "", "count", "mean", "p99", "max", "% time");
+		overhead(f, "dispatcher", dispatch, total);
+		overhead(f, "hf_yield()", yield, total);
+		for (int i = 0; i < LINES; i++)
+			if (isr[i].n > 0)
+				overhead(f, "irq " + i, isr[i], total);
+
+		if (n_misses > 0){
+			f.format("\ndeadline misses: %d", n_misses);
+			if (n_misses > MAX_MISSES)
+				f.format(" (first %d shown)", MAX_MISSES);
+			f.format("\n%s", missed);
+		}
+
+		return sb.toString();
+	}
+
+	void row(Formatter f, int id, Samples s, int n) {
+		f.format("%6d %8d", id, n);
+		if (s.n == 0){
+			f.format(" %10s %10s %10s %10s %10s", "-", "-", "-", "-", "-");
+			return;
+		}
+		f.format(" %10.1f %10.1f %10.1f %10.1f %10.1f", us(s.percentile(50)), us(s.percentile(90)),
+			us(s.percentile(99)), us(s.max()), us(s.max() - s.min()));
+	}
+
+	void overhead(Formatter f, String what, Samples s, long total) {
+		if (s.n == 0)
+			return;
+		f.format("%-12s %8d %10.2f %10.2f %10.2f %8.3f\n", what, s.n, us(s.sum) / s.n,
+			us(s.percentile(99)), us(s.max()), s.sum * 100.0 / total);
+	}
+
+	// headless analysis (Kprofiler -a trace.bin ...)
+	public static int analyze(String[] files) {
+		int err = 0;
+
+		for (String s : files){
+			try{
+				System.out.println(new TraceAnalysis(new File(s)).report());
+			} catch (IOException e){
+				System.err.println(s + ": " + e.getMessage());
+				err = 1;
+			}
+		}
+
+		return err;
+	}
+}
+
+// samples of a metric, in counter cycles
+class Samples {
+	long[] v = new long[64];
+	int n;
+	long sum;
+	boolean sorted;
+
+	void add(long x) {
+		if (n == v.length)
+			v = Arrays.copyOf(v, n * 2);
+		v[n++] = x;
+		sum += x;
+		sorted = false;
+	}
+
+	void sort() {
+		if (!sorted)
+			Arrays.sort(v, 0, n);
+		sorted = true;
+	}
+
+	long percentile(double p) {
+		sort();
+		int i = (int)Math.ceil(p / 100.0 * n) - 1;
+
+		return v[Math.max(0, Math.min(i, n - 1))];
+	}
+
+	long min() {
+		sort();
+		return v[0];
+	}
+
+	long max() {
+		sort();
+		return v[n - 1];
+	}
+}
@@ -0,0 +1,190 @@
+import java.io.*;
+import java.nio.ByteOrder;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
+import java.util.Arrays;
+
+/*
+binary kernel trace (KERNEL_LOG = 3) of a single core, see sys/kernel/trace.c for the
+format. the trace is memory mapped in chunks and reduced to the list of task execution
+slices (start / stop times, in counter cycles), so only the index is kept in memory.
+a pyramid of task bitmaps summarizes the slices, so the tasks executed in any time
+interval are found in logarithmic time, no matter how long the trace or the interval.
+*/
+public class TraceIndex {
+	static final int LEAF = 64;			// slices summarized by a level 0 node
+	static final long CHUNK = 64 << 20;		// bytes mapped at a time
+
+	String name;
+	long freq;					// counter frequency (Hz)
+	int n_slices, n_tasks;
+	long[] start = new long[1024];
+	long[] stop = new long[1024];
+	byte[] task = new byte[1024];
+	byte[] yield = new byte[1024];			// slice ended by hf_yield()
+	long[][] mask;
+
+	public static boolean isBinary(File file) {
+		byte[] magic = new byte[4];
+
+		try{
+			DataInputStream in = new DataInputStream(new FileInputStream(file));
+			try{
+				in.readFully(magic);
+			} finally {
+				in.close();
+			}
+			return "HFTR".equals(new String(magic, "US-ASCII"));
+		} catch (IOException e){
+			return false;
+		}
+	}
+
+	public TraceIndex(File file) throws IOException {
+		RandomAccessFile raf = new RandomAccessFile(file, "r");
+		FileChannel ch = raf.getChannel();
+		MappedByteBuffer buf;
+		long size, pos, len, time, last = 0, base = 0, open = -1;
+		int recsize, event, id = 0;
+
+		name = file.getName();
+		try{
+			buf = ch.map(FileChannel.MapMode.READ_ONLY, 0, 16);
+			buf.order(ByteOrder.LITTLE_ENDIAN);
+			buf.position(8);
+			recsize = buf.getInt();
+			freq = buf.getInt() & 0xffffffffL;
+			if (recsize < 8 || freq == 0)
+				throw new IOException("bad trace header");
+
+			size = ch.size();
+			for (pos = 16; pos + recsize <= size; pos += len){
+				len = Math.min(CHUNK - CHUNK % recsize, size - pos);
+				len -= len % recsize;
+				buf = ch.map(FileChannel.MapMode.READ_ONLY, pos, len);
+				buf.order(ByteOrder.LITTLE_ENDIAN);
+				while (buf.remaining() >= recsize){
+					int p = buf.position();
+					time = buf.getInt() & 0xffffffffL;
+					event = buf.get() & 0xff;
+					int t = buf.get() & 0xff;
+					buf.position(p + recsize);
+					if (time < last)		// the 32 bit cycle counter wrapped
+						base += 1L << 32;
+					last = time;
+					time += base;
+
+					if (event == 3){		// task selected to run
+						open = time;
+						id = t;
+					}
+					if ((event == 1 || event == 2) && open >= 0){	// dispatcher or hf_yield()
+						add(open, time, id, event == 2);
+						open = -1;
+					}
+				}
+			}
+		} finally {
+			raf.close();
+		}
+		n_tasks++;
+		buildIndex();
+	}
+
+	void add(long t0, long t1, int id, boolean y) {
+		if (n_slices == start.length){
+			int n = n_slices * 2;
+			start = Arrays.copyOf(start, n);
+			stop = Arrays.copyOf(stop, n);
+			task = Arrays.copyOf(task, n);
+			yield = Arrays.copyOf(yield, n);
+		}
+		start[n_slices] = t0;
+		stop[n_slices] = t1;
+		task[n_slices] = (byte)id;
+		yield[n_slices] = (byte)(y ? 1 : 0);
+		n_slices++;
+		if (id > n_tasks)
+			n_tasks = id;
+	}
+
+	long bit(int i) {
+		return 1L << ((task[i] & 0xff) & 63);
+	}
+
+	void buildIndex() {
+		int levels = 1, n = (n_slices + LEAF - 1) / LEAF;
+
+		for (int k = n; k > 1; k = (k + 1) / 2)
+			levels++;
+		mask = new long[levels][];
+		mask[0] = new long[Math.max(n, 1)];
+		for (int i = 0; i < n_slices; i++)
+			mask[0][i / LEAF] |= bit(i);
+		for (int l = 1; l < levels; l++){
+			mask[l] = new long[(mask[l - 1].length + 1) / 2];
+			for (int i = 0; i < mask[l - 1].length; i++)
+				mask[l][i / 2] |= mask[l - 1][i];
+		}
+	}
+
+	// last slice starting at or before t (-1 if none)
+	public int find(long t) {
+		int lo = 0, hi = n_slices - 1, r = -1;
+
+		while (lo <= hi){
+			int mid = (lo + hi) >>> 1;
+			if (start[mid] <= t){
+				r = mid;
+				lo = mid + 1;
+			}else{
+				hi = mid - 1;
+			}
+		}
+
+		return r;
+	}
+
+	// bitmap of the tasks (modulo 64) executed on slices [i0, i1)
+	public long tasks(int i0, int i1) {
+		long m = 0;
+		int b0, b1;
+
+		while (i0 < i1 && i0 % LEAF != 0)
+			m |= bit(i0++);
+		while (i1 > i0 && i1 % LEAF != 0)
+			m |= bit(--i1);
+		b0 = i0 / LEAF;
+		b1 = i1 / LEAF;
+		for (int l = 0; b0 < b1; l++){
+			if ((b0 & 1) != 0)
+				m |= mask[l][b0++];
+			if ((b1 & 1) != 0)
+				m |= mask[l][--b1];
+			b0 >>= 1;
+			b1 >>= 1;
+		}
+
+		return m;
+	}
+
+	// bitmap of the tasks executed in the time interval [t0, t1)
+	public long tasksAt(long t0, long t1) {
+		int i0 = find(t0), i1 = find(t1 - 1) + 1;
+
+		if (i0 < 0 || stop[i0] <= t0)
+			i0++;
+		if (i0 >= i1)
+			return 0;
+
+		return tasks(i0, i1);
+	}
+
+	public long firstTime() {
+		return n_slices > 0 ? start[0] : 0;
+	}
+
+	public long lastTime() {
+		return n_slices > 0 ? stop[n_slices - 1] : 0;
+	}
+}
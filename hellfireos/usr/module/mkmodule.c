@@ -0,0 +1,423 @@
+/*
+ * converts a module, linked at address 0 with its relocations (ld -q, see module.ld),
+ * to the module file format of the loader (sys/kernel/module.c, sys/include/module.h).
+ *
+ *	mkmodule [-n name] [-s stack_size] module.elf module.hfm
+ *
+ * the image is the allocated sections of the ELF file, and the relocations are the
+ * ones the loader must apply: absolute references (to the module itself or to kernel
+ * symbols) and pc relative references to kernel symbols. symbols undefined on the ELF
+ * file are imported from the kernel by name. MIPS (REL) and RISC-V (RELA) files, of
+ * any byte order, are supported. the file is written in the byte order of the target.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MODULE_MAGIC		0x48464d31
+#define MODULE_NAMELEN		16
+#define MODULE_SYMLEN		24
+#define MODULE_LOCAL		0xffff
+
+#define RELOC_32		1
+#define RELOC_MIPS_26		2
+#define RELOC_MIPS_HI16		3
+#define RELOC_MIPS_LO16		4
+#define RELOC_RISCV_HI20	5
+#define RELOC_RISCV_LO12_I	6
+#define RELOC_RISCV_LO12_S	7
+#define RELOC_RISCV_CALL	8
+#define RELOC_RISCV_JAL		9
+
+#define EM_MIPS			8
+#define EM_RISCV		243
+#define SHT_SYMTAB		2
+#define SHT_RELA		4
+#define SHT_NOBITS		8
+#define SHT_REL			9
+#define SHF_ALLOC		2
+
+struct reloc {
+	uint32_t offset, value;
+	uint16_t type, sym;
+};
+
+static uint8_t *elf;
+static long elf_size;
+static int big;
+static uint16_t machine;
+
+static uint8_t *image;
+static uint32_t image_size, mem_size;
+
+static char imports[65535][MODULE_SYMLEN];
+static int nimports;
+static struct reloc *relocs;
+static int nrelocs, maxrelocs;
+
+static void fail(const char *msg, const char *arg)
+{
+	fprintf(stderr, "mkmodule: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+	exit(1);
+}
+
+static uint32_t rd32(uint8_t *p)
+{
+	return big ? (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3] : (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+static uint16_t rd16(uint8_t *p)
+{
+	return big ? p[0] << 8 | p[1] : p[1] << 8 | p[0];
+}
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+	if (big){
+		p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+	}else{
+		p[3] = v >> 24; p[2] = v >> 16; p[1] = v >> 8; p[0] = v;
+	}
+}
+
+static void wr16(uint8_t *p, uint16_t v)
+{
+	if (big){
+		p[0] = v >> 8; p[1] = v;
+	}else{
+		p[1] = v >> 8; p[0] = v;
+	}
+}
+
+static uint8_t *elf_at(uint32_t off, uint32_t size)
+{
+	if ((long)off + size > elf_size)
+		fail("truncated ELF file", NULL);
+
+	return elf + off;
+}
+
+/* section header fields */
+static uint8_t *shdr(int i)
+{
+	return elf_at(rd32(elf + 32) + i * rd16(elf + 46), 40);
+}
+#define SH_NAME(s)	rd32((s) + 0)
+#define SH_TYPE(s)	rd32((s) + 4)
+#define SH_FLAGS(s)	rd32((s) + 8)
+#define SH_ADDR(s)	rd32((s) + 12)
+#define SH_OFFSET(s)	rd32((s) + 16)
+#define SH_SIZE(s)	rd32((s) + 20)
+#define SH_LINK(s)	rd32((s) + 24)
+#define SH_INFO(s)	rd32((s) + 28)
+#define SH_ENTSIZE(s)	rd32((s) + 36)
+
+static int import(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nimports; i++)
+		if (!strcmp(imports[i], name))
+			return i;
+	if (strlen(name) >= MODULE_SYMLEN)
+		fail("symbol name too long:", name);
+	if (nimports == MODULE_LOCAL)
+		fail("too many imports", NULL);
+	strcpy(imports[nimports], name);
+
+	return nimports++;
+}
+
+static void add_reloc(uint32_t offset, uint32_t value, uint16_t type, uint16_t sym)
+{
+	if (nrelocs == maxrelocs){
+		maxrelocs = maxrelocs ? maxrelocs * 2 : 256;
+		relocs = realloc(relocs, maxrelocs * sizeof(struct reloc));
+		if (!relocs)
+			fail("out of memory", NULL);
+	}
+	relocs[nrelocs].offset = offset;
+	relocs[nrelocs].value = value;
+	relocs[nrelocs].type = type;
+	relocs[nrelocs].sym = sym;
+	nrelocs++;
+}
+
+static uint32_t insn(uint32_t offset)
+{
+	if (offset + 4 > image_size)
+		fail("relocation out of the image", NULL);
+
+	return rd32(image + offset);
+}
+
+/* MIPS (REL): the addend is on the linked code, so the target address is taken from it */
+static void mips_reloc(uint8_t *rel, uint32_t count, uint8_t *symtab, uint32_t nsyms, const char *strtab)
+{
+	uint32_t i, j, off, info, type, sym, v, hi = 0, hi_sym = 0;
+	int have_hi = 0, imp;
+	uint8_t *s;
+
+	for (i = 0; i < count; i++, rel += 8){
+		off = rd32(rel);
+		info = rd32(rel + 4);
+		type = info & 0xff;
+		sym = info >> 8;
+		if (sym >= nsyms)
+			fail("bad symbol index", NULL);
+		s = symtab + sym * 16;
+		imp = sym && rd16(s + 14) == 0 ? import(strtab + rd32(s)) : -1;
+
+		switch (type){
+		case 0:					/* R_MIPS_NONE */
+		case 37:				/* R_MIPS_JALR (hint) */
+			break;
+		case 2:					/* R_MIPS_32 */
+			add_reloc(off, insn(off), RELOC_32, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 4:					/* R_MIPS_26 */
+			add_reloc(off, (insn(off) & 0x03ffffff) << 2, RELOC_MIPS_26, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 5:					/* R_MIPS_HI16, paired with the next LO16 of the symbol */
+			for (j = i + 1; j < count; j++)
+				if ((rd32(rel + (j - i) * 8 + 4) & 0xff) == 6 && rd32(rel + (j - i) * 8 + 4) >> 8 == sym)
+					break;
+			if (j == count)
+				fail("HI16 relocation without a LO16", NULL);
+			v = (insn(off) << 16) + (int16_t)(insn(rd32(rel + (j - i) * 8)) & 0xffff);
+			hi = insn(off) & 0xffff;
+			hi_sym = sym;
+			have_hi = 1;
+			add_reloc(off, v, RELOC_MIPS_HI16, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 6:					/* R_MIPS_LO16, the high part is the one of the last HI16 */
+			if (!have_hi || hi_sym != sym)
+				fail("LO16 relocation without a HI16", NULL);
+			v = (hi << 16) + (int16_t)(insn(off) & 0xffff);
+			add_reloc(off, v, RELOC_MIPS_LO16, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 10:				/* R_MIPS_PC16 */
+			if (imp >= 0)
+				fail("branch to a kernel symbol:", imports[imp]);
+			break;
+		case 7:					/* R_MIPS_GPREL16 */
+			fail("gp relative reference (build with -G 0)", NULL);
+		default:
+			fprintf(stderr, "mkmodule: unsupported MIPS relocation %u at %x\n", type, off);
+			exit(1);
+		}
+	}
+}
+
+/* RISC-V (RELA): the target address is the symbol value plus the addend */
+static void riscv_reloc(uint8_t *rel, uint32_t count, uint8_t *symtab, uint32_t nsyms, const char *strtab)
+{
+	uint32_t i, off, info, type, sym, v;
+	int imp;
+	uint8_t *s;
+
+	for (i = 0; i < count; i++, rel += 12){
+		off = rd32(rel);
+		info = rd32(rel + 4);
+		type = info & 0xff;
+		sym = info >> 8;
+		if (sym >= nsyms)
+			fail("bad symbol index", NULL);
+		s = symtab + sym * 16;
+		imp = sym && rd16(s + 14) == 0 ? import(strtab + rd32(s)) : -1;
+		v = (imp < 0 ? rd32(s + 4) : 0) + rd32(rel + 8);
+
+		switch (type){
+		case 0:					/* R_RISCV_NONE */
+		case 43:				/* R_RISCV_ALIGN */
+		case 51:				/* R_RISCV_RELAX */
+			break;
+		case 1:					/* R_RISCV_32 */
+			add_reloc(off, v, RELOC_32, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 26:				/* R_RISCV_HI20 */
+			add_reloc(off, v, RELOC_RISCV_HI20, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 27:				/* R_RISCV_LO12_I */
+			add_reloc(off, v, RELOC_RISCV_LO12_I, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 28:				/* R_RISCV_LO12_S */
+			add_reloc(off, v, RELOC_RISCV_LO12_S, imp < 0 ? MODULE_LOCAL : imp);
+			break;
+		case 17:				/* R_RISCV_JAL */
+			if (imp >= 0)
+				add_reloc(off, v, RELOC_RISCV_JAL, imp);
+			break;
+		case 18:				/* R_RISCV_CALL */
+		case 19:				/* R_RISCV_CALL_PLT */
+			if (imp >= 0)
+				add_reloc(off, v, RELOC_RISCV_CALL, imp);
+			break;
+		case 16:				/* R_RISCV_BRANCH */
+		case 44:				/* R_RISCV_RVC_BRANCH */
+		case 45:				/* R_RISCV_RVC_JUMP */
+			if (imp >= 0)
+				fail("branch to a kernel symbol:", imports[imp]);
+			break;
+		case 23:				/* R_RISCV_PCREL_HI20 */
+			if (imp >= 0)
+				fail("pc relative reference to a kernel symbol (build with -mcmodel=medlow):", imports[imp]);
+			break;
+		case 24:				/* R_RISCV_PCREL_LO12_I */
+		case 25:				/* R_RISCV_PCREL_LO12_S */
+			break;
+		default:
+			fprintf(stderr, "mkmodule: unsupported RISC-V relocation %u at %x\n", type, off);
+			exit(1);
+		}
+	}
+}
+
+static uint32_t crc32_update(uint32_t crc, uint8_t *data, uint32_t len)
+{
+	int i;
+
+	while (len--){
+		crc ^= (uint32_t)*data++ << 24;
+		for (i = 0; i < 8; i++)
+			crc = crc << 1 ^ (crc & 0x80000000 ? 0x04c11db7 : 0);
+	}
+
+	return crc;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t *s, *t, *symtab, *hdr, *out, *p;
+	const char *strtab, *in_name = NULL, *out_name = NULL;
+	char name[MODULE_NAMELEN] = "";
+	uint32_t i, shnum, entry, stack_size = 0, nsyms, end, out_size, crc;
+	int arg;
+
+	for (arg = 1; arg < argc; arg++){
+		if (!strcmp(argv[arg], "-n") && arg + 1 < argc)
+			strncpy(name, argv[++arg], MODULE_NAMELEN - 1);
+		else if (!strcmp(argv[arg], "-s") && arg + 1 < argc)
+			stack_size = strtoul(argv[++arg], NULL, 0);
+		else if (!in_name)
+			in_name = argv[arg];
+		else if (!out_name)
+			out_name = argv[arg];
+		else
+			in_name = NULL;
+	}
+	if (!in_name || !out_name){
+		fprintf(stderr, "usage: mkmodule [-n name] [-s stack_size] module.elf module.hfm\n");
+		return 1;
+	}
+	if (!name[0]){
+		const char *b = strrchr(out_name, '/');
+
+		strncpy(name, b ? b + 1 : out_name, MODULE_NAMELEN - 1);
+		if (strchr(name, '.'))
+			*strchr(name, '.') = '\0';
+	}
+
+	f = fopen(in_name, "rb");
+	if (!f)
+		fail("can't open", in_name);
+	fseek(f, 0, SEEK_END);
+	elf_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	elf = malloc(elf_size);
+	if (!elf || fread(elf, 1, elf_size, f) != (size_t)elf_size)
+		fail("can't read", in_name);
+	fclose(f);
+
+	if (elf_size < 52 || memcmp(elf, "\177ELF", 4) || elf[4] != 1)
+		fail("not an ELF32 file:", in_name);
+	big = elf[5] == 2;
+	machine = rd16(elf + 18);
+	if (machine != EM_MIPS && machine != EM_RISCV)
+		fail("not a MIPS or RISC-V file:", in_name);
+	entry = rd32(elf + 24);
+	shnum = rd16(elf + 48);
+
+	/* the image: allocated sections, at their (0 based) addresses */
+	for (i = 0; i < shnum; i++){
+		s = shdr(i);
+		if (!(SH_FLAGS(s) & SHF_ALLOC) || !SH_SIZE(s))
+			continue;
+		end = SH_ADDR(s) + SH_SIZE(s);
+		if (SH_TYPE(s) != SHT_NOBITS && end > image_size)
+			image_size = end;
+		if (end > mem_size)
+			mem_size = end;
+	}
+	image_size = (image_size + 3) & ~3;
+	if (mem_size < image_size)
+		mem_size = image_size;
+	mem_size = (mem_size + 3) & ~3;
+	image = calloc(1, image_size + 4);
+	for (i = 0; i < shnum; i++){
+		s = shdr(i);
+		if (!(SH_FLAGS(s) & SHF_ALLOC) || SH_TYPE(s) == SHT_NOBITS || !SH_SIZE(s))
+			continue;
+		memcpy(image + SH_ADDR(s), elf_at(SH_OFFSET(s), SH_SIZE(s)), SH_SIZE(s));
+	}
+	if (entry >= image_size)
+		fail("entry point out of the image", NULL);
+
+	/* relocations of allocated sections */
+	for (i = 0; i < shnum; i++){
+		s = shdr(i);
+		if (SH_TYPE(s) != SHT_REL && SH_TYPE(s) != SHT_RELA)
+			continue;
+		if (SH_INFO(s) >= shnum || !(SH_FLAGS(shdr(SH_INFO(s))) & SHF_ALLOC))
+			continue;
+		t = shdr(SH_LINK(s));
+		symtab = elf_at(SH_OFFSET(t), SH_SIZE(t));
+		nsyms = SH_SIZE(t) / 16;
+		strtab = (const char *)elf_at(SH_OFFSET(shdr(SH_LINK(t))), SH_SIZE(shdr(SH_LINK(t))));
+		if (machine == EM_MIPS && SH_TYPE(s) == SHT_REL)
+			mips_reloc(elf_at(SH_OFFSET(s), SH_SIZE(s)), SH_SIZE(s) / 8, symtab, nsyms, strtab);
+		else if (machine == EM_RISCV && SH_TYPE(s) == SHT_RELA)
+			riscv_reloc(elf_at(SH_OFFSET(s), SH_SIZE(s)), SH_SIZE(s) / 12, symtab, nsyms, strtab);
+		else
+			fail("unexpected relocation section format", NULL);
+	}
+	if (!nrelocs && !nimports)
+		fprintf(stderr, "mkmodule: warning, no relocations (was the module linked with -q?)\n");
+
+	/* header, imports, image and relocations */
+	out_size = 9 * 4 + MODULE_NAMELEN + nimports * MODULE_SYMLEN + image_size + nrelocs * 12;
+	out = calloc(1, out_size);
+	hdr = out;
+	p = out + 9 * 4 + MODULE_NAMELEN;
+	memcpy(p, imports, nimports * MODULE_SYMLEN);
+	p += nimports * MODULE_SYMLEN;
+	memcpy(p, image, image_size);
+	p += image_size;
+	for (i = 0; i < (uint32_t)nrelocs; i++, p += 12){
+		wr32(p, relocs[i].offset);
+		wr32(p + 4, relocs[i].value);
+		wr16(p + 8, relocs[i].type);
+		wr16(p + 10, relocs[i].sym);
+	}
+	crc = crc32_update(0xffffffff, out + 9 * 4 + MODULE_NAMELEN, out_size - 9 * 4 - MODULE_NAMELEN);
+	wr32(hdr, MODULE_MAGIC);
+	wr32(hdr + 4, machine);
+	wr32(hdr + 8, image_size);
+	wr32(hdr + 12, mem_size - image_size);
+	wr32(hdr + 16, entry);
+	wr32(hdr + 20, stack_size);
+	wr32(hdr + 24, nimports);
+	wr32(hdr + 28, nrelocs);
+	wr32(hdr + 32, crc);
+	memcpy(hdr + 36, name, MODULE_NAMELEN);
+
+	f = fopen(out_name, "wb");
+	if (!f || fwrite(out, 1, out_size, f) != out_size)
+		fail("can't write", out_name);
+	fclose(f);
+	printf("%s: %u bytes (image %u, bss %u), %d imports, %d relocations\n", out_name, out_size, image_size, mem_size - image_size, nimports, nrelocs);
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * sends a module file to a node running hf_module_uudp() (net/uudp/uudp.c).
+ *
+ *	modsend <ip> <port> module.hfm
+ *
+ * the file goes on datagrams holding the file offset of their data (4 bytes, network
+ * byte order) and up to CHUNK bytes of the file, one at a time. the node acks each
+ * datagram with the offset it expects next, and the datagram is sent again if no ack
+ * comes in TIMEOUT ms. the ack of the last datagram may be lost when the node stops
+ * listening to load the module, so a missing final ack is not an error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define CHUNK		1024		/* UUDP_MODULE_CHUNK */
+#define TIMEOUT		200		/* ms, for acks */
+#define RETRIES		20
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in node;
+	struct pollfd p;
+	FILE *f;
+	uint8_t *file, buf[CHUNK + 4], ack[16];
+	uint32_t offset = 0, next;
+	long size;
+	int sock, len, tries, n;
+
+	if (argc != 4){
+		fprintf(stderr, "usage: modsend <ip> <port> module.hfm\n");
+		return 1;
+	}
+	f = fopen(argv[3], "rb");
+	if (!f){
+		perror(argv[3]);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	file = malloc(size);
+	if (!file || fread(file, 1, size, f) != (size_t)size){
+		fprintf(stderr, "modsend: can't read %s\n", argv[3]);
+		return 1;
+	}
+	fclose(f);
+
+	memset(&node, 0, sizeof(node));
+	node.sin_family = AF_INET;
+	node.sin_port = htons(atoi(argv[2]));
+	if (inet_pton(AF_INET, argv[1], &node.sin_addr) != 1){
+		fprintf(stderr, "modsend: bad address %s\n", argv[1]);
+		return 1;
+	}
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0){
+		perror("socket");
+		return 1;
+	}
+	p.fd = sock;
+	p.events = POLLIN;
+
+	while (offset < size){
+		len = size - offset > CHUNK ? CHUNK : size - offset;
+		buf[0] = offset >> 24; buf[1] = offset >> 16;
+		buf[2] = offset >> 8; buf[3] = offset;
+		memcpy(buf + 4, file + offset, len);
+		for (tries = 0; tries < RETRIES; tries++){
+			if (sendto(sock, buf, len + 4, 0, (struct sockaddr *)&node, sizeof(node)) < 0)
+				perror("sendto");
+			next = 0;
+			while (poll(&p, 1, TIMEOUT) > 0){
+				n = recv(sock, ack, sizeof(ack), 0);
+				if (n != 4)
+					continue;
+				next = (uint32_t)ack[0] << 24 | ack[1] << 16 | ack[2] << 8 | ack[3];
+				if (next > offset)
+					break;
+			}
+			if (next > offset)
+				break;
+		}
+		if (tries == RETRIES){
+			if (offset + len == size)
+				break;
+			fprintf(stderr, "modsend: no ack from the node at offset %u\n", offset);
+			return 1;
+		}
+		offset = next;
+	}
+	printf("%s: %ld bytes sent\n", argv[3], size);
+	close(sock);
+
+	return 0;
+}
@@ -8,8 +8,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-
-#define MEM_SIZE			0x00100000
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif
+
+#define MEM_SIZE			0x00100000		/* default, -M sets it */
 #define SRAM_BASE			0x40000000
 #define EXIT_TRAP			0xe0000000
 #define IRQ_VECTOR			0xf0000000
@@ -22,10 +32,26 @@
 #define COMPARE2			0xf0000070
 #define EXTIO_IN			0xf0000080
 #define EXTIO_OUT			0xf0000090
+#define CHECKPOINT			0xf00000b0
+#define IDLE_HINT			0xf00000c0
 #define DEBUG_ADDR			0xf00000d0
 #define UART_WRITE			0xf00000e0
 #define UART_READ			0xf00000e0
 #define UART_DIVISOR			0xf00000f0
+#define NIC_CTRL			0xf0000200
+#define NIC_STATUS			0xf0000210
+#define NIC_RXADDR			0xf0000220
+#define NIC_RXLEN			0xf0000230
+#define NIC_TXADDR			0xf0000240
+#define NIC_TXLEN			0xf0000250
+#define NIC_MAC0			0xf0000260
+#define NIC_MAC1			0xf0000270
+#define BLK_CTRL			0xf0000300
+#define BLK_STATUS			0xf0000310
+#define BLK_SECTOR			0xf0000320
+#define BLK_COUNT			0xf0000330
+#define BLK_ADDR			0xf0000340
+#define BLK_SECTORS			0xf0000350
 
 #define ntohs(A) ( ((A)>>8) | (((A)&0xff)<<8) )
 #define htons(A) ntohs(A)
@@ -40,30 +66,189 @@ typedef struct {
 	int8_t j, nox_bds;
 	int32_t vector, cause, mask, status, status_dly[4], epc, counter, compare, compare2;
 	uint32_t ins, arith, logic, shift, comp, ls, bra, taken_bra, jmp, mul, div, other;
+	uint32_t idle;
 } state;
 
-int8_t sram[MEM_SIZE];
+/*
+simulated memory, a power of two (mem_mask decodes the address). memory is an anonymous
+mapping, so pages are zero until they are touched and the .bss of a program costs nothing
+to load. raw images and ELF segments are mapped from the file (private, copy on write)
+where the file offset allows it.
+*/
+int8_t *sram;
+uint32_t mem_size = MEM_SIZE, mem_mask = MEM_SIZE - 1;
+
+/*
+memory map, in pages of 64KB. a page is either memory (mirrored every mem_size bytes, the
+upper address bits are not decoded) or a device page, with callbacks for its registers.
+fetches, loads and stores to memory index the map and go straight to the buffer, without
+matching the address against the peripheral registers.
+*/
+#define PAGE_SHIFT			16
+#define PAGE_MASK			((1 << PAGE_SHIFT) - 1)
+#define PAGES				(1 << (32 - PAGE_SHIFT))
+
+struct page {
+	int32_t (*read)(state *s, int32_t size, uint32_t address);
+	void (*write)(state *s, int32_t size, uint32_t address, uint32_t value);
+	uint32_t offset;						/* of the page in memory */
+};
+
+struct page page_map[PAGES];
 
 FILE *fptr;
 int32_t log_enabled = 0;
 
-static int32_t mem_read(state *s, int32_t size, uint32_t address){
-	uint32_t value=0, ptr;
+static int32_t mem_init(uint32_t size){
+	if (size < 0x10000 || size > 0x40000000 || (size & (size - 1)))
+		return -1;
+	mem_size = size;
+	mem_mask = size - 1;
+	sram = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (sram == MAP_FAILED)
+		return -1;
 
-	switch(address){
-		case IRQ_VECTOR:	return s->vector;
-		case IRQ_CAUSE:		return s->cause | 0x0080 | 0x0040;
-		case IRQ_MASK:		return s->mask;
-		case IRQ_STATUS:	return s->status;
-		case IRQ_EPC:		return s->epc;
-		case COUNTER:		return s->counter;
-		case COMPARE:		return s->compare;
-		case COMPARE2:		return s->compare2;
-		case UART_READ:		return getchar();
-		case UART_DIVISOR:	return 0;
+	return 0;
+}
+
+/* size bytes at offset in the file, to memory at to. whole host pages are mapped */
+static int32_t load_segment(int fd, uint32_t offset, uint32_t size, uint32_t to){
+	uint32_t pg = sysconf(_SC_PAGESIZE), a, b;
+
+	if (to + size > mem_size || to + size < to)
+		return -1;
+	a = (to + pg - 1) & ~(pg - 1);
+	b = (to + size) & ~(pg - 1);
+	if ((offset - to) % pg || b <= a)
+		a = b = to + size;
+	else if (mmap(sram + a, b - a, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset + (a - to)) == MAP_FAILED)
+		return -1;
+	if (pread(fd, sram + to, a - to, offset) != a - to)
+		return -1;
+	if (pread(fd, sram + b, to + size - b, offset + (b - to)) != to + size - b)
+		return -1;
+
+	return 0;
+}
+
+/*
+loads a raw binary (at SRAM_BASE) or the PT_LOAD segments of an ELF file, and returns the
+entry point, or 0. the part of a segment beyond its size in the file (.bss) is left as is,
+zero.
+*/
+static uint32_t load_image(char *file){
+	Elf32_Ehdr eh;
+	Elf32_Phdr ph;
+	struct stat st;
+	uint32_t entry = SRAM_BASE, to, i;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) || st.st_size == 0){
+		close(fd);
+		return 0;
+	}
+	/* ELF files are big endian, as the target */
+	if (pread(fd, &eh, sizeof(eh), 0) == sizeof(eh) && !memcmp(eh.e_ident, ELFMAG, SELFMAG)){
+		if (eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_ident[EI_DATA] != ELFDATA2MSB || ntohs(eh.e_machine) != EM_MIPS){
+			printf("\nnot a MIPS (big endian) ELF file.");
+			close(fd);
+			return 0;
+		}
+		for (i = 0; i < ntohs(eh.e_phnum); i++){
+			if (pread(fd, &ph, sizeof(ph), ntohl(eh.e_phoff) + i * ntohs(eh.e_phentsize)) != sizeof(ph))
+				break;
+			if (ntohl(ph.p_type) != PT_LOAD || ph.p_memsz == 0)
+				continue;
+			to = ntohl(ph.p_vaddr) & mem_mask;
+			if (ntohl(ph.p_memsz) > mem_size - to || load_segment(fd, ntohl(ph.p_offset), ntohl(ph.p_filesz), to)){
+				printf("\nELF segment at %08x (%u bytes) does not fit in memory.", ntohl(ph.p_vaddr), ntohl(ph.p_memsz));
+				close(fd);
+				return 0;
+			}
+		}
+		entry = ntohl(eh.e_entry);
+	}else if (load_segment(fd, 0, st.st_size > mem_size ? mem_size : st.st_size, SRAM_BASE & mem_mask)){
+		entry = 0;
+	}
+	close(fd);
+
+	return entry;
+}
+
+/*
+checkpoints. a write to CHECKPOINT saves the machine state (registers, interrupt controller,
+timers, counters and memory) to the file given with -c, once the instruction is done, and
+-r starts the simulation from a saved state instead of a binary. files are meant for the
+same simulator build only.
+*/
+#define CKPT_MAGIC			"HFRSCKP2"
+
+char *ckpt_file = NULL;
+int32_t ckpt_pending = 0;
+
+static void checkpoint_save(state *s){
+	FILE *out;
+	uint32_t size = sizeof(state);
+
+	out = fopen(ckpt_file, "wb");
+	if (!out){
+		printf("\nerror writing checkpoint file.\n");
+		exit(1);
 	}
+	fwrite(CKPT_MAGIC, 1, 8, out);
+	fwrite(&size, sizeof(size), 1, out);
+	fwrite(&mem_size, sizeof(mem_size), 1, out);
+	fwrite(s, sizeof(state), 1, out);
+	fwrite(sram, 1, mem_size, out);
+	fclose(out);
+	printf("\ncheckpoint saved at %u cycles.\n", s->counter);
+}
 
-	ptr = (uint32_t)(intptr_t)s->mem + (address % MEM_SIZE);
+static int32_t checkpoint_restore(state *s, char *file){
+	FILE *in;
+	int8_t magic[8];
+	uint32_t size = 0, msize = 0;
+	int32_t ok;
+
+	in = fopen(file, "rb");
+	if (!in)
+		return -1;
+	/* the memory size is the one of the saved machine */
+	ok = fread(magic, 1, 8, in) == 8 && !memcmp(magic, CKPT_MAGIC, 8) &&
+		fread(&size, sizeof(size), 1, in) == 1 && size == sizeof(state) &&
+		fread(&msize, sizeof(msize), 1, in) == 1 && !mem_init(msize) &&
+		fread(s, sizeof(state), 1, in) == 1 && fread(sram, 1, mem_size, in) == mem_size;
+	fclose(in);
+	s->mem = &sram[0];
+
+	return ok ? 0 : -1;
+}
+
+/*
+cycles until the next timer event (a compare match, or a toggle of counter bits 16 and
+18), where the cause bits change. a write to IDLE_HINT (the program does nothing until an
+interrupt, or for at most the written number of cycles) advances the counter up to the
+cycle before it, so interrupts are raised on the same counter values.
+*/
+static uint32_t timer_distance(state *s){
+	uint32_t c, dist, t;
+
+	c = s->counter;
+	dist = ((c | 0xffff) + 1) - c;
+	t = (uint32_t)s->compare - c;
+	if (t && t < dist) dist = t;
+	t = ((uint32_t)s->compare2 - c) & 0xffffff;
+	if (t && t < dist) dist = t;
+
+	return dist;
+}
+
+static inline __attribute__((always_inline)) int32_t ram_read(state *s, int32_t size, uint32_t address, uint32_t offset){
+	int8_t *ptr = s->mem + offset;
+	uint32_t value=0;
 
 	switch(size){
 		case 4:
@@ -71,7 +256,7 @@ static int32_t mem_read(state *s, int32_t size, uint32_t address){
 				printf("\nunaligned access (load word) pc=0x%x addr=0x%x", s->pc, address);
 				exit(1);
 			}else{
-				value = *(uint32_t *)(intptr_t)ptr;
+				value = *(uint32_t *)ptr;
 				value = ntohl(value);
 			}
 			break;
@@ -80,12 +265,12 @@ static int32_t mem_read(state *s, int32_t size, uint32_t address){
 				printf("\nunaligned access (load halfword) pc=0x%x addr=0x%x", s->pc, address);
 				exit(1);
 			}else{
-				value = *(uint16_t *)(intptr_t)ptr;
+				value = *(uint16_t *)ptr;
 				value = ntohs((uint16_t)value);
 			}
 			break;
 		case 1:
-			value = *(uint8_t *)(intptr_t)ptr;
+			value = *(uint8_t *)ptr;
 			break;
 		default:
 			printf("\nerror");
@@ -94,47 +279,8 @@ static int32_t mem_read(state *s, int32_t size, uint32_t address){
 	return(value);
 }
 
-static void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
-	uint32_t ptr, i;
-
-	switch(address){
-		case IRQ_VECTOR:	s->vector = value; return;
-		case IRQ_CAUSE:		s->cause = value; return;
-		case IRQ_MASK:		s->mask = value; return;
-		case IRQ_STATUS:	if (value == 0){ s->status = 0; for (i = 0; i < 4; i++) s->status_dly[i] = 0; }else{ s->status_dly[3] = value; } return;
-		case IRQ_EPC:		s->epc = value; return;
-		case COUNTER:		s->counter = value; return;
-		case COMPARE:		s->compare = value; s->cause &= 0xffef; return;
-		case COMPARE2:		s->compare2 = value; s->cause &= 0xffdf; return;
-		case EXIT_TRAP:
-			fflush(stdout);
-			if (log_enabled)
-				fclose(fptr);
-			printf("\nend of simulation.\n");
-			printf("instructions: %d\n", s->ins);
-			printf("arith: %d (%f)\n", s->arith, (float)s->arith / (float)s->ins);
-			printf("logic: %d (%f)\n", s->logic, (float)s->logic / (float)s->ins);
-			printf("shift: %d (%f)\n", s->shift, (float)s->shift / (float)s->ins);
-			printf("compare: %d (%f)\n", s->logic, (float)s->comp/ (float)s->ins);
-			printf("memory: %d (%f)\n", s->ls, (float)s->ls / (float)s->ins);
-			printf("branch: %d (%f) (taken: %d, %f)\n", s->bra, (float)s->bra / (float)s->ins, s->taken_bra, (float)s->taken_bra/(float)s->bra);
-			printf("jump: %d (%f)\n", s->jmp, (float)s->jmp / (float)s->ins);
-			printf("mul: %d (%f)\n", s->mul, (float)s->mul / (float)s->ins);
-			printf("div: %d (%f)\n", s->div, (float)s->div / (float)s->ins);
-			printf("other: %d (%f)\n", s->other, (float)s->other / (float)s->ins);
-			exit(0);
-		case DEBUG_ADDR:
-			if (log_enabled)
-				fprintf(fptr, "%c", (int8_t)(value & 0xff));
-			return;
-		case UART_WRITE:
-			printf("%c", (int8_t)(value & 0xff));
-			return;
-		case UART_DIVISOR:
-			return;
-	}
-
-	ptr = (uint32_t)(intptr_t)s->mem + (address % MEM_SIZE);
+static inline __attribute__((always_inline)) void ram_write(state *s, int32_t size, uint32_t address, uint32_t offset, uint32_t value){
+	int8_t *ptr = s->mem + offset;
 
 	switch(size){
 		case 4:
@@ -143,7 +289,7 @@ static void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
 				exit(1);
 			}else{
 				value = htonl(value);
-				*(int32_t *)(intptr_t)ptr = value;
+				*(int32_t *)ptr = value;
 			}
 			break;
 		case 2:
@@ -152,17 +298,354 @@ static void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
 				exit(1);
 			}else{
 				value = htons((uint16_t)value);
-				*(int16_t *)(intptr_t)ptr = (uint16_t)value;
+				*(int16_t *)ptr = (uint16_t)value;
 			}
 			break;
 		case 1:
-			*(int8_t *)(intptr_t)ptr = (uint8_t)value;
+			*(int8_t *)ptr = (uint8_t)value;
 			break;
 		default:
 			printf("\nerror");
 	}
 }
 
+/*
+virtual Ethernet interface (drivers/eth_vnic.c of the hf-risc and hf-riscv ports). frames go
+between the program memory and a host TAP device (-n tap0), or are replayed from a capture
+file (-N in.pcap) as fast as the program takes them. frames sent by the program may be captured
+as well (-w out.pcap). the program gives a buffer address (and a length, to transmit) and
+a command on NIC_CTRL moves a whole frame: NIC_TX sends NIC_TXLEN bytes from NIC_TXADDR,
+and NIC_RX copies the next frame to NIC_RXADDR, with its size on NIC_RXLEN (0 if there is
+none, reception never blocks). NIC_STATUS reads NIC_PRESENT when a backend is open, and
+NIC_MAC0 / NIC_MAC1 the MAC address (bytes 0 - 3 and 4 - 5, first byte on the low bits).
+*/
+#define NIC_FRAME			1518
+#define NIC_TX				1
+#define NIC_RX				2
+#define NIC_PRESENT			1
+
+struct nic {
+	int fd;								/* TAP device, -1 if none */
+	FILE *in, *out;							/* capture files */
+	int32_t swap;							/* input capture of the other byte order */
+	uint32_t rxaddr, rxlen, txaddr, txlen;
+	uint32_t rx, tx;						/* frames moved */
+} nic = { -1, NULL, NULL, 0, 0, 0, 0, 0, 0, 0 };
+
+static uint32_t nic_word(uint8_t *p){
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+	return nic.swap ? ntohl(v) : v;
+}
+
+static int32_t nic_tap(char *name){
+#ifdef __linux__
+	struct ifreq ifr;
+
+	nic.fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+	if (nic.fd < 0)
+		return -1;
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(nic.fd, TUNSETIFF, &ifr) < 0){
+		close(nic.fd);
+		nic.fd = -1;
+		return -1;
+	}
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+static int32_t nic_pcap_in(char *file){
+	uint8_t h[24];
+	uint32_t magic;
+
+	nic.in = fopen(file, "rb");
+	if (!nic.in || fread(h, 1, 24, nic.in) != 24)
+		return -1;
+	magic = h[0] | (h[1] << 8) | (h[2] << 16) | ((uint32_t)h[3] << 24);
+	/* microsecond or nanosecond timestamps, either byte order */
+	if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+		nic.swap = 1;
+	else if (magic != 0xa1b2c3d4 && magic != 0xa1b23c4d)
+		return -1;
+	if (nic_word(h + 20) != 1)					/* link type, Ethernet */
+		return -1;
+
+	return 0;
+}
+
+static int32_t nic_pcap_out(char *file){
+	uint32_t h[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, NIC_FRAME, 1 };
+
+	nic.out = fopen(file, "wb");
+	if (!nic.out || fwrite(h, 1, sizeof(h), nic.out) != sizeof(h))
+		return -1;
+
+	return 0;
+}
+
+static void nic_close(void){
+	if (nic.rx || nic.tx)
+		printf("\nvirtual nic: %u frames received, %u sent.\n", nic.rx, nic.tx);
+	if (nic.out)
+		fclose(nic.out);
+}
+
+static int32_t nic_read(uint8_t *buf){
+	uint8_t h[16];
+	int32_t len = 0;
+	uint32_t incl;
+
+	if (nic.fd >= 0){
+		len = read(nic.fd, buf, NIC_FRAME);
+		if (len < 0)
+			len = 0;
+	}else if (nic.in && fread(h, 1, 16, nic.in) == 16){
+		incl = nic_word(h + 8);
+		if (incl > NIC_FRAME){
+			fseek(nic.in, incl, SEEK_CUR);
+			return 0;
+		}
+		len = fread(buf, 1, incl, nic.in);
+	}
+
+	return len;
+}
+
+static void nic_capture(uint8_t *buf, uint32_t len){
+	uint32_t h[4] = { 0, 0, len, len };
+
+	fwrite(h, 1, sizeof(h), nic.out);
+	fwrite(buf, 1, len, nic.out);
+}
+
+static void nic_cmd(state *s, uint32_t cmd){
+	uint8_t buf[NIC_FRAME];
+	uint32_t len, offset;
+
+	if (cmd == NIC_TX){
+		offset = nic.txaddr & mem_mask;
+		len = nic.txlen;
+		if (len > NIC_FRAME || offset + len > mem_size)
+			return;
+		if (nic.fd >= 0 && write(nic.fd, s->mem + offset, len) < 0)
+			return;
+		if (nic.out)
+			nic_capture((uint8_t *)s->mem + offset, len);
+		nic.tx++;
+	}else if (cmd == NIC_RX){
+		offset = nic.rxaddr & mem_mask;
+		len = nic_read(buf);
+		if (offset + len > mem_size)
+			len = 0;
+		memcpy(s->mem + offset, buf, len);
+		nic.rxlen = len;
+		if (len)
+			nic.rx++;
+	}
+}
+
+/*
+virtual block device (drivers/block/simdisk.c), backed by a host image file (-d disk.img)
+mapped in shared mode, so the program writes go to the file and the volume is kept across
+runs (the size of the file, in BLK_SECTOR_SIZE sectors, is the size of the device). the
+program sets a sector, a sector count and a buffer address, and a command on BLK_CTRL moves
+the sectors between the image and memory at once. BLK_STATUS holds 0 after a successful
+command (and while a backend is open), and BLK_SECTORS the size of the device.
+*/
+#define BLK_SECTOR_SIZE			512
+#define BLK_READ			1
+#define BLK_WRITE			2
+#define BLK_SYNC			3
+#define BLK_ERROR			1
+#define BLK_ABSENT			2
+
+struct blk {
+	int8_t *image;							/* file mapping, NULL if none */
+	uint32_t sectors, sector, count, addr, status;
+} blk = { NULL, 0, 0, 0, 0, BLK_ABSENT };
+
+static int32_t blk_open(char *file){
+	struct stat st;
+	int fd;
+
+	fd = open(file, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < BLK_SECTOR_SIZE)
+		return -1;
+	blk.image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (blk.image == MAP_FAILED){
+		blk.image = NULL;
+		return -1;
+	}
+	blk.sectors = st.st_size / BLK_SECTOR_SIZE;
+	blk.status = 0;
+
+	return 0;
+}
+
+static void blk_close(void){
+	if (blk.image)
+		msync(blk.image, (size_t)blk.sectors * BLK_SECTOR_SIZE, MS_SYNC);
+}
+
+static void blk_cmd(state *s, uint32_t cmd){
+	uint32_t offset, len;
+	int8_t *sector;
+
+	if (!blk.image)
+		return;
+	blk.status = BLK_ERROR;
+	if (cmd == BLK_SYNC){
+		if (msync(blk.image, (size_t)blk.sectors * BLK_SECTOR_SIZE, MS_SYNC) == 0)
+			blk.status = 0;
+		return;
+	}
+	offset = blk.addr & mem_mask;
+	len = blk.count * BLK_SECTOR_SIZE;
+	if (blk.count == 0 || blk.count > blk.sectors || blk.sector > blk.sectors - blk.count || offset + len > mem_size)
+		return;
+	sector = blk.image + (size_t)blk.sector * BLK_SECTOR_SIZE;
+	if (cmd == BLK_READ){
+		memcpy(s->mem + offset, sector, len);
+	}else if (cmd == BLK_WRITE){
+		memcpy(sector, s->mem + offset, len);
+	}else{
+		return;
+	}
+	blk.status = 0;
+}
+
+/* peripheral registers, other addresses of the page are memory */
+static int32_t io_read(state *s, int32_t size, uint32_t address){
+	switch(address){
+		case IRQ_VECTOR:	return s->vector;
+		case IRQ_CAUSE:		return s->cause | 0x0080 | 0x0040;
+		case IRQ_MASK:		return s->mask;
+		case IRQ_STATUS:	return s->status;
+		case IRQ_EPC:		return s->epc;
+		case COUNTER:		return s->counter;
+		case COMPARE:		return s->compare;
+		case COMPARE2:		return s->compare2;
+		case UART_READ:		return getchar();
+		case UART_DIVISOR:	return 0;
+		case NIC_STATUS:	return (nic.fd >= 0 || nic.in) ? NIC_PRESENT : 0;
+		case NIC_RXLEN:		return nic.rxlen;
+		case NIC_MAC0:		return 0x00464802;			/* 02:48:46:00:00:01, locally administered */
+		case NIC_MAC1:		return 0x0100;
+		case BLK_STATUS:	return blk.status;
+		case BLK_SECTORS:	return blk.sectors;
+	}
+
+	return ram_read(s, size, address, address & mem_mask);
+}
+
+static void io_write(state *s, int32_t size, uint32_t address, uint32_t value){
+	uint32_t i;
+
+	switch(address){
+		case IRQ_VECTOR:	s->vector = value; return;
+		case IRQ_CAUSE:		s->cause = value; return;
+		case IRQ_MASK:		s->mask = value; return;
+		case IRQ_STATUS:	if (value == 0){ s->status = 0; for (i = 0; i < 4; i++) s->status_dly[i] = 0; }else{ s->status_dly[3] = value; } return;
+		case IRQ_EPC:		s->epc = value; return;
+		case COUNTER:		s->counter = value; return;
+		case COMPARE:		s->compare = value; s->cause &= 0xffef; return;
+		case COMPARE2:		s->compare2 = value; s->cause &= 0xffdf; return;
+		case CHECKPOINT:
+			if (ckpt_file)
+				ckpt_pending = 1;
+			return;
+		case IDLE_HINT:
+			/* not while an interrupt enable is still in the status pipeline */
+			for (i = 0; i < 4; i++)
+				if (s->status_dly[i] != s->status) return;
+			i = timer_distance(s) - 1;
+			if (value < i) i = value;
+			s->counter += i;
+			s->idle += i;
+			return;
+		case DEBUG_ADDR:
+			if (log_enabled)
+				fprintf(fptr, "%c", (int8_t)(value & 0xff));
+			return;
+		case UART_WRITE:
+			printf("%c", (int8_t)(value & 0xff));
+			return;
+		case UART_DIVISOR:
+			return;
+		case NIC_CTRL:		nic_cmd(s, value); return;
+		case NIC_RXADDR:	nic.rxaddr = value; return;
+		case NIC_TXADDR:	nic.txaddr = value; return;
+		case NIC_TXLEN:		nic.txlen = value; return;
+		case BLK_CTRL:		blk_cmd(s, value); return;
+		case BLK_SECTOR:	blk.sector = value; return;
+		case BLK_COUNT:		blk.count = value; return;
+		case BLK_ADDR:		blk.addr = value; return;
+	}
+
+	ram_write(s, size, address, address & mem_mask, value);
+}
+
+static void trap_write(state *s, int32_t size, uint32_t address, uint32_t value){
+	if (address == EXIT_TRAP){
+		fflush(stdout);
+		if (log_enabled)
+			fclose(fptr);
+		printf("\nend of simulation.\n");
+		printf("cycles: %d (idle, fast forwarded: %d)\n", s->counter, s->idle);
+		printf("instructions: %d\n", s->ins);
+		printf("arith: %d (%f)\n", s->arith, (float)s->arith / (float)s->ins);
+		printf("logic: %d (%f)\n", s->logic, (float)s->logic / (float)s->ins);
+		printf("shift: %d (%f)\n", s->shift, (float)s->shift / (float)s->ins);
+		printf("compare: %d (%f)\n", s->logic, (float)s->comp/ (float)s->ins);
+		printf("memory: %d (%f)\n", s->ls, (float)s->ls / (float)s->ins);
+		printf("branch: %d (%f) (taken: %d, %f)\n", s->bra, (float)s->bra / (float)s->ins, s->taken_bra, (float)s->taken_bra/(float)s->bra);
+		printf("jump: %d (%f)\n", s->jmp, (float)s->jmp / (float)s->ins);
+		printf("mul: %d (%f)\n", s->mul, (float)s->mul / (float)s->ins);
+		printf("div: %d (%f)\n", s->div, (float)s->div / (float)s->ins);
+		printf("other: %d (%f)\n", s->other, (float)s->other / (float)s->ins);
+		exit(0);
+	}
+	ram_write(s, size, address, address & mem_mask, value);
+}
+
+static void map_init(void){
+	uint32_t i;
+
+	for (i = 0; i < PAGES; i++){
+		page_map[i].read = NULL;
+		page_map[i].write = NULL;
+		page_map[i].offset = (i << PAGE_SHIFT) & mem_mask;
+	}
+	page_map[IRQ_VECTOR >> PAGE_SHIFT].read = io_read;
+	page_map[IRQ_VECTOR >> PAGE_SHIFT].write = io_write;
+	page_map[EXIT_TRAP >> PAGE_SHIFT].write = trap_write;
+}
+
+static inline __attribute__((always_inline)) int32_t mem_read(state *s, int32_t size, uint32_t address){
+	struct page *p = &page_map[address >> PAGE_SHIFT];
+
+	if (p->read)
+		return p->read(s, size, address);
+
+	return ram_read(s, size, address, p->offset + (address & PAGE_MASK));
+}
+
+static inline __attribute__((always_inline)) void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
+	struct page *p = &page_map[address >> PAGE_SHIFT];
+
+	if (p->write)
+		p->write(s, size, address, value);
+	else
+		ram_write(s, size, address, p->offset + (address & PAGE_MASK), value);
+}
+
 void mult_unsigned(uint32_t a, uint32_t b, uint32_t *hi, uint32_t *lo){
 	uint32_t ahi, alo, bhi, blo;
 	uint32_t c0, c1, c2;
@@ -337,39 +820,94 @@ void cycle(state *s){
 int main(int argc, char *argv[]){
 	state context;
 	state *s;
-	FILE *in;
-	int bytes, i;
+	char *restore = NULL, *end;
+	char *nic_name = NULL, *nic_in = NULL, *nic_out = NULL, *disk = NULL;
+	uint32_t entry = SRAM_BASE;
+	int i, n;
 
 	s = &context;
 	memset(s, 0, sizeof(state));
-	memset(sram, 0xff, sizeof(MEM_SIZE));
 
-	if (argc >= 2){
-		in = fopen(argv[1], "rb");
-		if (in == 0){
-			printf("\nerror opening binary file.\n");
+	for (i = 1, n = 1; i < argc; i++){
+		if (!strcmp(argv[i], "-c") && i + 1 < argc)
+			ckpt_file = argv[++i];
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			restore = argv[++i];
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			nic_name = argv[++i];
+		else if (!strcmp(argv[i], "-N") && i + 1 < argc)
+			nic_in = argv[++i];
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+			nic_out = argv[++i];
+		else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+			disk = argv[++i];
+		else if (!strcmp(argv[i], "-M") && i + 1 < argc){
+			mem_size = strtoul(argv[++i], &end, 0);
+			if (*end == 'k' || *end == 'K') mem_size <<= 10;
+			if (*end == 'm' || *end == 'M') mem_size <<= 20;
+		}
+		else
+			argv[n++] = argv[i];
+	}
+	argc = n;
+
+	if (restore){
+		if (checkpoint_restore(s, restore)){
+			printf("\nerror reading checkpoint file.\n");
 			return 1;
 		}
-		bytes = fread(&sram, 1, MEM_SIZE, in);
-		fclose(in);
-		if (bytes == 0){
-			printf("\nerror reading binary file.\n");
+		/* the checkpoint takes the place of the binary file */
+		n = 1;
+	}else if (argc >= 2){
+		if (mem_init(mem_size)){
+			printf("\nthe memory size must be a power of two, from 64KB to 1GB.\n");
 			return 1;
 		}
-		if (argc == 3){
-			fptr = fopen(argv[2], "wb");
-			if (!fptr){
-				printf("\nerror reading binary file.\n");
-				return 1;
-			}
-			log_enabled = 1;
+		entry = load_image(argv[1]);
+		if (!entry){
+			printf("\nerror reading binary file.\n");
+			return 1;
 		}
+		n = 2;
 	}else{
-		printf("\nsyntax: hf_risc_sim [file.bin] [log_file.txt]\n");
+		printf("\nsyntax: hf_risc_sim [file.bin | file.elf | -r checkpoint] [log_file.txt] [-M memory_size]\n");
+		printf("                   [-c checkpoint]\n");
+		printf("                   [-n tap_device | -N in.pcap] [-w out.pcap] [-d disk.img]\n");
 		return 1;
 	}
+	if (argc == n + 1){
+		fptr = fopen(argv[n], "wb");
+		if (!fptr){
+			printf("\nerror reading binary file.\n");
+			return 1;
+		}
+		log_enabled = 1;
+	}
 
-	s->pc = SRAM_BASE;
+	if (nic_name && nic_tap(nic_name)){
+		printf("\nerror opening TAP device %s.\n", nic_name);
+		return 1;
+	}
+	if (!nic_name && nic_in && nic_pcap_in(nic_in)){
+		printf("\nerror reading capture file.\n");
+		return 1;
+	}
+	if (nic_out && nic_pcap_out(nic_out)){
+		printf("\nerror opening capture file.\n");
+		return 1;
+	}
+	atexit(nic_close);
+	if (disk && blk_open(disk)){
+		printf("\nerror opening disk image (the file must exist, with one sector at least).\n");
+		return 1;
+	}
+	atexit(blk_close);
+
+	map_init();
+	if (restore)
+		goto run;
+
+	s->pc = entry;
 	s->pc_next = s->pc + 4;
 	s->mem = &sram[0];
 	s->j = 0;
@@ -387,9 +925,15 @@ int main(int argc, char *argv[]){
 	s->ins = 0;
 	s->arith = 0; s->logic = 0; s->shift = 0; s->comp = 0; s->ls = 0;
 	s->bra = 0; s->taken_bra = 0; s->jmp = 0; s->mul= 0; s->div = 0; s->other = 0;
+	s->idle = 0;
 
+run:
 	for(;;){
 		cycle(s);
+		if (ckpt_pending){
+			ckpt_pending = 0;
+			checkpoint_save(s);
+		}
 	}
 
 	return(0);
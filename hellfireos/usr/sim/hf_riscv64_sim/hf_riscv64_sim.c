@@ -33,7 +33,7 @@
 #define htonl(A) ntohl(A)
 
 typedef struct {
-	int64_t r[32];
+	int64_t r[33];							/* r[32] takes writes to r0 */
 	int64_t pc, pc_next;
 	int8_t *mem;
 	int64_t vector, cause, mask, status, status_dly[4], epc, counter, compare, compare2;
@@ -60,12 +60,13 @@ void bp(state *s, uint64_t ir){
 	getchar();
 }
 
+/* an instruction, a halfword at a time (the upper half is not read for a compressed one) */
 static int32_t mem_fetch(state *s, uint32_t address){
-	uint32_t value=0, ptr;
+	uint32_t value=0;
 
-	ptr = (uint32_t)(intptr_t)s->mem + (address % MEM_SIZE);
-
-	value = *(int32_t *)(intptr_t)ptr;
+	value = *(uint16_t *)(s->mem + (address % MEM_SIZE));
+	if ((value & 3) == 3)
+		value |= *(uint16_t *)(s->mem + ((address + 2) % MEM_SIZE)) << 16;
 //	value = ntohl(value);
 
 	return(value);
@@ -205,207 +206,570 @@ static void mem_write(state *s, int32_t size, uint64_t address, uint64_t value){
 	}
 }
 
-void cycle(state *s){
-	uint32_t inst, i;
-	uint32_t opcode, rd, rs1, rs2, funct3, funct7, imm_i, imm_s, imm_sb, imm_u, imm_uj;
-	int64_t *r = s->r;
-	uint64_t *u = (uint64_t *)s->r;
-	uint32_t ptr_l, ptr_s;
-	
-	if (s->status && (s->cause & s->mask)){
-		s->epc = s->pc_next;
-		s->pc = s->vector;
-		s->pc_next = s->vector + 4;
-		s->status = 0;
-		for (i = 0; i < 4; i++)
-			s->status_dly[i] = 0;
+/*
+RVC (RV64C), expanded to the 32 bit instruction doing the same. compressed floating point
+loads and stores, and reserved encodings, give an invalid instruction.
+*/
+#define C_INVALID			0xffffffff
+#define C_BITS(c, hi, lo)		(((c) >> (lo)) & ((1 << ((hi) - (lo) + 1)) - 1))
+#define C_REG(c, lo)			(8 + C_BITS(c, (lo) + 2, lo))
+#define RV_I(imm, rs1, f3, rd, op)	((((imm) & 0xfff) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define RV_S(imm, rs2, rs1, f3, op)	(((((imm) >> 5) & 0x7f) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | (((imm) & 0x1f) << 7) | (op))
+#define RV_R(f7, rs2, rs1, f3, rd, op)	(((f7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define RV_B(imm, rs2, rs1, f3)		(((((imm) >> 12) & 1) << 31) | ((((imm) >> 5) & 0x3f) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((((imm) >> 1) & 0xf) << 8) | ((((imm) >> 11) & 1) << 7) | 0x63)
+#define RV_J(imm, rd)			(((((imm) >> 20) & 1) << 31) | ((((imm) >> 1) & 0x3ff) << 21) | ((((imm) >> 11) & 1) << 20) | ((((imm) >> 12) & 0xff) << 12) | ((rd) << 7) | 0x6f)
+
+static uint32_t rvc_expand(uint32_t c){
+	int32_t imm, rd = C_BITS(c, 11, 7), rs2 = C_BITS(c, 6, 2), shamt = C_BITS(c, 12, 12) << 5 | C_BITS(c, 6, 2);
+
+	/* 6 bit signed immediate of C.ADDI, C.LI, C.ANDI and C.LUI */
+	imm = C_BITS(c, 6, 2) | (c & 0x1000 ? -32 : 0);
+
+	switch ((c & 3) << 3 | C_BITS(c, 15, 13)){
+		case 0x00:										/* C.ADDI4SPN */
+			imm = C_BITS(c, 12, 11) << 4 | C_BITS(c, 10, 7) << 6 | C_BITS(c, 6, 6) << 2 | C_BITS(c, 5, 5) << 3;
+			if (!imm) return C_INVALID;
+			return RV_I(imm, 2, 0, C_REG(c, 2), 0x13);
+		case 0x02:										/* C.LW */
+			imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 6, 6) << 2 | C_BITS(c, 5, 5) << 6;
+			return RV_I(imm, C_REG(c, 7), 2, C_REG(c, 2), 0x03);
+		case 0x03:										/* C.LD */
+			imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 6, 5) << 6;
+			return RV_I(imm, C_REG(c, 7), 3, C_REG(c, 2), 0x03);
+		case 0x06:										/* C.SW */
+			imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 6, 6) << 2 | C_BITS(c, 5, 5) << 6;
+			return RV_S(imm, C_REG(c, 2), C_REG(c, 7), 2, 0x23);
+		case 0x07:										/* C.SD */
+			imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 6, 5) << 6;
+			return RV_S(imm, C_REG(c, 2), C_REG(c, 7), 3, 0x23);
+		case 0x08:										/* C.ADDI, C.NOP */
+			return RV_I(imm, rd, 0, rd, 0x13);
+		case 0x09:										/* C.ADDIW */
+			if (!rd) return C_INVALID;
+			return RV_I(imm, rd, 0, rd, 0x1b);
+		case 0x0d:										/* C.J */
+			imm = C_BITS(c, 5, 3) << 1 | C_BITS(c, 11, 11) << 4 | C_BITS(c, 2, 2) << 5 | C_BITS(c, 7, 7) << 6 |
+				C_BITS(c, 6, 6) << 7 | C_BITS(c, 10, 9) << 8 | C_BITS(c, 8, 8) << 10 | (c & 0x1000 ? -2048 : 0);
+			return RV_J(imm, 0);
+		case 0x0a:										/* C.LI */
+			return RV_I(imm, 0, 0, rd, 0x13);
+		case 0x0b:
+			if (rd == 2){									/* C.ADDI16SP */
+				imm = C_BITS(c, 6, 6) << 4 | C_BITS(c, 2, 2) << 5 | C_BITS(c, 5, 5) << 6 |
+					C_BITS(c, 4, 3) << 7 | (c & 0x1000 ? -512 : 0);
+				if (!imm) return C_INVALID;
+				return RV_I(imm, 2, 0, 2, 0x13);
+			}
+			if (!imm) return C_INVALID;							/* C.LUI */
+			return (imm << 12) | (rd << 7) | 0x37;
+		case 0x0c:
+			rd = C_REG(c, 7);
+			rs2 = C_REG(c, 2);
+			switch (C_BITS(c, 11, 10)){
+				case 0:									/* C.SRLI */
+					return RV_I(shamt, rd, 5, rd, 0x13);
+				case 1:									/* C.SRAI */
+					return RV_I(0x400 | shamt, rd, 5, rd, 0x13);
+				case 2:									/* C.ANDI */
+					return RV_I(imm, rd, 7, rd, 0x13);
+				default:
+					if (c & 0x1000){
+						switch (C_BITS(c, 6, 5)){
+							case 0: return RV_R(0x20, rs2, rd, 0, rd, 0x3b);	/* C.SUBW */
+							case 1: return RV_R(0, rs2, rd, 0, rd, 0x3b);		/* C.ADDW */
+							default: return C_INVALID;
+						}
+					}
+					switch (C_BITS(c, 6, 5)){
+						case 0: return RV_R(0x20, rs2, rd, 0, rd, 0x33);		/* C.SUB */
+						case 1: return RV_R(0, rs2, rd, 4, rd, 0x33);			/* C.XOR */
+						case 2: return RV_R(0, rs2, rd, 6, rd, 0x33);			/* C.OR */
+						default: return RV_R(0, rs2, rd, 7, rd, 0x33);			/* C.AND */
+					}
+			}
+		case 0x0e:										/* C.BEQZ */
+		case 0x0f:										/* C.BNEZ */
+			imm = C_BITS(c, 4, 3) << 1 | C_BITS(c, 11, 10) << 3 | C_BITS(c, 2, 2) << 5 |
+				C_BITS(c, 6, 5) << 6 | (c & 0x1000 ? -256 : 0);
+			return RV_B(imm, 0, C_REG(c, 7), C_BITS(c, 13, 13));
+		case 0x10:										/* C.SLLI */
+			return RV_I(shamt, rd, 1, rd, 0x13);
+		case 0x12:										/* C.LWSP */
+			if (!rd) return C_INVALID;
+			imm = C_BITS(c, 12, 12) << 5 | C_BITS(c, 6, 4) << 2 | C_BITS(c, 3, 2) << 6;
+			return RV_I(imm, 2, 2, rd, 0x03);
+		case 0x13:										/* C.LDSP */
+			if (!rd) return C_INVALID;
+			imm = C_BITS(c, 12, 12) << 5 | C_BITS(c, 6, 5) << 3 | C_BITS(c, 4, 2) << 6;
+			return RV_I(imm, 2, 3, rd, 0x03);
+		case 0x14:
+			if (!(c & 0x1000)){
+				if (rs2) return RV_R(0, rs2, 0, 0, rd, 0x33);				/* C.MV */
+				if (!rd) return C_INVALID;
+				return RV_I(0, rd, 0, 0, 0x67);						/* C.JR */
+			}
+			if (rs2) return RV_R(0, rs2, rd, 0, rd, 0x33);					/* C.ADD */
+			if (!rd) return 0x00100073;							/* C.EBREAK */
+			return RV_I(0, rd, 0, 1, 0x67);							/* C.JALR */
+		case 0x16:										/* C.SWSP */
+			imm = C_BITS(c, 12, 9) << 2 | C_BITS(c, 8, 7) << 6;
+			return RV_S(imm, rs2, 2, 2, 0x23);
+		case 0x17:										/* C.SDSP */
+			imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 9, 7) << 6;
+			return RV_S(imm, rs2, 2, 3, 0x23);
+		default:
+			return C_INVALID;
 	}
+}
+
+/*
+M extension. division by zero gives all ones (quotient) or the dividend (remainder), and
+the overflowing signed division (most negative / -1) gives the dividend and 0, as the
+spec says, without trapping.
+*/
+static void muldiv(state *s, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t rs2){
+	int64_t a = s->r[rs1], b = s->r[rs2];
+	uint64_t ua = a, ub = b;
+
+	switch(funct3){
+		case 0x0: s->r[rd] = ua * ub; break;								/* MUL */
+		case 0x1: s->r[rd] = ((__int128)a * b) >> 64; break;						/* MULH */
+		case 0x2: s->r[rd] = ((__int128)a * (unsigned __int128)ub) >> 64; break;			/* MULHSU */
+		case 0x3: s->r[rd] = ((unsigned __int128)ua * ub) >> 64; break;				/* MULHU */
+		case 0x4: s->r[rd] = b == 0 ? -1 : (b == -1 && ua == 0x8000000000000000ull) ? a : a / b; break;	/* DIV */
+		case 0x5: s->r[rd] = ub == 0 ? -1 : (int64_t)(ua / ub); break;				/* DIVU */
+		case 0x6: s->r[rd] = b == 0 ? a : b == -1 ? 0 : a % b; break;				/* REM */
+		case 0x7: s->r[rd] = ub == 0 ? a : (int64_t)(ua % ub); break;				/* REMU */
+	}
+}
+
+static void muldivw(state *s, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t rs2){
+	int32_t a = s->r[rs1], b = s->r[rs2];
+	uint32_t ua = a, ub = b;
+
+	switch(funct3){
+		case 0x0: s->r[rd] = (int32_t)(ua * ub); break;						/* MULW */
+		case 0x4: s->r[rd] = b == 0 ? -1 : (b == -1 && ua == 0x80000000) ? a : a / b; break;		/* DIVW */
+		case 0x5: s->r[rd] = ub == 0 ? -1 : (int32_t)(ua / ub); break;				/* DIVUW */
+		case 0x6: s->r[rd] = b == 0 ? a : b == -1 ? 0 : a % b; break;				/* REMW */
+		case 0x7: s->r[rd] = ub == 0 ? a : (int32_t)(ua % ub); break;				/* REMUW */
+	}
+}
 
-	inst = mem_fetch(s, s->pc);
+/*
+decoded instructions, shared by the interpreter (cycle()) and the block translator, so both
+run the same code for an instruction. writes to r0 go to r[32] (rd 0 is decoded as 32).
+jumps, branches and AUIPC hold their absolute target (or value) in imm.
+*/
+enum {
+	OP_LUI, OP_AUIPC, OP_JAL, OP_JALR, OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+	OP_LB, OP_LH, OP_LW, OP_LD, OP_LBU, OP_LHU, OP_LWU, OP_SB, OP_SH, OP_SW, OP_SD,
+	OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_SRAI, OP_ORI, OP_ANDI,
+	OP_ADDIW, OP_SLLIW, OP_SRLIW, OP_SRAIW, OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR,
+	OP_SRL, OP_SRA, OP_OR, OP_AND, OP_ADDW, OP_SUBW, OP_SLLW, OP_SRLW, OP_SRAW,
+	OP_MULDIV, OP_MULDIVW, OP_SYSTEM, OP_FAIL
+};
+
+struct binst {
+	uint8_t op, rd, rs1, rs2;
+	uint32_t inst;							/* as fetched (16 bits if compressed) */
+	int64_t imm;
+	int64_t pc, next;						/* of the instruction and of the next one */
+};
+
+static void decode(struct binst *d, uint32_t fetched, int64_t pc){
+	uint32_t inst = fetched, opcode, rd, rs1, rs2, funct3, funct7, shamt;
+	int32_t imm_i, imm_s, imm_sb, imm_u, imm_uj;
+	uint8_t op = OP_FAIL;
+	int64_t imm = 0;
+
+	d->pc = pc;
+	d->next = pc + 4;
+	if ((inst & 3) != 3){
+		inst = rvc_expand(inst & 0xffff);
+		fetched &= 0xffff;
+		d->next = pc + 2;
+	}
 
 	opcode = inst & 0x7f;
 	rd = (inst >> 7) & 0x1f;
 	rs1 = (inst >> 15) & 0x1f;
 	rs2 = (inst >> 20) & 0x1f;
+	shamt = (inst >> 20) & 0x3f;
 	funct3 = (inst >> 12) & 0x7;
 	funct7 = (inst >> 25) & 0x7f;
 	imm_i = (inst & 0xfff00000) >> 20;
 	imm_s = ((inst & 0xf80) >> 7) | ((inst & 0xfe000000) >> 20);
 	imm_sb = ((inst & 0xf00) >> 7) | ((inst & 0x7e000000) >> 20) | ((inst & 0x80) << 4) | ((inst & 0x80000000) >> 19);
 	imm_u = inst & 0xfffff000;
-	imm_uj = ((inst & 0x7fe00000) >> 20) | ((inst & 0x100000) >> 9) | (inst & 0xff000) | ((inst & 0x80000000) >> 11); 
+	imm_uj = ((inst & 0x7fe00000) >> 20) | ((inst & 0x100000) >> 9) | (inst & 0xff000) | ((inst & 0x80000000) >> 11);
 	if (inst & 0x80000000){
 		imm_i |= 0xfffff000;
 		imm_s |= 0xfffff000;
 		imm_sb |= 0xffffe000;
 		imm_uj |= 0xffe00000;
 	}
-	ptr_l = r[rs1] + (int32_t)imm_i;
-	ptr_s = r[rs1] + (int32_t)imm_s;
-	r[0] = 0;
-	
-//	bp(s, inst);
-	
+
 	switch(opcode){
-		case 0x37: r[rd] = imm_u; break;										/* LUI */
-		case 0x17: r[rd] = s->pc + imm_u; break;									/* AUIPC */
-		case 0x6f: r[rd] = s->pc_next; s->pc_next = s->pc + imm_uj; break;						/* JAL */
-		case 0x67: r[rd] = s->pc_next; s->pc_next = (r[rs1] + imm_i) & 0xfffffffe; break;				/* JALR */
+		case 0x37: op = OP_LUI; imm = imm_u; break;							/* LUI */
+		case 0x17: op = OP_AUIPC; imm = pc + imm_u; break;						/* AUIPC */
+		case 0x6f: op = OP_JAL; imm = pc + imm_uj; break;						/* JAL */
+		case 0x67: op = OP_JALR; imm = imm_i; break;							/* JALR */
 		case 0x63:
+			imm = pc + imm_sb;
 			switch(funct3){
-				case 0x0: if (r[rs1] == r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BEQ */
-				case 0x1: if (r[rs1] != r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BNE */
-				case 0x4: if (r[rs1] < r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BLT */
-				case 0x5: if (r[rs1] >= r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BGE */
-				case 0x6: if (u[rs1] < u[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BLTU */
-				case 0x7: if (u[rs1] >= u[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BGEU */
-				default: goto fail;
+				case 0x0: op = OP_BEQ; break;							/* BEQ */
+				case 0x1: op = OP_BNE; break;							/* BNE */
+				case 0x4: op = OP_BLT; break;							/* BLT */
+				case 0x5: op = OP_BGE; break;							/* BGE */
+				case 0x6: op = OP_BLTU; break;							/* BLTU */
+				case 0x7: op = OP_BGEU; break;							/* BGEU */
 			}
 			break;
 		case 0x3:
-			switch(funct3){
-				case 0x0: r[rd] = (int8_t)mem_read(s,1,ptr_l); break;						/* LB */
-				case 0x1: r[rd] = (int16_t)mem_read(s,2,ptr_l); break;						/* LH */
-				case 0x2: r[rd] = mem_read(s,4,ptr_l); break;							/* LW */
-				case 0x3: r[rd] = mem_read(s,8,ptr_l); break;							/* LD */
-				case 0x4: r[rd] = (uint8_t)mem_read(s,1,ptr_l); break;						/* LBU */
-				case 0x5: r[rd] = (uint16_t)mem_read(s,2,ptr_l); break;						/* LHU */
-				case 0x6: r[rd] = (uint32_t)mem_read(s, 4, ptr_l); break;					/* LWU */
-				default: goto fail;
-			}
+			imm = imm_i;
+			if (funct3 < 7) op = OP_LB + funct3;							/* LB, LH, LW, LD, LBU, LHU, LWU */
 			break;
 		case 0x23:
-			switch(funct3){
-				case 0x0: mem_write(s,1,ptr_s,r[rs2]); break;							/* SB */
-				case 0x1: mem_write(s,2,ptr_s,r[rs2]); break;							/* SH */
-				case 0x2: mem_write(s,4,ptr_s,r[rs2]); break;							/* SW */
-				case 0x3: mem_write(s,8,ptr_s,r[rs2]); break;							/* SD */
-				default: goto fail;
-			}
+			imm = imm_s;
+			if (funct3 < 4) op = OP_SB + funct3;							/* SB, SH, SW, SD */
 			break;
 		case 0x13:
+			imm = imm_i;
 			switch(funct3){
-				case 0x0: r[rd] = r[rs1] + (int64_t)imm_i; break;						/* ADDI */
-				case 0x1: r[rd] = u[rs1] << (rs2 & 0x3f); break;						/* SLLI */
-				case 0x2: r[rd] = r[rs1] < (int64_t)imm_i; break;		 				/* SLTI */
-				case 0x3: r[rd] = u[rs1] < (uint64_t)imm_i; break;						/* SLTIU */
-				case 0x4: r[rd] = r[rs1] ^ (int64_t)imm_i; break;						/* XORI */
-				case 0x6: r[rd] = r[rs1] | (int64_t)imm_i; break;						/* ORI */
-				case 0x7: r[rd] = r[rs1] & (int64_t)imm_i; break;						/* ANDI */
+				case 0x0: op = OP_ADDI; break;							/* ADDI */
+				case 0x1: op = OP_SLLI; imm = shamt; break;					/* SLLI */
+				case 0x2: op = OP_SLTI; break;							/* SLTI */
+				case 0x3: op = OP_SLTIU; break;							/* SLTIU */
+				case 0x4: op = OP_XORI; break;							/* XORI */
 				case 0x5:
-//					switch((funct7 & 0xfe) << 1){				// ?????
-					switch(funct7){
-						case 0x0: r[rd] = u[rs1] >> (rs2 & 0x3f); break;				/* SRLI */
-						case 0x20: r[rd] = r[rs1] >> (rs2 & 0x3f); break;				/* SRAI */
-						default: goto fail;
+					imm = shamt;
+					switch(funct7 & 0x7e){							/* bit 25 is shamt[5] */
+						case 0x0: op = OP_SRLI; break;					/* SRLI */
+						case 0x20: op = OP_SRAI; break;					/* SRAI */
 					}
 					break;
-				default: goto fail;
+				case 0x6: op = OP_ORI; break;							/* ORI */
+				case 0x7: op = OP_ANDI; break;							/* ANDI */
 			}
 			break;
 		case 0x1b:
+			imm = imm_i;
 			switch(funct3){
-				case 0x0: r[rd] = r[rs1] + (int32_t)imm_i; break;						/* ADDIW */
-				case 0x1: r[rd] = (int32_t)u[rs1] << (rs2 & 0x3f); break;					/* SLLIW */
+				case 0x0: op = OP_ADDIW; break;							/* ADDIW */
+				case 0x1: op = OP_SLLIW; imm = rs2; break;					/* SLLIW */
 				case 0x5:
+					imm = rs2;
 					switch(funct7){
-						case 0x0: r[rd] = (int32_t)u[rs1] >> (rs2 & 0x3f); break;			/* SRLIW */
-						case 0x20: r[rd] = (int32_t)r[rs1] >> (rs2 & 0x3f); break;			/* SRAIW */
-						default: goto fail;
+						case 0x0: op = OP_SRLIW; break;					/* SRLIW */
+						case 0x20: op = OP_SRAIW; break;				/* SRAIW */
 					}
-					break;					
-				default: goto fail;
+					break;
 			}
 			break;
 		case 0x33:
+			if (funct7 == 0x1){								/* RV64M */
+				op = OP_MULDIV; imm = funct3;
+				break;
+			}
 			switch(funct3){
 				case 0x0:
 					switch(funct7){
-						case 0x0: r[rd] = r[rs1] + r[rs2]; break;					/* ADD */
-						case 0x20: r[rd] = r[rs1] - r[rs2]; break;					/* SUB */
-						default: goto fail;
+						case 0x0: op = OP_ADD; break;					/* ADD */
+						case 0x20: op = OP_SUB; break;					/* SUB */
 					}
 					break;
-				case 0x1: r[rd] = r[rs1] << r[rs2]; break;							/* SLL */
-				case 0x2: r[rd] = r[rs1] < r[rs2]; break;		 					/* SLT */
-				case 0x3: r[rd] = u[rs1] < u[rs2]; break;		 					/* SLTU */
-				case 0x4: r[rd] = r[rs1] ^ r[rs2]; break;							/* XOR */
+				case 0x1: op = OP_SLL; break;							/* SLL */
+				case 0x2: op = OP_SLT; break;							/* SLT */
+				case 0x3: op = OP_SLTU; break;							/* SLTU */
+				case 0x4: op = OP_XOR; break;							/* XOR */
 				case 0x5:
 					switch(funct7){
-						case 0x0: r[rd] = u[rs1] >> u[rs2]; break;					/* SRL */
-						case 0x20: r[rd] = r[rs1] >> r[rs2]; break;					/* SRA */
-						default: goto fail;
+						case 0x0: op = OP_SRL; break;					/* SRL */
+						case 0x20: op = OP_SRA; break;					/* SRA */
 					}
 					break;
-				case 0x6: r[rd] = r[rs1] | r[rs2]; break;							/* OR */
-				case 0x7: r[rd] = r[rs1] & r[rs2]; break;							/* AND */
-				default: goto fail;
+				case 0x6: op = OP_OR; break;							/* OR */
+				case 0x7: op = OP_AND; break;							/* AND */
 			}
 			break;
 		case 0x3b:
+			if (funct7 == 0x1){								/* RV64M, 32 bit */
+				if (funct3 == 0 || funct3 >= 4){
+					op = OP_MULDIVW; imm = funct3;
+				}
+				break;
+			}
 			switch(funct3){
 				case 0x0:
 					switch(funct7){
-						case 0x0: r[rd] = (int32_t)r[rs1] + (int32_t)r[rs2]; break;			/* ADDW */
-						case 0x20: r[rd] = (int32_t)r[rs1] - (int32_t)r[rs2]; break;			/* SUBW */
-						default: goto fail;
+						case 0x0: op = OP_ADDW; break;					/* ADDW */
+						case 0x20: op = OP_SUBW; break;					/* SUBW */
 					}
 					break;
-				case 0x1: r[rd] = (int32_t)r[rs1] << (int32_t)r[rs2]; break;					/* SLLW */
+				case 0x1: op = OP_SLLW; break;							/* SLLW */
 				case 0x5:
 					switch(funct7){
-						case 0x0: r[rd] = (int32_t)u[rs1] >> (int32_t)u[rs2]; break;			/* SRLW */
-						case 0x20: r[rd] = (int32_t)r[rs1] >> (int32_t)r[rs2]; break;			/* SRAW */
-						default: goto fail;
+						case 0x0: op = OP_SRLW; break;					/* SRLW */
+						case 0x20: op = OP_SRAW; break;					/* SRAW */
 					}
-					break;				
+					break;
 			}
 			break;
 		case 0x73:
 			switch(funct3){
-				case 0:
-					switch(imm_i){
-//						case 0:	break;									/* SCALL */
-//						case 1:	bp(s, inst); break;							/* SBREAK */
-//						default: goto fail;
-					}
-					break;
+				case 0: op = OP_SYSTEM; break;							/* SCALL, SBREAK */
 				case 2:
-					switch(imm_i){
-						case 0xc00: break;								/* RDCYCLE */
-						case 0xc80: break;								/* RDCYCLEH */
-						case 0xc01: break;								/* RDTIME */
-						case 0xc81: break;								/* RDTIMEH */
-						case 0xc02: break;								/* RDINSTRET */
-						case 0xc82: break;								/* RDINSTRETH */
-						default: goto fail;
+					switch(imm_i & 0xfff){
+						case 0xc00:								/* RDCYCLE */
+						case 0xc80:								/* RDCYCLEH */
+						case 0xc01:								/* RDTIME */
+						case 0xc81:								/* RDTIMEH */
+						case 0xc02:								/* RDINSTRET */
+						case 0xc82:								/* RDINSTRETH */
+							op = OP_SYSTEM; break;
 					};
 					break;
-				default: goto fail;
 			}
 			break;
-		default: goto fail;
 	}
-	
-	s->pc = s->pc_next;
-	s->pc_next = s->pc_next + 4;
-	s->status = s->status_dly[0];
-	for (i = 0; i < 3; i++)
-		s->status_dly[i] = s->status_dly[i+1];
-	
-	s->counter++;
+
+	d->op = op;
+	d->imm = imm;
+	d->rd = rd ? rd : 32;
+	d->rs1 = rs1;
+	d->rs2 = rs2;
+	d->inst = fetched;
+}
+
+/*
+block translation (-b). a basic block (up to TB_INSTS instructions, ended by a jump or a
+branch) is decoded once into the translation cache, and runs without the per instruction
+work of the interpreter: the timer and interrupt state is only evaluated between blocks.
+a block runs this way when the results are the same, that is, when the interrupt enable
+pipeline is settled and no timer event (a compare match or a toggle of counter bits 16 and
+18) falls within it. otherwise, and for memory mapped registers (accesses at IO_BASE and up,
+which end the block before the access) and system instructions, the interpreter steps the
+instruction, so the simulation is cycle exact in both modes. stores to memory holding
+translated code flush the cache.
+*/
+#define IO_BASE				0xe0000000
+#define TB_HASH				4096			/* cache slots, direct mapped on the pc */
+#define TB_INSTS			32
+#define TB_POOL				(1 << 18)		/* decoded instructions in the cache */
+#define TB_PAGE_SHIFT			10			/* granularity of the code tracking */
+
+struct tb {
+	int64_t pc;
+	uint32_t n;
+	struct binst *code;
+};
+
+struct tb tbs[TB_HASH];
+struct binst tb_pool[TB_POOL];
+uint32_t tb_used;
+uint8_t tb_code[MEM_SIZE >> TB_PAGE_SHIFT];
+int32_t tb_enabled = 0;
+uint64_t tb_flushes = 0;
+
+static void tb_flush(void){
+	memset(tbs, 0, sizeof(tbs));
+	memset(tb_code, 0, sizeof(tb_code));
+	tb_used = 0;
+	tb_flushes++;
+}
+
+/* runs an instruction. in a block, returns 1 for an access to a register (not run), 2 ends the block */
+static inline __attribute__((always_inline)) int32_t exec(state *s, struct binst *d, int32_t block){
+	int64_t *r = s->r;
+	uint64_t *u = (uint64_t *)s->r;
+	uint32_t addr;
+	int64_t t;
+
+	switch(d->op){
+		case OP_LUI:
+		case OP_AUIPC: r[d->rd] = d->imm; break;
+		case OP_JAL: r[d->rd] = d->next; s->pc_next = d->imm; break;
+		case OP_JALR: t = (r[d->rs1] + d->imm) & ~1ll; r[d->rd] = d->next; s->pc_next = t; break;
+		case OP_BEQ: if (r[d->rs1] == r[d->rs2]) s->pc_next = d->imm; break;
+		case OP_BNE: if (r[d->rs1] != r[d->rs2]) s->pc_next = d->imm; break;
+		case OP_BLT: if (r[d->rs1] < r[d->rs2]) s->pc_next = d->imm; break;
+		case OP_BGE: if (r[d->rs1] >= r[d->rs2]) s->pc_next = d->imm; break;
+		case OP_BLTU: if (u[d->rs1] < u[d->rs2]) s->pc_next = d->imm; break;
+		case OP_BGEU: if (u[d->rs1] >= u[d->rs2]) s->pc_next = d->imm; break;
+		case OP_LB: case OP_LH: case OP_LW: case OP_LD: case OP_LBU: case OP_LHU: case OP_LWU:
+			addr = r[d->rs1] + d->imm;
+			if (block && addr >= IO_BASE)
+				return 1;
+			switch(d->op){
+				case OP_LB: r[d->rd] = (int8_t)mem_read(s, 1, addr); break;
+				case OP_LH: r[d->rd] = (int16_t)mem_read(s, 2, addr); break;
+				case OP_LW: r[d->rd] = (int32_t)mem_read(s, 4, addr); break;
+				case OP_LD: r[d->rd] = mem_read(s, 8, addr); break;
+				case OP_LBU: r[d->rd] = (uint8_t)mem_read(s, 1, addr); break;
+				case OP_LHU: r[d->rd] = (uint16_t)mem_read(s, 2, addr); break;
+				default: r[d->rd] = (uint32_t)mem_read(s, 4, addr); break;
+			}
+			break;
+		case OP_SB: case OP_SH: case OP_SW: case OP_SD:
+			addr = r[d->rs1] + d->imm;
+			if (block && addr >= IO_BASE)
+				return 1;
+			mem_write(s, 1 << (d->op - OP_SB), addr, r[d->rs2]);
+			if (addr < IO_BASE && tb_code[(addr % MEM_SIZE) >> TB_PAGE_SHIFT]){
+				tb_flush();
+				return 2;
+			}
+			break;
+		case OP_ADDI: r[d->rd] = r[d->rs1] + d->imm; break;
+		case OP_SLLI: r[d->rd] = u[d->rs1] << d->imm; break;
+		case OP_SLTI: r[d->rd] = r[d->rs1] < d->imm; break;
+		case OP_SLTIU: r[d->rd] = u[d->rs1] < (uint64_t)d->imm; break;
+		case OP_XORI: r[d->rd] = r[d->rs1] ^ d->imm; break;
+		case OP_SRLI: r[d->rd] = u[d->rs1] >> d->imm; break;
+		case OP_SRAI: r[d->rd] = r[d->rs1] >> d->imm; break;
+		case OP_ORI: r[d->rd] = r[d->rs1] | d->imm; break;
+		case OP_ANDI: r[d->rd] = r[d->rs1] & d->imm; break;
+		case OP_ADDIW: r[d->rd] = (int32_t)(u[d->rs1] + d->imm); break;
+		case OP_SLLIW: r[d->rd] = (int32_t)((uint32_t)u[d->rs1] << d->imm); break;
+		case OP_SRLIW: r[d->rd] = (int32_t)((uint32_t)u[d->rs1] >> d->imm); break;
+		case OP_SRAIW: r[d->rd] = (int32_t)r[d->rs1] >> d->imm; break;
+		case OP_ADD: r[d->rd] = u[d->rs1] + u[d->rs2]; break;
+		case OP_SUB: r[d->rd] = u[d->rs1] - u[d->rs2]; break;
+		case OP_SLL: r[d->rd] = u[d->rs1] << (r[d->rs2] & 0x3f); break;
+		case OP_SLT: r[d->rd] = r[d->rs1] < r[d->rs2]; break;
+		case OP_SLTU: r[d->rd] = u[d->rs1] < u[d->rs2]; break;
+		case OP_XOR: r[d->rd] = r[d->rs1] ^ r[d->rs2]; break;
+		case OP_SRL: r[d->rd] = u[d->rs1] >> (r[d->rs2] & 0x3f); break;
+		case OP_SRA: r[d->rd] = r[d->rs1] >> (r[d->rs2] & 0x3f); break;
+		case OP_OR: r[d->rd] = r[d->rs1] | r[d->rs2]; break;
+		case OP_AND: r[d->rd] = r[d->rs1] & r[d->rs2]; break;
+		case OP_ADDW: r[d->rd] = (int32_t)(u[d->rs1] + u[d->rs2]); break;
+		case OP_SUBW: r[d->rd] = (int32_t)(u[d->rs1] - u[d->rs2]); break;
+		case OP_SLLW: r[d->rd] = (int32_t)((uint32_t)u[d->rs1] << (r[d->rs2] & 0x1f)); break;
+		case OP_SRLW: r[d->rd] = (int32_t)((uint32_t)u[d->rs1] >> (r[d->rs2] & 0x1f)); break;
+		case OP_SRAW: r[d->rd] = (int32_t)r[d->rs1] >> (r[d->rs2] & 0x1f); break;
+		case OP_MULDIV: muldiv(s, d->imm, d->rd, d->rs1, d->rs2); break;
+		case OP_MULDIVW: muldivw(s, d->imm, d->rd, d->rs1, d->rs2); break;
+		case OP_SYSTEM: break;
+		default:
+			printf("\ninvalid opcode (pc=0x%x opcode=0x%x)", s->pc, d->inst);
+			dumpregs(s);
+			exit(0);
+	}
+
+	return 0;
+}
+
+/* timer cause bits, for the current counter value */
+static void timer_tick(state *s){
 	if ((s->compare2 & 0xffffff) == (s->counter & 0xffffff)) s->cause |= 0x20;		/*IRQ_COMPARE2*/
 	if (s->compare == s->counter) s->cause |= 0x10;						/*IRQ_COMPARE*/
 	if (!(s->counter & 0x10000)) s->cause |= 0x8; else s->cause &= 0xfff7;			/*IRQ_COUNTER2_NOT*/
 	if (s->counter & 0x10000) s->cause |= 0x4; else s->cause &= 0xfffb;			/*IRQ_COUNTER2*/
 	if (!(s->counter & 0x40000)) s->cause |= 0x2; else s->cause &= 0xfffd;			/*IRQ_COUNTER_NOT*/
 	if (s->counter & 0x40000) s->cause |= 0x1; else s->cause &= 0xfffe;			/*IRQ_COUNTER*/
-	
-	return;
-fail:
-	printf("\ninvalid opcode (pc=0x%x opcode=0x%x)", s->pc, inst);
-	dumpregs(s);
-	exit(0);
+}
+
+void cycle(state *s){
+	struct binst d;
+	uint32_t i;
+
+	if (s->status && (s->cause & s->mask)){
+		s->epc = s->pc_next;
+		s->pc = s->vector;
+		s->pc_next = s->vector + 4;
+		s->status = 0;
+		for (i = 0; i < 4; i++)
+			s->status_dly[i] = 0;
+	}
+
+	decode(&d, mem_fetch(s, s->pc), s->pc);
+	s->pc_next = d.next;
+	s->r[0] = 0;
+
+//	bp(s, d.inst);
+
+	exec(s, &d, 0);
+
+	s->pc = s->pc_next;
+	s->pc_next = s->pc_next + 4;
+	s->status = s->status_dly[0];
+	for (i = 0; i < 3; i++)
+		s->status_dly[i] = s->status_dly[i+1];
+
+	s->counter++;
+	timer_tick(s);
+}
+
+static struct tb *tb_translate(state *s, int64_t pc){
+	struct tb *t = &tbs[(pc >> 1) & (TB_HASH - 1)];
+	struct binst *d;
+	uint32_t n = 0, a;
+
+	if (tb_used + TB_INSTS > TB_POOL)
+		tb_flush();
+	t->pc = pc;
+	t->code = &tb_pool[tb_used];
+	while (n < TB_INSTS){
+		d = &t->code[n];
+		decode(d, mem_fetch(s, pc), pc);
+		if (d->op >= OP_SYSTEM)
+			break;
+		a = pc % MEM_SIZE;
+		tb_code[a >> TB_PAGE_SHIFT] = 1;
+		tb_code[((a + 3) % MEM_SIZE) >> TB_PAGE_SHIFT] = 1;
+		n++;
+		if (d->op >= OP_JAL && d->op <= OP_BGEU)
+			break;
+		pc = d->next;
+	}
+	t->n = n;
+	tb_used += n;
+
+	return t;
+}
+
+static void run_blocks(state *s){
+	struct tb *t;
+	struct binst *d;
+	uint32_t k, n;
+	int32_t rc;
+
+	for (;;){
+		t = &tbs[(s->pc >> 1) & (TB_HASH - 1)];
+		if (t->pc != s->pc || !t->n)
+			t = tb_translate(s, s->pc);
+		n = t->n;
+		/* interpreted: pending interrupts, the enable pipeline, timer events in the block */
+		if (!n || (s->status && (s->cause & s->mask)) ||
+			s->status_dly[0] != s->status || s->status_dly[1] != s->status ||
+			s->status_dly[2] != s->status || s->status_dly[3] != s->status ||
+			(s->counter >> 16) != ((s->counter + n) >> 16) ||
+			(uint64_t)(s->compare - s->counter - 1) < n ||
+			((s->compare2 - s->counter - 1) & 0xffffff) < n){
+			cycle(s);
+			continue;
+		}
+		rc = 0;
+		d = t->code;
+		for (k = 0; k < n; k++, d++){
+			s->pc = d->pc;
+			s->pc_next = d->next;
+			rc = exec(s, d, 1);
+			if (rc){
+				if (rc == 2)
+					k++;
+				break;
+			}
+		}
+		s->pc = rc == 1 ? d->pc : s->pc_next;
+		s->pc_next = s->pc + 4;
+		s->counter += k;
+		timer_tick(s);
+		if (rc == 1)
+			cycle(s);
+	}
 }
 
 int main(int argc, char *argv[]){
@@ -418,6 +782,11 @@ int main(int argc, char *argv[]){
 	memset(s, 0, sizeof(state));
 	memset(sram, 0xff, sizeof(MEM_SIZE));
 
+	if (argc >= 2 && !strcmp(argv[1], "-b")){
+		tb_enabled = 1;
+		argc--;
+		argv++;
+	}
 	if (argc >= 2){
 		in = fopen(argv[1], "rb");
 		if (in == 0){
@@ -439,7 +808,8 @@ int main(int argc, char *argv[]){
 			log_enabled = 1;
 		}
 	}else{
-		printf("\nsyntax: hf_risc_sim [file.bin] [logfile.txt]\n");
+		printf("\nsyntax: hf_riscv64_sim [-b] [file.bin] [logfile.txt]\n");
+		printf("-b translates basic blocks (faster, with the same results)\n");
 		return 1;
 	}
 
@@ -457,6 +827,8 @@ int main(int argc, char *argv[]){
 	s->compare = 0;
 	s->compare2 = 0;
 
+	if (tb_enabled)
+		run_blocks(s);
 	for(;;){
 		cycle(s);
 	}
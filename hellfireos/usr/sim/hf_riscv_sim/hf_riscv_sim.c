@@ -8,8 +8,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif
 
-#define MEM_SIZE			0x00100000
+#define MEM_SIZE			0x00100000		/* default, -M sets it */
 #define SRAM_BASE			0x40000000
 #define EXIT_TRAP			0xe0000000
 #define IRQ_VECTOR			0xf0000000
@@ -22,28 +32,479 @@
 #define COMPARE2			0xf0000070
 #define EXTIO_IN			0xf0000080
 #define EXTIO_OUT			0xf0000090
+#define CHECKPOINT			0xf00000b0
+#define IDLE_HINT			0xf00000c0
 #define DEBUG_ADDR			0xf00000d0
 #define UART_WRITE			0xf00000e0
 #define UART_READ			0xf00000e0
 #define UART_DIVISOR			0xf00000f0
+#define TRACE_CTRL			0xf0000100
+#define NIC_CTRL			0xf0000200
+#define NIC_STATUS			0xf0000210
+#define NIC_RXADDR			0xf0000220
+#define NIC_RXLEN			0xf0000230
+#define NIC_TXADDR			0xf0000240
+#define NIC_TXLEN			0xf0000250
+#define NIC_MAC0			0xf0000260
+#define NIC_MAC1			0xf0000270
+#define BLK_CTRL			0xf0000300
+#define BLK_STATUS			0xf0000310
+#define BLK_SECTOR			0xf0000320
+#define BLK_COUNT			0xf0000330
+#define BLK_ADDR			0xf0000340
+#define BLK_SECTORS			0xf0000350
 
 #define ntohs(A) ( ((A)>>8) | (((A)&0xff)<<8) )
 #define htons(A) ntohs(A)
 #define ntohl(A) ( ((A)>>24) | (((A)&0xff0000)>>8) | (((A)&0xff00)<<8) | ((A)<<24) )
 #define htonl(A) ntohl(A)
 
+/*
+user level counters, read with RDCYCLE, RDTIME, RDINSTRET and the hpmcounter CSRs (32 bits,
+and the upper half on the H variants). an instruction takes a cycle, so the cycle (and time)
+counter is the instructions retired plus the idle cycles fast forwarded, and is not changed
+by writes to COUNTER. hpmcounter3 to hpmcounter7 count loads, stores, conditional branches,
+branches taken and jumps (JAL / JALR). the simulator models no caches, so other counters
+read 0.
+*/
+#define HPM_LOADS			0
+#define HPM_STORES			1
+#define HPM_BRANCHES			2
+#define HPM_TAKEN			3
+#define HPM_JUMPS			4
+#define HPM_EVENTS			5
+
 typedef struct {
-	int32_t r[32];
+	int32_t r[33];							/* r[32] takes writes to r0 */
 	int32_t pc, pc_next;
 	int8_t *mem;
 	int32_t vector, cause, mask, status, status_dly[4], epc, counter, compare, compare2;
+	uint32_t next_event;						/* counter value of the next timer event */
+	int32_t dly_pending;						/* cycles until status_dly[] settles */
+	uint64_t idle;							/* cycles skipped on idle hints */
+	uint64_t instret;						/* instructions retired */
+	uint64_t hpm[HPM_EVENTS];					/* event counters (hpmcounter3 and up) */
 } state;
 
-int8_t sram[MEM_SIZE];
+/*
+decoded instruction cache. each halfword of memory has an entry holding its decoded fields,
+length and the handler that executes it (dispatched with computed gotos, a GCC extension),
+filled on the first fetch and invalidated when the instruction is written (so self modifying
+and loaded code is decoded again). compressed (RVC) instructions are expanded to their 32 bit
+form when decoded, so they run on the same handlers. interrupt and timer
+state is not evaluated on every cycle: the cause bits only change at timer events (a
+compare match, or a toggle of counter bits 16 and 18) and on writes to the interrupt
+registers, so they are updated at those points only, with the same results.
+
+a write to IDLE_HINT tells the simulator the program does nothing until an interrupt, or
+for at most the written number of cycles (_cpu_idle() and the delay loops). the counter
+is advanced up to the cycle before the next timer event, without interpreting the idle
+loop, so interrupts are raised on the same counter values.
+*/
+enum {
+	OP_DECODE = 0,
+	OP_LUI, OP_AUIPC, OP_JAL, OP_JALR, OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU, OP_LB,
+	OP_LH, OP_LW, OP_LBU, OP_LHU, OP_SB, OP_SH, OP_SW, OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI,
+	OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI, OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV,
+	OP_DIVU, OP_REM, OP_REMU, OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA,
+	OP_OR, OP_AND, OP_CSR, OP_NOP, OP_FAIL
+};
+
+struct dinst {
+	uint8_t op, rd, rs1, rs2;
+	int32_t imm;
+	uint32_t inst;
+	uint32_t len;							/* 2 (compressed) or 4 bytes */
+};
+
+/*
+simulated memory, a power of two (mem_mask decodes the address). memory and the decoded
+instruction cache are anonymous mappings, so pages are zero until they are touched and
+the .bss of a program costs nothing to load. raw images and ELF segments are mapped from
+the file (private, copy on write) where the file offset allows it.
+*/
+int8_t *sram;
+struct dinst *dcache;
+uint32_t mem_size = MEM_SIZE, mem_mask = MEM_SIZE - 1;
+
+/*
+memory map, in pages of 64KB. a page is either memory (mirrored every mem_size bytes, the
+upper address bits are not decoded) or a device page, with callbacks for its registers.
+loads and stores to memory index the map and go straight to the buffer, without matching
+the address against the peripheral registers (the access functions are inlined in the
+handlers, so the size is known there as well).
+*/
+#define PAGE_SHIFT			16
+#define PAGE_MASK			((1 << PAGE_SHIFT) - 1)
+#define PAGES				(1 << (32 - PAGE_SHIFT))
+
+struct page {
+	int32_t (*read)(state *s, int32_t size, uint32_t address);
+	void (*write)(state *s, int32_t size, uint32_t address, uint32_t value);
+	uint32_t offset;						/* of the page in memory */
+};
+
+struct page page_map[PAGES];
 
 FILE *fptr;
 int32_t log_enabled = 0;
 
+static int32_t mem_init(uint32_t size){
+	if (size < 0x10000 || size > 0x40000000 || (size & (size - 1)))
+		return -1;
+	mem_size = size;
+	mem_mask = size - 1;
+	sram = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	dcache = mmap(NULL, (size >> 1) * sizeof(struct dinst), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (sram == MAP_FAILED || dcache == MAP_FAILED)
+		return -1;
+
+	return 0;
+}
+
+/* size bytes at offset in the file, to memory at to. whole host pages are mapped */
+static int32_t load_segment(int fd, uint32_t offset, uint32_t size, uint32_t to){
+	uint32_t pg = sysconf(_SC_PAGESIZE), a, b;
+
+	if (to + size > mem_size || to + size < to)
+		return -1;
+	a = (to + pg - 1) & ~(pg - 1);
+	b = (to + size) & ~(pg - 1);
+	if ((offset - to) % pg || b <= a)
+		a = b = to + size;
+	else if (mmap(sram + a, b - a, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset + (a - to)) == MAP_FAILED)
+		return -1;
+	if (pread(fd, sram + to, a - to, offset) != a - to)
+		return -1;
+	if (pread(fd, sram + b, to + size - b, offset + (b - to)) != to + size - b)
+		return -1;
+
+	return 0;
+}
+
+/*
+loads a raw binary (at SRAM_BASE) or the PT_LOAD segments of an ELF file, and returns the
+entry point, or 0. the part of a segment beyond its size in the file (.bss) is not
+written, it is zero already.
+*/
+static uint32_t load_image(char *file){
+	Elf32_Ehdr eh;
+	Elf32_Phdr ph;
+	struct stat st;
+	uint32_t entry = SRAM_BASE, to, i;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) || st.st_size == 0){
+		close(fd);
+		return 0;
+	}
+	if (pread(fd, &eh, sizeof(eh), 0) == sizeof(eh) && !memcmp(eh.e_ident, ELFMAG, SELFMAG)){
+		if (eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_ident[EI_DATA] != ELFDATA2LSB || eh.e_machine != EM_RISCV){
+			printf("\nnot a RV32 (little endian) ELF file.");
+			close(fd);
+			return 0;
+		}
+		for (i = 0; i < eh.e_phnum; i++){
+			if (pread(fd, &ph, sizeof(ph), eh.e_phoff + i * eh.e_phentsize) != sizeof(ph))
+				break;
+			if (ph.p_type != PT_LOAD || ph.p_memsz == 0)
+				continue;
+			to = ph.p_vaddr & mem_mask;
+			if (ph.p_memsz > mem_size - to || load_segment(fd, ph.p_offset, ph.p_filesz, to)){
+				printf("\nELF segment at %08x (%u bytes) does not fit in memory.", ph.p_vaddr, ph.p_memsz);
+				close(fd);
+				return 0;
+			}
+		}
+		entry = eh.e_entry;
+	}else if (load_segment(fd, 0, st.st_size > mem_size ? mem_size : st.st_size, SRAM_BASE & mem_mask)){
+		entry = 0;
+	}
+	close(fd);
+
+	return entry;
+}
+
+/*
+checkpoints. a write to CHECKPOINT saves the machine state (registers, interrupt controller,
+timers and memory) to the file given with -c, once the instruction is done, and -r starts
+the simulation from a saved state instead of a binary. the decoded instruction cache is not
+saved, instructions are decoded again. files are meant for the same simulator build only.
+*/
+#define CKPT_MAGIC			"HFRVCKP3"
+
+char *ckpt_file = NULL;
+int32_t ckpt_pending = 0;
+
+static void checkpoint_save(state *s){
+	FILE *out;
+	uint32_t size = sizeof(state);
+
+	out = fopen(ckpt_file, "wb");
+	if (!out){
+		printf("\nerror writing checkpoint file.\n");
+		exit(1);
+	}
+	fwrite(CKPT_MAGIC, 1, 8, out);
+	fwrite(&size, sizeof(size), 1, out);
+	fwrite(&mem_size, sizeof(mem_size), 1, out);
+	fwrite(s, sizeof(state), 1, out);
+	fwrite(sram, 1, mem_size, out);
+	fclose(out);
+	printf("\ncheckpoint saved at %u cycles.\n", s->counter);
+}
+
+static int32_t checkpoint_restore(state *s, char *file){
+	FILE *in;
+	int8_t magic[8];
+	uint32_t size = 0, msize = 0;
+	int32_t ok;
+
+	in = fopen(file, "rb");
+	if (!in)
+		return -1;
+	/* the memory size is the one of the saved machine */
+	ok = fread(magic, 1, 8, in) == 8 && !memcmp(magic, CKPT_MAGIC, 8) &&
+		fread(&size, sizeof(size), 1, in) == 1 && size == sizeof(state) &&
+		fread(&msize, sizeof(msize), 1, in) == 1 && !mem_init(msize) &&
+		fread(s, sizeof(state), 1, in) == 1 && fread(sram, 1, mem_size, in) == mem_size;
+	fclose(in);
+	s->mem = &sram[0];
+
+	return ok ? 0 : -1;
+}
+
+/*
+binary trace (-t file), written through a large buffer. records are little endian
+varints, tagged on the two low bits:
+
+0: n instructions, each one 4 bytes after the last (n << 2)
+1: one instruction, at a pc relative to the last one, in halfwords (zigzag << 2)
+2: a memory access of the next instruction, at an address relative to the last one
+   (zigzag << 5 | log2(size) << 3 | store << 2)
+3: a marker (kind << 2, 0 start, 1 stop), followed by the counter value
+
+-m adds memory accesses, -p n traces one instruction out of n (the decoder weighs each
+one by n), -b and -e start and stop the trace when the pc reaches an address (-b 0 waits
+for the program) and writes of 1 / 0 to TRACE_CTRL start and stop it from the program.
+the trace goes after the header "HFTRACE1", the period and the flags (1: memory accesses,
+2: relative pcs in halfwords, as instructions may be compressed; older traces have words).
+hf_trace decodes it.
+*/
+#define TRACE_MAGIC			"HFTRACE1"
+#define TRACE_BUF			(1 << 20)
+
+struct trace {
+	FILE *out;
+	uint8_t buf[TRACE_BUF + 32];
+	uint32_t len;
+	int32_t on, mem;
+	uint32_t start, stop;						/* pc addresses, or 0 */
+	uint32_t period, count;
+	uint32_t pc, addr, seq;						/* last pc and address, pending instructions */
+} trace;
+
+int32_t trace_enabled = 0;
+
+static void trace_put(uint64_t v){
+	while (v >= 0x80){
+		trace.buf[trace.len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	trace.buf[trace.len++] = v;
+	if (trace.len >= TRACE_BUF){
+		fwrite(trace.buf, 1, trace.len, trace.out);
+		trace.len = 0;
+	}
+}
+
+static uint64_t zigzag(int32_t v){
+	return (uint32_t)((v << 1) ^ (v >> 31));
+}
+
+static void trace_seq(void){
+	if (trace.seq){
+		trace_put((uint64_t)trace.seq << 2);
+		trace.seq = 0;
+	}
+}
+
+static void trace_marker(state *s, uint32_t kind){
+	trace_seq();
+	trace_put(kind << 2 | 3);
+	trace_put((uint32_t)s->counter);
+	trace.on = !kind;
+}
+
+/* after each instruction */
+static void trace_inst(state *s){
+	uint32_t pc = s->pc;
+
+	if (!trace.on){
+		if (!trace.start || pc != trace.start)
+			return;
+		trace_marker(s, 0);
+	}
+	if (pc == trace.stop){
+		trace_marker(s, 1);
+		return;
+	}
+	if (--trace.count)
+		return;
+	trace.count = trace.period;
+	if (pc == trace.pc + 4){
+		trace.seq++;
+	}else{
+		trace_seq();
+		trace_put(zigzag((int32_t)(pc - trace.pc) >> 1) << 2 | 1);
+	}
+	trace.pc = pc;
+}
+
+/* loads and stores, of the instruction being executed */
+static void trace_access(uint32_t address, int32_t size, int32_t store){
+	if (!trace.on || !trace.mem || trace.count != 1)
+		return;
+	trace_seq();
+	trace_put(zigzag(address - trace.addr) << 5 | (size >> 1) << 3 | store << 2 | 2);
+	trace.addr = address;
+}
+
+static void trace_close(void){
+	if (trace.out){
+		trace_seq();
+		fwrite(trace.buf, 1, trace.len, trace.out);
+		fclose(trace.out);
+		trace.out = NULL;
+	}
+}
+
+/* with wait, the trace starts at the start address (or a write to TRACE_CTRL) */
+static int32_t trace_open(char *file, int32_t wait){
+	uint32_t v;
+
+	trace.out = fopen(file, "wb");
+	if (!trace.out)
+		return -1;
+	fwrite(TRACE_MAGIC, 1, 8, trace.out);
+	v = trace.period;
+	fwrite(&v, sizeof(v), 1, trace.out);
+	v = (trace.mem ? 1 : 0) | 2;
+	fwrite(&v, sizeof(v), 1, trace.out);
+	trace.on = !wait;
+	trace.count = 1;
+	trace_enabled = 1;
+	atexit(trace_close);
+
+	return 0;
+}
+
+/*
+sampling profiler (-P file, -i cycles). the pc is sampled every interval cycles (1000 by
+default), at timer events (see timer_event()), so the interpreter loop is not slowed
+down. calls (jal / jalr linking ra) and returns (jalr to ra) are tracked on a shadow
+stack, and each sample is also counted on the call edges of the stack. a return to an
+address not on the stack (a context switch, or a longjmp) empties it. the profile is a
+text file of samples ("s pc count") and call edges ("c site callee count"), hf_trace
+symbolizes it.
+*/
+#define PROF_STACK			64
+
+struct prof_entry {
+	uint32_t a, b, count;
+};
+
+struct prof_table {
+	struct prof_entry *e;
+	uint32_t size, used;
+};
+
+struct prof {
+	FILE *out;
+	uint32_t interval, next;
+	struct prof_table pcs, edges;
+	uint32_t site[PROF_STACK], callee[PROF_STACK], ret[PROF_STACK];
+	int32_t depth;							/* frames above PROF_STACK are not kept */
+} prof;
+
+int32_t prof_enabled = 0;
+
+static void prof_add(struct prof_table *t, uint32_t a, uint32_t b, uint32_t count){
+	struct prof_entry *old;
+	uint32_t i, n;
+
+	if (t->used * 2 >= t->size){
+		old = t->e;
+		n = t->size;
+		t->size = n ? n * 2 : 4096;
+		t->e = calloc(t->size, sizeof(struct prof_entry));
+		t->used = 0;
+		for (i = 0; i < n; i++)
+			if (old[i].count)
+				prof_add(t, old[i].a, old[i].b, old[i].count);
+		free(old);
+	}
+	i = ((a >> 2) ^ (b * 31)) * 2654435761u & (t->size - 1);
+	while (t->e[i].count && (t->e[i].a != a || t->e[i].b != b))
+		i = (i + 1) & (t->size - 1);
+	if (!t->e[i].count){
+		t->e[i].a = a;
+		t->e[i].b = b;
+		t->used++;
+	}
+	t->e[i].count += count;
+}
+
+static void prof_call(uint32_t site, uint32_t callee, uint32_t ret){
+	if (prof.depth < PROF_STACK){
+		prof.site[prof.depth] = site;
+		prof.callee[prof.depth] = callee;
+		prof.ret[prof.depth] = ret;
+	}
+	prof.depth++;
+}
+
+static void prof_return(uint32_t target){
+	int32_t i;
+
+	if (prof.depth > PROF_STACK){
+		prof.depth--;
+		return;
+	}
+	for (i = prof.depth - 1; i >= 0; i--)
+		if (prof.ret[i] == target)
+			break;
+	prof.depth = i < 0 ? 0 : i;
+}
+
+static void prof_sample(state *s){
+	int32_t i;
+
+	prof_add(&prof.pcs, s->pc, 0, 1);
+	for (i = 0; i < prof.depth && i < PROF_STACK; i++)
+		prof_add(&prof.edges, prof.site[i], prof.callee[i], 1);
+	prof.next = s->counter + prof.interval;
+}
+
+static void prof_close(void){
+	uint32_t i;
+
+	if (!prof.out)
+		return;
+	fprintf(prof.out, "# hf_prof interval %u\n", prof.interval);
+	for (i = 0; i < prof.pcs.size; i++)
+		if (prof.pcs.e[i].count)
+			fprintf(prof.out, "s %08x %u\n", prof.pcs.e[i].a, prof.pcs.e[i].count);
+	for (i = 0; i < prof.edges.size; i++)
+		if (prof.edges.e[i].count)
+			fprintf(prof.out, "c %08x %08x %u\n", prof.edges.e[i].a, prof.edges.e[i].b, prof.edges.e[i].count);
+	fclose(prof.out);
+	prof.out = NULL;
+}
+
 void dumpregs(state *s){
 	int32_t i;
 	
@@ -60,34 +521,29 @@ void bp(state *s, uint32_t ir){
 	getchar();
 }
 
+/* an instruction, a halfword at a time (the upper half is not read for a compressed one) */
 static int32_t mem_fetch(state *s, uint32_t address){
-	uint32_t value=0, ptr;
+	uint32_t value=0;
 
-	ptr = (uint32_t)(intptr_t)s->mem + (address % MEM_SIZE);
-
-	value = *(int32_t *)(intptr_t)ptr;
+	value = *(uint16_t *)(s->mem + (address & mem_mask));
+	if ((value & 3) == 3)
+		value |= *(uint16_t *)(s->mem + ((address + 2) & mem_mask)) << 16;
 //	value = ntohl(value);
 
 	return(value);
 }
 
-static int32_t mem_read(state *s, int32_t size, uint32_t address){
-	uint32_t value=0, ptr;
+/* entries of the decoded cache holding the bytes written (from the halfword before, the tail of a 32 bit instruction) */
+static inline __attribute__((always_inline)) void dcache_inval(uint32_t offset, uint32_t len){
+	uint32_t i, end = (offset + len + 1) >> 1;
 
-	switch(address){
-		case IRQ_VECTOR:	return s->vector;
-		case IRQ_CAUSE:		return s->cause | 0x0080 | 0x0040;
-		case IRQ_MASK:		return s->mask;
-		case IRQ_STATUS:	return s->status;
-		case IRQ_EPC:		return s->epc;
-		case COUNTER:		return s->counter;
-		case COMPARE:		return s->compare;
-		case COMPARE2:		return s->compare2;
-		case UART_READ:		return getchar();
-		case UART_DIVISOR:	return 0;
-	}
+	for (i = (offset >> 1) - 1; i != end; i++)
+		dcache[i & (mem_mask >> 1)].op = OP_DECODE;
+}
 
-	ptr = (uint32_t)(intptr_t)s->mem + (address % MEM_SIZE);
+static inline __attribute__((always_inline)) int32_t ram_read(state *s, int32_t size, uint32_t address, uint32_t offset){
+	int8_t *ptr = s->mem + offset;
+	uint32_t value=0;
 
 	switch(size){
 		case 4:
@@ -96,7 +552,7 @@ static int32_t mem_read(state *s, int32_t size, uint32_t address){
 				dumpregs(s);
 				exit(1);
 			}else{
-				value = *(int32_t *)(intptr_t)ptr;
+				value = *(int32_t *)ptr;
 //				value = ntohl(value);
 			}
 			break;
@@ -106,52 +562,25 @@ static int32_t mem_read(state *s, int32_t size, uint32_t address){
 				dumpregs(s);
 				exit(1);
 			}else{
-				value = *(int16_t *)(intptr_t)ptr;
+				value = *(int16_t *)ptr;
 //				value = ntohs((uint16_t)value);
 			}
 			break;
 		case 1:
-			value = *(int8_t *)(intptr_t)ptr;
+			value = *ptr;
 			break;
 		default:
 			printf("\nerror");
 	}
-//	printf("\nload(%d): %x, addr: %08x", size, value, address);
 
 	return(value);
 }
 
-static void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
-	uint32_t ptr, i;
+static inline __attribute__((always_inline)) void ram_write(state *s, int32_t size, uint32_t address, uint32_t offset, uint32_t value){
+	int8_t *ptr = s->mem + offset;
 
-	switch(address){
-		case IRQ_VECTOR:	s->vector = value; return;
-		case IRQ_CAUSE:		s->cause = value; return;
-		case IRQ_MASK:		s->mask = value; return;
-		case IRQ_STATUS:	if (value == 0){ s->status = 0; for (i = 0; i < 4; i++) s->status_dly[i] = 0; }else{ s->status_dly[3] = value; } return;
-		case IRQ_EPC:		s->epc = value; return;
-		case COUNTER:		s->counter = value; return;
-		case COMPARE:		s->compare = value; s->cause &= 0xffef; return;
-		case COMPARE2:		s->compare2 = value; s->cause &= 0xffdf; return;
-		case EXIT_TRAP:
-			fflush(stdout);
-			if (log_enabled)
-				fclose(fptr);
-			printf("\nend of simulation - %d cycles.\n", s->counter);
-			exit(0);
-		case DEBUG_ADDR:
-			if (log_enabled)
-				fprintf(fptr, "%c", (int8_t)(value & 0xff));
-			return;
-		case UART_WRITE:
-			fprintf(stderr, "%c", (int8_t)(value & 0xff));
-			return;
-		case UART_DIVISOR:
-			return;
-	}
+	dcache_inval(offset, size);
 
-	ptr = (uint32_t)(intptr_t)s->mem + (address % MEM_SIZE);
-	
 	switch(size){
 		case 4:
 //			printf("\nstore(%d): %x, addr: %08x", size, value, address);
@@ -161,7 +590,7 @@ static void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
 				exit(1);
 			}else{
 //				value = htonl(value);
-				*(int32_t *)(intptr_t)ptr = value;
+				*(int32_t *)ptr = value;
 			}
 			break;
 		case 2:
@@ -172,35 +601,465 @@ static void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
 				exit(1);
 			}else{
 //				value = htons((uint16_t)value);
-				*(int16_t *)(intptr_t)ptr = (uint16_t)value;
+				*(int16_t *)ptr = (uint16_t)value;
 			}
 			break;
 		case 1:
 //			printf("\nstore(%d): %x, addr: %08x", size, (uint8_t)value, address);
-			*(int8_t *)(intptr_t)ptr = (uint8_t)value;
+			*ptr = (uint8_t)value;
 			break;
 		default:
 			printf("\nerror");
 	}
 }
 
-void cycle(state *s){
-	uint32_t inst, i;
-	uint32_t opcode, rd, rs1, rs2, funct3, funct7, imm_i, imm_s, imm_sb, imm_u, imm_uj;
-	int32_t *r = s->r;
-	uint32_t *u = (uint32_t *)s->r;
-	uint32_t ptr_l, ptr_s;
-	
-	if (s->status && (s->cause & s->mask)){
-		s->epc = s->pc_next;
-		s->pc = s->vector;
-		s->pc_next = s->vector + 4;
-		s->status = 0;
-		for (i = 0; i < 4; i++)
-			s->status_dly[i] = 0;
+/*
+virtual Ethernet interface (drivers/eth_vnic.c of the hf-risc and hf-riscv ports). frames go
+between the program memory and a host TAP device (-n tap0), or are replayed from a capture
+file (-N in.pcap) as fast as the program takes them. frames sent by the program may be captured
+as well (-w out.pcap). the program gives a buffer address (and a length, to transmit) and
+a command on NIC_CTRL moves a whole frame: NIC_TX sends NIC_TXLEN bytes from NIC_TXADDR,
+and NIC_RX copies the next frame to NIC_RXADDR, with its size on NIC_RXLEN (0 if there is
+none, reception never blocks). NIC_STATUS reads NIC_PRESENT when a backend is open, and
+NIC_MAC0 / NIC_MAC1 the MAC address (bytes 0 - 3 and 4 - 5, first byte on the low bits).
+*/
+#define NIC_FRAME			1518
+#define NIC_TX				1
+#define NIC_RX				2
+#define NIC_PRESENT			1
+
+struct nic {
+	int fd;								/* TAP device, -1 if none */
+	FILE *in, *out;							/* capture files */
+	int32_t swap;							/* input capture of the other byte order */
+	uint32_t rxaddr, rxlen, txaddr, txlen;
+	uint32_t rx, tx;						/* frames moved */
+} nic = { -1, NULL, NULL, 0, 0, 0, 0, 0, 0, 0 };
+
+static uint32_t nic_word(uint8_t *p){
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+	return nic.swap ? ntohl(v) : v;
+}
+
+static int32_t nic_tap(char *name){
+#ifdef __linux__
+	struct ifreq ifr;
+
+	nic.fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+	if (nic.fd < 0)
+		return -1;
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(nic.fd, TUNSETIFF, &ifr) < 0){
+		close(nic.fd);
+		nic.fd = -1;
+		return -1;
+	}
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+static int32_t nic_pcap_in(char *file){
+	uint8_t h[24];
+	uint32_t magic;
+
+	nic.in = fopen(file, "rb");
+	if (!nic.in || fread(h, 1, 24, nic.in) != 24)
+		return -1;
+	magic = h[0] | (h[1] << 8) | (h[2] << 16) | ((uint32_t)h[3] << 24);
+	/* microsecond or nanosecond timestamps, either byte order */
+	if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+		nic.swap = 1;
+	else if (magic != 0xa1b2c3d4 && magic != 0xa1b23c4d)
+		return -1;
+	if (nic_word(h + 20) != 1)					/* link type, Ethernet */
+		return -1;
+
+	return 0;
+}
+
+static int32_t nic_pcap_out(char *file){
+	uint32_t h[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, NIC_FRAME, 1 };
+
+	nic.out = fopen(file, "wb");
+	if (!nic.out || fwrite(h, 1, sizeof(h), nic.out) != sizeof(h))
+		return -1;
+
+	return 0;
+}
+
+static void nic_close(void){
+	if (nic.rx || nic.tx)
+		printf("\nvirtual nic: %u frames received, %u sent.\n", nic.rx, nic.tx);
+	if (nic.out)
+		fclose(nic.out);
+}
+
+static int32_t nic_read(uint8_t *buf){
+	uint8_t h[16];
+	int32_t len = 0;
+	uint32_t incl;
+
+	if (nic.fd >= 0){
+		len = read(nic.fd, buf, NIC_FRAME);
+		if (len < 0)
+			len = 0;
+	}else if (nic.in && fread(h, 1, 16, nic.in) == 16){
+		incl = nic_word(h + 8);
+		if (incl > NIC_FRAME){
+			fseek(nic.in, incl, SEEK_CUR);
+			return 0;
+		}
+		len = fread(buf, 1, incl, nic.in);
 	}
 
-	inst = mem_fetch(s, s->pc);
+	return len;
+}
+
+static void nic_capture(uint8_t *buf, uint32_t len){
+	uint32_t h[4] = { 0, 0, len, len };
+
+	fwrite(h, 1, sizeof(h), nic.out);
+	fwrite(buf, 1, len, nic.out);
+}
+
+static void nic_cmd(state *s, uint32_t cmd){
+	uint8_t buf[NIC_FRAME];
+	uint32_t len, offset;
+
+	if (cmd == NIC_TX){
+		offset = nic.txaddr & mem_mask;
+		len = nic.txlen;
+		if (len > NIC_FRAME || offset + len > mem_size)
+			return;
+		if (nic.fd >= 0 && write(nic.fd, s->mem + offset, len) < 0)
+			return;
+		if (nic.out)
+			nic_capture((uint8_t *)s->mem + offset, len);
+		nic.tx++;
+	}else if (cmd == NIC_RX){
+		offset = nic.rxaddr & mem_mask;
+		len = nic_read(buf);
+		if (offset + len > mem_size)
+			len = 0;
+		memcpy(s->mem + offset, buf, len);
+		dcache_inval(offset, len);
+		nic.rxlen = len;
+		if (len)
+			nic.rx++;
+	}
+}
+
+/*
+virtual block device (drivers/block/simdisk.c), backed by a host image file (-d disk.img)
+mapped in shared mode, so the program writes go to the file and the volume is kept across
+runs (the size of the file, in BLK_SECTOR_SIZE sectors, is the size of the device). the
+program sets a sector, a sector count and a buffer address, and a command on BLK_CTRL moves
+the sectors between the image and memory at once. BLK_STATUS holds 0 after a successful
+command (and while a backend is open), and BLK_SECTORS the size of the device.
+*/
+#define BLK_SECTOR_SIZE			512
+#define BLK_READ			1
+#define BLK_WRITE			2
+#define BLK_SYNC			3
+#define BLK_ERROR			1
+#define BLK_ABSENT			2
+
+struct blk {
+	int8_t *image;							/* file mapping, NULL if none */
+	uint32_t sectors, sector, count, addr, status;
+} blk = { NULL, 0, 0, 0, 0, BLK_ABSENT };
+
+static int32_t blk_open(char *file){
+	struct stat st;
+	int fd;
+
+	fd = open(file, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < BLK_SECTOR_SIZE)
+		return -1;
+	blk.image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (blk.image == MAP_FAILED){
+		blk.image = NULL;
+		return -1;
+	}
+	blk.sectors = st.st_size / BLK_SECTOR_SIZE;
+	blk.status = 0;
+
+	return 0;
+}
+
+static void blk_close(void){
+	if (blk.image)
+		msync(blk.image, (size_t)blk.sectors * BLK_SECTOR_SIZE, MS_SYNC);
+}
+
+static void blk_cmd(state *s, uint32_t cmd){
+	uint32_t offset, len;
+	int8_t *sector;
+
+	if (!blk.image)
+		return;
+	blk.status = BLK_ERROR;
+	if (cmd == BLK_SYNC){
+		if (msync(blk.image, (size_t)blk.sectors * BLK_SECTOR_SIZE, MS_SYNC) == 0)
+			blk.status = 0;
+		return;
+	}
+	offset = blk.addr & mem_mask;
+	len = blk.count * BLK_SECTOR_SIZE;
+	if (blk.count == 0 || blk.count > blk.sectors || blk.sector > blk.sectors - blk.count || offset + len > mem_size)
+		return;
+	sector = blk.image + (size_t)blk.sector * BLK_SECTOR_SIZE;
+	if (cmd == BLK_READ){
+		memcpy(s->mem + offset, sector, len);
+		dcache_inval(offset, len);
+	}else if (cmd == BLK_WRITE){
+		memcpy(sector, s->mem + offset, len);
+	}else{
+		return;
+	}
+	blk.status = 0;
+}
+
+/* peripheral registers, other addresses of the page are memory */
+static int32_t io_read(state *s, int32_t size, uint32_t address){
+	switch(address){
+		case IRQ_VECTOR:	return s->vector;
+		case IRQ_CAUSE:		return s->cause | 0x0080 | 0x0040;
+		case IRQ_MASK:		return s->mask;
+		case IRQ_STATUS:	return s->status;
+		case IRQ_EPC:		return s->epc;
+		case COUNTER:		return s->counter;
+		case COMPARE:		return s->compare;
+		case COMPARE2:		return s->compare2;
+		case UART_READ:		return getchar();
+		case UART_DIVISOR:	return 0;
+		case NIC_STATUS:	return (nic.fd >= 0 || nic.in) ? NIC_PRESENT : 0;
+		case NIC_RXLEN:		return nic.rxlen;
+		case NIC_MAC0:		return 0x00464802;			/* 02:48:46:00:00:01, locally administered */
+		case NIC_MAC1:		return 0x0100;
+		case BLK_STATUS:	return blk.status;
+		case BLK_SECTORS:	return blk.sectors;
+	}
+
+	return ram_read(s, size, address, address & mem_mask);
+}
+
+static void io_write(state *s, int32_t size, uint32_t address, uint32_t value){
+	uint32_t i;
+
+	switch(address){
+		case IRQ_VECTOR:	s->vector = value; return;
+		case IRQ_CAUSE:		s->cause = value; s->next_event = s->counter + 1; return;
+		case IRQ_MASK:		s->mask = value; s->next_event = s->counter + 1; return;
+		case IRQ_STATUS:	if (value == 0){ s->status = 0; for (i = 0; i < 4; i++) s->status_dly[i] = 0; s->dly_pending = 0; }else{ s->status_dly[3] = value; s->dly_pending = 4; } return;
+		case IRQ_EPC:		s->epc = value; return;
+		case COUNTER:		s->counter = value; s->next_event = s->counter + 1; return;
+		case COMPARE:		s->compare = value; s->cause &= 0xffef; s->next_event = s->counter + 1; return;
+		case COMPARE2:		s->compare2 = value; s->cause &= 0xffdf; s->next_event = s->counter + 1; return;
+		case CHECKPOINT:
+			if (ckpt_file){
+				ckpt_pending = 1;
+				s->next_event = s->counter + 1;
+			}
+			return;
+		case IDLE_HINT:
+			if (!s->dly_pending){
+				i = s->next_event - (uint32_t)s->counter - 1;
+				if (value < i) i = value;
+				s->counter += i;
+				s->idle += i;
+			}
+			return;
+		case DEBUG_ADDR:
+			if (log_enabled)
+				fprintf(fptr, "%c", (int8_t)(value & 0xff));
+			return;
+		case UART_WRITE:
+			fprintf(stderr, "%c", (int8_t)(value & 0xff));
+			return;
+		case UART_DIVISOR:
+			return;
+		case NIC_CTRL:		nic_cmd(s, value); return;
+		case NIC_RXADDR:	nic.rxaddr = value; return;
+		case NIC_TXADDR:	nic.txaddr = value; return;
+		case NIC_TXLEN:		nic.txlen = value; return;
+		case BLK_CTRL:		blk_cmd(s, value); return;
+		case BLK_SECTOR:	blk.sector = value; return;
+		case BLK_COUNT:		blk.count = value; return;
+		case BLK_ADDR:		blk.addr = value; return;
+		case TRACE_CTRL:
+			if (trace_enabled && !trace.on != !value)
+				trace_marker(s, value ? 0 : 1);
+			return;
+	}
+
+	ram_write(s, size, address, address & mem_mask, value);
+}
+
+static void trap_write(state *s, int32_t size, uint32_t address, uint32_t value){
+	if (address == EXIT_TRAP){
+		fflush(stdout);
+		if (log_enabled)
+			fclose(fptr);
+		printf("\nend of simulation - %d cycles.\n", s->counter);
+		if (s->idle)
+			printf("%llu idle cycles fast forwarded.\n", (unsigned long long)s->idle);
+		exit(0);
+	}
+	ram_write(s, size, address, address & mem_mask, value);
+}
+
+static void map_init(void){
+	uint32_t i;
+
+	for (i = 0; i < PAGES; i++){
+		page_map[i].read = NULL;
+		page_map[i].write = NULL;
+		page_map[i].offset = (i << PAGE_SHIFT) & mem_mask;
+	}
+	page_map[IRQ_VECTOR >> PAGE_SHIFT].read = io_read;
+	page_map[IRQ_VECTOR >> PAGE_SHIFT].write = io_write;
+	page_map[EXIT_TRAP >> PAGE_SHIFT].write = trap_write;
+}
+
+static inline __attribute__((always_inline)) int32_t mem_read(state *s, int32_t size, uint32_t address){
+	struct page *p = &page_map[address >> PAGE_SHIFT];
+
+	if (trace_enabled)
+		trace_access(address, size, 0);
+	if (p->read)
+		return p->read(s, size, address);
+
+	return ram_read(s, size, address, p->offset + (address & PAGE_MASK));
+}
+
+static inline __attribute__((always_inline)) void mem_write(state *s, int32_t size, uint32_t address, uint32_t value){
+	struct page *p = &page_map[address >> PAGE_SHIFT];
+
+	if (trace_enabled)
+		trace_access(address, size, 1);
+	if (p->write)
+		p->write(s, size, address, value);
+	else
+		ram_write(s, size, address, p->offset + (address & PAGE_MASK), value);
+}
+
+/*
+RVC (RV32C), expanded to the 32 bit instruction doing the same. compressed floating point
+loads and stores, and reserved encodings, give an invalid instruction.
+*/
+#define C_INVALID			0xffffffff
+#define C_BITS(c, hi, lo)		(((c) >> (lo)) & ((1 << ((hi) - (lo) + 1)) - 1))
+#define C_REG(c, lo)			(8 + C_BITS(c, (lo) + 2, lo))
+#define RV_I(imm, rs1, f3, rd, op)	((((imm) & 0xfff) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define RV_S(imm, rs2, rs1, f3, op)	(((((imm) >> 5) & 0x7f) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | (((imm) & 0x1f) << 7) | (op))
+#define RV_R(f7, rs2, rs1, f3, rd, op)	(((f7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define RV_B(imm, rs2, rs1, f3)		(((((imm) >> 12) & 1) << 31) | ((((imm) >> 5) & 0x3f) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((((imm) >> 1) & 0xf) << 8) | ((((imm) >> 11) & 1) << 7) | 0x63)
+#define RV_J(imm, rd)			(((((imm) >> 20) & 1) << 31) | ((((imm) >> 1) & 0x3ff) << 21) | ((((imm) >> 11) & 1) << 20) | ((((imm) >> 12) & 0xff) << 12) | ((rd) << 7) | 0x6f)
+
+static uint32_t rvc_expand(uint32_t c){
+	int32_t imm, rd = C_BITS(c, 11, 7), rs2 = C_BITS(c, 6, 2);
+
+	/* 6 bit signed immediate of C.ADDI, C.LI, C.ANDI and C.LUI */
+	imm = C_BITS(c, 6, 2) | (c & 0x1000 ? -32 : 0);
+
+	switch ((c & 3) << 3 | C_BITS(c, 15, 13)){
+		case 0x00:										/* C.ADDI4SPN */
+			imm = C_BITS(c, 12, 11) << 4 | C_BITS(c, 10, 7) << 6 | C_BITS(c, 6, 6) << 2 | C_BITS(c, 5, 5) << 3;
+			if (!imm) return C_INVALID;
+			return RV_I(imm, 2, 0, C_REG(c, 2), 0x13);
+		case 0x02:										/* C.LW */
+			imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 6, 6) << 2 | C_BITS(c, 5, 5) << 6;
+			return RV_I(imm, C_REG(c, 7), 2, C_REG(c, 2), 0x03);
+		case 0x06:										/* C.SW */
+			imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 6, 6) << 2 | C_BITS(c, 5, 5) << 6;
+			return RV_S(imm, C_REG(c, 2), C_REG(c, 7), 2, 0x23);
+		case 0x08:										/* C.ADDI, C.NOP */
+			return RV_I(imm, rd, 0, rd, 0x13);
+		case 0x09:										/* C.JAL */
+		case 0x0d:										/* C.J */
+			imm = C_BITS(c, 5, 3) << 1 | C_BITS(c, 11, 11) << 4 | C_BITS(c, 2, 2) << 5 | C_BITS(c, 7, 7) << 6 |
+				C_BITS(c, 6, 6) << 7 | C_BITS(c, 10, 9) << 8 | C_BITS(c, 8, 8) << 10 | (c & 0x1000 ? -2048 : 0);
+			return RV_J(imm, (c & 0x8000) ? 0 : 1);
+		case 0x0a:										/* C.LI */
+			return RV_I(imm, 0, 0, rd, 0x13);
+		case 0x0b:
+			if (rd == 2){									/* C.ADDI16SP */
+				imm = C_BITS(c, 6, 6) << 4 | C_BITS(c, 2, 2) << 5 | C_BITS(c, 5, 5) << 6 |
+					C_BITS(c, 4, 3) << 7 | (c & 0x1000 ? -512 : 0);
+				if (!imm) return C_INVALID;
+				return RV_I(imm, 2, 0, 2, 0x13);
+			}
+			if (!imm) return C_INVALID;							/* C.LUI */
+			return (imm << 12) | (rd << 7) | 0x37;
+		case 0x0c:
+			rd = C_REG(c, 7);
+			rs2 = C_REG(c, 2);
+			switch (C_BITS(c, 11, 10)){
+				case 0:									/* C.SRLI */
+					if (c & 0x1000) return C_INVALID;
+					return RV_I(C_BITS(c, 6, 2), rd, 5, rd, 0x13);
+				case 1:									/* C.SRAI */
+					if (c & 0x1000) return C_INVALID;
+					return RV_I(0x400 | C_BITS(c, 6, 2), rd, 5, rd, 0x13);
+				case 2:									/* C.ANDI */
+					return RV_I(imm, rd, 7, rd, 0x13);
+				default:
+					if (c & 0x1000) return C_INVALID;
+					switch (C_BITS(c, 6, 5)){
+						case 0: return RV_R(0x20, rs2, rd, 0, rd, 0x33);		/* C.SUB */
+						case 1: return RV_R(0, rs2, rd, 4, rd, 0x33);			/* C.XOR */
+						case 2: return RV_R(0, rs2, rd, 6, rd, 0x33);			/* C.OR */
+						default: return RV_R(0, rs2, rd, 7, rd, 0x33);			/* C.AND */
+					}
+			}
+		case 0x0e:										/* C.BEQZ */
+		case 0x0f:										/* C.BNEZ */
+			imm = C_BITS(c, 4, 3) << 1 | C_BITS(c, 11, 10) << 3 | C_BITS(c, 2, 2) << 5 |
+				C_BITS(c, 6, 5) << 6 | (c & 0x1000 ? -256 : 0);
+			return RV_B(imm, 0, C_REG(c, 7), C_BITS(c, 13, 13));
+		case 0x10:										/* C.SLLI */
+			if (c & 0x1000) return C_INVALID;
+			return RV_I(C_BITS(c, 6, 2), rd, 1, rd, 0x13);
+		case 0x12:										/* C.LWSP */
+			if (!rd) return C_INVALID;
+			imm = C_BITS(c, 12, 12) << 5 | C_BITS(c, 6, 4) << 2 | C_BITS(c, 3, 2) << 6;
+			return RV_I(imm, 2, 2, rd, 0x03);
+		case 0x14:
+			if (!(c & 0x1000)){
+				if (rs2) return RV_R(0, rs2, 0, 0, rd, 0x33);				/* C.MV */
+				if (!rd) return C_INVALID;
+				return RV_I(0, rd, 0, 0, 0x67);						/* C.JR */
+			}
+			if (rs2) return RV_R(0, rs2, rd, 0, rd, 0x33);					/* C.ADD */
+			if (!rd) return 0x00100073;							/* C.EBREAK */
+			return RV_I(0, rd, 0, 1, 0x67);							/* C.JALR */
+		case 0x16:										/* C.SWSP */
+			imm = C_BITS(c, 12, 9) << 2 | C_BITS(c, 8, 7) << 6;
+			return RV_S(imm, rs2, 2, 2, 0x23);
+		default:
+			return C_INVALID;
+	}
+}
+
+static void decode(struct dinst *d, uint32_t inst){
+	uint32_t opcode, rd, rs1, rs2, funct3, funct7, imm_i, imm_s, imm_sb, imm_u, imm_uj;
+	uint8_t op = OP_FAIL;
+	int32_t imm = 0;
+
+	if ((inst & 3) != 3){
+		decode(d, rvc_expand(inst & 0xffff));
+		d->inst = inst & 0xffff;
+		d->len = 2;
+		return;
+	}
 
 	opcode = inst & 0x7f;
 	rd = (inst >> 7) & 0x1f;
@@ -219,187 +1078,527 @@ void cycle(state *s){
 		imm_sb |= 0xffffe000;
 		imm_uj |= 0xffe00000;
 	}
-	ptr_l = r[rs1] + (int32_t)imm_i;
-	ptr_s = r[rs1] + (int32_t)imm_s;
-	r[0] = 0;
-	
-//	bp(s, inst);
-	
+
 	switch(opcode){
-		case 0x37: r[rd] = imm_u; break;										/* LUI */
-		case 0x17: r[rd] = s->pc + imm_u; break;									/* AUIPC */
-		case 0x6f: r[rd] = s->pc_next; s->pc_next = s->pc + imm_uj; break;						/* JAL */
-		case 0x67: r[rd] = s->pc_next; s->pc_next = (r[rs1] + imm_i) & 0xfffffffe; break;				/* JALR */
+		case 0x37: op = OP_LUI; imm = imm_u; break;								/* LUI */
+		case 0x17: op = OP_AUIPC; imm = imm_u; break;								/* AUIPC */
+		case 0x6f: op = OP_JAL; imm = imm_uj; break;								/* JAL */
+		case 0x67: op = OP_JALR; imm = imm_i; break;								/* JALR */
 		case 0x63:
+			imm = imm_sb;
 			switch(funct3){
-				case 0x0: if (r[rs1] == r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BEQ */
-				case 0x1: if (r[rs1] != r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BNE */
-				case 0x4: if (r[rs1] < r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BLT */
-				case 0x5: if (r[rs1] >= r[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BGE */
-				case 0x6: if (u[rs1] < u[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BLTU */
-				case 0x7: if (u[rs1] >= u[rs2]){ s->pc_next = s->pc + imm_sb; } break;				/* BGEU */
-				default: goto fail;
+				case 0x0: op = OP_BEQ; break;								/* BEQ */
+				case 0x1: op = OP_BNE; break;								/* BNE */
+				case 0x4: op = OP_BLT; break;								/* BLT */
+				case 0x5: op = OP_BGE; break;								/* BGE */
+				case 0x6: op = OP_BLTU; break;								/* BLTU */
+				case 0x7: op = OP_BGEU; break;								/* BGEU */
 			}
 			break;
 		case 0x3:
+			imm = imm_i;
 			switch(funct3){
-				case 0x0: r[rd] = (int8_t)mem_read(s,1,ptr_l); break;						/* LB */
-				case 0x1: r[rd] = (int16_t)mem_read(s,2,ptr_l); break;						/* LH */
-				case 0x2: r[rd] = mem_read(s,4,ptr_l); break;							/* LW */
-				case 0x4: r[rd] = (uint8_t)mem_read(s,1,ptr_l); break;						/* LBU */
-				case 0x5: r[rd] = (uint16_t)mem_read(s,2,ptr_l); break;						/* LHU */
-				default: goto fail;
+				case 0x0: op = OP_LB; break;								/* LB */
+				case 0x1: op = OP_LH; break;								/* LH */
+				case 0x2: op = OP_LW; break;								/* LW */
+				case 0x4: op = OP_LBU; break;								/* LBU */
+				case 0x5: op = OP_LHU; break;								/* LHU */
 			}
 			break;
 		case 0x23:
+			imm = imm_s;
 			switch(funct3){
-				case 0x0: mem_write(s,1,ptr_s,r[rs2]); break;							/* SB */
-				case 0x1: mem_write(s,2,ptr_s,r[rs2]); break;							/* SH */
-				case 0x2: mem_write(s,4,ptr_s,r[rs2]); break;							/* SW */
-				default: goto fail;
+				case 0x0: op = OP_SB; break;								/* SB */
+				case 0x1: op = OP_SH; break;								/* SH */
+				case 0x2: op = OP_SW; break;								/* SW */
 			}
 			break;
 		case 0x13:
+			imm = imm_i;
 			switch(funct3){
-				case 0x0: r[rd] = r[rs1] + (int32_t)imm_i; break;						/* ADDI */
-				case 0x2: r[rd] = r[rs1] < (int32_t)imm_i; break;		 				/* SLTI */
-				case 0x3: r[rd] = u[rs1] < (uint32_t)imm_i; break;						/* SLTIU */
-				case 0x4: r[rd] = r[rs1] ^ (int32_t)imm_i; break;						/* XORI */
-				case 0x6: r[rd] = r[rs1] | (int32_t)imm_i; break;						/* ORI */
-				case 0x7: r[rd] = r[rs1] & (int32_t)imm_i; break;						/* ANDI */
-				case 0x1: r[rd] = u[rs1] << (rs2 & 0x3f); break;						/* SLLI */
+				case 0x0: op = OP_ADDI; break;								/* ADDI */
+				case 0x2: op = OP_SLTI; break;								/* SLTI */
+				case 0x3: op = OP_SLTIU; break;								/* SLTIU */
+				case 0x4: op = OP_XORI; break;								/* XORI */
+				case 0x6: op = OP_ORI; break;								/* ORI */
+				case 0x7: op = OP_ANDI; break;								/* ANDI */
+				case 0x1: op = OP_SLLI; imm = rs2 & 0x3f; break;					/* SLLI */
 				case 0x5:
+					imm = rs2 & 0x3f;
 					switch(funct7){
-						case 0x0: r[rd] = u[rs1] >> (rs2 & 0x3f); break;				/* SRLI */
-						case 0x20: r[rd] = r[rs1] >> (rs2 & 0x3f); break;				/* SRAI */
-						default: goto fail;
+						case 0x0: op = OP_SRLI; break;						/* SRLI */
+						case 0x20: op = OP_SRAI; break;						/* SRAI */
 					}
 					break;
-				default: goto fail;
 			}
 			break;
 		case 0x33:
 			if (funct7 == 0x1){											/* RV32M */
 				switch(funct3){
-					case 0:	r[rd] = (((int64_t)r[rs1] * (int64_t)r[rs2]) & 0xffffffff); break;		/* MUL */
-					case 1:	r[rd] = ((((int64_t)r[rs1] * (int64_t)r[rs2]) >> 32) & 0xffffffff); break;	/* MULH */
-					case 2:	r[rd] = ((((int64_t)r[rs1] * (uint64_t)u[rs2]) >> 32) & 0xffffffff); break;	/* MULHSU */
-					case 3:	r[rd] = ((((uint64_t)u[rs1] * (uint64_t)u[rs2]) >> 32) & 0xffffffff); break;	/* MULHU */
-					case 4:	if (r[rs2]) r[rd] = r[rs1] / r[rs2]; else r[rd] = 0; break;							/* DIV */
-					case 5:	if (r[rs2]) r[rd] = u[rs1] / u[rs2]; else r[rd] = 0; break;							/* DIVU */
-					case 6:	if (r[rs2]) r[rd] = r[rs1] % r[rs2]; else r[rd] = 0; break;							/* REM */
-					case 7:	if (r[rs2]) r[rd] = u[rs1] % u[rs2]; else r[rd] = 0; break;							/* REMU */
-					default: goto fail;
+					case 0: op = OP_MUL; break;							/* MUL */
+					case 1: op = OP_MULH; break;							/* MULH */
+					case 2: op = OP_MULHSU; break;							/* MULHSU */
+					case 3: op = OP_MULHU; break;							/* MULHU */
+					case 4: op = OP_DIV; break;							/* DIV */
+					case 5: op = OP_DIVU; break;							/* DIVU */
+					case 6: op = OP_REM; break;							/* REM */
+					case 7: op = OP_REMU; break;							/* REMU */
 				}
-				break;
 			}else{
 				switch(funct3){
 					case 0x0:
 						switch(funct7){
-							case 0x0: r[rd] = r[rs1] + r[rs2]; break;				/* ADD */
-							case 0x20: r[rd] = r[rs1] - r[rs2]; break;				/* SUB */
-							default: goto fail;
+							case 0x0: op = OP_ADD; break;					/* ADD */
+							case 0x20: op = OP_SUB; break;					/* SUB */
 						}
 						break;
-					case 0x1: r[rd] = r[rs1] << r[rs2]; break;						/* SLL */
-					case 0x2: r[rd] = r[rs1] < r[rs2]; break;		 				/* SLT */
-					case 0x3: r[rd] = u[rs1] < u[rs2]; break;		 				/* SLTU */
-					case 0x4: r[rd] = r[rs1] ^ r[rs2]; break;						/* XOR */
+					case 0x1: op = OP_SLL; break;							/* SLL */
+					case 0x2: op = OP_SLT; break;							/* SLT */
+					case 0x3: op = OP_SLTU; break;							/* SLTU */
+					case 0x4: op = OP_XOR; break;							/* XOR */
 					case 0x5:
 						switch(funct7){
-							case 0x0: r[rd] = u[rs1] >> u[rs2]; break;				/* SRL */
-							case 0x20: r[rd] = r[rs1] >> r[rs2]; break;				/* SRA */
-							default: goto fail;
+							case 0x0: op = OP_SRL; break;					/* SRL */
+							case 0x20: op = OP_SRA; break;					/* SRA */
 						}
 						break;
-					case 0x6: r[rd] = r[rs1] | r[rs2]; break;						/* OR */
-					case 0x7: r[rd] = r[rs1] & r[rs2]; break;						/* AND */
-					default: goto fail;
+					case 0x6: op = OP_OR; break;							/* OR */
+					case 0x7: op = OP_AND; break;							/* AND */
 				}
-				break;
 			}
+			break;
 		case 0x73:
 			switch(funct3){
-				case 0:
-					switch(imm_i){
-//						case 0:	break;									/* SCALL */
-//						case 1:	bp(s, inst); break;							/* SBREAK */
-//						default: goto fail;
-					}
-					break;
-				case 2:
-					switch(imm_i){
-						case 0xc00: break;								/* RDCYCLE */
-						case 0xc80: break;								/* RDCYCLEH */
-						case 0xc01: break;								/* RDTIME */
-						case 0xc81: break;								/* RDTIMEH */
-						case 0xc02: break;								/* RDINSTRET */
-						case 0xc82: break;								/* RDINSTRETH */
-						default: goto fail;
-					};
+				case 0: op = OP_NOP; break;								/* SCALL, SBREAK */
+				case 2:										/* CSRRS */
+					imm = imm_i & 0xfff;
+					/* RDCYCLE, RDTIME, RDINSTRET, hpmcounter3 .. 31 and their upper halves */
+					if ((imm & 0xf60) == 0xc00 && rs1 == 0)
+						op = OP_CSR;
 					break;
-				default: goto fail;
 			}
 			break;
-		default: goto fail;
 	}
-	
-	s->pc = s->pc_next;
-	s->pc_next = s->pc_next + 4;
-	s->status = s->status_dly[0];
-	for (i = 0; i < 3; i++)
-		s->status_dly[i] = s->status_dly[i+1];
-	
-	s->counter++;
+
+	d->op = op;
+	d->imm = imm;
+	d->rd = rd ? rd : 32;
+	d->rs1 = rs1;
+	d->rs2 = rs2;
+	d->inst = inst;
+	d->len = 4;
+}
+
+/* timer cause bits for the current counter value, and the counter value of the next event */
+static void timer_event(state *s){
+	uint32_t c, dist, t;
+
 	if ((s->compare2 & 0xffffff) == (s->counter & 0xffffff)) s->cause |= 0x20;		/*IRQ_COMPARE2*/
 	if (s->compare == s->counter) s->cause |= 0x10;						/*IRQ_COMPARE*/
 	if (!(s->counter & 0x10000)) s->cause |= 0x8; else s->cause &= 0xfff7;			/*IRQ_COUNTER2_NOT*/
 	if (s->counter & 0x10000) s->cause |= 0x4; else s->cause &= 0xfffb;			/*IRQ_COUNTER2*/
 	if (!(s->counter & 0x40000)) s->cause |= 0x2; else s->cause &= 0xfffd;			/*IRQ_COUNTER_NOT*/
 	if (s->counter & 0x40000) s->cause |= 0x1; else s->cause &= 0xfffe;			/*IRQ_COUNTER*/
-	
-	return;
-fail:
-	printf("\ninvalid opcode (pc=0x%x opcode=0x%x)", s->pc, inst);
+
+	/* counter bits 16 and 18 toggle on multiples of 0x10000 */
+	c = s->counter;
+	dist = ((c | 0xffff) + 1) - c;
+	t = (uint32_t)s->compare - c;
+	if (t && t < dist) dist = t;
+	t = ((uint32_t)s->compare2 - c) & 0xffffff;
+	if (t && t < dist) dist = t;
+	/* profiler samples */
+	if (prof_enabled){
+		t = prof.next - c;
+		if (t == 0 || t > prof.interval){
+			prof.next = c + prof.interval;
+			t = prof.interval;
+		}
+		if (t < dist) dist = t;
+	}
+	s->next_event = c + dist;
+}
+
+#define R(x)	s->r[d->x]
+#define U(x)	((uint32_t *)s->r)[d->x]
+#define NEXT	goto next
+#define BRANCH(c)	do { s->hpm[HPM_BRANCHES]++; if (c){ s->hpm[HPM_TAKEN]++; s->pc_next = s->pc + d->imm; } } while (0)
+
+/* a user level counter (CSR 0xc00 - 0xc1f, upper halves at 0xc80 - 0xc9f) */
+static uint32_t csr_counter(state *s, uint32_t csr){
+	uint64_t v;
+	uint32_t n = csr & 0x1f;
+
+	if (n < 2)
+		v = s->instret + s->idle;
+	else if (n == 2)
+		v = s->instret;
+	else if (n - 3 < HPM_EVENTS)
+		v = s->hpm[n - 3];
+	else
+		v = 0;
+
+	return (csr & 0x80) ? v >> 32 : v;
+}
+
+/* executes instructions, dispatching (threaded) on the decoded cache */
+static void run(state *s){
+	static const void *label[] = {
+		&&op_decode,
+		&&op_lui, &&op_auipc, &&op_jal, &&op_jalr, &&op_beq, &&op_bne, &&op_blt, &&op_bge,
+		&&op_bltu, &&op_bgeu, &&op_lb, &&op_lh, &&op_lw, &&op_lbu, &&op_lhu, &&op_sb,
+		&&op_sh, &&op_sw, &&op_addi, &&op_slti, &&op_sltiu, &&op_xori, &&op_ori, &&op_andi,
+		&&op_slli, &&op_srli, &&op_srai, &&op_mul, &&op_mulh, &&op_mulhsu, &&op_mulhu,
+		&&op_div, &&op_divu, &&op_rem, &&op_remu, &&op_add, &&op_sub, &&op_sll, &&op_slt,
+		&&op_sltu, &&op_xor, &&op_srl, &&op_sra, &&op_or, &&op_and, &&op_csr, &&op_nop, &&op_fail
+	};
+	struct dinst *d;
+	uint32_t i;
+
+fetch:
+	d = &dcache[((uint32_t)s->pc & mem_mask) >> 1];
+	s->pc_next = s->pc + d->len;
+//	bp(s, d->inst);
+	goto *label[d->op];
+
+op_decode:
+	decode(d, mem_fetch(s, s->pc));
+	s->pc_next = s->pc + d->len;
+	goto *label[d->op];
+op_lui:
+	R(rd) = d->imm;
+	NEXT;
+op_auipc:
+	R(rd) = s->pc + d->imm;
+	NEXT;
+op_jal:
+	s->hpm[HPM_JUMPS]++;
+	R(rd) = s->pc_next; s->pc_next = s->pc + d->imm;
+	if (prof_enabled && d->rd == 1) prof_call(s->pc, s->pc_next, s->pc + d->len);
+	NEXT;
+op_jalr:
+	s->hpm[HPM_JUMPS]++;
+	R(rd) = s->pc_next; s->pc_next = (R(rs1) + d->imm) & 0xfffffffe;
+	if (prof_enabled){
+		if (d->rd == 1)
+			prof_call(s->pc, s->pc_next, s->pc + d->len);
+		else if (d->rd == 32 && d->rs1 == 1)
+			prof_return(s->pc_next);
+	}
+	NEXT;
+op_beq:
+	BRANCH(R(rs1) == R(rs2));
+	NEXT;
+op_bne:
+	BRANCH(R(rs1) != R(rs2));
+	NEXT;
+op_blt:
+	BRANCH(R(rs1) < R(rs2));
+	NEXT;
+op_bge:
+	BRANCH(R(rs1) >= R(rs2));
+	NEXT;
+op_bltu:
+	BRANCH(U(rs1) < U(rs2));
+	NEXT;
+op_bgeu:
+	BRANCH(U(rs1) >= U(rs2));
+	NEXT;
+op_lb:
+	s->hpm[HPM_LOADS]++;
+	R(rd) = (int8_t)mem_read(s, 1, R(rs1) + d->imm);
+	NEXT;
+op_lh:
+	s->hpm[HPM_LOADS]++;
+	R(rd) = (int16_t)mem_read(s, 2, R(rs1) + d->imm);
+	NEXT;
+op_lw:
+	s->hpm[HPM_LOADS]++;
+	R(rd) = mem_read(s, 4, R(rs1) + d->imm);
+	NEXT;
+op_lbu:
+	s->hpm[HPM_LOADS]++;
+	R(rd) = (uint8_t)mem_read(s, 1, R(rs1) + d->imm);
+	NEXT;
+op_lhu:
+	s->hpm[HPM_LOADS]++;
+	R(rd) = (uint16_t)mem_read(s, 2, R(rs1) + d->imm);
+	NEXT;
+op_sb:
+	s->hpm[HPM_STORES]++;
+	mem_write(s, 1, R(rs1) + d->imm, R(rs2));
+	NEXT;
+op_sh:
+	s->hpm[HPM_STORES]++;
+	mem_write(s, 2, R(rs1) + d->imm, R(rs2));
+	NEXT;
+op_sw:
+	s->hpm[HPM_STORES]++;
+	mem_write(s, 4, R(rs1) + d->imm, R(rs2));
+	NEXT;
+op_addi:
+	R(rd) = R(rs1) + d->imm;
+	NEXT;
+op_slti:
+	R(rd) = R(rs1) < d->imm;
+	NEXT;
+op_sltiu:
+	R(rd) = U(rs1) < (uint32_t)d->imm;
+	NEXT;
+op_xori:
+	R(rd) = R(rs1) ^ d->imm;
+	NEXT;
+op_ori:
+	R(rd) = R(rs1) | d->imm;
+	NEXT;
+op_andi:
+	R(rd) = R(rs1) & d->imm;
+	NEXT;
+op_slli:
+	R(rd) = U(rs1) << d->imm;
+	NEXT;
+op_srli:
+	R(rd) = U(rs1) >> d->imm;
+	NEXT;
+op_srai:
+	R(rd) = R(rs1) >> d->imm;
+	NEXT;
+op_mul:
+	R(rd) = (((int64_t)R(rs1) * (int64_t)R(rs2)) & 0xffffffff);
+	NEXT;
+op_mulh:
+	R(rd) = ((((int64_t)R(rs1) * (int64_t)R(rs2)) >> 32) & 0xffffffff);
+	NEXT;
+op_mulhsu:
+	R(rd) = ((((int64_t)R(rs1) * (uint64_t)U(rs2)) >> 32) & 0xffffffff);
+	NEXT;
+op_mulhu:
+	R(rd) = ((((uint64_t)U(rs1) * (uint64_t)U(rs2)) >> 32) & 0xffffffff);
+	NEXT;
+op_div:
+	if (R(rs2) == 0) R(rd) = -1;
+	else if (R(rs2) == -1 && U(rs1) == 0x80000000) R(rd) = R(rs1);
+	else R(rd) = R(rs1) / R(rs2);
+	NEXT;
+op_divu:
+	if (R(rs2)) R(rd) = U(rs1) / U(rs2); else R(rd) = -1;
+	NEXT;
+op_rem:
+	if (R(rs2) == 0) R(rd) = R(rs1);
+	else if (R(rs2) == -1) R(rd) = 0;
+	else R(rd) = R(rs1) % R(rs2);
+	NEXT;
+op_remu:
+	if (R(rs2)) R(rd) = U(rs1) % U(rs2); else R(rd) = R(rs1);
+	NEXT;
+op_add:
+	R(rd) = R(rs1) + R(rs2);
+	NEXT;
+op_sub:
+	R(rd) = R(rs1) - R(rs2);
+	NEXT;
+op_sll:
+	R(rd) = R(rs1) << R(rs2);
+	NEXT;
+op_slt:
+	R(rd) = R(rs1) < R(rs2);
+	NEXT;
+op_sltu:
+	R(rd) = U(rs1) < U(rs2);
+	NEXT;
+op_xor:
+	R(rd) = R(rs1) ^ R(rs2);
+	NEXT;
+op_srl:
+	R(rd) = U(rs1) >> U(rs2);
+	NEXT;
+op_sra:
+	R(rd) = R(rs1) >> R(rs2);
+	NEXT;
+op_or:
+	R(rd) = R(rs1) | R(rs2);
+	NEXT;
+op_and:
+	R(rd) = R(rs1) & R(rs2);
+	NEXT;
+op_csr:
+	R(rd) = csr_counter(s, d->imm);
+	NEXT;
+op_nop:
+	NEXT;
+op_fail:
+	printf("\ninvalid opcode (pc=0x%x opcode=0x%x)", s->pc, d->inst);
 	exit(0);
+
+next:
+	if (trace_enabled)
+		trace_inst(s);
+	s->pc = s->pc_next;
+	s->counter++;
+	s->instret++;
+	if (!s->dly_pending && (uint32_t)s->counter != s->next_event)
+		goto fetch;
+
+	/* status pipeline, timer events and interrupts */
+	if (s->dly_pending){
+		s->dly_pending--;
+		s->status = s->status_dly[0];
+		for (i = 0; i < 3; i++)
+			s->status_dly[i] = s->status_dly[i+1];
+	}
+	if ((uint32_t)s->counter == s->next_event){
+		if (prof_enabled && (uint32_t)s->counter == prof.next)
+			prof_sample(s);
+		timer_event(s);
+	}
+	if (s->status && (s->cause & s->mask)){
+		s->epc = s->pc + 4;						/* crt0 takes 4 back off */
+		s->pc = s->vector;
+		s->status = 0;
+		for (i = 0; i < 4; i++)
+			s->status_dly[i] = 0;
+		s->dly_pending = 0;
+	}
+	if (ckpt_pending){
+		ckpt_pending = 0;
+		checkpoint_save(s);
+	}
+	goto fetch;
 }
 
 int main(int argc, char *argv[]){
 	state context;
 	state *s;
-	FILE *in;
-	int bytes, i;
+	char *restore = NULL, *trace_file = NULL, *prof_file = NULL, *end;
+	char *nic_name = NULL, *nic_in = NULL, *nic_out = NULL, *disk = NULL;
+	uint32_t entry = SRAM_BASE;
+	int i, n, wait = 0;
 
 	s = &context;
 	memset(s, 0, sizeof(state));
-	memset(sram, 0xff, sizeof(MEM_SIZE));
 
-	if (argc >= 2){
-		in = fopen(argv[1], "rb");
-		if (in == 0){
-			printf("\nerror opening binary file.\n");
+	for (i = 1, n = 1; i < argc; i++){
+		if (!strcmp(argv[i], "-c") && i + 1 < argc)
+			ckpt_file = argv[++i];
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			restore = argv[++i];
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			trace_file = argv[++i];
+		else if (!strcmp(argv[i], "-m"))
+			trace.mem = 1;
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+			trace.period = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc){
+			trace.start = strtoul(argv[++i], NULL, 0);
+			wait = 1;
+		}
+		else if (!strcmp(argv[i], "-e") && i + 1 < argc)
+			trace.stop = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-P") && i + 1 < argc)
+			prof_file = argv[++i];
+		else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+			prof.interval = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			nic_name = argv[++i];
+		else if (!strcmp(argv[i], "-N") && i + 1 < argc)
+			nic_in = argv[++i];
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+			nic_out = argv[++i];
+		else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+			disk = argv[++i];
+		else if (!strcmp(argv[i], "-M") && i + 1 < argc){
+			mem_size = strtoul(argv[++i], &end, 0);
+			if (*end == 'k' || *end == 'K') mem_size <<= 10;
+			if (*end == 'm' || *end == 'M') mem_size <<= 20;
+		}
+		else
+			argv[n++] = argv[i];
+	}
+	argc = n;
+	if (trace.period == 0)
+		trace.period = 1;
+	if (trace.start && trace.start == trace.stop){
+		printf("\nthe trace starts and stops at the same address.\n");
+		return 1;
+	}
+
+	if (restore){
+		if (checkpoint_restore(s, restore)){
+			printf("\nerror reading checkpoint file.\n");
 			return 1;
 		}
-		bytes = fread(&sram, 1, MEM_SIZE, in);
-		fclose(in);
-		if (bytes == 0){
-			printf("\nerror reading binary file.\n");
+		/* the checkpoint takes the place of the binary file */
+		n = 1;
+	}else if (argc >= 2){
+		if (mem_init(mem_size)){
+			printf("\nthe memory size must be a power of two, from 64KB to 1GB.\n");
 			return 1;
 		}
-		if (argc == 3){
-			fptr = fopen(argv[2], "wb");
-			if (!fptr){
-				printf("\nerror reading binary file.\n");
-				return 1;
-			}
-			log_enabled = 1;
+		entry = load_image(argv[1]);
+		if (!entry){
+			printf("\nerror reading binary file.\n");
+			return 1;
 		}
+		n = 2;
 	}else{
-		printf("\nsyntax: hf_risc_sim [file.bin] [logfile.txt]\n");
+		printf("\nsyntax: hf_riscv_sim [file.bin | file.elf | -r checkpoint] [logfile.txt] [-M memory_size]");
+		printf("\n                    [-c checkpoint]");
+		printf("\n                    [-t trace.bin [-m] [-p period] [-b start_pc] [-e stop_pc]]");
+		printf("\n                    [-P profile.txt [-i interval]]");
+		printf("\n                    [-n tap_device | -N in.pcap] [-w out.pcap] [-d disk.img]\n");
 		return 1;
 	}
+	if (argc == n + 1){
+		fptr = fopen(argv[n], "wb");
+		if (!fptr){
+			printf("\nerror reading binary file.\n");
+			return 1;
+		}
+		log_enabled = 1;
+	}
+	if (trace_file && trace_open(trace_file, wait)){
+		printf("\nerror opening trace file.\n");
+		return 1;
+	}
+	if (prof_file){
+		prof.out = fopen(prof_file, "w");
+		if (!prof.out){
+			printf("\nerror opening profile file.\n");
+			return 1;
+		}
+		if (prof.interval == 0)
+			prof.interval = 1000;
+		prof.next = s->counter + prof.interval;
+		prof_enabled = 1;
+		atexit(prof_close);
+	}
 
-	s->pc = SRAM_BASE;
+	if (nic_name && nic_tap(nic_name)){
+		printf("\nerror opening TAP device %s.\n", nic_name);
+		return 1;
+	}
+	if (!nic_name && nic_in && nic_pcap_in(nic_in)){
+		printf("\nerror reading capture file.\n");
+		return 1;
+	}
+	if (nic_out && nic_pcap_out(nic_out)){
+		printf("\nerror opening capture file.\n");
+		return 1;
+	}
+	atexit(nic_close);
+	if (disk && blk_open(disk)){
+		printf("\nerror opening disk image (the file must exist, with one sector at least).\n");
+		return 1;
+	}
+	atexit(blk_close);
+
+	map_init();
+	if (restore){
+		run(s);
+		return(0);
+	}
+
+	s->pc = entry;
 	s->pc_next = s->pc + 4;
 	s->mem = &sram[0];
 	s->vector = 0;
@@ -412,10 +1611,11 @@ int main(int argc, char *argv[]){
 	s->counter = 0;
 	s->compare = 0;
 	s->compare2 = 0;
+	s->next_event = 1;
+	s->dly_pending = 0;
+	s->idle = 0;
 
-	for(;;){
-		cycle(s);
-	}
+	run(s);
 
 	return(0);
 }
@@ -0,0 +1,429 @@
+/* file:          hf_trace.c
+ * description:   decoder of the binary traces of hf_riscv_sim (-t), and of the
+ *                sampled profiles of hf_riscv_sim (-P) and mpsoc_sim (-P)
+ *
+ * build:         gcc -O2 -o hf_trace hf_trace.c
+ * usage:         hf_trace [-d] [-a] trace.bin [symbols]
+ *                hf_trace [-a] profile.txt [symbols]
+ *
+ * prints a flat profile of the trace: instructions (and loads / stores, if the trace
+ * has memory accesses) per function. symbols are the linker map (image.map) or the
+ * output of nm (nm -n image.elf). without symbols, or with -a, the profile is per pc.
+ * -d prints the trace itself, one line per instruction, memory access or marker.
+ *
+ * for a sampled profile, prints the samples per function (self, and inclusive of the
+ * functions called), then the call graph: callers and callees of each function, with
+ * the samples taken in the callee when called from there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#define TRACE_MAGIC			"HFTRACE1"
+#define PROF_MAGIC			"# hf_pro"
+
+struct pc_count {
+	uint32_t pc;
+	uint64_t ins, loads, stores;
+};
+
+struct symbol {
+	uint32_t addr;
+	char *name;
+	uint64_t ins, loads, stores;
+	uint64_t incl;							/* profiles: with the callees */
+};
+
+struct edge {
+	uint32_t site, callee, count;
+	struct symbol *from, *to;
+};
+
+/* pc histogram, open addressing */
+struct pc_count *table;
+uint32_t table_size = 1 << 16, table_used = 0;
+
+struct symbol *symbols;
+int32_t n_symbols = 0;
+
+static struct pc_count *lookup(uint32_t pc){
+	struct pc_count *old;
+	uint32_t i, n;
+
+	if (table_used * 2 >= table_size){
+		old = table;
+		n = table_size;
+		table_size *= 2;
+		table = calloc(table_size, sizeof(struct pc_count));
+		table_used = 0;
+		for (i = 0; i < n; i++)
+			if (old[i].ins || old[i].loads || old[i].stores)
+				*lookup(old[i].pc) = old[i];
+		free(old);
+	}
+	i = (pc >> 1) * 2654435761u & (table_size - 1);
+	while (table[i].pc != pc && (table[i].ins || table[i].loads || table[i].stores))
+		i = (i + 1) & (table_size - 1);
+	if (table[i].pc != pc || !(table[i].ins || table[i].loads || table[i].stores)){
+		table[i].pc = pc;
+		table_used++;
+	}
+
+	return &table[i];
+}
+
+static int read_varint(FILE *in, uint64_t *v){
+	int c, shift = 0;
+
+	*v = 0;
+	while ((c = getc(in)) != EOF){
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return 1;
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static int32_t unzigzag(uint64_t v){
+	return (int32_t)((uint32_t)(v >> 1) ^ -(uint32_t)(v & 1));
+}
+
+static int cmp_symbol(const void *a, const void *b){
+	const struct symbol *x = a, *y = b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* symbol lines of a linker map ("0x40000010  main") or of nm ("40000010 T main") */
+static void load_symbols(char *file){
+	FILE *in;
+	char line[512], a[256], b[256], c[256], *name;
+	uint32_t addr;
+	int32_t n, max = 1024;
+
+	in = fopen(file, "r");
+	if (!in){
+		printf("error opening symbols file.\n");
+		exit(1);
+	}
+	symbols = malloc(max * sizeof(struct symbol));
+	while (fgets(line, sizeof(line), in)){
+		n = sscanf(line, "%255s %255s %255s", a, b, c);
+		if (n == 2 && !strncmp(a, "0x", 2) && (b[0] == '_' || isalpha((unsigned char)b[0]))){
+			addr = strtoul(a, NULL, 16);
+			name = b;
+		}else if (n == 3 && strlen(b) == 1 && strchr("tTwW", b[0])){
+			addr = strtoul(a, NULL, 16);
+			name = c;
+		}else{
+			continue;
+		}
+		if (n_symbols == max){
+			max *= 2;
+			symbols = realloc(symbols, max * sizeof(struct symbol));
+		}
+		symbols[n_symbols].addr = addr;
+		symbols[n_symbols].name = strdup(name);
+		symbols[n_symbols].ins = symbols[n_symbols].loads = symbols[n_symbols].stores = 0;
+		symbols[n_symbols].incl = 0;
+		n_symbols++;
+	}
+	fclose(in);
+	qsort(symbols, n_symbols, sizeof(struct symbol), cmp_symbol);
+}
+
+static struct symbol *find_symbol(uint32_t pc){
+	int32_t lo = 0, hi = n_symbols - 1, mid;
+
+	if (n_symbols == 0 || pc < symbols[0].addr)
+		return NULL;
+	while (lo < hi){
+		mid = (lo + hi + 1) / 2;
+		if (symbols[mid].addr <= pc)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return &symbols[lo];
+}
+
+static int cmp_count(const void *a, const void *b){
+	const struct pc_count *x = a, *y = b;
+
+	return x->ins > y->ins ? -1 : x->ins < y->ins;
+}
+
+static int cmp_symbol_count(const void *a, const void *b){
+	const struct symbol *x = a, *y = b;
+
+	return x->ins > y->ins ? -1 : x->ins < y->ins;
+}
+
+static void print_count(uint64_t ins, uint64_t loads, uint64_t stores, uint64_t total, uint32_t flags){
+	printf("%12llu %6.2f%%", (unsigned long long)ins, 100.0 * ins / total);
+	if (flags & 1)
+		printf(" %10llu %10llu", (unsigned long long)loads, (unsigned long long)stores);
+}
+
+static int cmp_symbol_incl(const void *a, const void *b){
+	const struct symbol *x = *(struct symbol **)a, *y = *(struct symbol **)b;
+
+	return x->incl > y->incl ? -1 : x->incl < y->incl;
+}
+
+static int cmp_edge(const void *a, const void *b){
+	const struct edge *x = a, *y = b;
+
+	return x->count > y->count ? -1 : x->count < y->count;
+}
+
+/* sampled profile: "s pc count" and "c site callee count" lines */
+static int profile(FILE *in, char *file, int32_t per_pc){
+	char line[256];
+	uint32_t interval = 0, a, b, c;
+	uint64_t total = 0, incl;
+	struct edge *edges = NULL, *e;
+	int32_t n_edges = 0, max_edges = 0, i, j, k;
+	struct pc_count *p, *pcs;
+	struct symbol *sym, **order;
+
+	while (fgets(line, sizeof(line), in)){
+		if (sscanf(line, "# hf_prof interval %u", &a) == 1){
+			interval = a;
+		}else if (sscanf(line, "s %x %u", &a, &c) == 2){
+			p = lookup(a);
+			p->ins += c;
+			total += c;
+		}else if (sscanf(line, "c %x %x %u", &a, &b, &c) == 3){
+			if (n_edges == max_edges){
+				max_edges = max_edges ? max_edges * 2 : 1024;
+				edges = realloc(edges, max_edges * sizeof(struct edge));
+			}
+			edges[n_edges].site = a;
+			edges[n_edges].callee = b;
+			edges[n_edges].count = c;
+			n_edges++;
+		}
+	}
+	fclose(in);
+
+	printf("profile: %s, one sample every %u cycles, %llu samples\n\n", file, interval, (unsigned long long)total);
+	if (!total)
+		return 0;
+
+	pcs = malloc(table_used * sizeof(struct pc_count));
+	for (i = 0, j = 0; i < table_size; i++)
+		if (table[i].ins)
+			pcs[j++] = table[i];
+	qsort(edges, n_edges, sizeof(struct edge), cmp_edge);
+
+	if (per_pc || !n_symbols){
+		qsort(pcs, j, sizeof(struct pc_count), cmp_count);
+		printf("%-8s %12s %7s\n", "pc", "samples", "%");
+		for (i = 0; i < j; i++){
+			printf("%08x %12llu %6.2f%%", pcs[i].pc, (unsigned long long)pcs[i].ins, 100.0 * pcs[i].ins / total);
+			sym = find_symbol(pcs[i].pc);
+			if (sym)
+				printf("  %s+0x%x", sym->name, pcs[i].pc - sym->addr);
+			printf("\n");
+		}
+		printf("\n%-8s %-8s %12s\n", "site", "callee", "samples");
+		for (i = 0; i < n_edges; i++)
+			printf("%08x %08x %12u\n", edges[i].site, edges[i].callee, edges[i].count);
+		return 0;
+	}
+
+	for (i = 0; i < j; i++){
+		sym = find_symbol(pcs[i].pc);
+		if (sym){
+			sym->ins += pcs[i].ins;
+			sym->incl += pcs[i].ins;
+		}
+	}
+	/* samples taken in the callees count on the caller too (recursion counts twice) */
+	for (i = 0; i < n_edges; i++){
+		e = &edges[i];
+		e->from = find_symbol(e->site);
+		e->to = find_symbol(e->callee);
+		if (e->from && e->from != e->to)
+			e->from->incl += e->count;
+	}
+	order = malloc(n_symbols * sizeof(struct symbol *));
+	for (i = 0; i < n_symbols; i++)
+		order[i] = &symbols[i];
+	qsort(order, n_symbols, sizeof(struct symbol *), cmp_symbol_incl);
+
+	printf("%12s %7s %12s %7s  %s\n", "self", "%", "inclusive", "%", "function");
+	for (i = 0; i < n_symbols && order[i]->incl; i++){
+		incl = order[i]->incl > total ? total : order[i]->incl;
+		printf("%12llu %6.2f%% %12llu %6.2f%%  %s\n", (unsigned long long)order[i]->ins, 100.0 * order[i]->ins / total,
+			(unsigned long long)incl, 100.0 * incl / total, order[i]->name);
+	}
+
+	printf("\ncall graph (samples taken in the callee, for each call site)\n");
+	for (i = 0; i < n_symbols && order[i]->incl; i++){
+		printf("\n%s\n", order[i]->name);
+		for (k = 0; k < n_edges; k++){
+			e = &edges[k];
+			if (e->to == order[i] && e->from)
+				printf("    called from %12u  %s+0x%x\n", e->count, e->from->name, e->site - e->from->addr);
+			else if (e->to == order[i])
+				printf("    called from %12u  %08x\n", e->count, e->site);
+		}
+		for (k = 0; k < n_edges; k++){
+			e = &edges[k];
+			if (e->from == order[i] && e->to != order[i])
+				printf("    calls       %12u  %s (at +0x%x)\n", e->count, e->to ? e->to->name : "?", e->site - order[i]->addr);
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	FILE *in;
+	char magic[8];
+	uint32_t period, flags, unit, pc = 0, addr = 0, n;
+	uint64_t v, total = 0, loads = 0, stores = 0, records = 0, pending_loads = 0, pending_stores = 0;
+	uint32_t access[4][3], n_access = 0;
+	int32_t dump = 0, per_pc = 0, i, j;
+	struct pc_count *p, *pcs;
+	struct symbol *sym;
+	char *file = NULL, *sym_file = NULL;
+
+	for (i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "-d"))
+			dump = 1;
+		else if (!strcmp(argv[i], "-a"))
+			per_pc = 1;
+		else if (!file)
+			file = argv[i];
+		else
+			sym_file = argv[i];
+	}
+	if (!file){
+		printf("syntax: hf_trace [-d] [-a] trace.bin [symbols]\n");
+		printf("        hf_trace [-a] profile.txt [symbols]\n");
+		return 1;
+	}
+
+	in = fopen(file, "rb");
+	if (!in){
+		printf("error opening trace file.\n");
+		return 1;
+	}
+	if (sym_file)
+		load_symbols(sym_file);
+	table = calloc(table_size, sizeof(struct pc_count));
+	if (fread(magic, 1, 8, in) == 8 && !memcmp(magic, PROF_MAGIC, 8)){
+		rewind(in);
+		return profile(in, file, per_pc);
+	}
+	if (memcmp(magic, TRACE_MAGIC, 8) ||
+		fread(&period, sizeof(period), 1, in) != 1 || fread(&flags, sizeof(flags), 1, in) != 1){
+		printf("not a trace file.\n");
+		return 1;
+	}
+	/* relative pcs in halfwords (compressed instructions) or words */
+	unit = flags & 2 ? 2 : 4;
+
+	while (read_varint(in, &v)){
+		records++;
+		switch (v & 3){
+			case 0:		/* sequential instructions */
+			case 1:		/* one instruction, after a jump */
+				n = (v & 3) ? 1 : v >> 2;
+				for (i = 0; i < n; i++){
+					pc += (v & 3) ? unzigzag(v >> 2) * unit : 4;
+					p = lookup(pc);
+					p->ins += period;
+					/* accesses come before their instruction */
+					p->loads += pending_loads;
+					p->stores += pending_stores;
+					pending_loads = pending_stores = 0;
+					if (dump){
+						printf("%08x\n", pc);
+						for (j = 0; j < n_access; j++)
+							printf("    %s %08x (%d)\n", access[j][2] ? "store" : "load ", access[j][0], access[j][1]);
+						n_access = 0;
+					}
+				}
+				total += (uint64_t)n * period;
+				break;
+			case 2:		/* memory access */
+				addr += unzigzag(v >> 5);
+				if (v & 4){
+					pending_stores += period;
+					stores += period;
+				}else{
+					pending_loads += period;
+					loads += period;
+				}
+				if (dump && n_access < 4){
+					access[n_access][0] = addr;
+					access[n_access][1] = 1 << ((v >> 3) & 3);
+					access[n_access][2] = (v & 4) != 0;
+					n_access++;
+				}
+				break;
+			case 3:		/* marker */
+				n = v >> 2;
+				if (!read_varint(in, &v))
+					break;
+				if (dump)
+					printf("-- %s, counter %u\n", n ? "stop" : "start", (uint32_t)v);
+				break;
+		}
+	}
+	fclose(in);
+
+	printf("trace: %s, one instruction out of %u%s\n", file, period, flags & 1 ? ", memory accesses" : "");
+	printf("records: %llu, instructions: %llu", (unsigned long long)records, (unsigned long long)total);
+	if (flags & 1)
+		printf(", loads: %llu, stores: %llu", (unsigned long long)loads, (unsigned long long)stores);
+	printf("\n\n");
+	if (!total)
+		return 0;
+
+	pcs = malloc(table_used * sizeof(struct pc_count));
+	for (i = 0, j = 0; i < table_size; i++)
+		if (table[i].ins || table[i].loads || table[i].stores)
+			pcs[j++] = table[i];
+
+	if (per_pc || !n_symbols){
+		qsort(pcs, j, sizeof(struct pc_count), cmp_count);
+		printf("%-8s %12s %7s%s\n", "pc", "instructions", "%", flags & 1 ? "      loads     stores" : "");
+		for (i = 0; i < j; i++){
+			printf("%08x ", pcs[i].pc);
+			print_count(pcs[i].ins, pcs[i].loads, pcs[i].stores, total, flags);
+			sym = find_symbol(pcs[i].pc);
+			if (sym)
+				printf("  %s+0x%x", sym->name, pcs[i].pc - sym->addr);
+			printf("\n");
+		}
+		return 0;
+	}
+
+	for (i = 0; i < j; i++){
+		sym = find_symbol(pcs[i].pc);
+		if (sym){
+			sym->ins += pcs[i].ins;
+			sym->loads += pcs[i].loads;
+			sym->stores += pcs[i].stores;
+		}
+	}
+	qsort(symbols, n_symbols, sizeof(struct symbol), cmp_symbol_count);
+	printf("%12s %7s%s  %s\n", "instructions", "%", flags & 1 ? "      loads     stores" : "", "function");
+	for (i = 0; i < n_symbols && symbols[i].ins; i++){
+		print_count(symbols[i].ins, symbols[i].loads, symbols[i].stores, total, flags);
+		printf("  %s\n", symbols[i].name);
+	}
+
+	return 0;
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include "noc.h"
 
 /*
@@ -31,6 +34,15 @@
 #define OUT_FACILITY			0x200000D0	/* not implemented yet */
 #define LOG_FACILITY			0x200000E0
 #define EXIT_TRAP			0x200000F0
+#define NOC_DMA_RX_ADDR			0x20000100	/* DMA reception buffer */
+#define NOC_DMA_TX_ADDR			0x20000110	/* DMA transmission buffer */
+#define NOC_DMA_CTRL			0x20000120	/* DMA start (write) */
+#define NOC_DMA_STATUS			0x20000130	/* DMA busy (read), interrupt ack (write) */
+#define IDLE_HINT			0x20000140	/* idle until an interrupt, for at most n cycles (write) */
+#define CHECKPOINT			0x20000150	/* save the whole system to the checkpoint file (write) */
+
+#define NOC_DMA_RX			0x01
+#define NOC_DMA_TX			0x02
 
 #define IRQ_UART_READ_AVAILABLE		0x01
 #define IRQ_UART_WRITE_AVAILABLE	0x02
@@ -41,6 +53,8 @@
 #define IRQ_GPIO30			0x40
 #define IRQ_GPIO31			0x80
 #define IRQ_NOC_READ			0x100
+#define IRQ_NOC_DMA_RX			0x200
+#define IRQ_NOC_DMA_TX			0x400
 
 #define ENERGY_PER_CYCLE_ARITHMETIC	0.00000000160864
 #define ENERGY_PER_CYCLE_BRANCH_JUMP	0.00000000239897
@@ -142,6 +156,16 @@ static char *class_shift[]={
 unsigned char is_sending[MAX_N_CORES]; // necessary to synchronize with noc simulator 
 unsigned char is_reading[MAX_N_CORES];
 int flits_remaining[MAX_N_CORES]; 
+int flits_packet[MAX_N_CORES];		// flits of the packet being read (plus the dummy read), packets have a variable length
+
+/*
+	NETWORK INTERFACE DMA (one packet per transfer, one flit per cycle). the length of a
+	packet is taken from its payload flit (the second one)
+*/
+unsigned char dma_rx[MAX_N_CORES], dma_tx[MAX_N_CORES];
+unsigned char dma_sending[MAX_N_CORES];	// DMA flit waiting for the interface ack (the cpu keeps running)
+unsigned int dma_rx_addr[MAX_N_CORES], dma_tx_addr[MAX_N_CORES];
+int dma_tx_remaining[MAX_N_CORES];
 extern Router *routers;
 extern NetworkInterface *network_interfaces;
 extern Core *cores;
@@ -164,6 +188,8 @@ double est_energy[MAX_N_CORES];
 unsigned int ins_counter[MAX_N_CORES];
 unsigned int ins_class_counter[6][MAX_N_CORES];
 unsigned int io_counter[MAX_N_CORES];
+unsigned long long idle_until[MAX_N_CORES];	// core waiting (IDLE_HINT) for an interrupt, up to this cycle
+unsigned long long idle_cycles[MAX_N_CORES];	// cycles not interpreted, waiting
 unsigned char brkpt[MAX_N_CORES];
 double bus_est_energy;
 unsigned int flits_sent[MAX_N_CORES];
@@ -172,6 +198,8 @@ unsigned int broadcasts[MAX_N_CORES];
 char logout_string[] = "./reports/logout\0\0\0\0\0\0\0\0\0\0\0";
 char outout_string[] = "./reports/out\0\0\0\0\0\0\0\0\0\0\0";
 FILE *log_out[MAX_N_CORES], *out_out[MAX_N_CORES];
+char *ckpt_file = NULL;
+int ckpt_pending = 0;
 
 char *itoa(unsigned int num){
 	static char buf[12];
@@ -361,6 +389,7 @@ static int show_cpu_stats(unsigned char *output, int cpu_n){
 	fprintf(rpt_ptr, "\n\nInstructions executed: %d", ins_counter[cpu_n]);
 	fprintf(rpt_ptr, "\nEffective instructions per cycle (IPC): %f", ((double)ins_counter[cpu_n]/(double)cpu_cycles[cpu_n]));
 	fprintf(rpt_ptr, "\nI/O wait cycles: %d",io_counter[cpu_n]);
+	fprintf(rpt_ptr, "\nIdle cycles (fast forwarded): %lld",idle_cycles[cpu_n]);
 	fprintf(rpt_ptr, "\n\nInstructions executed from each class:");
 	fprintf(rpt_ptr, "\nArithmetic:  %12d (%f%%)",ins_class_counter[0][cpu_n], (((float)ins_class_counter[0][cpu_n]/(float)ins_counter[cpu_n])*100));
 	fprintf(rpt_ptr, "\nBranch/Jump: %12d (%f%%)",ins_class_counter[1][cpu_n], (((float)ins_class_counter[1][cpu_n]/(float)ins_counter[cpu_n])*100));
@@ -422,15 +451,90 @@ static int show_mpsoc_stats(unsigned char *output){
 	fprintf(rpt_ptr, "\n\nBroadcasts: %ld",k);
 	for(j=0;j<n_cores;j++)
 		fprintf(rpt_ptr, "\n    core %d: %ld",j, flits_received[j]);
+	fprintf(rpt_ptr, "\n\nLink utilization:");
+	report_links(rpt_ptr);
 	fprintf(rpt_ptr, "\n");
 
 	fclose(rpt_ptr);	
 }
 	
 
-static int mem_read(State *s, int size, unsigned int address, int cpu_n){
-	unsigned int value=0, ptr;
-	
+/*
+	MEMORY MAP
+
+	the address space is split in pages of 64KB, each one either memory (mirrored
+	every MEM_SIZE bytes, in the memory of the core) or a device page, with
+	callbacks for its registers. fetches, loads and stores to memory index the map
+	and go straight to the memory of the core, without matching the address
+	against the peripheral registers.
+*/
+#define PAGE_SHIFT			16
+#define PAGE_MASK			((1 << PAGE_SHIFT) - 1)
+#define PAGES				(1 << (32 - PAGE_SHIFT))
+
+struct page {
+	int (*read)(State *s, int size, unsigned int address, int cpu_n);
+	void (*write)(State *s, int size, unsigned int address, unsigned int value, FILE *std_out, int cpu_n);
+	unsigned int offset;				// of the page in the memory of a core
+};
+
+struct page page_map[PAGES];
+
+static inline __attribute__((always_inline)) int ram_read(State *s, int size, unsigned int address, unsigned int offset){
+	unsigned int value=0;
+	unsigned char *ptr = (unsigned char *)s->mem + offset;
+
+	switch(size){
+		case 4:
+			if(address & 3){
+				printf("\nUnaligned access PC=0x%x data=0x%x :(", s->pc, address);
+				fflush(stdout);
+			}
+			value = *(int *)ptr;
+			if(big_endian)
+				value = ntohl(value);
+			break;
+		case 2:
+			value = *(unsigned short *)ptr;
+			if(big_endian)
+				value = ntohs((unsigned short)value);
+			break;
+		case 1:
+			value = *ptr;
+			break;
+		default:
+			printf("ERROR");
+			fflush(stdout);
+	}
+
+	return(value);
+}
+
+static inline __attribute__((always_inline)) void ram_write(State *s, int size, unsigned int address, unsigned int offset, unsigned int value){
+	unsigned char *ptr = (unsigned char *)s->mem + offset;
+
+	switch(size){
+		case 4:
+			if(big_endian)
+				value = htonl(value);
+			*(int *)ptr = value;
+			break;
+		case 2:
+			if(big_endian)
+				value = htons((unsigned short)value);
+			*(short *)ptr = (unsigned short)value;
+			break;
+		case 1:
+			*ptr = (unsigned char)value;
+			break;
+		default:
+			printf("ERROR");
+			fflush(stdout);
+	}
+}
+
+/* peripheral registers, other addresses of the page are memory */
+static int io_read(State *s, int size, unsigned int address, int cpu_n){
 	Core *core;
 	NetworkInterface *ni;
 	Buffer *buffer;
@@ -464,7 +568,7 @@ static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 
 			core = getCore(cpu_n);
 			port = &(core->port);
-			if(flits_remaining[cpu_n] == OS_PACKET_SIZE+1)
+			if(flits_remaining[cpu_n] == flits_packet[cpu_n])
 			{
 				flits_remaining[cpu_n]--;
 				return 0;
@@ -491,39 +595,21 @@ static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 			return HWMemory[4][cpu_n];
 		case LOG_FACILITY:
 			return 0xa5a5a5a5;
+		case NOC_DMA_RX_ADDR:
+			return dma_rx_addr[cpu_n];
+		case NOC_DMA_TX_ADDR:
+			return dma_tx_addr[cpu_n];
+		case NOC_DMA_STATUS:
+			return (dma_rx[cpu_n] ? NOC_DMA_RX : 0) | (dma_tx[cpu_n] ? NOC_DMA_TX : 0);
 	}
 
-	ptr = (unsigned int)s->mem + (address % MEM_SIZE);
-
-	switch(size){
-		case 4:
-			if(address & 3){
-				printf("\nUnaligned access PC=0x%x data=0x%x :(", s->pc, address);
-				fflush(stdout);
-			}
-			value = *(int*)ptr;
-			if(big_endian)
-				value = ntohl(value);
-			break;
-		case 2:
-			value = *(unsigned short*)ptr;
-			if(big_endian)
-				value = ntohs((unsigned short)value);
-			break;
-		case 1:
-			value = *(unsigned char*)ptr;
-			break;
-		default:
-			printf("ERROR");
-			fflush(stdout);
-	}
-
-	return(value);
+	return ram_read(s, size, address, address % MEM_SIZE);
 }
 
-static void mem_write(State *s, int size, int unsigned address, unsigned int value, FILE *std_out, int cpu_n){
+static inline int mem_read(State *s, int size, unsigned int address, int cpu_n);
+
+static void io_write(State *s, int size, unsigned int address, unsigned int value, FILE *std_out, int cpu_n){
 	static char_count=0;
-	unsigned int ptr;
 	
 	Core *core;
 	Port *port;	
@@ -606,6 +692,34 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 				}
 			}
 			return;
+		case NOC_DMA_RX_ADDR:
+			dma_rx_addr[cpu_n] = value;
+			return;
+		case NOC_DMA_TX_ADDR:
+			dma_tx_addr[cpu_n] = value;
+			return;
+		case NOC_DMA_CTRL:
+			if (value & NOC_DMA_RX){
+				HWMemory[2][cpu_n] &= ~IRQ_NOC_READ;
+				dma_rx[cpu_n] = ON;
+			}
+			if (value & NOC_DMA_TX){
+				dma_tx[cpu_n] = ON;
+				dma_tx_remaining[cpu_n] = (mem_read(s, 2, dma_tx_addr[cpu_n] + 2, cpu_n) & 0xffff) + 2;
+				if (dma_tx_remaining[cpu_n] > OS_PACKET_SIZE)
+					dma_tx_remaining[cpu_n] = OS_PACKET_SIZE;
+			}
+			return;
+		case NOC_DMA_STATUS:
+			HWMemory[2][cpu_n] &= ~(value & (IRQ_NOC_DMA_RX | IRQ_NOC_DMA_TX));
+			return;
+		case IDLE_HINT:
+			idle_until[cpu_n] = cpu_cycles[cpu_n] + value + 1;
+			return;
+		case CHECKPOINT:
+			if (ckpt_file)
+				ckpt_pending = 1;
+			return;
 		case EXIT_TRAP:
 			printf("[BP, CPU %d]", cpu_n);
 			fflush(stdout);
@@ -613,26 +727,155 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 			return;
 	}
 
-	ptr = (unsigned int)s->mem + (address % MEM_SIZE);
+	ram_write(s, size, address, address % MEM_SIZE, value);
+}
 
-	switch(size){
-		case 4:
-			if(big_endian)
-				value = htonl(value);
-			*(int*)ptr = value;
-			break;
-		case 2:
-			if(big_endian)
-				value = htons((unsigned short)value);
-			*(short*)ptr = (unsigned short)value;
-			break;
-		case 1:
-			*(char*)ptr = (unsigned char)value;
+static void map_init(void){
+	unsigned int i;
+
+	for (i = 0; i < PAGES; i++){
+		page_map[i].read = NULL;
+		page_map[i].write = NULL;
+		page_map[i].offset = (i << PAGE_SHIFT) % MEM_SIZE;
+	}
+	page_map[MISC_BASE >> PAGE_SHIFT].read = io_read;
+	page_map[MISC_BASE >> PAGE_SHIFT].write = io_write;
+}
+
+static inline __attribute__((always_inline)) int mem_read(State *s, int size, unsigned int address, int cpu_n){
+	struct page *p = &page_map[address >> PAGE_SHIFT];
+
+	if (p->read)
+		return p->read(s, size, address, cpu_n);
+
+	return ram_read(s, size, address, p->offset + (address & PAGE_MASK));
+}
+
+static inline __attribute__((always_inline)) void mem_write(State *s, int size, unsigned int address, unsigned int value, FILE *std_out, int cpu_n){
+	struct page *p = &page_map[address >> PAGE_SHIFT];
+
+	if (p->write)
+		p->write(s, size, address, value, std_out, cpu_n);
+	else
+		ram_write(s, size, address, p->offset + (address & PAGE_MASK), value);
+}
+
+/*
+	PROFILER
+
+	with -P <interval>, the pc of each core is sampled every interval cycles. calls
+	(JAL, JALR linking $31) and returns (JR $31) are tracked on a shadow stack per
+	core, and each sample is also counted on the call edges of the stack. a return
+	to an address not on the stack (a context switch) empties it. profiles are
+	written to ./reports/profile<n>.txt, as samples ("s pc count") and call edges
+	("c site callee count"), and hf_trace symbolizes them.
+*/
+#define PROF_STACK			64
+
+struct prof_entry {
+	unsigned int a, b, count;
+};
+
+struct prof_table {
+	struct prof_entry *e;
+	unsigned int size, used;
+};
+
+struct prof {
+	unsigned long long next;
+	struct prof_table pcs, edges;
+	unsigned int site[PROF_STACK], callee[PROF_STACK], ret[PROF_STACK];
+	int depth;		// frames above PROF_STACK are not kept
+};
+
+static struct prof prof[MAX_N_CORES];
+static unsigned int prof_interval = 0;
+
+static void prof_add(struct prof_table *t, unsigned int a, unsigned int b, unsigned int count){
+	struct prof_entry *old;
+	unsigned int i, n;
+
+	if (t->used * 2 >= t->size){
+		old = t->e;
+		n = t->size;
+		t->size = n ? n * 2 : 4096;
+		t->e = calloc(t->size, sizeof(struct prof_entry));
+		t->used = 0;
+		for (i = 0; i < n; i++)
+			if (old[i].count)
+				prof_add(t, old[i].a, old[i].b, old[i].count);
+		free(old);
+	}
+	i = ((a >> 2) ^ (b * 31)) * 2654435761u & (t->size - 1);
+	while (t->e[i].count && (t->e[i].a != a || t->e[i].b != b))
+		i = (i + 1) & (t->size - 1);
+	if (!t->e[i].count){
+		t->e[i].a = a;
+		t->e[i].b = b;
+		t->used++;
+	}
+	t->e[i].count += count;
+}
+
+static void prof_call(int cpu_n, unsigned int site, unsigned int callee, unsigned int ret){
+	struct prof *p = &prof[cpu_n];
+
+	if (p->depth < PROF_STACK){
+		p->site[p->depth] = site;
+		p->callee[p->depth] = callee;
+		p->ret[p->depth] = ret;
+	}
+	p->depth++;
+}
+
+static void prof_return(int cpu_n, unsigned int target){
+	struct prof *p = &prof[cpu_n];
+	int i;
+
+	if (p->depth > PROF_STACK){
+		p->depth--;
+		return;
+	}
+	for (i = p->depth - 1; i >= 0; i--)
+		if (p->ret[i] == target)
 			break;
-		default:
-			printf("ERROR");
-			fflush(stdout);
+	p->depth = i < 0 ? 0 : i;
+}
+
+// cycles skipped (fast forward) are counted on the same pc
+static void prof_sample(int cpu_n, unsigned int pc){
+	struct prof *p = &prof[cpu_n];
+	unsigned int n;
+	int i;
+
+	n = (cpu_cycles[cpu_n] - p->next) / prof_interval + 1;
+	p->next += (unsigned long long)n * prof_interval;
+	prof_add(&p->pcs, pc, 0, n);
+	for (i = 0; i < p->depth && i < PROF_STACK; i++)
+		prof_add(&p->edges, p->site[i], p->callee[i], n);
+}
+
+static void prof_write(int cpu_n){
+	struct prof *p = &prof[cpu_n];
+	char file[64];
+	FILE *out;
+	unsigned int i;
+
+	sprintf(file, "./reports/profile%d.txt", cpu_n);
+	out = fopen(file, "wb");
+	if (out == NULL){
+		printf("\nCould not open %s for writing.\n", file);
+		fflush(stdout);
+		return;
 	}
+	fprintf(out, "# hf_prof interval %u\n", prof_interval);
+	for (i = 0; i < p->pcs.size; i++)
+		if (p->pcs.e[i].count)
+			fprintf(out, "s %08x %u\n", p->pcs.e[i].a, p->pcs.e[i].count);
+	for (i = 0; i < p->edges.size; i++)
+		if (p->edges.e[i].count)
+			fprintf(out, "c %08x %08x %u\n", p->edges.e[i].a, p->edges.e[i].b, p->edges.e[i].count);
+	fclose(out);
 }
 
 void mult_big_unsigned(unsigned int a, unsigned int b, unsigned int *hi, unsigned int *lo){
@@ -770,11 +1013,15 @@ void cycle(State *s, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles,
 					est_energy[cpu_n]+=ENERGY_PER_CYCLE_SHIFT*2;
 					break;
 				case 0x08:/*JR*/
+					if (prof_interval && rs == 31)
+						prof_return(cpu_n, r[rs]);
 					s->jump_or_branch = 1;
 					s->pc_next=r[rs];
 					est_energy[cpu_n]+=ENERGY_PER_CYCLE_BRANCH_JUMP;
 					break;
 				case 0x09:/*JALR*/
+					if (prof_interval && rd == 31)
+						prof_call(cpu_n, s->pc - 4, r[rs], s->pc_next);
 					s->jump_or_branch = 1;
 					r[rd]=s->pc_next;
 					s->pc_next=r[rs];
@@ -931,6 +1178,8 @@ void cycle(State *s, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles,
 			ins_counter_rt[rt][cpu_n]++;
 			break;
 			case 0x03:/*JAL*/
+				if (prof_interval)
+					prof_call(cpu_n, s->pc - 4, (s->pc&0xf0000000)|target, s->pc_next);
 				r[31]=s->pc_next;
 			case 0x02:/*J*/
 				s->jump_or_branch = 1;
@@ -1120,101 +1369,469 @@ void cycle(State *s, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles,
 	}
 }
 
-int do_debug(State *s[], FILE *std_out[]){
-	int ch;
-	unsigned char mem;
-	int i, j=0, watch=0, addr, k=0, l, m, n[MAX_N_CORES];
-	int pause_cpu[MAX_N_CORES];
-	int irq_counter[MAX_N_CORES];
-	char report_string[]= "./reports/report\0\0\0\0\0\0\0\0\0\0";
-	unsigned long long gcycles = 0;
-
+/*
+	SIMULATION LOOP
+*/
+static int pause_cpu[MAX_N_CORES];
+static int irq_counter[MAX_N_CORES];
+static unsigned char halted[MAX_N_CORES];	// core stopped (breakpoint or cycle limit)
+static unsigned long long start_cycles = 0;	// first cycle of the simulation (restored)
+static int restored = 0;
+
+// timer, uart, DMA and NoC interrupt of a core, before the network is synchronized
+static void core_devices(State *s, FILE *std_out, int j){
 	Core *core;
 	NetworkInterface *ni;
 	Buffer *buffer;
 	Port *port;
 
-	for(j=0;j<MAX_N_CORES;j++){
-		l = -1;
-		m = -1;
-		n[j] = 0;
+	if ((cpu_cycles[j] & ((long long)HWMemory[4][j] - 1)) == ((long long)HWMemory[4][j] - 1)){
+		if (HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)){
+//		if ((HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)) && ((HWMemory[2][j] & IRQ_NOC_READ) == 0) ){
+			if(s->status == 1) irq_counter[j] = 1;
+		}
+		if (HWMemory[2][j] & IRQ_COUNTER18){
+			HWMemory[2][j] &= ~IRQ_COUNTER18;
+			HWMemory[2][j] |= IRQ_COUNTER18_NOT;
+		}else{
+			HWMemory[2][j] &= ~IRQ_COUNTER18_NOT;
+			HWMemory[2][j] |= IRQ_COUNTER18;
+		}
+	}
+
+	if ((!(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE)) && (uart_delay[j]) > 0){
+		uart_delay[j]--;
+		io_counter[j]++;
+	}else{
+		uart_delay[j] = UART_DELAY;
+		HWMemory[2][j] |= IRQ_UART_WRITE_AVAILABLE;
+	}
+
+	core = getCore(j);
+	port = &(core->port);
+	ni = getNetworkInterface(j);
+	buffer = getBuffer(ni, NOC);
+
+	// DMA engine: moves a flit per cycle between memory and the core port
+	if(dma_rx[j] == ON)
+	{
+		if(flits_remaining[j] == flits_packet[j])
+		{
+			flits_remaining[j]--;
+		}
+		else if(port->in_request == ON && port->in_ack == OFF)
+		{
+			port->in_ack = ON;
+			flits_remaining[j]--;
+			mem_write(s, 2, dma_rx_addr[j], port->in, std_out, j);
+			dma_rx_addr[j] += 2;
+			if(flits_remaining[j] == 0)
+			{
+				dma_rx[j] = OFF;
+				HWMemory[2][j] |= IRQ_NOC_DMA_RX;
+			}
+		}
+	}
+	if(dma_tx[j] == ON && dma_sending[j] == OFF && is_sending[j] == OFF)
+	{
+		if(dma_tx_remaining[j] > 0)
+		{
+			dma_sending[j] = ON;
+			port->out = mem_read(s, 2, dma_tx_addr[j], j);
+			port->out_request = ON;
+			port->out_ack = OFF;
+			dma_tx_addr[j] += 2;
+			dma_tx_remaining[j]--;
+		}
+		else
+		{
+			dma_tx[j] = OFF;
+			HWMemory[2][j] |= IRQ_NOC_DMA_TX;
+		}
+	}
+	if((HWMemory[2][j] & HWMemory[1][j] & (IRQ_NOC_DMA_RX | IRQ_NOC_DMA_TX)) && s->status == 1)
+	{
+		irq_counter[j] = 1;
+	}
+
+	if(packetReady(buffer) && port->in_request == ON && flits_remaining[j] == 0 && dma_rx[j] == OFF)//&& irq_counter[j] == 0)
+	// to create a noc interrupt a whole packet must be on the buffer, requesting to send the first flit,
+	// there also can't be any thing on the idle buffer and a clock interrupt can't be generated at the same cycle
+	{
+		if(HWMemory[1][j] & IRQ_NOC_READ)
+		// não mascarada					
+		{
+			if(s->status == 1)
+			// interrupções habilitadas
+			{
+				flits_packet[j] = packetReady(buffer) + 1;
+				flits_remaining[j] = flits_packet[j];
+//				irq_counter[j] = 1;
+				irq_counter[j] = 2;
+				HWMemory[2][j] |= IRQ_NOC_READ;
+			}
+		}
+	}
+}
+
+// releases the core port once the network interface took the flit
+static void core_release(int j){
+	Core *core;
+	Port *port;
+
+	if(is_sending[j] == ON)
+	{
+		core = getCore(j);
+		port = &(core->port);
+		if(port->out_ack == ON)
+		{
+			port->out = 0;
+			port->out_request = OFF;
+			port->out_ack = OFF;
+			is_sending[j] = OFF;
+		}
+	}
+	if(dma_sending[j] == ON)
+	{
+		core = getCore(j);
+		port = &(core->port);
+		if(port->out_ack == ON)
+		{
+			port->out = 0;
+			port->out_request = OFF;
+			port->out_ack = OFF;
+			dma_sending[j] = OFF;
+		}
+	}
+}
+
+/*
+	a core waiting on IDLE_HINT is not interpreted until an interrupt is pending (the
+	interrupt wakes it up) or the hinted cycles are over. cycles are still counted, and
+	the idle loop would only have run until then.
+*/
+static void core_step(State *s, FILE *std_out, int j){
+	if (irq_counter[j])
+		idle_until[j] = 0;
+	if (brkpt[j] == 0){			
+		if (pause_cpu[j] == 0 && is_sending[j] == OFF && idle_until[j] > cpu_cycles[j])
+			idle_cycles[j]++;
+		else if (pause_cpu[j] == 0 && is_sending[j] == OFF)
+			cycle(s, 0, j, std_out, &pause_cpu[j], &irq_counter[j]);
+		else if(pause_cpu[j] >= 1)
+			pause_cpu[j]--;
+
+		if (prof_interval && cpu_cycles[j] >= prof[j].next)
+			prof_sample(j, s->pc);
+		if (cpu_cycles[j] >= max_cycles){
+			brkpt[j] = 1;
+		}
+		cpu_cycles[j]++;
+	}else{
+		halted[j] = 1;
+	}		
+}
+
+#ifndef BUS
+/*
+	when all cores are halted or waiting on IDLE_HINT and no flit is on the network,
+	the next cycles only count time until the first core event (a timer interrupt, the
+	end of a hint or the cycle limit), and are skipped at once: cycle counters advance
+	and routers only move their arbiters. returns the number of cycles skipped.
+*/
+static unsigned long long fast_forward(State *s[], unsigned long long gcycles){
+	unsigned long long k = -1, d, m;
+	int j;
+
+	for(j=0;j<n_cores;j++){
+		if (brkpt[j]){
+			if (halted[j] == 0) return 0;
+			continue;
+		}
+		if (idle_until[j] <= cpu_cycles[j] || irq_counter[j] || pause_cpu[j]) return 0;
+		if (is_sending[j] || dma_sending[j] || dma_rx[j] || dma_tx[j]) return 0;
+		if (!(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE)) return 0;
+		if ((HWMemory[2][j] & HWMemory[1][j] & (IRQ_NOC_DMA_RX | IRQ_NOC_DMA_TX)) && s[j]->status == 1) return 0;
+		m = (unsigned long long)HWMemory[4][j] - 1;
+		if (HWMemory[4][j] & m) return 0;
+		d = (cpu_cycles[j] | m) - cpu_cycles[j];
+		if (d < k) k = d;
+		d = idle_until[j] - cpu_cycles[j];
+		if (d < k) k = d;
+		d = max_cycles > cpu_cycles[j] ? max_cycles - cpu_cycles[j] : 0;
+		if (d < k) k = d;
+	}
+	if (k == 0 || k == (unsigned long long)-1) return 0;
+	for(j=0;j<N_CORES;j++)
+		if (!idleRouter(j) || !idleNetworkInterface(j)) return 0;
+
+	d = (gcycles + k) / CPU_NETWORK_CLK_RATIO - gcycles / CPU_NETWORK_CLK_RATIO;
+	for(j=0;j<N_CORES;j++)
+		skipRouter(j, d);
+	for(j=0;j<n_cores;j++){
+		if (brkpt[j]) continue;
+		cpu_cycles[j] += k;
+		idle_cycles[j] += k;
+		uart_delay[j] = UART_DELAY;
+	}
+
+	return k;
+}
+
+/*
+	PARALLEL SIMULATION
+
+	each host thread simulates a group of consecutive cores, with their network
+	interfaces and routers. the cores, interfaces and local router ports of a group
+	only talk to each other, so a thread steps them on its own. routers only exchange
+	flits on router cycles (one every CPU_NETWORK_CLK_RATIO cycles), and links between
+	two router cycles are synchronized once (see synchronizeRouterLinks()). the threads
+	meet on two barriers around each router cycle: the first one after every router
+	of the last router cycle is done, before the links are synchronized, the second one
+	after all links are synchronized, before the routers cycle. this is the same order
+	of events of the sequential loop, so results are cycle accurate for any number of
+	threads. the only exception is a clock frequency reconfiguration, as it changes
+	the cycle limit of all cores. cores waiting on IDLE_HINT are not interpreted, but
+	the whole system is only fast forwarded by the sequential loop.
+*/
+struct sim_thread {
+	pthread_t thread;
+	int first, last;	// cores, interfaces and routers [first, last)
+	int done;		// all cores of the group halted, written before the first barrier
+	int sense;
+	State **s;
+	FILE **std_out;
+};
+
+static struct sim_thread threads[MAX_N_CORES];
+static int n_threads=1;
+static volatile int barrier_count, barrier_sense;
+
+// sense reversing barrier. spins for a while, as barriers are frequent, then yields
+static void barrier_wait(struct sim_thread *t){
+	int spin = 0;
+
+	t->sense = !t->sense;
+	if (__sync_sub_and_fetch(&barrier_count, 1) == 0){
+		barrier_count = n_threads;
+		__atomic_store_n(&barrier_sense, t->sense, __ATOMIC_RELEASE);
+	}else{
+		while (__atomic_load_n(&barrier_sense, __ATOMIC_ACQUIRE) != t->sense)
+			if (++spin > 1000) sched_yield();
+	}
+}
+
+static void *sim_thread(void *arg){
+	struct sim_thread *t = arg;
+	unsigned long long gcycles = start_cycles;
+	int i, j;
+
+	while(1){
+		for(j=t->first;j<t->last && j<n_cores;j++)
+			if (brkpt[j] == 0)
+				core_devices(t->s[j], t->std_out[j], j);
+
+		gcycles++;
+
+		for(j=t->first;j<t->last && j<n_cores;j++)
+			core_release(j);
+
+		if (gcycles % CPU_NETWORK_CLK_RATIO == 0){
+			for(j=t->first;j<t->last && j<n_cores;j++)
+				if (halted[j] == 0) break;
+			t->done = (j == t->last || j == n_cores);
+			barrier_wait(t);
+			for(i=0;i<n_threads;i++)
+				if (threads[i].done == 0) break;
+			if (i == n_threads)
+				return NULL;
+			for(j=t->first;j<t->last;j++)
+				synchronizeRouterLinks(j);
+		}
+
+		for(j=t->first;j<t->last;j++){
+			synchronizeRouterLocal(j);
+			synchronizeNetworkInterface(j);
+			synchronizeCore(j);
+		}
+
+		if (gcycles % CPU_NETWORK_CLK_RATIO == 0){
+			barrier_wait(t);
+			for(j=t->first;j<t->last;j++)
+				cycleRouter(j);
+		}
+		for(j=t->first;j<t->last;j++)
+			cycleNetworkInterface(j);
+
+		for(j=t->first;j<t->last && j<n_cores;j++)
+			core_step(t->s[j], t->std_out[j], j);
+	}
+}
+
+/*
+	stops when all cores are halted. threads only agree on that on a router cycle, so
+	they may run a few cycles past the last core halted, but these only step the
+	network interfaces and do not show in the reports.
+*/
+static void run_threads(State *s[], FILE *std_out[]){
+	int i;
+
+	barrier_count = n_threads;
+	barrier_sense = 0;
+	for(i=0;i<n_threads;i++){
+		threads[i].first = i * N_CORES / n_threads;
+		threads[i].last = (i + 1) * N_CORES / n_threads;
+		threads[i].done = 0;
+		threads[i].sense = 0;
+		threads[i].s = s;
+		threads[i].std_out = std_out;
+	}
+	for(i=1;i<n_threads;i++){
+		if (pthread_create(&threads[i].thread, NULL, sim_thread, &threads[i])){
+			printf("\nCould not create simulation thread %d.\n", i);
+			fflush(stdout);
+			exit(-1);
+		}
+	}
+	sim_thread(&threads[0]);
+	for(i=1;i<n_threads;i++)
+		pthread_join(threads[i].thread, NULL);
+}
+#endif
+
+/*
+	CHECKPOINTS
+
+	a write to CHECKPOINT on any core saves the whole system (cpu contexts, memories,
+	interrupt controllers, timers, DMA, statistics, routers, network interfaces and their
+	buffers) to the file given with -c, at the end of the simulation cycle. -r starts
+	from a saved system instead of the object codes: reports keep counting from the
+	boot, the cycle limit counts from the checkpoint. files are meant for the same
+	simulator build, NoC options (-R, -B) and platform only.
+*/
+#define CKPT_MAGIC			"MPSOCKP3"
+
+struct ckpt_var {
+	void *addr;
+	size_t size;
+};
+
+static struct ckpt_var ckpt_vars[] = {
+	{is_sending, sizeof(is_sending)}, {is_reading, sizeof(is_reading)},
+	{flits_remaining, sizeof(flits_remaining)}, {flits_packet, sizeof(flits_packet)}, {dma_rx, sizeof(dma_rx)},
+	{dma_tx, sizeof(dma_tx)}, {dma_sending, sizeof(dma_sending)},
+	{dma_rx_addr, sizeof(dma_rx_addr)}, {dma_tx_addr, sizeof(dma_tx_addr)},
+	{dma_tx_remaining, sizeof(dma_tx_remaining)}, {&reference_clock, sizeof(reference_clock)},
+	{HWMemory, sizeof(HWMemory)}, {GPIOAIN, sizeof(GPIOAIN)}, {GPIO0OUT, sizeof(GPIO0OUT)},
+	{cpu_cycles, sizeof(cpu_cycles)}, {ins_counter_op, sizeof(ins_counter_op)},
+	{ins_counter_func, sizeof(ins_counter_func)}, {ins_counter_rt, sizeof(ins_counter_rt)},
+	{uart_delay, sizeof(uart_delay)}, {est_energy, sizeof(est_energy)},
+	{ins_counter, sizeof(ins_counter)}, {ins_class_counter, sizeof(ins_class_counter)},
+	{io_counter, sizeof(io_counter)}, {idle_until, sizeof(idle_until)},
+	{idle_cycles, sizeof(idle_cycles)}, {brkpt, sizeof(brkpt)},
+	{&bus_est_energy, sizeof(bus_est_energy)}, {flits_sent, sizeof(flits_sent)},
+	{flits_received, sizeof(flits_received)}, {broadcasts, sizeof(broadcasts)},
+	{pause_cpu, sizeof(pause_cpu)}, {irq_counter, sizeof(irq_counter)},
+	{halted, sizeof(halted)}
+};
+
+// simulator build and NoC options (set in main()), checked on restore
+static unsigned int ckpt_config[] = {
+	N_CORES, NOC_BUFFER_SIZE, OS_PACKET_SIZE, MEM_SIZE, ROUTERSIZE, sizeof(State), sizeof(Router), XY
+};
+
+static void checkpoint_save(State *s[], unsigned long long gcycles){
+	FILE *out;
+	int j;
+
+	out = fopen(ckpt_file, "wb");
+	if (out == NULL){
+		printf("\nCould not open %s for writing.\n", ckpt_file);
+		fflush(stdout);
+		exit(-1);
+	}
+	fwrite(CKPT_MAGIC, 1, 8, out);
+	fwrite(ckpt_config, sizeof(ckpt_config), 1, out);
+	fwrite(&n_cores, sizeof(n_cores), 1, out);
+	fwrite(&gcycles, sizeof(gcycles), 1, out);
+	for(j=0;j<n_cores;j++)
+		fwrite(s[j], sizeof(State), 1, out);
+	fwrite(SRAM, MEM_SIZE, n_cores, out);
+	for(j=0;j<sizeof(ckpt_vars)/sizeof(ckpt_vars[0]);j++)
+		fwrite(ckpt_vars[j].addr, ckpt_vars[j].size, 1, out);
+	save_architecture(out);
+	fclose(out);
+
+	printf("\nCheckpoint saved to %s at cycle %lld", ckpt_file, gcycles);
+	fflush(stdout);
+}
+
+// the architecture must be loaded. returns 0 on success
+static int checkpoint_restore(State *s[], char *file){
+	FILE *in;
+	char magic[8];
+	unsigned int config[sizeof(ckpt_config)/sizeof(ckpt_config[0])];
+	int j, ok;
+
+	in = fopen(file, "rb");
+	if (in == NULL)
+		return -1;
+	ok = fread(magic, 1, 8, in) == 8 && memcmp(magic, CKPT_MAGIC, 8) == 0 &&
+		fread(config, sizeof(config), 1, in) == 1 && memcmp(config, ckpt_config, sizeof(config)) == 0 &&
+		fread(&n_cores, sizeof(n_cores), 1, in) == 1 && n_cores > 0 && n_cores <= N_CORES &&
+		fread(&start_cycles, sizeof(start_cycles), 1, in) == 1;
+	for(j=0;ok && j<n_cores;j++){
+		ok = fread(s[j], sizeof(State), 1, in) == 1;
+		s[j]->mem = &SRAM[j*MEM_SIZE];
+	}
+	ok = ok && fread(SRAM, MEM_SIZE, n_cores, in) == n_cores;
+	for(j=0;ok && j<sizeof(ckpt_vars)/sizeof(ckpt_vars[0]);j++)
+		ok = fread(ckpt_vars[j].addr, ckpt_vars[j].size, 1, in) == 1;
+	ok = ok && restore_architecture(in) == 0;
+	fclose(in);
+	restored = 1;
+
+	return ok ? 0 : -1;
+}
+
+int do_debug(State *s[], FILE *std_out[]){
+	int j;
+	char report_string[]= "./reports/report\0\0\0\0\0\0\0\0\0\0";
+	unsigned long long gcycles = start_cycles;
+
+	for(j=0;j<MAX_N_CORES && !restored;j++){
+		halted[j] = 0;
 		pause_cpu[j] = 0;
 		irq_counter[j] = 0;
 	}
 
-	for(j=0;j<n_cores;j++){
+	for(j=0;j<n_cores;j++)
+		prof[j].next = cpu_cycles[j];
+
+	for(j=0;j<n_cores && !restored;j++){
 		s[j]->pc_next = s[j]->pc + 4;
 		s[j]->skip = 0;
 		s[j]->wakeup = 0;
 		cycle(s[j], 0, j, std_out[j], &pause_cpu[j], &irq_counter[j]);
 	}
 
+#ifndef BUS
+	if (n_threads > 1)
+		run_threads(s, std_out);
+	else
+#endif
 	while(1){
-		for(j=0;j<n_cores;j++){
-			if (brkpt[j] == 0){
-				if ((cpu_cycles[j] & ((long long)HWMemory[4][j] - 1)) == ((long long)HWMemory[4][j] - 1)){
-					if (HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)){
-//					if ((HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)) && ((HWMemory[2][j] & IRQ_NOC_READ) == 0) ){
-						if(s[j]->status == 1) irq_counter[j] = 1;
-					}
-					if (HWMemory[2][j] & IRQ_COUNTER18){
-						HWMemory[2][j] &= ~IRQ_COUNTER18;
-						HWMemory[2][j] |= IRQ_COUNTER18_NOT;
-					}else{
-						HWMemory[2][j] &= ~IRQ_COUNTER18_NOT;
-						HWMemory[2][j] |= IRQ_COUNTER18;
-					}
-				}
-
-				if ((!(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE)) && (uart_delay[j]) > 0){
-					uart_delay[j]--;
-					io_counter[j]++;
-				}else{
-					uart_delay[j] = UART_DELAY;
-					HWMemory[2][j] |= IRQ_UART_WRITE_AVAILABLE;
-				}
-
-				core = getCore(j);
-				port = &(core->port);
-				ni = getNetworkInterface(j);
-				buffer = getBuffer(ni, NOC);
-				if(isFull(buffer) && port->in_request == ON && flits_remaining[j] == 0 )//&& irq_counter[j] == 0)
-				// to create a noc interrupt the buffer need to be full and requesing to send the first flit,
-				// there also can't be any thing on the idle buffer and a clock interrupt can't be generated at the same cycle
-				{
-					if(HWMemory[1][j] & IRQ_NOC_READ)
-					// não mascarada					
-					{
-						if(s[j]->status == 1)
-						// interrupções habilitadas
-						{
-							flits_remaining[j] = OS_PACKET_SIZE+1;
-//							irq_counter[j] = 1;
-							irq_counter[j] = 2;
-							HWMemory[2][j] |= IRQ_NOC_READ;
-						}
-					}
-				}
-			}
-		}
+#ifndef BUS
+		gcycles += fast_forward(s, gcycles);
+#endif
+		for(j=0;j<n_cores;j++)
+			if (brkpt[j] == 0)
+				core_devices(s[j], std_out[j], j);
 
 		gcycles++;
 
 		for(j=0;j<n_cores;j++)
-		{
-			if(is_sending[j] == ON)
-			{
-				core = getCore(j);
-				port = &(core->port);
-				if(port->out_ack == ON)
-				{
-					port->out = 0;
-					port->out_request = OFF;
-					port->out_ack = OFF;
-					is_sending[j] = OFF;
-				}
-			}
-		}
+			core_release(j);
 		
 #ifndef BUS
 		for(j=0;j<N_CORES;j++){
@@ -1241,33 +1858,29 @@ int do_debug(State *s[], FILE *std_out[]){
 		}
 #endif
 
-		for(j=0;j<n_cores;j++){					
-			if (brkpt[j] == 0){			
-				if (pause_cpu[j] == 0 && is_sending[j] == OFF)
-					cycle(s[j], 0, j, std_out[j], &pause_cpu[j], &irq_counter[j]);
-				else if(pause_cpu[j] >= 1)
-					pause_cpu[j]--;
+		for(j=0;j<n_cores;j++)
+			core_step(s[j], std_out[j], j);
 
-				if (cpu_cycles[j] >= max_cycles){
-					brkpt[j] = 1;
-				}
-				cpu_cycles[j]++;
-			}else{
-				n[j] = 1;
-			}		
+		if (ckpt_pending){
+			ckpt_pending = 0;
+			checkpoint_save(s, gcycles);
 		}
+
 		for(j=0;j<n_cores;j++)
-			if (n[j] == 0) break;
-		if (j == n_cores){
-			printf("\n");
-			for(j=0;j<n_cores;j++){
-				show_cpu_stats(strcat(strcat(report_string, itoa(j)),".txt"),j);
-				strcpy(report_string, "./reports/report\0\0\0\0\0\0\0\0\0\0\0");
-			}
-			show_mpsoc_stats("./reports/mpsoc.txt");
-			return 0;
-		}
+			if (halted[j] == 0) break;
+		if (j == n_cores)
+			break;
+	}
+
+	printf("\n");
+	for(j=0;j<n_cores;j++){
+		show_cpu_stats(strcat(strcat(report_string, itoa(j)),".txt"),j);
+		strcpy(report_string, "./reports/report\0\0\0\0\0\0\0\0\0\0\0");
 	}
+	show_mpsoc_stats("./reports/mpsoc.txt");
+	for(j=0;j<n_cores && prof_interval;j++)
+		prof_write(j);
+	return 0;
 }
 
 int main(int argc,char *argv[]){
@@ -1276,8 +1889,11 @@ int main(int argc,char *argv[]){
 	FILE *in[MAX_N_CORES];
 	FILE *std_out[MAX_N_CORES];
 	int bytes, index;
-	clock_t time;
-	int i,j;
+	struct timespec start, end;
+	long time;
+	unsigned int clock;
+	char *restore = NULL;
+	int i,j,n;
 	char filename_string[] = "./objects/code\0\0\0\0\0\0\0\0\0\0\0";
 	char stdout_string[] = "./reports/stdout\0\0\0\0\0\0\0\0\0\0\0";
 
@@ -1288,7 +1904,12 @@ int main(int argc,char *argv[]){
 	for(j=0;j<MAX_N_CORES;j++){
 		is_sending[j] = 0;
 		is_reading[j] = 0;
+		dma_rx[j] = 0;
+		dma_tx[j] = 0;
+		dma_sending[j] = 0;
+		dma_tx_remaining[j] = 0;
 		flits_remaining[j] = 0;
+		flits_packet[j] = 0;
 		
 		s[j] = &context[j];
 		memset(s[j], 0, sizeof(State));
@@ -1315,16 +1936,63 @@ int main(int argc,char *argv[]){
 		for(i=0;i<6;i++)
 			ins_class_counter[i][j] = 0;
 		io_counter[j] = 0;
+		idle_until[j] = 0;
+		idle_cycles[j] = 0;
 		brkpt[j] = 0;
 		flits_sent[j] = 0;
 		flits_received[j] = 0;
 		broadcasts[j] = 0;
 	}	
 
+	for(i=1,n=1;i<argc;i++){
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			ckpt_file = argv[++i];
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			restore = argv[++i];
+		else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+			prof_interval = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc){
+			i++;
+			if (strcmp(argv[i], "xy") == 0)
+				routing_algorithm = XY;
+			else if (strcmp(argv[i], "wf") == 0)
+				routing_algorithm = WEST_FIRST;
+			else if (strcmp(argv[i], "oe") == 0)
+				routing_algorithm = ODD_EVEN;
+			else{
+				printf("\nUnknown routing %s (xy, wf or oe).\n", argv[i]);
+				return -1;
+			}
+		}else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc){
+			router_buffer_size = atoi(argv[++i]);
+			if (router_buffer_size < 1){
+				printf("\nInvalid buffer depth %s.\n", argv[i]);
+				return -1;
+			}
+		}else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc)
+			class_arbitration = atoi(argv[++i]) != 0;
+		else
+			argv[n++] = argv[i];
+	}
+	argc = n;
+
 	if(argc <= 1){
-		printf("\nUsage: mpsoc_sim [n_cycles] [frequency]");
+		printf("\nUsage: mpsoc_sim [n_cycles] [frequency] [threads] [-c checkpoint] [-r checkpoint] [-P interval]");
+		printf("\n                 [-R xy|wf|oe] [-B depth] [-Q 0|1]");
 		printf("\n         or");
-		printf("\n       mpsoc_sim [time unit] e.g. 1000 ns 10 us, 50 ms, 1 s");
+		printf("\n       mpsoc_sim [time unit] [threads] e.g. 1000 ns 10 us, 50 ms, 1 s");
+		printf("\n - threads is the number of host threads (1 by default), each one");
+		printf("\n   simulates a group of cores. results do not depend on it.");
+		printf("\n - -c saves the system to a checkpoint file when software writes to");
+		printf("\n   CHECKPOINT, -r restores it instead of loading object codes (the");
+		printf("\n   limit of cycles or time then counts from the checkpoint).");
+		printf("\n - -P samples the pc of each core every interval cycles, profiles are");
+		printf("\n   saved as /reports/profile0.txt, profile1.txt... (see hf_trace).");
+		printf("\n - -R selects the routing of the mesh: xy (default), wf (west first)");
+		printf("\n   or oe (odd even), the last two adaptive (packets may arrive out of");
+		printf("\n   order). -B sets the depth of the router buffers, in flits (%d by", NOC_BUFFER_SIZE);
+		printf("\n   default). -Q 0 turns off the precedence of packets of the real");
+		printf("\n   time class (PKT_PRIO on their header) on the routers.");
 		printf("\n - Object codes must be in /objects directory and named");
 		printf("\n   code0.bin, code1.bin, code2.bin...");
 		printf("\n   There must be between 1 and 128 object codes in this directory.");
@@ -1334,7 +2002,7 @@ int main(int argc,char *argv[]){
 		return 0;
 	}
 
-	if(argc == 3 && argv[2][0] != '\0'){
+	if((argc == 3 || argc == 4) && argv[2][0] != '\0'){
 		max_cycles = atoll(argv[1]+'\0');
 		if (argv[2][0] == 'c'){
 			sim_metric = 'c';
@@ -1361,21 +2029,62 @@ int main(int argc,char *argv[]){
 		return (-1);
 	}
 
-	for(j=0;j<MAX_N_CORES;j++){
-		in[j] = fopen(strcat(strcat(filename_string, itoa(j)),".bin"), "rb");
-		strcpy(filename_string, "./objects/code\0\0\0\0\0\0\0\0\0\0\0");
-		if (in[j] == NULL){
-			if (j == 0){
-				printf("\nCould not find at least one object file in ./objects/");
-				printf("\nFiles must be named code0.bin, code1.bin, code2.bin... in sequence\n");
-				fflush(stdout);
+	ckpt_config[1] = router_buffer_size;
+	ckpt_config[7] = routing_algorithm;
+	load_architecture();
+	map_init();
 
-				return(-1);
-			}else{
-				n_cores = j;
-				break;
+	clock = reference_clock;
+	if (restore){
+		if (checkpoint_restore(s, restore)){
+			printf("\nCould not restore the checkpoint %s (missing, or from another build).\n", restore);
+			fflush(stdout);
+
+			return(-1);
+		}
+		// the limit counts from the checkpoint, with the clock set by the software
+		if (sim_metric != 'c' && reference_clock != clock)
+			max_cycles = (double)max_cycles * reference_clock / clock;
+		max_cycles += start_cycles;
+		printf("\nRestored %d cores at cycle %lld", n_cores, start_cycles);
+		fflush(stdout);
+	}else{
+		for(j=0;j<MAX_N_CORES;j++){
+			in[j] = fopen(strcat(strcat(filename_string, itoa(j)),".bin"), "rb");
+			strcpy(filename_string, "./objects/code\0\0\0\0\0\0\0\0\0\0\0");
+			if (in[j] == NULL){
+				if (j == 0){
+					printf("\nCould not find at least one object file in ./objects/");
+					printf("\nFiles must be named code0.bin, code1.bin, code2.bin... in sequence\n");
+					fflush(stdout);
+
+					return(-1);
+				}else{
+					n_cores = j;
+					break;
+				}
 			}
 		}
+
+		for(j=0;j<n_cores;j++){
+			bytes = fread(&SRAM[j*MEM_SIZE], 1, MEM_SIZE, in[j]);
+			fclose(in[j]);
+		}
+
+		for(j=n_cores;j<MAX_N_CORES;j++)
+			brkpt[j] = 1;
+
+		for(j=0;j<n_cores;j++){
+			s[j]->pc = 0x0;
+			s[j]->irqStatus = 0;
+			s[j]->big_endian = 1;
+			s[j]->jump_or_branch = 0;
+			s[j]->no_execute_branch_delay_slot = 0;
+			s[j]->mem = &SRAM[j*MEM_SIZE];
+			index = mem_read(s[j], 4, 0, j);
+			if(index == 0x3c1c1000)
+				s[j]->pc = RAM_EXTERNAL_BASE;
+		}
 	}
 
 	for(j=0;j<n_cores;j++){
@@ -1389,26 +2098,6 @@ int main(int argc,char *argv[]){
 		}
 	}
 
-	for(j=0;j<n_cores;j++){
-		bytes = fread(&SRAM[j*MEM_SIZE], 1, MEM_SIZE, in[j]);
-		fclose(in[j]);
-	}
-
-	for(j=n_cores;j<MAX_N_CORES;j++)
-		brkpt[j] = 1;
-	
-	for(j=0;j<n_cores;j++){
-		s[j]->pc = 0x0;
-		s[j]->irqStatus = 0;
-		s[j]->big_endian = 1;
-		s[j]->jump_or_branch = 0;
-		s[j]->no_execute_branch_delay_slot = 0;
-		s[j]->mem = &SRAM[j*MEM_SIZE];
-		index = mem_read(s[j], 4, 0, j);
-		if(index == 0x3c1c1000)
-			s[j]->pc = RAM_EXTERNAL_BASE;
-	}
-	
 	for(j=0;j<n_cores;j++){
 		log_out[j] = fopen(strcat(strcat(logout_string, itoa(j)),".txt"), "wb");
 		out_out[j] = fopen(strcat(strcat(outout_string, itoa(j)),".txt"), "wb");
@@ -1428,14 +2117,35 @@ int main(int argc,char *argv[]){
  		}
 	}
 
-	load_architecture();	
-	
-	time = clock();
+	if(argc == 4){
+#ifndef BUS
+		n_threads = atoi(argv[3]);
+		if (n_threads < 1)
+			n_threads = 1;
+		if (n_threads > N_CORES)
+			n_threads = N_CORES;
+		if (n_threads > 1)
+			printf("\nSimulating on %d threads", n_threads);
+#else
+		printf("\nThe bus is simulated on a single thread");
+#endif
+		fflush(stdout);
+	}
+#ifndef BUS
+	if (ckpt_file && n_threads > 1){
+		printf("\nCheckpoints are taken by the sequential loop, simulating on a single thread");
+		fflush(stdout);
+		n_threads = 1;
+	}
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	
 	do_debug(s, std_out);
 
-	time = clock() - time;
-	printf("\nSimulation time: %ld.%.3lds\n", time/CLOCKS_PER_SEC,(time%CLOCKS_PER_SEC)*1000/CLOCKS_PER_SEC);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	time = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+	printf("\nSimulation time: %ld.%.3lds\n", time / 1000, time % 1000);
 
 	for(j=0;j<n_cores;j++){
 		fclose(std_out[j]);
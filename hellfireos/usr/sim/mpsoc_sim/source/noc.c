@@ -5,6 +5,13 @@
 #include <math.h>
 #include "noc.h"
 
+int routing_algorithm = XY;			// XY, WEST_FIRST or ODD_EVEN
+int router_buffer_size = NOC_BUFFER_SIZE;	// flits per router input
+int class_arbitration = 1;			// packets of the real time class served first
+Router *routers;
+NetworkInterface *network_interfaces;
+Core *cores;
+
 /*
 
 
@@ -52,11 +59,54 @@ Flit take(Buffer* buffer)
 	return i;
 }
 
+/* length (in flits) of the packet at the head of a buffer if it is all there, 0 otherwise.
+   the second flit of a packet (payload) is the number of flits after it */
+int packetReady(Buffer* buffer)
+{
+	int len;
+
+	if( buffer->size < 2 )
+		return 0;
+	len = buffer->buffer[ (buffer->start + 1) % buffer->max ] + 2;
+	if( len > buffer->max )
+		len = buffer->max;
+
+	return buffer->size >= len ? len : 0;
+}
+
 void destroy(Buffer* buffer)
 {
 	free(buffer->buffer);
 }
 
+/*
+ * idle input of a router holding the header of a packet of the real time class, the first one
+ * from the arbiter on (so these are served round robin too), or -1. a packet behind another
+ * one on the same buffer still waits for it, and a connection is never preempted: a real time
+ * packet waits for a bulk packet at most on each output it takes.
+ */
+static int priorityInput(Router *router)
+{
+	int i, j;
+	Buffer *buffer;
+
+	if( ! class_arbitration )
+	{
+		return -1;
+	}
+	for( j = 0 ; j < ROUTERSIZE ; j++ )
+	{
+		i = ( router->arbiter + j ) % ROUTERSIZE;
+		buffer = getBuffer(router, i);
+		if( router->status[i] == IDLE && ! isEmpty(buffer) && ( read(buffer) & HEADER_PRIO ) )
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
 /*
 
 
@@ -143,6 +193,7 @@ void load_architecture()
 		//router
 		router = getRouter(i);
 		router->arbiter = 0;
+		router->cycles = 0;
 		//network interface
 		network_interface = getNetworkInterface(i);
 		create(getBuffer(network_interface, NOC), NI_BUFFER_LENGTH);
@@ -154,10 +205,12 @@ void load_architecture()
 		{
 			//router
 			router->packets_remaining[k] = 0;
+			router->link_flits[k] = 0;
+			router->link_busy[k] = 0;
 			router->status[k] = IDLE;
 			router->redirect_to[k] = NONE;
 			router->routing_delay[k] = NONE;
-			create(getBuffer(router, k), NOC_BUFFER_SIZE);
+			create(getBuffer(router, k), router_buffer_size);
 			//ports
 			cleanPort(&(router->ports[k]));
 			if( k <= 1 )
@@ -179,14 +232,17 @@ void load_architecture()
 	cores = (Core*) malloc(sizeof(Core)*N_CORES);
 	router = getRouter(i);
 	router->arbiter = 0;
+	router->cycles = 0;
 	for( k = 0 ; k < ROUTERSIZE ; k++ )
 	{
 		//router
 		router->packets_remaining[k] = 0;
+		router->link_flits[k] = 0;
+		router->link_busy[k] = 0;
 		router->status[k] = IDLE;
 		router->redirect_to[k] = NONE;
 		router->routing_delay[k] = NONE;
-		create(getBuffer(router, k), NOC_BUFFER_SIZE);
+		create(getBuffer(router, k), router_buffer_size);
 		//ports
 		cleanPort(&(router->ports[k]));
 	}
@@ -208,6 +264,111 @@ void load_architecture()
 #endif
 
 #ifndef BUS
+static void nextArbiter(int n, Router *router);
+
+/*
+
+
+	ROUTING
+
+
+*/
+
+/* output port of the router taken by an input other than i */
+static int outputInUse(Router *router, int i, int port)
+{
+	int j;
+
+	for( j = 0 ; j < 5 ; j++ )
+	{
+		if( j != i && router->status[j] != IDLE && router->redirect_to[j] == port )
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * output port of router n for a packet on input i, towards core dest. XY goes to the
+ * column of the destination first (east or west), then to its line. west first and odd
+ * even are minimal adaptive routings, deadlock free by the turns they leave out: west
+ * first sends packets going west only to the west, odd even has no east to north/south
+ * turn on even columns and no north/south to west turn on odd columns (Chiu's rules,
+ * with the input port telling the turn). of the (up to two) ports allowed, the first
+ * one free is taken, east or west first, as XY would. packets between two cores may
+ * then arrive out of order (the driver fails messages longer than a packet with
+ * ERR_SEQ_ERROR). only the state of this router is used, so results do not depend on
+ * the order routers cycle in. returns NONE if the ports are all in use.
+ */
+static int route(int n, int i, int dest, Router *router)
+{
+	int c, dc, dl, h, v, h_ok, v_ok, first, second;
+
+	c = GET_COLUMN(n);
+	dc = GET_COLUMN(dest) - c;
+	dl = GET_LINE(dest) - GET_LINE(n);
+	h = dc > 0 ? EAST : WEST;
+	v = dl > 0 ? NORTH : SOUTH;
+
+	if( dc == 0 && dl == 0 )
+	{
+		return outputInUse(router, i, LOCAL) ? NONE : LOCAL;
+	}
+
+	if( routing_algorithm == WEST_FIRST )
+	{
+		h_ok = dc != 0;
+		v_ok = dl != 0 && dc >= 0;
+	}
+	else if( routing_algorithm == ODD_EVEN )
+	{
+		if( dc == 0 )
+		{
+			h_ok = 0;
+			v_ok = 1;
+		}
+		else if( dc > 0 )
+		{
+			h_ok = dl == 0 || dc != 1 || GET_COLUMN(dest) % 2 == 1;
+			v_ok = dl != 0 && ( c % 2 == 1 || i != WEST );
+		}
+		else
+		{
+			h_ok = 1;
+			v_ok = dl != 0 && c % 2 == 0;
+		}
+	}
+	else
+	{
+		h_ok = dc != 0;
+		v_ok = dc == 0;
+	}
+
+	if( h_ok )
+	{
+		first = h;
+		second = v_ok ? v : NONE;
+	}
+	else
+	{
+		first = v;
+		second = h_ok ? h : NONE;
+	}
+
+	if( ! outputInUse(router, i, first) )
+	{
+		return first;
+	}
+	if( second != NONE && ! outputInUse(router, i, second) )
+	{
+		return second;
+	}
+
+	return NONE;
+}
+
 void cycleRouter(int n)
 {
 	unsigned char in_use = 0, active = 0;
@@ -218,6 +379,7 @@ void cycleRouter(int n)
 	Buffer *buffer;
 	Port *port_source, *port_dest;
 
+	router->cycles++;
 	for( i = 0 ; i < 5 ; i++ )
 	{
 		if( router->ports[i].in_request == ON )
@@ -243,6 +405,21 @@ void cycleRouter(int n)
 		}
 	}
 
+	// a real time packet is routed first. if its output is taken, the arbiter input may
+	// still get another output
+	if( active == 0 && ( i = priorityInput(router) ) >= 0 )
+	{
+		header = (long long int) ( read(getBuffer(router, i)) & ~HEADER_PRIO );
+		dest = route(n, i, headerToDecimal(header), router);
+		if( dest != NONE )
+		{
+			router->redirect_to[i] = dest;
+			router->status[i] = ROUTING_DELAY;
+			router->routing_delay[i] = ROUTING_ALGORITHM_DELAY;
+			active = 1;
+		}
+	}
+
 	if( router->status[ router->arbiter ] == IDLE && active == 0 )
 	{        
 		buffer = getBuffer(router, router->arbiter);
@@ -251,41 +428,10 @@ void cycleRouter(int n)
 			i = router->arbiter;
 			port_source = getPort(router, i);
 			flit = read(buffer);
-			header = (long long int) flit;
+			header = (long long int) ( flit & ~HEADER_PRIO );
 			header = headerToDecimal(header);
-		    
-			if( GET_LINE(n) == GET_LINE(header) && GET_COLUMN(n) == GET_COLUMN(header) )
-			{
-				dest = LOCAL;
-			}
-			else if( GET_COLUMN(n) < GET_COLUMN(header) )
-			{
-				dest = EAST;
-			}
-			else if( GET_COLUMN(n) > GET_COLUMN(header) )
-			{
-				dest = WEST;
-			}
-			else if( GET_LINE(n) > GET_LINE(header) )
-			{
-				dest = SOUTH;
-			}
-		    	else if( GET_LINE(n) < GET_LINE(header) )
-			{
-				dest = NORTH;
-			}
-			
-			in_use = 0;
-			for( j = 0 ; j < 5 ; j++ )
-			{
-				if( j != i )
-				{
-					if( router->status[j] != IDLE && router->redirect_to[j] == dest )
-					{
-			        		in_use = 1;
-			        	}
-				}
-			}
+			dest = route(n, i, header, router);
+			in_use = dest == NONE;
 
 			if( ! in_use )
 			{
@@ -304,6 +450,7 @@ void cycleRouter(int n)
 		{
 			buffer = getBuffer(router, i);
 			port_dest = getPort(router, router->redirect_to[i]);
+			router->link_busy[router->redirect_to[i]]++;
 			if( router->status[i] == ROUTING_DELAY )
 			{
 				if( router->routing_delay[i]-- <= 0 )
@@ -315,6 +462,7 @@ void cycleRouter(int n)
 						port_dest->out_request = ON;
 						port_dest->out_ack = OFF;
 						router->status[i] = ROUTING_HEADER;
+						router->link_flits[router->redirect_to[i]]++;
 						//printf("\n\tROUTER %d HEADER %d", n, flit);
 					}
 				}
@@ -330,6 +478,7 @@ void cycleRouter(int n)
 						port_dest->out_ack = OFF;
 						port_dest->out = flit;
 						router->packets_remaining[i] = (long long int) flit;
+						router->link_flits[router->redirect_to[i]]++;
 						router->status[i] = ROUTING_PAYLOAD;
 						//printf("\n\tROUTER %d PAYLOAD %d", n, flit);
 					}
@@ -359,6 +508,7 @@ void cycleRouter(int n)
 								port_dest->out_ack = OFF;
 								port_dest->out = flit;
 									router->packets_remaining[i]--;
+									router->link_flits[router->redirect_to[i]]++;
 							}
 						}
 					}        
@@ -367,8 +517,15 @@ void cycleRouter(int n)
 		}
 	}   
     
-	router->arbiter = ++router->arbiter % 5;
+	nextArbiter(n, router);
+}
 
+/* round robin to the next router input, skipping ports on the border of the mesh */
+static void nextArbiter(int n, Router *router)
+{
+	int l, c;
+
+	router->arbiter = ++router->arbiter % 5;
 
 	if( ARBITRATION_CONSIDERING_POS == 1 )
 	{
@@ -448,6 +605,41 @@ void cycleRouter(int n)
 		}
 	}
 }
+
+/* no packet on the router: buffers empty, no connection and no request on its ports */
+int idleRouter(int n)
+{
+	int i;
+	Router *router = getRouter(n);
+
+	for( i = 0 ; i < 5 ; i++ )
+	{
+		if( router->status[i] != IDLE || ! isEmpty(getBuffer(router, i)) || router->ports[i].in_request == ON || router->ports[i].out_request == ON )
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * cycles of an idle router, which only moves its arbiter. the arbiter follows a function
+ * of 5 states, so after 5 steps it is on a cycle of length 1 to 5, and 60 more steps get
+ * back to the same state.
+ */
+void skipRouter(int n, unsigned long long cycles)
+{
+	Router *router = getRouter(n);
+	unsigned long long i, steps;
+
+	router->cycles += cycles;
+	steps = cycles < 5 ? cycles : 5 + (cycles - 5) % 60;
+	for( i = 0 ; i < steps ; i++ )
+	{
+		nextArbiter(n, router);
+	}
+}
 #else
 void cycleRouter(int n)
 {
@@ -459,6 +651,7 @@ void cycleRouter(int n)
 	Buffer *buffer;
 	Port *port_source, *port_dest;
 
+	router->cycles++;
 	for( i = 0 ; i < ROUTERSIZE ; i++ )
 	{
 		if( router->ports[i].in_request == ON )
@@ -483,13 +676,17 @@ void cycleRouter(int n)
 
 	if( router->status[ router->arbiter ] == IDLE && active == 0 )
 	{        
-		buffer = getBuffer(router, router->arbiter);
-		if( ! isEmpty(buffer) )
+		i = priorityInput(router);
+		if( i < 0 )
 		{
 			i = router->arbiter;
+		}
+		buffer = getBuffer(router, i);
+		if( ! isEmpty(buffer) )
+		{
 			port_source = getPort(router, i);
 			flit = read(buffer);
-			header = (long long int) flit;	
+			header = (long long int) ( flit & ~HEADER_PRIO );
 				    
 			dest = header;		
 						
@@ -507,6 +704,7 @@ void cycleRouter(int n)
 		{
 			buffer = getBuffer(router, i);
 			port_dest = getPort(router, router->redirect_to[i]);
+			router->link_busy[router->redirect_to[i]]++;
 			if( router->status[i] == ROUTING_DELAY )
 			{
 				if( router->routing_delay[i]-- <= 0 )
@@ -518,6 +716,7 @@ void cycleRouter(int n)
 						port_dest->out_request = ON;
 						port_dest->out_ack = OFF;
 						router->status[i] = ROUTING_HEADER;
+						router->link_flits[router->redirect_to[i]]++;
 //						printf("\n\tROUTER %d HEADER %d", n, flit);
 					}
 				}
@@ -533,6 +732,7 @@ void cycleRouter(int n)
 						port_dest->out_ack = OFF;
 						port_dest->out = flit;
 						router->packets_remaining[i] = (long long int) flit;
+						router->link_flits[router->redirect_to[i]]++;
 						router->status[i] = ROUTING_PAYLOAD;
 //						printf("\n\tROUTER %d PAYLOAD %d", n, flit);
 					}
@@ -562,6 +762,7 @@ void cycleRouter(int n)
 								port_dest->out_ack = OFF;
 								port_dest->out = flit;
 								router->packets_remaining[i]--;
+								router->link_flits[router->redirect_to[i]]++;
 							}
 						}
 					}        
@@ -658,6 +859,24 @@ void cycleNetworkInterface(int n)
 	}       
 }
 
+/* no flit on the network interface, or on the ports to its router and core */
+int idleNetworkInterface(int n)
+{
+	NetworkInterface *ni = getNetworkInterface(n);
+	Port *port = &(getCore(n)->port);
+	int i;
+
+	for( i = 0 ; i < 2 ; i++ )
+	{
+		if( ! isEmpty(getBuffer(ni, i)) || ni->ports[i].in_request == ON || ni->ports[i].out_request == ON )
+		{
+			return 0;
+		}
+	}
+
+	return port->in_request == OFF && port->out_request == OFF;
+}
+
 void synchronizePorts(Port *p1, Port *p2)
 {
 	if( p1->out_request == ON && p2->in_ack == OFF && p1->out_ack == OFF )
@@ -675,24 +894,39 @@ void synchronizePorts(Port *p1, Port *p2)
 }
 
 #ifndef BUS
-void synchronizeRouter(int n)
+/* local port of a router, towards its network interface (or core) */
+void synchronizeRouterLocal(int n)
+{
+	Router *router = getRouter(n);
+	Port *p1, *p2;
+
+	p1 = &(router->ports[LOCAL]);
+	if( NI_BUFFER_LENGTH != 0 )
+	{
+		p2 = getPort(getNetworkInterface(n), NOC);
+	}
+	else
+	{
+		p2 = &(getCore(n)->port);
+	}
+	synchronizePorts(p1, p2);
+}
+
+/*
+ * links from a router to its neighbours. each call only drives the direction leaving
+ * router n (out fields of its ports, in fields of the neighbour ports), so the links of
+ * different routers can be synchronized in any order, or in parallel. only cycleRouter()
+ * changes the ports of a link, so between two router cycles every call after the first
+ * is a no op.
+ */
+void synchronizeRouterLinks(int n)
 {
 	int l, c;
 	Router *router = getRouter(n);
 	Router *aux;
-	NetworkInterface *ni;
-	Core *core;
 	Port *p1, *p2;
 	char flags[4];
-	
-    	if( NI_BUFFER_LENGTH != 0 )
-    	{
-		ni = getNetworkInterface(n);
-    	}
-    	else
-	{
-	    	core = getCore(n);
-    	}
+
 	l = GET_LINE(n);
 	c = GET_COLUMN(n);
     	flags[0] = flags[1] = flags[2] = flags[3] = OFF;
@@ -725,17 +959,6 @@ void synchronizeRouter(int n)
 	    	flags[NORTH] = ON;
 	}
 
-	p1 = &(router->ports[LOCAL]);
-	if( NI_BUFFER_LENGTH != 0 )
-	{
-        	p2 = getPort(ni, NOC);
-    	}
-	else
-	{
-        	p2 = &(core->port);
-    	}
-    	synchronizePorts(p1, p2);
-	
 	if( flags[SOUTH] )
 	{
 		aux = getRouter(n-NOC_WIDTH);
@@ -765,6 +988,12 @@ void synchronizeRouter(int n)
 		synchronizePorts(p1, p2);
 	}
 }
+
+void synchronizeRouter(int n)
+{
+	synchronizeRouterLocal(n);
+	synchronizeRouterLinks(n);
+}
 #else
 void synchronizeRouter(int n)
 {
@@ -876,3 +1105,113 @@ void synchronizeCore(int n)
 }
 #endif
 
+/* per router link utilization: flits sent on each output port, and the share of router
+ * cycles the port carried a flit (util) or was allocated to a packet (busy) */
+void report_links(FILE *out)
+{
+	int i, k;
+	Router *router;
+#ifndef BUS
+	const char *names[ROUTERSIZE] = {"east", "west", "north", "south", "local"};
+
+	for( i = 0 ; i < N_CORES ; i++ )
+	{
+		router = getRouter(i);
+		fprintf(out, "\n    router %d (%d,%d):", i, GET_COLUMN(i), GET_LINE(i));
+		for( k = 0 ; k < ROUTERSIZE && router->cycles ; k++ )
+		{
+			fprintf(out, "\n        %-5s flits: %10lld util: %6.2f%% busy: %6.2f%%", names[k], router->link_flits[k],
+				100.0 * router->link_flits[k] / router->cycles, 100.0 * router->link_busy[k] / router->cycles);
+		}
+	}
+#else
+	router = getRouter(0);
+	fprintf(out, "\n    bus:");
+	for( k = 0 ; k < ROUTERSIZE && router->cycles ; k++ )
+	{
+		fprintf(out, "\n        core %-3d flits: %10lld util: %6.2f%% busy: %6.2f%%", k, router->link_flits[k],
+			100.0 * router->link_flits[k] / router->cycles, 100.0 * router->link_busy[k] / router->cycles);
+	}
+#endif
+}
+
+/*
+
+
+	CHECKPOINTS
+
+
+*/
+
+#ifndef BUS
+	#define N_ROUTERS			N_CORES
+#else
+	#define N_ROUTERS			1
+#endif
+
+/* routers, network interfaces and core ports, then the contents of every buffer */
+void save_architecture(FILE *out)
+{
+	int i, k;
+	Router *router;
+	NetworkInterface *network_interface;
+
+	fwrite(routers, sizeof(Router), N_ROUTERS, out);
+	fwrite(network_interfaces, sizeof(NetworkInterface), N_CORES, out);
+	fwrite(cores, sizeof(Core), N_CORES, out);
+	for( i = 0 ; i < N_ROUTERS ; i++ )
+	{
+		router = getRouter(i);
+		for( k = 0 ; k < ROUTERSIZE ; k++ )
+			fwrite(router->buffers[k].buffer, sizeof(Flit), router->buffers[k].max, out);
+	}
+	for( i = 0 ; i < N_CORES ; i++ )
+	{
+		network_interface = getNetworkInterface(i);
+		for( k = 0 ; k < 2 ; k++ )
+			fwrite(network_interface->buffers[k].buffer, sizeof(Flit), network_interface->buffers[k].max, out);
+	}
+}
+
+/* on a loaded architecture, buffers keep their memory. returns 0 on success */
+int restore_architecture(FILE *in)
+{
+	int i, k, ok = 1;
+	Router router;
+	NetworkInterface network_interface;
+	Buffer *buffer;
+
+	for( i = 0 ; i < N_ROUTERS ; i++ )
+	{
+		ok &= fread(&router, sizeof(Router), 1, in) == 1;
+		for( k = 0 ; k < ROUTERSIZE ; k++ )
+			router.buffers[k].buffer = getRouter(i)->buffers[k].buffer;
+		*getRouter(i) = router;
+	}
+	for( i = 0 ; i < N_CORES ; i++ )
+	{
+		ok &= fread(&network_interface, sizeof(NetworkInterface), 1, in) == 1;
+		for( k = 0 ; k < 2 ; k++ )
+			network_interface.buffers[k].buffer = getNetworkInterface(i)->buffers[k].buffer;
+		*getNetworkInterface(i) = network_interface;
+	}
+	ok &= fread(cores, sizeof(Core), N_CORES, in) == N_CORES;
+	for( i = 0 ; i < N_ROUTERS ; i++ )
+	{
+		for( k = 0 ; k < ROUTERSIZE ; k++ )
+		{
+			buffer = getBuffer(getRouter(i), k);
+			ok &= fread(buffer->buffer, sizeof(Flit), buffer->max, in) == buffer->max;
+		}
+	}
+	for( i = 0 ; i < N_CORES ; i++ )
+	{
+		for( k = 0 ; k < 2 ; k++ )
+		{
+			buffer = getBuffer(getNetworkInterface(i), k);
+			ok &= fread(buffer->buffer, sizeof(Flit), buffer->max, in) == buffer->max;
+		}
+	}
+
+	return ok ? 0 : -1;
+}
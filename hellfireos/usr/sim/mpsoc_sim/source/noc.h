@@ -16,9 +16,27 @@ typedef unsigned short int Flit;
 	#define SIMULTANEOUS_SWITCHING		1
 #endif
 
+//HEADER FORMAT (column and line fields, as in the driver: 8 bits for meshes larger than 16x16)
+#ifndef NOC_ADDR_BITS
+	#if NOC_WIDTH > 16 || NOC_HEIGHT > 16
+		#define NOC_ADDR_BITS		8
+	#else
+		#define NOC_ADDR_BITS		4
+	#endif
+#endif
+#define NOC_ADDR_MASK			((1 << NOC_ADDR_BITS) - 1)
+
+//TRAFFIC CLASSES (top bit of the header, as PKT_PRIO in the driver: real time class)
+#define HEADER_PRIO			0x8000
+
+//ROUTING ALGORITHMS
+#define XY				0
+#define WEST_FIRST			1
+#define ODD_EVEN			2
+
 //USEFUL MACROS
-#define headerToDecimal(X)		( ( ((unsigned int) X) & 0x0f )*NOC_WIDTH + ( (unsigned int) ((unsigned int) X & 0xf0)>>4 )  )
-#define decimalToHeader(X)		( GET_COLUMN(X)<<4 | GET_LINE(X) ) 
+#define headerToDecimal(X)		( ( ((unsigned int) X) & NOC_ADDR_MASK )*NOC_WIDTH + ( ((unsigned int) X >> NOC_ADDR_BITS) & NOC_ADDR_MASK ) )
+#define decimalToHeader(X)		( GET_COLUMN(X)<<NOC_ADDR_BITS | GET_LINE(X) ) 
 #define GET_LINE(n)			((int) n / NOC_WIDTH)
 #define GET_COLUMN(n)			((int) n % NOC_WIDTH)
 #define getRouter(n)			(&routers[ n ])
@@ -82,6 +100,9 @@ typedef struct {
 	int				routing_delay[ROUTERSIZE];
 	Buffer				buffers[ROUTERSIZE];
 	Port				ports[ROUTERSIZE];
+	unsigned long long		cycles;			// router cycles
+	unsigned long long		link_flits[ROUTERSIZE];	// flits sent on each output port
+	unsigned long long		link_busy[ROUTERSIZE];	// cycles each output port was allocated
 } Router;
 
 int teste(int i);
@@ -93,6 +114,7 @@ int isEmpty(Buffer* buffer);
 void put(Buffer* buffer, Flit value);
 Flit read(Buffer* buffer);
 Flit take(Buffer* buffer);
+int packetReady(Buffer* buffer);
 void destroy(Buffer* buffer);
 
 // IMPORTANT FUNCTIONS FOR SIMULATION
@@ -103,10 +125,21 @@ void cycleRouter(int n);
 void cycleNetworkInterface(int n);
 void synchronizePorts(Port *p1, Port *p2);
 void synchronizeRouter(int n);
+void synchronizeRouterLocal(int n);
+void synchronizeRouterLinks(int n);
 void synchronizeNetworkInterface(int n);
 void synchronizeCore(int n);
+void report_links(FILE *out);
+int idleRouter(int n);
+int idleNetworkInterface(int n);
+void skipRouter(int n, unsigned long long cycles);
+void save_architecture(FILE *out);
+int restore_architecture(FILE *in);
 
 // GLOBAL VARS
-Router *routers;
-NetworkInterface *network_interfaces;
-Core *cores;
+extern int routing_algorithm;
+extern int router_buffer_size;
+extern int class_arbitration;
+extern Router *routers;
+extern NetworkInterface *network_interfaces;
+extern Core *cores;